@@ -1264,6 +1264,7 @@ m4_include([m4/secure_getenv.m4])
 m4_include([m4/select.m4])
 m4_include([m4/setenv.m4])
 m4_include([m4/setlocale.m4])
+m4_include([m4/sha256.m4])
 m4_include([m4/sigaction.m4])
 m4_include([m4/signal_h.m4])
 m4_include([m4/signalblocking.m4])
@@ -19,15 +19,31 @@
 #include <config.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include "cmpbuf.h"
 #include "intprops.h"
 
+/* Physical extents are found with the FIEMAP ioctl, which Linux has.  */
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+# include <linux/fiemap.h>
+#endif
+#ifdef FS_IOC_FIEMAP
+# define HAVE_FIEMAP 1
+#else
+# define HAVE_FIEMAP 0
+#endif
+
 #ifndef SSIZE_MAX
 # define SSIZE_MAX TYPE_MAXIMUM (ssize_t)
 #endif
@@ -35,6 +51,14 @@
 #undef MIN
 #define MIN(a, b) ((a) <= (b) ? (a) : (b))
 
+/* The size that buffer_grow grows buffers to.  Much larger buffers
+   no longer fit in the processor's caches, which makes comparing them
+   slower than the system calls they save.  Build with
+   -DBUFFER_GROWTH_MAX=BYTES to tune this.  */
+#ifndef BUFFER_GROWTH_MAX
+# define BUFFER_GROWTH_MAX (256 * 1024)
+#endif
+
 /* Read NBYTES bytes from descriptor FD into BUF.
    NBYTES must not be SIZE_MAX.
    Return the number of characters successfully read.
@@ -90,6 +114,349 @@ block_read (int fd, char *buf, size_t nbytes)
   return bp - buf;/*返回读取到的实际长度*/
 }
 
+/* Read NBYTES bytes at offset OFFSET of descriptor FD into BUF,
+   without using or changing the file offset.  Return what block_read
+   would.  */
+
+size_t
+block_pread (int fd, char *buf, size_t nbytes, off_t offset)
+{
+  char *bp = buf;
+  char const *buflim = buf + nbytes;
+  size_t readlim = MIN (SSIZE_MAX, SIZE_MAX);
+
+  do
+    {
+      size_t bytes_remaining = buflim - bp;
+      size_t bytes_to_read = MIN (bytes_remaining, readlim);
+      ssize_t nread = pread (fd, bp, bytes_to_read, offset + (bp - buf));
+      if (nread <= 0)
+	{
+	  if (nread == 0)
+	    break;
+	  if (errno == EINVAL && INT_MAX < bytes_to_read)
+	    {
+	      readlim = INT_MAX;
+	      continue;
+	    }
+	  if (! SA_RESTART && errno == EINTR)
+	    continue;
+	  return SIZE_MAX;
+	}
+      bp += nread;
+    }
+  while (bp < buflim);
+
+  return bp - buf;
+}
+
+/* Ask the system to read the regular file open on FD directly into
+   the reader's buffers, bypassing its cache, and return the alignment
+   that the buffers, offsets and sizes of the reads then need; or
+   return 0 if the system cannot, in which case the reader should ask
+   it to discard the data instead, with read_advice_direct.  */
+
+size_t
+direct_io_start (int fd)
+{
+#if O_DIRECT
+  int flags = fcntl (fd, F_GETFL);
+  if (0 <= flags
+      && ((flags & O_DIRECT)
+	  || fcntl (fd, F_SETFL, flags | O_DIRECT) == 0))
+    return getpagesize ();
+#endif
+  return 0;
+}
+
+/* Stop reading the file open on FD directly, after direct_io_start.  */
+
+void
+direct_io_stop (int fd)
+{
+#if O_DIRECT
+  int flags = fcntl (fd, F_GETFL);
+  if (0 <= flags && (flags & O_DIRECT))
+    fcntl (fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+}
+
+/* Read as block_pread does, but if *DIRECT, the file open on FD is
+   being read directly and a read that the system rejects as
+   misaligned, such as one at the end of a limit on the bytes
+   compared, is done again through the cache after clearing *DIRECT.  */
+
+size_t
+direct_pread (int fd, char *buf, size_t nbytes, off_t offset, bool *direct)
+{
+  size_t r = block_pread (fd, buf, nbytes, offset);
+  if (r == SIZE_MAX && errno == EINVAL && *direct)
+    {
+      *direct = false;
+      direct_io_stop (fd);
+      r = block_pread (fd, buf, nbytes, offset);
+    }
+  return r;
+}
+
+/* Number of bytes to ask the system to read ahead of a sequential reader,
+   and to discard behind it, at a time.  */
+enum { READ_ADVICE_STRIDE = 1024 * 1024 };
+
+/* Initialize RA for sequential reads from the file open on FD, which
+   are to start at the current file offset.  REGULAR_SIZE is the size
+   of the file if it is a regular file, and negative otherwise; no
+   advice is given for other files.  If DISCARD, the data will not be
+   read again, so ask the system to discard it once it has been read
+   if the file is large.  Advice is only a hint, so ignore failures.  */
+
+void
+read_advice_init (struct read_advice *ra, int fd, off_t regular_size,
+		  bool discard)
+{
+  ra->fd = -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (0 <= regular_size)
+    {
+      off_t pos = lseek (fd, 0, SEEK_CUR);
+      if (0 <= pos)
+	{
+	  ra->fd = fd;
+	  ra->pos = ra->ahead = ra->behind = pos;
+	  ra->direct = NULL;
+	  ra->discard = (discard
+			 && READ_ADVICE_DISCARD_MINIMUM <= regular_size);
+	  posix_fadvise (fd, pos, 0, POSIX_FADV_SEQUENTIAL);
+	}
+    }
+#endif
+}
+
+/* Record in RA that NREAD more bytes have been read, and keep the
+   system reading ahead of the reader, asking it a stride at a time
+   so as not to issue a system call per read.  */
+
+void
+read_advice_update (struct read_advice *ra, size_t nread)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (ra->fd < 0)
+    return;
+
+  ra->pos += nread;
+
+  if (ra->direct && *ra->direct)
+    {
+      ra->ahead = ra->behind = ra->pos;
+      return;
+    }
+
+  if (ra->ahead - READ_ADVICE_STRIDE / 2 <= ra->pos)
+    {
+      ra->ahead = ra->pos + READ_ADVICE_STRIDE;
+      posix_fadvise (ra->fd, ra->pos, READ_ADVICE_STRIDE,
+		     POSIX_FADV_WILLNEED);
+    }
+
+  if (ra->discard && ra->behind + READ_ADVICE_STRIDE <= ra->pos)
+    {
+      posix_fadvise (ra->fd, ra->behind, ra->pos - ra->behind,
+		     POSIX_FADV_DONTNEED);
+      ra->behind = ra->pos;
+    }
+#endif
+}
+
+/* Advise the system for the file RA is for as --direct-io needs:
+   while *DIRECT the file is read directly, so give no advice, and
+   once it is read through the cache, discard the data once it has
+   been read, whatever the file's size.  */
+
+void
+read_advice_direct (struct read_advice *ra, bool const *direct)
+{
+  ra->discard = true;
+  ra->direct = direct;
+}
+
+/* Initialize ES to scan the extents of the file open on FD, whose
+   status is *ST.  Only regular files are scanned.  Holes are looked
+   for only if the file has one at or after the current file offset,
+   so that scanning a file without holes costs no more than this call.  */
+
+void
+extent_scan_init (struct extent_scan *es, int fd, struct stat const *st)
+{
+  es->fd = -1;
+  if (fd < 0 || ! S_ISREG (st->st_mode))
+    return;
+
+  es->fd = fd;
+  es->dev = st->st_dev;
+  es->size = st->st_size;
+  es->holes = false;
+  es->fiemap = HAVE_FIEMAP;
+  es->extent_start = es->extent_end = 0;
+
+#ifdef SEEK_HOLE
+  {
+    off_t pos = lseek (fd, 0, SEEK_CUR);
+    if (0 <= pos && pos < es->size)
+      {
+	off_t hole = lseek (fd, pos, SEEK_HOLE);
+	if (lseek (fd, pos, SEEK_SET) == pos
+	    && pos <= hole && hole < es->size)
+	  {
+	    es->holes = true;
+	    es->hole_start = es->data_start = pos;
+	    es->data_end = hole;
+	  }
+      }
+  }
+#endif
+}
+
+/* Return the number of bytes in the hole at offset POS of the file
+   scanned by ES, or 0 if POS is not known to be in a hole.  Leave
+   the file offset as it was.  */
+
+static off_t
+hole_size (struct extent_scan *es, off_t pos)
+{
+#ifdef SEEK_HOLE
+  if (es->holes && ! (es->hole_start <= pos && pos < es->data_end)
+      && pos < es->size)
+    {
+      off_t cur = lseek (es->fd, 0, SEEK_CUR);
+      off_t data = lseek (es->fd, pos, SEEK_DATA);
+      off_t hole = data < 0 ? -1 : lseek (es->fd, data, SEEK_HOLE);
+      if (cur < 0 || lseek (es->fd, cur, SEEK_SET) != cur
+	  || (data < 0 && errno != ENXIO))
+	{
+	  /* Give up on finding holes, and read everything.  */
+	  es->holes = false;
+	  return 0;
+	}
+
+      /* If there is no data after POS, the rest of the file is a
+	 hole.  */
+      es->hole_start = pos;
+      es->data_start = data < 0 ? es->size : data;
+      es->data_end = hole < 0 ? es->size : hole;
+    }
+
+  if (es->holes && es->hole_start <= pos && pos < es->data_start)
+    return es->data_start - pos;
+#endif
+  return 0;
+}
+
+/* Return the number of bytes at offset POS of the file scanned by ES
+   that are in the same extent, setting *PHYSICAL to where the byte at
+   POS is stored.  Return 0 if this is not known.  */
+
+static off_t
+extent_size (struct extent_scan *es, off_t pos, uint64_t *physical)
+{
+#if HAVE_FIEMAP
+  if (es->fiemap && ! (es->extent_start <= pos && pos < es->extent_end)
+      && pos < es->size)
+    {
+      union
+      {
+	struct fiemap fm;
+	char buf[sizeof (struct fiemap) + sizeof (struct fiemap_extent)];
+      } u;
+      struct fiemap_extent const *fe = &u.fm.fm_extents[0];
+
+      /* Extents whose data is not simply stored where they say, or
+	 that are not stored yet, cannot be compared by location.
+	 FIEMAP_FLAG_SYNC writes out any data not stored yet.  */
+      enum { UNRELIABLE = (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC
+			   | FIEMAP_EXTENT_ENCODED
+			   | FIEMAP_EXTENT_DATA_ENCRYPTED
+			   | FIEMAP_EXTENT_NOT_ALIGNED
+			   | FIEMAP_EXTENT_DATA_INLINE
+			   | FIEMAP_EXTENT_DATA_TAIL
+			   | FIEMAP_EXTENT_UNWRITTEN) };
+
+      memset (&u, 0, sizeof u);
+      u.fm.fm_start = pos;
+      u.fm.fm_length = es->size - pos;
+      u.fm.fm_flags = FIEMAP_FLAG_SYNC;
+      u.fm.fm_extent_count = 1;
+      if (ioctl (es->fd, FS_IOC_FIEMAP, &u.fm) != 0)
+	{
+	  es->fiemap = false;
+	  return 0;
+	}
+
+      es->extent_start = pos;
+      es->physical_known = false;
+      if (u.fm.fm_mapped_extents == 0)
+	es->extent_end = es->size;
+      else if (pos < fe->fe_logical)
+	es->extent_end = fe->fe_logical;
+      else
+	{
+	  es->extent_start = fe->fe_logical;
+	  es->extent_end = fe->fe_logical + fe->fe_length;
+	  es->physical = fe->fe_physical;
+	  es->physical_known = ! (fe->fe_flags & UNRELIABLE);
+	}
+      if (es->extent_end <= pos)
+	{
+	  es->fiemap = false;
+	  return 0;
+	}
+    }
+
+  if (es->fiemap && es->physical_known
+      && es->extent_start <= pos && pos < es->extent_end)
+    {
+      *physical = es->physical + (pos - es->extent_start);
+      return MIN (es->extent_end, es->size) - pos;
+    }
+#endif
+  return 0;
+}
+
+/* Return the number of bytes at offsets POS0 and POS1 of the files
+   scanned by ES[0] and ES[1] that are known to be the same without
+   reading them, because they are holes in both files or are stored
+   in the same place.  Set *STORED to whether they are stored, and so
+   need not be null bytes.  */
+
+off_t
+same_extent_bytes (struct extent_scan es[2], off_t pos0, off_t pos1,
+		   bool *stored)
+{
+  off_t size;
+  uint64_t physical0, physical1;
+
+  *stored = false;
+  if (es[0].fd < 0 || es[1].fd < 0)
+    return 0;
+
+  size = hole_size (&es[0], pos0);
+  if (size)
+    return MIN (size, hole_size (&es[1], pos1));
+
+  if (es[0].dev != es[1].dev)
+    return 0;
+  size = extent_size (&es[0], pos0, &physical0);
+  if (size)
+    {
+      off_t size1 = extent_size (&es[1], pos1, &physical1);
+      if (size1 && physical0 == physical1)
+	{
+	  *stored = true;
+	  return MIN (size, size1);
+	}
+    }
+  return 0;
+}
+
 /* Least common multiple of two buffer sizes A and B.  However, if
    either A or B is zero, or if the multiple is greater than LCM_MAX,
    return a reasonable buffer size.  */
@@ -117,3 +484,103 @@ buffer_lcm (size_t a, size_t b, size_t lcm_max)
   lcm = q * b;
   return lcm <= lcm_max && lcm / b == q ? lcm : a;
 }
+
+/* Return the size to use for a buffer of SIZE bytes that has just
+   been filled while reading from regular files, so that a long run of
+   reads grows the buffer geometrically and makes fewer system calls,
+   but short comparisons do not pay for a large buffer.  The result
+   is a multiple of SIZE that is at most BUFFER_GROWTH_MAX and LIMIT,
+   unless SIZE itself is larger.  */
+
+size_t
+buffer_grow (size_t size, size_t limit)
+{
+  size_t max = MIN (BUFFER_GROWTH_MAX, limit);
+  return size <= max / 2 ? 2 * size : size;
+}
+
+/* Return the number of newlines in BUF, of size BUFSIZE, by searching
+   for each one.  This is fastest when newlines are sparse.  */
+
+static size_t _GL_ATTRIBUTE_PURE
+search_newlines (char const *buf, size_t bufsize)
+{
+  size_t count = 0;
+  char const *p;
+  char const *lim = buf + bufsize;
+  for (p = buf; (p = memchr (p, '\n', lim - p)); p++)
+    count++;
+  return count;
+}
+
+/* Return the number of newlines in the word-aligned BUF, of size
+   BUFSIZE, by examining a word at a time.  This is fastest when
+   newlines are dense.
+
+   XORing a word with newlines leaves a zero byte where each newline
+   was, and the high bit of each byte of NONZERO below says whether
+   the corresponding byte is nonzero.  The counts for each byte
+   position are summed in a word for up to NSUM words, few enough that
+   the total fits in a byte, and then the bytes of the sum are added by
+   multiplication.  */
+
+static size_t _GL_ATTRIBUTE_PURE
+sum_newlines (char const *buf, size_t bufsize)
+{
+  enum { NSUM = UCHAR_MAX / sizeof (size_t) };
+  size_t const ones = (size_t) -1 / UCHAR_MAX;
+  size_t const highs = ones << (CHAR_BIT - 1);
+  size_t const newlines = ones * '\n';
+  size_t const *wp = (size_t const *) buf;
+  size_t nwords = bufsize / sizeof (size_t);
+  size_t count = 0;
+
+  while (nwords)
+    {
+      size_t n = MIN (nwords, NSUM);
+      size_t sum = 0;
+      nwords -= n;
+      do
+	{
+	  size_t x = *wp++ ^ newlines;
+	  size_t nonzero = ((x & ~highs) + ~highs) | x;
+	  sum += (~nonzero & highs) >> (CHAR_BIT - 1);
+	}
+      while (--n);
+      count += sum * ones >> (sizeof (size_t) - 1) * CHAR_BIT;
+    }
+
+  return count + search_newlines ((char const *) wp,
+				  buf + bufsize - (char const *) wp);
+}
+
+/* Return the number of newlines in BUF, of size BUFSIZE.  Count a
+   chunk at a time, summing the newlines in a chunk if the previous
+   chunk had more than one newline per SPARSE_NEWLINES bytes and
+   searching for them otherwise; summing costs about as much as
+   searching at that density.  The bytes before the first word
+   boundary are searched.  */
+
+size_t
+count_newlines (char const *buf, size_t bufsize)
+{
+  enum { CHUNK = 4096, SPARSE_NEWLINES = 128 };
+  size_t head = MIN (bufsize, -(uintptr_t) buf % sizeof (size_t));
+  size_t count = search_newlines (buf, head);
+  bool dense = false;
+
+  buf += head;
+  bufsize -= head;
+
+  while (bufsize)
+    {
+      size_t n = MIN (bufsize, CHUNK);
+      size_t c = (dense ? sum_newlines : search_newlines) (buf, n);
+      dense = n / SPARSE_NEWLINES < c;
+      count += c;
+      buf += n;
+      bufsize -= n;
+    }
+
+  return count;
+}
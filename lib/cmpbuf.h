@@ -16,4 +16,59 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 size_t block_read (int, char *, size_t);
+size_t block_pread (int, char *, size_t, off_t);
+size_t direct_io_start (int);
+void direct_io_stop (int);
+size_t direct_pread (int, char *, size_t, off_t, bool *);
+
+/* Discard data only from files at least this large.  Smaller files
+   are likely to be read again soon, and do not crowd out much else.  */
+enum { READ_ADVICE_DISCARD_MINIMUM = 64 * 1024 * 1024 };
+
+/* The state of a file that is being read sequentially, for advising
+   the system about the reads; see read_advice_init.  */
+struct read_advice
+{
+  int fd;		/* File descriptor, or -1 to give no advice.  */
+  off_t pos;		/* Offset of the next byte to be read.  */
+  off_t ahead;		/* Offset through which read-ahead was requested.  */
+  off_t behind;		/* Offset before which data was discarded.  */
+  bool discard;		/* Whether to discard data once read.  */
+  bool const *direct;	/* If nonnull, whether the file is read directly.  */
+};
+
+void read_advice_init (struct read_advice *, int, off_t, bool);
+void read_advice_update (struct read_advice *, size_t);
+void read_advice_direct (struct read_advice *, bool const *);
+
+/* The state of a file whose extents are being scanned, so that
+   extents that two files have in common need not be read; see
+   extent_scan_init.  Each member describes what was last found.  */
+struct extent_scan
+{
+  int fd;		/* File descriptor, or -1 to scan nothing.  */
+  bool holes;		/* Whether to look for holes.  */
+  bool fiemap;		/* Whether to look for physical extents.  */
+  dev_t dev;		/* Device of the file.  */
+  off_t size;		/* Size of the file.  */
+
+  /* A hole starting at HOLE_START and followed by data from
+     DATA_START to DATA_END.  */
+  off_t hole_start;
+  off_t data_start;
+  off_t data_end;
+
+  /* The bytes from EXTENT_START to EXTENT_END, which are stored at
+     PHYSICAL if PHYSICAL_KNOWN.  */
+  off_t extent_start;
+  off_t extent_end;
+  uint64_t physical;
+  bool physical_known;
+};
+
+struct stat;
+void extent_scan_init (struct extent_scan *, int, struct stat const *);
+off_t same_extent_bytes (struct extent_scan[2], off_t, off_t, bool *);
 size_t buffer_lcm (size_t, size_t, size_t) _GL_ATTRIBUTE_CONST;
+size_t buffer_grow (size_t, size_t) _GL_ATTRIBUTE_CONST;
+size_t count_newlines (char const *, size_t) _GL_ATTRIBUTE_PURE;
@@ -48,8 +48,38 @@
      NOTE_INSERT(ctxt, yoff) Record the insertion of the object yvec[yoff].
      EARLY_ABORT(ctxt)       (Optional) A boolean expression that triggers an
                              early abort of the computation.
+     NOTE_DIAGONALS(ctxt, n) (Optional) Record that an edit step of the
+                             search extended n diagonals.
      USE_HEURISTIC           (Optional) Define if you want to support the
                              heuristic for large vectors.
+     GROW_DIAGONALS(ctxt, n) (Optional) Reallocate ctxt->fdiag and
+                             ctxt->bdiag to 2 * n + 3 elements each,
+                             keeping their contents, and return true; or
+                             return false if memory is short.  If this is
+                             defined, the vectors need room only for the
+                             diagonals that the search reaches, and grow
+                             as it widens.
+     SETTLED_ABORT(ctxt, xoff, yoff)
+                             (Optional) A boolean expression, evaluated
+                             when all of xvec before xoff and of yvec
+                             before yoff has been compared, that aborts
+                             the rest of the computation.  Subproblems
+                             are solved from the start of the vectors to
+                             their end, so xoff and yoff never decrease.
+     RUN_AHEAD(ctxt, xoff, yoff)
+                             (Optional) Given that xvec[xoff] equals
+                             yvec[yoff], the number of elements, at least
+                             1, from xoff and yoff on that are known to
+                             be equal pair by pair, as when both start
+                             runs of the same element.  Snakes then step
+                             over such runs at once.
+     RUN_BEHIND(ctxt, xoff, yoff)
+                             (Optional) Likewise, given that xvec[xoff - 1]
+                             equals yvec[yoff - 1], the number of elements
+                             before xoff and yoff known to be equal.
+     RUNS(ctxt)              (Required with RUN_AHEAD) A boolean expression,
+                             evaluated once a search, that tells whether
+                             to use RUN_AHEAD and RUN_BEHIND at all.
    It is also possible to use this file with abstract arrays.  In this case,
    xvec and yvec are not represented in memory.  They only exist conceptually.
    In this case, the list of defines above is amended as follows:
@@ -62,6 +92,8 @@
      #include <limits.h>
      #include <stdbool.h>
      #include "minmax.h"
+   and with GROW_DIAGONALS:
+     #include <string.h>
  */
 
 /* Maximum value of type OFFSET.  */
@@ -73,6 +105,32 @@
 # define EARLY_ABORT(ctxt) false
 #endif
 
+/* Default to comparing all of the vectors.  */
+#ifndef SETTLED_ABORT
+# define SETTLED_ABORT(ctxt, xoff, yoff) false
+#endif
+
+/* Default to following snakes one element at a time.  Otherwise step
+   over the runs that RUN_AHEAD and RUN_BEHIND report, but not past
+   the limits of the subproblem.  */
+#ifdef RUN_AHEAD
+# define SNAKE_AHEAD(runs, ctxt, x, y, xlim, ylim) \
+    (! (runs) ? 1 \
+     : MIN (RUN_AHEAD (ctxt, x, y), MIN ((xlim) - (x), (ylim) - (y))))
+# define SNAKE_BEHIND(runs, ctxt, x, y, xoff, yoff) \
+    (! (runs) ? 1 \
+     : MIN (RUN_BEHIND (ctxt, x, y), MIN ((x) - (xoff), (y) - (yoff))))
+#else
+# define RUNS(ctxt) false
+# define SNAKE_AHEAD(runs, ctxt, x, y, xlim, ylim) ((void) (runs), 1)
+# define SNAKE_BEHIND(runs, ctxt, x, y, xoff, yoff) ((void) (runs), 1)
+#endif
+
+/* Default to not counting the diagonals searched.  */
+#ifndef NOTE_DIAGONALS
+# define NOTE_DIAGONALS(ctxt, n) ((void) 0)
+#endif
+
 /* Use this to suppress gcc's "...may be used before initialized" warnings.
    Beware: The Code argument must not contain commas.  */
 #ifndef IF_LINT
@@ -116,6 +174,13 @@ struct context
      matrix.  */
   OFFSET *bdiag;
 
+  #ifdef GROW_DIAGONALS
+  /* With GROW_DIAGONALS, FDIAG and BDIAG instead have 2 * DIAG_ROOM + 3
+     elements each, for the diagonals within DIAG_ROOM + 1 of the center
+     diagonal of the forward and the backward search.  */
+  OFFSET diag_room;
+  #endif
+
   #ifdef USE_HEURISTIC
   /* This corresponds to the diff --speed-large-files flag.  With this
      heuristic, for vectors with a constant small density of changes,
@@ -123,6 +188,9 @@ struct context
   bool heuristic;
   #endif
 
+  /* Edit scripts longer than this are too expensive to compute.  */
+  OFFSET too_expensive;
+
   /* Snakes bigger than this are considered "big".  */
   #define SNAKE_LIMIT 20
 };
@@ -132,9 +200,37 @@ struct partition
   /* Midpoints of this partition.  */
   OFFSET xmid;
   OFFSET ymid;
+
+  /* True if low half will be analyzed minimally.  */
+  bool lo_minimal;
+
+  /* Likewise for high half.  */
+  bool hi_minimal;
 };
 
 
+#ifdef GROW_DIAGONALS
+/* Make room in CTXT's vectors for at least NEED diagonals on each
+   side of the center, but for no more than MOST, moving the diagonals
+   already there to the center.  Return false if memory is short.  */
+
+static bool
+widen_diagonals (struct context *ctxt, OFFSET need, OFFSET most)
+{
+  OFFSET old = ctxt->diag_room;
+  OFFSET room = MAX (old <= most / 2 ? 2 * old : most, need);
+
+  if (! GROW_DIAGONALS (ctxt, room))
+    return false;
+  memmove (ctxt->fdiag + (room - old), ctxt->fdiag,
+           (2 * old + 3) * sizeof *ctxt->fdiag);
+  memmove (ctxt->bdiag + (room - old), ctxt->bdiag,
+           (2 * old + 3) * sizeof *ctxt->bdiag);
+  ctxt->diag_room = room;
+  return true;
+}
+#endif
+
 /* Find the midpoint of the shortest edit script for a specified portion
    of the two vectors.
 
@@ -143,10 +239,17 @@ struct partition
    When the two searches meet, we have found the midpoint of the shortest
    edit sequence.
 
+   If FIND_MINIMAL is true, find the minimal edit script regardless of
+   expense.  Otherwise, if the search is too expensive, use heuristics to
+   stop the search and report a suboptimal answer.
+
    Set *PART to the midpoint (XMID,YMID).  The diagonal number
    XMID - YMID equals the number of inserted elements minus the number
    of deleted elements (counting only elements before the midpoint).
 
+   Set PART->lo_minimal to true iff the minimal edit script for the
+   left half of the partition is known; similarly for PART->hi_minimal.
+
    This function assumes that the first elements of the specified portions
    of the two vectors do not match, and likewise that the last elements do not
    match.  The caller must trim matching elements from the beginning and end
@@ -156,11 +259,16 @@ struct partition
    suboptimal diff output.  It cannot cause incorrect diff output.  */
 
 static void
-diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
+diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim, bool find_minimal,
       struct partition *part, struct context *ctxt)
 {
+#ifdef GROW_DIAGONALS
+  OFFSET *fd;
+  OFFSET *bd;
+#else
   OFFSET *const fd = ctxt->fdiag;       /* Give the compiler a chance. */
   OFFSET *const bd = ctxt->bdiag;       /* Additional help for the compiler. */
+#endif
 #ifdef ELEMENT
   ELEMENT const *const xv = ctxt->xvec; /* Still more help for the compiler. */
   ELEMENT const *const yv = ctxt->yvec; /* And more and more . . . */
@@ -179,6 +287,14 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
   OFFSET c;                     /* Cost. */
   bool odd = (fmid - bmid) & 1; /* True if southeast corner is on an odd
                                    diagonal with respect to the northwest. */
+  bool cramped = false;         /* True if the vectors cannot grow. */
+  bool const runs = RUNS (ctxt); /* True if snakes can step over runs. */
+
+#ifdef GROW_DIAGONALS
+  /* Index the vectors by the diagonals around each search's center.  */
+  fd = ctxt->fdiag + ctxt->diag_room + 1 - fmid;
+  bd = ctxt->bdiag + ctxt->diag_room + 1 - bmid;
+#endif
 
   fd[fmid] = xoff;
   bd[bmid] = xlim;
@@ -201,14 +317,20 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
         {
           OFFSET x;
           OFFSET y;
+          OFFSET step;
           OFFSET tlo = fd[d - 1];
           OFFSET thi = fd[d + 1];
           OFFSET x0 = tlo < thi ? thi : tlo + 1;
 
+          /* Follow the snake one element at a time, or a run of the
+             same element at a time.  Most snakes found here are zero or
+             a few elements long; comparing blocks with memcmp only adds
+             overhead, and the long runs left after discarding are
+             handled by sliding in compareseq.  */
           for (x = x0, y = x0 - d;
                x < xlim && y < ylim && XREF_YREF_EQUAL (x, y);
-               x++, y++)
-            continue;
+               x += step, y += step)
+            step = SNAKE_AHEAD (runs, ctxt, x, y, xlim, ylim);
           if (x - x0 > SNAKE_LIMIT)
             big_snake = true;
           fd[d] = x;
@@ -216,6 +338,7 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
             {
               part->xmid = x;
               part->ymid = y;
+              part->lo_minimal = part->hi_minimal = true;
               return;
             }
         }
@@ -233,14 +356,15 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
         {
           OFFSET x;
           OFFSET y;
+          OFFSET step;
           OFFSET tlo = bd[d - 1];
           OFFSET thi = bd[d + 1];
           OFFSET x0 = tlo < thi ? tlo : thi - 1;
 
           for (x = x0, y = x0 - d;
                xoff < x && yoff < y && XREF_YREF_EQUAL (x - 1, y - 1);
-               x--, y--)
-            continue;
+               x -= step, y -= step)
+            step = SNAKE_BEHIND (runs, ctxt, x, y, xoff, yoff);
           if (x0 - x > SNAKE_LIMIT)
             big_snake = true;
           bd[d] = x;
@@ -248,10 +372,41 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
             {
               part->xmid = x;
               part->ymid = y;
+              part->lo_minimal = part->hi_minimal = true;
               return;
             }
         }
 
+      NOTE_DIAGONALS (ctxt, (fmax - fmin) / 2 + (bmax - bmin) / 2 + 2);
+
+      /* If the computation is being aborted, return a trivial split;
+         compareseq notices the abort before splitting any further.  */
+      if (EARLY_ABORT (ctxt))
+        {
+          part->xmid = xoff;
+          part->ymid = yoff;
+          part->lo_minimal = part->hi_minimal = true;
+          return;
+        }
+
+#ifdef GROW_DIAGONALS
+      /* Make room for the diagonals that the next edit step reaches.
+         If there is none, settle for a good split as below.  */
+      if (ctxt->diag_room <= c && c < dmax - dmin)
+        {
+          if (widen_diagonals (ctxt, c + 1, dmax - dmin))
+            {
+              fd = ctxt->fdiag + ctxt->diag_room + 1 - fmid;
+              bd = ctxt->bdiag + ctxt->diag_room + 1 - bmid;
+            }
+          else
+            cramped = true;
+        }
+#endif
+
+      if (find_minimal && !cramped)
+        continue;
+
 #ifdef USE_HEURISTIC
       /* Heuristic: check occasionally for a diagonal that has made lots
          of progress compared with the edit distance.  If we have any
@@ -295,7 +450,11 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
                   }
               }
             if (best > 0)
-	      return;
+              {
+                part->lo_minimal = true;
+                part->hi_minimal = false;
+                return;
+              }
           }
 
           {
@@ -330,10 +489,77 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
                   }
               }
             if (best > 0)
-	      return;
+              {
+                part->lo_minimal = false;
+                part->hi_minimal = true;
+                return;
+              }
           }
         }
 #endif /* USE_HEURISTIC */
+
+      /* Heuristic: if we've gone well beyond the call of duty, give up
+         and report halfway between our best results so far.  */
+      if (c >= ctxt->too_expensive || cramped)
+        {
+          OFFSET fxybest;
+          OFFSET fxbest IF_LINT (= 0);
+          OFFSET bxybest;
+          OFFSET bxbest IF_LINT (= 0);
+
+          /* Find forward diagonal that maximizes X + Y.  */
+          fxybest = -1;
+          for (d = fmax; d >= fmin; d -= 2)
+            {
+              OFFSET x = MIN (fd[d], xlim);
+              OFFSET y = x - d;
+              if (ylim < y)
+                {
+                  x = ylim + d;
+                  y = ylim;
+                }
+              if (fxybest < x + y)
+                {
+                  fxybest = x + y;
+                  fxbest = x;
+                }
+            }
+
+          /* Find backward diagonal that minimizes X + Y.  */
+          bxybest = OFFSET_MAX;
+          for (d = bmax; d >= bmin; d -= 2)
+            {
+              OFFSET x = MAX (xoff, bd[d]);
+              OFFSET y = x - d;
+              if (y < yoff)
+                {
+                  x = yoff + d;
+                  y = yoff;
+                }
+              if (x + y < bxybest)
+                {
+                  bxybest = x + y;
+                  bxbest = x;
+                }
+            }
+
+          /* Use the better of the two diagonals.  */
+          if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff))
+            {
+              part->xmid = fxbest;
+              part->ymid = fxybest - fxbest;
+              part->lo_minimal = true;
+              part->hi_minimal = false;
+            }
+          else
+            {
+              part->xmid = bxbest;
+              part->ymid = bxybest - bxbest;
+              part->lo_minimal = false;
+              part->hi_minimal = true;
+            }
+          return;
+        }
     }
   #undef XREF_YREF_EQUAL
 }
@@ -347,6 +573,9 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
    Note that XLIM, YLIM are exclusive bounds.  All indices into the vectors
    are origin-0.
 
+   If FIND_MINIMAL, find a minimal difference no matter how
+   expensive it is.
+
    The results are recorded by invoking NOTE_DELETE and NOTE_INSERT.
 
    Return false if terminated normally, or true if terminated through early
@@ -354,7 +583,7 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
 
 static bool
 compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
-            struct context *ctxt)
+            bool find_minimal, struct context *ctxt)
 {
 #ifdef ELEMENT
   ELEMENT const *xv = ctxt->xvec; /* Help the compiler.  */
@@ -363,19 +592,27 @@ compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
 #else
   #define XREF_YREF_EQUAL(x,y)  XVECREF_YVECREF_EQUAL (ctxt, x, y)
 #endif
+  bool const runs = RUNS (ctxt);
 
   /* Slide down the bottom initial diagonal.  */
   while (xoff < xlim && yoff < ylim && XREF_YREF_EQUAL (xoff, yoff))
     {
-      xoff++;
-      yoff++;
+      OFFSET step = SNAKE_AHEAD (runs, ctxt, xoff, yoff, xlim, ylim);
+      xoff += step;
+      yoff += step;
     }
 
+  /* Everything before XOFF and YOFF is now settled, as the
+     subproblems before this one have been solved.  */
+  if (SETTLED_ABORT (ctxt, xoff, yoff))
+    return true;
+
   /* Slide up the top initial diagonal. */
   while (xoff < xlim && yoff < ylim && XREF_YREF_EQUAL (xlim - 1, ylim - 1))
     {
-      xlim--;
-      ylim--;
+      OFFSET step = SNAKE_BEHIND (runs, ctxt, xlim, ylim, xoff, yoff);
+      xlim -= step;
+      ylim -= step;
     }
 
   /* Handle simple cases. */
@@ -399,13 +636,16 @@ compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
     {
       struct partition part IF_LINT2 (= { .xmid = 0, .ymid = 0 });
 
+      if (EARLY_ABORT (ctxt))
+        return true;
+
       /* Find a point of correspondence in the middle of the vectors.  */
-      diag (xoff, xlim, yoff, ylim, &part, ctxt);
+      diag (xoff, xlim, yoff, ylim, find_minimal, &part, ctxt);
 
       /* Use the partitions to split this problem into subproblems.  */
-      if (compareseq (xoff, part.xmid, yoff, part.ymid, ctxt))
+      if (compareseq (xoff, part.xmid, yoff, part.ymid, part.lo_minimal, ctxt))
         return true;
-      if (compareseq (part.xmid, xlim, part.ymid, ylim, ctxt))
+      if (compareseq (part.xmid, xlim, part.ymid, ylim, part.hi_minimal, ctxt))
         return true;
     }
 
@@ -420,6 +660,14 @@ compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
 #undef NOTE_DELETE
 #undef NOTE_INSERT
 #undef EARLY_ABORT
+#undef SETTLED_ABORT
+#undef RUN_AHEAD
+#undef RUN_BEHIND
+#undef RUNS
+#undef SNAKE_AHEAD
+#undef SNAKE_BEHIND
+#undef NOTE_DIAGONALS
 #undef USE_HEURISTIC
+#undef GROW_DIAGONALS
 #undef XVECREF_YVECREF_EQUAL
 #undef OFFSET_MAX
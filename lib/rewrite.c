@@ -0,0 +1,59 @@
+/* Rewrite a file in place.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include "rewrite.h"
+
+/* Replace the contents of the file NAME with everything written so
+   far to the stream CONTENTS, which must be open for reading too, as
+   from tmpfile.  The file is truncated and written over, as ed's w
+   command does, rather than replaced by a new file, so that its
+   owner, mode and links stay as they were.  The contents are staged
+   in a stream of their own because they are usually made from the
+   file's old contents, which must still be read while they are made.
+   Return 0 if successful, and an errno value otherwise.  */
+
+int
+rewrite_file (char const *name, FILE *contents)
+{
+  char buf[64 * 1024];
+  size_t n;
+  int err = 0;
+  FILE *out;
+
+  if (fflush (contents) != 0 || fseeko (contents, 0, SEEK_SET) != 0)
+    return errno;
+
+  out = fopen (name, "wb");
+  if (! out)
+    return errno;
+
+  while ((n = fread (buf, 1, sizeof buf, contents)) != 0)
+    if (fwrite (buf, 1, n, out) != n)
+      {
+	err = errno;
+	break;
+      }
+  if (! err && ferror (contents))
+    err = errno;
+  if (fclose (out) != 0 && ! err)
+    err = errno;
+  return err;
+}
@@ -19,95 +19,935 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "diff.h"
+#include "probes.h"
 #include <cmpbuf.h>
 #include <error.h>
 #include <file-type.h>
+#include <timespec.h>
 #include <xalloc.h>
 
 /* The core of the Diff algorithm.  */
 #define ELEMENT lin
 #define EQUAL(x,y) ((x) == (y))
 #define OFFSET lin
-#define EXTRA_CONTEXT_FIELDS /* none */
-#define NOTE_DELETE(c, xoff) (files[0].changed[files[0].realindexes[xoff]] = 1)
-#define NOTE_INSERT(c, yoff) (files[1].changed[files[1].realindexes[yoff]] = 1)
+#define EXTRA_CONTEXT_FIELDS \
+  /* If not null, for each element of each vector, how many elements \
+     from it on and up to it are the same as it, up to UCHAR_MAX.  */ \
+  unsigned char *ahead[2]; \
+  unsigned char *behind[2];
+#define NOTE_DELETE(c, xoff) \
+  (files[0].changed[files[0].realindexes[xoff]] = 1, \
+   progress.settled[0] = (xoff))
+#define NOTE_INSERT(c, yoff) \
+  (files[1].changed[files[1].realindexes[yoff]] = 1, \
+   progress.settled[1] = (yoff))
+#define EARLY_ABORT(c) early_abort ()
+#define NOTE_DIAGONALS(c, n) (stats.diagonals += (n))
 #define USE_HEURISTIC 1
+#define GROW_DIAGONALS(c, n) grow_diagonals (c, n)
+#define SETTLED_ABORT(c, xoff, yoff) settled_abort (xoff, yoff)
+#define RUN_AHEAD(c, xoff, yoff) MIN ((c)->ahead[0][xoff], (c)->ahead[1][yoff])
+#define RUN_BEHIND(c, xoff, yoff) \
+  MIN ((c)->behind[0][(xoff) - 1], (c)->behind[1][(yoff) - 1])
+#define RUNS(c) ((c)->ahead[0] != NULL)
+static bool early_abort (void);
+static bool settled_abort (lin, lin);
+struct context;
+static bool grow_diagonals (struct context *, lin);
 #include <diffseq.h>
 
-/* Discard lines from one file that have no matches in the other file.
+/* The room that the vectors of diagonals start with.  */
+enum { DIAG_ROOM_MIN = 256 };
 
-   A line which is discarded will not be considered by the actual
-   comparison algorithm; it will be as if that line were not in the file.
-   The file's 'realindexes' table maps virtual line numbers
-   (which don't count the discarded lines) into real line numbers;
-   this is how the actual comparison algorithm produces results
-   that are comprehensible when the discarded lines are counted.
+/* Reallocate the vectors of diagonals of CTXT to 2 * N + 3 elements
+   each.  Return false if memory is short.  */
+static bool
+grow_diagonals (struct context *ctxt, lin n)
+{
+  lin *p;
 
-   When we discard a line, we also mark it as a deletion or insertion
-   so that it will be printed in the output.  */
+  if (PTRDIFF_MAX / sizeof *p / 2 - 2 < n)
+    return false;
+  p = realloc (ctxt->fdiag, (2 * n + 3) * sizeof *p);
+  if (! p)
+    return false;
+  ctxt->fdiag = p;
+  advise_huge_pages (p, (2 * n + 3) * sizeof *p);
+  p = realloc (ctxt->bdiag, (2 * n + 3) * sizeof *p);
+  if (! p)
+    return false;
+  ctxt->bdiag = p;
+  advise_huge_pages (p, (2 * n + 3) * sizeof *p);
+  return true;
+}
 
+/* The work done on the current pair of files, and when to give up on
+   it, for --max-cost and --timeout.  */
+static lin cost;
+static struct timespec deadline;
+static bool costly;
+
+/* Whether the comparison was cut short because there was not enough
+   memory to compare the files in detail.  */
+static bool short_of_memory;
+
+/* The diagonals that compareseq may search, counting those searched
+   for all files so far, before it gives way to lcs_seq, or 0 if it
+   need not; and whether it did.  With --diff-algorithm=auto, whether
+   it gives way to histogram diff instead.  */
+static uintmax_t lcs_budget;
+static bool lcs_instead;
+static bool histogram_instead;
+
+/* Start measuring the work done on a pair of files.  */
 static void
-discard_confusing_lines (struct file_data filevec[])
+start_cost (void)
+{
+  cost = 0;
+  costly = short_of_memory = false;
+  if (max_seconds)
+    {
+      gettime (&deadline);
+      deadline.tv_sec = (TYPE_MAXIMUM (time_t) - deadline.tv_sec < max_seconds
+			 ? TYPE_MAXIMUM (time_t)
+			 : deadline.tv_sec + max_seconds);
+    }
+}
+
+/* Count one more step of the search for changes: a changed line
+   noted, a region split, or an edit step in 'diag'.  Return true if
+   the comparison has become too costly to finish, or if compareseq
+   has searched more diagonals than lcs_seq would take to finish.
+   Every so many steps, see whether --progress is due to report.  */
+static bool
+early_abort (void)
+{
+  static unsigned int steps;
+  if (lcs_budget && lcs_budget < stats.diagonals)
+    return lcs_instead = true;
+  if (show_progress && ! (++steps & 0xfff))
+    progress_tick ();
+
+  if (! costly && (max_cost || max_seconds))
+    {
+      struct timespec now;
+      if (max_cost && max_cost < ++cost)
+	costly = true;
+      else if (max_seconds)
+	{
+	  gettime (&now);
+	  costly = timespec_cmp (deadline, now) < 0;
+	}
+    }
+  return costly;
+}
+
+/* Scratch memory for one call of diff_lines.  Its vectors and the
+   nodes of its edit script are carved from a chain of blocks, which is
+   released all at once when the comparison is done.  A block no bigger
+   than SCRATCH_BLOCK_SIZE is kept for the next comparison, so that
+   diff -r over many small files reuses the same memory.  */
+
+struct scratch_block
+{
+  struct scratch_block *next;
+  size_t size;			/* Bytes available in DATA.  */
+  size_t used;			/* Bytes of DATA handed out so far.  */
+  max_align_t data[];
+};
+
+enum { SCRATCH_BLOCK_SIZE = 64 * 1024 };
+
+static struct scratch_block *scratch;
+
+/* The total size of the blocks in the chain.  */
+static size_t scratch_size;
+
+/* Return SIZE bytes of scratch memory, or a null pointer if there is
+   not enough memory.  */
+static void *
+scratch_try_alloc (size_t size)
+{
+  struct scratch_block *b = scratch;
+  size_t align = sizeof (max_align_t);
+  void *p;
+
+  if (SIZE_MAX - offsetof (struct scratch_block, data) - align < size)
+    return NULL;
+  size = (size + align - 1) / align * align;
+  if (! b || b->size - b->used < size)
+    {
+      size_t bsize = MAX (size, SCRATCH_BLOCK_SIZE);
+      b = malloc (offsetof (struct scratch_block, data) + bsize);
+      if (! b)
+	return NULL;
+      b->size = bsize;
+      b->used = 0;
+      b->next = scratch;
+      scratch = b;
+      scratch_size += bsize;
+    }
+  p = (char *) b->data + b->used;
+  b->used += size;
+  return p;
+}
+
+/* Return SIZE bytes of scratch memory.  */
+static void *
+scratch_alloc (size_t size)
+{
+  void *p = scratch_try_alloc (size);
+  if (! p)
+    xalloc_die ();
+  return p;
+}
+
+/* Return SIZE bytes of zeroed scratch memory.  */
+static void *
+scratch_zalloc (size_t size)
+{
+  return memset (scratch_alloc (size), 0, size);
+}
+
+/* Release all scratch memory.  */
+static void
+scratch_release (void)
+{
+  while (scratch && (scratch->next || SCRATCH_BLOCK_SIZE < scratch->size))
+    {
+      struct scratch_block *next = scratch->next;
+      scratch_size -= scratch->size;
+      free (scratch);
+      scratch = next;
+    }
+  if (scratch)
+    scratch->used = 0;
+}
+
+/* With --max-hunks, the search for changes stops once it has settled
+   the hunks that will be output.  Each time the lines settled have
+   doubled, their changes are copied and shifted as shift_boundaries
+   would shift them, and the search stops if the hunks to be output
+   are followed, in the copy, by enough unchanged lines that the output
+   would not join them to the next, up to a line that occurs once in
+   each file.  No run of changes can be shifted past such a line, so
+   the lines not yet compared cannot move the hunks before it.  */
+static struct
+{
+  /* Whether to stop once the hunks are settled, and whether the
+     search stopped.  */
+  bool on;
+  bool stopped;
+
+  /* The lines of both files settled when last checked.  */
+  lin checked;
+
+  /* The lines of each file before the line where the search
+     stopped, and that line.  */
+  lin line[2];
+
+  /* For each equivalence class, the number of lines of each file in
+     it, up to 2.  */
+  char *count[2];
+
+  /* The unchanged lines that separate two hunks of output.  */
+  lin gap_min;
+} settling;
+
+static void shift_boundaries (char *[2], lin const *[2], lin const[2]);
+
+/* Start looking for the hunks settled in the files being compared.  */
+static void
+start_settling (void)
 {
   int f;
   lin i;
-  char *discarded[2];
-  lin *equiv_count[2];
-  lin *p;
 
-  /* Allocate our results.  */
-  p = xmalloc ((filevec[0].buffered_lines + filevec[1].buffered_lines)
-	       * (2 * sizeof *p));
+  settling.on = (max_hunks && ! (ignore_blank_lines || ignore_regexp.fastmap)
+		 && (diff_algorithm == MYERS_ALGORITHM
+		     || diff_algorithm == AUTO_ALGORITHM || minimal));
+  settling.stopped = false;
+  settling.checked = 0;
+  settling.gap_min = (output_style == OUTPUT_CONTEXT
+		      || output_style == OUTPUT_UNIFIED
+		      ? 2 * context + 1 : 1);
+  if (! settling.on)
+    return;
+
+  settling.count[0] = scratch_zalloc (2 * files[0].equiv_max);
+  settling.count[1] = settling.count[0] + files[0].equiv_max;
+  for (f = 0; f < 2; f++)
+    for (i = 0; i < files[f].buffered_lines; i++)
+      {
+	char *c = &settling.count[f][files[f].equivs[i]];
+	*c += *c < 2;
+      }
+}
+
+/* Return true if the changes found in the first LINES[0] lines of the
+   first file and LINES[1] of the second, once shifted, settle the
+   hunks that --max-hunks says to output, and if so set the lines
+   where the search stops.  */
+static bool
+hunks_settled (lin const lines[2])
+{
+  char *changed[2];
+  lin const *equivs[2];
+  lin i0 = 0, i1 = 0, hunks = 0, gap = 0;
+  bool settled = false;
+  int f;
+
+  /* Shift copies of the changed flags, with a 0 before and after.  */
   for (f = 0; f < 2; f++)
     {
-      filevec[f].undiscarded = p;  p += filevec[f].buffered_lines;
-      filevec[f].realindexes = p;  p += filevec[f].buffered_lines;
+      changed[f] = (char *) xmalloc (lines[f] + 2) + 1;
+      changed[f][-1] = changed[f][lines[f]] = 0;
+      memcpy (changed[f], files[f].changed, lines[f]);
+      equivs[f] = files[f].equivs;
     }
+  shift_boundaries (changed, equivs, lines);
+
+  for (;;)
+    if (changed[0][i0] || changed[1][i1])
+      {
+	if (! hunks || settling.gap_min <= gap)
+	  hunks++;
+	gap = 0;
+	while (changed[0][i0])
+	  i0++;
+	while (changed[1][i1])
+	  i1++;
+      }
+    else if (i0 < lines[0] && i1 < lines[1])
+      {
+	lin e = equivs[0][i0];
+	i0++;
+	i1++;
+	gap++;
+	if (max_hunks <= hunks - (gap < settling.gap_min)
+	    && settling.count[0][e] == 1 && settling.count[1][e] == 1)
+	  {
+	    settling.line[0] = i0;
+	    settling.line[1] = i1;
+	    settled = true;
+	    break;
+	  }
+      }
+    else
+      break;
+
+  for (f = 0; f < 2; f++)
+    free (changed[f] - 1);
+  return settled;
+}
 
-  /* Set up equiv_count[F][I] as the number of lines in file F
-     that fall in equivalence class I.  */
+/* Return true if the search for changes, which has settled the lines
+   of the files before their undiscarded lines XOFF and YOFF, has
+   settled the hunks that --max-hunks says to output.  */
+static bool
+settled_abort (lin xoff, lin yoff)
+{
+  lin lines[2];
 
-  p = zalloc (filevec[0].equiv_max * (2 * sizeof *p));
-  equiv_count[0] = p;
-  equiv_count[1] = p + filevec[0].equiv_max;
+  if (! settling.on)
+    return false;
 
-  for (i = 0; i < filevec[0].buffered_lines; ++i)
-    ++equiv_count[0][filevec[0].equivs[i]];
-  for (i = 0; i < filevec[1].buffered_lines; ++i)
-    ++equiv_count[1][filevec[1].equivs[i]];
+  lines[0] = (xoff < files[0].nondiscarded_lines
+	      ? files[0].realindexes[xoff] : files[0].buffered_lines);
+  lines[1] = (yoff < files[1].nondiscarded_lines
+	      ? files[1].realindexes[yoff] : files[1].buffered_lines);
+  if (lines[0] + lines[1] <= 2 * settling.checked)
+    return false;
 
-  /* Set up tables of which lines are going to be discarded.  */
+  settling.checked = lines[0] + lines[1];
+  settling.stopped = hunks_settled (lines);
+  return settling.stopped;
+}
 
-  discarded[0] = zalloc (filevec[0].buffered_lines
-			 + filevec[1].buffered_lines);
-  discarded[1] = discarded[0] + filevec[0].buffered_lines;
+/* Return the number of lines of FILEVEC[F] whose changes are known:
+   all of them, unless the search stopped at the hunks it settled.  */
+static lin
+lines_settled (struct file_data const filevec[], int f)
+{
+  return settling.stopped ? settling.line[f] : filevec[f].buffered_lines;
+}
+
+/* Alternatives to compareseq, for --diff-algorithm.  Like compareseq,
+   they compare CTXT->xvec[XOFF..XLIM) with CTXT->yvec[YOFF..YLIM) and
+   note each line inserted or deleted.  Rather than minimizing the
+   changes, they first match lines that are rare in the region being
+   compared, which tends to keep reordered blocks of text together.
+   Where they find no such lines, they fall back on compareseq.  */
+
+/* Workspace for the alternative algorithms.  The vectors indexed by
+   equivalence class are all zero between uses.  */
+struct anchors
+{
+  struct context *ctxt;
+  lin *count[2];	/* Occurrences of each class in each vector.  */
+  lin *where;		/* The first (histogram) or only (patience)
+			   occurrence of each class in the X vector.  */
+  lin *next;		/* The next occurrence of X[I]'s class in the
+			   X vector after I, for histogram.  */
+};
+
+/* Histogram diff does not start a match with a line whose class
+   occurs more often than this in the region being compared.  */
+enum { HISTOGRAM_CHAIN_LIMIT = 64 };
+
+/* Patience diff gives up on finding unique lines, and uses compareseq
+   instead, below this depth of recursion.  */
+enum { PATIENCE_DEPTH_LIMIT = 1024 };
+
+/* With --diff-algorithm=auto, compareseq gives way to histogram diff
+   once it has searched this many diagonals per line, about twice as
+   long as histogram diff takes, if at least AUTO_UNIQUE_PERCENT
+   percent of the lines left by discard_confusing_lines occur once in
+   each file, so that histogram diff matches nearly as many of them.
+   It does not when either file has fewer than LCS_LINES_MIN lines
+   left.  */
+enum { AUTO_DIAGONALS_PER_LINE = 16 };
+enum { AUTO_UNIQUE_PERCENT = 90 };
+
+static void
+note_changes (lin xoff, lin xlim, lin yoff, lin ylim)
+{
+  for (; xoff < xlim; xoff++)
+    files[0].changed[files[0].realindexes[xoff]] = 1;
+  for (; yoff < ylim; yoff++)
+    files[1].changed[files[1].realindexes[yoff]] = 1;
+}
+
+/* Forget the changes noted among the first N lines of the X vector
+   and the first M of the Y vector, to compare them again.  */
+static void
+note_changes_undone (lin n, lin m)
+{
+  lin i;
+  for (i = 0; i < n; i++)
+    files[0].changed[files[0].realindexes[i]] = 0;
+  for (i = 0; i < m; i++)
+    files[1].changed[files[1].realindexes[i]] = 0;
+}
+
+/* Discard the lines common to the start and to the end of the region
+   of CTXT's vectors given by *XOFF, *XLIM, *YOFF and *YLIM.  If the
+   region then still has lines from both vectors, return true;
+   otherwise note the remaining lines as changed and return false.  */
+
+static bool
+reduce_region (struct context const *ctxt,
+	       lin *xoff, lin *xlim, lin *yoff, lin *ylim)
+{
+  lin const *xv = ctxt->xvec;
+  lin const *yv = ctxt->yvec;
+
+  while (*xoff < *xlim && *yoff < *ylim && xv[*xoff] == yv[*yoff])
+    ++*xoff, ++*yoff;
+  while (*xoff < *xlim && *yoff < *ylim && xv[*xlim - 1] == yv[*ylim - 1])
+    --*xlim, --*ylim;
+
+  if (*xoff < *xlim && *yoff < *ylim)
+    return true;
+  note_changes (*xoff, *xlim, *yoff, *ylim);
+  return false;
+}
+
+/* Histogram diff, as in Git.  Match the longest run of common lines
+   that contains the region's rarest common line, then compare the
+   regions before and after the run.  */
+
+static void
+histogram_seq (lin xoff, lin xlim, lin yoff, lin ylim, struct anchors *a)
+{
+  lin const *xv = a->ctxt->xvec;
+  lin const *yv = a->ctxt->yvec;
+  lin *count = a->count[0];
+  lin *first = a->where;
+  lin *next = a->next;
+
+  while (reduce_region (a->ctxt, &xoff, &xlim, &yoff, &ylim))
+    {
+      lin x, y;
+      lin best_count = HISTOGRAM_CHAIN_LIMIT + 1;
+      lin bx0 = 0, bx1 = 0, by0 = 0, by1 = 0;
+      bool common = false;
+
+      if (early_abort ())
+	return;
+
+      /* Chain together the occurrences of each class in X.  */
+      for (x = xlim; xoff < x; )
+	{
+	  lin c = xv[--x];
+	  next[x] = count[c] ? first[c] : xlim;
+	  first[c] = x;
+	  count[c]++;
+	}
+
+      /* Find the best run, skipping past each run found so far.  */
+      for (y = yoff; y < ylim; )
+	{
+	  lin c = yv[y];
+	  lin ynext = y + 1;
+
+	  if (count[c])
+	    {
+	      common = true;
+	      if (count[c] <= best_count)
+		for (x = first[c]; x < xlim; )
+		  {
+		    lin x0 = x, x1 = x + 1, y0 = y, y1 = y + 1;
+		    lin rarest = count[c];
+
+		    while (xoff < x0 && yoff < y0 && xv[x0 - 1] == yv[y0 - 1])
+		      {
+			x0--, y0--;
+			rarest = MIN (rarest, count[xv[x0]]);
+		      }
+		    while (x1 < xlim && y1 < ylim && xv[x1] == yv[y1])
+		      {
+			rarest = MIN (rarest, count[xv[x1]]);
+			x1++, y1++;
+		      }
+
+		    if (ynext < y1)
+		      ynext = y1;
+		    if (bx1 - bx0 < x1 - x0 || rarest < best_count)
+		      {
+			bx0 = x0, bx1 = x1, by0 = y0, by1 = y1;
+			best_count = rarest;
+		      }
+
+		    do
+		      x = next[x];
+		    while (x < x1);
+		  }
+	    }
+
+	  y = ynext;
+	}
+
+      for (x = xoff; x < xlim; x++)
+	count[xv[x]] = 0;
+
+      if (bx0 == bx1)
+	{
+	  if (common)
+	    compareseq (xoff, xlim, yoff, ylim, false, a->ctxt);
+	  else
+	    note_changes (xoff, xlim, yoff, ylim);
+	  return;
+	}
+
+      /* Recurse on the smaller side of the run, to bound the depth of
+	 recursion, and loop on the larger side.  */
+      if ((bx0 - xoff) + (by0 - yoff) < (xlim - bx1) + (ylim - by1))
+	{
+	  histogram_seq (xoff, bx0, yoff, by0, a);
+	  xoff = bx1, yoff = by1;
+	}
+      else
+	{
+	  histogram_seq (bx1, xlim, by1, ylim, a);
+	  xlim = bx0, ylim = by0;
+	}
+    }
+}
+
+/* Patience diff.  Match the longest sequence of lines that occur just
+   once in each vector's region and appear in the same order in both,
+   then compare the regions between the matched lines.  DEPTH is the
+   depth of recursion.  */
+
+static void
+patience_seq (lin xoff, lin xlim, lin yoff, lin ylim, struct anchors *a,
+	      int depth)
+{
+  lin const *xv = a->ctxt->xvec;
+  lin const *yv = a->ctxt->yvec;
+  lin *count0 = a->count[0];
+  lin *count1 = a->count[1];
+  lin *where = a->where;
+  lin *ax, *ay, *prev, *tails;
+  lin x, y, i, n, len;
+
+  if (! reduce_region (a->ctxt, &xoff, &xlim, &yoff, &ylim)
+      || early_abort ())
+    return;
+  if (PATIENCE_DEPTH_LIMIT <= depth)
+    {
+      compareseq (xoff, xlim, yoff, ylim, false, a->ctxt);
+      return;
+    }
+
+  for (x = xoff; x < xlim; x++)
+    {
+      count0[xv[x]]++;
+      where[xv[x]] = x;
+    }
+  for (y = yoff; y < ylim; y++)
+    count1[yv[y]]++;
+
+  /* List the lines unique to both regions, in Y order.  */
+  n = MIN (xlim - xoff, ylim - yoff);
+  ax = xnmalloc (n, 4 * sizeof *ax);
+  ay = ax + n;
+  prev = ay + n;
+  tails = prev + n;
+  n = 0;
+  for (y = yoff; y < ylim; y++)
+    if (count0[yv[y]] == 1 && count1[yv[y]] == 1)
+      {
+	ax[n] = where[yv[y]];
+	ay[n] = y;
+	n++;
+      }
+
+  for (x = xoff; x < xlim; x++)
+    count0[xv[x]] = 0;
+  for (y = yoff; y < ylim; y++)
+    count1[yv[y]] = 0;
+
+  if (n == 0)
+    {
+      free (ax);
+      compareseq (xoff, xlim, yoff, ylim, false, a->ctxt);
+      return;
+    }
+
+  /* Find the longest subsequence that increases in X too, by patience
+     sorting: TAILS[J] is the last element of the best subsequence of
+     length J + 1 found so far.  */
+  len = 0;
+  for (i = 0; i < n; i++)
+    {
+      lin lo = 0, hi = len;
+      while (lo < hi)
+	{
+	  lin mid = lo + (hi - lo) / 2;
+	  if (ax[tails[mid]] < ax[i])
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      prev[i] = lo ? tails[lo - 1] : -1;
+      tails[lo] = i;
+      len += lo == len;
+    }
+
+  /* List the subsequence's elements in order at the start of TAILS.  */
+  for (i = tails[len - 1], n = len; 0 <= i; i = prev[i])
+    tails[--n] = i;
+
+  for (n = 0; n < len; n++)
+    {
+      i = tails[n];
+      patience_seq (xoff, ax[i], yoff, ay[i], a, depth + 1);
+      xoff = ax[i] + 1;
+      yoff = ay[i] + 1;
+    }
+  free (ax);
+  patience_seq (xoff, xlim, yoff, ylim, a, depth + 1);
+}
+
+/* Bit-parallel LCS, after Allison and Dix (1986) and Hyyrö (2004).
+   Compare CTXT->xvec[XOFF..XLIM) with CTXT->yvec[YOFF..YLIM) as
+   compareseq does with MINIMAL, finding a longest common subsequence,
+   but in O(N*M/64) time rather than O((N+M)*D).  That is the faster
+   way when the files are much rewritten, so that D is close to N.
+
+   A row of the table of LCS lengths is a vector of bits, one for each
+   line of Y, with bit J clear where the length grows by one at line
+   J.  The next row, for the next line of X, is made from it with an
+   addition and a few logical operations on each word of 64 lines.
+   The space is linear, as Hirschberg's algorithm splits each region
+   at the middle line of X where the forward and reverse rows meet.  */
+
+typedef uint64_t lcs_word;
+enum { LCS_WORD_BITS = 64 };
+
+/* lcs_seq is not used when either vector has fewer lines than this,
+   as then compareseq is fast anyway.  */
+enum { LCS_LINES_MIN = 2048 };
+
+/* lcs_seq takes about as long for LCS_DIAGONAL_WORDS words of a row
+   as compareseq takes to search a diagonal for an edit step.  */
+enum { LCS_DIAGONAL_WORDS = 1 };
+
+/* Workspace for lcs_seq.  The vectors indexed by equivalence class
+   are all zero between uses.  */
+struct lcs
+{
+  struct context *ctxt;
+  lin *count;		/* Occurrences of each class in the Y region.  */
+  lin *first;		/* The first occurrence of each class there.  */
+  lin *next;		/* The next occurrence of Y[I]'s class after I.  */
+  lin *dense;		/* For a class that occurs often, 1 + the index of
+			   its match vectors in MATCHES, else 0.  */
+  lcs_word *matches;	/* Match vectors of the frequent classes,
+			   forward and reversed.  */
+  lcs_word *match;	/* The match vector of a rarer class.  */
+  lcs_word *row[2];	/* The forward and reverse rows.  */
+};
+
+/* Set the bits of WORDS for the lines of class C in the Y region
+   YOFF..YLIM, in reverse order if REVERSE.  */
+
+static void
+lcs_set_matches (struct lcs const *l, lcs_word *words, lin c,
+		 lin yoff, lin ylim, bool reverse)
+{
+  lin y;
+  for (y = l->first[c]; y < ylim; y = l->next[y])
+    {
+      lin b = reverse ? ylim - 1 - y : y - yoff;
+      words[b / LCS_WORD_BITS] |= (lcs_word) 1 << b % LCS_WORD_BITS;
+    }
+}
+
+/* Set ROW to the last row of the table of LCS lengths of the X lines
+   XOFF..XLIM and the Y lines YOFF..YLIM, or of both reversed if
+   REVERSE.  Return false if the comparison became too costly.  */
+
+static bool
+lcs_row (struct lcs const *l, lin xoff, lin xlim, lin yoff, lin ylim,
+	 bool reverse, lcs_word *row)
+{
+  lin const *xv = l->ctxt->xvec;
+  lin words = (ylim - yoff + LCS_WORD_BITS - 1) / LCS_WORD_BITS;
+  lin i, k;
+
+  for (k = 0; k < words; k++)
+    row[k] = -1;
+
+  for (i = 0; i < xlim - xoff; i++)
+    {
+      lin c = xv[reverse ? xlim - 1 - i : xoff + i];
+      lcs_word const *match;
+      lcs_word carry = 0;
+
+      if (early_abort ())
+	return false;
+      if (! l->count[c])
+	continue;
+      if (l->dense[c])
+	match = l->matches + (2 * (l->dense[c] - 1) + reverse) * words;
+      else
+	{
+	  lcs_set_matches (l, l->match, c, yoff, ylim, reverse);
+	  match = l->match;
+	}
+
+      for (k = 0; k < words; k++)
+	{
+	  lcs_word v = row[k];
+	  lcs_word u = v & match[k];
+	  lcs_word sum = v + u;
+	  lcs_word overflow = sum < v;
+	  sum += carry;
+	  carry = overflow | (sum < carry);
+	  row[k] = sum | (v & ~match[k]);
+	}
+
+      if (! l->dense[c])
+	{
+	  lin y;
+	  for (y = l->first[c]; y < ylim; y = l->next[y])
+	    {
+	      lin b = reverse ? ylim - 1 - y : y - yoff;
+	      l->match[b / LCS_WORD_BITS] = 0;
+	    }
+	}
+    }
+  return true;
+}
+
+/* Return bit B of ROW.  */
+
+static bool
+lcs_bit (lcs_word const *row, lin b)
+{
+  return (row[b / LCS_WORD_BITS] >> b % LCS_WORD_BITS) & 1;
+}
+
+static void
+lcs_seq (lin xoff, lin xlim, lin yoff, lin ylim, struct lcs *l)
+{
+  lin const *yv = l->ctxt->yvec;
+  lin xmid, y, ysplit, words, ndense;
+  lin best, length;
+
+  if (! reduce_region (l->ctxt, &xoff, &xlim, &yoff, &ylim)
+      || early_abort ())
+    return;
+
+  /* Chain together the occurrences of each class in Y.  Setting and
+     clearing the bits of a class for each row it is used in would
+     cost about as much as the row itself for a class that occurs
+     more than once in every eight words, so such a class has match
+     vectors of its own, filled in once.  */
+  words = (ylim - yoff + LCS_WORD_BITS - 1) / LCS_WORD_BITS;
+  for (y = ylim; yoff < y; )
+    {
+      lin c = yv[--y];
+      l->next[y] = l->count[c] ? l->first[c] : ylim;
+      l->first[c] = y;
+      l->count[c]++;
+    }
+  ndense = 0;
+  for (y = yoff; y < ylim; y++)
+    {
+      lin c = yv[y];
+      if (8 * l->count[c] > words && ! l->dense[c])
+	{
+	  lcs_word *m = l->matches + 2 * ndense * words;
+	  l->dense[c] = ++ndense;
+	  memset (m, 0, 2 * words * sizeof *m);
+	  lcs_set_matches (l, m, c, yoff, ylim, false);
+	  lcs_set_matches (l, m + words, c, yoff, ylim, true);
+	}
+    }
+
+  /* Find where the LCS of the X lines before XMID and the Y lines
+     before YSPLIT, plus that of the lines after, is longest.  */
+  xmid = xoff + (xlim - xoff) / 2;
+  if (xlim - xoff == 1)
+    {
+      lin c = l->ctxt->xvec[xoff];
+      ysplit = l->count[c] ? l->first[c] : ylim;
+    }
+  else if (lcs_row (l, xoff, xmid, yoff, ylim, false, l->row[0])
+	   && lcs_row (l, xmid, xlim, yoff, ylim, true, l->row[1]))
+    {
+      length = 0;
+      for (y = 0; y < ylim - yoff; y++)
+	length += ! lcs_bit (l->row[1], y);
+      best = length;
+      ysplit = yoff;
+      for (y = yoff; y < ylim; y++)
+	{
+	  length += (! lcs_bit (l->row[0], y - yoff)
+		     - ! lcs_bit (l->row[1], ylim - 1 - y));
+	  if (best < length)
+	    {
+	      best = length;
+	      ysplit = y + 1;
+	    }
+	}
+    }
+  else
+    ysplit = -1;
+
+  for (y = yoff; y < ylim; y++)
+    l->count[yv[y]] = l->dense[yv[y]] = 0;
+
+  if (ysplit < 0)
+    return;
+  if (xlim - xoff == 1)
+    {
+      /* The one X line matches the first Y line of its class, if any.  */
+      note_changes (xoff, xoff + (ysplit == ylim), yoff, ysplit);
+      note_changes (xlim, xlim, ysplit + (ysplit < ylim), ylim);
+      return;
+    }
+  lcs_seq (xoff, xmid, yoff, ysplit, l);
+  lcs_seq (xmid, xlim, ysplit, ylim, l);
+}
+
+/* Set up L to compare with lcs_seq the vectors of CTXT, whose lines
+   are in CLASSES classes and the second of which has M lines.  Return
+   false if memory is short.  */
+
+static bool
+lcs_start (struct lcs *l, struct context *ctxt, lin classes, lin m)
+{
+  lin words = m / LCS_WORD_BITS + 1;
+  lin *p = scratch_try_alloc (classes * (3 * sizeof *p));
+
+  /* Two rows, the vector of a rare class, and those of the frequent
+     classes, which occur more than once in every eight words and so
+     take fewer than 16 * M words.  */
+  lcs_word *w = scratch_try_alloc ((16 * m + 4 * words + 4) * sizeof *w);
+
+  l->next = scratch_try_alloc (m * sizeof *l->next);
+  if (! (p && w && l->next))
+    return false;
+  memset (p, 0, classes * (3 * sizeof *p));
+  l->ctxt = ctxt;
+  l->count = p;
+  l->first = p + classes;
+  l->dense = p + 2 * classes;
+  l->row[0] = w;
+  l->row[1] = w + words;
+  l->match = memset (w + 2 * words, 0, words * sizeof *w);
+  l->matches = w + 3 * words;
+  return true;
+}
+
+/* Mark in DISCARDED[F] the lines of file F of FILEVEC that have no
+   matches in the other file with 1, and those that match many lines
+   and occur amid such lines with 2.  */
+
+static void
+find_confusing_lines (struct file_data const filevec[], char *discarded[2])
+{
+  int f;
+  lin i;
+  lin many[2];
+  unsigned short *counts;
 
-  /* Mark to be discarded each line that matches no line of the other file.
-     If a line matches many lines, mark it as provisionally discardable.  */
+  /* Set MANY[F] to the number of matches in the other file above which
+     a line of file F is provisionally discardable: 5 times roughly the
+     square root of the number of lines, divided by 8.  Keep it below
+     USHRT_MAX, which only files of more than 10**10 lines reach.  */
+  for (f = 0; f < 2; f++)
+    {
+      size_t tem = filevec[f].buffered_lines / 64;
+      many[f] = 5;
+      while ((tem = tem >> 2) > 0)
+	many[f] *= 2;
+      many[f] = MIN (many[f], USHRT_MAX - 1);
+    }
 
+  /* Count the lines of one file in each equivalence class, up to one
+     more than the other file's MANY, and mark the lines of the other
+     file by those counts; then the same the other way.  Counting one
+     file at a time into counts this narrow keeps the array of counts
+     an eighth the size of two arrays of lin, so that more of it stays
+     in cache when the files have millions of distinct lines.  The
+     classes are numbered in the order their first lines were met, so
+     on similar files both passes go through the array mostly in
+     order.  */
+  counts = scratch_alloc (filevec[0].equiv_max * sizeof *counts);
   for (f = 0; f < 2; f++)
     {
-      size_t end = filevec[f].buffered_lines;
+      lin const *other = filevec[1 - f].equivs;
+      lin other_end = filevec[1 - f].buffered_lines;
+      lin end = filevec[f].buffered_lines;
       char *discards = discarded[f];
-      lin *counts = equiv_count[1 - f];
-      lin *equivs = filevec[f].equivs;
-      size_t many = 5;
-      size_t tem = end / 64;
+      lin const *equivs = filevec[f].equivs;
+      unsigned short cap = many[f] + 1;
 
-      /* Multiply MANY by approximate square root of number of lines.
-	 That is the threshold for provisionally discardable lines.  */
-      while ((tem = tem >> 2) > 0)
-	many *= 2;
+      memset (counts, 0, filevec[0].equiv_max * sizeof *counts);
+      for (i = 0; i < other_end; i++)
+	{
+	  unsigned short *c = &counts[other[i]];
+	  *c += *c < cap;
+	}
 
+      /* Mark to be discarded each line that matches no line of the
+	 other file.  If a line matches many lines, mark it as
+	 provisionally discardable.  */
       for (i = 0; i < end; i++)
 	{
-	  lin nmatch;
+	  unsigned short nmatch;
 	  if (equivs[i] == 0)
 	    continue;
 	  nmatch = counts[equivs[i]];
 	  if (nmatch == 0)
 	    discards[i] = 1;
-	  else if (nmatch > many)
+	  else if (nmatch == cap)
 	    discards[i] = 2;
 	}
     }
@@ -123,10 +963,13 @@ discard_confusing_lines (struct file_data filevec[])
 
       for (i = 0; i < end; i++)
 	{
-	  /* Cancel provisional discards not in middle of run of discards.  */
-	  if (discards[i] == 2)
-	    discards[i] = 0;
-	  else if (discards[i] != 0)
+	  /* Cancel provisional discards not in middle of run of discards,
+	     that is, all of them up to the next nonprovisional discard.  */
+	  char *run = memchr (discards + i, 1, end - i);
+	  lin next = run ? run - discards : end;
+	  memset (discards + i, 0, next - i);
+	  i = next;
+	  if (i < end)
 	    {
 	      /* We have found a nonprovisional discard.  */
 	      register lin j;
@@ -223,62 +1066,267 @@ discard_confusing_lines (struct file_data filevec[])
 	    }
 	}
     }
-
-  /* Actually discard the lines. */
-  for (f = 0; f < 2; f++)
-    {
-      char *discards = discarded[f];
-      lin end = filevec[f].buffered_lines;
-      lin j = 0;
-      for (i = 0; i < end; ++i)
-	if (minimal || discards[i] == 0)
-	  {
-	    filevec[f].undiscarded[j] = filevec[f].equivs[i];
-	    filevec[f].realindexes[j++] = i;
-	  }
-	else
-	  filevec[f].changed[i] = 1;
-      filevec[f].nondiscarded_lines = j;
-    }
-
-  free (discarded[0]);
-  free (equiv_count[0]);
 }
-
-/* Adjust inserts/deletes of identical lines to join changes
-   as much as possible.
 
-   We do something when a run of changed lines include a
-   line at one end and have an excluded, identical line at the other.
-   We are free to choose which identical line is included.
-   'compareseq' usually chooses the one at the beginning,
-   but usually it is cleaner to consider the following identical line
-   to be the "change".  */
+/* Mark in DISCARDED[F] the lines of file F of FILEVEC that match an
+   -I regexp, for --ignore-matching-lines-early.  When lines of the
+   same class are identical, run the regexps once for each class.  */
 
 static void
-shift_boundaries (struct file_data filevec[])
+find_ignored_lines (struct file_data const filevec[], char *discarded[2])
 {
+  signed char *known = NULL;
   int f;
+  lin i;
+
+  if (ignore_white_space == IGNORE_NO_WHITE_SPACE && !ignore_case)
+    known = scratch_zalloc (filevec[0].equiv_max * sizeof *known);
 
   for (f = 0; f < 2; f++)
     {
-      char *changed = filevec[f].changed;
-      char *other_changed = filevec[1 - f].changed;
+      char const *const *linbuf = filevec[f].linbuf;
       lin const *equivs = filevec[f].equivs;
-      lin i = 0;
-      lin j = 0;
-      lin i_end = filevec[f].buffered_lines;
+      lin end = filevec[f].buffered_lines;
 
-      while (1)
+      for (i = 0; i < end; i++)
 	{
-	  lin runlength, start, corresponding;
-
-	  /* Scan forwards to find beginning of another run of changes.
-	     Also keep track of the corresponding point in the other file.  */
+	  signed char *k = known && equivs[i] ? &known[equivs[i]] : NULL;
+	  bool match;
 
-	  while (i < i_end && !changed[i])
+	  if (k && *k)
+	    match = 0 < *k;
+	  else
 	    {
-	      while (other_changed[j++])
+	      char const *lastbyte = linbuf[i + 1] - 1;
+	      size_t len = lastbyte + (*lastbyte != '\n') - linbuf[i];
+	      match = matches_ignore_regexp (linbuf[i], len);
+	      if (k)
+		*k = match ? 1 : -1;
+	    }
+	  if (match)
+	    discarded[f][i] = 1;
+	}
+    }
+}
+
+/* The number of runs of lines that discard_confusing_lines discarded
+   from the two files, each of which is part of a hunk.  */
+static lin discarded_runs;
+
+/* Discard lines from one file that have no matches in the other file.
+
+   A line which is discarded will not be considered by the actual
+   comparison algorithm; it will be as if that line were not in the file.
+   The file's 'realindexes' table maps virtual line numbers
+   (which don't count the discarded lines) into real line numbers;
+   this is how the actual comparison algorithm produces results
+   that are comprehensible when the discarded lines are counted.
+
+   When we discard a line, we also mark it as a deletion or insertion
+   so that it will be printed in the output.
+
+   With --ignore-matching-lines-early, discard the lines that match an
+   -I regexp too, even with --minimal, so that the other lines are
+   matched up as if they were absent.  */
+
+static void
+discard_confusing_lines (struct file_data filevec[])
+{
+  int f;
+  lin i;
+  char *discarded[2];
+  lin *p;
+
+  /* Allocate our results.  */
+  p = scratch_alloc ((filevec[0].buffered_lines + filevec[1].buffered_lines)
+		     * (2 * sizeof *p));
+  for (f = 0; f < 2; f++)
+    {
+      filevec[f].undiscarded = p;  p += filevec[f].buffered_lines;
+      filevec[f].realindexes = p;  p += filevec[f].buffered_lines;
+    }
+
+  discarded_runs = 0;
+
+  /* With --minimal no line is discarded, so just copy the lines.  */
+  if (minimal && ! ignore_matching_lines_early)
+    {
+      for (f = 0; f < 2; f++)
+	{
+	  for (i = 0; i < filevec[f].buffered_lines; i++)
+	    {
+	      filevec[f].undiscarded[i] = filevec[f].equivs[i];
+	      filevec[f].realindexes[i] = i;
+	    }
+	  filevec[f].nondiscarded_lines = filevec[f].buffered_lines;
+	}
+      return;
+    }
+
+  /* Set up tables of which lines are going to be discarded.  */
+
+  discarded[0] = scratch_zalloc (filevec[0].buffered_lines
+				 + filevec[1].buffered_lines);
+  discarded[1] = discarded[0] + filevec[0].buffered_lines;
+
+  if (! minimal)
+    find_confusing_lines (filevec, discarded);
+  if (ignore_matching_lines_early)
+    find_ignored_lines (filevec, discarded);
+
+  /* Actually discard the lines. */
+  for (f = 0; f < 2; f++)
+    {
+      char *discards = discarded[f];
+      lin end = filevec[f].buffered_lines;
+      lin j = 0;
+      for (i = 0; i < end; ++i)
+	if (discards[i] == 0)
+	  {
+	    filevec[f].undiscarded[j] = filevec[f].equivs[i];
+	    filevec[f].realindexes[j++] = i;
+	  }
+	else
+	  {
+	    filevec[f].changed[i] = 1;
+	    discarded_runs += i == 0 || discards[i - 1] == 0;
+	  }
+      filevec[f].nondiscarded_lines = j;
+    }
+}
+
+/* Runs of at least this many lines of the same class, left after
+   discarding, in both files make it worth finding all the runs.  */
+enum { LONG_RUN_MIN = 64 };
+
+/* Set CTXT's run lengths for the lines of FILEVEC that
+   discard_confusing_lines left, so that following a snake through a
+   run of the same line, as in logs that repeat a line many times,
+   takes a step rather than a step a line.  Leave them null unless
+   both files have a long run.  */
+
+static void
+find_runs (struct context *ctxt, struct file_data const filevec[])
+{
+  int f;
+  lin i;
+
+  ctxt->ahead[0] = ctxt->ahead[1] = NULL;
+  ctxt->behind[0] = ctxt->behind[1] = NULL;
+  for (f = 0; f < 2; f++)
+    {
+      lin const *v = filevec[f].undiscarded;
+      lin n = filevec[f].nondiscarded_lines;
+      lin run = 1;
+      for (i = 1; i < n && run < LONG_RUN_MIN; i++)
+	run = v[i] == v[i - 1] ? run + 1 : 1;
+      if (run < LONG_RUN_MIN)
+	return;
+    }
+
+  for (f = 0; f < 2; f++)
+    {
+      lin const *v = filevec[f].undiscarded;
+      lin n = filevec[f].nondiscarded_lines;
+      unsigned char *ahead = scratch_alloc (2 * n);
+      unsigned char *behind = ahead + n;
+
+      for (i = 0; i < n; i++)
+	behind[i] = (0 < i && v[i] == v[i - 1]
+		     ? behind[i - 1] + (behind[i - 1] < UCHAR_MAX) : 1);
+      for (i = n; 0 < i--; )
+	ahead[i] = (i + 1 < n && v[i] == v[i + 1]
+		    ? ahead[i + 1] + (ahead[i + 1] < UCHAR_MAX) : 1);
+      ctxt->ahead[f] = ahead;
+      ctxt->behind[f] = behind;
+    }
+}
+
+/* Return the percentage of the N lines of CTXT's X vector and the M
+   lines of its Y vector, whose classes are less than CLASSES, that are
+   in a class that occurs once in each vector, or 0 if memory is
+   short.  */
+
+static int
+unique_percent (struct context const *ctxt, lin classes, lin n, lin m)
+{
+  unsigned char *count = scratch_try_alloc (2 * classes);
+  lin unique = 0;
+  lin i;
+
+  if (! count)
+    return 0;
+  memset (count, 0, 2 * classes);
+  for (i = 0; i < n; i++)
+    count[ctxt->xvec[i]] += count[ctxt->xvec[i]] < 2;
+  for (i = 0; i < m; i++)
+    count[classes + ctxt->yvec[i]] += count[classes + ctxt->yvec[i]] < 2;
+  for (i = 0; i < n; i++)
+    unique += count[ctxt->xvec[i]] == 1 && count[classes + ctxt->xvec[i]] == 1;
+  return 200.0 * unique / ((double) n + m);
+}
+
+/* Return a guess at how many diagonals compareseq would search in
+   comparing the N lines left in the X vector by discard_confusing_lines
+   with the M lines left in the Y vector.  The search takes about
+   (N + M) * D / 2, where D is the number of lines inserted and
+   deleted, or D is at most TOO_EXPENSIVE if the search settles for a
+   good split.  D is guessed to be as dense among the lines left in
+   FILEVEC as among the lines discarded, unless the lines discarded are
+   in fewer runs than that, as when a block of lines was replaced.  */
+
+static double
+guess_diagonals (struct file_data const filevec[], lin n, lin m,
+		 lin too_expensive)
+{
+  double total = filevec[0].buffered_lines + filevec[1].buffered_lines;
+  double d = (n + m) * ((total - n - m) / total);
+  d = MIN (d, discarded_runs);
+  d = MAX (d, n < m ? m - n : n - m);
+  if (! minimal)
+    d = MIN (d, too_expensive);
+  return (n + m) * d / 2;
+}
+
+/* Adjust inserts/deletes of identical lines to join changes
+   as much as possible.
+
+   We do something when a run of changed lines include a
+   line at one end and have an excluded, identical line at the other.
+   We are free to choose which identical line is included.
+   'compareseq' usually chooses the one at the beginning,
+   but usually it is cleaner to consider the following identical line
+   to be the "change".
+
+   Each line is visited a bounded number of times per file, so this
+   takes time linear in the files' sizes, which is small next to the
+   comparison itself even when there are very many hunks.  */
+
+static void
+shift_boundaries (char *changed_vec[2], lin const *equivs_vec[2],
+		  lin const lines[2])
+{
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      char *changed = changed_vec[f];
+      char const *other_changed = changed_vec[1 - f];
+      lin const *equivs = equivs_vec[f];
+      lin i = 0;
+      lin j = 0;
+      lin i_end = lines[f];
+
+      while (1)
+	{
+	  lin runlength, start, corresponding;
+
+	  /* Scan forwards to find beginning of another run of changes.
+	     Also keep track of the corresponding point in the other file.  */
+
+	  while (i < i_end && !changed[i])
+	    {
+	      while (other_changed[j++])
 		continue;
 	      i++;
 	    }
@@ -352,19 +1400,49 @@ shift_boundaries (struct file_data filevec[])
     }
 }
 
+/* Forget the changes found so far, and mark as changed instead every
+   line of FILEVEC except those common to the start and to the end of
+   both files.  This is the coarse result when the comparison is too
+   costly to finish.  */
+
+static void
+mark_all_changed (struct file_data filevec[])
+{
+  lin n0 = filevec[0].buffered_lines;
+  lin n1 = filevec[1].buffered_lines;
+  lin const *e0 = filevec[0].equivs;
+  lin const *e1 = filevec[1].equivs;
+  lin head = 0, tail = 0, i;
+
+  while (head < n0 && head < n1 && e0[head] == e1[head])
+    head++;
+  while (tail < n0 - head && tail < n1 - head
+	 && e0[n0 - 1 - tail] == e1[n1 - 1 - tail])
+    tail++;
+
+  for (i = 0; i < n0; i++)
+    filevec[0].changed[i] = head <= i && i < n0 - tail;
+  for (i = 0; i < n1; i++)
+    filevec[1].changed[i] = head <= i && i < n1 - tail;
+}
+
 /* Cons an additional entry onto the front of an edit script OLD.
    LINE0 and LINE1 are the first affected lines in the two files (origin 0).
    DELETED is the number of lines deleted here from file 0.
    INSERTED is the number of lines inserted here in file 1.
 
    If DELETED is 0 then LINE0 is the number of the line before
-   which the insertion was done; vice versa for INSERTED and LINE1.  */
+   which the insertion was done; vice versa for INSERTED and LINE1.
+
+   The entries are carved one after another from scratch memory, so an
+   edit script already lies in one stretch of memory and costs nothing
+   to free.  */
 
 static struct change *
 add_change (lin line0, lin line1, lin deleted, lin inserted,
 	    struct change *old)
 {
-  struct change *new = xmalloc (sizeof *new);
+  struct change *new = scratch_alloc (sizeof *new);
 
   new->line0 = line0;
   new->line1 = line1;
@@ -374,43 +1452,6 @@ add_change (lin line0, lin line1, lin deleted, lin inserted,
   return new;
 }
 
-/* Scan the tables of which lines are inserted and deleted,
-   producing an edit script in reverse order.  */
-
-static struct change *
-build_reverse_script (struct file_data const filevec[])
-{
-  struct change *script = 0;
-  char *changed0 = filevec[0].changed;
-  char *changed1 = filevec[1].changed;
-  lin len0 = filevec[0].buffered_lines;
-  lin len1 = filevec[1].buffered_lines;
-
-  /* Note that changedN[lenN] does exist, and is 0.  */
-
-  lin i0 = 0, i1 = 0;
-
-  while (i0 < len0 || i1 < len1)
-    {
-      if (changed0[i0] | changed1[i1])
-	{
-	  lin line0 = i0, line1 = i1;
-
-	  /* Find # lines changed here in each file.  */
-	  while (changed0[i0]) ++i0;
-	  while (changed1[i1]) ++i1;
-
-	  /* Record this change.  */
-	  script = add_change (line0, line1, i0 - line0, i1 - line1, script);
-	}
-
-      /* We have reached lines in the two files that match each other.  */
-      i0++, i1++;
-    }
-
-  return script;
-}
-
 /* Scan the tables of which lines are inserted and deleted,
    producing an edit script in forward order.  */
 
@@ -420,7 +1461,7 @@ build_script (struct file_data const filevec[])
   struct change *script = 0;
   char *changed0 = filevec[0].changed;
   char *changed1 = filevec[1].changed;
-  lin i0 = filevec[0].buffered_lines, i1 = filevec[1].buffered_lines;
+  lin i0 = lines_settled (filevec, 0), i1 = lines_settled (filevec, 1);
 
   /* Note that changedN[-1] does exist, and is 0.  */
 
@@ -457,238 +1498,989 @@ briefly_report (int changes, struct file_data const filevec[])
 	     file_label[1] ? file_label[1] : filevec[1].name);
 }
 
-/* Report the differences of two files.  */
-int
-diff_2_files (struct comparison *cmp)
+/* Match up the lines left in the vectors of CTXT by
+   discard_confusing_lines from FILEVEC, with patience diff if
+   ALGORITHM is PATIENCE_ALGORITHM and with histogram diff otherwise.
+   Return false if memory is short.  */
+static bool
+anchored_seq (struct context *ctxt, struct file_data const filevec[],
+	      enum diff_algorithm algorithm)
+{
+  struct anchors a;
+  lin classes = filevec[0].equiv_max;
+  lin n = filevec[0].nondiscarded_lines;
+  lin m = filevec[1].nondiscarded_lines;
+
+  a.ctxt = ctxt;
+  a.count[0] = scratch_try_alloc (classes * (2 * sizeof *a.count[0]));
+  a.where = scratch_try_alloc (classes * sizeof *a.where);
+  a.next = scratch_try_alloc ((n + 1) * sizeof *a.next);
+  if (! (a.count[0] && a.where && a.next))
+    return false;
+  memset (a.count[0], 0, classes * (2 * sizeof *a.count[0]));
+  a.count[1] = a.count[0] + classes;
+  if (algorithm == PATIENCE_ALGORITHM)
+    patience_seq (0, n, 0, m, &a, 0);
+  else
+    histogram_seq (0, n, 0, m, &a);
+  return true;
+}
+
+/* Compare the lines of the text files of CMP, which read_files or
+   read_next_windows has prepared, and return the edit script.  */
+static struct change *
+script_lines (struct comparison *cmp)
+{
+  struct context ctxt;
+  struct lcs l;
+  lin diags;
+  size_t diag_memory;
+  struct change *script;
+  struct change *e;
+  char *changed[2];
+  lin const *equivs[2];
+  lin lines[2];
+  int f;
+
+  /* Allocate vectors for the results of comparison:
+     a flag for each line of each file, saying whether that line
+     is an insertion or deletion.
+     Allocate an extra element, always 0, at each end of each vector.  */
+
+  size_t s = cmp->file[0].buffered_lines + cmp->file[1].buffered_lines + 4;
+  char *flag_space = scratch_zalloc (s);
+  cmp->file[0].changed = flag_space + 1;
+  cmp->file[1].changed = flag_space + cmp->file[0].buffered_lines + 3;
+
+  /* Some lines are obviously insertions or deletions
+     because they don't match anything.  Detect them now, and
+     avoid even thinking about them in the main comparison algorithm.  */
+
+  stats_phase (STATS_DISCARD);
+  discard_confusing_lines (cmp->file);
+  stats_phase (STATS_COMPARE);
+
+  /* Now do the main comparison algorithm, considering just the
+     undiscarded lines.  */
+
+  ctxt.xvec = cmp->file[0].undiscarded;
+  ctxt.yvec = cmp->file[1].undiscarded;
+  find_runs (&ctxt, cmp->file);
+  diags = (cmp->file[0].nondiscarded_lines
+	   + cmp->file[1].nondiscarded_lines + 3);
+
+  /* The vectors of diagonals have room only for the diagonals that
+     the search reaches, which are few for files that are much alike,
+     and grow as it widens.  If they cannot, the search settles for a
+     good split rather than the best one.  */
+  ctxt.diag_room = DIAG_ROOM_MIN;
+  ctxt.fdiag = ctxt.bdiag = NULL;
+  if (! grow_diagonals (&ctxt, ctxt.diag_room))
+    costly = short_of_memory = true;
+
+  ctxt.heuristic = speed_large_files;
+
+  /* Set TOO_EXPENSIVE to be the approximate square root of the
+     input size, bounded below by 4096.  Past that many edit steps
+     'diag' settles for a good split instead of the best one, so that
+     large inputs with many scattered changes take O(N**1.5 log N)
+     time rather than O(N**2).  --minimal disables this.  */
+  ctxt.too_expensive = 1;
+  for (;  diags != 0;  diags >>= 2)
+    ctxt.too_expensive <<= 1;
+  ctxt.too_expensive = MAX (4096, ctxt.too_expensive);
+
+  files[0] = cmp->file[0];
+  files[1] = cmp->file[1];
+  progress.settled[0] = progress.settled[1] = 0;
+  start_settling ();
+  PROBE2 (compare_start, cmp->file[0].nondiscarded_lines,
+	  cmp->file[1].nondiscarded_lines);
+
+  if (costly)
+    {
+      /* The comparison is already cut short.  */
+    }
+  else if (diff_algorithm == MYERS_ALGORITHM
+	   || diff_algorithm == AUTO_ALGORITHM || minimal)
+    {
+      /* When the files are much rewritten, so that compareseq would
+	 take longer than lcs_seq, use lcs_seq instead: at once if the
+	 lines discarded suggest so, or else once compareseq has taken
+	 that long.  With --diff-algorithm=auto, use histogram diff in
+	 the same way if it would take less time than lcs_seq and the
+	 lines are mostly unique.  */
+      lin n = cmp->file[0].nondiscarded_lines;
+      lin m = cmp->file[1].nondiscarded_lines;
+      lcs_instead = histogram_instead = false;
+      if (! settling.on && LCS_LINES_MIN <= MIN (n, m))
+	{
+	  double words = 2.0 * n * (m / LCS_WORD_BITS + 1);
+	  double budget = words / LCS_DIAGONAL_WORDS;
+	  double histogram_budget = AUTO_DIAGONALS_PER_LINE * ((double) n + m);
+	  if (diff_algorithm == AUTO_ALGORITHM && ! minimal
+	      && histogram_budget < budget
+	      && (AUTO_UNIQUE_PERCENT
+		  <= unique_percent (&ctxt, cmp->file[0].equiv_max, n, m)))
+	    {
+	      budget = histogram_budget;
+	      histogram_instead = true;
+	    }
+	  if (budget < guess_diagonals (cmp->file, n, m, ctxt.too_expensive))
+	    lcs_instead = true;
+	  else if (budget < UINTMAX_MAX - stats.diagonals)
+	    lcs_budget = stats.diagonals + budget;
+	}
+      if (! lcs_instead)
+	compareseq (0, n, 0, m, minimal, &ctxt);
+      lcs_budget = 0;
+      histogram_instead &= lcs_instead;
+      if (histogram_instead)
+	{
+	  note_changes_undone (n, m);
+	  if (! anchored_seq (&ctxt, cmp->file, HISTOGRAM_ALGORITHM))
+	    costly = short_of_memory = true;
+	}
+      else if (lcs_instead)
+	{
+	  if (! lcs_start (&l, &ctxt, cmp->file[0].equiv_max, m))
+	    costly = short_of_memory = true;
+	  else
+	    {
+	      note_changes_undone (n, m);
+	      lcs_seq (0, n, 0, m, &l);
+	    }
+	}
+      if (diff_algorithm == AUTO_ALGORITHM && ! minimal)
+	{
+	  if (histogram_instead)
+	    stats.auto_histogram++;
+	  else
+	    stats.auto_myers++;
+	}
+    }
+  else if (! anchored_seq (&ctxt, cmp->file, diff_algorithm))
+    costly = short_of_memory = true;
+  PROBE1 (compare_done, costly);
+  diag_memory = 2 * (2 * ctxt.diag_room + 3) * sizeof *ctxt.fdiag;
+  free (ctxt.fdiag);
+  free (ctxt.bdiag);
+
+  if (costly)
+    {
+      settling.stopped = false;
+      mark_all_changed (cmp->file);
+    }
+  else if (settling.stopped)
+    {
+      /* Forget the changes after the line where the search stopped,
+	 which are not output.  */
+      for (f = 0; f < 2; f++)
+	memset (cmp->file[f].changed + settling.line[f], 0,
+		cmp->file[f].buffered_lines - settling.line[f]);
+    }
+
+  /* Modify the results slightly to make them prettier
+     in cases where that can validly be done.  Shifting does not change
+     how many lines are changed, so --stat and --numstat skip it unless
+     -B or -I may ignore some of them.  */
+
+  stats_phase (STATS_SHIFT);
+  if (! (STAT_OUTPUT_STYLE (output_style)
+	 && ! (ignore_blank_lines || ignore_regexp.fastmap)))
+    {
+      for (f = 0; f < 2; f++)
+	{
+	  changed[f] = cmp->file[f].changed;
+	  equivs[f] = cmp->file[f].equivs;
+	  lines[f] = lines_settled (cmp->file, f);
+	}
+      shift_boundaries (changed, equivs, lines);
+    }
+
+  /* Get the results of comparison in the form of a chain
+     of 'struct change's -- an edit script.  */
+
+  script = build_script (cmp->file);
+
+  for (e = script; e; e = e->link)
+    stats.hunks++;
+  stats_memory (files_memory (cmp->file) + scratch_size + diag_memory);
+  stats_phase (STATS_OUTPUT);
+  return script;
+}
+
+/* Free what script_lines allocated for CMP, including its script.  */
+static void
+release_lines (struct comparison *cmp)
 {
   int f;
-  struct change *e, *p;
+
+  ignorable_class = 0;
+  scratch_release ();
+
+  for (f = 0; f < 2; f++)
+    {
+      free (cmp->file[f].equivs);
+
+      /* Files that share a buffer may share their table of lines.  */
+      if (! (f && cmp->file[1].linbuf == cmp->file[0].linbuf))
+	keep_spare_block (cmp->file[f].linbuf + cmp->file[f].linbuf_base,
+			  ((cmp->file[f].alloc_lines - cmp->file[f].linbuf_base)
+			   * sizeof *cmp->file[f].linbuf));
+    }
+}
+
+/* Decide whether the text files of CMP differ, for --brief, from the
+   classes of their lines alone, stopping at the first pair of lines
+   that differ.  Return 1 if they differ, 0 if they do not, and -1 if
+   only looking for the changes can tell.  The lines that -B or -I
+   ignore are skipped, and then the files surely differ if the other
+   lines do, but whether they differ if not depends on how the changes
+   that diff would find line up with the ignored lines.  */
+static int
+brief_lines_differ (struct comparison const *cmp)
+{
+  struct file_data const *f0 = &cmp->file[0];
+  struct file_data const *f1 = &cmp->file[1];
+  lin n0 = f0->buffered_lines;
+  lin n1 = f1->buffered_lines;
+  lin i0, i1;
+
+  if (! (ignore_blank_lines || ignore_regexp.fastmap))
+    {
+      if (n0 != n1)
+	return 1;
+      for (i0 = 0; i0 < n0; i0++)
+	if (f0->equivs[i0] != f1->equivs[i0])
+	  return 1;
+      return 0;
+    }
+
+  for (i0 = i1 = 0; ; i0++, i1++)
+    {
+      while (i0 < n0 && line_is_ignorable (f0, i0))
+	i0++;
+      while (i1 < n1 && line_is_ignorable (f1, i1))
+	i1++;
+      if (i0 == n0 || i1 == n1)
+	return i0 == n0 && i1 == n1 ? -1 : 1;
+      if (f0->equivs[i0] != f1->equivs[i1])
+	return 1;
+    }
+}
+
+/* Compare the lines of the text files of CMP, which read_files or
+   read_next_windows has prepared, and output the differences unless
+   only a brief report is wanted.  Return 1 if the files differ,
+   0 otherwise.  */
+int
+diff_lines (struct comparison *cmp)
+{
   struct change *script;
   int changes;
 
+  /* A brief report needs no changes found if the classes of the
+     lines tell whether the files differ.  */
+  if (brief)
+    {
+      stats_phase (STATS_COMPARE);
+      changes = brief_lines_differ (cmp);
+      if (0 <= changes)
+	{
+	  release_lines (cmp);
+	  return changes;
+	}
+    }
 
-  /* If we have detected that either file is binary,
-     compare the two files as binary.  This can happen
-     only when the first chunk is read.
-     Also, --brief without any --ignore-* options means
-     we can speed things up by treating the files as binary.  */
+  script = script_lines (cmp);
+  while (horizon_reached (cmp->file))
+    {
+      release_lines (cmp);
+      widen_horizon (cmp->file);
+      script = script_lines (cmp);
+    }
 
-  if (read_files (cmp->file, files_can_be_treated_as_binary))
+  /* Set CHANGES if we had any diffs.
+     If some changes are ignored, we must scan the script to decide.  */
+  if (ignore_blank_lines || ignore_regexp.fastmap)
     {
-      /* Files with different lengths must be different.  */
-      if (cmp->file[0].stat.st_size != cmp->file[1].stat.st_size
-	  && (cmp->file[0].desc < 0 || S_ISREG (cmp->file[0].stat.st_mode))
-	  && (cmp->file[1].desc < 0 || S_ISREG (cmp->file[1].stat.st_mode)))
-	changes = 1;
+      struct change *next = script;
+      changes = 0;
 
-      /* Standard input equals itself.  */
-      else if (cmp->file[0].desc == cmp->file[1].desc)
-	changes = 0;
+      /* The scan and the output both classify the changed lines, so
+	 remember the answer for each class of identical lines.  */
+      if (ignore_white_space == IGNORE_NO_WHITE_SPACE && !ignore_case)
+	ignorable_class = scratch_zalloc (cmp->file[0].equiv_max
+					  * sizeof *ignorable_class);
 
-      else
-	/* Scan both files, a buffer at a time, looking for a difference.  */
-	{
-	  /* Allocate same-sized buffers for both files.  */
-	  size_t lcm_max = PTRDIFF_MAX - 1;
-	  size_t buffer_size =
-	    buffer_lcm (sizeof (word),
-			buffer_lcm (STAT_BLOCKSIZE (cmp->file[0].stat),
-				    STAT_BLOCKSIZE (cmp->file[1].stat),
-				    lcm_max),
-			lcm_max);
-
-	  /*为各file初始化buffer*/
-	  for (f = 0; f < 2; f++)
-	    cmp->file[f].buffer = xrealloc (cmp->file[f].buffer, buffer_size);
+      while (next && changes == 0)
+	{
+	  struct change *this, *end;
+	  lin first0, last0, first1, last1;
 
-	  for (;; cmp->file[0].buffered = cmp->file[1].buffered = 0)
-	    {
-	      /* Read a buffer's worth from both files.  */
-		  /*为各file的buffer加载满buffer*/
-	      for (f = 0; f < 2; f++)
-		if (0 <= cmp->file[f].desc)
-		  file_block_read (&cmp->file[f],
-				   buffer_size - cmp->file[f].buffered);
-
-	      /* If the buffers differ, the files differ.  */
-	      if (cmp->file[0].buffered != cmp->file[1].buffered
-		  || memcmp (cmp->file[0].buffer,
-			     cmp->file[1].buffer,
-			     cmp->file[0].buffered))
-		{
-	    	  /*两文件buffer不同*/
-		  changes = 1;
-		  break;
-		}
+	  /* Find a set of changes that belong together.  */
+	  this = next;
+	  end = find_change (next);
 
-	      /* If we reach end of file, the files are the same.  */
-	      if (cmp->file[0].buffered != buffer_size)
-		{
-		  changes = 0;
-		  break;
-		}
-	    }
-	}
+	  /* Disconnect them from the rest of the changes, making them
+	     a hunk, and remember the rest for next iteration.  */
+	  next = end->link;
+	  end->link = 0;
 
-      briefly_report (changes, cmp->file);
+	  /* Determine whether this hunk is really a difference.  */
+	  if (analyze_hunk (this, &first0, &last0, &first1, &last1))
+	    changes = 1;
+
+	  /* Reconnect the script so it will all be freed properly.  */
+	  end->link = next;
+	}
     }
   else
-    {
-      struct context ctxt;
-      lin diags;
+    changes = (script != 0);
+
+  if (! brief && (changes || !no_diff_means_no_output))
+    switch (output_style)
+      {
+      case OUTPUT_CONTEXT:
+	print_context_script (script, false);
+	break;
+
+      case OUTPUT_UNIFIED:
+	print_context_script (script, true);
+	break;
+
+      case OUTPUT_ED:
+	if (apply_edits)
+	  apply_ed_script (script);
+	else
+	  print_ed_script (script);
+	break;
+
+      case OUTPUT_FORWARD_ED:
+	pr_forward_ed_script (script);
+	break;
+
+      case OUTPUT_RCS:
+	print_rcs_script (script);
+	break;
 
-      /* Allocate vectors for the results of comparison:
-	 a flag for each line of each file, saying whether that line
-	 is an insertion or deletion.
-	 Allocate an extra element, always 0, at each end of each vector.  */
+      case OUTPUT_NORMAL:
+	print_normal_script (script);
+	break;
 
-      size_t s = cmp->file[0].buffered_lines + cmp->file[1].buffered_lines + 4;
-      char *flag_space = zalloc (s);
-      cmp->file[0].changed = flag_space + 1;
-      cmp->file[1].changed = flag_space + cmp->file[0].buffered_lines + 3;
+      case OUTPUT_IFDEF:
+	print_ifdef_script (script);
+	break;
 
-      /* Some lines are obviously insertions or deletions
-	 because they don't match anything.  Detect them now, and
-	 avoid even thinking about them in the main comparison algorithm.  */
+      case OUTPUT_SDIFF:
+	print_sdiff_script (script);
+	break;
 
-      discard_confusing_lines (cmp->file);
+      case OUTPUT_JSON:
+	print_json_script (script);
+	break;
 
-      /* Now do the main comparison algorithm, considering just the
-	 undiscarded lines.  */
+      case OUTPUT_MOVES:
+	print_moves_script (script);
+	break;
 
-      ctxt.xvec = cmp->file[0].undiscarded;
-      ctxt.yvec = cmp->file[1].undiscarded;
-      diags = (cmp->file[0].nondiscarded_lines
-	       + cmp->file[1].nondiscarded_lines + 3);
-      ctxt.fdiag = xmalloc (diags * (2 * sizeof *ctxt.fdiag));
-      ctxt.bdiag = ctxt.fdiag + diags;
-      ctxt.fdiag += cmp->file[1].nondiscarded_lines + 1;
-      ctxt.bdiag += cmp->file[1].nondiscarded_lines + 1;
+      case OUTPUT_WORD_DIFF:
+	print_word_diff_script (script);
+	break;
 
-      ctxt.heuristic = speed_large_files;
+      case OUTPUT_STAT:
+      case OUTPUT_NUMSTAT:
+	count_stat_script (script);
+	break;
 
-      files[0] = cmp->file[0];
-      files[1] = cmp->file[1];
+      default:
+	abort ();
+      }
+
+  /* The hunks of later windows may be in a function whose header
+     line is in this one.  */
+  if (show_function && comparing_windows ()
+      && (output_style == OUTPUT_CONTEXT || output_style == OUTPUT_UNIFIED))
+    carry_function ();
+
+  release_lines (cmp);
+  return changes;
+}
 
-      compareseq (0, cmp->file[0].nondiscarded_lines,
-		  0, cmp->file[1].nondiscarded_lines, &ctxt);
+/* If one file of CMP does not exist and is to be treated as empty,
+   and the other's lines can be output as they are, all deleted or
+   all inserted, return the index of the other.  Otherwise return -1,
+   and the files are compared as usual.  */
+static int
+lone_file (struct comparison const *cmp)
+{
+  int f;
 
-      free (ctxt.fdiag - (cmp->file[1].nondiscarded_lines + 1));
+  if (brief || max_memory || ignore_blank_lines || ignore_regexp.fastmap
+      || ignore_matching_lines_early
+      || ! (output_style == OUTPUT_NORMAL || output_style == OUTPUT_CONTEXT
+	    || output_style == OUTPUT_UNIFIED))
+    return -1;
 
-      /* Modify the results slightly to make them prettier
-	 in cases where that can validly be done.  */
+  for (f = 0; f < 2; f++)
+    if (cmp->file[f].desc == NONEXISTENT && ! cmp->file[f].retained)
+      {
+	struct file_data const *other = &cmp->file[! f];
+	return (other->desc == NONEXISTENT || other->supplied
+		|| other->retained
+		? -1 : ! f);
+      }
+
+  return -1;
+}
 
-      shift_boundaries (cmp->file);
+/* Print the range of N lines starting at the first line of a file, in
+   the unified format if UNIDIFF, and otherwise in the context format.  */
+static void
+print_lone_range (lin n, bool unidiff)
+{
+  if (n == 0)
+    fputs (unidiff ? "0,0" : "0", outfile);
+  else if (n == 1)
+    putc ('1', outfile);
+  else
+    fprintf (outfile, "1,%ld", (long int) n);
+}
 
-      /* Get the results of comparison in the form of a chain
-	 of 'struct change's -- an edit script.  */
+/* Output the lines of FILE, the one file of a comparison that exists,
+   as all inserted if INSERTED and otherwise as all deleted, in the
+   normal, context or unified format.  The lines are found as they
+   are output, with no table of them, for there is nothing to compare
+   them with.  Return 1 if there were any lines, 0 otherwise.  */
+static int
+print_lone_file (struct file_data const *file, bool inserted)
+{
+  char const *lim = FILE_BUFFER (file) + file->buffered;
+  char const *line[2];
+  char const *flag = NULL;
+  lin n = 0;
+  FILE *out;
+
+  for (line[0] = FILE_BUFFER (file); line[0] < lim;
+       line[0] = (char const *) rawmemchr (line[0], '\n') + 1)
+    n++;
+  if (! n)
+    return 0;
+
+  /* As in find_and_hash_each_line, leave out the newline appended
+     to an incomplete last line, so that print_1_line says it is
+     missing.  */
+  if (file->missing_newline)
+    lim--;
+
+  stats.hunks++;
+  begin_output ();
+  index_hunk (inserted ? 0 : n, inserted ? n : 0);
+  out = outfile;
+
+  switch (output_style)
+    {
+    case OUTPUT_NORMAL:
+      print_number_range (',', &files[0], 0, inserted ? -1 : n - 1);
+      fputc (inserted ? 'a' : 'd', out);
+      print_number_range (',', &files[1], 0, inserted ? n - 1 : -1);
+      fputc ('\n', out);
+      flag = inserted ? ">" : "<";
+      break;
+
+    case OUTPUT_CONTEXT:
+      fputs ("***************\n*** ", out);
+      print_lone_range (inserted ? 0 : n, false);
+      fputs (" ****\n", out);
+      if (inserted)
+	{
+	  fputs ("--- ", out);
+	  print_lone_range (n, false);
+	  fputs (" ----\n", out);
+	}
+      flag = inserted ? "+" : "-";
+      break;
+
+    case OUTPUT_UNIFIED:
+      fputs ("@@ -", out);
+      print_lone_range (inserted ? 0 : n, true);
+      fputs (" +", out);
+      print_lone_range (inserted ? n : 0, true);
+      fputs (" @@\n", out);
+      break;
+
+    default:
+      abort ();
+    }
 
-      if (output_style == OUTPUT_ED)
-	script = build_reverse_script (cmp->file);
+  for (line[0] = FILE_BUFFER (file); line[0] < lim; line[0] = line[1])
+    {
+      line[1] = (char const *) rawmemchr (line[0], '\n') + 1;
+      if (lim < line[1])
+	line[1] = lim;
+      if (flag)
+	print_1_line (flag, line);
       else
-	script = build_script (cmp->file);
+	{
+	  putc (inserted ? '+' : '-', out);
+	  if (initial_tab && ! (suppress_blank_empty && *line[0] == '\n'))
+	    putc ('\t', out);
+	  print_1_line (NULL, line);
+	}
+    }
+
+  if (output_style == OUTPUT_CONTEXT && ! inserted)
+    fputs ("--- 0 ----\n", out);
+
+  return 1;
+}
+
+/* Return true if the files mapped into memory in FILE[0] and FILE[1],
+   which have the same size, differ.  Holes that both files have at
+   the same offset, and data that they share, are skipped rather than
+   compared.  */
+
+static bool
+mapped_files_differ (struct file_data const file[])
+{
+  enum { CHUNK = 1024 * 1024 };
+  char const *p0 = (char const *) file[0].buffer;
+  char const *p1 = (char const *) file[1].buffer;
+  size_t size = file[0].buffered;
+  size_t pos = 0;
+  struct extent_scan extents[2];
+  int f;
 
-      /* Set CHANGES if we had any diffs.
-	 If some changes are ignored, we must scan the script to decide.  */
-      if (ignore_blank_lines || ignore_regexp.fastmap)
+  for (f = 0; f < 2; f++)
+    extent_scan_init (&extents[f], file[f].desc, &file[f].stat);
+  if (extents[0].fd < 0 || extents[1].fd < 0)
+    return memcmp (p0, p1, size) != 0;
+
+  while (pos < size)
+    {
+      bool stored;
+      off_t skip = same_extent_bytes (extents, pos, pos, &stored);
+      if (skip)
+	pos += MIN (skip, size - pos);
+      else
 	{
-	  struct change *next = script;
-	  changes = 0;
+	  size_t n = MIN (CHUNK, size - pos);
+	  if (memcmp (p0 + pos, p1 + pos, n) != 0)
+	    return true;
+	  pos += n;
+	}
+    }
 
-	  while (next && changes == 0)
-	    {
-	      struct change *this, *end;
-	      lin first0, last0, first1, last1;
+  return false;
+}
 
-	      /* Find a set of changes that belong together.  */
-	      this = next;
-	      end = find_change (next);
+/* Return 1 if the regular files of CMP differ, and 0 otherwise,
+   comparing them from where sip started reading them as --direct-io
+   asks: at explicit offsets, into buffers aligned so that the system
+   can read into them directly, and otherwise discarding what is read
+   from the cache.  Holes and data that the files share are skipped.  */
+
+static int
+direct_files_differ (struct comparison const *cmp)
+{
+  size_t lcm_max = PTRDIFF_MAX - 1;
+  size_t alignment = sizeof (word);
+  size_t buffer_size = buffer_lcm (STAT_BLOCKSIZE (cmp->file[0].stat),
+				   STAT_BLOCKSIZE (cmp->file[1].stat),
+				   lcm_max);
+  bool direct[2];
+  struct read_advice advice[2];
+  struct extent_scan extents[2];
+  off_t pos[2];
+  size_t read[2];
+  char *storage = NULL;
+  char *buf[2];
+  int changes;
+  int f;
 
-	      /* Disconnect them from the rest of the changes, making them
-		 a hunk, and remember the rest for next iteration.  */
-	      next = end->link;
-	      end->link = 0;
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data const *file = &cmp->file[f];
+      size_t a;
+
+      pos[f] = lseek (file->desc, - (off_t) file->buffered, SEEK_CUR);
+      if (pos[f] < 0)
+	pfatal_with_name (file->name);
+      a = direct_io_start (file->desc);
+      direct[f] = !!a;
+      if (a)
+	alignment = buffer_lcm (alignment, a, lcm_max);
+      read_advice_init (&advice[f], file->desc, file->stat.st_size, true);
+      read_advice_direct (&advice[f], &direct[f]);
+      extent_scan_init (&extents[f], file->desc, &file->stat);
+    }
+  buffer_size = buffer_lcm (buffer_size, alignment, lcm_max);
 
-	      /* Determine whether this hunk is really a difference.  */
-	      if (analyze_hunk (this, &first0, &last0, &first1, &last1))
-		changes = 1;
+  for (;;)
+    {
+      size_t new_size;
 
-	      /* Reconnect the script so it will all be freed properly.  */
-	      end->link = next;
-	    }
+      if (! storage)
+	{
+	  storage = xmalloc (2 * buffer_size + alignment - 1);
+	  buf[0] = storage + ((alignment - (uintptr_t) storage % alignment)
+			      % alignment);
+	  buf[1] = buf[0] + buffer_size;
 	}
-      else
-	changes = (script != 0);
 
-      if (brief)
-	briefly_report (changes, cmp->file);
-      else
+      if (0 <= extents[0].fd && 0 <= extents[1].fd)
 	{
-	  if (changes || !no_diff_means_no_output)
+	  bool stored;
+	  off_t skip = same_extent_bytes (extents, pos[0], pos[1], &stored);
+	  for (f = 0; f < 2; f++)
 	    {
-	      /* Record info for starting up output,
-		 to be used if and when we have some output to print.  */
-	      setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
-			    file_label[1] ? file_label[1] : cmp->file[1].name,
-			    cmp->parent != 0);
+	      read_advice_update (&advice[f], skip);
+	      pos[f] += skip;
+	    }
+	}
 
-	      switch (output_style)
-		{
-		case OUTPUT_CONTEXT:
-		  print_context_script (script, false);
-		  break;
+      for (f = 0; f < 2; f++)
+	{
+	  read[f] = direct_pread (cmp->file[f].desc, buf[f], buffer_size,
+				  pos[f], &direct[f]);
+	  if (read[f] == SIZE_MAX)
+	    pfatal_with_name (cmp->file[f].name);
+	  read_advice_update (&advice[f], read[f]);
+	  pos[f] += read[f];
+	}
 
-		case OUTPUT_UNIFIED:
-		  print_context_script (script, true);
-		  break;
+      if (read[0] != read[1] || memcmp (buf[0], buf[1], read[0]))
+	{
+	  changes = 1;
+	  break;
+	}
+      if (read[0] != buffer_size)
+	{
+	  changes = 0;
+	  break;
+	}
 
-		case OUTPUT_ED:
-		  print_ed_script (script);
-		  break;
+      new_size = buffer_grow (buffer_size, lcm_max);
+      if (new_size != buffer_size)
+	{
+	  free (storage);
+	  storage = NULL;
+	  buffer_size = new_size;
+	}
+    }
 
-		case OUTPUT_FORWARD_ED:
-		  pr_forward_ed_script (script);
-		  break;
+  for (f = 0; f < 2; f++)
+    if (direct[f])
+      direct_io_stop (cmp->file[f].desc);
+  free (storage);
+  return changes;
+}
 
-		case OUTPUT_RCS:
-		  print_rcs_script (script);
-		  break;
+/* Return 1 if the files of CMP, one of which read_files has found to
+   be binary, differ, and 0 otherwise.  */
 
-		case OUTPUT_NORMAL:
-		  print_normal_script (script);
-		  break;
+static int
+binary_files_differ (struct comparison *cmp)
+{
+  int f;
+  int changes;
 
-		case OUTPUT_IFDEF:
-		  print_ifdef_script (script);
-		  break;
+  /* Files with different lengths must be different.  */
+  if (cmp->file[0].stat.st_size != cmp->file[1].stat.st_size
+      && (cmp->file[0].desc < 0 || S_ISREG (cmp->file[0].stat.st_mode))
+      && (cmp->file[1].desc < 0 || S_ISREG (cmp->file[1].stat.st_mode)))
+    changes = 1;
+
+  /* A retained file has no null bytes, so it differs from any file
+     that appears binary.  */
+  else if (cmp->file[0].retained || cmp->file[1].retained)
+    changes = 1;
+
+  /* Standard input equals itself.  */
+  else if (cmp->file[0].desc == cmp->file[1].desc)
+    changes = 0;
+
+  /* Files that sip has mapped into memory can be compared
+     directly.  */
+  else if (cmp->file[0].mapped && cmp->file[1].mapped)
+    changes = (cmp->file[0].buffered != cmp->file[1].buffered
+	       || mapped_files_differ (cmp->file));
+
+  /* With --direct-io, regular files are read without filling the
+     system's cache.  */
+  else if (direct_io
+	   && 0 <= cmp->file[0].desc && S_ISREG (cmp->file[0].stat.st_mode)
+	   && 0 <= cmp->file[1].desc && S_ISREG (cmp->file[1].stat.st_mode))
+    changes = direct_files_differ (cmp);
 
-		case OUTPUT_SDIFF:
-		  print_sdiff_script (script);
-		  break;
+  else
+    /* Scan both files, a buffer at a time, looking for a difference.  */
+    {
+      /* Allocate same-sized buffers for both files.  */
+      size_t lcm_max = PTRDIFF_MAX - 1;
+      size_t buffer_size =
+	buffer_lcm (sizeof (word),
+		    buffer_lcm (STAT_BLOCKSIZE (cmp->file[0].stat),
+				STAT_BLOCKSIZE (cmp->file[1].stat),
+				lcm_max),
+		    lcm_max);
+
+      struct read_advice advice[2];
+
+      /* Holes and data that both files have in common are skipped,
+	 and need the files' offsets to be found.  */
+      struct extent_scan extents[2];
+      off_t pos[2];
+
+      /* Grow the buffers while reading regular files, which are
+	 unlikely to be interactive.  */
+      bool grow = (S_ISREG (cmp->file[0].stat.st_mode)
+		   && S_ISREG (cmp->file[1].stat.st_mode));
+
+      /*为各file初始化buffer*/
+      for (f = 0; f < 2; f++)
+	{
+	  struct file_data *file = &cmp->file[f];
 
-		default:
-		  abort ();
-		}
+	  /* Read a file that sip has mapped, like the other file.
+	     Mapping does not move the file offset.  */
+	  if (file->mapped)
+	    {
+	      file_buffer_free (file);
+	      file->buffer = NULL;
+	      file->buffered = 0;
+	      file->eof = false;
+	    }
+
+	  file->buffer = xrealloc (file->buffer, buffer_size);
+	  file->bufsize = buffer_size;
+	  read_advice_init (&advice[f], file->desc,
+			    (0 <= file->desc && S_ISREG (file->stat.st_mode)
+			     ? file->stat.st_size : -1),
+			    true);
+	  extent_scan_init (&extents[f], file->desc, &file->stat);
+	  pos[f] = (0 <= extents[f].fd
+		    ? lseek (file->desc, 0, SEEK_CUR) : -1);
+	}
+
+      for (;; cmp->file[0].buffered = cmp->file[1].buffered = 0)
+	{
+	  /* Skip any hole that both files have here, or any data
+	     that they share, as if it had been read and found
+	     equal.  */
+	  if (0 <= extents[0].fd && 0 <= extents[1].fd
+	      && ! cmp->file[0].buffered && ! cmp->file[1].buffered)
+	    {
+	      bool stored;
+	      off_t skip = same_extent_bytes (extents, pos[0], pos[1],
+					      &stored);
+	      if (skip)
+		for (f = 0; f < 2; f++)
+		  {
+		    if (lseek (cmp->file[f].desc, skip, SEEK_CUR) < 0)
+		      pfatal_with_name (cmp->file[f].name);
+		    read_advice_update (&advice[f], skip);
+		    pos[f] += skip;
+		  }
+	    }
+
+	  /* Read a buffer's worth from both files.  */
+	      /*为各file的buffer加载满buffer*/
+	  for (f = 0; f < 2; f++)
+	    if (0 <= cmp->file[f].desc)
+	      {
+		size_t buffered = cmp->file[f].buffered;
+		file_block_read (&cmp->file[f], buffer_size - buffered);
+		read_advice_update (&advice[f],
+				    cmp->file[f].buffered - buffered);
+		pos[f] += cmp->file[f].buffered - buffered;
+	      }
+
+	  /* If the buffers differ, the files differ.  */
+	  if (cmp->file[0].buffered != cmp->file[1].buffered
+	      || memcmp (cmp->file[0].buffer,
+			 cmp->file[1].buffer,
+			 cmp->file[0].buffered))
+	    {
+	      /*两文件buffer不同*/
+	      changes = 1;
+	      break;
+	    }
 
-	      finish_output ();
+	  /* If we reach end of file, the files are the same.  */
+	  if (cmp->file[0].buffered != buffer_size)
+	    {
+	      changes = 0;
+	      break;
+	    }
+
+	  if (grow)
+	    {
+	      size_t new_size = buffer_grow (buffer_size, lcm_max);
+	      if (new_size != buffer_size)
+		for (f = 0; f < 2; f++)
+		  {
+		    free (cmp->file[f].buffer);
+		    cmp->file[f].buffer = xmalloc (new_size);
+		    cmp->file[f].bufsize = new_size;
+		  }
+	      buffer_size = new_size;
 	    }
 	}
+    }
 
-      free (cmp->file[0].undiscarded);
+  return changes;
+}
 
-      free (flag_space);
+/* Return true if the files of CMP are regular files of the same size
+   whose bytes, read a buffer at a time from their current offsets,
+   are all the same.  The offsets do not move, and the files are never
+   read whole into memory, so files that are the same cost two small
+   buffers rather than two copies of their text.  Holes and data that
+   the files share are skipped rather than read.  */
+static bool
+same_regular_files (struct comparison const *cmp)
+{
+  enum { CHUNK = 64 * 1024 };
+  struct extent_scan extents[2];
+  off_t pos[2];
+  off_t left;
+  char *buf;
+  bool same = true;
+  int f;
 
-      for (f = 0; f < 2; f++)
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data const *file = &cmp->file[f];
+      if (! (0 <= file->desc && S_ISREG (file->stat.st_mode))
+	  || file->retained || file->supplied)
+	return false;
+    }
+  if (cmp->file[0].desc == cmp->file[1].desc
+      || cmp->file[0].stat.st_size != cmp->file[1].stat.st_size)
+    return false;
+
+  /* With --direct-io, compare them without filling the cache.  */
+  if (direct_io)
+    return ! direct_files_differ (cmp);
+
+  for (f = 0; f < 2; f++)
+    {
+      pos[f] = lseek (cmp->file[f].desc, 0, SEEK_CUR);
+      if (pos[f] < 0)
+	return false;
+      extent_scan_init (&extents[f], cmp->file[f].desc, &cmp->file[f].stat);
+    }
+  if (pos[0] != pos[1])
+    return false;
+  left = cmp->file[0].stat.st_size - pos[0];
+
+  buf = xmalloc (2 * CHUNK);
+  while (same && 0 < left)
+    {
+      bool stored;
+      off_t n = same_extent_bytes (extents, pos[0], pos[1], &stored);
+      if (n)
+	n = MIN (n, left);
+      else
 	{
-	  free (cmp->file[f].equivs);
-	  free (cmp->file[f].linbuf + cmp->file[f].linbuf_base);
+	  n = MIN (CHUNK, left);
+	  same = (pread (cmp->file[0].desc, buf, n, pos[0]) == n
+		  && pread (cmp->file[1].desc, buf + CHUNK, n, pos[1]) == n
+		  && memcmp (buf, buf + CHUNK, n) == 0);
 	}
+      pos[0] += n;
+      pos[1] += n;
+      left -= n;
+    }
+  free (buf);
+  return same;
+}
 
-      for (e = script; e; e = p)
+/* Report the differences of two files.  */
+int
+diff_2_files (struct comparison *cmp)
+{
+  int f;
+  int changes;
+  int lone = lone_file (cmp);
+
+  /* Most files compared with -r are often the same.  If nothing is
+     output for files that are the same, find out whether they are
+     before reading them into memory.  If the files can be compared
+     as binary, that comparison reads them a buffer at a time anyway.
+     ed scripts warn about a missing newline even then.  */
+  if (no_diff_means_no_output && ! files_can_be_treated_as_binary
+      && ROBUST_OUTPUT_STYLE (output_style)
+      && same_regular_files (cmp))
+    {
+      stats.files++;
+      return 0;
+    }
+
+  /* If we have detected that either file is binary,
+     compare the two files as binary.  This can happen
+     only when the first chunk is read.
+     Also, --brief without any --ignore-* options means
+     we can speed things up by treating the files as binary.  */
+
+  if (0 <= lone
+      ? read_lone_file (cmp->file, lone)
+      : read_files (cmp->file, files_can_be_treated_as_binary))
+    {
+      changes = binary_files_differ (cmp);
+      stats_phase (STATS_OTHER);
+      if (changes && ! brief && STAT_OUTPUT_STYLE (output_style))
+	stat_pair (file_label[1] ? file_label[1] : cmp->file[1].name, true);
+      else if (! (changes && ! brief && binary_delta
+		  && print_binary_delta (cmp)))
+	briefly_report (changes, cmp->file);
+    }
+  else
+    {
+      /* Record info for starting up output,
+	 to be used if and when we have some output to print.  */
+      if (! brief)
+	setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
+		      file_label[1] ? file_label[1] : cmp->file[1].name,
+		      cmp->parent != 0);
+
+      /* Compare the files, a window at a time if they are too large
+	 for --max-memory.  */
+      changes = 0;
+      start_cost ();
+      if (0 <= lone)
 	{
-	  p = e->link;
-	  free (e);
+	  files[0] = cmp->file[0];
+	  files[1] = cmp->file[1];
+	  stats_memory (files_memory (cmp->file));
+	  stats_phase (STATS_OUTPUT);
+	  changes = print_lone_file (&cmp->file[lone], lone == 1);
 	}
+      else if (windows_are_remote ())
+	changes = compare_remotely (cmp);
+      else
+	do
+	  changes |= diff_lines (cmp);
+	while (! (brief && changes) && read_next_windows (cmp->file));
+
+      if (costly && ! brief)
+	error (0, 0, (short_of_memory
+		      ? _("%s and %s: not enough memory to compare in detail;"
+			  " differences are shown coarsely")
+		      : _("%s and %s: too costly to compare in detail;"
+			  " differences are shown coarsely")),
+	       file_label[0] ? file_label[0] : cmp->file[0].name,
+	       file_label[1] ? file_label[1] : cmp->file[1].name);
+
+      if (brief)
+	briefly_report (changes, cmp->file);
+      else
+	finish_output ();
+      if (changes && ! brief && STAT_OUTPUT_STYLE (output_style))
+	stat_pair (file_label[1] ? file_label[1] : cmp->file[1].name, false);
+      stats_phase (STATS_OTHER);
 
       if (! ROBUST_OUTPUT_STYLE (output_style))
 	for (f = 0; f < 2; ++f)
@@ -702,8 +2494,45 @@ diff_2_files (struct comparison *cmp)
     }
 
   if (cmp->file[0].buffer != cmp->file[1].buffer)
-    free (cmp->file[0].buffer);
-  free (cmp->file[1].buffer);
+    file_buffer_free (&cmp->file[0]);
+  file_buffer_free (&cmp->file[1]);
+
+  return changes;
+}
+
+/* Compare the text files of CMP as diff_2_files does, but instead of
+   outputting the differences, pass each edit script to CONSUME along
+   with the files whose lines it refers to and ARG.  The files are
+   compared a window at a time if they are too large for --max-memory,
+   with a script for each window; each script is freed when CONSUME
+   returns, and the next window overwrites the lines it refers to.
+   The files' buffers are left for the caller to free with
+   file_buffer_free.  Return 1 if the files
+   differ, 0 if they do not, and -1 if either is binary and they
+   differ.  */
+int
+script_2_files (struct comparison *cmp,
+		void (*consume) (struct change *, struct file_data const[],
+				 void *),
+		void *arg)
+{
+  int changes;
+
+  if (read_files (cmp->file, false))
+    changes = - binary_files_differ (cmp);
+  else
+    {
+      changes = 0;
+      start_cost ();
+      do
+	{
+	  struct change *script = script_lines (cmp);
+	  changes |= script != 0;
+	  consume (script, cmp->file, arg);
+	  release_lines (cmp);
+	}
+      while (read_next_windows (cmp->file));
+    }
 
   return changes;
 }
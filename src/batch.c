@@ -0,0 +1,282 @@
+/* Run jobs read from standard input, each in a child process.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "system.h"
+#include "batch.h"
+
+#if HAVE_WORKING_FORK
+
+#include <error.h>
+#include <getopt.h>
+#include <inttostr.h>
+#include <signal.h>
+#include <xalloc.h>
+#include <xfreopen.h>
+
+/* With --batch, diff and diff3 read jobs from standard input and run
+   each in a child process forked from the batch process, up to
+   BATCH_JOBS at a time, so that startup is paid for only once.  A job
+   consists of the arguments the program would be given on the command
+   line, each terminated by a null byte, followed by an empty argument.
+   Each child writes its standard output and standard error to
+   temporary files.  For each job, in the order the jobs were read,
+   the batch process outputs a line giving the child's exit status
+   and the sizes of the two files, followed by their contents.  Jobs
+   are started as soon as they are read, and a job's results are
+   output once the queue of BATCH_JOBS jobs is full or the input has
+   ended.  */
+
+struct batch_job
+{
+  pid_t pid;
+
+  /* Temporary files for the child's stdout and stderr.  */
+  int out, err;
+};
+
+/* A circular queue of BATCH_JOBS jobs, of which PENDING_BATCH_JOBS
+   starting at FIRST_BATCH_JOB have been started and not yet
+   finished.  */
+static struct batch_job *batch_job;
+static int batch_jobs = 1;
+static int first_batch_job;
+static int pending_batch_jobs;
+
+/* Whether this process is running a job of a batch.  */
+static bool batch_child;
+
+/* Return a temporary file descriptor for a child's output.  */
+
+static int
+batch_temp (void)
+{
+  FILE *f = tmpfile ();
+  if (! f)
+    error (EXIT_TROUBLE, errno, "%s", "tmpfile");
+  return fileno (f);
+}
+
+/* Return the size of the temporary file FD.  */
+
+static off_t
+batch_output_size (int fd)
+{
+  struct stat st;
+  if (fstat (fd, &st) != 0)
+    error (EXIT_TROUBLE, errno, "%s", "fstat");
+  return st.st_size;
+}
+
+/* Copy the contents of the temporary file FD to stdout, and empty FD.  */
+
+static void
+copy_batch_output (int fd)
+{
+  char buf[16 * 1024];
+  ssize_t n;
+
+  if (lseek (fd, 0, SEEK_SET) != 0)
+    error (EXIT_TROUBLE, errno, "%s", "lseek");
+  while ((n = read (fd, buf, sizeof buf)) != 0)
+    {
+      if (n < 0)
+	error (EXIT_TROUBLE, errno, "%s", _("read failed"));
+      fwrite (buf, sizeof (char), n, stdout);
+    }
+  if (lseek (fd, 0, SEEK_SET) != 0 || ftruncate (fd, 0) != 0)
+    error (EXIT_TROUBLE, errno, "%s", "ftruncate");
+}
+
+/* Flush standard output, so that a reader sees each result as soon
+   as it is complete and children do not inherit buffered output.  */
+
+static void
+flush_batch_output (void)
+{
+  if (fflush (stdout) != 0 || ferror (stdout))
+    error (EXIT_TROUBLE, errno, "%s", _("write failed"));
+}
+
+/* Wait for the oldest pending job, and output its results.  */
+
+static void
+finish_batch_job (void)
+{
+  struct batch_job *j = &batch_job[first_batch_job];
+  char outbuf[INT_BUFSIZE_BOUND (off_t)];
+  char errbuf[INT_BUFSIZE_BOUND (off_t)];
+  int wstatus;
+
+  if (waitpid (j->pid, &wstatus, 0) < 0)
+    error (EXIT_TROUBLE, errno, "%s", "waitpid");
+  first_batch_job = (first_batch_job + 1) % batch_jobs;
+  pending_batch_jobs--;
+
+  printf ("%d %s %s\n",
+	  WIFEXITED (wstatus) ? WEXITSTATUS (wstatus) : EXIT_TROUBLE,
+	  offtostr (batch_output_size (j->out), outbuf),
+	  offtostr (batch_output_size (j->err), errbuf));
+  copy_batch_output (j->out);
+  copy_batch_output (j->err);
+  flush_batch_output ();
+}
+
+/* Read the next job from standard input, and return its arguments as
+   a null-terminated vector whose element 0 is left for the program
+   name, storing their number (counting element 0) into *PARGC and
+   the buffer that holds them into *PBUF.  Return a null pointer at
+   the end of the input.  */
+
+static char **
+read_batch_job (int *pargc, char **pbuf)
+{
+  char *buf = NULL;
+  size_t size = 0;
+  size_t alloc = 0;
+  int args = 0;
+  char **argv;
+  char *p;
+  int c;
+  int i;
+
+  while ((c = getc (stdin)) != EOF)
+    {
+      if (size == alloc)
+	buf = x2realloc (buf, &alloc);
+      buf[size++] = c;
+      if (c == '\0')
+	{
+	  /* An empty argument ends the job.  */
+	  if (size == 1 || buf[size - 2] == '\0')
+	    break;
+	  if (args == INT_MAX - 2)
+	    xalloc_die ();
+	  args++;
+	}
+    }
+
+  if (c == EOF)
+    {
+      if (ferror (stdin))
+	error (EXIT_TROUBLE, errno, "%s", _("read failed"));
+      if (size)
+	error (EXIT_TROUBLE, 0, "%s", _("incomplete batch job"));
+      return NULL;
+    }
+
+  argv = xnmalloc (args + 2, sizeof *argv);
+  argv[0] = NULL;
+  for (i = 1, p = buf; i <= args; i++, p += strlen (p) + 1)
+    argv[i] = p;
+  argv[i] = NULL;
+
+  *pargc = args + 1;
+  *pbuf = buf;
+  return argv;
+}
+
+/* Act on --batch, whose argument is JOBS_ARG, with *PARGC and *PARGV
+   being the command line.  Run the jobs that standard input holds,
+   and exit.  In each child, though, return with the job's arguments
+   in *PARGC and *PARGV, for getopt_long to parse afresh.  Report
+   usage errors with TRY_HELP.  */
+
+void
+run_batch (int *pargc, char ***pargv, char const *jobs_arg,
+	   void (*try_help) (char const *, char const *))
+{
+  char *buf;
+  char **argv;
+  int argc;
+  int i;
+
+  if (batch_child)
+    try_help ("--batch cannot be used in a batch job", 0);
+  if (optind != 2 || optind < *pargc)
+    try_help ("--batch must be the only argument", 0);
+  if (jobs_arg)
+    {
+      char *numend;
+      uintmax_t numval = strtoumax (jobs_arg, &numend, 10);
+      if (*numend || ! numval)
+	try_help ("invalid --batch value '%s'", jobs_arg);
+      batch_jobs = MIN (numval, INT_MAX);
+    }
+
+#ifdef SIGCHLD
+  /* System V fork+wait does not work if SIGCHLD is ignored.  */
+  signal (SIGCHLD, SIG_DFL);
+#endif
+
+  batch_job = xnmalloc (batch_jobs, sizeof *batch_job);
+  for (i = 0; i < batch_jobs; i++)
+    batch_job[i].out = batch_job[i].err = -1;
+
+  while ((argv = read_batch_job (&argc, &buf)))
+    {
+      struct batch_job *j
+	= &batch_job[(first_batch_job + pending_batch_jobs) % batch_jobs];
+      int fd;
+
+      if (j->out < 0)
+	{
+	  j->out = batch_temp ();
+	  j->err = batch_temp ();
+	}
+
+      j->pid = fork ();
+      if (j->pid == 0)
+	{
+	  if (dup2 (j->out, STDOUT_FILENO) < 0
+	      || dup2 (j->err, STDERR_FILENO) < 0)
+	    error (EXIT_TROUBLE, errno, "%s", "dup2");
+
+	  /* The jobs are on standard input, so give the job none.  */
+	  fd = open (NULL_DEVICE, O_RDONLY);
+	  if (fd < 0 || dup2 (fd, STDIN_FILENO) < 0)
+	    error (EXIT_TROUBLE, errno, "%s", NULL_DEVICE);
+	  close (fd);
+	  xfreopen (NULL_DEVICE, "r", stdin);
+
+	  batch_child = true;
+	  argv[0] = (*pargv)[0];
+	  *pargc = argc;
+	  *pargv = argv;
+	  optind = 0;
+	  return;
+	}
+      if (j->pid < 0)
+	error (EXIT_TROUBLE, errno, "%s", "fork");
+      pending_batch_jobs++;
+
+      free (argv);
+      free (buf);
+
+      /* With one job at a time, output each result before reading the
+	 next job, so that a client can wait for it.  */
+      if (pending_batch_jobs == batch_jobs)
+	finish_batch_job ();
+    }
+
+  while (pending_batch_jobs)
+    finish_batch_job ();
+  exit (EXIT_SUCCESS);
+}
+
+#endif
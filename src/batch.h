@@ -0,0 +1,24 @@
+/* Run jobs read from standard input, each in a child process.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#if HAVE_WORKING_FORK
+/* Used by diff and diff3 for --batch.  */
+extern void run_batch (int *, char ***, char const *,
+		       void (*) (char const *, char const *));
+#endif
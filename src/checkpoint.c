@@ -0,0 +1,291 @@
+/* Checkpoints of recursive comparisons for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+
+#include <error.h>
+#include <timespec.h>
+#include <xalloc.h>
+
+/* With --checkpoint=FILE, diff records in FILE, every
+   CHECKPOINT_INTERVAL seconds and when it finishes, the last pair of
+   files in the directories being compared whose comparison has
+   finished, and the largest exit status so far.  With --resume=FILE,
+   it skips that pair and all pairs before it, at every depth, in the
+   order in which diff_dirs compares them, and exits with at least
+   that status.  The output of the pairs before the checkpoint is
+   flushed before the checkpoint is written, and if standard output is
+   a regular file, FILE records how large it was then, so that a run
+   resumed with its output appended to the same file first cuts off
+   what followed, and the file ends up as if there had been one run.
+
+   FILE holds a header; the status, the size of the output or -1, and
+   the device and inode numbers of the output, as one null-terminated
+   field; and the names on the path from the top directories to the
+   pair, each followed by a null byte.  */
+
+static char const checkpoint_header[] = "GNU diff checkpoint 1";
+
+enum { CHECKPOINT_INTERVAL = 10 };
+
+/* A path of names relative to the top directories, each followed by a
+   null byte, and how many names it has.  */
+struct checkpoint_path
+{
+  char *names;
+  size_t used;
+  size_t alloc;
+  size_t depth;
+};
+
+/* The pair being compared, and the last pair whose comparison has
+   finished.  */
+static struct checkpoint_path current;
+static struct checkpoint_path finished;
+
+/* The pair to resume after, and how many names at the start of
+   CURRENT are the same as its.  */
+static struct checkpoint_path resumed;
+static size_t resumed_depth;
+
+/* Whether --resume was given, and the largest exit status so far.  */
+static bool resuming;
+static int checkpoint_status;
+
+/* When the next checkpoint is due, if the time has been set.  */
+static struct timespec checkpoint_due;
+
+/* Whether standard output is a regular file.  */
+static signed char output_is_regular = -1;
+
+/* Return the name at DEPTH in the path P, which must have one.  */
+
+static char const *
+path_name (struct checkpoint_path const *p, size_t depth)
+{
+  char const *name = p->names;
+  for (; depth; depth--)
+    name += strlen (name) + 1;
+  return name;
+}
+
+/* Read the checkpoint NAME for --resume, and make the comparison skip
+   the pairs before it.  If standard output is the regular file that
+   the checkpoint's run was writing to, cut it off where that run's
+   output was when the checkpoint was written.  Do nothing if NAME
+   does not exist, as happens the first time a run that is to be
+   resumed is started.  Return the exit status that NAME records.  */
+
+int
+resume_checkpoint (char const *name)
+{
+  FILE *fp;
+  char *buf = NULL;
+  size_t bufsize = 0;
+  size_t used = 0;
+  char const *p;
+  char const *lim;
+  intmax_t size;
+  uintmax_t dev, ino;
+  int status;
+  struct stat st;
+
+  resuming = true;
+  fp = fopen (name, "rb");
+  if (! fp)
+    {
+      if (errno != ENOENT)
+	pfatal_with_name (name);
+      return EXIT_SUCCESS;
+    }
+
+  for (;;)
+    {
+      size_t bytes;
+      if (used == bufsize)
+	buf = x2realloc (buf, &bufsize);
+      bytes = fread (buf + used, 1, bufsize - used, fp);
+      if (! bytes)
+	break;
+      used += bytes;
+    }
+  if (ferror (fp) || fclose (fp) != 0)
+    pfatal_with_name (name);
+
+  lim = buf + used;
+  p = (sizeof checkpoint_header <= used
+       ? memchr (buf + sizeof checkpoint_header, 0,
+		 used - sizeof checkpoint_header)
+       : NULL);
+  if (! (p
+	 && memcmp (buf, checkpoint_header, sizeof checkpoint_header) == 0
+	 && sscanf (buf + sizeof checkpoint_header,
+		    "%d %"SCNdMAX" %"SCNuMAX" %"SCNuMAX,
+		    &status, &size, &dev, &ino) == 4
+	 && EXIT_SUCCESS <= status && status <= EXIT_TROUBLE
+	 && ! lim[-1]))
+    error (EXIT_TROUBLE, 0, _("%s: not a diff checkpoint"), name);
+
+  resumed.used = lim - ++p;
+  resumed.names = xmemdup (p, resumed.used);
+  for (; p < lim; p += strlen (p) + 1)
+    resumed.depth++;
+  free (buf);
+
+  if (0 <= size && fstat (STDOUT_FILENO, &st) == 0 && S_ISREG (st.st_mode)
+      && st.st_dev == dev && st.st_ino == ino && size <= st.st_size
+      && (ftruncate (STDOUT_FILENO, size) != 0
+	  || lseek (STDOUT_FILENO, size, SEEK_SET) < 0))
+    pfatal_with_name (_("standard output"));
+
+  checkpoint_status = status;
+  return status;
+}
+
+/* Return the name of the pair to resume after, or of the directory on
+   the way to it, among those of the directories being compared, or
+   null if they are not on its path.  Set *LAST to whether the name is
+   that of the pair itself.  */
+
+char const *
+resume_point (bool *last)
+{
+  if (! (resumed_depth == current.depth && current.depth < resumed.depth))
+    return NULL;
+  *last = current.depth + 1 == resumed.depth;
+  return path_name (&resumed, current.depth);
+}
+
+/* Note that the pair NAME in the directories being compared is being
+   compared.  */
+
+void
+checkpoint_begin (char const *name)
+{
+  size_t size;
+
+  if (! (checkpoint_name || resuming))
+    return;
+
+  if (resumed_depth == current.depth && current.depth < resumed.depth
+      && STREQ (name, path_name (&resumed, current.depth)))
+    resumed_depth++;
+
+  size = strlen (name) + 1;
+  while (current.alloc - current.used < size)
+    current.names = x2realloc (current.names, &current.alloc);
+  memcpy (current.names + current.used, name, size);
+  current.used += size;
+  current.depth++;
+}
+
+/* Write a checkpoint to checkpoint_name after the pair FINISHED,
+   with the exit status STATUS, replacing the last one.  */
+
+static void
+write_checkpoint (int status)
+{
+  char *temp = concat (checkpoint_name, ".tmp", "");
+  intmax_t size = -1;
+  struct stat st;
+  FILE *fp;
+
+  if (fflush (stdout) != 0)
+    pfatal_with_name (_("write failed"));
+  if (output_is_regular < 0)
+    output_is_regular = (fstat (STDOUT_FILENO, &st) == 0
+			 && S_ISREG (st.st_mode));
+  if (output_is_regular
+      && (fsync (STDOUT_FILENO) != 0
+	  || fstat (STDOUT_FILENO, &st) != 0
+	  || (size = lseek (STDOUT_FILENO, 0, SEEK_CUR)) < 0))
+    pfatal_with_name (_("standard output"));
+
+  fp = fopen (temp, "wb");
+  if (! fp)
+    pfatal_with_name (temp);
+  fwrite (checkpoint_header, 1, sizeof checkpoint_header, fp);
+  fprintf (fp, "%d %"PRIdMAX" %"PRIuMAX" %"PRIuMAX, status, size,
+	   output_is_regular ? (uintmax_t) st.st_dev : 0,
+	   output_is_regular ? (uintmax_t) st.st_ino : 0);
+  putc ('\0', fp);
+  if (finished.used)
+    fwrite (finished.names, 1, finished.used, fp);
+  if (ferror (fp) | (fflush (fp) != 0) | (fsync (fileno (fp)) != 0)
+      | (fclose (fp) != 0))
+    pfatal_with_name (temp);
+  if (rename (temp, checkpoint_name) != 0)
+    pfatal_with_name (checkpoint_name);
+  free (temp);
+}
+
+/* Note that the comparison of the pair that checkpoint_begin was last
+   called for, and not yet ended, has finished with the status VAL,
+   and write a checkpoint if one is due.  */
+
+void
+checkpoint_end (int val)
+{
+  struct timespec now;
+
+  if (! (checkpoint_name || resuming))
+    return;
+
+  if (checkpoint_status < val)
+    checkpoint_status = val;
+  while (finished.alloc < current.used)
+    finished.names = x2realloc (finished.names, &finished.alloc);
+  memcpy (finished.names, current.names, current.used);
+  finished.used = current.used;
+  finished.depth = current.depth;
+
+  current.depth--;
+  current.used--;
+  while (current.used && current.names[current.used - 1])
+    current.used--;
+  if (current.depth < resumed_depth)
+    resumed_depth = current.depth;
+
+  if (! checkpoint_name)
+    return;
+  gettime (&now);
+  if (! checkpoint_due.tv_sec)
+    {
+      checkpoint_due = now;
+      checkpoint_due.tv_sec += CHECKPOINT_INTERVAL;
+    }
+  else if (0 <= timespec_cmp (now, checkpoint_due))
+    {
+      write_checkpoint (checkpoint_status);
+      checkpoint_due = now;
+      checkpoint_due.tv_sec += CHECKPOINT_INTERVAL;
+    }
+}
+
+/* Write the last checkpoint, with the exit status STATUS of the whole
+   run.  A run resumed from it skips all the pairs that this one, and
+   any that it resumed, compared.  */
+
+void
+finish_checkpoint (int status)
+{
+  if (! finished.used)
+    finished = resumed;
+  write_checkpoint (status);
+}
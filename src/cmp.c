@@ -17,6 +17,10 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "system.h"
+#include "decompress.h"
+#include "filestat.h"
+#include "mapwatch.h"
+#include "numa.h"
 #include "paths.h"
 
 #include <stdio.h>
@@ -30,6 +34,7 @@
 #include <hard-locale.h>
 #include <inttostr.h>
 #include <progname.h>
+#include <sha256.h>
 #include <unlocked-io.h>
 #include <version-etc.h>
 #include <xalloc.h>
@@ -50,10 +55,24 @@
 #endif
 
 static int cmp (void);
+static int cmp_many (int, char *const *);
+static int emit_hashes (void);
+static int compare_hashes (void);
+static int compare_chunks (void);
+static void open_input (int);
+static void discard_input (int, char const *, off_t);
+static void skip_initial (int);
+static size_t read_input (int, char *, size_t, off_t);
+static void compare_parts (void);
+static void allocate_buffers (void);
 static off_t file_position (int);
+static off_t input_size (int);
+static off_t count_lines_before (off_t);
 static size_t block_compare (word const *, word const *) _GL_ATTRIBUTE_PURE;
-static size_t count_newlines (char *, size_t);
 static void sprintc (char *, unsigned char);
+static void print_first_difference (char const *, char const *, off_t, off_t,
+				    unsigned char, unsigned char);
+static void print_differing_bytes (off_t, int, unsigned char, unsigned char);
 
 /* Filenames of the compared files.  */
 static char const *file[2];
@@ -64,8 +83,17 @@ static int file_desc[2];
 /* Status of the files.  */
 static struct stat stat_buf[2];
 
-/* Read buffers for the files.  */
+/* Read buffers for the files, and the storage they were carved from.  */
 static word *buffer[2];
+static void *buffer_storage;
+
+/* With --direct-io, the files are read without filling the system's
+   cache: directly into buffers aligned to DIRECT_ALIGNMENT if
+   DIRECT[F], and otherwise through the cache, discarding the data
+   once it is read.  */
+static bool direct_io;
+static bool direct[2];
+static size_t direct_alignment;
 
 /* Optimal block size for the files.  */
 static size_t buf_size;
@@ -76,6 +104,63 @@ static off_t ignore_initial[2];
 /* Number of bytes to compare.  */
 static uintmax_t bytes = UINTMAX_MAX;
 
+/* Number of bytes, and of newlines among them, that compare_parts
+   found identical after the ignored initial bytes.  */
+static off_t skipped_bytes;
+static off_t skipped_lines;
+
+/* Compare regular files in up to this many parts at once.  */
+static int jobs = 1;
+
+/* With --emit-hashes or --against-hashes=LIST, FILE1 is not compared
+   with another file, but with the SHA-256 digests of the blocks of a
+   file that need not be at hand.  --emit-hashes outputs a header,
+   the digest of each block of HASH_BLOCK_SIZE bytes in hexadecimal,
+   and the number of bytes hashed, one per line; and
+   --against-hashes=LIST reads such output from LIST.  */
+static bool emit_hashes_option;
+static char const *against_hashes;
+
+enum { HASH_BLOCK_SIZE = 64 * 1024 };
+
+static char const hashes_header[] = "GNU cmp hashes 1";
+
+/* With --chunks, the files are cut into chunks where the bytes before
+   the cut have a certain rolling hash, so that an insertion or
+   deletion moves the cuts near it but no others, and the byte ranges
+   of the chunks of each file that are not in the other are output.
+   Chunks are between CHUNK_MIN and CHUNK_MAX bytes long, and about
+   CHUNK_MIN plus 1 << CHUNK_BITS bytes on average.  */
+static bool chunks_option;
+
+enum { CHUNK_MIN = 2 * 1024, CHUNK_BITS = 13, CHUNK_MAX = 64 * 1024 };
+
+/* With --from-file=REF, each operand is compared with REF, which is
+   read only once.  */
+static char const *from_file;
+
+#if USE_MMAP
+/* Regular files with at least MMAP_THRESHOLD bytes to compare are
+   mapped into memory MMAP_WINDOW bytes at a time rather than read,
+   so that their data is not copied out of the page cache.  Files
+   large enough to be discarded from the cache are still read, as
+   their data is unlikely to be cached, and faulting it in page by
+   page is slower than reading it.  */
+enum { MMAP_THRESHOLD = 1024 * 1024, MMAP_WINDOW = 8 * 1024 * 1024 };
+
+/* The part of each file that is mapped, if any.  */
+static struct
+{
+  void *region;
+  size_t size;
+} window[2];
+
+static bool map_windows (off_t, size_t, char const *[2], size_t[2]);
+static void unmap_window (int);
+static size_t first_difference (char const *, char const *, size_t)
+  _GL_ATTRIBUTE_PURE;
+#endif
+
 /* Output format.  */
 static enum comparison_type
   {
@@ -88,17 +173,41 @@ static enum comparison_type
 /* If nonzero, print values of bytes quoted like cat -t does. */
 static bool opt_print_bytes;
 
+#if HAVE_WORKING_FORK
+/* Compare the text of compressed files rather than the files
+   (--decompress).  */
+static bool decompress;
+#else
+enum { decompress = false };
+#endif
+
 /* Values for long options that do not have single-letter equivalents.  */
 enum
 {
-  HELP_OPTION = CHAR_MAX + 1
+  HELP_OPTION = CHAR_MAX + 1,
+  AGAINST_HASHES_OPTION,
+  CACHED_STAT_OPTION,
+  CHUNKS_OPTION,
+  DECOMPRESS_OPTION,
+  DIRECT_IO_OPTION,
+  EMIT_HASHES_OPTION,
+  FROM_FILE_OPTION,
+  JOBS_OPTION
 };
 
 static struct option const long_options[] =
 {
+  {"against-hashes", 1, 0, AGAINST_HASHES_OPTION},
   {"print-bytes", 0, 0, 'b'},
   {"print-chars", 0, 0, 'c'}, /* obsolescent as of diffutils 2.7.3 */
+  {"cached-stat", 0, 0, CACHED_STAT_OPTION},
+  {"chunks", 0, 0, CHUNKS_OPTION},
+  {"decompress", 0, 0, DECOMPRESS_OPTION},
+  {"direct-io", 0, 0, DIRECT_IO_OPTION},
+  {"emit-hashes", 0, 0, EMIT_HASHES_OPTION},
+  {"from-file", 1, 0, FROM_FILE_OPTION},
   {"ignore-initial", 1, 0, 'i'},
+  {"jobs", 1, 0, JOBS_OPTION},
   {"verbose", 0, 0, 'l'},
   {"bytes", 1, 0, 'n'},
   {"silent", 0, 0, 's'},
@@ -158,10 +267,22 @@ check_stdout (void)
 }
 
 static char const * const option_help_msgid[] = {
+  N_("    --against-hashes=LIST  compare FILE1 with the block hashes in LIST"),
   N_("-b, --print-bytes          print differing bytes"),
+  N_("    --cached-stat          use the file status that network file\n"
+     "                             systems have cached"),
+  N_("    --chunks               output the byte ranges of each file that\n"
+     "                             are not in the other"),
+  N_("    --decompress           compare the text of files compressed by\n"
+     "                             gzip, bzip2, xz or zstd"),
+  N_("    --direct-io            read files without filling the system's cache"),
+  N_("    --emit-hashes          output block hashes of FILE1 for\n"
+     "                             --against-hashes"),
+  N_("    --from-file=REF        compare REF with each FILE operand"),
   N_("-i, --ignore-initial=SKIP         skip first SKIP bytes of both inputs"),
   N_("-i, --ignore-initial=SKIP1:SKIP2  skip first SKIP1 bytes of FILE1 and\n"
      "                                      first SKIP2 bytes of FILE2"),
+  N_("    --jobs=NUM             compare regular files in NUM parts at once"),
   N_("-l, --verbose              output byte numbers and differing byte values"),
   N_("-n, --bytes=LIMIT          compare at most LIMIT bytes"),
   N_("-s, --quiet, --silent      suppress all normal output"),
@@ -200,7 +321,6 @@ int
 main (int argc, char **argv)
 {
   int c, f, exit_status;
-  size_t words_per_buffer;
 
   exit_failure = EXIT_TROUBLE;
   initialize_main (&argc, &argv);
@@ -253,6 +373,51 @@ main (int argc, char **argv)
 	check_stdout ();
 	return EXIT_SUCCESS;
 
+      case AGAINST_HASHES_OPTION:
+	against_hashes = optarg;
+	break;
+
+      case CACHED_STAT_OPTION:
+	cached_stat = true;
+	break;
+
+      case CHUNKS_OPTION:
+	chunks_option = true;
+	break;
+
+      case DECOMPRESS_OPTION:
+#if HAVE_WORKING_FORK
+	decompress = true;
+	break;
+#else
+	try_help ("--decompress is not supported on this system", 0);
+#endif
+
+      case DIRECT_IO_OPTION:
+	direct_io = true;
+	break;
+
+      case EMIT_HASHES_OPTION:
+	emit_hashes_option = true;
+	break;
+
+      case FROM_FILE_OPTION:
+	from_file = optarg;
+	break;
+
+      case JOBS_OPTION:
+	{
+	  uintmax_t n;
+	  if (! (xstrtoumax (optarg, 0, 10, &n, "") == LONGINT_OK && 0 < n))
+	    try_help ("invalid --jobs value '%s'", optarg);
+	  jobs = MIN (n, INT_MAX);
+	}
+#ifdef SIGCHLD
+	/* System V fork+wait does not work if SIGCHLD is ignored.  */
+	signal (SIGCHLD, SIG_DFL);
+#endif
+	break;
+
       case HELP_OPTION:
 	usage ();
 	check_stdout ();
@@ -265,6 +430,57 @@ main (int argc, char **argv)
   if (optind == argc)
     try_help ("missing operand after '%s'", argv[argc - 1]);
 
+  if (chunks_option)
+    {
+      if (from_file || emit_hashes_option || against_hashes)
+	try_help ("options --chunks and --%s are incompatible",
+		  (from_file ? "from-file"
+		   : emit_hashes_option ? "emit-hashes" : "against-hashes"));
+      if (comparison_type == type_all_diffs)
+	try_help ("options -l and --chunks are incompatible", 0);
+    }
+
+  if (from_file)
+    {
+      if (emit_hashes_option || against_hashes)
+	try_help ("options --from-file and --%s are incompatible",
+		  emit_hashes_option ? "emit-hashes" : "against-hashes");
+      if (comparison_type == type_all_diffs)
+	try_help ("options -l and --from-file are incompatible", 0);
+      exit (cmp_many (argc - optind, argv + optind));
+    }
+
+  if (emit_hashes_option || against_hashes)
+    {
+      if (emit_hashes_option && against_hashes)
+	try_help ("options --emit-hashes and --against-hashes are incompatible",
+		  0);
+      if (comparison_type == type_all_diffs)
+	try_help ("options -l and --%s are incompatible",
+		  emit_hashes_option ? "emit-hashes" : "against-hashes");
+      if (emit_hashes_option && comparison_type == type_status)
+	try_help ("options -s and --emit-hashes are incompatible", 0);
+
+      /* There is only FILE1, and perhaps SKIP1.  */
+      file[0] = argv[optind++];
+      if (optind < argc)
+	{
+	  char *arg = argv[optind++];
+	  specify_ignore_initial (0, &arg, 0);
+	}
+      if (optind < argc)
+	try_help ("extra operand '%s'", argv[optind]);
+
+      open_input (0);
+      exit_status = emit_hashes_option ? emit_hashes () : compare_hashes ();
+
+      if (decompress_close (file_desc[0]) != 0)
+	error (EXIT_TROUBLE, errno, "%s", file[0]);
+      if (exit_status != EXIT_SUCCESS || emit_hashes_option)
+	check_stdout ();
+      exit (exit_status);
+    }
+
   file[0] = argv[optind++];
   file[1] = optind < argc ? argv[optind++] : "-";
 
@@ -289,22 +505,7 @@ main (int argc, char **argv)
 	  && file_name_cmp (file[0], file[1]) == 0)
 	return EXIT_SUCCESS;
 
-      if (STREQ (file[f1], "-"))
-	{
-	  file_desc[f1] = STDIN_FILENO;
-	  if (O_BINARY && ! isatty (STDIN_FILENO))
-	    set_binary_mode (STDIN_FILENO, O_BINARY);
-	}
-      else
-	file_desc[f1] = open (file[f1], O_RDONLY | O_BINARY, 0);
-
-      if (file_desc[f1] < 0 || fstat (file_desc[f1], stat_buf + f1) != 0)
-	{
-	  if (file_desc[f1] < 0 && comparison_type == type_status)
-	    exit (EXIT_TROUBLE);
-	  else
-	    error (EXIT_TROUBLE, errno, "%s", file[f1]);
-	}
+      open_input (f1);
     }
 
   /* If the files are links to the same inode and have the same file position,
@@ -353,23 +554,167 @@ main (int argc, char **argv)
 			 STAT_BLOCKSIZE (stat_buf[1]),
 			 PTRDIFF_MAX - sizeof (word));
 
-  /* Allocate word-aligned buffers, with space for sentinels at the end.  */
+  if (direct_io)
+    for (f = 0; f < 2; f++)
+      if (S_ISREG (stat_buf[f].st_mode) && 0 <= file_position (f))
+	{
+	  size_t alignment = direct_io_start (file_desc[f]);
+	  if (alignment)
+	    {
+	      direct[f] = true;
+	      direct_alignment = buffer_lcm (direct_alignment, alignment,
+					     PTRDIFF_MAX - sizeof (word));
+	      buf_size = buffer_lcm (buf_size, alignment,
+				     PTRDIFF_MAX - sizeof (word));
+	    }
+	}
+  allocate_buffers ();
 
-  words_per_buffer = (buf_size + 2 * sizeof (word) - 1) / sizeof (word);
-  buffer[0] = xmalloc (2 * sizeof (word) * words_per_buffer);
-  buffer[1] = buffer[0] + words_per_buffer;
+  if (chunks_option)
+    exit_status = compare_chunks ();
+  else
+    {
+#if HAVE_WORKING_FORK
+      if (1 < jobs && comparison_type != type_all_diffs
+	  && S_ISREG (stat_buf[0].st_mode) && S_ISREG (stat_buf[1].st_mode))
+	compare_parts ();
+#endif
 
-  exit_status = cmp ();
+      exit_status = cmp ();
+    }
 
   for (f = 0; f < 2; f++)
-    if (close (file_desc[f]) != 0)
-      error (EXIT_TROUBLE, errno, "%s", file[f]);
+    {
+      if (direct[f])
+	direct_io_stop (file_desc[f]);
+      if (decompress_close (file_desc[f]) != 0)
+	error (EXIT_TROUBLE, errno, "%s", file[f]);
+    }
   if (exit_status != EXIT_SUCCESS && comparison_type < type_no_stdout)
     check_stdout ();
   exit (exit_status);
   return exit_status;
 }
 
+/* Open file F, and get its status.  */
+
+static void
+open_input (int f)
+{
+  if (STREQ (file[f], "-"))
+    {
+      file_desc[f] = STDIN_FILENO;
+      if (O_BINARY && ! isatty (STDIN_FILENO))
+	set_binary_mode (STDIN_FILENO, O_BINARY);
+    }
+  else
+    file_desc[f] = open (file[f], O_RDONLY | O_BINARY, 0);
+
+  if (file_desc[f] < 0 || desc_status (file_desc[f], stat_buf + f) != 0)
+    {
+      if (file_desc[f] < 0 && comparison_type == type_status)
+	exit (EXIT_TROUBLE);
+      else
+	error (EXIT_TROUBLE, errno, "%s", file[f]);
+    }
+
+  if (decompress)
+    decompress_input (&file_desc[f], &stat_buf[f], file[f]);
+}
+
+/* Discard the first IG bytes of the file open on DESC, whose name is
+   NAME, which cannot seek.  Splice them to the null device if DESC is
+   a pipe, so that they are not copied, and otherwise read them into
+   'buffer[0]'.  */
+
+static void
+discard_input (int desc, char const *name, off_t ig)
+{
+#ifdef SPLICE_F_MOVE
+  int null_desc = open (NULL_DEVICE, O_WRONLY);
+  if (0 <= null_desc)
+    {
+      ssize_t r;
+      int e;
+      for (; ig; ig -= r)
+	{
+	  r = splice (desc, NULL, null_desc, NULL, MIN (ig, INT_MAX),
+		      SPLICE_F_MOVE);
+	  if (r <= 0)
+	    break;
+	}
+      e = errno;
+      close (null_desc);
+      if (ig && r == 0)
+	return;
+      if (ig && e != EINVAL)
+	error (EXIT_TROUBLE, e, "%s", name);
+    }
+#endif
+
+  while (ig)
+    {
+      size_t bytes_to_read = MIN (ig, buf_size);
+      size_t r = block_read (desc, (char *) buffer[0], bytes_to_read);
+      if (r != bytes_to_read)
+	{
+	  if (r == SIZE_MAX)
+	    error (EXIT_TROUBLE, errno, "%s", name);
+	  break;
+	}
+      ig -= r;
+    }
+}
+
+/* Skip the initial bytes of file F that are to be ignored, if F
+   cannot seek.  */
+
+static void
+skip_initial (int f)
+{
+  if (ignore_initial[f] && file_position (f) == -1)
+    discard_input (file_desc[f], file[f], ignore_initial[f]);
+}
+
+/* Read into BUF up to SIZE bytes of file F that follow the first DONE
+   bytes after its ignored initial bytes, and return how many were
+   read.  Files that can seek are read at explicit offsets, so that
+   their file offsets need not be kept in step with what is compared;
+   other files are read in order, so DONE must then be the number of
+   bytes already read.  A file read directly is read through the cache
+   from then on if a read is misaligned.  */
+
+static size_t
+read_input (int f, char *buf, size_t size, off_t done)
+{
+  size_t r = (file_position (f) < 0
+	      ? block_read (file_desc[f], buf, size)
+	      : direct_pread (file_desc[f], buf, size,
+			      file_position (f) + done, &direct[f]));
+  if (r == SIZE_MAX)
+    error (EXIT_TROUBLE, errno, "%s", file[f]);
+  return r;
+}
+
+/* Allocate word-aligned buffers of 'buf_size' bytes, with space for
+   sentinels at the end, discarding any previous buffers.  With
+   --direct-io the buffers are aligned to 'direct_alignment'.  */
+
+static void
+allocate_buffers (void)
+{
+  size_t alignment = MAX (direct_alignment, sizeof (word));
+  size_t bytes_per_buffer = ((buf_size + 2 * sizeof (word) + alignment - 1)
+			     / alignment * alignment);
+  char *p;
+  free (buffer_storage);
+  buffer_storage = xmalloc (2 * bytes_per_buffer + alignment - 1);
+  p = buffer_storage;
+  p += (alignment - (uintptr_t) p % alignment) % alignment;
+  buffer[0] = (word *) p;
+  buffer[1] = (word *) (p + bytes_per_buffer);
+}
+
 /* Compare the two files already open on 'file_desc[0]' and 'file_desc[1]',
    using 'buffer[0]' and 'buffer[1]'.
    Return EXIT_SUCCESS if identical, EXIT_FAILURE if different,
@@ -378,19 +723,27 @@ main (int argc, char **argv)
 static int
 cmp (void)
 {
-  off_t line_number = 1;	/* Line number (1...) of difference. */
-  off_t byte_number = 1;	/* Byte number (1...) of difference. */
+  off_t line_number = 1 + skipped_lines; /* Line number (1...) of diff. */
+  off_t byte_number = 1 + skipped_bytes; /* Byte number (1...) of diff. */
   uintmax_t remaining = bytes;	/* Remaining number of bytes to compare.  */
-  size_t read0, read1;		/* Number of bytes read from each file. */
+  size_t read[2];		/* Number of bytes read from each file. */
+  size_t size;			/* The buffer size for the latest reads. */
   size_t first_diff;		/* Offset (0...) in buffers of 1st diff. */
-  size_t smaller;		/* The lesser of 'read0' and 'read1'. */
+  size_t smaller;		/* The lesser of 'read[0]' and 'read[1]'. */
   word *buffer0 = buffer[0];
   word *buffer1 = buffer[1];
   char *buf0 = (char *) buffer0;
   char *buf1 = (char *) buffer1;
+  char const *data[2];		/* The bytes read from each file.  */
   int differing = 0;
   int f;
   int offset_width IF_LINT (= 0);
+  struct read_advice advice[2];
+  struct extent_scan extents[2];
+  off_t input_bytes[2];		/* Sizes of the files, or -1 if unknown.  */
+  bool grow;
+  bool mapped;			/* Whether the files are mapped, not read.  */
+  bool lines_skipped = false;	/* Whether skipped bytes had uncounted lines.  */
 
   if (comparison_type == type_all_diffs)
     {
@@ -410,108 +763,112 @@ cmp (void)
 
   for (f = 0; f < 2; f++)
     {
-      off_t ig = ignore_initial[f];
-      if (ig && file_position (f) == -1)
-	{
-	  /* lseek failed; read and discard the ignored initial prefix.  */
-	  do
-	    {
-	      size_t bytes_to_read = MIN (ig, buf_size);
-	      size_t r = block_read (file_desc[f], buf0, bytes_to_read);
-	      if (r != bytes_to_read)
-		{
-		  if (r == SIZE_MAX)
-		    error (EXIT_TROUBLE, errno, "%s", file[f]);
-		  break;
-		}
-	      ig -= r;
-	    }
-	  while (ig);
-	}
+      skip_initial (f);
+      input_bytes[f] = input_size (f);
+      read_advice_init (&advice[f], file_desc[f], input_bytes[f], true);
+      if (direct_io)
+	read_advice_direct (&advice[f], &direct[f]);
+      /* Count the bytes that compare_parts found identical as read.  */
+      read_advice_update (&advice[f], skipped_bytes);
+      extent_scan_init (&extents[f], file_desc[f], &stat_buf[f]);
     }
 
+  /* Grow the buffers while reading regular files and block devices,
+     which are unlikely to be interactive.  */
+  grow = 0 <= input_bytes[0] && 0 <= input_bytes[1];
+
+  mapped = false;
+#if USE_MMAP
+  mapped = (S_ISREG (stat_buf[0].st_mode) && S_ISREG (stat_buf[1].st_mode)
+	    && MMAP_THRESHOLD <= input_bytes[0] - file_position (0)
+	    && MMAP_THRESHOLD <= input_bytes[1] - file_position (1)
+	    && MMAP_THRESHOLD <= remaining
+	    && ! direct_io
+	    && input_bytes[0] < READ_ADVICE_DISCARD_MINIMUM
+	    && input_bytes[1] < READ_ADVICE_DISCARD_MINIMUM);
+#endif
+
   do
     {
-      size_t bytes_to_read = buf_size;
+      size_t bytes_to_read;
 
-      if (remaining != UINTMAX_MAX)
+      /* Skip any hole that both files have here, or any data that they
+	 share, as if it had been read and found equal.  */
+      if (0 <= extents[0].fd && 0 <= extents[1].fd)
 	{
-	  if (remaining < bytes_to_read)
-	    bytes_to_read = remaining;
-	  remaining -= bytes_to_read;
+	  off_t done = byte_number - 1;
+	  bool stored;
+	  off_t skip = same_extent_bytes (extents, file_position (0) + done,
+					  file_position (1) + done, &stored);
+	  lines_skipped |= stored;
+	  if (remaining < skip)
+	    skip = remaining;
+	  if (skip)
+	    {
+	      for (f = 0; f < 2; f++)
+		read_advice_update (&advice[f], skip);
+	      byte_number += skip;
+	      if (remaining != UINTMAX_MAX)
+		remaining -= skip;
+	    }
 	}
 
-      read0 = block_read (file_desc[0], buf0, bytes_to_read);
-      if (read0 == SIZE_MAX)
-	error (EXIT_TROUBLE, errno, "%s", file[0]);
-      read1 = block_read (file_desc[1], buf1, bytes_to_read);
-      if (read1 == SIZE_MAX)
-	error (EXIT_TROUBLE, errno, "%s", file[1]);
+#if USE_MMAP
+      if (mapped)
+	{
+	  size = MMAP_WINDOW;
+	  mapped = map_windows (byte_number - 1, MIN (remaining, size),
+				data, read);
+	}
+#endif
+      if (! mapped)
+	size = buf_size;
+      bytes_to_read = MIN (remaining, size);
+      if (remaining != UINTMAX_MAX)
+	remaining -= bytes_to_read;
+
+      if (! mapped)
+	{
+	  read[0] = read_input (0, buf0, bytes_to_read, byte_number - 1);
+	  read[1] = read_input (1, buf1, bytes_to_read, byte_number - 1);
+	  data[0] = buf0;
+	  data[1] = buf1;
+	  for (f = 0; f < 2; f++)
+	    read_advice_update (&advice[f], read[f]);
+	}
 
-      smaller = MIN (read0, read1);
+      smaller = MIN (read[0], read[1]);
 
       /* Optimize the common case where the buffers are the same.  */
-      if (memcmp (buf0, buf1, smaller) == 0)
+      if (memcmp (data[0], data[1], smaller) == 0)
 	first_diff = smaller;
+#if USE_MMAP
+      else if (mapped)
+	first_diff = first_difference (data[0], data[1], smaller);
+#endif
       else
 	{
 	  /* Insert sentinels for the block compare.  */
-	  buf0[read0] = ~buf1[read0];
-	  buf1[read1] = ~buf0[read1];
+	  buf0[read[0]] = ~buf1[read[0]];
+	  buf1[read[1]] = ~buf0[read[1]];
 
 	  first_diff = block_compare (buffer0, buffer1);
 	}
 
       byte_number += first_diff;
       if (comparison_type == type_first_diff)
-	line_number += count_newlines (buf0, first_diff);
+	line_number += count_newlines (data[0], first_diff);
 
       if (first_diff < smaller)
 	{
 	  switch (comparison_type)
 	    {
 	    case type_first_diff:
-	      {
-		char byte_buf[INT_BUFSIZE_BOUND (off_t)];
-		char line_buf[INT_BUFSIZE_BOUND (off_t)];
-		char const *byte_num = offtostr (byte_number, byte_buf);
-		char const *line_num = offtostr (line_number, line_buf);
-		if (!opt_print_bytes)
-		  {
-		    /* See POSIX 1003.1-2001 for this format.  This
-		       message is used only in the POSIX locale, so it
-		       need not be translated.  */
-		    static char const char_message[] =
-		      "%s %s differ: char %s, line %s\n";
-
-		    /* The POSIX rationale recommends using the word
-		       "byte" outside the POSIX locale.  Some gettext
-		       implementations translate even in the POSIX
-		       locale if certain other environment variables
-		       are set, so use "byte" if a translation is
-		       available, or if outside the POSIX locale.  */
-		    static char const byte_msgid[] =
-		      N_("%s %s differ: byte %s, line %s\n");
-		    char const *byte_message = _(byte_msgid);
-		    bool use_byte_message = (byte_message != byte_msgid
-					     || hard_locale_LC_MESSAGES);
-
-		    printf (use_byte_message ? byte_message : char_message,
-			    file[0], file[1], byte_num, line_num);
-		  }
-		else
-		  {
-		    unsigned char c0 = buf0[first_diff];
-		    unsigned char c1 = buf1[first_diff];
-		    char s0[5];
-		    char s1[5];
-		    sprintc (s0, c0);
-		    sprintc (s1, c1);
-		    printf (_("%s %s differ: byte %s, line %s is %3o %s %3o %s\n"),
-			    file[0], file[1], byte_num, line_num,
-			    c0, s0, c1, s1);
-		}
-	      }
+	      if (lines_skipped)
+		line_number = 1 + count_lines_before (byte_number - 1);
+	      print_first_difference (file[0], file[1], byte_number,
+				      line_number, data[0][first_diff],
+				      data[1][first_diff]);
 	      /* Fall through.  */
 	    case type_status:
 	      return EXIT_FAILURE;
@@ -519,28 +876,10 @@ cmp (void)
 	    case type_all_diffs:
 	      do
 		{
-		  unsigned char c0 = buf0[first_diff];
-		  unsigned char c1 = buf1[first_diff];
+		  unsigned char c0 = data[0][first_diff];
+		  unsigned char c1 = data[1][first_diff];
 		  if (c0 != c1)
-		    {
-		      char byte_buf[INT_BUFSIZE_BOUND (off_t)];
-		      char const *byte_num = offtostr (byte_number, byte_buf);
-		      if (!opt_print_bytes)
-			{
-			  /* See POSIX 1003.1-2001 for this format.  */
-			  printf ("%*s %3o %3o\n",
-				  offset_width, byte_num, c0, c1);
-			}
-		      else
-			{
-			  char s0[5];
-			  char s1[5];
-			  sprintc (s0, c0);
-			  sprintc (s1, c1);
-			  printf ("%*s %3o %-4s %3o %s\n",
-				  offset_width, byte_num, c0, s0, c1, s1);
-			}
-		    }
+		    print_differing_bytes (byte_number, offset_width, c0, c1);
 		  byte_number++;
 		  first_diff++;
 		}
@@ -554,22 +893,1020 @@ cmp (void)
 	    }
 	}
 
-      if (read0 != read1)
+      if (read[0] != read[1])
 	{
 	  if (differing <= 0 && comparison_type != type_status)
 	    {
 	      /* See POSIX 1003.1-2001 for this format.  */
-	      fprintf (stderr, _("cmp: EOF on %s\n"), file[read1 < read0]);
+	      fprintf (stderr, _("cmp: EOF on %s\n"), file[read[1] < read[0]]);
 	    }
 
 	  return EXIT_FAILURE;
 	}
+
+#if USE_MMAP
+      /* Unmap the windows before asking the system to discard them.  */
+      if (mapped)
+	for (f = 0; f < 2; f++)
+	  {
+	    unmap_window (f);
+	    read_advice_update (&advice[f], read[f]);
+	  }
+#endif
+
+      if (grow && ! mapped && read[0] == size)
+	{
+	  buf_size = buffer_grow (size, PTRDIFF_MAX - sizeof (word));
+	  if (buf_size != size)
+	    {
+	      allocate_buffers ();
+	      buffer0 = buffer[0];
+	      buffer1 = buffer[1];
+	      buf0 = (char *) buffer0;
+	      buf1 = (char *) buffer1;
+	    }
+	}
     }
-  while (differing <= 0 && read0 == buf_size);
+  while (differing <= 0 && read[0] == size);
 
   return differing == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+/* A file that --from-file compares with the reference file.  */
+struct candidate
+{
+  char const *name;
+  int desc;
+  off_t position;		/* Offset after the ignored initial bytes,
+				   or -1 if the file cannot seek.  */
+  struct read_advice advice;
+  word *buffer;
+  bool done;			/* Whether the comparison is over.  */
+};
+
+/* Compare the reference file 'from_file' with each of the N files
+   named in NAMES, reading the reference file only once: each block
+   of it is compared with the same block of every file that has not
+   yet been found to differ.  Output what cmp would for each pair, in
+   the order the differences are found.  Return the worst exit
+   status.  */
+
+static int
+cmp_many (int n, char *const *names)
+{
+  struct candidate *cand;
+  struct read_advice advice;
+  off_t byte_number = 1;	/* Byte number (1...) of the block.  */
+  off_t line_number = 1;	/* Line number (1...) of the block.  */
+  uintmax_t remaining = bytes;
+  int status = EXIT_SUCCESS;
+  int active = 0;
+  int i;
+
+  if (n == 0)
+    try_help ("missing operand after '%s'", from_file);
+
+  file[0] = from_file;
+  open_input (0);
+  buf_size = STAT_BLOCKSIZE (stat_buf[0]);
+
+  cand = xcalloc (n, sizeof *cand);
+  for (i = 0; i < n; i++)
+    {
+      struct candidate *c = &cand[i];
+      struct stat st;
+      c->name = names[i];
+      if (STREQ (c->name, "-"))
+	{
+	  c->desc = STDIN_FILENO;
+	  if (O_BINARY && ! isatty (STDIN_FILENO))
+	    set_binary_mode (STDIN_FILENO, O_BINARY);
+	}
+      else
+	c->desc = open (c->name, O_RDONLY | O_BINARY, 0);
+      if (c->desc < 0 || desc_status (c->desc, &st) != 0)
+	{
+	  if (comparison_type == type_status)
+	    exit (EXIT_TROUBLE);
+	  error (0, errno, "%s", c->name);
+	  status = EXIT_TROUBLE;
+	  c->done = true;
+	  continue;
+	}
+      if (decompress)
+	decompress_input (&c->desc, &st, c->name);
+      c->position = lseek (c->desc, ignore_initial[1], SEEK_CUR);
+      read_advice_init (&c->advice, c->desc,
+			S_ISREG (st.st_mode) ? st.st_size : -1, true);
+      buf_size = buffer_lcm (buf_size, STAT_BLOCKSIZE (st),
+			     PTRDIFF_MAX - sizeof (word));
+      active++;
+    }
+
+  /* The files are read in lockstep, so use large buffers at once.  */
+  for (;;)
+    {
+      size_t size = buffer_grow (buf_size, PTRDIFF_MAX - sizeof (word));
+      if (size == buf_size)
+	break;
+      buf_size = size;
+    }
+  allocate_buffers ();
+  for (i = 0; i < n; i++)
+    if (! cand[i].done)
+      {
+	cand[i].buffer = xnmalloc ((buf_size + 2 * sizeof (word) - 1)
+				   / sizeof (word),
+				   sizeof (word));
+	if (cand[i].position < 0)
+	  discard_input (cand[i].desc, cand[i].name, ignore_initial[1]);
+      }
+  skip_initial (0);
+  read_advice_init (&advice, file_desc[0], input_size (0), true);
+
+  while (active)
+    {
+      char *buf0 = (char *) buffer[0];
+      size_t bytes_to_read = MIN (remaining, buf_size);
+      size_t read0 = read_input (0, buf0, bytes_to_read, byte_number - 1);
+      read_advice_update (&advice, read0);
+
+      for (i = 0; i < n; i++)
+	{
+	  struct candidate *c = &cand[i];
+	  char *buf1 = (char *) c->buffer;
+	  size_t read1;
+	  size_t smaller;
+	  size_t first_diff;
+
+	  if (c->done)
+	    continue;
+
+	  read1 = (c->position < 0
+		   ? block_read (c->desc, buf1, bytes_to_read)
+		   : block_pread (c->desc, buf1, bytes_to_read,
+				  c->position + byte_number - 1));
+	  if (read1 == SIZE_MAX)
+	    {
+	      error (0, errno, "%s", c->name);
+	      status = EXIT_TROUBLE;
+	      c->done = true;
+	      active--;
+	      continue;
+	    }
+	  read_advice_update (&c->advice, read1);
+
+	  smaller = MIN (read0, read1);
+	  if (memcmp (buf0, buf1, smaller) == 0)
+	    first_diff = smaller;
+	  else
+	    {
+	      /* Insert sentinels for the block compare.  */
+	      buf0[read0] = ~buf1[read0];
+	      buf1[read1] = ~buf0[read1];
+	      first_diff = block_compare (buffer[0], c->buffer);
+	    }
+
+	  if (first_diff < smaller)
+	    {
+	      if (comparison_type == type_first_diff)
+		print_first_difference (from_file, c->name,
+					byte_number + first_diff,
+					(line_number
+					 + count_newlines (buf0, first_diff)),
+					buf0[first_diff], buf1[first_diff]);
+	    }
+	  else if (read0 != read1)
+	    {
+	      if (comparison_type != type_status)
+		fprintf (stderr, _("cmp: EOF on %s\n"),
+			 read1 < read0 ? c->name : from_file);
+	    }
+	  else
+	    continue;
+
+	  status = MAX (status, EXIT_FAILURE);
+	  c->done = true;
+	  active--;
+	}
+
+      if (read0 < buf_size)
+	break;
+      if (comparison_type == type_first_diff)
+	line_number += count_newlines (buf0, read0);
+      byte_number += read0;
+      if (remaining != UINTMAX_MAX)
+	remaining -= read0;
+    }
+
+  for (i = 0; i < n; i++)
+    if (0 <= cand[i].desc && decompress_close (cand[i].desc) != 0)
+      error (EXIT_TROUBLE, errno, "%s", cand[i].name);
+  if (decompress_close (file_desc[0]) != 0)
+    error (EXIT_TROUBLE, errno, "%s", file[0]);
+  if (status != EXIT_SUCCESS && comparison_type < type_no_stdout)
+    check_stdout ();
+  return status;
+}
+
+/* Return the size of file F if it is a regular file or a block
+   device, or -1 if it is some other kind of file.  The system can
+   read ahead of cmp in the former, so the reads of both files
+   proceed while the buffers already read are compared; this matters
+   most when comparing disks or partitions, whose blocks are small.  */
+
+static off_t
+input_size (int f)
+{
+  if (S_ISREG (stat_buf[f].st_mode))
+    return stat_buf[f].st_size;
+
+  if (S_ISBLK (stat_buf[f].st_mode) && 0 <= file_position (f))
+    {
+      off_t end = lseek (file_desc[f], 0, SEEK_END);
+      if (0 <= end)
+	{
+	  if (lseek (file_desc[f], file_position (f), SEEK_SET) < 0)
+	    error (EXIT_TROUBLE, errno, "%s", file[f]);
+	  return end;
+	}
+    }
+
+  return -1;
+}
+
+/* The block digests in a list output by --emit-hashes.  */
+struct hash_list
+{
+  size_t block_size;		/* Number of bytes in each block.  */
+  size_t blocks;		/* Number of blocks.  */
+  unsigned char (*digest)[SHA256_DIGEST_SIZE];
+  uintmax_t size;		/* Number of bytes hashed.  */
+};
+
+/* Return the value of the hexadecimal digit C, or -1 if C is not one.  */
+
+static int
+hex_digit_value (char c)
+{
+  if ('0' <= c && c <= '9')
+    return c - '0';
+  if ('a' <= c && c <= 'f')
+    return c - 'a' + 10;
+  if ('A' <= c && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Read into *LIST the block digests in the file 'against_hashes'.  */
+
+static void
+read_hashes (struct hash_list *list)
+{
+  char const *name = against_hashes;
+  bool use_stdin = STREQ (name, "-");
+  FILE *fp = use_stdin ? stdin : fopen (name, "r");
+  char *buf = NULL;
+  size_t bufsize = 0;
+  size_t used = 0;
+  size_t alloc = 0;
+  char const *p;
+  uintmax_t block_size;
+  int n = 0;
+
+  if (! fp)
+    error (EXIT_TROUBLE, errno, "%s", name);
+  for (;;)
+    {
+      size_t bytes_read;
+      if (bufsize - used <= 1)
+	buf = x2realloc (buf, &bufsize);
+      bytes_read = fread (buf + used, 1, bufsize - used - 1, fp);
+      if (! bytes_read)
+	break;
+      used += bytes_read;
+    }
+  if (ferror (fp) || (! use_stdin && fclose (fp) != 0))
+    error (EXIT_TROUBLE, errno, "%s", name);
+  buf[used] = '\0';
+
+  p = buf;
+  if (! (strncmp (p, hashes_header, sizeof hashes_header - 1) == 0
+	 && p[sizeof hashes_header - 1] == '\n'
+	 && sscanf (p + sizeof hashes_header, "sha256 %"SCNuMAX"\n%n",
+		    &block_size, &n) == 1
+	 && n
+	 && 0 < block_size && block_size <= PTRDIFF_MAX - sizeof (word)))
+    error (EXIT_TROUBLE, 0, _("%s: not a list of block hashes"), name);
+  p += sizeof hashes_header + n;
+  list->block_size = block_size;
+
+  list->blocks = 0;
+  list->digest = NULL;
+  for (;; p += 2 * SHA256_DIGEST_SIZE + 1)
+    {
+      unsigned char digest[SHA256_DIGEST_SIZE];
+      int i;
+      for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+	{
+	  int hi = hex_digit_value (p[2 * i]);
+	  int lo;
+	  if (hi < 0 || (lo = hex_digit_value (p[2 * i + 1])) < 0)
+	    break;
+	  digest[i] = hi << 4 | lo;
+	}
+      if (i < SHA256_DIGEST_SIZE || p[2 * i] != '\n')
+	break;
+      if (list->blocks == alloc)
+	list->digest = x2nrealloc (list->digest, &alloc, sizeof *list->digest);
+      memcpy (list->digest[list->blocks++], digest, sizeof digest);
+    }
+
+  n = 0;
+  if (! (sscanf (p, "end %"SCNuMAX"\n%n", &list->size, &n) == 1
+	 && p + n == buf + used
+	 && list->size / block_size + (list->size % block_size != 0)
+	    == list->blocks))
+    error (EXIT_TROUBLE, 0, _("%s: not a list of block hashes"), name);
+
+  free (buf);
+}
+
+/* Get ready to hash file 0 in blocks of BLOCK_SIZE bytes, reading
+   ahead as advised by *ADVICE.  */
+
+static void
+start_hashing (size_t block_size, struct read_advice *advice)
+{
+  buf_size = block_size;
+  allocate_buffers ();
+  skip_initial (0);
+  read_advice_init (advice, file_desc[0], input_size (0), true);
+}
+
+/* Read into 'buffer[0]' up to SIZE bytes of file 0 that follow the
+   first DONE bytes hashed, and store their SHA-256 digest in DIGEST.
+   Return the number of bytes read.  */
+
+static size_t
+hash_block (size_t size, off_t done, unsigned char digest[SHA256_DIGEST_SIZE],
+	    struct read_advice *advice)
+{
+  struct sha256_ctx ctx;
+  size_t r = read_input (0, (char *) buffer[0], size, done);
+  read_advice_update (advice, r);
+  sha256_init_ctx (&ctx);
+  sha256_process_bytes (buffer[0], r, &ctx);
+  sha256_finish_ctx (&ctx, digest);
+  return r;
+}
+
+/* Output the digests of the blocks of file 0 for --emit-hashes.  */
+
+static int
+emit_hashes (void)
+{
+  struct read_advice advice;
+  uintmax_t remaining = bytes;
+  uintmax_t total = 0;
+  char total_buf[INT_BUFSIZE_BOUND (uintmax_t)];
+
+  start_hashing (HASH_BLOCK_SIZE, &advice);
+  printf ("%s\nsha256 %d\n", hashes_header, HASH_BLOCK_SIZE);
+
+  while (remaining)
+    {
+      unsigned char digest[SHA256_DIGEST_SIZE];
+      size_t size = MIN (remaining, HASH_BLOCK_SIZE);
+      size_t r = hash_block (size, total, digest, &advice);
+      int i;
+
+      if (! r)
+	break;
+      for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+	printf ("%02x", digest[i]);
+      putchar ('\n');
+      total += r;
+      if (remaining != UINTMAX_MAX)
+	remaining -= r;
+      if (r < size)
+	break;
+    }
+
+  printf ("end %s\n", umaxtostr (total, total_buf));
+  return EXIT_SUCCESS;
+}
+
+/* Compare file 0 with the block digests listed in 'against_hashes'.
+   Return EXIT_SUCCESS if they match, EXIT_FAILURE otherwise.  */
+
+static int
+compare_hashes (void)
+{
+  struct hash_list list;
+  struct read_advice advice;
+  uintmax_t limit;
+  uintmax_t start;
+  size_t i;
+
+  read_hashes (&list);
+  start_hashing (list.block_size, &advice);
+
+  /* A limit within a block is rounded up to the end of the block,
+     as only whole blocks can be compared.  */
+  limit = MIN (bytes, list.size);
+
+  for (i = 0, start = 0; start < limit; i++, start += list.block_size)
+    {
+      unsigned char digest[SHA256_DIGEST_SIZE];
+      size_t size = MIN (list.block_size, list.size - start);
+      size_t r = hash_block (size, start, digest, &advice);
+
+      if (r == 0)
+	{
+	  if (comparison_type != type_status)
+	    fprintf (stderr, _("cmp: EOF on %s\n"), file[0]);
+	  return EXIT_FAILURE;
+	}
+
+      if (r < size || memcmp (digest, list.digest[i], sizeof digest) != 0)
+	{
+	  if (comparison_type == type_first_diff)
+	    {
+	      char block_buf[INT_BUFSIZE_BOUND (uintmax_t)];
+	      char first_buf[INT_BUFSIZE_BOUND (uintmax_t)];
+	      char last_buf[INT_BUFSIZE_BOUND (uintmax_t)];
+	      printf (_("%s %s differ: block %s, bytes %s-%s\n"),
+		      file[0], against_hashes, umaxtostr (i + 1, block_buf),
+		      umaxtostr (start + 1, first_buf),
+		      umaxtostr (start + size, last_buf));
+	    }
+	  return EXIT_FAILURE;
+	}
+    }
+
+  /* Unless the limit cut the comparison short, FILE1 must end where
+     the hashed file did.  */
+  if (list.size < bytes)
+    {
+      if (read_input (0, (char *) buffer[0], 1, list.size))
+	{
+	  if (comparison_type != type_status)
+	    fprintf (stderr, _("cmp: EOF on %s\n"), against_hashes);
+	  return EXIT_FAILURE;
+	}
+    }
+
+  return EXIT_SUCCESS;
+}
+
+/* A chunk of a file, for --chunks.  */
+struct chunk
+{
+  uintmax_t start;		/* Offset of the chunk's first byte.  */
+  size_t size;			/* Number of bytes in the chunk.  */
+  unsigned char digest[SHA256_DIGEST_SIZE];
+};
+
+struct chunk_list
+{
+  struct chunk *chunk;
+  size_t chunks;
+  size_t alloc;
+};
+
+/* Random values for the bytes, for the rolling hash of --chunks.
+   Each byte shifts the hash left one bit and adds its value, so the
+   top CHUNK_BITS bits of the hash depend on the last 64 bytes, and a
+   cut is made where they are all 0.  */
+static uint64_t gear[UCHAR_MAX + 1];
+
+static void
+init_gear (void)
+{
+  uint64_t x = 0;
+  int i;
+
+  /* SplitMix64, so that every run cuts files in the same places.  */
+  for (i = 0; i <= UCHAR_MAX; i++)
+    {
+      uint64_t z = x += UINT64_C (0x9e3779b97f4a7c15);
+      z = (z ^ (z >> 30)) * UINT64_C (0xbf58476d1ce4e5b9);
+      z = (z ^ (z >> 27)) * UINT64_C (0x94d049bb133111eb);
+      gear[i] = z ^ (z >> 31);
+    }
+}
+
+/* Add to LIST a chunk of SIZE bytes that starts at START, whose
+   digest *CTX has computed, and start the next chunk's digest.  */
+
+static void
+add_chunk (struct chunk_list *list, uintmax_t start, size_t size,
+	   struct sha256_ctx *ctx)
+{
+  struct chunk *c;
+  if (list->chunks == list->alloc)
+    list->chunk = x2nrealloc (list->chunk, &list->alloc, sizeof *list->chunk);
+  c = &list->chunk[list->chunks++];
+  c->start = start;
+  c->size = size;
+  sha256_finish_ctx (ctx, c->digest);
+  sha256_init_ctx (ctx);
+}
+
+/* Cut file F into chunks, reading it into 'buffer[F]', and store
+   them into *LIST.  */
+
+static void
+chunk_file (int f, struct chunk_list *list)
+{
+  unsigned char *buf = (unsigned char *) buffer[f];
+  uint64_t const cut_mask = ~ (UINT64_MAX >> CHUNK_BITS);
+  uint64_t h = 0;
+  uintmax_t remaining = bytes;
+  uintmax_t done = 0;
+  uintmax_t start = 0;
+  struct sha256_ctx ctx;
+
+  list->chunk = NULL;
+  list->chunks = list->alloc = 0;
+  skip_initial (f);
+  sha256_init_ctx (&ctx);
+
+  while (remaining)
+    {
+      size_t size = MIN (remaining, buf_size);
+      size_t r = read_input (f, (char *) buf, size, done);
+      size_t i;
+      size_t from = 0;
+
+      for (i = 0; i < r; i++)
+	{
+	  size_t len = done + i + 1 - start;
+	  h = (h << 1) + gear[buf[i]];
+	  if ((CHUNK_MIN <= len && ! (h & cut_mask)) || len == CHUNK_MAX)
+	    {
+	      sha256_process_bytes (buf + from, i + 1 - from, &ctx);
+	      add_chunk (list, start, len, &ctx);
+	      start += len;
+	      from = i + 1;
+	      h = 0;
+	    }
+	}
+      sha256_process_bytes (buf + from, r - from, &ctx);
+
+      done += r;
+      if (remaining != UINTMAX_MAX)
+	remaining -= r;
+      if (r < size)
+	break;
+    }
+
+  if (start < done)
+    add_chunk (list, start, done - start, &ctx);
+}
+
+#if HAVE_WORKING_FORK
+/* Cut file 1 into chunks in a child process while this process cuts
+   file 0, and store them into LIST.  The child writes its chunks
+   into a temporary file, as a pipe would stop it until this process
+   was done with file 0.  Return false if the child cannot be
+   started.  */
+
+static bool
+chunk_files_at_once (struct chunk_list list[2])
+{
+  FILE *tmp = tmpfile ();
+  pid_t pid;
+  int status;
+  size_t n;
+
+  if (! tmp)
+    return false;
+  pid = fork ();
+  if (pid < 0)
+    {
+      fclose (tmp);
+      return false;
+    }
+  if (pid == 0)
+    {
+      chunk_file (1, &list[1]);
+      _exit (fwrite (list[1].chunk, sizeof *list[1].chunk, list[1].chunks,
+		     tmp) == list[1].chunks
+	     && fflush (tmp) == 0
+	     ? EXIT_SUCCESS : EXIT_TROUBLE);
+    }
+
+  chunk_file (0, &list[0]);
+
+  while (waitpid (pid, &status, 0) < 0)
+    if (errno != EINTR)
+      error (EXIT_TROUBLE, errno, "waitpid");
+  if (! (WIFEXITED (status) && WEXITSTATUS (status) == EXIT_SUCCESS))
+    error (EXIT_TROUBLE, 0, _("%s: cutting into chunks failed"), file[1]);
+
+  list[1].chunk = NULL;
+  list[1].chunks = list[1].alloc = 0;
+  if (fseeko (tmp, 0, SEEK_SET) != 0)
+    error (EXIT_TROUBLE, errno, "tmpfile");
+  do
+    {
+      if (list[1].chunks == list[1].alloc)
+	list[1].chunk = x2nrealloc (list[1].chunk, &list[1].alloc,
+				    sizeof *list[1].chunk);
+      n = fread (list[1].chunk + list[1].chunks, sizeof *list[1].chunk,
+		 list[1].alloc - list[1].chunks, tmp);
+      list[1].chunks += n;
+    }
+  while (list[1].chunks == list[1].alloc);
+  if (ferror (tmp))
+    error (EXIT_TROUBLE, errno, "tmpfile");
+  fclose (tmp);
+  return true;
+}
+#endif
+
+/* A hash table of the chunks of a file, by digest: the index of each
+   chunk plus 1, or 0 in a slot that is empty.  */
+struct chunk_table
+{
+  size_t *slot;
+  size_t mask;
+};
+
+static size_t
+chunk_slot (struct chunk_table const *t, unsigned char const *digest)
+{
+  size_t h;
+  memcpy (&h, digest, sizeof h);
+  return h & t->mask;
+}
+
+static void
+build_chunk_table (struct chunk_table *t, struct chunk_list const *list)
+{
+  size_t n = 16;
+  size_t i;
+
+  while (n < 2 * list->chunks)
+    n *= 2;
+  t->slot = xcalloc (n, sizeof *t->slot);
+  t->mask = n - 1;
+  for (i = 0; i < list->chunks; i++)
+    {
+      size_t j = chunk_slot (t, list->chunk[i].digest);
+      while (t->slot[j])
+	j = (j + 1) & t->mask;
+      t->slot[j] = i + 1;
+    }
+}
+
+/* Return true if a chunk of LIST, whose table is T, has DIGEST.  */
+
+static bool _GL_ATTRIBUTE_PURE
+has_chunk (struct chunk_table const *t, struct chunk_list const *list,
+	   unsigned char const *digest)
+{
+  size_t j;
+  for (j = chunk_slot (t, digest); t->slot[j]; j = (j + 1) & t->mask)
+    if (memcmp (list->chunk[t->slot[j] - 1].digest, digest,
+		SHA256_DIGEST_SIZE) == 0)
+      return true;
+  return false;
+}
+
+/* Output the byte ranges of the chunks of file F, whose chunks are
+   LIST[F], that are not among the chunks of the other file, whose
+   table is *OTHER.  Adjacent chunks are output as one range.  */
+
+static void
+print_chunk_ranges (int f, struct chunk_list const list[2],
+		    struct chunk_table const *other)
+{
+  struct chunk_list const *l = &list[f];
+  size_t i = 0;
+
+  while (i < l->chunks)
+    {
+      uintmax_t first, last;
+      char first_buf[INT_BUFSIZE_BOUND (uintmax_t)];
+      char last_buf[INT_BUFSIZE_BOUND (uintmax_t)];
+
+      if (has_chunk (other, &list[! f], l->chunk[i].digest))
+	{
+	  i++;
+	  continue;
+	}
+      first = l->chunk[i].start;
+      do
+	last = l->chunk[i].start + l->chunk[i].size;
+      while (++i < l->chunks
+	     && ! has_chunk (other, &list[! f], l->chunk[i].digest));
+
+      printf (_("%s bytes %s-%s not in %s\n"),
+	      file[f], umaxtostr (first + 1, first_buf),
+	      umaxtostr (last, last_buf), file[! f]);
+    }
+}
+
+/* Cut the two files into chunks, and output the byte ranges of each
+   file that are not in the other.  Return EXIT_SUCCESS if the files
+   have the same chunks in the same order, EXIT_FAILURE otherwise.
+   The whole of each file is read, and the work and memory are
+   proportional to the sizes of the files.  */
+
+static int
+compare_chunks (void)
+{
+  struct chunk_list list[2];
+  bool same;
+  size_t i;
+  int f;
+
+  init_gear ();
+
+#if HAVE_WORKING_FORK
+  if (! (1 < jobs && chunk_files_at_once (list)))
+#endif
+    for (f = 0; f < 2; f++)
+      chunk_file (f, &list[f]);
+
+  same = list[0].chunks == list[1].chunks;
+  for (i = 0; same && i < list[0].chunks; i++)
+    same = (list[0].chunk[i].size == list[1].chunk[i].size
+	    && memcmp (list[0].chunk[i].digest, list[1].chunk[i].digest,
+		       SHA256_DIGEST_SIZE) == 0);
+
+  if (! same && comparison_type == type_first_diff)
+    {
+      struct chunk_table table[2];
+      for (f = 0; f < 2; f++)
+	build_chunk_table (&table[f], &list[f]);
+      for (f = 0; f < 2; f++)
+	print_chunk_ranges (f, list, &table[! f]);
+      for (f = 0; f < 2; f++)
+	free (table[f].slot);
+    }
+
+  for (f = 0; f < 2; f++)
+    free (list[f].chunk);
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#if USE_MMAP
+/* Map into memory the SIZE bytes of each file that follow the first
+   DONE bytes compared, or as many of them as the file has, setting
+   DATA[F] to their address and READ[F] to their number.  The kernel
+   is told to start reading each window, in order.  Return true if
+   successful; otherwise the files are to be read instead.  */
+
+static bool
+map_windows (off_t done, size_t size, char const *data[2], size_t read[2])
+{
+  off_t pagesize = getpagesize ();
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      off_t pos = file_position (f) + done;
+      off_t start = pos - pos % pagesize;
+      off_t left = stat_buf[f].st_size - pos;
+
+      read[f] = left <= 0 ? 0 : left < size ? left : size;
+      data[f] = "";
+      if (read[f])
+	{
+	  void *region;
+	  window[f].size = pos - start + read[f];
+	  region = mmap (NULL, window[f].size, PROT_READ, MAP_PRIVATE,
+			 file_desc[f], start);
+	  if (region == MAP_FAILED)
+	    break;
+	  /* A file that shrinks while mapped would raise SIGBUS.  */
+	  if (! watch_mapping (region, window[f].size, file[f]))
+	    {
+	      munmap (region, window[f].size);
+	      break;
+	    }
+	  window[f].region = region;
+# ifdef MADV_SEQUENTIAL
+	  madvise (region, window[f].size, MADV_SEQUENTIAL);
+# endif
+# ifdef POSIX_FADV_WILLNEED
+	  posix_fadvise (file_desc[f], pos, 2 * read[f], POSIX_FADV_WILLNEED);
+# endif
+	  data[f] = (char const *) region + (pos - start);
+	}
+    }
+
+  if (f == 2)
+    return true;
+
+  for (f = 0; f < 2; f++)
+    unmap_window (f);
+  return false;
+}
+
+/* Unmap the window of file F, if any.  */
+
+static void
+unmap_window (int f)
+{
+  if (window[f].region)
+    {
+      unwatch_mapping (window[f].region);
+      munmap (window[f].region, window[f].size);
+    }
+  window[f].region = NULL;
+}
+#endif
+
+#if HAVE_WORKING_FORK
+
+/* With --jobs=NUM, the bytes that two regular files have in common
+   are split into NUM parts, each compared by a child process with
+   pread.  Each child writes to a pipe how many bytes at the start of
+   its part are identical, and how many newlines are among them.  The
+   parent then skips the identical bytes before the first part that
+   differs, and cmp compares the rest as usual, so that the output is
+   the same as without --jobs.  A child that cannot read its part
+   reports it as differing where the read failed, leaving the parent
+   to diagnose the failure.  */
+
+struct part
+{
+  pid_t pid;
+  int fd;			/* Read end of the pipe from the child.  */
+  off_t size;			/* Number of bytes in the part.  */
+};
+
+struct part_result
+{
+  off_t same;			/* Identical bytes at the start of the part.  */
+  off_t newlines;		/* Newlines among them.  */
+};
+
+/* Parts smaller than this are not worth a process.  */
+enum { MINIMUM_PART = 1024 * 1024 };
+
+/* Compare the SIZE bytes starting at OFFSET bytes past the current
+   positions of the files, and return what was found.  */
+
+static struct part_result
+compare_part (off_t offset, off_t size)
+{
+  struct part_result r;
+  bool count = comparison_type == type_first_diff;
+  char *buf0 = (char *) buffer[0];
+  char *buf1 = (char *) buffer[1];
+  r.same = r.newlines = 0;
+
+  while (r.same < size)
+    {
+      size_t n = MIN (buf_size, size - r.same);
+      off_t pos0 = file_position (0) + offset + r.same;
+      off_t pos1 = file_position (1) + offset + r.same;
+      ssize_t read0, read1;
+      size_t first_diff;
+
+      read0 = pread (file_desc[0], buf0, n, pos0);
+      read1 = pread (file_desc[1], buf1, n, pos1);
+      if (read0 < 0 || read1 < 0)
+	break;
+      if (read0 != (ssize_t) n || read1 != (ssize_t) n
+	  || memcmp (buf0, buf1, n) != 0)
+	{
+	  size_t smaller = MIN (read0, read1);
+	  buf0[smaller] = ~buf1[smaller];
+	  buf1[smaller] = ~buf0[smaller];
+	  first_diff = block_compare (buffer[0], buffer[1]);
+	}
+      else
+	first_diff = n;
+      if (count)
+	r.newlines += count_newlines (buf0, first_diff);
+      r.same += first_diff;
+      if (first_diff < n)
+	break;
+
+      if (n == buf_size)
+	{
+	  size_t size1 = buffer_grow (buf_size, PTRDIFF_MAX - sizeof (word));
+	  if (size1 != buf_size)
+	    {
+	      buf_size = size1;
+	      allocate_buffers ();
+	      buf0 = (char *) buffer[0];
+	      buf1 = (char *) buffer[1];
+	    }
+	}
+    }
+
+  return r;
+}
+
+/* Compare the files in parts with child processes, and skip the
+   bytes before the first difference that they find.  */
+
+static void
+compare_parts (void)
+{
+  off_t s0 = stat_buf[0].st_size - file_position (0);
+  off_t s1 = stat_buf[1].st_size - file_position (1);
+  off_t common = MIN (s0, s1);
+  struct part *part;
+  int nparts;
+  int i;
+  off_t offset;
+
+  if (file_position (0) < 0 || file_position (1) < 0)
+    return;
+  if (bytes < common)
+    common = bytes;
+  nparts = MIN (jobs, common / MINIMUM_PART);
+  if (nparts < 2)
+    return;
+
+  part = xnmalloc (nparts, sizeof *part);
+  plan_workers ();
+  for (i = 0, offset = 0; i < nparts; i++)
+    {
+      int fd[2];
+      part[i].size = common / nparts + (i < common % nparts);
+
+      if (pipe (fd) != 0)
+	error (EXIT_TROUBLE, errno, "pipe");
+      part[i].pid = fork ();
+      if (part[i].pid < 0)
+	error (EXIT_TROUBLE, errno, "fork");
+      if (part[i].pid == 0)
+	{
+	  struct part_result r;
+	  place_worker (i);
+	  r = compare_part (offset, part[i].size);
+	  _exit (write (fd[1], &r, sizeof r) == sizeof r
+		 ? EXIT_SUCCESS : EXIT_TROUBLE);
+	}
+      close (fd[1]);
+      part[i].fd = fd[0];
+      offset += part[i].size;
+    }
+
+  /* Skip identical parts in order, up to the first that differs.
+     A part whose child failed is taken to differ at its start.  */
+  for (i = 0; i < nparts; i++)
+    {
+      struct part_result r;
+      if (read (part[i].fd, &r, sizeof r) != sizeof r)
+	break;
+      skipped_bytes += r.same;
+      skipped_lines += r.newlines;
+      if (r.same < part[i].size)
+	break;
+    }
+
+  for (i = 0; i < nparts; i++)
+    {
+      kill (part[i].pid, SIGTERM);
+      close (part[i].fd);
+      waitpid (part[i].pid, NULL, 0);
+    }
+  free (part);
+
+  if (bytes != UINTMAX_MAX)
+    bytes -= skipped_bytes;
+}
+
+#endif
+
+/* Return the number of newlines in the first SIZE bytes of the first
+   file after its ignored initial bytes, reading them again.  This is
+   needed only when data that the files share was skipped unread.  */
+
+static off_t
+count_lines_before (off_t size)
+{
+  word *buf = xmalloc (buf_size + sizeof (word));
+  off_t lines = 0;
+  off_t done = 0;
+
+  while (done < size)
+    {
+      size_t n = MIN (buf_size, size - done);
+      ssize_t r = pread (file_desc[0], buf, n, file_position (0) + done);
+      if (r < 0)
+	error (EXIT_TROUBLE, errno, "%s", file[0]);
+      if (r == 0)
+	break;
+      lines += count_newlines ((char *) buf, r);
+      done += r;
+    }
+
+  free (buf);
+  return lines;
+}
+
 /* Compare two blocks of memory P0 and P1 until they differ.
    If the blocks are not guaranteed to be different, put sentinels at the ends
    of the blocks before calling this function.
@@ -598,19 +1935,124 @@ block_compare (word const *p0, word const *p1)
   return c0 - (char const *) p0;
 }
 
-/* Return the number of newlines in BUF, of size BUFSIZE,
-   where BUF[NBYTES] is available for use as a sentinel.  */
+#if USE_MMAP
+/* Return the offset of the first byte that differs between P0 and P1,
+   which are known to differ within their first SIZE bytes.  Unlike
+   block_compare, this needs no sentinels, so it works on mapped files.  */
 
 static size_t
-count_newlines (char *buf, size_t bufsize)
+first_difference (char const *p0, char const *p1, size_t size)
 {
-  size_t count = 0;
-  char *p;
-  char *lim = buf + bufsize;
-  *lim = '\n';
-  for (p = buf; (p = rawmemchr (p, '\n')) != lim; p++)
-    count++;
-  return count;
+  enum { CHUNK = 256 };
+  size_t i = 0;
+
+  while (CHUNK <= size - i && memcmp (p0 + i, p1 + i, CHUNK) == 0)
+    i += CHUNK;
+  while (p0[i] == p1[i])
+    i++;
+  return i;
+}
+#endif
+
+/* Output the message saying that files NAME0 and NAME1 first differ
+   at BYTE_NUMBER and LINE_NUMBER, where they have the bytes C0 and C1.  */
+
+static void
+print_first_difference (char const *name0, char const *name1,
+			off_t byte_number, off_t line_number,
+			unsigned char c0, unsigned char c1)
+{
+  char byte_buf[INT_BUFSIZE_BOUND (off_t)];
+  char line_buf[INT_BUFSIZE_BOUND (off_t)];
+  char const *byte_num = offtostr (byte_number, byte_buf);
+  char const *line_num = offtostr (line_number, line_buf);
+  if (!opt_print_bytes)
+    {
+      /* See POSIX 1003.1-2001 for this format.  This message is used
+	 only in the POSIX locale, so it need not be translated.  */
+      static char const char_message[] =
+	"%s %s differ: char %s, line %s\n";
+
+      /* The POSIX rationale recommends using the word "byte" outside
+	 the POSIX locale.  Some gettext implementations translate even
+	 in the POSIX locale if certain other environment variables are
+	 set, so use "byte" if a translation is available, or if
+	 outside the POSIX locale.  */
+      static char const byte_msgid[] = N_("%s %s differ: byte %s, line %s\n");
+      char const *byte_message = _(byte_msgid);
+      bool use_byte_message = (byte_message != byte_msgid
+			       || hard_locale_LC_MESSAGES);
+
+      printf (use_byte_message ? byte_message : char_message,
+	      name0, name1, byte_num, line_num);
+    }
+  else
+    {
+      char s0[5];
+      char s1[5];
+      sprintc (s0, c0);
+      sprintc (s1, c1);
+      printf (_("%s %s differ: byte %s, line %s is %3o %s %3o %s\n"),
+	      name0, name1, byte_num, line_num, c0, s0, c1, s1);
+    }
+}
+
+/* Put into BUF the unsigned char C in octal, right-justified in three
+   columns, and return the end of what was put.  */
+
+static char *
+format_octal (char *buf, unsigned char c)
+{
+  buf[0] = c < 0100 ? ' ' : '0' + (c >> 6);
+  buf[1] = c < 010 ? ' ' : '0' + ((c >> 3) & 7);
+  buf[2] = '0' + (c & 7);
+  return buf + 3;
+}
+
+/* Output the line for -l saying that the bytes C0 and C1 differ at
+   BYTE_NUMBER, which is right-justified in OFFSET_WIDTH columns.
+   The line is formatted by hand rather than with printf, which
+   would take most of the time when many bytes differ.  */
+
+static void
+print_differing_bytes (off_t byte_number, int offset_width,
+		       unsigned char c0, unsigned char c1)
+{
+  char byte_buf[INT_BUFSIZE_BOUND (off_t)];
+  char const *byte_num = offtostr (byte_number, byte_buf);
+  int digits = byte_buf + sizeof byte_buf - 1 - byte_num;
+  char line[2 * INT_BUFSIZE_BOUND (off_t) + sizeof " 377 M-^? 377 M-^?\n"];
+  char *p = line;
+
+  /* See POSIX 1003.1-2001 for this format, which is that of
+     printf ("%*s %3o %3o\n", offset_width, byte_num, c0, c1).
+     With -b, each octal value is followed by the byte quoted by
+     sprintc, the first padded on the right to four columns.  */
+  for (; digits < offset_width; offset_width--)
+    *p++ = ' ';
+  memcpy (p, byte_num, digits);
+  p += digits;
+  *p++ = ' ';
+  p = format_octal (p, c0);
+  if (opt_print_bytes)
+    {
+      char *s0 = ++p;
+      p[-1] = ' ';
+      sprintc (s0, c0);
+      p += strlen (s0);
+      while (p < s0 + 4)
+	*p++ = ' ';
+    }
+  *p++ = ' ';
+  p = format_octal (p, c1);
+  if (opt_print_bytes)
+    {
+      *p++ = ' ';
+      sprintc (p, c1);
+      p += strlen (p);
+    }
+  *p++ = '\n';
+  fwrite (line, 1, p - line, stdout);
 }
 
 /* Put into BUF the unsigned char C, making unprintable bytes
@@ -22,10 +22,15 @@
 #include "c-ctype.h"
 #include <stat-time.h>
 #include <strftime.h>
+#include <xalloc.h>
 
 static char const *find_function (char const * const *, lin);
+static bool function_line (char const *, size_t);
+static void compile_function_regexp (void);
 static struct change *find_hunk (struct change *);
 static void mark_ignorable (struct change *);
+static enum changes analyze_marked_hunk (struct change *, lin *, lin *,
+					 lin *, lin *);
 static void pr_context_hunk (struct change *);
 static void pr_unidiff_hunk (struct change *);
 
@@ -34,45 +39,154 @@ static lin find_function_last_search;
 
 /* The value find_function returned when it started searching there.  */
 static lin find_function_last_match;
+
+/* When comparing files a window at a time, a copy of the last
+   function-header line of file 0 in the windows before the current
+   one, or null if they have none.  */
+static char *carried_function;
+
+/* Whether the search for function-header lines has been started in
+   the current window.  */
+static bool function_search_started;
 
-/* Print a label for a context diff, with a file name and date or a label.  */
+/* The time stamps of the headers of files modified in the same second
+   differ only in their nanoseconds, so the text of a time stamp before
+   and after its nanoseconds is kept for the seconds formatted most
+   recently, in a table indexed by the second.  The time format is
+   split once at its %N, the only conversion that shows nanoseconds;
+   a format with more than one is formatted afresh each time.  The time
+   zone is set once, so that localtime_r need not look for a change to
+   it for each file, as localtime may.  */
+
+enum { TIME_CACHE_SIZE = 16 };
+enum { TIME_TEXT_SIZE = MAX (INT_STRLEN_BOUND (int) + 32,
+			     INT_STRLEN_BOUND (time_t) + 11) };
+
+/* The text of a time stamp: HEAD, the nanoseconds if SPLIT, then TAIL.  */
+struct time_text
+{
+  bool valid;
+  time_t sec;
+  char head[TIME_TEXT_SIZE];
+  char tail[TIME_TEXT_SIZE];
+};
+
+static struct time_text time_cache[TIME_CACHE_SIZE];
+
+/* The formats of the text before and after the nanoseconds, whether
+   there are nanoseconds, and whether the formats may be cached.  */
+static char *time_head_format;
+static char const *time_tail_format;
+static bool time_split;
+static bool time_cacheable;
 
 static void
-print_context_label (char const *mark,
-		     struct file_data *inf,
-		     char const *name,
-		     char const *label)
+plan_time_format (void)
 {
-  if (label)
-    fprintf (outfile, "%s %s\n", mark, label);
+  char const *n = strchr (time_format, 'N');
+
+  tzset ();
+
+  /* Look only for a plain %N, and give up on formats with any other N,
+     which might be part of another conversion of the nanoseconds.  */
+  time_split = (n && time_format < n && n[-1] == '%'
+		&& ! (time_format < n - 1 && n[-2] == '%'));
+  time_cacheable = ! n || (time_split && ! strchr (n + 1, 'N'));
+  if (time_split)
+    {
+      size_t len = n - 1 - time_format;
+      time_head_format = xmalloc (len + 1);
+      memcpy (time_head_format, time_format, len);
+      time_head_format[len] = '\0';
+      time_tail_format = n + 1;
+    }
   else
     {
-      char buf[MAX (INT_STRLEN_BOUND (int) + 32,
-		    INT_STRLEN_BOUND (time_t) + 11)];
-      struct tm const *tm = localtime (&inf->stat.st_mtime);
-      int nsec = get_stat_mtime_ns (&inf->stat);
-      if (! (tm && nstrftime (buf, sizeof buf, time_format, tm, 0, nsec)))
+      time_head_format = xstrdup (time_format);
+      time_tail_format = "";
+    }
+}
+
+/* Format with FORMAT the time TM and NSEC into BUF, which has SIZE
+   bytes.  Return false if this fails; an empty FORMAT gives "".  */
+
+static bool
+format_time (char *buf, size_t size, char const *format,
+	     struct tm const *tm, int nsec)
+{
+  *buf = '\0';
+  return ! *format || nstrftime (buf, size, format, tm, 0, nsec) != 0;
+}
+
+/* Print the modification time of INF, or its seconds and nanoseconds
+   since the Epoch if it cannot be formatted.  */
+
+static void
+print_context_time (struct file_data const *inf)
+{
+  time_t sec = inf->stat.st_mtime;
+  int nsec = get_stat_mtime_ns (&inf->stat);
+  struct time_text *t = &time_cache[(size_t) sec % TIME_CACHE_SIZE];
+  struct time_text fresh;
+  struct tm tm;
+
+  if (! time_head_format)
+    plan_time_format ();
+
+  if (! (time_cacheable && t->valid && t->sec == sec))
+    {
+      if (! time_cacheable)
+	t = &fresh;
+      t->valid = false;
+      if (! (localtime_r (&sec, &tm)
+	     && (time_cacheable
+		 ? (format_time (t->head, sizeof t->head, time_head_format,
+				 &tm, 0)
+		    && format_time (t->tail, sizeof t->tail, time_tail_format,
+				    &tm, 0))
+		 : (nstrftime (t->head, sizeof t->head, time_format, &tm, 0,
+			       nsec) != 0
+		    && (*t->tail = '\0', true)))))
 	{
 	  verify (TYPE_IS_INTEGER (time_t));
 	  if (LONG_MIN <= TYPE_MINIMUM (time_t)
 	      && TYPE_MAXIMUM (time_t) <= LONG_MAX)
-	    {
-	      long int sec = inf->stat.st_mtime;
-	      sprintf (buf, "%ld.%.9d", sec, nsec);
-	    }
+	    fprintf (outfile, "%ld.%.9d", (long int) sec, nsec);
 	  else if (TYPE_MAXIMUM (time_t) <= INTMAX_MAX)
-	    {
-	      intmax_t sec = inf->stat.st_mtime;
-	      sprintf (buf, "%"PRIdMAX".%.9d", sec, nsec);
-	    }
+	    fprintf (outfile, "%"PRIdMAX".%.9d", (intmax_t) sec, nsec);
 	  else
-	    {
-	      uintmax_t sec = inf->stat.st_mtime;
-	      sprintf (buf, "%"PRIuMAX".%.9d", sec, nsec);
-	    }
+	    fprintf (outfile, "%"PRIuMAX".%.9d", (uintmax_t) sec, nsec);
+	  return;
 	}
-      fprintf (outfile, "%s %s\t%s\n", mark, name, buf);
+      t->valid = true;
+      t->sec = sec;
     }
+
+  fputs (t->head, outfile);
+  if (time_split && time_cacheable)
+    fprintf (outfile, "%.9d", nsec);
+  fputs (t->tail, outfile);
+}
+
+/* Print a label for a context diff, with a file name and date or a label.  */
+
+static void
+print_context_label (char const *mark,
+		     struct file_data *inf,
+		     char const *name,
+		     char const *label)
+{
+  fputs (mark, outfile);
+  putc (' ', outfile);
+  if (label)
+    fputs (label, outfile);
+  else
+    {
+      fputs (name, outfile);
+      putc ('\t', outfile);
+      print_context_time (inf);
+    }
+  putc ('\n', outfile);
 }
 
 /* Print a header for a context diff, with the file names and dates.  */
@@ -92,22 +206,71 @@ print_context_header (struct file_data inf[], char const *const *names, bool uni
     }
 }
 
+/* Start searching for function-header lines from the start of the
+   current window of file 0.  The lines of earlier windows are
+   forgotten if this is the first window of a comparison.  */
+
+static void
+start_function_search (void)
+{
+  find_function_last_search = - files[0].prefix_lines;
+  find_function_last_match = LIN_MAX;
+  function_search_started = true;
+  if (! files[0].window_lines)
+    {
+      free (carried_function);
+      carried_function = NULL;
+    }
+}
+
+/* When comparing files a window at a time, remember the last
+   function-header line of the current window of file 0, if it has
+   one, for the hunks of the windows after it.  The lines past those
+   the window's hunks searched are searched now, including those of
+   its identical suffix that were not divided into lines.  */
+
+void
+carry_function (void)
+{
+  struct file_data const *f = &files[0];
+  char const *function = NULL;
+  char const *p = f->linbuf[f->valid_lines];
+  char const *lim = FILE_BUFFER (f) + f->buffered;
+
+  if (! function_search_started)
+    start_function_search ();
+  function_search_started = false;
+
+  compile_function_regexp ();
+  while (p < lim)
+    {
+      char const *next = (char const *) rawmemchr (p, '\n') + 1;
+      if (function_line (p, next - p - 1))
+	function = p;
+      p = next;
+    }
+  if (! function)
+    function = find_function (f->linbuf, f->valid_lines);
+
+  if (function && function != carried_function)
+    {
+      char const *end = rawmemchr (function, '\n');
+      char *copy = xmemdup (function, end - function + 1);
+      free (carried_function);
+      carried_function = copy;
+    }
+}
+
 /* Print an edit script in context format.  */
 
 void
 print_context_script (struct change *script, bool unidiff)
 {
-  if (ignore_blank_lines || ignore_regexp.fastmap)
+  /* find_hunk marks the changes after the first as it comes to them.  */
+  if (script)
     mark_ignorable (script);
-  else
-    {
-      struct change *e;
-      for (e = script; e; e = e->link)
-	e->ignore = false;
-    }
 
-  find_function_last_search = - files[0].prefix_lines;
-  find_function_last_match = LIN_MAX;
+  start_function_search ();
 
   if (unidiff)
     print_script (script, find_hunk, pr_unidiff_hunk);
@@ -167,14 +330,15 @@ print_context_function (FILE *out, char const *function)
 static void
 pr_context_hunk (struct change *hunk)
 {
-  lin first0, last0, first1, last1, i;
+  lin first0, last0, first1, last1, i, end;
   char const *prefix;
   char const *function;
   FILE *out;
 
   /* Determine range of line numbers involved in each file.  */
 
-  enum changes changes = analyze_hunk (hunk, &first0, &last0, &first1, &last1);
+  enum changes changes = analyze_marked_hunk (hunk, &first0, &last0,
+					      &first1, &last1);
   if (! changes)
     return;
 
@@ -194,7 +358,7 @@ pr_context_hunk (struct change *hunk)
 
   /* If desired, find the preceding function definition line in file 0.  */
   function = NULL;
-  if (function_regexp.fastmap)
+  if (show_function)
     function = find_function (files[0].linbuf, first0);
 
   begin_output ();
@@ -213,7 +377,7 @@ pr_context_hunk (struct change *hunk)
     {
       struct change *next = hunk;
 
-      for (i = first0; i <= last0; i++)
+      for (i = first0; i <= last0; i = end)
 	{
 	  /* Skip past changes that apply (in file 0)
 	     only to lines before line I.  */
@@ -221,16 +385,22 @@ pr_context_hunk (struct change *hunk)
 	  while (next && next->line0 + next->deleted <= i)
 	    next = next->link;
 
-	  /* Compute the marking for line I.  */
+	  /* Compute the marking for line I, and the end of the run of
+	     lines that share it.  */
 
 	  prefix = " ";
+	  end = next ? next->line0 : last0 + 1;
 	  if (next && next->line0 <= i)
-	    /* The change NEXT covers this line.
-	       If lines were inserted here in file 1, this is "changed".
-	       Otherwise it is "deleted".  */
-	    prefix = (next->inserted > 0 ? "!" : "-");
+	    {
+	      /* The change NEXT covers this line.
+		 If lines were inserted here in file 1, this is "changed".
+		 Otherwise it is "deleted".  */
+	      prefix = (next->inserted > 0 ? "!" : "-");
+	      end = next->line0 + next->deleted;
+	    }
+	  end = MIN (end, last0 + 1);
 
-	  print_1_line (prefix, &files[0].linbuf[i]);
+	  print_flagged_lines (prefix, &files[0], i, end - 1);
 	}
     }
 
@@ -242,7 +412,7 @@ pr_context_hunk (struct change *hunk)
     {
       struct change *next = hunk;
 
-      for (i = first1; i <= last1; i++)
+      for (i = first1; i <= last1; i = end)
 	{
 	  /* Skip past changes that apply (in file 1)
 	     only to lines before line I.  */
@@ -250,16 +420,22 @@ pr_context_hunk (struct change *hunk)
 	  while (next && next->line1 + next->inserted <= i)
 	    next = next->link;
 
-	  /* Compute the marking for line I.  */
+	  /* Compute the marking for line I, and the end of the run of
+	     lines that share it.  */
 
 	  prefix = " ";
+	  end = next ? next->line1 : last1 + 1;
 	  if (next && next->line1 <= i)
-	    /* The change NEXT covers this line.
-	       If lines were deleted here in file 0, this is "changed".
-	       Otherwise it is "inserted".  */
-	    prefix = (next->deleted > 0 ? "!" : "+");
+	    {
+	      /* The change NEXT covers this line.
+		 If lines were deleted here in file 0, this is "changed".
+		 Otherwise it is "inserted".  */
+	      prefix = (next->deleted > 0 ? "!" : "+");
+	      end = next->line1 + next->inserted;
+	    }
+	  end = MIN (end, last1 + 1);
 
-	  print_1_line (prefix, &files[1].linbuf[i]);
+	  print_flagged_lines (prefix, &files[1], i, end - 1);
 	}
     }
 }
@@ -301,6 +477,9 @@ pr_unidiff_hunk (struct change *hunk)
   lin i, j, k;
   struct change *next;
   char const *function;
+  char const *context_prefix, *context_empty;
+  char const *delete_prefix, *delete_empty;
+  char const *insert_prefix, *insert_empty;
   FILE *out;
 
   /* Determine range of line numbers involved in each file.  */
@@ -324,7 +503,7 @@ pr_unidiff_hunk (struct change *hunk)
 
   /* If desired, find the preceding function definition line in file 0.  */
   function = NULL;
-  if (function_regexp.fastmap)
+  if (show_function)
     function = find_function (files[0].linbuf, first0);
 
   begin_output ();
@@ -342,6 +521,15 @@ pr_unidiff_hunk (struct change *hunk)
 
   putc ('\n', out);
 
+  /* The flag of each line, and what is left of it on an empty line
+     with --suppress-blank-empty.  */
+  context_prefix = initial_tab ? "\t" : " ";
+  context_empty = suppress_blank_empty ? "" : context_prefix;
+  delete_prefix = initial_tab ? "-\t" : "-";
+  delete_empty = suppress_blank_empty ? "-" : delete_prefix;
+  insert_prefix = initial_tab ? "+\t" : "+";
+  insert_empty = suppress_blank_empty ? "+" : insert_prefix;
+
   next = hunk;
   i = first0;
   j = first1;
@@ -349,41 +537,32 @@ pr_unidiff_hunk (struct change *hunk)
   while (i <= last0 || j <= last1)
     {
 
-      /* If the line isn't a difference, output the context from file 0. */
+      /* If the line isn't a difference, output the context from file 0
+	 up to the next difference. */
 
       if (!next || i < next->line0)
 	{
-	  char const *const *line = &files[0].linbuf[i++];
-	  if (! (suppress_blank_empty && **line == '\n'))
-	    putc (initial_tab ? '\t' : ' ', out);
-	  print_1_line (NULL, line);
-	  j++;
+	  k = (next ? next->line0 : last0 + 1) - i;
+	  print_prefixed_lines (&files[0], i, i + k - 1,
+				context_prefix, context_empty);
+	  i += k;
+	  j += k;
 	}
       else
 	{
 	  /* For each difference, first output the deleted part. */
 
 	  k = next->deleted;
-	  while (k--)
-	    {
-	      char const * const *line = &files[0].linbuf[i++];
-	      putc ('-', out);
-	      if (initial_tab && ! (suppress_blank_empty && **line == '\n'))
-		putc ('\t', out);
-	      print_1_line (NULL, line);
-	    }
+	  print_prefixed_lines (&files[0], i, i + k - 1,
+				delete_prefix, delete_empty);
+	  i += k;
 
 	  /* Then output the inserted part. */
 
 	  k = next->inserted;
-	  while (k--)
-	    {
-	      char const * const *line = &files[1].linbuf[j++];
-	      putc ('+', out);
-	      if (initial_tab && ! (suppress_blank_empty && **line == '\n'))
-		putc ('\t', out);
-	      print_1_line (NULL, line);
-	    }
+	  print_prefixed_lines (&files[1], j, j + k - 1,
+				insert_prefix, insert_empty);
+	  j += k;
 
 	  /* We're done with this hunk, so on to the next! */
 
@@ -394,9 +573,12 @@ pr_unidiff_hunk (struct change *hunk)
 
 /* Scan a (forward-ordered) edit script for the first place that more than
    2*CONTEXT unchanged lines appear, and return a pointer
-   to the 'struct change' for the last change before those lines.  */
+   to the 'struct change' for the last change before those lines.
+   START must have been marked by mark_ignorable; mark each change
+   after it that is looked at, so that the script is classified and
+   grouped into hunks in a single pass.  */
 
-static struct change * _GL_ATTRIBUTE_PURE
+static struct change *
 find_hunk (struct change *start)
 {
   struct change *prev;
@@ -416,6 +598,8 @@ find_hunk (struct change *start)
       top1 = start->line1 + start->inserted;
       prev = start;
       start = start->link;
+      if (start)
+	mark_ignorable (start);
       thresh = (start && start->ignore
 		? ignorable_threshold
 		: non_ignorable_threshold);
@@ -431,36 +615,111 @@ find_hunk (struct change *start)
   return prev;
 }
 
-/* Set the 'ignore' flag properly in each change in SCRIPT.
-   It should be 1 if all the lines inserted or deleted in that change
-   are ignorable lines.  */
+/* Set the 'ignore' flag of the change E.  It should be 1 if all the
+   lines inserted or deleted in that change are ignorable lines.  */
 
 static void
-mark_ignorable (struct change *script)
+mark_ignorable (struct change *e)
 {
-  while (script)
+  bool ignore = ignore_blank_lines || ignore_regexp.fastmap;
+  lin i;
+
+  for (i = e->line0; ignore && i < e->line0 + e->deleted; i++)
+    ignore = line_is_ignorable (&files[0], i);
+  for (i = e->line1; ignore && i < e->line1 + e->inserted; i++)
+    ignore = line_is_ignorable (&files[1], i);
+
+  e->ignore = ignore;
+}
+
+/* Like analyze_hunk, but take whether the changes of HUNK are
+   ignorable from the 'ignore' flags that find_hunk has set, rather
+   than looking at their lines again.  */
+
+static enum changes
+analyze_marked_hunk (struct change *hunk,
+		     lin *first0, lin *last0,
+		     lin *first1, lin *last1)
+{
+  struct change *e = hunk;
+  lin show_from = 0, show_to = 0;
+  bool trivial = true;
+
+  *first0 = hunk->line0;
+  *first1 = hunk->line1;
+
+  for (;;)
     {
-      struct change *next = script->link;
-      lin first0, last0, first1, last1;
+      show_from += e->deleted;
+      show_to += e->inserted;
+      trivial &= e->ignore;
+      if (! e->link)
+	break;
+      e = e->link;
+    }
 
-      /* Turn this change into a hunk: detach it from the others.  */
-      script->link = NULL;
+  *last0 = e->line0 + e->deleted - 1;
+  *last1 = e->line1 + e->inserted - 1;
 
-      /* Determine whether this change is ignorable.  */
-      script->ignore = ! analyze_hunk (script,
-				       &first0, &last0, &first1, &last1);
+  if (trivial)
+    return UNCHANGED;
+
+  return (show_from ? OLD : UNCHANGED) | (show_to ? NEW : UNCHANGED);
+}
+
+/* Compile the regexps that -F and -p give for function-header lines
+   into FUNCTION_REGEXP, unless that has been done already.  Only a
+   hunk of context output needs them, so a run that finds no
+   differences never compiles them.  */
+
+static void
+compile_function_regexp (void)
+{
+  if (function_regexp.fastmap)
+    return;
+  if (show_c_function)
+    add_regexp (&function_regexp_list, "^[[:alpha:]$_]");
+  summarize_regexp_list (&function_regexp_list);
+  function_regexp_anchored = ! function_regexp_list.unanchored;
+}
 
-      /* Reconnect the chain as before.  */
-      script->link = next;
+/* Return true if the line at LINE, of length LINELEN, is a
+   function-header line: one containing a match for the regexp in
+   'function_regexp', which has been compiled.  */
 
-      /* Advance to the following change.  */
-      script = next;
+static bool
+function_line (char const *line, size_t linelen)
+{
+  /* FIXME: re_search's size args should be size_t, not int.  */
+  int len = MIN (linelen, INT_MAX);
+
+  /* Most lines cannot start a match anywhere, and the fastmap
+     shows that far more cheaply than a call to re_search.  */
+  if (! function_regexp.can_be_null)
+    {
+      char const *fastmap = function_regexp.fastmap;
+      if (function_regexp_anchored)
+	{
+	  if (! (len && fastmap[(unsigned char) line[0]]))
+	    return false;
+	}
+      else
+	{
+	  int j = 0;
+	  while (j < len && ! fastmap[(unsigned char) line[j]])
+	    j++;
+	  if (j == len)
+	    return false;
+	}
     }
+
+  return 0 <= re_search (&function_regexp, line, len, 0, len, NULL);
 }
-
+
 /* Find the last function-header line in LINBUF prior to line number LINENUM.
    This is a line containing a match for the regexp in 'function_regexp'.
-   Return the address of the text, or NULL if no function-header is found.  */
+   Return the address of the text, or NULL if no function-header is found
+   in this window or the windows before it.  */
 
 static char const *
 find_function (char const * const *linbuf, lin linenum)
@@ -469,16 +728,13 @@ find_function (char const * const *linbuf, lin linenum)
   lin last = find_function_last_search;
   find_function_last_search = i;
 
+  compile_function_regexp ();
+
   while (last <= --i)
     {
       /* See if this line is what we want.  */
       char const *line = linbuf[i];
-      size_t linelen = linbuf[i + 1] - line - 1;
-
-      /* FIXME: re_search's size args should be size_t, not int.  */
-      int len = MIN (linelen, INT_MAX);
-
-      if (0 <= re_search (&function_regexp, line, len, 0, len, NULL))
+      if (function_line (line, linbuf[i + 1] - line - 1))
 	{
 	  find_function_last_match = i;
 	  return line;
@@ -489,5 +745,5 @@ find_function (char const * const *linbuf, lin linenum)
   if (find_function_last_match != LIN_MAX)
     return linbuf[find_function_last_match];
 
-  return NULL;
+  return carried_function;
 }
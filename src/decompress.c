@@ -0,0 +1,296 @@
+/* Read compressed files through a decompressor, and compress output.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "system.h"
+#include "decompress.h"
+
+#if HAVE_WORKING_FORK
+
+#include <c-ctype.h>
+#include <error.h>
+#include <signal.h>
+#include <xalloc.h>
+
+/* A compressed file is recognized by the bytes it starts with, and
+   is read from a pipe that a child process running the program that
+   compresses such files, with -dc, writes its text into.  Running
+   the programs, rather than linking their libraries, costs a fork
+   and an exec per file, but lets each file be decompressed in a
+   process of its own, so that the two files of a comparison are
+   decompressed at once, and at the same time as the text already
+   decompressed is read.  */
+
+struct decompressor
+{
+  char const *magic;
+  int magic_len;
+  char const *program;
+
+  /* Whether the program compresses with a thread per CPU when given
+     -T0.  */
+  bool threads;
+};
+
+static struct decompressor const decompressors[] =
+{
+  { "\x1f\x8b", 2, "gzip", false },
+  { "BZh", 3, "bzip2", false },
+  { "\xfd" "7zXZ\0", 6, "xz", true },
+  { "\x28\xb5\x2f\xfd", 4, "zstd", true }
+};
+
+enum { MAGIC_MAX = 6 };
+
+/* The decompressors running, and the descriptors of the pipes that
+   they write into.  */
+struct child
+{
+  int desc;
+  pid_t pid;
+};
+static struct child *children;
+static size_t nchildren;
+static size_t children_alloc;
+
+/* Return the decompressor for the file open on DESC, whose status is
+   *ST, or null if it does not look compressed.  */
+
+static struct decompressor const *
+find_decompressor (int desc, struct stat const *st)
+{
+  char magic[MAGIC_MAX];
+  ssize_t n;
+  off_t pos;
+  size_t i;
+
+  if (! S_ISREG (st->st_mode))
+    return NULL;
+  pos = lseek (desc, 0, SEEK_CUR);
+  if (pos < 0)
+    return NULL;
+  n = pread (desc, magic, sizeof magic, pos);
+  for (i = 0; i < sizeof decompressors / sizeof *decompressors; i++)
+    if (decompressors[i].magic_len <= n
+	&& memcmp (magic, decompressors[i].magic,
+		   decompressors[i].magic_len) == 0)
+      return &decompressors[i];
+  return NULL;
+}
+
+/* If the file NAME, open on *PDESC with status *ST, is a regular file
+   that is compressed, start decompressing it from its current offset
+   and replace *PDESC with a pipe that its text can be read from.  The
+   file is closed, and *ST, whose time stamps are kept for the headers
+   of diff's output, now says that the file is a FIFO, so that it is
+   read as a stream rather than by its size.  Exit if the
+   decompressor cannot be started.  */
+
+void
+decompress_input (int *pdesc, struct stat *st, char const *name)
+{
+  struct decompressor const *d = find_decompressor (*pdesc, st);
+  int fds[2];
+  pid_t pid;
+
+  if (! d)
+    return;
+
+  /* The pipe's read end must not be inherited by the decompressor
+     of the other file, which would keep this one from seeing that
+     the read end was closed.  */
+  if (pipe (fds) != 0 || fcntl (fds[0], F_SETFD, FD_CLOEXEC) != 0)
+    error (EXIT_TROUBLE, errno, "%s", name);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      if (dup2 (*pdesc, STDIN_FILENO) < 0
+	  || dup2 (fds[1], STDOUT_FILENO) < 0)
+	_exit (EXIT_TROUBLE);
+      close (*pdesc);
+      close (fds[1]);
+      execlp (d->program, d->program, "-dc", (char *) NULL);
+      error (0, errno, "%s", d->program);
+      _exit (errno == ENOENT ? 127 : 126);
+    }
+  if (pid < 0)
+    error (EXIT_TROUBLE, errno, "%s", "fork");
+
+  close (fds[1]);
+  close (*pdesc);
+  *pdesc = fds[0];
+  st->st_mode = (st->st_mode & ~S_IFMT) | S_IFIFO;
+
+  if (nchildren == children_alloc)
+    children = x2nrealloc (children, &children_alloc, sizeof *children);
+  children[nchildren].desc = fds[0];
+  children[nchildren].pid = pid;
+  nchildren++;
+}
+
+/* Close DESC, and if a decompressor writes into it, wait for the
+   decompressor to exit.  Return -1, setting errno, if closing fails
+   or the decompressor failed; a decompressor that dies of SIGPIPE,
+   as the reader stopped reading before the end, has not failed.  */
+
+int
+decompress_close (int desc)
+{
+  int r = close (desc);
+  int e = errno;
+  size_t i;
+
+  for (i = 0; i < nchildren; i++)
+    if (children[i].desc == desc)
+      {
+	int status;
+	pid_t pid = children[i].pid;
+	children[i] = children[--nchildren];
+	while (waitpid (pid, &status, 0) < 0)
+	  if (errno != EINTR)
+	    return -1;
+	if (r == 0
+	    && ! (WIFEXITED (status) && WEXITSTATUS (status) == 0)
+	    && ! (WIFSIGNALED (status) && WTERMSIG (status) == SIGPIPE))
+	  {
+	    r = -1;
+	    e = EIO;
+	  }
+	break;
+      }
+
+  errno = e;
+  return r;
+}
+
+/* The process that compresses standard output, and its program.  */
+static pid_t compressor_pid;
+static char const *compressor_program;
+
+/* SIGPIPE is caught while the compressor runs, so that a write to a
+   compressor that has exited fails with EPIPE and is reported by
+   finish_compressed_output, instead of killing diff.  Catching it
+   rather than ignoring it lets the programs that diff runs later get
+   the default action.  */
+
+static void
+catch_sigpipe (int sig __attribute__((unused)))
+{
+}
+
+/* Make standard output, to which nothing has been written yet, a pipe
+   to a child process that compresses what is written to it and writes
+   the result to what was standard output.  SPEC is PROGRAM or
+   PROGRAM:LEVEL, where PROGRAM is one of the decompressors' programs
+   and LEVEL a compression level of one or two digits, passed to it as
+   -LEVEL.  xz and zstd are told to use a thread per CPU.  Return false
+   if SPEC is not of that form.  Exit if the compressor cannot be
+   started.  */
+
+bool
+start_compressed_output (char const *spec)
+{
+  char const *colon = strchr (spec, ':');
+  size_t len = colon ? colon - spec : strlen (spec);
+  char level[sizeof "-99"];
+  char const *argv[5];
+  struct decompressor const *d = NULL;
+  struct sigaction act;
+  int fds[2];
+  pid_t pid;
+  size_t i;
+  int n = 0;
+
+  for (i = 0; i < sizeof decompressors / sizeof *decompressors; i++)
+    if (strlen (decompressors[i].program) == len
+	&& memcmp (decompressors[i].program, spec, len) == 0)
+      d = &decompressors[i];
+  if (! d)
+    return false;
+
+  argv[n++] = d->program;
+  argv[n++] = "-c";
+  if (colon)
+    {
+      char const *l = colon + 1;
+      if (! (c_isdigit (l[0]) && (! l[1] || (c_isdigit (l[1]) && ! l[2]))))
+	return false;
+      level[0] = '-';
+      strcpy (level + 1, l);
+      argv[n++] = level;
+    }
+  if (d->threads)
+    argv[n++] = "-T0";
+  argv[n] = NULL;
+
+  if (pipe (fds) != 0)
+    error (EXIT_TROUBLE, errno, "%s", "pipe");
+  pid = fork ();
+  if (pid == 0)
+    {
+      if (dup2 (fds[0], STDIN_FILENO) < 0)
+	_exit (EXIT_TROUBLE);
+      close (fds[0]);
+      close (fds[1]);
+      execvp (d->program, (char **) argv);
+      error (0, errno, "%s", d->program);
+      _exit (errno == ENOENT ? 127 : 126);
+    }
+  if (pid < 0)
+    error (EXIT_TROUBLE, errno, "%s", "fork");
+
+  if (dup2 (fds[1], STDOUT_FILENO) < 0)
+    error (EXIT_TROUBLE, errno, "%s", "dup2");
+  close (fds[0]);
+  close (fds[1]);
+
+  sigaction (SIGPIPE, NULL, &act);
+  if (act.sa_handler != SIG_IGN)
+    {
+      act.sa_handler = catch_sigpipe;
+      sigemptyset (&act.sa_mask);
+      act.sa_flags = SA_RESTART;
+      sigaction (SIGPIPE, &act, NULL);
+    }
+
+  compressor_pid = pid;
+  compressor_program = d->program;
+  return true;
+}
+
+/* Wait for the compressor of standard output, which has been closed,
+   to finish.  Exit if it failed, which is also why writing to it
+   fails with EPIPE.  */
+
+void
+finish_compressed_output (void)
+{
+  int status;
+
+  if (! compressor_pid)
+    return;
+  while (waitpid (compressor_pid, &status, 0) < 0)
+    if (errno != EINTR)
+      error (EXIT_TROUBLE, errno, "%s", compressor_program);
+  if (! (WIFEXITED (status) && WEXITSTATUS (status) == 0))
+    error (EXIT_TROUBLE, 0, _("%s: compressing the output failed"),
+	   compressor_program);
+}
+
+#endif
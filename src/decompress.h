@@ -0,0 +1,31 @@
+/* Read compressed files through a decompressor, and compress output.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#if HAVE_WORKING_FORK
+/* Used by diff and cmp for --decompress.  */
+extern void decompress_input (int *, struct stat *, char const *);
+extern int decompress_close (int);
+/* Used by diff for --output-compress.  */
+extern bool start_compressed_output (char const *);
+extern void finish_compressed_output (void);
+#else
+# define decompress_input(pdesc, st, name) ((void) 0)
+# define decompress_close(desc) close (desc)
+# define finish_compressed_output() ((void) 0)
+#endif
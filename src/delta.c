@@ -0,0 +1,532 @@
+/* Binary deltas of binary files for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <cmpbuf.h>
+#include <xalloc.h>
+
+/* With --binary-delta, a pair of binary files that differ is output
+   as a delta in the VCDIFF format of RFC 3284, which rebuilds the
+   second file from the first; 'xdelta3 -d -s FILE1' applies it.  The
+   delta uses only the default code table, with ADD instructions for
+   new bytes and COPY instructions for bytes found in the first file,
+   whose sizes and addresses are given explicitly.
+
+   The second file is encoded a window of DELTA_WINDOW bytes at a
+   time.  Its bytes are looked up in an index of the first file with
+   an entry for each aligned block of the first file, found by a
+   rolling hash of each block of the second file, so that a block
+   found anywhere in the first file is copied from there; and the
+   bytes that follow the last copy, shifted as it was, are tried
+   first, so that runs broken by changed bytes resume at once.  The
+   block size grows with the first file so that its index has at most
+   DELTA_INDEX_MAX entries, and the first file is read through a small
+   cache, so the memory used is bounded whatever the files' sizes.
+   Where the files are at the same offsets, data that they share and
+   holes that they both have are copied without being read.  */
+
+enum
+{
+  DELTA_WINDOW = 4 * 1024 * 1024,
+  DELTA_INDEX_MAX = 1024 * 1024,
+  DELTA_BLOCK_MIN = 16,
+
+  /* The first file is read through a cache of DELTA_SLOTS slots of
+     DELTA_SLOT_SIZE bytes.  */
+  DELTA_SLOT_SIZE = 64 * 1024,
+  DELTA_SLOTS = 16
+};
+
+/* The code table indexes of the instructions used: ADD and COPY in
+   mode 0 (VCD_SELF), with their sizes following them.  */
+enum { VCD_ADD = 1, VCD_COPY = 19 };
+
+/* Window indicator bit saying that the window copies from the source
+   file.  */
+enum { VCD_SOURCE = 1 };
+
+static unsigned char const vcdiff_header[] = { 0xD6, 0xC3, 0xC4, 0, 0 };
+
+/* A growing byte array.  */
+struct bytes
+{
+  char *buf;
+  size_t len;
+  size_t alloc;
+};
+
+/* The state of encoding a delta.  */
+struct delta
+{
+  /* The first file, which is the source, and the second, which is
+     the target.  */
+  int desc[2];
+  off_t size[2];
+  char const *name[2];
+
+  /* The index of the source's blocks: the offset of a block with
+     each hash, or -1.  */
+  off_t *index;
+  size_t index_mask;
+  size_t block;
+  uint32_t block_power;
+
+  /* The cache of the source's contents.  */
+  char *slot[DELTA_SLOTS];
+  off_t slot_start[DELTA_SLOTS];
+  size_t slot_len[DELTA_SLOTS];
+
+  /* The sections of the window being encoded.  */
+  struct bytes data, inst, addr;
+};
+
+/* The multiplier of the rolling hash.  */
+enum { HASH_MULTIPLIER = 0x01000193 };
+
+static void
+put_byte (struct bytes *b, unsigned char c)
+{
+  if (b->len == b->alloc)
+    b->buf = x2nrealloc (b->buf, &b->alloc, 1);
+  b->buf[b->len++] = c;
+}
+
+static void
+put_bytes (struct bytes *b, char const *p, size_t n)
+{
+  while (b->alloc - b->len < n)
+    b->buf = x2nrealloc (b->buf, &b->alloc, 1);
+  memcpy (b->buf + b->len, p, n);
+  b->len += n;
+}
+
+/* Append N as a VCDIFF integer: base 128, most significant digit
+   first, with the top bit set in all bytes but the last.  */
+
+static void
+put_integer (struct bytes *b, uintmax_t n)
+{
+  unsigned char digits[(sizeof n * CHAR_BIT + 6) / 7];
+  int i = sizeof digits;
+
+  digits[--i] = n & 0x7f;
+  while ((n >>= 7) != 0)
+    digits[--i] = 0x80 | (n & 0x7f);
+  put_bytes (b, (char const *) digits + i, sizeof digits - i);
+}
+
+/* Output the bytes of B to OUT.  B's buffer is null if it is empty.  */
+
+static void
+write_bytes (struct bytes const *b, FILE *out)
+{
+  if (b->len)
+    fwrite (b->buf, 1, b->len, out);
+}
+
+/* Return the hash of the N bytes at P.  */
+
+static uint32_t
+block_hash (char const *p, size_t n)
+{
+  uint32_t h = 0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    h = h * HASH_MULTIPLIER + (unsigned char) p[i];
+  return h;
+}
+
+/* Return the slot of D's index for the hash H.  */
+
+static size_t
+index_slot (struct delta const *d, uint32_t h)
+{
+  h ^= h >> 15;
+  h *= 0x2c1b3c6d;
+  h ^= h >> 12;
+  return h & d->index_mask;
+}
+
+/* Index the aligned blocks of D's source, keeping the first block
+   with each hash.  */
+
+static void
+index_source (struct delta *d)
+{
+  size_t entries = 1;
+  size_t buf_size;
+  char *buf;
+  off_t pos = 0;
+  struct read_advice advice;
+  size_t i;
+
+  d->block = DELTA_BLOCK_MIN;
+  while (d->size[0] / d->block > DELTA_INDEX_MAX)
+    d->block *= 2;
+  while (entries < 2 * (d->size[0] / d->block)
+	 && entries < 2 * DELTA_INDEX_MAX)
+    entries *= 2;
+  d->index = xnmalloc (entries, sizeof *d->index);
+  d->index_mask = entries - 1;
+  for (i = 0; i < entries; i++)
+    d->index[i] = -1;
+
+  d->block_power = 1;
+  for (i = 0; i < d->block; i++)
+    d->block_power *= HASH_MULTIPLIER;
+
+  buf_size = MAX (d->block, DELTA_SLOT_SIZE);
+  buf = xmalloc (buf_size);
+  read_advice_init (&advice, d->desc[0], d->size[0], false);
+  while (pos + (off_t) d->block <= d->size[0])
+    {
+      size_t n = block_pread (d->desc[0], buf, buf_size, pos);
+      size_t b;
+      if (n == SIZE_MAX)
+	pfatal_with_name (d->name[0]);
+      read_advice_update (&advice, n);
+      for (b = 0; b + d->block <= n; b += d->block)
+	{
+	  size_t s = index_slot (d, block_hash (buf + b, d->block));
+	  if (d->index[s] < 0)
+	    d->index[s] = pos + b;
+	}
+      if (n < buf_size)
+	break;
+      pos += n;
+    }
+  free (buf);
+}
+
+/* Return the cached contents of D's source starting at START, a
+   multiple of DELTA_SLOT_SIZE, storing their length into *LEN.  */
+
+static char const *
+source_slot (struct delta *d, off_t start, size_t *len)
+{
+  int s = (start / DELTA_SLOT_SIZE) % DELTA_SLOTS;
+  if (d->slot_start[s] != start)
+    {
+      size_t n;
+      if (! d->slot[s])
+	d->slot[s] = xmalloc (DELTA_SLOT_SIZE);
+      n = block_pread (d->desc[0], d->slot[s], DELTA_SLOT_SIZE, start);
+      if (n == SIZE_MAX)
+	pfatal_with_name (d->name[0]);
+      d->slot_start[s] = start;
+      d->slot_len[s] = n;
+    }
+  *len = d->slot_len[s];
+  return d->slot[s];
+}
+
+/* Return how many of the N bytes at T are the same as the bytes of
+   D's source at SRC.  */
+
+static size_t
+source_match (struct delta *d, off_t src, char const *t, size_t n)
+{
+  size_t matched = 0;
+
+  while (matched < n && src < d->size[0])
+    {
+      off_t start = src - src % DELTA_SLOT_SIZE;
+      size_t len;
+      char const *p = source_slot (d, start, &len);
+      size_t i = src - start;
+      if (len <= i)
+	break;
+      while (i < len && matched < n && p[i] == t[matched])
+	{
+	  i++;
+	  matched++;
+	}
+      src = start + i;
+      if (i < len && matched < n)
+	break;
+    }
+  return matched;
+}
+
+/* Return how many of the N bytes before T are the same as the bytes
+   of D's source before SRC.  */
+
+static size_t
+source_match_back (struct delta *d, off_t src, char const *t, size_t n)
+{
+  size_t matched = 0;
+
+  while (matched < n && 0 < src)
+    {
+      off_t start = (src - 1) - (src - 1) % DELTA_SLOT_SIZE;
+      size_t len;
+      char const *p = source_slot (d, start, &len);
+      size_t i = src - start;
+      if (len < i)
+	break;
+      while (0 < i && matched < n && p[i - 1] == t[-1 - (ptrdiff_t) matched])
+	{
+	  i--;
+	  matched++;
+	}
+      src = start + i;
+      if (0 < i && matched < n)
+	break;
+    }
+  return matched;
+}
+
+static void
+add_instruction (struct delta *d, char const *p, size_t n)
+{
+  if (n)
+    {
+      put_byte (&d->inst, VCD_ADD);
+      put_integer (&d->inst, n);
+      put_bytes (&d->data, p, n);
+    }
+}
+
+static void
+copy_instruction (struct delta *d, off_t src, size_t n)
+{
+  put_byte (&d->inst, VCD_COPY);
+  put_integer (&d->inst, n);
+  put_integer (&d->addr, src);
+}
+
+/* Output to OUT the window of SIZE target bytes whose instructions D
+   holds, and clear them.  */
+
+static void
+output_window (struct delta *d, FILE *out, size_t size)
+{
+  struct bytes head = { NULL, 0, 0 };
+  struct bytes delta = { NULL, 0, 0 };
+
+  put_integer (&delta, size);
+  put_byte (&delta, 0);
+  put_integer (&delta, d->data.len);
+  put_integer (&delta, d->inst.len);
+  put_integer (&delta, d->addr.len);
+
+  if (d->size[0])
+    {
+      put_byte (&head, VCD_SOURCE);
+      put_integer (&head, d->size[0]);
+      put_integer (&head, 0);
+    }
+  else
+    put_byte (&head, 0);
+  put_integer (&head, delta.len + d->data.len + d->inst.len + d->addr.len);
+
+  write_bytes (&head, out);
+  write_bytes (&delta, out);
+  write_bytes (&d->data, out);
+  write_bytes (&d->inst, out);
+  write_bytes (&d->addr, out);
+  free (head.buf);
+  free (delta.buf);
+  d->data.len = d->inst.len = d->addr.len = 0;
+}
+
+/* Encode the SIZE bytes of D's target at T, which start at offset
+   TPOS in it, as a window output to OUT.  *SHIFT is the offset in the
+   source less the offset in the target of the bytes that follow the
+   last copy; update it.  */
+
+static void
+encode_window (struct delta *d, FILE *out, char const *t, size_t size,
+	       off_t tpos, off_t *shift)
+{
+  size_t block = d->block;
+  size_t lit = 0;		/* Start of the bytes not yet encoded.  */
+  size_t p = 0;
+  size_t hashed = SIZE_MAX;	/* Where H is the hash of a block.  */
+  uint32_t h = 0;
+
+  while (p < size)
+    {
+      off_t src = tpos + p + *shift;
+      size_t len = 0;
+
+      /* Try the bytes that follow the last copy.  */
+      if (0 <= src && src < d->size[0])
+	len = source_match (d, src, t + p, size - p);
+
+      /* Otherwise look the block here up in the index.  */
+      if (len < block && d->size[0] && block <= size - p)
+	{
+	  off_t found;
+	  if (hashed != p)
+	    h = block_hash (t + p, block);
+	  hashed = p;
+	  found = d->index[index_slot (d, h)];
+	  if (0 <= found)
+	    {
+	      size_t n = source_match (d, found, t + p, size - p);
+	      if (block <= n && len < n)
+		{
+		  src = found;
+		  len = n;
+		}
+	    }
+	}
+
+      if (DELTA_BLOCK_MIN <= len)
+	{
+	  size_t back = source_match_back (d, src, t + p, p - lit);
+	  add_instruction (d, t + lit, p - lit - back);
+	  copy_instruction (d, src - back, back + len);
+	  p += len;
+	  lit = p;
+	  *shift = src + len - (tpos + p);
+	  continue;
+	}
+
+      /* Move on a byte, rolling the hash along.  */
+      if (hashed == p && block < size - p)
+	{
+	  h = (h * HASH_MULTIPLIER + (unsigned char) t[p + block]
+	       - (unsigned char) t[p] * d->block_power);
+	  hashed = p + 1;
+	}
+      p++;
+    }
+
+  add_instruction (d, t + lit, size - lit);
+  output_window (d, out, size);
+}
+
+/* Output to OUT a VCDIFF delta that rebuilds the second regular file
+   of CMP from the first, reading them from their starts.  */
+
+static void
+encode_delta (struct comparison const *cmp, FILE *out)
+{
+  struct delta d;
+  struct extent_scan extents[2];
+  struct read_advice advice;
+  off_t tpos = 0;
+  off_t shift = 0;
+  char *t;
+  int f;
+
+  memset (&d, 0, sizeof d);
+  for (f = 0; f < 2; f++)
+    {
+      d.desc[f] = cmp->file[f].desc;
+      d.size[f] = cmp->file[f].stat.st_size;
+      d.name[f] = cmp->file[f].name;
+      if (lseek (d.desc[f], 0, SEEK_SET) < 0)
+	pfatal_with_name (d.name[f]);
+      extent_scan_init (&extents[f], d.desc[f], &cmp->file[f].stat);
+    }
+  for (f = 0; f < DELTA_SLOTS; f++)
+    d.slot_start[f] = -1;
+  index_source (&d);
+  read_advice_init (&advice, d.desc[1], d.size[1], true);
+
+  fwrite (vcdiff_header, 1, sizeof vcdiff_header, out);
+  t = xmalloc (DELTA_WINDOW);
+  while (tpos < d.size[1])
+    {
+      size_t n;
+
+      /* Copy what the files share at the same offsets unread.  */
+      if (! shift && 0 <= extents[0].fd && 0 <= extents[1].fd)
+	{
+	  bool stored;
+	  off_t skip = same_extent_bytes (extents, tpos, tpos, &stored);
+	  skip = MIN (skip, MIN (d.size[0], d.size[1]) - tpos);
+	  skip = MIN (skip, DELTA_WINDOW);
+	  if (skip)
+	    {
+	      copy_instruction (&d, tpos, skip);
+	      output_window (&d, out, skip);
+	      read_advice_update (&advice, skip);
+	      tpos += skip;
+	      continue;
+	    }
+	}
+
+      n = block_pread (d.desc[1], t, MIN (DELTA_WINDOW, d.size[1] - tpos),
+		       tpos);
+      if (n == SIZE_MAX)
+	pfatal_with_name (d.name[1]);
+      if (! n)
+	break;
+      read_advice_update (&advice, n);
+      encode_window (&d, out, t, n, tpos, &shift);
+      tpos += n;
+    }
+
+  free (t);
+  free (d.index);
+  for (f = 0; f < DELTA_SLOTS; f++)
+    free (d.slot[f]);
+  free (d.data.buf);
+  free (d.inst.buf);
+  free (d.addr.buf);
+}
+
+/* Output a binary delta for the binary files of CMP, which differ.
+   Return false if they are not both regular files, which a delta
+   cannot be made for.  A pair of files found while comparing
+   directories gets a line naming the files and giving the size of
+   the delta before the delta itself.  */
+
+bool
+print_binary_delta (struct comparison const *cmp)
+{
+  int f;
+
+  for (f = 0; f < 2; f++)
+    if (! (0 <= cmp->file[f].desc && S_ISREG (cmp->file[f].stat.st_mode)))
+      return false;
+
+  if (! cmp->parent)
+    encode_delta (cmp, stdout);
+  else
+    {
+      FILE *tmp = tmpfile ();
+      char buf[16 * 1024];
+      char sizebuf[INT_BUFSIZE_BOUND (intmax_t)];
+      off_t size;
+      size_t n;
+
+      if (! tmp)
+	pfatal_with_name ("tmpfile");
+      encode_delta (cmp, tmp);
+      if (fflush (tmp) != 0 || ferror (tmp))
+	pfatal_with_name (_("write failed"));
+      size = ftello (tmp);
+      rewind (tmp);
+      sprintf (sizebuf, "%"PRIdMAX, (intmax_t) size);
+      printf (_("Binary delta from %s to %s, %s bytes:\n"),
+	      file_label[0] ? file_label[0] : cmp->file[0].name,
+	      file_label[1] ? file_label[1] : cmp->file[1].name, sizebuf);
+      while ((n = fread (buf, 1, sizeof buf, tmp)) != 0)
+	fwrite (buf, 1, n, stdout);
+      if (ferror (tmp))
+	pfatal_with_name (_("read failed"));
+      fclose (tmp);
+    }
+  return true;
+}
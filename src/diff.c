@@ -18,10 +18,13 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
-#define GDIFF_MAIN
 #include "diff.h"
 #include <assert.h>
+#include "batch.h"
+#include "decompress.h"
+#include "filestat.h"
 #include "paths.h"
+#include "probes.h"
 #include <c-stack.h>
 #include <dirname.h>
 #include <error.h>
@@ -34,12 +37,11 @@
 #include <hard-locale.h>
 #include <prepargs.h>
 #include <progname.h>
-#include <sh-quote.h>
 #include <stat-time.h>
 #include <timespec.h>
 #include <version-etc.h>
 #include <xalloc.h>
-#include <xreadlink.h>
+#include <xstrtol.h>
 #include <binary-io.h>
 
 /* The official name of this program (e.g., no 'g' prefix).  */
@@ -52,35 +54,20 @@
   proper_name ("Richard Stallman"), \
   proper_name ("Len Tower")
 
-#ifndef GUTTER_WIDTH_MINIMUM
-# define GUTTER_WIDTH_MINIMUM 3
-#endif
-
-struct regexp_list
-{
-  char *regexps;	/* chars representing disjunction of the regexps */
-  size_t len;		/* chars used in 'regexps' */
-  size_t size;		/* size malloc'ed for 'regexps'; 0 if not malloc'ed */
-  bool multiple_regexps;/* Does 'regexps' represent a disjunction?  */
-  struct re_pattern_buffer *buf;
-};
-
 static int compare_files (struct comparison const *, char const *, char const *);
-static void add_regexp (struct regexp_list *, char const *);
-static void summarize_regexp_list (struct regexp_list *);
+static int compare_pairs (void);
+static void retain_fixed_file (char const *, int);
 static void specify_style (enum output_style);
 static void specify_value (char const **, char const *, char const *);
 static void try_help (char const *, char const *) __attribute__((noreturn));
 static void check_stdout (void);
+static void output_to_fd (int);
 static void usage (void);
 
 /* If comparing directories, compare their common subdirectories
    recursively.  */
 static bool recursive;
 
-/* In context diffs, show previous lines that match these regexps.  */
-static struct regexp_list function_regexp_list;
-
 /* Ignore changes affecting only lines that match these regexps.  */
 static struct regexp_list ignore_regexp_list;
 
@@ -102,6 +89,47 @@ static bool unidirectional_new_file;
 /* Report files compared that are the same (-s).
    Normally nothing is output when that happens.  */
 static bool report_identical_files;
+
+/* Consider regular files with the same size and last modification
+   time to be identical, without reading them (--trust-mtime).  */
+static bool trust_mtime;
+
+/* Compare the pairs of files listed on standard input rather than
+   the operands (--batch-pairs).  */
+static bool batch_pairs;
+
+#if HAVE_WORKING_FORK
+/* Compare the text of compressed files rather than the files
+   (--decompress).  */
+static bool decompress;
+#else
+enum { decompress = false };
+#endif
+
+/* The compressor, and its level, that the output is piped through
+   (--output-compress), or null.  */
+static char const *output_compressor;
+
+/* The descriptor of the file or shared memory object that the output
+   goes to instead of standard output (--output-fd-mmap), or -1.  */
+static int output_fd = -1;
+
+/* The file to write an index of the output to (--output-index), or
+   null.  */
+static char const *output_index_name;
+
+/* The checkpoint to resume a recursive comparison from (--resume), or
+   null.  */
+static char const *resume_name;
+
+/* The file that --from-file or --to-file names, if retain_fixed_file
+   has kept it in memory.  */
+static struct file_data retained_file;
+
+/* Flush stdout after each pair of files that differ.  This is done
+   only if stdout is a terminal, or is where error messages go too, as
+   otherwise it costs a write per pair and shows nothing sooner.  */
+static bool flush_each_pair;
 
 static char const shortopts[] =
 "0123456789abBcC:dD:eEfF:hHiI:lL:nNpPqrsS:tTuU:vwW:x:X:yZ";
@@ -109,23 +137,60 @@ static char const shortopts[] =
 /* Values for long options that do not have single-letter equivalents.  */
 enum
 {
-  BINARY_OPTION = CHAR_MAX + 1,
+  APPLY_OPTION = CHAR_MAX + 1,
+  BATCH_OPTION,
+  BATCH_PAIRS_OPTION,
+  BINARY_OPTION,
+  BINARY_DELTA_OPTION,
+  CACHED_STAT_OPTION,
+  CHECKPOINT_OPTION,
+  DECOMPRESS_OPTION,
+  DIFF_ALGORITHM_OPTION,
+  DIRECT_IO_OPTION,
+  EXTERNAL_PR_OPTION,
+  FIND_RENAMES_OPTION,
   FROM_FILE_OPTION,
   HELP_OPTION,
   HORIZON_LINES_OPTION,
+  HUGE_PAGES_OPTION,
   IGNORE_FILE_NAME_CASE_OPTION,
+  IGNORE_MATCHING_LINES_EARLY_OPTION,
+  INCLUDE_OPTION,
   INHIBIT_HUNK_MERGE_OPTION,
+  JOBS_OPTION,
+  JSON_OPTION,
   LEFT_COLUMN_OPTION,
+  LINE_DICTIONARY_OPTION,
   LINE_FORMAT_OPTION,
+  MANIFEST_OPTION,
+  MAX_COST_OPTION,
+  MAX_HUNKS_OPTION,
+  MAX_MEMORY_OPTION,
+  MOVES_OPTION,
   NO_DEREFERENCE_OPTION,
   NO_IGNORE_FILE_NAME_CASE_OPTION,
   NORMAL_OPTION,
+  NUMSTAT_OPTION,
+  OUTPUT_COMPRESS_OPTION,
+  OUTPUT_FD_MMAP_OPTION,
+  OUTPUT_INDEX_OPTION,
+  PREFETCH_OPTION,
+  PROGRESS_OPTION,
+  READ_INDEX_OPTION,
+  REMOTE_OPTION,
+  RESUME_OPTION,
   SDIFF_MERGE_ASSIST_OPTION,
+  STAT_OPTION,
+  STATS_OPTION,
   STRIP_TRAILING_CR_OPTION,
   SUPPRESS_BLANK_EMPTY_OPTION,
   SUPPRESS_COMMON_LINES_OPTION,
   TABSIZE_OPTION,
+  TIMEOUT_OPTION,
   TO_FILE_OPTION,
+  TRUST_MTIME_OPTION,
+  WORD_DIFF_OPTION,
+  WRITE_INDEX_OPTION,
 
   /* These options must be in sequence.  */
   UNCHANGED_LINE_FORMAT_OPTION,
@@ -156,97 +221,140 @@ static char const line_format_option[][sizeof "--unchanged-line-format"] =
 
 static struct option const longopts[] =
 {
+  {"apply", 0, 0, APPLY_OPTION},
+  {"batch", 2, 0, BATCH_OPTION},
+  {"batch-pairs", 0, 0, BATCH_PAIRS_OPTION},
   {"binary", 0, 0, BINARY_OPTION},
+  {"binary-delta", 0, 0, BINARY_DELTA_OPTION},
   {"brief", 0, 0, 'q'},
+  {"cached-stat", 0, 0, CACHED_STAT_OPTION},
   {"changed-group-format", 1, 0, CHANGED_GROUP_FORMAT_OPTION},
+  {"checkpoint", 1, 0, CHECKPOINT_OPTION},
   {"context", 2, 0, 'C'},
+  {"decompress", 0, 0, DECOMPRESS_OPTION},
+  {"diff-algorithm", 1, 0, DIFF_ALGORITHM_OPTION},
+  {"direct-io", 0, 0, DIRECT_IO_OPTION},
   {"ed", 0, 0, 'e'},
   {"exclude", 1, 0, 'x'},
   {"exclude-from", 1, 0, 'X'},
   {"expand-tabs", 0, 0, 't'},
+  {"external-pr", 0, 0, EXTERNAL_PR_OPTION},
   {"forward-ed", 0, 0, 'f'},
+  {"find-renames", 0, 0, FIND_RENAMES_OPTION},
   {"from-file", 1, 0, FROM_FILE_OPTION},
   {"help", 0, 0, HELP_OPTION},
   {"horizon-lines", 1, 0, HORIZON_LINES_OPTION},
+  {"huge-pages", 0, 0, HUGE_PAGES_OPTION},
   {"ifdef", 1, 0, 'D'},
   {"ignore-all-space", 0, 0, 'w'},
   {"ignore-blank-lines", 0, 0, 'B'},
   {"ignore-case", 0, 0, 'i'},
   {"ignore-file-name-case", 0, 0, IGNORE_FILE_NAME_CASE_OPTION},
   {"ignore-matching-lines", 1, 0, 'I'},
+  {"ignore-matching-lines-early", 0, 0, IGNORE_MATCHING_LINES_EARLY_OPTION},
   {"ignore-space-change", 0, 0, 'b'},
   {"ignore-tab-expansion", 0, 0, 'E'},
+  {"include", 1, 0, INCLUDE_OPTION},
   {"ignore-trailing-space", 0, 0, 'Z'},
   {"inhibit-hunk-merge", 0, 0, INHIBIT_HUNK_MERGE_OPTION},
   {"initial-tab", 0, 0, 'T'},
+  {"jobs", 1, 0, JOBS_OPTION},
+  {"json", 0, 0, JSON_OPTION},
   {"label", 1, 0, 'L'},
   {"left-column", 0, 0, LEFT_COLUMN_OPTION},
+  {"line-dictionary", 2, 0, LINE_DICTIONARY_OPTION},
   {"line-format", 1, 0, LINE_FORMAT_OPTION},
+  {"manifest", 1, 0, MANIFEST_OPTION},
+  {"max-cost", 1, 0, MAX_COST_OPTION},
+  {"max-hunks", 1, 0, MAX_HUNKS_OPTION},
+  {"max-memory", 1, 0, MAX_MEMORY_OPTION},
   {"minimal", 0, 0, 'd'},
+  {"moves", 2, 0, MOVES_OPTION},
   {"new-file", 0, 0, 'N'},
   {"new-group-format", 1, 0, NEW_GROUP_FORMAT_OPTION},
   {"new-line-format", 1, 0, NEW_LINE_FORMAT_OPTION},
   {"no-dereference", 0, 0, NO_DEREFERENCE_OPTION},
   {"no-ignore-file-name-case", 0, 0, NO_IGNORE_FILE_NAME_CASE_OPTION},
   {"normal", 0, 0, NORMAL_OPTION},
+  {"numstat", 0, 0, NUMSTAT_OPTION},
   {"old-group-format", 1, 0, OLD_GROUP_FORMAT_OPTION},
   {"old-line-format", 1, 0, OLD_LINE_FORMAT_OPTION},
+  {"output-compress", 1, 0, OUTPUT_COMPRESS_OPTION},
+  {"output-fd-mmap", 1, 0, OUTPUT_FD_MMAP_OPTION},
+  {"output-index", 1, 0, OUTPUT_INDEX_OPTION},
   {"paginate", 0, 0, 'l'},
+  {"prefetch", 1, 0, PREFETCH_OPTION},
+  {"progress", 0, 0, PROGRESS_OPTION},
   {"rcs", 0, 0, 'n'},
+  {"read-index", 0, 0, READ_INDEX_OPTION},
   {"recursive", 0, 0, 'r'},
+  {"remote", 1, 0, REMOTE_OPTION},
   {"report-identical-files", 0, 0, 's'},
+  {"resume", 1, 0, RESUME_OPTION},
   {"sdiff-merge-assist", 0, 0, SDIFF_MERGE_ASSIST_OPTION},
   {"show-c-function", 0, 0, 'p'},
   {"show-function-line", 1, 0, 'F'},
   {"side-by-side", 0, 0, 'y'},
   {"speed-large-files", 0, 0, 'H'},
   {"starting-file", 1, 0, 'S'},
+  {"stat", 0, 0, STAT_OPTION},
+  {"stats", 2, 0, STATS_OPTION},
   {"strip-trailing-cr", 0, 0, STRIP_TRAILING_CR_OPTION},
   {"suppress-blank-empty", 0, 0, SUPPRESS_BLANK_EMPTY_OPTION},
   {"suppress-common-lines", 0, 0, SUPPRESS_COMMON_LINES_OPTION},
   {"tabsize", 1, 0, TABSIZE_OPTION},
   {"text", 0, 0, 'a'},
+  {"timeout", 1, 0, TIMEOUT_OPTION},
   {"to-file", 1, 0, TO_FILE_OPTION},
+  {"trust-mtime", 0, 0, TRUST_MTIME_OPTION},
   {"unchanged-group-format", 1, 0, UNCHANGED_GROUP_FORMAT_OPTION},
   {"unchanged-line-format", 1, 0, UNCHANGED_LINE_FORMAT_OPTION},
   {"unidirectional-new-file", 0, 0, 'P'},
   {"unified", 2, 0, 'U'},
   {"version", 0, 0, 'v'},
   {"width", 1, 0, 'W'},
+  {"word-diff", 0, 0, WORD_DIFF_OPTION},
+  {"write-index", 0, 0, WRITE_INDEX_OPTION},
   {0, 0, 0, 0}
 };
 
-/* Return a string containing the command options with which diff was invoked.
-   Spaces appear between what were separate ARGV-elements.
-   There is a space at the beginning but none at the end.
-   If there were no options, the result is an empty string.
+/* The elements of ARGV for options that affect only how diff does its
+   work or what it writes elsewhere than the differences, such as
+   --jobs and --stats.  They are left out of the headers of the
+   output, so that it is the same with them as without.  */
+static char **scheduling_switch;
+static size_t scheduling_switches;
+static size_t scheduling_switch_alloc;
 
-   Arguments: OPTIONVEC, a vector containing separate ARGV-elements, and COUNT,
-   the length of that vector.  */
+/* Note that the option that getopt_long just returned from ARGV is a
+   scheduling option, along with its argument if that was a separate
+   element.  */
 
-static char *
-option_list (char **optionvec, int count)
+static void
+omit_switch (char **argv)
 {
-  int i;
-  size_t size = 1;
-  char *result;
-  char *p;
-
-  for (i = 0; i < count; i++)
-    size += 1 + shell_quote_length (optionvec[i]);
-
-  p = result = xmalloc (size);
-
-  for (i = 0; i < count; i++)
+  int n = 1 + (optarg && optarg == argv[optind - 1]);
+  while (n)
     {
-      *p++ = ' ';
-      p = shell_quote_copy (p, optionvec[i]);
+      if (scheduling_switches == scheduling_switch_alloc)
+	scheduling_switch = x2nrealloc (scheduling_switch,
+					&scheduling_switch_alloc,
+					sizeof *scheduling_switch);
+      scheduling_switch[scheduling_switches++] = argv[optind - n--];
     }
-
-  *p = '\0';
-  return result;
 }
 
+/* Return true if the element ARG of argv was noted by omit_switch.  */
+
+static bool _GL_ATTRIBUTE_PURE
+omitted_switch (char const *arg)
+{
+  size_t i;
+  for (i = 0; i < scheduling_switches; i++)
+    if (scheduling_switch[i] == arg)
+      return true;
+  return false;
+}
 
 /* Return an option value suitable for add_exclude.  */
 
@@ -260,13 +368,14 @@ int
 main (int argc, char **argv)
 {
   int exit_status = EXIT_SUCCESS;
+  int resumed_status = EXIT_SUCCESS;
   int c;
   int i;
   int prev = -1;
+  bool remote_worker;
   lin ocontext = -1;
   bool explicit_context = false;
   size_t width = 0;
-  bool show_c_function = false;
   char const *from_file = NULL;
   char const *to_file = NULL;
   uintmax_t numval;
@@ -276,12 +385,20 @@ main (int argc, char **argv)
   exit_failure = EXIT_TROUBLE;
   initialize_main (&argc, &argv);
   set_program_name (argv[0]);
-  setlocale (LC_ALL, "");
+  /* Only the categories that most runs need are set here; the others
+     cost as much again to load, so use_locale sets them on demand.  */
+  setlocale (LC_CTYPE, "");
+  setlocale (LC_MESSAGES, "");
   bindtextdomain (PACKAGE, LOCALEDIR);
   textdomain (PACKAGE);
   c_stack_action (0);
+  /* A worker for --remote gets its options from the coordinator.  */
+  remote_worker = argc == 2 && STREQ (argv[1], "--remote-worker");
+  if (remote_worker)
+    read_remote_arguments (&argc, &argv);
   function_regexp_list.buf = &function_regexp;
   ignore_regexp_list.buf = &ignore_regexp;
+  ignore_regexp_list.indexed = true;
   re_set_syntax (RE_SYNTAX_GREP | RE_NO_POSIX_BACKTRACKING);
   excluded = new_exclude ();
 
@@ -419,9 +536,13 @@ main (int argc, char **argv)
 	  break;
 
 	case 'l':
+	  paginate = true;
+	  break;
+
+	case EXTERNAL_PR_OPTION:
 	  if (!pr_program[0])
 	    try_help ("pagination not supported on this host", NULL);
-	  paginate = true;
+	  paginate = paginate_with_pr = true;
 #ifdef SIGCHLD
 	  /* Pagination requires forking and waiting, and
 	     System V fork+wait does not work if SIGCHLD is ignored.  */
@@ -448,7 +569,6 @@ main (int argc, char **argv)
 
 	case 'p':
 	  show_c_function = true;
-	  add_regexp (&function_regexp_list, "^[[:alpha:]$_]");
 	  break;
 
 	case 'P':
@@ -497,11 +617,11 @@ main (int argc, char **argv)
 	  break;
 
 	case 'x':
-	  add_exclude (excluded, optarg, exclude_options ());
+	  add_excluded_pattern (excluded, optarg, exclude_options ());
 	  break;
 
 	case 'X':
-	  if (add_exclude_file (add_exclude, excluded, optarg,
+	  if (add_exclude_file (add_excluded_pattern, excluded, optarg,
 				exclude_options (), '\n'))
 	    pfatal_with_name (optarg);
 	  break;
@@ -522,6 +642,28 @@ main (int argc, char **argv)
 	    }
 	  break;
 
+	case APPLY_OPTION:
+	  apply_edits = true;
+	  specify_style (OUTPUT_ED);
+	  break;
+
+	case BATCH_OPTION:
+#if HAVE_WORKING_FORK
+	  run_batch (&argc, &argv, optarg, try_help);
+	  break;
+#else
+	  try_help ("--batch is not supported on this system", 0);
+#endif
+
+	case BATCH_PAIRS_OPTION:
+	  batch_pairs = true;
+	  break;
+
+	case CACHED_STAT_OPTION:
+	  cached_stat = true;
+	  omit_switch (argv);
+	  break;
+
 	case BINARY_OPTION:
 #if O_BINARY
 	  binary = true;
@@ -530,6 +672,33 @@ main (int argc, char **argv)
 #endif
 	  break;
 
+	case BINARY_DELTA_OPTION:
+	  binary_delta = true;
+	  if (O_BINARY && ! isatty (STDOUT_FILENO))
+	    set_binary_mode (STDOUT_FILENO, O_BINARY);
+	  break;
+
+	case DECOMPRESS_OPTION:
+#if HAVE_WORKING_FORK
+	  decompress = true;
+	  break;
+#else
+	  try_help ("--decompress is not supported on this system", 0);
+#endif
+
+	case DIFF_ALGORITHM_OPTION:
+	  if (STREQ (optarg, "myers"))
+	    diff_algorithm = MYERS_ALGORITHM;
+	  else if (STREQ (optarg, "patience"))
+	    diff_algorithm = PATIENCE_ALGORITHM;
+	  else if (STREQ (optarg, "histogram"))
+	    diff_algorithm = HISTOGRAM_ALGORITHM;
+	  else if (STREQ (optarg, "auto"))
+	    diff_algorithm = AUTO_ALGORITHM;
+	  else
+	    try_help ("invalid --diff-algorithm value '%s'", optarg);
+	  break;
+
 	case FROM_FILE_OPTION:
 	  specify_value (&from_file, optarg, "--from-file");
 	  break;
@@ -540,6 +709,11 @@ main (int argc, char **argv)
 	  return EXIT_SUCCESS;
 
 	case HORIZON_LINES_OPTION:
+	  if (STREQ (optarg, "auto"))
+	    {
+	      adaptive_horizon = true;
+	      break;
+	    }
 	  numval = strtoumax (optarg, &numend, 10);
 	  if (*numend)
 	    try_help ("invalid horizon length '%s'", optarg);
@@ -550,6 +724,17 @@ main (int argc, char **argv)
 	  ignore_file_name_case = true;
 	  break;
 
+	case IGNORE_MATCHING_LINES_EARLY_OPTION:
+	  ignore_matching_lines_early = true;
+	  omit_switch (argv);
+	  break;
+
+	case INCLUDE_OPTION:
+	  if (! included)
+	    included = new_exclude ();
+	  add_included_pattern (included, optarg, exclude_options ());
+	  break;
+
 	case INHIBIT_HUNK_MERGE_OPTION:
 	  /* This option is obsolete, but accept it for backward
              compatibility.  */
@@ -565,23 +750,182 @@ main (int argc, char **argv)
 	    specify_value (&line_format[i], optarg, "--line-format");
 	  break;
 
+	case MAX_COST_OPTION:
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (*numend || ! numval)
+	    try_help ("invalid --max-cost value '%s'", optarg);
+	  max_cost = MIN (numval, LIN_MAX);
+	  break;
+
+	case MAX_HUNKS_OPTION:
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (*numend || ! numval)
+	    try_help ("invalid --max-hunks value '%s'", optarg);
+	  max_hunks = MIN (numval, LIN_MAX);
+	  break;
+
+	case MOVES_OPTION:
+	  specify_style (OUTPUT_MOVES);
+	  move_min = 3;
+	  if (optarg)
+	    {
+	      numval = strtoumax (optarg, &numend, 10);
+	      if (*numend || ! numval)
+		try_help ("invalid --moves value '%s'", optarg);
+	      move_min = MIN (numval, LIN_MAX);
+	    }
+	  break;
+
+	case WORD_DIFF_OPTION:
+	  specify_style (OUTPUT_WORD_DIFF);
+	  break;
+
+	case FIND_RENAMES_OPTION:
+	  find_renames = true;
+	  break;
+
+	case MANIFEST_OPTION:
+	  specify_value (&manifest_name, optarg, "--manifest");
+	  omit_switch (argv);
+	  break;
+
+	case CHECKPOINT_OPTION:
+	  specify_value (&checkpoint_name, optarg, "--checkpoint");
+	  omit_switch (argv);
+	  break;
+
+	case RESUME_OPTION:
+	  specify_value (&resume_name, optarg, "--resume");
+	  omit_switch (argv);
+	  break;
+
+	case MAX_MEMORY_OPTION:
+	  if (xstrtoumax (optarg, 0, 0, &numval, "kKMGTPEZY0") != LONGINT_OK
+	      || ! numval)
+	    try_help ("invalid --max-memory value '%s'", optarg);
+	  max_memory = MIN (numval, SIZE_MAX);
+	  break;
+
+	case HUGE_PAGES_OPTION:
+	  huge_pages = true;
+	  omit_switch (argv);
+	  break;
+
+	case DIRECT_IO_OPTION:
+	  direct_io = true;
+	  omit_switch (argv);
+	  break;
+
+	case LINE_DICTIONARY_OPTION:
+	  line_dictionary = 32 * 1024 * 1024;
+	  if (optarg)
+	    {
+	      if (xstrtoumax (optarg, 0, 0, &numval, "kKMGTPEZY0")
+		  != LONGINT_OK
+		  || ! numval)
+		try_help ("invalid --line-dictionary value '%s'", optarg);
+	      line_dictionary = MIN (numval, SIZE_MAX);
+	    }
+	  omit_switch (argv);
+	  break;
+
 	case NO_DEREFERENCE_OPTION:
 	  no_dereference_symlinks = true;
 	  break;
 
+	case READ_INDEX_OPTION:
+	  read_index = true;
+	  omit_switch (argv);
+	  break;
+
+	case REMOTE_OPTION:
+	  add_remote_worker (optarg);
+	  break;
+
+	case WRITE_INDEX_OPTION:
+	  write_index = true;
+	  omit_switch (argv);
+	  break;
+
 	case NO_IGNORE_FILE_NAME_CASE_OPTION:
 	  ignore_file_name_case = false;
 	  break;
 
+	case PREFETCH_OPTION:
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (*numend)
+	    try_help ("invalid --prefetch value '%s'", optarg);
+	  prefetch = MIN (numval, INT_MAX);
+	  omit_switch (argv);
+	  break;
+
+	case JOBS_OPTION:
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (*numend || ! numval)
+	    try_help ("invalid --jobs value '%s'", optarg);
+	  jobs = MIN (numval, INT_MAX);
+	  omit_switch (argv);
+#ifdef SIGCHLD
+	  /* System V fork+wait does not work if SIGCHLD is ignored.  */
+	  signal (SIGCHLD, SIG_DFL);
+#endif
+	  break;
+
+	case JSON_OPTION:
+	  specify_style (OUTPUT_JSON);
+	  break;
+
 	case NORMAL_OPTION:
 	  specify_style (OUTPUT_NORMAL);
 	  break;
 
+	case NUMSTAT_OPTION:
+	  specify_style (OUTPUT_NUMSTAT);
+	  break;
+
+	case OUTPUT_COMPRESS_OPTION:
+#if HAVE_WORKING_FORK
+	  output_compressor = optarg;
+	  break;
+#else
+	  try_help ("--output-compress is not supported on this system", 0);
+#endif
+
+	case OUTPUT_FD_MMAP_OPTION:
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (numend == optarg || *numend || INT_MAX < numval)
+	    try_help ("invalid --output-fd-mmap value '%s'", optarg);
+	  output_fd = numval;
+	  break;
+
+	case OUTPUT_INDEX_OPTION:
+	  specify_value (&output_index_name, optarg, "--output-index");
+	  break;
+
+	case PROGRESS_OPTION:
+	  show_progress = true;
+	  omit_switch (argv);
+	  break;
+
 	case SDIFF_MERGE_ASSIST_OPTION:
 	  specify_style (OUTPUT_SDIFF);
 	  sdiff_merge_assist = true;
 	  break;
 
+	case STAT_OPTION:
+	  specify_style (OUTPUT_STAT);
+	  break;
+
+	case STATS_OPTION:
+	  if (! optarg)
+	    stats_format = STATS_TEXT;
+	  else if (STREQ (optarg, "json"))
+	    stats_format = STATS_JSON;
+	  else
+	    try_help ("invalid --stats value '%s'", optarg);
+	  omit_switch (argv);
+	  break;
+
 	case STRIP_TRAILING_CR_OPTION:
 	  strip_trailing_cr = true;
 	  break;
@@ -607,10 +951,21 @@ main (int argc, char **argv)
 	    }
 	  break;
 
+	case TIMEOUT_OPTION:
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (*numend || ! numval)
+	    try_help ("invalid --timeout value '%s'", optarg);
+	  max_seconds = MIN (numval, TYPE_MAXIMUM (time_t));
+	  break;
+
 	case TO_FILE_OPTION:
 	  specify_value (&to_file, optarg, "--to-file");
 	  break;
 
+	case TRUST_MTIME_OPTION:
+	  trust_mtime = true;
+	  break;
+
 	case UNCHANGED_LINE_FORMAT_OPTION:
 	case OLD_LINE_FORMAT_OPTION:
 	case NEW_LINE_FORMAT_OPTION:
@@ -646,7 +1001,17 @@ main (int argc, char **argv)
 	specify_style (OUTPUT_NORMAL);
     }
 
+  /* A decompressed file cannot be written back as it was read.  */
+  if (apply_edits && decompress)
+    try_help ("options --apply and --decompress are incompatible", NULL);
+
+  /* A delta is output as it is made, so it cannot be paginated.  */
+  if (binary_delta && paginate)
+    try_help ("options -l and --binary-delta are incompatible", NULL);
+
   /*设置time格式化样式*/
+  if (output_style == OUTPUT_CONTEXT)
+    use_locale (LC_TIME);
   if (output_style != OUTPUT_CONTEXT || hard_locale (LC_TIME))
     {
 #if (defined STAT_TIMESPEC || defined STAT_TIMESPEC_NS \
@@ -674,35 +1039,26 @@ main (int argc, char **argv)
   if (! width)
     width = 130;
 
-  {
-    /* Maximize first the half line width, and then the gutter width,
-       according to the following constraints:
-
-	1.  Two half lines plus a gutter must fit in a line.
-	2.  If the half line width is nonzero:
-	    a.  The gutter width is at least GUTTER_WIDTH_MINIMUM.
-	    b.  If tabs are not expanded to spaces,
-		a half line plus a gutter is an integral number of tabs,
-		so that tabs in the right column line up.  */
-
-    size_t t = expand_tabs ? 1 : tabsize;
-    size_t w = width;
-    size_t t_plus_g = t + GUTTER_WIDTH_MINIMUM;
-    size_t unaligned_off = (w >> 1) + (t_plus_g >> 1) + (w & t_plus_g & 1);
-    size_t off = unaligned_off - unaligned_off % t;
-    sdiff_half_width = (off <= GUTTER_WIDTH_MINIMUM || w <= off
-			? 0
-			: MIN (off - GUTTER_WIDTH_MINIMUM, w - off));
-    sdiff_column2_offset = sdiff_half_width ? off : w;
-  }
+  set_sdiff_width (width);
 
   /* Make the horizon at least as large as the context, so that
      shift_boundaries has more freedom to shift the first and last hunks.  */
   if (horizon_lines < context)
     horizon_lines = context;
 
-  summarize_regexp_list (&function_regexp_list);
+  show_function = show_c_function || function_regexp_list.regexps;
   summarize_regexp_list (&ignore_regexp_list);
+  ignore_regexp_set = ignore_regexp_list.set;
+  ignore_matching_lines_early &= !!ignore_regexp_list.regexps;
+
+  /* The hunks of these styles are output from the end, or with the
+     lines between them, or matched up with all the others.  */
+  if (max_hunks
+      && (output_style == OUTPUT_ED || output_style == OUTPUT_IFDEF
+	  || output_style == OUTPUT_SDIFF || output_style == OUTPUT_MOVES))
+    try_help ("--max-hunks cannot be used with -e, -D, -y or --moves", NULL);
+  if (max_hunks && STAT_OUTPUT_STYLE (output_style))
+    try_help ("--max-hunks cannot be used with --stat or --numstat", NULL);
 
   if (output_style == OUTPUT_IFDEF)
     {
@@ -734,29 +1090,88 @@ main (int argc, char **argv)
      & ~ (ignore_blank_lines | ignore_case | strip_trailing_cr
 	  | (ignore_regexp_list.regexps || ignore_white_space)));
 
-  switch_string = option_list (argv + 1, optind - 1);
+  switch_vector = xnmalloc (optind, sizeof *switch_vector);
+  switch_count = 0;
+  for (i = 1; i < optind; i++)
+    if (! omitted_switch (argv[i]))
+      switch_vector[switch_count++] = argv[i];
+
+  if (remote_worker)
+    {
+      exit_status = serve_remote_requests ();
+      check_stdout ();
+      return exit_status;
+    }
+  set_remote_options (argv + 1, optind - 1);
+
+  /* Files set aside for --find-renames are compared only at the end,
+     and the pairs of --from-file, --to-file and --batch-pairs are not
+     in any one tree, so a checkpoint could not say which are done.  */
+  if ((checkpoint_name || resume_name)
+      && (find_renames || from_file || to_file || batch_pairs))
+    try_help ("--checkpoint and --resume cannot be used with"
+	      " --find-renames, --from-file, --to-file or --batch-pairs",
+	      NULL);
+
+  if (manifest_name)
+    read_manifest (manifest_name);
+
+  if (0 <= output_fd)
+    output_to_fd (output_fd);
+
+  if (output_index_name)
+    {
+      if (output_compressor)
+	try_help ("--output-index cannot be used with --output-compress", 0);
+      if (lseek (STDOUT_FILENO, 0, SEEK_CUR) < 0)
+	try_help ("--output-index requires standard output to be seekable",
+		  0);
+      open_output_index (output_index_name);
+    }
+
+  if (resume_name)
+    resumed_status = resume_checkpoint (resume_name);
+
+#if HAVE_WORKING_FORK
+  if (output_compressor && ! start_compressed_output (output_compressor))
+    try_help ("invalid --output-compress value '%s'", output_compressor);
+#endif
+
+  {
+    struct stat out_st, err_st;
+    flush_each_pair = (isatty (STDOUT_FILENO)
+		       || (fstat (STDOUT_FILENO, &out_st) == 0
+			   && fstat (STDERR_FILENO, &err_st) == 0
+			   && same_file (&out_st, &err_st)));
+  }
+
+  stats_phase (STATS_OTHER);
 
-  if (from_file)
+  if (batch_pairs)
+    {
+      if (from_file || to_file)
+	try_help ("--batch-pairs cannot be used with --from-file"
+		  " or --to-file", NULL);
+      if (optind < argc)
+	try_help ("extra operand '%s'", argv[optind]);
+      exit_status = compare_pairs ();
+    }
+  else if (from_file)
     {
       if (to_file)
 	fatal ("--from-file and --to-file both specified");
-      else
-	for (; optind < argc; optind++)
-	  {
-	    int status = compare_files (NULL, from_file, argv[optind]);
-	    if (exit_status < status)
-	      exit_status = status;
-	  }
+      retain_fixed_file (from_file, argc - optind);
+      exit_status = diff_fixed (from_file, true, argv + optind,
+				argc - optind, compare_files);
     }
   else
     {
       if (to_file)
-	for (; optind < argc; optind++)
-	  {
-	    int status = compare_files (NULL, argv[optind], to_file);
-	    if (exit_status < status)
-	      exit_status = status;
-	  }
+	{
+	  retain_fixed_file (to_file, argc - optind);
+	  exit_status = diff_fixed (to_file, false, argv + optind,
+				    argc - optind, compare_files);
+	}
       else
 	{
 	  if (argc - optind != 2)
@@ -772,72 +1187,33 @@ main (int argc, char **argv)
 	}
     }
 
-  /* Print any messages that were saved up for last.  */
-  print_message_queue ();
-
-  check_stdout ();
-  exit (exit_status);
-  return exit_status;
-}
-
-/* Append to REGLIST the regexp PATTERN.  */
-
-static void
-add_regexp (struct regexp_list *reglist, char const *pattern)
-{
-  size_t patlen = strlen (pattern);
-  char const *m = re_compile_pattern (pattern, patlen, reglist->buf);
-
-  if (m != 0)
-    error (0, 0, "%s: %s", pattern, m);
-  else
+  if (find_renames)
     {
-      char *regexps = reglist->regexps;
-      size_t len = reglist->len;
-      bool multiple_regexps = reglist->multiple_regexps = regexps != 0;
-      size_t newlen = reglist->len = len + 2 * multiple_regexps + patlen;
-      size_t size = reglist->size;
+      int status = diff_lone_files (compare_files);
+      if (exit_status < status)
+	exit_status = status;
+    }
 
-      if (size <= newlen)
-	{
-	  if (!size)
-	    size = 1;
+  if (exit_status < resumed_status)
+    exit_status = resumed_status;
+  if (checkpoint_name)
+    finish_checkpoint (exit_status);
 
-	  do size *= 2;
-	  while (size <= newlen);
+  if (manifest_name)
+    write_manifest (manifest_name);
 
-	  reglist->size = size;
-	  reglist->regexps = regexps = xrealloc (regexps, size);
-	}
-      if (multiple_regexps)
-	{
-	  regexps[len++] = '\\';
-	  regexps[len++] = '|';
-	}
-      memcpy (regexps + len, pattern, patlen + 1);
-    }
-}
+  /* Print any messages that were saved up for last.  */
+  print_message_queue ();
 
-/* Ensure that REGLIST represents the disjunction of its regexps.
-   This is done here, rather than earlier, to avoid O(N^2) behavior.  */
+  print_stat_summary ();
 
-static void
-summarize_regexp_list (struct regexp_list *reglist)
-{
-  if (reglist->regexps)
-    {
-      /* At least one regexp was specified.  Allocate a fastmap for it.  */
-      reglist->buf->fastmap = xmalloc (1 << CHAR_BIT);
-      if (reglist->multiple_regexps)
-	{
-	  /* Compile the disjunction of the regexps.
-	     (If just one regexp was specified, it is already compiled.)  */
-	  char const *m = re_compile_pattern (reglist->regexps, reglist->len,
-					      reglist->buf);
-	  if (m)
-	    error (EXIT_TROUBLE, 0, "%s: %s", reglist->regexps, m);
-	}
-    }
+  print_stats ();
+  close_output_index (output_index_name);
+  finish_remote_workers ();
+  check_stdout ();
+  finish_compressed_output ();
+  exit (exit_status);
+  return exit_status;
 }
 
 static void
@@ -853,21 +1229,70 @@ try_help (char const *reason_msgid, char const *operand)
 static void
 check_stdout (void)
 {
+  /* Output that could not be written because the compressor exited
+     is reported as the compressor's failure.  */
   if (ferror (stdout))
-    fatal ("write failed");
+    {
+      fclose (stdout);
+      finish_compressed_output ();
+      fatal ("write failed");
+    }
   else if (fclose (stdout) != 0)
-    pfatal_with_name (_("standard output"));
+    {
+      int e = errno;
+      finish_compressed_output ();
+      errno = e;
+      pfatal_with_name (_("standard output"));
+    }
+}
+
+/* For --output-fd-mmap, make the output go to the start of the file
+   open on descriptor FD, truncating it first, instead of to standard
+   output.  When diff exits, FD's file then holds exactly the output,
+   which a parent process sharing a memfd or POSIX shared memory object
+   with diff can map and read in place, with no pipe to drain.  Every
+   kind of output, including that of --jobs, -l and --output-compress,
+   is written to standard output's descriptor, so FD is simply made
+   standard output.  */
+
+static void
+output_to_fd (int fd)
+{
+  struct stat st;
+
+  if (fstat (fd, &st) != 0)
+    pfatal_with_name ("--output-fd-mmap");
+  if (! (S_ISREG (st.st_mode) || S_TYPEISSHM (&st)))
+    try_help ("--output-fd-mmap requires a regular file"
+	      " or shared memory object", 0);
+  if (ftruncate (fd, 0) != 0 || lseek (fd, 0, SEEK_SET) < 0
+      || (fd != STDOUT_FILENO
+	  && (dup2 (fd, STDOUT_FILENO) < 0 || close (fd) != 0)))
+    pfatal_with_name ("--output-fd-mmap");
 }
 
 static char const * const option_help_msgid[] = {
   N_("    --normal                  output a normal diff (the default)"),
   N_("-q, --brief                   report only when files differ"),
   N_("-s, --report-identical-files  report when two files are the same"),
+  N_("    --trust-mtime             assume files of the same size and time stamp\n"
+     "                                are the same"),
+  N_("    --manifest=FILE           record identical files in FILE, and skip\n"
+     "                                those it records that are unchanged"),
   N_("-c, -C NUM, --context[=NUM]   output NUM (default 3) lines of copied context"),
   N_("-u, -U NUM, --unified[=NUM]   output NUM (default 3) lines of unified context"),
   N_("-e, --ed                      output an ed script"),
+  N_("    --apply                   edit FILE1 as the -e script would, instead"),
   N_("-n, --rcs                     output an RCS format diff"),
   N_("-y, --side-by-side            output in two columns"),
+  N_("    --json                    output the location of each change as JSON"),
+  N_("    --moves[=NUM]             output a normal diff that shows blocks of at\n"
+     "                                least NUM (default 3) lines that moved as moves"),
+  N_("    --word-diff               output the words that changed in each hunk"),
+  N_("    --stat                    output a histogram of the lines changed in\n"
+     "                                each file"),
+  N_("    --numstat                 output the numbers of lines inserted and\n"
+     "                                deleted in each file"),
   N_("-W, --width=NUM               output at most NUM (default 130) print columns"),
   N_("    --left-column             output only the left column of common lines"),
   N_("    --suppress-common-lines   do not output common lines"),
@@ -881,7 +1306,14 @@ static char const * const option_help_msgid[] = {
   N_("-T, --initial-tab             make tabs line up by prepending a tab"),
   N_("    --tabsize=NUM             tab stops every NUM (default 8) print columns"),
   N_("    --suppress-blank-empty    suppress space or tab before empty output lines"),
-  N_("-l, --paginate                pass output through 'pr' to paginate it"),
+  N_("-l, --paginate                paginate the output like 'pr'"),
+  N_("    --external-pr             pass output through 'pr' to paginate it"),
+  N_("    --output-compress=PROG[:LEVEL]  compress the output with 'gzip',\n"
+     "                                'bzip2', 'xz' or 'zstd'"),
+  N_("    --output-fd-mmap=FD       write the output to the start of the file or\n"
+     "                                shared memory object open on FD"),
+  N_("    --output-index=FILE       list where the output for each pair of\n"
+     "                                files starts in FILE"),
   "",
   N_("-r, --recursive                 recursively compare any subdirectories found"),
   N_("    --no-dereference            don't follow symbolic links"),
@@ -891,11 +1323,26 @@ static char const * const option_help_msgid[] = {
   N_("    --no-ignore-file-name-case  consider case when comparing file names"),
   N_("-x, --exclude=PAT               exclude files that match PAT"),
   N_("-X, --exclude-from=FILE         exclude files that match any pattern in FILE"),
+  N_("    --include=PAT               compare only files that match PAT"),
   N_("-S, --starting-file=FILE        start with FILE when comparing directories"),
+  N_("    --checkpoint=FILE           record in FILE how far comparing directories\n"
+     "                                  has got, every 10 seconds"),
+  N_("    --resume=FILE               skip the files that the --checkpoint FILE\n"
+     "                                  records as compared"),
+  N_("    --find-renames              report files moved between directories"),
+  N_("    --jobs=NUM                  compare up to NUM groups of files at once,\n"
+     "                                  and large files with NUM processes"),
+  N_("    --prefetch=NUM              read NUM files ahead in each directory"),
   N_("    --from-file=FILE1           compare FILE1 to all operands;\n"
      "                                  FILE1 can be a directory"),
   N_("    --to-file=FILE2             compare all operands to FILE2;\n"
      "                                  FILE2 can be a directory"),
+  N_("    --batch[=NUM]               run comparisons read from standard input,\n"
+     "                                  NUM at a time"),
+  N_("    --batch-pairs               compare the pairs of files listed on\n"
+     "                                  standard input"),
+  N_("    --cached-stat               use the file status that network file\n"
+     "                                  systems have cached"),
   "",
   N_("-i, --ignore-case               ignore case differences in file contents"),
   N_("-E, --ignore-tab-expansion      ignore changes due to tab expansion"),
@@ -904,12 +1351,18 @@ static char const * const option_help_msgid[] = {
   N_("-w, --ignore-all-space          ignore all white space"),
   N_("-B, --ignore-blank-lines        ignore changes where lines are all blank"),
   N_("-I, --ignore-matching-lines=RE  ignore changes where all lines match RE"),
+  N_("    --ignore-matching-lines-early\n"
+     "                                  match up the other lines as if\n"
+     "                                  the lines matching RE were absent"),
   "",
   N_("-a, --text                      treat all files as text"),
   N_("    --strip-trailing-cr         strip trailing carriage return on input"),
+  N_("    --decompress                compare the text of files compressed by\n"
+     "                                  gzip, bzip2, xz or zstd"),
 #if O_BINARY
   N_("    --binary                    read and write data in binary mode"),
 #endif
+  N_("    --binary-delta              output a VCDIFF delta for binary files that differ"),
   "",
   N_("-D, --ifdef=NAME                output merged file with '#ifdef NAME' diffs"),
   N_("    --GTYPE-group-format=GFMT   format GTYPE input groups with GFMT"),
@@ -941,8 +1394,32 @@ static char const * const option_help_msgid[] = {
     C    the character C (other characters represent themselves)"),
   "",
   N_("-d, --minimal            try hard to find a smaller set of changes"),
-  N_("    --horizon-lines=NUM  keep NUM lines of the common prefix and suffix"),
+  N_("    --diff-algorithm=ALG  match lines using ALG: myers (the default),\n"
+     "                            patience, histogram, or auto to choose"),
+  N_("    --horizon-lines=NUM  keep NUM lines of the common prefix and suffix;\n"
+     "                           'auto' keeps more only where the changes need it"),
   N_("    --speed-large-files  assume large files and many scattered small changes"),
+  N_("    --max-memory=SIZE    compare large files in pieces, using about SIZE bytes;\n"
+     "                           the result may be less than minimal"),
+  N_("    --remote=COMMAND     with --max-memory, have a diff run by COMMAND,\n"
+     "                           often on another machine, compare the pieces"),
+  N_("    --huge-pages         use huge pages for the text and tables of large files"),
+  N_("    --direct-io          compare files byte for byte without filling\n"
+     "                           the system's cache"),
+  N_("    --line-dictionary[=SIZE]  keep the lines of all the files compared\n"
+     "                           in a dictionary of about SIZE (default 32M) bytes"),
+  N_("    --read-index         use the indexes of large files' lines that\n"
+     "                           --write-index wrote, rather than hashing lines"),
+  N_("    --write-index        write an index of each file's lines to FILE.diff-index"),
+  N_("    --max-cost=NUM       after NUM steps of searching two files for changes,\n"
+     "                           show their remaining differences as one change"),
+  N_("    --timeout=SECS       likewise, after SECS seconds comparing two files"),
+  N_("    --max-hunks=NUM      output only the first NUM hunks of each pair of files,\n"
+     "                           and stop comparing them once those are found"),
+  N_("    --stats[=json]       report the time spent in each phase of comparison,\n"
+     "                           and what was counted, on standard error"),
+  N_("    --progress           report every second on standard error how far\n"
+     "                           the comparison has got"),
   "",
   N_("    --help               display this help and exit"),
   N_("-v, --version            output version information and exit"),
@@ -987,6 +1464,67 @@ Mandatory arguments to long options are mandatory for short options too.\n\
   emit_bug_reporting_address ();
 }
 
+/* With --batch-pairs, read records of four null-terminated fields
+   from standard input: FILE1, FILE2, LABEL1 and LABEL2.  Compare each
+   pair of files as if they were the operands, with their output
+   labeled LABEL1 and LABEL2, or as usual if a label is empty.  The
+   files are compared in this process one after another, so that the
+   buffers and tables of each comparison are reused by the next.
+   Return the worst exit status.  */
+
+static int
+compare_pairs (void)
+{
+  char *option_label[2];
+  char *buf = NULL;
+  size_t alloc = 0;
+  int exit_status = EXIT_SUCCESS;
+
+  option_label[0] = file_label[0];
+  option_label[1] = file_label[1];
+
+  for (;;)
+    {
+      char *field[4];
+      size_t size = 0;
+      int fields = 0;
+      int c;
+      int status;
+      int f;
+
+      while (fields < 4 && (c = getc (stdin)) != EOF)
+	{
+	  if (size == alloc)
+	    buf = x2realloc (buf, &alloc);
+	  buf[size++] = c;
+	  fields += c == '\0';
+	}
+      if (fields < 4)
+	{
+	  if (ferror (stdin))
+	    pfatal_with_name (_("standard input"));
+	  if (size)
+	    fatal ("incomplete --batch-pairs record");
+	  break;
+	}
+
+      field[0] = buf;
+      for (f = 1; f < 4; f++)
+	field[f] = field[f - 1] + strlen (field[f - 1]) + 1;
+      for (f = 0; f < 2; f++)
+	file_label[f] = *field[2 + f] ? field[2 + f] : option_label[f];
+
+      status = compare_files (NULL, field[0], field[1]);
+      if (exit_status < status)
+	exit_status = status;
+    }
+
+  free (buf);
+  file_label[0] = option_label[0];
+  file_label[1] = option_label[1];
+  return exit_status;
+}
+
 /* Set VAR to VALUE, reporting an OPTION error if this is a
    conflict.  */
 static void
@@ -1032,6 +1570,161 @@ set_mtime_to_now (struct stat *st)
 #endif
 }
 
+/* Get the status of FILE, whose name within the directory of file F
+   of PARENT is BASE.  Look it up relative to that directory if it is
+   open, to save resolving the whole of FILE->name again.  Return 0 if
+   successful, -1 (setting errno) otherwise.  */
+
+static int
+stat_file (struct comparison const *parent, int f, char const *base,
+	   struct file_data *file)
+{
+#ifdef AT_FDCWD
+  if (parent && 0 <= parent->file[f].desc)
+    return file_status (parent->file[f].desc, base, &file->stat,
+			no_dereference_symlinks);
+#endif
+  return file_status (-1, file->name, &file->stat, no_dereference_symlinks);
+}
+
+/* Likewise, but open FILE with OFLAGS and return its descriptor.  */
+
+static int
+open_file (struct comparison const *parent, int f, char const *base,
+	   struct file_data const *file, int oflags)
+{
+#ifdef AT_FDCWD
+  if (parent && 0 <= parent->file[f].desc)
+    return openat (parent->file[f].desc, base, oflags);
+#endif
+  return open (file->name, oflags, 0);
+}
+
+/* Likewise, but read the value of the symbolic link FILE into a buffer
+   that is reused by later calls with the same F, sized at first from
+   the link's st_size.  Return the buffer and store the value's length
+   into *LEN, or return NULL and set errno on failure.  */
+
+static char const *
+read_link (struct comparison const *parent, int f, char const *base,
+	   struct file_data const *file, size_t *len)
+{
+  static char *buffer[2];
+  static size_t buffer_size[2];
+  size_t size = (0 <= file->stat.st_size && file->stat.st_size < SSIZE_MAX
+		 ? file->stat.st_size + 1 : 0);
+
+  for (;;)
+    {
+      ssize_t n;
+
+      if (buffer_size[f] < size)
+	{
+	  free (buffer[f]);
+	  buffer[f] = xmalloc (size);
+	  buffer_size[f] = size;
+	}
+
+#ifdef AT_FDCWD
+      if (parent && 0 <= parent->file[f].desc)
+	n = readlinkat (parent->file[f].desc, base, buffer[f],
+			buffer_size[f]);
+      else
+#endif
+	n = readlink (file->name, buffer[f], buffer_size[f]);
+
+      if (n < 0)
+	return NULL;
+      if (n < (ssize_t) buffer_size[f])
+	{
+	  *len = n;
+	  return buffer[f];
+	}
+
+      /* The link is longer than its st_size said, or has changed.  */
+      if (SSIZE_MAX / 2 < buffer_size[f])
+	xalloc_die ();
+      size = buffer_size[f] ? 2 * buffer_size[f] : 128;
+    }
+}
+
+/* Open the directories of CMP, whose names within the directories of
+   CMP->parent are BASE0 and BASE1, so that the files in them can be
+   looked up relative to them.  A directory that cannot be opened
+   stays UNOPENED, and its files are looked up by their full names.
+   So does one whose descriptor lands in the upper half of the
+   descriptor table, so that deep trees leave room for the files
+   being compared.  */
+
+static void
+open_dirs (struct comparison *cmp, char const *base0, char const *base1)
+{
+#ifdef AT_FDCWD
+  static long int desc_limit;
+  int f;
+
+  if (! desc_limit)
+    {
+      long int open_max = sysconf (_SC_OPEN_MAX);
+      desc_limit = 0 < open_max ? open_max / 2 : 128;
+    }
+
+  for (f = 0; f < 2; f++)
+    if (cmp->file[f].desc == UNOPENED)
+      {
+	int desc = open_file (cmp->parent, f, f ? base1 : base0,
+			      &cmp->file[f], O_RDONLY | O_DIRECTORY);
+	if (desc_limit <= desc)
+	  close (desc);
+	else if (0 <= desc)
+	  cmp->file[f].desc = desc;
+      }
+#endif
+}
+
+/* Close the directories that open_dirs opened.  */
+
+static void
+close_dirs (struct comparison *cmp)
+{
+  int f;
+  for (f = 0; f < 2; f++)
+    if (0 <= cmp->file[f].desc)
+      {
+	close (cmp->file[f].desc);
+	cmp->file[f].desc = UNOPENED;
+      }
+}
+
+/* If the file NAME that --from-file or --to-file names is a regular
+   file that will be compared with more than one of the N operands,
+   read it once and keep it in memory, along with the classes of its
+   lines, for all its comparisons.  The other files' lines are then
+   put into the same classes, rather than each comparison reading and
+   hashing NAME again.  Leave it to the comparisons to report any
+   trouble with NAME.  */
+
+static void
+retain_fixed_file (char const *name, int n)
+{
+  struct file_data *file = &retained_file;
+
+  /* Files compared as binary, or a window at a time, or through a
+     decompressor, are not read the way a retained file is.  */
+  if (n < 2 || STREQ (name, "-") || files_can_be_treated_as_binary
+      || max_memory || decompress)
+    return;
+
+  file->name = name;
+  file->desc = open (name, O_RDONLY | (binary ? O_BINARY : 0));
+  if (file->desc < 0)
+    return;
+  if (desc_status (file->desc, &file->stat) == 0 && S_ISREG (file->stat.st_mode))
+    retain_file (file);
+  close (file->desc);
+  file->desc = NONEXISTENT;
+}
+
 /* Compare two files (or dirs) with parent comparison PARENT
    and names NAME0 and NAME1.
    (If PARENT is null, then the first name is just NAME0, etc.)
@@ -1073,16 +1766,10 @@ compare_files (struct comparison const *parent,
       return EXIT_FAILURE;
     }
 
+  PROBE2 (compare_files_start, name0, name1);
   memset (cmp.file, 0, sizeof cmp.file);
   cmp.parent = parent;
 
-  /* cmp.file[f].desc markers */
-#define NONEXISTENT (-1) /* nonexistent file */
-#define UNOPENED (-2) /* unopened file (e.g. directory) */
-#define ERRNO_ENCODE(errno) (-3 - (errno)) /* encoded errno value */
-
-#define ERRNO_DECODE(desc) (-3 - (desc)) /* inverse of ERRNO_ENCODE */
-
   cmp.file[0].desc = name0 ? UNOPENED : NONEXISTENT;
   cmp.file[1].desc = name1 ? UNOPENED : NONEXISTENT;
 
@@ -1125,7 +1812,7 @@ compare_files (struct comparison const *parent,
 	      cmp.file[f].desc = STDIN_FILENO;
 	      if (binary && ! isatty (STDIN_FILENO))
 		set_binary_mode (STDIN_FILENO, O_BINARY);
-	      if (fstat (STDIN_FILENO, &cmp.file[f].stat) != 0)
+	      if (desc_status (STDIN_FILENO, &cmp.file[f].stat) != 0)
 		cmp.file[f].desc = ERRNO_ENCODE (errno);
 	      else
 		{
@@ -1144,10 +1831,7 @@ compare_files (struct comparison const *parent,
 		  set_mtime_to_now (&cmp.file[f].stat);
 		}
 	    }
-	  else if ((no_dereference_symlinks
-		    ? lstat (cmp.file[f].name, &cmp.file[f].stat)
-		    : stat (cmp.file[f].name, &cmp.file[f].stat))
-		   != 0)
+	  else if (stat_file (parent, f, f ? name1 : name0, &cmp.file[f]) != 0)
 	    cmp.file[f].desc = ERRNO_ENCODE (errno);
 	}
     }
@@ -1203,9 +1887,8 @@ compare_files (struct comparison const *parent,
       if (STREQ (fnm, "-"))
 	fatal ("cannot compare '-' to a directory");
 
-      if ((no_dereference_symlinks
-	   ? lstat (filename, &cmp.file[dir_arg].stat)
-	   : stat (filename, &cmp.file[dir_arg].stat))
+      if (file_status (-1, filename, &cmp.file[dir_arg].stat,
+		       no_dereference_symlinks)
 	  != 0)
 	{
 	  perror_with_name (filename);
@@ -1231,7 +1914,28 @@ compare_files (struct comparison const *parent,
 	   && no_diff_means_no_output)
     {
       /* The two named files are actually the same physical file.
-	 We know they are identical without actually reading them.  */
+	 We know they are identical without actually reading them.
+	 This is what makes comparing trees that share unchanged
+	 files as hard links, such as backup snapshots, cheap.  */
+    }
+  else if (trust_mtime
+	   && no_diff_means_no_output
+	   && S_ISREG (cmp.file[0].stat.st_mode)
+	   && S_ISREG (cmp.file[1].stat.st_mode)
+	   && cmp.file[0].stat.st_size == cmp.file[1].stat.st_size
+	   && timespec_cmp (get_stat_mtime (&cmp.file[0].stat),
+			    get_stat_mtime (&cmp.file[1].stat)) == 0)
+    {
+      /* The user has told us to take the files' size and time stamp
+	 as proof that they are identical.  */
+    }
+  else if (no_diff_means_no_output
+	   && S_ISREG (cmp.file[0].stat.st_mode)
+	   && S_ISREG (cmp.file[1].stat.st_mode)
+	   && manifest_lists (cmp.file))
+    {
+      /* An earlier run found these files identical, and neither has
+	 changed since.  */
     }
   else if (DIR_P (0) & DIR_P (1))
     {
@@ -1249,8 +1953,12 @@ compare_files (struct comparison const *parent,
 		   cmp.file[0].name, cmp.file[1].name);
 	}
       else
-    	  /*目录比对*/
-	status = diff_dirs (&cmp, compare_files);
+	{
+	  /*目录比对*/
+	  open_dirs (&cmp, name0, name1);
+	  status = diff_dirs (&cmp, compare_files);
+	  close_dirs (&cmp);
+	}
     }
   else if ((DIR_P (0) | DIR_P (1))
 	   || (parent
@@ -1268,7 +1976,11 @@ compare_files (struct comparison const *parent,
 	      && (new_file
 		  || (unidirectional_new_file
 		      && cmp.file[0].desc == NONEXISTENT)))
-	    status = diff_dirs (&cmp, compare_files);
+	    {
+	      open_dirs (&cmp, name0, name1);
+	      status = diff_dirs (&cmp, compare_files);
+	      close_dirs (&cmp);
+	    }
 	  else
 	    {
 	      char const *dir;
@@ -1308,11 +2020,13 @@ compare_files (struct comparison const *parent,
 	  && S_ISLNK (cmp.file[1].stat.st_mode))
 	{
 	  /* Compare the values of the symbolic links.  */
-	  char *link_value[2] = { NULL, NULL };
+	  char const *link_value[2];
+	  size_t link_len[2];
 
 	  for (f = 0; f < 2; f++)
 	    {
-	      link_value[f] = xreadlink (cmp.file[f].name);
+	      link_value[f] = read_link (parent, f, f ? name1 : name0,
+					 &cmp.file[f], &link_len[f]);
 	      if (link_value[f] == NULL)
 		{
 		  perror_with_name (cmp.file[f].name);
@@ -1322,7 +2036,8 @@ compare_files (struct comparison const *parent,
 	    }
 	  if (status == EXIT_SUCCESS)
 	    {
-	      if ( ! STREQ (link_value[0], link_value[1]))
+	      if (link_len[0] != link_len[1]
+		  || memcmp (link_value[0], link_value[1], link_len[0]) != 0)
 		{
 		  message ("Symbolic links %s and %s differ\n",
 			   cmp.file[0].name, cmp.file[1].name);
@@ -1330,8 +2045,6 @@ compare_files (struct comparison const *parent,
 		  status = EXIT_FAILURE;
 		}
 	    }
-	  for (f = 0; f < 2; f++)
-	    free (link_value[f]);
 	}
       else
 	{
@@ -1349,6 +2062,7 @@ compare_files (struct comparison const *parent,
 	}
     }
   else if (files_can_be_treated_as_binary
+	   && ! decompress
 	   && S_ISREG (cmp.file[0].stat.st_mode)
 	   && S_ISREG (cmp.file[1].stat.st_mode)
 	   && cmp.file[0].stat.st_size != cmp.file[1].stat.st_size)
@@ -1366,9 +2080,19 @@ compare_files (struct comparison const *parent,
 
       int oflags = O_RDONLY | (binary ? O_BINARY : 0);
 
+      /* Use the file that --from-file or --to-file names from memory,
+	 if it is kept there.  */
+      if (! parent && ! same_files && retained_file.retained)
+	for (f = 0; f < 2; f++)
+	  if (cmp.file[f].desc == UNOPENED
+	      && STREQ (cmp.file[f].name, retained_file.name))
+	    cmp.file[f] = retained_file;
+
       /*打开文件0*/
       if (cmp.file[0].desc == UNOPENED)
-	if ((cmp.file[0].desc = open (cmp.file[0].name, oflags, 0)) < 0)
+	if ((cmp.file[0].desc = open_file (parent, 0, name0, &cmp.file[0],
+					   oflags))
+	    < 0)
 	  {
 	    perror_with_name (cmp.file[0].name);
 	    status = EXIT_TROUBLE;
@@ -1379,28 +2103,56 @@ compare_files (struct comparison const *parent,
 	{
 	  if (same_files)
 	    cmp.file[1].desc = cmp.file[0].desc;
-	  else if ((cmp.file[1].desc = open (cmp.file[1].name, oflags, 0)) < 0)
+	  else if ((cmp.file[1].desc = open_file (parent, 1, name1, &cmp.file[1],
+						  oflags))
+		   < 0)
 	    {
 	      perror_with_name (cmp.file[1].name);
 	      status = EXIT_TROUBLE;
 	    }
 	}
 
-      /* Compare the files, if no error was found.  */
+      /* Read compressed files through decompressors, which run while
+	 the files are compared.  The second file shares the first's
+	 decompressor if they are the same file.  */
+      if (status == EXIT_SUCCESS && decompress)
+	{
+	  bool shared = cmp.file[0].desc == cmp.file[1].desc;
+	  decompress_input (&cmp.file[0].desc, &cmp.file[0].stat,
+			    cmp.file[0].name);
+	  if (shared)
+	    {
+	      cmp.file[1].desc = cmp.file[0].desc;
+	      cmp.file[1].stat = cmp.file[0].stat;
+	    }
+	  else
+	    decompress_input (&cmp.file[1].desc, &cmp.file[1].stat,
+			      cmp.file[1].name);
+	}
+
+      /* Compare the files, if no error was found.  There is no cache
+	 of output keyed by the files' contents, as checksumming the
+	 files would cost nearly as much as comparing them.  */
 
       if (status == EXIT_SUCCESS)
-    	  /*比对打开的两个文件*/
-	status = diff_2_files (&cmp);
+	{
+	  /*比对打开的两个文件*/
+	  status = diff_2_files (&cmp);
+	  if (status == EXIT_SUCCESS
+	      && S_ISREG (cmp.file[0].stat.st_mode)
+	      && S_ISREG (cmp.file[1].stat.st_mode))
+	    manifest_add (cmp.file);
+	}
 
       /* Close the file descriptors.  */
 
-      if (0 <= cmp.file[0].desc && close (cmp.file[0].desc) != 0)
+      if (0 <= cmp.file[0].desc && decompress_close (cmp.file[0].desc) != 0)
 	{
 	  perror_with_name (cmp.file[0].name);
 	  status = EXIT_TROUBLE;
 	}
       if (0 <= cmp.file[1].desc && cmp.file[0].desc != cmp.file[1].desc
-	  && close (cmp.file[1].desc) != 0)
+	  && decompress_close (cmp.file[1].desc) != 0)
 	{
 	  perror_with_name (cmp.file[1].name);
 	  status = EXIT_TROUBLE;
@@ -1417,10 +2169,9 @@ compare_files (struct comparison const *parent,
 		 file_label[0] ? file_label[0] : cmp.file[0].name,
 		 file_label[1] ? file_label[1] : cmp.file[1].name);
     }
-  else
+  else if (flush_each_pair)
     {
-      /* Flush stdout so that the user sees differences immediately.
-	 This can hurt performance, unfortunately.  */
+      /* Flush stdout so that the user sees differences immediately.  */
       if (fflush (stdout) != 0)
 	pfatal_with_name (_("standard output"));
     }
@@ -1428,5 +2179,6 @@ compare_files (struct comparison const *parent,
   free (free0);
   free (free1);
 
+  PROBE3 (compare_files_done, name0, name1, status);
   return status;
 }
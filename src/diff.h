@@ -74,12 +74,33 @@ enum output_style
   OUTPUT_IFDEF,
 
   /* Output sdiff style (-y).  */
-  OUTPUT_SDIFF
+  OUTPUT_SDIFF,
+
+  /* Output a JSON record of the changes' locations (--json).  */
+  OUTPUT_JSON,
+
+  /* Output a normal diff that shows moved blocks as moves (--moves).  */
+  OUTPUT_MOVES,
+
+  /* Output the words that changed in each hunk (--word-diff).  */
+  OUTPUT_WORD_DIFF,
+
+  /* Output a histogram of the lines changed in each file (--stat).  */
+  OUTPUT_STAT,
+
+  /* Output the numbers of lines changed in each file (--numstat).  */
+  OUTPUT_NUMSTAT
 };
 
 /* True for output styles that are robust,
-   i.e. can handle a file that ends in a non-newline.  */
-#define ROBUST_OUTPUT_STYLE(S) ((S) != OUTPUT_ED && (S) != OUTPUT_FORWARD_ED)
+   i.e. can handle a file that ends in a non-newline.  An ed script
+   that is applied with --apply is, as no script is output.  */
+#define ROBUST_OUTPUT_STYLE(S) \
+  (((S) != OUTPUT_ED && (S) != OUTPUT_FORWARD_ED) || apply_edits)
+
+/* True for output styles that count the lines changed in each file
+   rather than output them.  */
+#define STAT_OUTPUT_STYLE(S) ((S) == OUTPUT_STAT || (S) == OUTPUT_NUMSTAT)
 
 XTERN enum output_style output_style;/*输出样式*/
 
@@ -97,6 +118,10 @@ XTERN bool text;
 /* Number of lines to keep in identical prefix and suffix.  */
 XTERN lin horizon_lines;
 
+/* Keep more of the identical prefix and suffix only when the changes
+   found reach the lines kept (--horizon-lines=auto).  */
+XTERN bool adaptive_horizon;
+
 /* The significance of white space during comparisons.  */
 enum DIFF_white_space
 {
@@ -142,12 +167,50 @@ XTERN bool no_dereference_symlinks;
 /* File labels for '-c' output headers (--label).  */
 XTERN char *file_label[2];
 
-/* Regexp to identify function-header lines (-F).  */
+/* Regexp to identify function-header lines (-F, -p).  */
 XTERN struct re_pattern_buffer function_regexp;
 
+/* Can FUNCTION_REGEXP match only at the start of a line?  */
+XTERN bool function_regexp_anchored;
+
 /* Ignore changes that affect only lines matching this regexp (-I).  */
 XTERN struct re_pattern_buffer ignore_regexp;
 
+/* The regexps of IGNORE_REGEXP, indexed by strings that their
+   matches contain, or null if some regexp has no such string.  */
+XTERN struct regexp_set *ignore_regexp_set;
+
+/* Leave the lines that match IGNORE_REGEXP out of the comparison, so
+   that they do not sway how the other lines are matched up
+   (--ignore-matching-lines-early).  */
+XTERN bool ignore_matching_lines_early;
+
+/* A list of regexps, as options like -I specify them.  */
+struct regexp_list
+{
+  char *regexps;	/* chars representing disjunction of the regexps */
+  size_t len;		/* chars used in 'regexps' */
+  size_t size;		/* size malloc'ed for 'regexps'; 0 if not malloc'ed */
+  bool multiple_regexps;/* Does 'regexps' represent a disjunction?  */
+  bool unanchored;	/* Might some regexp match after a line's start?  */
+  bool indexed;		/* Should the regexps be indexed as below?  */
+  char **literals;	/* for each regexp, a string its matches contain */
+  struct re_pattern_buffer **literal_bufs; /* and the regexp by itself */
+  size_t nliterals;	/* number of those strings */
+  bool no_literal;	/* Does some regexp have no such string?  */
+  struct regexp_set *set; /* the regexps indexed by those strings */
+  struct re_pattern_buffer *buf;
+};
+
+/* In context diffs, show previous lines that match these regexps
+   (-F), and the default one for C functions if -p was given.  They
+   are compiled into FUNCTION_REGEXP only when first needed.  */
+XTERN struct regexp_list function_regexp_list;
+XTERN bool show_c_function;
+
+/* Was -F or -p given, so that hunk headers show the function?  */
+XTERN bool show_function;
+
 /* Say only whether files differ, not how (-q).  */
 XTERN bool brief;
 
@@ -174,9 +237,12 @@ XTERN bool strip_trailing_cr;
    All file names less than this name are ignored.  */
 XTERN char const *starting_file;
 
-/* Pipe each file's output through pr (-l).  */
+/* Paginate each file's output like pr (-l).  */
 XTERN bool paginate;
 
+/* Pipe each file's output through the pr program instead (--external-pr).  */
+XTERN bool paginate_with_pr;
+
 /* Line group formats for unchanged, old, new, and changed groups.  */
 XTERN char const *group_format[CHANGED + 1];
 
@@ -186,6 +252,11 @@ XTERN char const *line_format[NEW + 1];
 /* If using OUTPUT_SDIFF print extra information to help the sdiff filter.  */
 XTERN bool sdiff_merge_assist;
 
+/* If nonnull, OUTPUT_SDIFF calls this for each run of common lines
+   and each hunk, passing whether the lines changed and the lines'
+   ranges in each file, instead of printing them.  */
+XTERN void (*sdiff_run_hook) (bool, lin, lin, lin, lin);
+
 /* Tell OUTPUT_SDIFF to show only the left version of common lines.  */
 XTERN bool left_column;
 
@@ -196,24 +267,269 @@ XTERN bool suppress_common_lines;
 XTERN size_t sdiff_half_width;
 XTERN size_t sdiff_column2_offset;
 
-/* String containing all the command options diff received,
-   with spaces between and at the beginning but none at the end.
-   If there were no options given, this string is empty.  */
-XTERN char *switch_string;
+/* The minimum width of the gutter between the columns of OUTPUT_SDIFF.  */
+#ifndef GUTTER_WIDTH_MINIMUM
+# define GUTTER_WIDTH_MINIMUM 3
+#endif
+
+/* The command options diff received, less those that affect only how
+   it does its work, from which switch_string makes the string for the
+   headers of its output.  */
+XTERN char **switch_vector;
+XTERN int switch_count;
 
 /* Use heuristics for better speed with large files with a small
    density of changes.  */
 XTERN bool speed_large_files;
 
+/* If nonzero, compare large files a window at a time, so as to use
+   roughly at most this many bytes of memory (--max-memory).  */
+XTERN size_t max_memory;
+
+/* Ask for huge pages for large buffers and tables, to cut the misses
+   in the translation lookaside buffer when they are used out of order
+   (--huge-pages).  */
+XTERN bool huge_pages;
+
+/* Compare files that are compared byte for byte, such as binary files
+   and files compared with -q, without filling the system's cache with
+   their data (--direct-io).  */
+XTERN bool direct_io;
+
+/* Write the changes that an ed script would make over the first of
+   two files that differ, rather than outputting the script (--apply).  */
+XTERN bool apply_edits;
+
+/* Output a binary delta that rebuilds the second of two binary files
+   that differ from the first, rather than saying that they differ
+   (--binary-delta).  */
+XTERN bool binary_delta;
+
+/* If nonzero, keep a dictionary of the lines of the files compared
+   that lasts the whole run and takes up roughly at most this many
+   bytes (--line-dictionary).  */
+XTERN size_t line_dictionary;
+
+/* If nonzero, stop looking for a small set of changes between two
+   files after this many steps of the search (--max-cost), or after
+   this many seconds (--timeout), and report all the lines that differ
+   as one change instead.  */
+XTERN lin max_cost;
+
+/* If nonzero, output at most this many hunks for each pair of files,
+   and stop looking for changes once the search has settled that many
+   (--max-hunks).  */
+XTERN lin max_hunks;
+XTERN time_t max_seconds;
+
+/* The number of workers started by --remote to compare the windows
+   of files too large for --max-memory.  */
+XTERN size_t remote_count;
+
 /* Patterns that match file names to be excluded.  */
 XTERN struct exclude *excluded;
 
+/* Patterns that match the names of the files in directories to be
+   compared, or null to compare them all.  */
+XTERN struct exclude *included;
+
+/* Compare up to this many groups of files in a directory at once,
+   each in a child process (--jobs).  */
+XTERN int jobs;
+
+/* Ask the system to read this many files ahead in each directory
+   being compared (--prefetch).  */
+XTERN int prefetch;
+
+/* File that records the pairs of files found identical, so that later
+   runs need not read them again (--manifest), or null.  */
+XTERN char const *manifest_name;
+
+/* File to which how far a recursive comparison has got is written
+   every so often, so that a later run can resume from there
+   (--checkpoint), or null.  */
+XTERN char const *checkpoint_name;
+
+/* The file to which an index of the output of each pair of files is
+   written (--output-index), or null.  */
+XTERN FILE *output_index;
+
+/* Write an index of the lines of each regular file read whole next
+   to it (--write-index), and use such indexes instead of splitting
+   and hashing files again (--read-index).  */
+XTERN bool write_index;
+XTERN bool read_index;
+
+/* Pair up files that are each in only one directory but have the same
+   contents, and report them as moved (--find-renames).  */
+XTERN bool find_renames;
+
+/* The fewest lines that --moves shows as a moved block.  */
+XTERN lin move_min;
+
 /* Don't discard lines.  This makes things slower (sometimes much
    slower) but will find a guaranteed minimal set of changes.  */
 XTERN bool minimal;
 
+/* The algorithm that matches up the lines of two files
+   (--diff-algorithm).  --minimal always uses Myers's.  */
+enum diff_algorithm
+{
+  /* Myers's O(ND) algorithm, which looks for few changes, or a
+     bit-parallel LCS if the files differ in most of their lines.  */
+  MYERS_ALGORITHM,
+
+  /* Match lines unique to both files first (patience diff).  */
+  PATIENCE_ALGORITHM,
+
+  /* Match the rarest common lines first (histogram diff).  */
+  HISTOGRAM_ALGORITHM,
+
+  /* Myers's, unless it is taking much longer than histogram diff
+     would and the lines are mostly unique, as in files whose blocks
+     of lines have moved around.  */
+  AUTO_ALGORITHM
+};
+
+XTERN enum diff_algorithm diff_algorithm;
+
 /* The strftime format to use for time strings.  */
 XTERN char const *time_format;
+
+/* Report where the time went to standard error (--stats), as text or
+   as JSON, or not at all.  */
+enum stats_format
+{
+  STATS_NONE,
+  STATS_TEXT,
+  STATS_JSON
+};
+
+XTERN enum stats_format stats_format;
+
+/* The phases of a comparison that --stats times.  */
+enum stats_phase
+{
+  /* Reading the files, and comparing binary files.  */
+  STATS_READ,
+
+  /* Finding the identical prefix and suffix (find_identical_ends).  */
+  STATS_ENDS,
+
+  /* Hashing lines into equivalence classes.  */
+  STATS_HASH,
+
+  /* Discarding lines that match nothing (discard_confusing_lines).  */
+  STATS_DISCARD,
+
+  /* Matching up the remaining lines (compareseq and friends).  */
+  STATS_COMPARE,
+
+  /* Sliding changes into place and building the edit script.  */
+  STATS_SHIFT,
+
+  /* Outputting the differences.  */
+  STATS_OUTPUT,
+
+  /* Everything else: parsing options, scanning directories, etc.  */
+  STATS_OTHER,
+
+  STATS_PHASES
+};
+
+/* What --stats counts, over all the files compared.  */
+struct stats
+{
+  /* Pairs of files whose contents were read.  */
+  uintmax_t files;
+
+  /* Lines hashed, and equivalence classes made of them.  */
+  uintmax_t lines;
+  uintmax_t classes;
+
+  /* Lines whose classes were found in the dictionary of lines.  */
+  uintmax_t dictionary_hits;
+
+  /* Times that --horizon-lines=auto hashed files again.  */
+  uintmax_t horizon_widened;
+
+  /* Lookups in the hash table of classes, the slots that they
+     probed, and the most slots that one lookup probed.  */
+  uintmax_t lookups;
+  uintmax_t probes;
+  uintmax_t max_probes;
+
+  /* The slots of the hash tables, when they were done with, and how
+     many of them were in use; and how many times a table grew.  */
+  uintmax_t slots;
+  uintmax_t slots_used;
+  uintmax_t table_grows;
+
+  /* Lines compared with a class's line because their hashes were
+     equal, and how many of those turned out not to be equal.  */
+  uintmax_t compares;
+  uintmax_t collisions;
+
+  /* Calls to lines_differ.  */
+  uintmax_t lines_differ;
+
+  /* Diagonals that the search for the middle snake in 'diag'
+     extended.  */
+  uintmax_t diagonals;
+
+  /* Pairs of files that --diff-algorithm=auto compared with Myers's
+     algorithm, and with histogram diff.  */
+  uintmax_t auto_myers;
+  uintmax_t auto_histogram;
+
+  /* Runs of changed lines in the edit scripts.  */
+  uintmax_t hunks;
+
+  /* Bytes of input lines copied into the output.  */
+  uintmax_t output_bytes;
+
+  /* The most bytes that the files' buffers and the tables built
+     for their lines took up at once.  */
+  uintmax_t peak_memory;
+
+  /* With --jobs, the groups of files that child processes compared;
+     the children running, and the groups finished and waiting to be
+     output, summed over time in seconds; and the seconds that the
+     parent waited for a child to finish while all were busy, and
+     while the queue of output was full.  */
+  uintmax_t job_groups;
+  double job_running_seconds;
+  double job_waiting_seconds;
+  double jobs_wait;
+  double output_wait;
+};
+
+XTERN struct stats stats;
+
+/* Report how far the comparison has got to standard error, every
+   second or so (--progress).  */
+XTERN bool show_progress;
+
+/* What --progress reports, besides the phase of the comparison.  */
+struct progress
+{
+  /* Names found in the directories being compared, and how many of
+     them have been dealt with.  */
+  uintmax_t names_found;
+  uintmax_t names_done;
+
+  /* The files being compared.  */
+  struct file_data const *files;
+
+  /* Lines of the files hashed so far.  */
+  lin hashed;
+
+  /* Lines of each file, not counting discarded lines, that the
+     search for changes has got past.  */
+  lin settled[2];
+};
+
+XTERN struct progress progress;
 
 /* The result of comparison is an "edit script": a chain of 'struct change'.
    Each 'struct change' represents one place where some lines are deleted
@@ -238,6 +554,33 @@ struct change
 
 /* Structures that describe the input files.  */
 
+/* file_data.desc markers.  A directory being compared has its
+   descriptor in desc if it could be opened, and is UNOPENED otherwise.  */
+#define NONEXISTENT (-1) /* nonexistent file */
+#define UNOPENED (-2) /* unopened file (e.g. directory) */
+#define ERRNO_ENCODE(errno) (-3 - (errno)) /* encoded errno value */
+
+#define ERRNO_DECODE(desc) (-3 - (desc)) /* inverse of ERRNO_ENCODE */
+
+/* An index of the lines of a file, read from its sidecar file.  */
+
+struct line_index
+{
+  /* The number of lines.  */
+  lin lines;
+
+  /* The offsets in the file's buffer of the start of each line, and
+     of the end of the last line.  */
+  uint64_t const *offset;
+
+  /* The hash of each line.  */
+  uint64_t const *hash;
+
+  /* The memory holding the index, and its size.  */
+  void *region;
+  size_t size;
+};
+
 /* Data on one input file being compared.  */
 
 struct file_data {
@@ -258,6 +601,10 @@ struct file_data {
     /* Number of valid bytes now in the buffer.  */
     size_t buffered;/*在buffer中的内容长度*/
 
+    /* If nonzero, BUFFER is a private memory mapping of the file,
+       this many bytes long, rather than storage from the heap.  */
+    size_t mapped;
+
     /* Array of pointers to lines in the file.  */
     char const **linbuf;
 
@@ -274,6 +621,14 @@ struct file_data {
        There are this many lines in the file before linbuf[0].  */
     lin prefix_lines;
 
+    /* Count of lines before the current window, when comparing files
+       a window at a time (--max-memory).  These lines have already
+       been compared and are no longer in the buffer.  */
+    lin window_lines;
+
+    /* Count of bytes before the current window, likewise.  */
+    uintmax_t window_bytes;
+
     /* Pointer to start of suffix of this file to ignore when hashing.  */
     char const *suffix_begin;
 
@@ -301,6 +656,20 @@ struct file_data {
     /* 1 if file ends in a line with no final newline.  */
     bool missing_newline;/*标明buffer中最后是否为真实的换行*/
 
+    /* 1 if the buffer, and the equivalence classes of the lines,
+       belong to a file that retain_file keeps in memory across
+       comparisons.  */
+    bool retained;
+
+    /* 1 if the buffer was supplied by a program using the engine,
+       already holding all of the file's text, which is neither read
+       nor checked for null bytes; the buffer is not freed.  */
+    bool supplied;
+
+    /* The index of the file's lines, if --read-index found one that
+       is up to date, or null.  */
+    struct line_index *index;
+
     /* 1 if at end of file.  */
     bool eof;/*是否到达文件结尾*/
 
@@ -325,6 +694,12 @@ struct comparison
 /* Describe the two files currently being compared.  */
 
 XTERN struct file_data files[2];
+
+/* For each equivalence class of the lines of FILES, whether -B and -I
+   would ignore its lines: 0 if not yet known, 1 if so, -1 if not.
+   Null if lines in the same class can differ.  */
+
+XTERN signed char *ignorable_class;
 
 /* Stdio stream to output diffs to.  */
 
@@ -334,52 +709,150 @@ XTERN FILE *outfile;/*diff输出文件*/
 
 /* analyze.c */
 extern int diff_2_files (struct comparison *);
+extern int diff_lines (struct comparison *);
+extern int script_2_files (struct comparison *,
+			   void (*) (struct change *, struct file_data const[],
+				     void *),
+			   void *);
+
+/* checkpoint.c */
+extern int resume_checkpoint (char const *);
+extern char const *resume_point (bool *);
+extern void checkpoint_begin (char const *);
+extern void checkpoint_end (int);
+extern void finish_checkpoint (int);
 
 /* context.c */
 extern void print_context_header (struct file_data[], char const * const *, bool);
 extern void print_context_script (struct change *, bool);
+extern void carry_function (void);
+
+/* delta.c */
+extern bool print_binary_delta (struct comparison const *);
+
+/* diffstat.c */
+extern void count_stat_script (struct change *);
+extern void stat_pair (char const *, bool);
+extern void print_stat_summary (void);
 
 /* dir.c */
+extern void add_excluded_pattern (struct exclude *, char const *, int);
+extern void add_included_pattern (struct exclude *, char const *, int);
 extern int diff_dirs (struct comparison const *,
                       int (*) (struct comparison const *,
                                char const *, char const *));
+extern int diff_fixed (char const *, bool, char *const *, int,
+                       int (*) (struct comparison const *,
+                                char const *, char const *));
 extern char *find_dir_file_pathname (char const *, char const *);
+extern int diff_lone_files (int (*) (struct comparison const *,
+                                     char const *, char const *));
 
 /* ed.c */
 extern void print_ed_script (struct change *);
+extern void apply_ed_script (struct change *);
 extern void pr_forward_ed_script (struct change *);
+extern void print_rcs_script (struct change *);
 
 /* ifdef.c */
 extern void print_ifdef_script (struct change *);
 
+/* index.c */
+extern void load_line_index (struct file_data *, uint64_t);
+extern void save_line_index (struct file_data const *, uint64_t,
+			     lin, uint64_t const *, uint64_t const *);
+extern void free_line_index (struct line_index *);
+
 /* io.c */
 extern void file_block_read (struct file_data *, size_t);
+extern void *take_spare_block (size_t);
+extern void keep_spare_block (void *, size_t);
+extern void file_buffer_free (struct file_data *);
 extern bool read_files (struct file_data[], bool);
+extern bool read_lone_file (struct file_data[], int);
+extern bool read_next_windows (struct file_data[]);
+extern bool windows_are_remote (void) _GL_ATTRIBUTE_PURE;
+extern bool comparing_windows (void) _GL_ATTRIBUTE_PURE;
+extern void window_extents (struct file_data const[],
+                            uintmax_t[2], size_t[2]);
+extern bool horizon_reached (struct file_data const[]) _GL_ATTRIBUTE_PURE;
+extern void widen_horizon (struct file_data[]);
+extern size_t files_memory (struct file_data const[]) _GL_ATTRIBUTE_PURE;
+extern bool retain_file (struct file_data *);
+extern void reset_token_classes (void);
+extern lin token_class (char const *, size_t);
+
+/* json.c */
+extern void print_json_header (char const *, char const *);
+extern void print_json_script (struct change *);
+extern void print_json_trailer (void);
+
+/* manifest.c */
+extern void read_manifest (char const *);
+extern bool manifest_lists (struct file_data const[]);
+extern void manifest_add (struct file_data const[]);
+extern void write_manifest (char const *);
+
+/* moves.c */
+extern void print_moves_script (struct change *);
 
 /* normal.c */
 extern void print_normal_script (struct change *);
 
-/* rcs.c */
-extern void print_rcs_script (struct change *);
+/* paginate.c */
+extern FILE *begin_pagination (char *);
+extern void finish_pagination (void);
+
+/* remote.c */
+extern void add_remote_worker (char const *);
+extern void set_remote_options (char **, int);
+extern bool remote_comparable (struct file_data const[]) _GL_ATTRIBUTE_PURE;
+extern int compare_remotely (struct comparison *);
+extern void finish_remote_workers (void);
+extern void read_remote_arguments (int *, char ***);
+extern int serve_remote_requests (void);
 
 /* side.c */
 extern void print_sdiff_script (struct change *);
+extern void print_sdiff_run (bool, lin, lin, lin, lin);
+extern void set_sdiff_width (size_t);
+
+/* stats.c */
+extern void stats_phase (enum stats_phase);
+extern void stats_memory (size_t);
+extern void stats_child (void);
+extern void stats_send (int);
+extern void stats_receive (int);
+extern void progress_tick (void);
+extern void print_stats (void);
 
 /* util.c */
 extern char const change_letter[4];
 extern char const pr_program[];
+extern void use_locale (int);
+extern char const *switch_string (void);
+extern void add_regexp (struct regexp_list *, char const *);
+extern void summarize_regexp_list (struct regexp_list *);
+extern void free_regexp_list (struct regexp_list *);
 extern char *concat (char const *, char const *, char const *);
 extern bool lines_differ (char const *, char const *) _GL_ATTRIBUTE_PURE;
+extern bool matches_ignore_regexp (char const *, size_t);
+extern bool line_is_ignorable (struct file_data const *, lin);
 extern lin translate_line_number (struct file_data const *, lin);
 extern struct change *find_change (struct change *);
 extern struct change *find_reverse_change (struct change *);
 extern void *zalloc (size_t);
+extern void advise_huge_pages (void *, size_t);
 extern enum changes analyze_hunk (struct change *, lin *, lin *, lin *, lin *);
 extern void begin_output (void);
+extern bool hunk_limit_reached (void) _GL_ATTRIBUTE_PURE;
+extern void index_hunk (lin, lin);
 extern void debug_script (struct change *);
 extern void fatal (char const *) __attribute__((noreturn));
 extern void finish_output (void);
 extern void message (char const *, char const *, char const *);
+extern void open_output_index (char const *);
+extern void close_output_index (char const *);
 extern void message5 (char const *, char const *, char const *,
                       char const *, char const *);
 extern void output_1_line (char const *, char const *, char const *,
@@ -387,6 +860,11 @@ extern void output_1_line (char const *, char const *, char const *,
 extern void perror_with_name (char const *);
 extern void pfatal_with_name (char const *) __attribute__((noreturn));
 extern void print_1_line (char const *, char const * const *);
+extern void print_bare_lines (struct file_data const *, lin, lin);
+extern void print_flagged_lines (char const *, struct file_data const *,
+                                 lin, lin);
+extern void print_prefixed_lines (struct file_data const *, lin, lin,
+                                  char const *, char const *);
 extern void print_message_queue (void);
 extern void print_number_range (char, struct file_data *, lin, lin);
 extern void print_script (struct change *, struct change * (*) (struct change *),
@@ -394,3 +872,6 @@ extern void print_script (struct change *, struct change * (*) (struct change *)
 extern void setup_output (char const *, char const *, bool);
 extern void translate_range (struct file_data const *, lin, lin,
                              long int *, long int *);
+
+/* words.c */
+extern void print_word_diff_script (struct change *);
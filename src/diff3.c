@@ -17,7 +17,10 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "system.h"
+#include "batch.h"
+#include "engine.h"
 #include "paths.h"
+#include "probes.h"
 
 #include <stdio.h>
 #include <unlocked-io.h>
@@ -29,6 +32,7 @@
 #include <file-type.h>
 #include <getopt.h>
 #include <progname.h>
+#include <rewrite.h>
 #include <system-quote.h>
 #include <version-etc.h>
 #include <xalloc.h>
@@ -75,8 +79,8 @@ enum diff_type {
 /* Two way diff */
 struct diff_block {
   lin ranges[2][2];		/* Ranges are inclusive */
-  char **lines[2];		/* The actual lines (may contain nulls) */
-  size_t *lengths[2];		/* Line lengths (including newlines, if any) */
+  char const **lines[2];	/* Starts of the lines (which may contain
+				   nulls), then the end of the last */
   struct diff_block *next;
 };
 
@@ -85,9 +89,37 @@ struct diff_block {
 struct diff3_block {
   enum diff_type correspond;	/* Type of diff */
   lin ranges[3][2];		/* Ranges are inclusive */
-  char **lines[3];		/* The actual lines (may contain nulls) */
-  size_t *lengths[3];		/* Line lengths (including newlines, if any) */
-  struct diff3_block *next;
+  char const *const **lines[3];	/* The lines, as entries of the
+				   two way blocks' lines */
+};
+
+/* A two way diff being computed by a child process, which outputs it
+   in normal format to a pipe.  */
+
+struct diff_child {
+  char const *filea;		/* The files being compared */
+  char const *fileb;
+  int fd;			/* The pipe's read end */
+#if HAVE_WORKING_FORK
+  pid_t pid;
+#else
+  FILE *fpipe;
+#endif
+};
+
+/* What is left to compare of three files once the lines at their
+   start and end that all three have in common are trimmed: the
+   SIZE[F] bytes of text at TEXT[F] of FILE0, FILE1 and FILEC, which
+   begin after line OFFSET of each file.  As the engine may change a
+   text that it compares, COMMON[F] is a copy of the text of FILEC to
+   compare with file F, and CONTEXT[F] owns the hunks found.  */
+
+struct middles {
+  lin offset;
+  char *text[3];
+  size_t size[3];
+  char *common[2];
+  struct engine_context *context[2];
 };
 
 /* Access the ranges on a diff block.  */
@@ -103,14 +135,18 @@ struct diff3_block {
    are lvalues and can be used for assignment.  */
 #define	D_RELNUM(diff, filenum, linenum)	\
   ((diff)->lines[filenum][linenum])
-#define	D_RELLEN(diff, filenum, linenum)	\
-  ((diff)->lengths[filenum][linenum])
 
 /* And get at them directly, when that should be necessary.  */
 #define	D_LINEARRAY(diff, filenum)	\
   ((diff)->lines[filenum])
-#define	D_LENARRAY(diff, filenum)	\
-  ((diff)->lengths[filenum])
+
+/* A line of a three way diff is the address of the entry for it in
+   the lines of a two way diff, so that it runs from *LINE up to the
+   start of the entry's successor.  Lines are kept this way, rather
+   than as an address and a length, to halve the memory that large
+   merges need for them.  */
+#define	LINE_TEXT(line)		(*(line))
+#define	LINE_LENGTH(line)	((size_t) ((line)[1] - (line)[0]))
 
 /* Next block.  */
 #define	D_NEXT(diff)	((diff)->next)
@@ -158,6 +194,10 @@ static bool overlap_only;
 /* If nonzero, show information for DIFF_2ND diffs.  */
 static bool show_2nd;
 
+/* If nonzero, output nothing, and only find out whether there are
+   conflicts.  */
+static bool conflicts_only;
+
 /* If nonzero, include ':wq' at the end of the script
    to write out the file being edited.   */
 static bool finalwrite;
@@ -165,37 +205,87 @@ static bool finalwrite;
 /* If nonzero, output a merged file.  */
 static bool merge;
 
-static char *read_diff (char const *, char const *, char **);
-static char *scan_diff_line (char *, char **, size_t *, char *, char);
+/* If nonzero, write the merged file over MYFILE rather than to
+   standard output, as ed does with an -i script (--apply).  */
+static bool apply;
+
+static bool start_child (char const *, char const *, struct diff_child *);
+static char *read_child (struct diff_child const *, char **,
+			 struct diff_block ***, struct diff_block **);
+static struct diff_block *finish_child (struct diff_child *, struct diff_block **);
+static void start_diff (char const *, char const *, struct diff_child *);
+static char *scan_diff_line (char *, char **, char *, char);
 static enum diff_type process_diff_control (char **, struct diff_block *);
-static bool compare_line_list (char * const[], size_t const[], char * const[], size_t const[], lin);
-static bool copy_stringlist (char * const[], size_t const[], char *[], size_t[], lin);
-static bool output_diff3_edscript (FILE *, struct diff3_block *, int const[3], int const[3], char const *, char const *, char const *);
-static bool output_diff3_merge (FILE *, FILE *, struct diff3_block *, int const[3], int const[3], char const *, char const *, char const *);
-static struct diff3_block *create_diff3_block (lin, lin, lin, lin, lin, lin);
-static struct diff3_block *make_3way_diff (struct diff_block *, struct diff_block *);
-static struct diff3_block *reverse_diff3_blocklist (struct diff3_block *);
-static struct diff3_block *using_to_diff3_block (struct diff_block *[2], struct diff_block *[2], int, int, struct diff3_block const *);
+static bool compare_line_list (char const *const *const[], char const *const *const[], lin);
+static bool copy_stringlist (char const *const[], char const *const *[], lin);
+static bool output_diff3_edscript (FILE *, struct diff3_block const *, lin, int const[3], int const[3], char const *, char const *, char const *);
+static bool output_diff3_merge (FILE *, FILE *, struct diff3_block const *, lin, int const[3], int const[3], char const *, char const *, char const *);
+static void init_diff3_block (struct diff3_block *, lin, lin, lin, lin, lin, lin);
+static struct diff3_block *make_3way_diff (struct diff_block *, struct diff_block *, bool, lin *);
+static bool using_to_diff3_block (struct diff3_block *, struct diff_block *[2], struct diff_block *[2], int, int, struct diff3_block const *);
+static struct diff_block *hunk_blocks (struct engine_hunk *, lin, bool, struct diff_block **);
+static struct diff_block *engine_diff (char const *, char const *, struct diff_block **);
+static void parse_diff (char *, char *, struct diff_block ***,
+			struct diff_block **);
 static struct diff_block *process_diff (char const *, char const *, struct diff_block **);
+static bool same_contents (char const *, char const *);
+static bool trim_common_ends (char const *const[3], struct middles *);
+static struct diff_block *middle_diff (struct middles const *, int, struct diff_block **);
+static struct diff_block *copy_diff_blocks (struct diff_block const *);
+static void diff_against_common (char **, int, struct diff_block *[]);
+static void diff_with_common (char const *const[3], struct diff_block *[2]);
+static void init_engine (struct engine_options *);
+static bool output_nway_merge (FILE *, FILE *, struct diff_block *[], int, char const * const[]);
+static FILE *merge_output (void);
+static void finish_merge_output (FILE *, char const *);
 static void check_stdout (void);
 static void fatal (char const *) __attribute__((noreturn));
-static void output_diff3 (FILE *, struct diff3_block *, int const[3], int const[3]);
+static void output_diff3 (FILE *, struct diff3_block const *, lin, int const[3], int const[3]);
 static void perror_with_exit (char const *) __attribute__((noreturn));
 static void try_help (char const *, char const *) __attribute__((noreturn));
 static void usage (void);
 
-static char const *diff_program = DEFAULT_DIFF_PROGRAM;
+/* The program to compare files with, or null if files are to be
+   compared in-process by diff's own engine, which spares forking
+   'diff' twice and parsing its output.  */
+static char const *diff_program;
+
+/* Compare a pair of files with diff's engine in a child process,
+   concurrently with the other pair, if the pair has at least this
+   many bytes.  Below that, forking costs more than it saves.  */
+enum { CHILD_ENGINE_MINIMUM = 1024 * 1024 };
+
+/* Keep this many of the lines that two files have in common at their
+   start and end, as the engine does to place hunks where they would
+   be if the whole files were compared.  */
+enum { HORIZON_LINES = 100 };
+
+/* Trim the lines common to the start and end of all three files only
+   if the common file has at least this many bytes, and only if at
+   least half of them go; otherwise comparing whole files, perhaps
+   concurrently, costs no more.  */
+enum { TRIM_MINIMUM = 64 * 1024 };
+
+/* read_child reads a child's output in chunks that grow to this
+   size, unless a single block of the diff needs more.  */
+enum { CHUNK_SIZE_MAXIMUM = 1024 * 1024 };
 
 /* Values for long options that do not have single-letter equivalents.  */
 enum
 {
-  DIFF_PROGRAM_OPTION = CHAR_MAX + 1,
+  APPLY_OPTION = CHAR_MAX + 1,
+  BATCH_OPTION,
+  CONFLICTS_ONLY_OPTION,
+  DIFF_PROGRAM_OPTION,
   HELP_OPTION,
   STRIP_TRAILING_CR_OPTION
 };
 
 static struct option const longopts[] =
 {
+  {"apply", 0, 0, APPLY_OPTION},
+  {"batch", 2, 0, BATCH_OPTION},
+  {"conflicts-only", 0, 0, CONFLICTS_ONLY_OPTION},
   {"diff-program", 1, 0, DIFF_PROGRAM_OPTION},
   {"easy-only", 0, 0, '3'},
   {"ed", 0, 0, 'e'},
@@ -221,12 +311,15 @@ main (int argc, char **argv)
   int rev_mapping[3];
   int incompat = 0;
   bool conflicts_found;
-  struct diff_block *thread0, *thread1, *last_block;
+  char const *name[3];
+  struct diff_block *thread[2];
   struct diff3_block *diff3;
+  lin nblocks;
   int tag_count = 0;
   char *tag_strings[3];
   char *commonname;
   char **file;
+  int nfiles;
   struct stat statb;
 
   exit_failure = EXIT_TROUBLE;
@@ -283,6 +376,19 @@ main (int argc, char **argv)
 		       AUTHORS, (char *) NULL);
 	  check_stdout ();
 	  return EXIT_SUCCESS;
+	case APPLY_OPTION:
+	  apply = true;
+	  break;
+	case BATCH_OPTION:
+#if HAVE_WORKING_FORK
+	  run_batch (&argc, &argv, optarg, try_help);
+	  break;
+#else
+	  try_help ("--batch is not supported on this system", 0);
+#endif
+	case CONFLICTS_ONLY_OPTION:
+	  conflicts_only = true;
+	  break;
 	case DIFF_PROGRAM_OPTION:
 	  diff_program = optarg;
 	  break;
@@ -303,24 +409,51 @@ main (int argc, char **argv)
 	}
     }
 
+  /* --apply does the merge that an -i script has ed do, so -i is
+     implied rather than incompatible.  */
+  if (apply)
+    {
+      merge = true;
+      finalwrite = false;
+    }
+
   edscript = incompat & ~merge;  /* -AeExX3 without -m implies ed script.  */
   show_2nd |= ~incompat & merge;  /* -m without -AeExX3 implies -A.  */
   flagging |= ~incompat & merge;
 
   if (incompat > 1  /* Ensure at most one of -AeExX3.  */
       || finalwrite & merge /* -i -m would rewrite input file.  */
+      || (conflicts_only && (incompat || merge)) /* Nothing to output.  */
       || (tag_count && ! flagging)) /* -L requires one of -AEX.  */
     try_help ("incompatible options", 0);
 
-  if (argc - optind != 3)
-    {
-      if (argc - optind < 3)
-	try_help ("missing operand after '%s'", argv[argc - 1]);
-      else
-	try_help ("extra operand '%s'", argv[optind + 3]);
-    }
+  /* A merge without -AeExX3 can take more than one YOURFILE.  */
+  if (argc - optind < 3)
+    try_help ("missing operand after '%s'", argv[argc - 1]);
+  if (3 < argc - optind && ! (merge && ! incompat))
+    try_help ("extra operand '%s'", argv[optind + 3]);
 
   file = &argv[optind];
+  nfiles = argc - optind;
+
+  if (apply && STREQ (file[0], "-"))
+    fatal ("MYFILE cannot be '-' with --apply");
+
+  if (3 < nfiles)
+    {
+      /* OLDFILE is the common file of all the comparisons, so it
+	 cannot be standard input, and only one other file can.  */
+      bool stdin_seen = false;
+      for (i = 0; i < nfiles; i++)
+	if (STREQ (file[i], "-"))
+	  {
+	    if (i == 1)
+	      fatal ("OLDFILE cannot be '-' when there is more than one YOURFILE");
+	    if (stdin_seen)
+	      fatal ("'-' specified for more than one input file");
+	    stdin_seen = true;
+	  }
+    }
 
   for (i = tag_count; i < 3; i++)
     tag_strings[i] = file[i];
@@ -338,10 +471,11 @@ main (int argc, char **argv)
 
      Historically, the default common file was file2, so some older
      applications (e.g. Emacs ediff) used file2 as the ancestor.  So,
-     for compatibility, if this is a 3-way diff (not a merge or
-     edscript), prefer file2 as the common file.  */
+     for compatibility, if this is a 3-way diff (not a merge,
+     edscript or check for conflicts), prefer file2 as the common
+     file.  */
 
-  common = 2 - (edscript | merge);
+  common = 2 - (edscript | merge | conflicts_only);
 
   if (STREQ (file[common], "-"))
     {
@@ -360,7 +494,7 @@ main (int argc, char **argv)
   for (i = 0; i < 3; i++)
     rev_mapping[mapping[i]] = i;
 
-  for (i = 0; i < 3; i++)
+  for (i = 0; i < nfiles; i++)
     if (! STREQ (file[i], "-"))
       {
 	if (stat (file[i], &statb) < 0)
@@ -374,29 +508,65 @@ main (int argc, char **argv)
   signal (SIGCHLD, SIG_DFL);
 #endif
 
-  /* Invoke diff twice on two pairs of input files, combine the two
-     diffs, and output them.  */
-
   commonname = file[rev_mapping[FILEC]];
-  thread1 = process_diff (file[rev_mapping[FILE1]], commonname, &last_block);
-  thread0 = process_diff (file[rev_mapping[FILE0]], commonname, &last_block);
-  diff3 = make_3way_diff (thread0, thread1);
-  if (edscript)
+
+  if (3 < nfiles)
+    {
+      /* Merge the changes that each file other than OLDFILE makes to
+	 it, comparing each such file to OLDFILE only once.  */
+      char const **label = xnmalloc (nfiles, sizeof *label);
+      struct diff_block **threads = xnmalloc (nfiles, sizeof *threads);
+      FILE *out;
+      for (i = 0; i < nfiles; i++)
+	label[i] = i < 3 ? tag_strings[i] : file[i];
+      if (! diff_program)
+	{
+	  /* Read the common file just once.  A child that compares a
+	     file to it inherits it.  */
+	  struct engine_options options;
+	  init_engine (&options);
+	  engine_retain (commonname);
+	}
+      diff_against_common (file, nfiles, threads);
+      xfreopen (commonname, "r", stdin);
+      out = merge_output ();
+      conflicts_found = output_nway_merge (stdin, out, threads, nfiles,
+					   label);
+      if (ferror (stdin))
+	fatal ("read failed");
+      finish_merge_output (out, file[0]);
+      check_stdout ();
+      exit (conflicts_found);
+    }
+
+  /* Compare two pairs of input files, combine the two diffs, and
+     output them.  */
+
+  for (i = 0; i < 3; i++)
+    name[i] = file[rev_mapping[i]];
+  diff_with_common (name, thread);
+  diff3 = make_3way_diff (thread[0], thread[1], conflicts_only, &nblocks);
+  if (conflicts_only)
+    conflicts_found = nblocks != 0;
+  else if (edscript)
     conflicts_found
-      = output_diff3_edscript (stdout, diff3, mapping, rev_mapping,
+      = output_diff3_edscript (stdout, diff3, nblocks, mapping, rev_mapping,
 			       tag_strings[0], tag_strings[1], tag_strings[2]);
   else if (merge)
     {
+      FILE *out = merge_output ();
       xfreopen (file[rev_mapping[FILE0]], "r", stdin);
       conflicts_found
-	= output_diff3_merge (stdin, stdout, diff3, mapping, rev_mapping,
+	= output_diff3_merge (stdin, out, diff3, nblocks,
+			      mapping, rev_mapping,
 			      tag_strings[0], tag_strings[1], tag_strings[2]);
       if (ferror (stdin))
 	fatal ("read failed");
+      finish_merge_output (out, file[rev_mapping[FILE0]]);
     }
   else
     {
-      output_diff3 (stdout, diff3, mapping, rev_mapping);
+      output_diff3 (stdout, diff3, nblocks, mapping, rev_mapping);
       conflicts_found = false;
     }
 
@@ -405,6 +575,43 @@ main (int argc, char **argv)
   return conflicts_found;
 }
 
+/* Return the stream to output a merged file to: standard output, or
+   with --apply a temporary file, as the merge reads MYFILE.  */
+
+static FILE *
+merge_output (void)
+{
+  FILE *out;
+
+  if (! apply)
+    return stdout;
+  out = tmpfile ();
+  if (! out)
+    perror_with_exit ("tmpfile");
+  return out;
+}
+
+/* Finish the merged file output to OUT, writing it over MYFILE with
+   --apply.  */
+
+static void
+finish_merge_output (FILE *out, char const *myfile)
+{
+  int err;
+
+  if (out == stdout)
+    return;
+  if (ferror (out))
+    fatal ("write failed");
+  err = rewrite_file (myfile, out);
+  if (err)
+    {
+      errno = err;
+      perror_with_exit (myfile);
+    }
+  fclose (out);
+}
+
 static void
 try_help (char const *reason_msgid, char const *operand)
 {
@@ -437,11 +644,16 @@ static char const * const option_help_msgid[] = {
   "",
   N_("-m, --merge                 output actual merged file, according to\n"
      "                                -A if no other options are given"),
+  N_("    --apply                 like -m, but write the merged file over MYFILE"),
   "",
   N_("-a, --text                  treat all files as text"),
   N_("    --strip-trailing-cr     strip trailing carriage return on input"),
   N_("-T, --initial-tab           make tabs line up by prepending a tab"),
+  N_("    --conflicts-only        output nothing; just exit with status 1\n"
+     "                                if the changes conflict"),
   N_("    --diff-program=PROGRAM  use PROGRAM to compare files"),
+  N_("    --batch[=NUM]           run merge jobs read from standard input,\n"
+     "                                NUM at a time"),
   N_("-L, --label=LABEL           use LABEL instead of file name\n"
      "                                (can be repeated up to three times)"),
   "",
@@ -457,6 +669,8 @@ usage (void)
 
   printf (_("Usage: %s [OPTION]... MYFILE OLDFILE YOURFILE\n"),
 	  program_name);
+  printf (_("  or:  %s -m [OPTION]... MYFILE OLDFILE YOURFILE...\n"),
+	  program_name);
   printf ("%s\n\n", _("Compare three files line by line."));
 
   fputs (_("\
@@ -531,15 +745,21 @@ robust than using ed.\n"), stdout);
      Then do it again, until the blocks are exhausted.  */
 
 
-/* Make a three way diff (chain of diff3_block's) from two two way
+/* Make a three way diff (array of diff3_block's) from two two way
    diffs (chains of diff_block's).  Assume that each of the two diffs
    passed are onto the same file (i.e. that each of the diffs were
-   made "to" the same file).  Return a three way diff pointer with
+   made "to" the same file).  Return the blocks, in order, with
    numbering FILE0 = the other file in diff02, FILE1 = the other file
-   in diff12, and FILEC = the common file.  */
+   in diff12, and FILEC = the common file, and store their number
+   into *NBLOCKS.
+
+   If ONLY_CONFLICTS, return just the first block in which all three
+   files differ, if there is one, and do not create blocks in which
+   only one file differs at all, as they cannot conflict.  */
 
 static struct diff3_block *
-make_3way_diff (struct diff_block *thread0, struct diff_block *thread1)
+make_3way_diff (struct diff_block *thread0, struct diff_block *thread1,
+		bool only_conflicts, lin *nblocks)
 {
   /* Work on the two diffs passed to it as threads.  Thread number 0
      is diff02, thread number 1 is diff12.  USING is the base of the
@@ -566,7 +786,10 @@ make_3way_diff (struct diff_block *thread0, struct diff_block *thread1)
      LAST_DIFF is the last diff block produced by this routine, for
      line correspondence purposes between that diff and the one
      currently being worked on.  It is ZERO_DIFF before any blocks
-     have been created.  */
+     have been created.
+
+     RESULT is an array of RESULT_ALLOC blocks, of which the first
+     RESULT_COUNT are in use.  */
 
   struct diff_block *using[2];
   struct diff_block *last_using[2];
@@ -583,7 +806,8 @@ make_3way_diff (struct diff_block *thread0, struct diff_block *thread1)
 
   struct diff3_block *result;
   struct diff3_block *tmpblock;
-  struct diff3_block **result_end;
+  size_t result_count;
+  size_t result_alloc;
 
   struct diff3_block const *last_diff3;
 
@@ -591,7 +815,7 @@ make_3way_diff (struct diff_block *thread0, struct diff_block *thread1)
 
   /* Initialization */
   result = 0;
-  result_end = &result;
+  result_count = result_alloc = 0;
   current[0] = thread0; current[1] = thread1;
   last_diff3 = &zero_diff3;
 
@@ -664,29 +888,46 @@ make_3way_diff (struct diff_block *thread0, struct diff_block *thread1)
 	  other_diff = current[other_thread];
 	}
 
+      if (only_conflicts && ! (using[0] && using[1]))
+	continue;
+
       /* The using lists contain a list of all of the blocks to be
-	 included in this diff3_block.  Create it.  */
+	 included in this diff3_block.  Create it at the end of the
+	 array.  */
 
-      tmpblock = using_to_diff3_block (using, last_using,
-				       base_water_thread, high_water_thread,
-				       last_diff3);
+      if (result_count == result_alloc)
+	result = x2nrealloc (result, &result_alloc, sizeof *result);
+      tmpblock = &result[result_count];
 
-      if (!tmpblock)
+      if (!using_to_diff3_block (tmpblock, using, last_using,
+				 base_water_thread, high_water_thread,
+				 result_count ? tmpblock - 1 : last_diff3))
 	fatal ("internal error: screwup in format of diff blocks");
 
-      /* Put it on the list.  */
-      *result_end = tmpblock;
-      result_end = &tmpblock->next;
+      if (only_conflicts)
+	{
+	  /* LAST_DIFF3 is needed only for a thread with no blocks in
+	     USING, so the block need not be kept unless it is the
+	     conflict sought.  */
+	  if (D3_TYPE (tmpblock) == DIFF_ALL)
+	    {
+	      result_count = 1;
+	      break;
+	    }
+	  continue;
+	}
 
-      /* Set up corresponding lines correctly.  */
-      last_diff3 = tmpblock;
+      /* Keep it.  */
+      result_count++;
     }
+
+  *nblocks = result_count;
   return result;
 }
 
 /* Take two lists of blocks (from two separate diff threads) and put
-   them together into one diff3 block.  Return a pointer to this diff3
-   block or 0 for failure.
+   them together into the diff3 block RESULT.  Return false for
+   failure.
 
    All arguments besides using are for the convenience of the routine;
    they could be derived from the using array.  LAST_USING is a pair
@@ -700,14 +941,14 @@ make_3way_diff (struct diff_block *thread0, struct diff_block *thread1)
    that are part of a normal two diff block, and the three diffs that
    are part of a diff3_block.  */
 
-static struct diff3_block *
-using_to_diff3_block (struct diff_block *using[2],
+static bool
+using_to_diff3_block (struct diff3_block *result,
+		      struct diff_block *using[2],
 		      struct diff_block *last_using[2],
 		      int low_thread, int high_thread,
 		      struct diff3_block const *last_diff3)
 {
   lin low[2], high[2];
-  struct diff3_block *result;
   struct diff_block *ptr;
   int d;
   lin i;
@@ -732,11 +973,11 @@ using_to_diff3_block (struct diff_block *using[2],
 	high[d] = D_HIGH_MAPLINE (last_diff3, FILEC, FILE0 + d, highc);
       }
 
-  /* Create a block with the appropriate sizes */
-  result = create_diff3_block (low[0], high[0], low[1], high[1], lowc, highc);
+  /* Set up a block with the appropriate sizes */
+  init_diff3_block (result, low[0], high[0], low[1], high[1], lowc, highc);
 
   /* Copy information for the common file.
-     Return with a zero if any of the compares failed.  */
+     Return false if any of the compares failed.  */
 
   for (d = 0; d < 2; d++)
     for (ptr = using[d]; ptr; ptr = D_NEXT (ptr))
@@ -744,11 +985,9 @@ using_to_diff3_block (struct diff_block *using[2],
 	lin result_offset = D_LOWLINE (ptr, FC) - lowc;
 
 	if (!copy_stringlist (D_LINEARRAY (ptr, FC),
-			      D_LENARRAY (ptr, FC),
 			      D_LINEARRAY (result, FILEC) + result_offset,
-			      D_LENARRAY (result, FILEC) + result_offset,
 			      D_NUMLINES (ptr, FC)))
-	  return 0;
+	  return false;
       }
 
   /* Copy information for file d.  First deal with anything that might be
@@ -762,10 +1001,7 @@ using_to_diff3_block (struct diff_block *using[2],
       for (i = 0;
 	   i + lo < (u ? D_LOWLINE (u, FO) : hi + 1);
 	   i++)
-	{
-	  D_RELNUM (result, FILE0 + d, i) = D_RELNUM (result, FILEC, i);
-	  D_RELLEN (result, FILE0 + d, i) = D_RELLEN (result, FILEC, i);
-	}
+	D_RELNUM (result, FILE0 + d, i) = D_RELNUM (result, FILEC, i);
 
       for (ptr = u; ptr; ptr = D_NEXT (ptr))
 	{
@@ -773,22 +1009,16 @@ using_to_diff3_block (struct diff_block *using[2],
 	  lin linec;
 
 	  if (!copy_stringlist (D_LINEARRAY (ptr, FO),
-				D_LENARRAY (ptr, FO),
 				D_LINEARRAY (result, FILE0 + d) + result_offset,
-				D_LENARRAY (result, FILE0 + d) + result_offset,
 				D_NUMLINES (ptr, FO)))
-	    return 0;
+	    return false;
 
 	  /* Catch the lines between here and the next diff */
 	  linec = D_HIGHLINE (ptr, FC) + 1 - lowc;
 	  for (i = D_HIGHLINE (ptr, FO) + 1 - lo;
 	       i < (D_NEXT (ptr) ? D_LOWLINE (D_NEXT (ptr), FO) : hi + 1) - lo;
 	       i++)
-	    {
-	      D_RELNUM (result, FILE0 + d, i) = D_RELNUM (result, FILEC, linec);
-	      D_RELLEN (result, FILE0 + d, i) = D_RELLEN (result, FILEC, linec);
-	      linec++;
-	    }
+	    D_RELNUM (result, FILE0 + d, i) = D_RELNUM (result, FILEC, linec++);
 	}
     }
 
@@ -804,66 +1034,102 @@ using_to_diff3_block (struct diff_block *using[2],
 
       if (nl0 != nl1
 	  || !compare_line_list (D_LINEARRAY (result, FILE0),
-				 D_LENARRAY (result, FILE0),
 				 D_LINEARRAY (result, FILE1),
-				 D_LENARRAY (result, FILE1),
 				 nl0))
 	D3_TYPE (result) = DIFF_ALL;
       else
 	D3_TYPE (result) = DIFF_3RD;
     }
 
-  return result;
+  return true;
 }
 
-/* Copy pointers from a list of strings to a different list of
-   strings.  If a spot in the second list is already filled, make sure
-   that it is filled with the same string; if not, return false, the copy
-   incomplete.  Upon successful completion of the copy, return true.  */
+/* Return true if the lines LINE1 and LINE2 have the same text.  */
 
 static bool
-copy_stringlist (char * const fromptrs[], size_t const fromlengths[],
-		 char *toptrs[], size_t tolengths[],
-		 lin copynum)
+same_line (char const *const *line1, char const *const *line2)
 {
-  register char * const *f = fromptrs;
-  register char **t = toptrs;
-  register size_t const *fl = fromlengths;
-  register size_t *tl = tolengths;
+  size_t length = LINE_LENGTH (line1);
 
-  while (copynum--)
-    {
-      if (*t)
-	{
-	  if (*fl != *tl || memcmp (*f, *t, *fl) != 0)
-	    return false;
-	}
-      else
-	{
-	  *t = *f;
-	  *tl = *fl;
-	}
+  /* The two diffs often point at the same copy of the common file's
+     text.  */
+  return (length == LINE_LENGTH (line2)
+	  && (LINE_TEXT (line1) == LINE_TEXT (line2)
+	      || memcmp (LINE_TEXT (line1), LINE_TEXT (line2), length) == 0));
+}
+
+/* Copy the COPYNUM lines of a two way diff whose starts are at
+   FROMLINES to the lines of a three way diff at TOLINES.  If a spot
+   in the second list is already filled, make sure that it is filled
+   with the same line; if not, return false, the copy incomplete.
+   Upon successful completion of the copy, return true.  */
 
-      t++; f++; tl++; fl++;
+static bool
+copy_stringlist (char const *const fromlines[],
+		 char const *const *tolines[], lin copynum)
+{
+  char const *const *f = fromlines;
+  char const *const **t = tolines;
+
+  for (; copynum--; t++, f++)
+    {
+      if (! *t)
+	*t = f;
+      else if (! same_line (*t, f))
+	return false;
     }
 
   return true;
 }
 
-/* Create a diff3_block, with ranges as specified in the arguments.
-   Allocate the arrays for the various pointers (and zero them) based
-   on the arguments passed.  Return the block as a result.  */
+/* The line tables of diff3 blocks live until diff3 exits, so they
+   are carved out of chunks of TABLE_CHUNK_LINES lines rather than
+   allocated one by one.  TABLE_PTR and TABLE_LIM delimit the unused
+   part of the current chunk.  */
 
-static struct diff3_block *
-create_diff3_block (lin low0, lin high0,
-		    lin low1, lin high1,
-		    lin low2, lin high2)
+enum { TABLE_CHUNK_LINES = 64 * 1024 };
+
+static char const *const **table_ptr;
+static char const *const **table_lim;
+
+/* Return a zeroed table of N lines.  Give a table too big to share a
+   chunk its own allocation.  */
+
+static char const *const **
+alloc_line_table (size_t n)
+{
+  char const *const **p;
+
+  if ((size_t) (table_lim - table_ptr) < n)
+    {
+      if (TABLE_CHUNK_LINES / 4 < n)
+	return xcalloc (n, sizeof *p);
+      table_ptr = xnmalloc (TABLE_CHUNK_LINES, sizeof *table_ptr);
+      table_lim = table_ptr + TABLE_CHUNK_LINES;
+    }
+
+  p = table_ptr;
+  table_ptr += n;
+  memset (p, 0, n * sizeof *p);
+  return p;
+}
+
+/* Set up the diff3_block RESULT, with ranges as specified in the
+   arguments.  Allocate the arrays for the lines (and zero them)
+   based on the arguments passed, carving the three files' arrays out
+   of one table.  */
+
+static void
+init_diff3_block (struct diff3_block *result,
+		  lin low0, lin high0,
+		  lin low1, lin high1,
+		  lin low2, lin high2)
 {
-  struct diff3_block *result = xmalloc (sizeof *result);
-  lin numlines;
+  lin numlines = 0;
+  char const *const **lines = 0;
+  int f;
 
   D3_TYPE (result) = ERROR;
-  D_NEXT (result) = 0;
 
   /* Assign ranges */
   D_LOWLINE (result, FILE0) = low0;
@@ -874,93 +1140,366 @@ create_diff3_block (lin low0, lin high0,
   D_HIGHLINE (result, FILE2) = high2;
 
   /* Allocate and zero space */
-  numlines = D_NUMLINES (result, FILE0);
+  for (f = FILE0; f <= FILE2; f++)
+    numlines += D_NUMLINES (result, f);
   if (numlines)
     {
-      D_LINEARRAY (result, FILE0) = xcalloc (numlines, sizeof (char *));
-      D_LENARRAY (result, FILE0) = xcalloc (numlines, sizeof (size_t));
-    }
-  else
-    {
-      D_LINEARRAY (result, FILE0) = 0;
-      D_LENARRAY (result, FILE0) = 0;
+      if (SIZE_MAX / sizeof *lines < numlines)
+	xalloc_die ();
+      lines = alloc_line_table (numlines);
     }
 
-  numlines = D_NUMLINES (result, FILE1);
-  if (numlines)
+  for (f = FILE0; f <= FILE2; f++)
+    if (D_NUMLINES (result, f))
+      {
+	D_LINEARRAY (result, f) = lines;
+	lines += D_NUMLINES (result, f);
+      }
+    else
+      D_LINEARRAY (result, f) = 0;
+}
+
+/* Compare two lists of lines of text.
+   Return 1 if they are equivalent, 0 if not.  */
+
+static bool
+compare_line_list (char const *const *const list1[],
+		   char const *const *const list2[], lin nl)
+{
+  char const *const *const *l1 = list1;
+  char const *const *const *l2 = list2;
+
+  for (; nl--; l1++, l2++)
+    if (!*l1 || !*l2 || !same_line (*l1, *l2))
+      return false;
+  return true;
+}
+
+/* Return a list of blocks for the list of hunks HUNK that the engine
+   found, whose line numbers are OFFSET less than those of the files,
+   storing its last block into *LAST_BLOCK.  Free the hunks if OWNED.  */
+
+static struct diff_block *
+hunk_blocks (struct engine_hunk *hunk, lin offset, bool owned,
+	     struct diff_block **last_block)
+{
+  struct diff_block *block_list;
+  struct diff_block **block_list_end = &block_list;
+  struct diff_block *bptr IF_LINT (= NULL);
+
+  while (hunk)
     {
-      D_LINEARRAY (result, FILE1) = xcalloc (numlines, sizeof (char *));
-      D_LENARRAY (result, FILE1) = xcalloc (numlines, sizeof (size_t));
+      struct engine_hunk *next = hunk->next;
+      int f;
+
+      bptr = xmalloc (sizeof *bptr);
+      for (f = 0; f < 2; f++)
+	{
+	  lin n = hunk->last[f] - hunk->first[f] + 1;
+	  bptr->ranges[f][RANGE_START] = hunk->first[f] + offset;
+	  bptr->ranges[f][RANGE_END] = hunk->last[f] + offset;
+	  bptr->lines[f] = hunk->linbuf[f];
+
+	  /* As when reading diff's output, count the newline that an
+	     incomplete last line lacks if an edit script is being
+	     generated, since edit scripts cannot handle missing
+	     newlines, and say so.  */
+	  if (n && edscript && bptr->lines[f][n][-1] != '\n')
+	    {
+	      fprintf (stderr, "%s: %s\n", program_name,
+		       _("No newline at end of file"));
+	      bptr->lines[f][n]++;
+	    }
+	}
+      if (owned)
+	free (hunk);
+      hunk = next;
+
+      *block_list_end = bptr;
+      block_list_end = &bptr->next;
     }
-  else
+
+  *block_list_end = NULL;
+  *last_block = bptr;
+  return block_list;
+}
+
+/* Compare FILEA to FILEB with diff's engine, and return the two way
+   diff as a list of blocks, storing its last block into *LAST_BLOCK.  */
+
+static struct diff_block *
+engine_diff (char const *filea,
+	     char const *fileb,
+	     struct diff_block **last_block)
+{
+  struct engine_hunk *hunk;
+
+  if (engine_compare (filea, fileb, &hunk) < 0)
     {
-      D_LINEARRAY (result, FILE1) = 0;
-      D_LENARRAY (result, FILE1) = 0;
+      fprintf (stderr, _("%s: diff failed: "), program_name);
+      fprintf (stderr, _("Binary files %s and %s differ\n"), filea, fileb);
+      exit (EXIT_TROUBLE);
     }
 
-  numlines = D_NUMLINES (result, FILE2);
-  if (numlines)
+  return hunk_blocks (hunk, 0, true, last_block);
+}
+
+/* Compare the middle of file F, which is FILE0 or FILE1, to that of
+   FILEC, and return the two way diff of the whole files as a list of
+   blocks, storing its last block into *LAST_BLOCK.  */
+
+static struct diff_block *
+middle_diff (struct middles const *m, int f, struct diff_block **last_block)
+{
+  struct engine_hunk *hunk;
+
+  engine_compare_text (m->context[f], m->text[f], m->size[f],
+		       m->common[f], m->size[FILEC], &hunk);
+  return hunk_blocks (hunk, m->offset, false, last_block);
+}
+
+/* Compare FILEA to FILEB, and return the two way diff as a list of
+   blocks, storing its last block into *LAST_BLOCK.  */
+
+static struct diff_block *
+process_diff (char const *filea,
+	      char const *fileb,
+	      struct diff_block **last_block)
+{
+  struct diff_child child;
+
+  if (! diff_program)
+    return engine_diff (filea, fileb, last_block);
+
+  start_diff (filea, fileb, &child);
+  return finish_child (&child, last_block);
+}
+
+/* Return true if the files named A and B are known to have the same
+   contents: if they are the same regular file, or regular files of
+   the same size whose bytes are the same.  Files that cannot be read
+   are not known to be the same, and are left for diff to report, and
+   standard input is not read here, as it can be read only once.  */
+
+static bool
+same_contents (char const *a, char const *b)
+{
+  enum { CHUNK = 64 * 1024 };
+  struct stat st[2];
+  int fd[2];
+  char *buf;
+  size_t n0, n1;
+  bool same;
+
+  if (STREQ (a, "-") || STREQ (b, "-")
+      || stat (a, &st[0]) != 0 || stat (b, &st[1]) != 0
+      || ! S_ISREG (st[0].st_mode) || ! S_ISREG (st[1].st_mode)
+      || st[0].st_size != st[1].st_size)
+    return false;
+  if (0 < same_file (&st[0], &st[1])
+      && same_file_attributes (&st[0], &st[1]))
+    return true;
+
+  fd[0] = open (a, O_RDONLY | O_BINARY);
+  if (fd[0] < 0)
+    return false;
+  fd[1] = open (b, O_RDONLY | O_BINARY);
+  if (fd[1] < 0)
     {
-      D_LINEARRAY (result, FILE2) = xcalloc (numlines, sizeof (char *));
-      D_LENARRAY (result, FILE2) = xcalloc (numlines, sizeof (size_t));
+      close (fd[0]);
+      return false;
     }
-  else
+
+  buf = xmalloc (2 * CHUNK);
+  do
     {
-      D_LINEARRAY (result, FILE2) = 0;
-      D_LENARRAY (result, FILE2) = 0;
+      n0 = block_read (fd[0], buf, CHUNK);
+      n1 = block_read (fd[1], buf + CHUNK, CHUNK);
+      same = (n0 == n1 && n0 != SIZE_MAX
+	      && memcmp (buf, buf + CHUNK, n0) == 0);
     }
+  while (same && n0 == CHUNK);
 
-  /* Return */
-  return result;
+  free (buf);
+  close (fd[0]);
+  close (fd[1]);
+  return same;
 }
 
-/* Compare two lists of lines of text.
-   Return 1 if they are equivalent, 0 if not.  */
+/* Find the lines at the start and at the end that the files NAME[FILE0],
+   NAME[FILE1] and NAME[FILEC] all have in common, and if trimming them
+   pays, read what is between them into *M and return true.  Keep
+   HORIZON_LINES of the common lines on either side of the middles, so
+   that the engine finds the hunks it would find in the whole files.
+   Return false if a file is standard input or not a regular file, or
+   cannot be read, or if a null byte is seen without -a, leaving such
+   files to be compared whole.  */
 
 static bool
-compare_line_list (char * const list1[], size_t const lengths1[],
-		   char * const list2[], size_t const lengths2[],
-		   lin nl)
+trim_common_ends (char const *const name[3], struct middles *m)
 {
-  char * const *l1 = list1;
-  char * const *l2 = list2;
-  size_t const *lgths1 = lengths1;
-  size_t const *lgths2 = lengths2;
-
-  while (nl--)
-    if (!*l1 || !*l2 || *lgths1 != *lgths2++
-	|| memcmp (*l1++, *l2++, *lgths1++) != 0)
-      return false;
-  return true;
+  enum { CHUNK = 64 * 1024 };
+  struct stat st;
+  off_t size[3];
+  int fd[3];
+  int f, nopen;
+  char *buf = NULL;
+  off_t lim, done;
+  off_t prefix = 0, prefix_limit = 0, suffix = 0;
+  off_t end[HORIZON_LINES + 1];
+  lin newlines;
+  bool trimmed = false;
+
+  for (f = 0; f < 3; f++)
+    {
+      if (STREQ (name[f], "-") || stat (name[f], &st) != 0
+	  || ! S_ISREG (st.st_mode))
+	return false;
+      size[f] = st.st_size;
+    }
+  if (size[FILEC] < TRIM_MINIMUM)
+    return false;
+
+  for (nopen = 0; nopen < 3; nopen++)
+    if ((fd[nopen] = open (name[nopen], O_RDONLY | O_BINARY)) < 0)
+      goto done;
+  buf = xmalloc (3 * CHUNK);
+  lim = MIN (size[0], MIN (size[1], size[2]));
+
+  /* Find the common prefix, remembering the offsets just past its last
+     HORIZON_LINES + 1 newlines.  */
+  newlines = 0;
+  for (done = 0; done < lim; )
+    {
+      size_t n = MIN (CHUNK, lim - done);
+      size_t k;
+      for (f = 0; f < 3; f++)
+	if (block_read (fd[f], buf + f * CHUNK, n) != n)
+	  goto done;
+      for (k = 0; k < n; k++)
+	{
+	  char c = buf[k];
+	  if (c != buf[CHUNK + k] || c != buf[2 * CHUNK + k])
+	    break;
+	  if (c == '\n')
+	    end[newlines++ % (HORIZON_LINES + 1)] = done + k + 1;
+	  else if (! c && ! text)
+	    goto done;
+	}
+      done += k;
+      if (k < n)
+	break;
+    }
+  if (newlines)
+    prefix_limit = end[(newlines - 1) % (HORIZON_LINES + 1)];
+  m->offset = 0;
+  if (HORIZON_LINES < newlines)
+    {
+      m->offset = newlines - HORIZON_LINES;
+      prefix = end[(m->offset - 1) % (HORIZON_LINES + 1)];
+    }
+
+  /* Likewise find the common suffix that does not overlap the prefix,
+     remembering how far from the ends of the files the lines after
+     its first HORIZON_LINES + 1 newlines start.  */
+  newlines = 0;
+  for (done = 0; done < lim - prefix_limit; )
+    {
+      size_t n = MIN (CHUNK, lim - prefix_limit - done);
+      size_t k;
+      for (f = 0; f < 3; f++)
+	if (lseek (fd[f], size[f] - done - n, SEEK_SET) < 0
+	    || block_read (fd[f], buf + f * CHUNK, n) != n)
+	  goto done;
+      for (k = 0; k < n; k++)
+	{
+	  size_t i = n - 1 - k;
+	  char c = buf[i];
+	  if (c != buf[CHUNK + i] || c != buf[2 * CHUNK + i])
+	    break;
+	  if (c == '\n')
+	    end[newlines++ % (HORIZON_LINES + 1)] = done + k;
+	  else if (! c && ! text)
+	    goto done;
+	}
+      done += k;
+      if (k < n)
+	break;
+    }
+  if (HORIZON_LINES < newlines)
+    suffix = end[(newlines - HORIZON_LINES - 1) % (HORIZON_LINES + 1)];
+
+  if ((prefix + suffix) * 2 < size[FILEC])
+    goto done;
+
+  for (f = 0; f < 3; f++)
+    {
+      size_t n = size[f] - prefix - suffix;
+      m->size[f] = n;
+      m->text[f] = xmalloc (n + ENGINE_TEXT_ROOM);
+      if (lseek (fd[f], prefix, SEEK_SET) < 0
+	  || block_read (fd[f], m->text[f], n) != n
+	  || (! text && memchr (m->text[f], 0, n)))
+	{
+	  do
+	    free (m->text[f]);
+	  while (f--);
+	  goto done;
+	}
+    }
+  m->common[FILE1] = m->text[FILEC];
+  m->common[FILE0] = xmalloc (m->size[FILEC] + ENGINE_TEXT_ROOM);
+  memcpy (m->common[FILE0], m->text[FILEC], m->size[FILEC]);
+  trimmed = true;
+
+ done:
+  free (buf);
+  while (nopen--)
+    close (fd[nopen]);
+  return trimmed;
 }
-
-/* Input and parse two way diffs.  */
+
+/* Return a copy of the list of blocks THREAD, whose lines it shares,
+   for make_3way_diff to take apart along with THREAD.  */
 
 static struct diff_block *
-process_diff (char const *filea,
-	      char const *fileb,
-	      struct diff_block **last_block)
+copy_diff_blocks (struct diff_block const *thread)
 {
-  char *diff_contents;
-  char *diff_limit;
-  char *scan_diff;
+  struct diff_block *copy = NULL;
+  struct diff_block **end = &copy;
+
+  for (; thread; thread = thread->next)
+    {
+      *end = xmemdup (thread, sizeof *thread);
+      end = &(*end)->next;
+    }
+  *end = NULL;
+  return copy;
+}
+
+/* Parse the two way diff in normal format from DIFF_CONTENTS up to
+   DIFF_LIMIT, which must end in a newline, and append its blocks to
+   the list whose end *BLOCK_LIST_END points at, advancing
+   *BLOCK_LIST_END past them.  Store the last block appended, if any,
+   into *LAST_BLOCK.  */
+
+static void
+parse_diff (char *diff_contents,
+	    char *diff_limit,
+	    struct diff_block ***block_list_end,
+	    struct diff_block **last_block)
+{
+  char *scan_diff = diff_contents;
   enum diff_type dt;
   lin i;
-  struct diff_block *block_list;
-  struct diff_block **block_list_end = &block_list;
-  struct diff_block *bptr IF_LINT (= NULL);
-  size_t too_many_lines = (PTRDIFF_MAX
-			   / MIN (sizeof *bptr->lines[1],
-				  sizeof *bptr->lengths[1]));
-
-  diff_limit = read_diff (filea, fileb, &diff_contents);
-  scan_diff = diff_contents;
+  struct diff_block **end = *block_list_end;
+  struct diff_block *bptr;
+  size_t too_many_lines = PTRDIFF_MAX / sizeof *bptr->lines[1];
 
   while (scan_diff < diff_limit)
     {
       bptr = xmalloc (sizeof *bptr);
       bptr->lines[0] = bptr->lines[1] = 0;
-      bptr->lengths[0] = bptr->lengths[1] = 0;
 
       dt = process_diff_control (&scan_diff, bptr);
       if (dt == ERROR || *scan_diff != '\n')
@@ -992,20 +1531,22 @@ process_diff (char const *filea,
 	}
 
       /* Allocate space for the pointers for the lines from filea, and
-	 parcel them out among these pointers */
+	 parcel them out among these pointers, with one more for the
+	 end of the last */
       if (dt != ADD)
 	{
 	  lin numlines = D_NUMLINES (bptr, 0);
+	  char *text_end = scan_diff;
 	  if (too_many_lines <= numlines)
 	    xalloc_die ();
-	  bptr->lines[0] = xmalloc (numlines * sizeof *bptr->lines[0]);
-	  bptr->lengths[0] = xmalloc (numlines * sizeof *bptr->lengths[0]);
+	  bptr->lines[0] = xnmalloc (numlines + 1, sizeof *bptr->lines[0]);
 	  for (i = 0; i < numlines; i++)
-	    scan_diff = scan_diff_line (scan_diff,
-					&(bptr->lines[0][i]),
-					&(bptr->lengths[0][i]),
-					diff_limit,
-					'<');
+	    {
+	      bptr->lines[0][i] = text_end;
+	      scan_diff = scan_diff_line (scan_diff, &text_end, diff_limit,
+					  '<');
+	    }
+	  bptr->lines[0][numlines] = text_end;
 	}
 
       /* Get past the separator for changes */
@@ -1016,31 +1557,31 @@ process_diff (char const *filea,
 	  scan_diff += 4;
 	}
 
-      /* Allocate space for the pointers for the lines from fileb, and
-	 parcel them out among these pointers */
+      /* Likewise for the lines from fileb */
       if (dt != DELETE)
 	{
 	  lin numlines = D_NUMLINES (bptr, 1);
+	  char *text_end = scan_diff;
 	  if (too_many_lines <= numlines)
 	    xalloc_die ();
-	  bptr->lines[1] = xmalloc (numlines * sizeof *bptr->lines[1]);
-	  bptr->lengths[1] = xmalloc (numlines * sizeof *bptr->lengths[1]);
+	  bptr->lines[1] = xnmalloc (numlines + 1, sizeof *bptr->lines[1]);
 	  for (i = 0; i < numlines; i++)
-	    scan_diff = scan_diff_line (scan_diff,
-					&(bptr->lines[1][i]),
-					&(bptr->lengths[1][i]),
-					diff_limit,
-					'>');
+	    {
+	      bptr->lines[1][i] = text_end;
+	      scan_diff = scan_diff_line (scan_diff, &text_end, diff_limit,
+					  '>');
+	    }
+	  bptr->lines[1][numlines] = text_end;
 	}
 
       /* Place this block on the blocklist.  */
-      *block_list_end = bptr;
-      block_list_end = &bptr->next;
+      *end = bptr;
+      end = &bptr->next;
+      *last_block = bptr;
     }
 
-  *block_list_end = NULL;
-  *last_block = bptr;
-  return block_list;
+  *end = NULL;
+  *block_list_end = end;
 }
 
 /* Skip tabs and spaces, and return the first character after them.  */
@@ -1151,26 +1692,25 @@ process_diff_control (char **string, struct diff_block *db)
   return type;
 }
 
-static char *
-read_diff (char const *filea,
-	   char const *fileb,
-	   char **output_placement)
+/* Start running diff_program to compare FILEA to FILEB, and record
+   the child process in CHILD.  */
+
+static void
+start_diff (char const *filea,
+	    char const *fileb,
+	    struct diff_child *child)
 {
-  char *diff_result;
-  size_t current_chunk_size, total;
-  int fd, wstatus, status;
-  int werrno = 0;
-  struct stat pipestat;
   char const *argv[9];
   char const **ap;
 #if HAVE_WORKING_FORK
   int fds[2];
-  pid_t pid;
 #else
-  FILE *fpipe;
   char *command;
 #endif
 
+  child->filea = filea;
+  child->fileb = fileb;
+
   ap = argv;
   *ap++ = diff_program;
   if (text)
@@ -1188,8 +1728,8 @@ read_diff (char const *filea,
   if (pipe (fds) != 0)
     perror_with_exit ("pipe");
 
-  pid = fork ();
-  if (pid == 0)
+  child->pid = fork ();
+  if (child->pid == 0)
     {
       /* Child */
       close (fds[0]);
@@ -1206,34 +1746,206 @@ read_diff (char const *filea,
       _exit (errno == ENOENT ? 127 : 126);
     }
 
-  if (pid == -1)
+  if (child->pid == -1)
     perror_with_exit ("fork");
 
   close (fds[1]);		/* Prevent erroneous lack of EOF */
-  fd = fds[0];
+  child->fd = fds[0];
+  PROBE3 (diff_child, filea, fileb, child->pid);
 
 #else
 
   command = system_quote_argv (SCI_SYSTEM, (char **) argv);
   errno = 0;
-  fpipe = popen (command, "r");
-  if (!fpipe)
+  child->fpipe = popen (command, "r");
+  if (!child->fpipe)
     perror_with_exit (command);
   free (command);
-  fd = fileno (fpipe);
+  child->fd = fileno (child->fpipe);
+
+#endif
+}
+
+#if HAVE_WORKING_FORK
+
+/* Output the list of hunks HUNK to OUT in normal format, as diff
+   would.  */
+
+static void
+print_hunks (FILE *out, struct engine_hunk const *hunk)
+{
+  for (; hunk; hunk = hunk->next)
+    {
+      int f;
+      lin i;
+
+      for (f = 0; f < 2; f++)
+	{
+	  long int first = hunk->first[f];
+	  long int last = hunk->last[f];
+	  if (f)
+	    putc (hunk->first[0] > hunk->last[0] ? 'a'
+		  : hunk->first[1] > hunk->last[1] ? 'd' : 'c',
+		  out);
+	  if (first < last)
+	    fprintf (out, "%ld,%ld", first, last);
+	  else
+	    fprintf (out, "%ld", last);
+	}
+      putc ('\n', out);
+
+      for (f = 0; f < 2; f++)
+	{
+	  lin n = hunk->last[f] - hunk->first[f] + 1;
+	  if (f && 0 < n && hunk->first[0] <= hunk->last[0])
+	    fputs ("---\n", out);
+	  for (i = 0; i < n; i++)
+	    {
+	      char const *line = hunk->linbuf[f][i];
+	      size_t length = hunk->linbuf[f][i + 1] - line;
+	      fputs (f ? "> " : "< ", out);
+	      fwrite (line, 1, length, out);
+	      if (line[length - 1] != '\n')
+		fprintf (out, "\n\\ %s\n", _("No newline at end of file"));
+	    }
+	}
+    }
+}
+
+/* Start comparing FILEA to FILEB with diff's engine in a child
+   process, which outputs the two way diff in normal format, and
+   record the child in CHILD.  */
+
+static void
+start_engine_diff (char const *filea,
+		   char const *fileb,
+		   struct diff_child *child)
+{
+  int fds[2];
+
+  child->filea = filea;
+  child->fileb = fileb;
+
+  if (pipe (fds) != 0)
+    perror_with_exit ("pipe");
+
+  child->pid = fork ();
+  if (child->pid == 0)
+    {
+      /* Child.  If it fails, the parent compares the files itself,
+	 and reports any error then, so say nothing here.  */
+      struct engine_hunk *hunks;
+      FILE *out;
+      int null = open (NULL_DEVICE, O_WRONLY);
+      if (0 <= null)
+	dup2 (null, STDERR_FILENO);
+      close (fds[0]);
+      out = fdopen (fds[1], "w");
+      if (! out)
+	_exit (EXIT_TROUBLE);
+      if (engine_compare (filea, fileb, &hunks) < 0)
+	fprintf (out, _("Binary files %s and %s differ\n"), filea, fileb);
+      else
+	print_hunks (out, hunks);
+      _exit (fclose (out) == 0 ? EXIT_SUCCESS : EXIT_TROUBLE);
+    }
+
+  if (child->pid == -1)
+    perror_with_exit ("fork");
+
+  close (fds[1]);
+  child->fd = fds[0];
+  PROBE3 (diff_child, filea, fileb, child->pid);
+}
+
+/* Return the size of the file named NAME, or 0 if it is not a regular
+   file.  */
+
+static off_t
+file_size (char const *name)
+{
+  struct stat st;
+  int r = (STREQ (name, "-")
+	   ? fstat (STDIN_FILENO, &st)
+	   : stat (name, &st));
+  return r == 0 && S_ISREG (st.st_mode) ? st.st_size : 0;
+}
 
 #endif
 
-  if (fstat (fd, &pipestat) != 0)
+/* Start comparing FILEA to FILEB in a child process, so that the
+   comparison runs while the parent compares the other pair of files,
+   and record the child in CHILD.  Return false, starting nothing, if
+   that would not pay.  */
+
+static bool
+start_child (char const *filea,
+	     char const *fileb,
+	     struct diff_child *child)
+{
+  if (diff_program)
+    {
+      start_diff (filea, fileb, child);
+      return true;
+    }
+
+#if HAVE_WORKING_FORK
+  if (CHILD_ENGINE_MINIMUM <= file_size (filea) + file_size (fileb))
+    {
+      start_engine_diff (filea, fileb, child);
+      return true;
+    }
+#endif
+
+  return false;
+}
+
+/* Return the start of the last line in the bytes from START up to
+   LIMIT that begins a block of a diff in normal format, or START if
+   there is none.  Only such lines begin with a digit.  */
+
+static char *
+last_block_start (char *start, char *limit)
+{
+  char *p = limit;
+
+  while (start < p)
+    if (ISDIGIT (*--p) && (p == start || p[-1] == '\n'))
+      return p;
+  return start;
+}
+
+/* Read all the output of CHILD, a two way diff in normal format, a
+   chunk at a time, and as each chunk fills up, parse the blocks that
+   it holds completely, so that parsing overlaps the child's work and
+   the output is never copied wholesale.  Append the blocks to the
+   list whose end *BLOCK_LIST_END points at, as parse_diff does.
+   Store the address of the unparsed rest of the output, which the
+   caller should parse once it knows that CHILD succeeded, into
+   *OUTPUT_PLACEMENT, and return the address just past it.  */
+
+static char *
+read_child (struct diff_child const *child, char **output_placement,
+	    struct diff_block ***block_list_end,
+	    struct diff_block **last_block)
+{
+  char *chunk;
+  size_t chunk_size, total;
+  struct stat pipestat;
+
+  if (fstat (child->fd, &pipestat) != 0)
     perror_with_exit ("fstat");
-  current_chunk_size = MAX (1, STAT_BLOCKSIZE (pipestat));
-  diff_result = xmalloc (current_chunk_size);
+  chunk_size = MAX (1, STAT_BLOCKSIZE (pipestat));
+  chunk = xmalloc (chunk_size);
   total = 0;
 
   for (;;)
     {
-      size_t bytes_to_read = current_chunk_size - total;
-      size_t bytes = block_read (fd, diff_result + total, bytes_to_read);
+      size_t bytes_to_read = chunk_size - total;
+      size_t bytes = block_read (child->fd, chunk + total, bytes_to_read);
+      char *rest;
+      size_t rest_size;
+
       total += bytes;
       if (bytes != bytes_to_read)
 	{
@@ -1241,28 +1953,69 @@ read_diff (char const *filea,
 	    perror_with_exit (_("read failed"));
 	  break;
 	}
-      if (PTRDIFF_MAX / 2 <= current_chunk_size)
+
+      rest = last_block_start (chunk, chunk + total);
+      rest_size = chunk + total - rest;
+      if (PTRDIFF_MAX / 2 <= chunk_size)
 	xalloc_die ();
-      current_chunk_size *= 2;
-      diff_result = xrealloc (diff_result, current_chunk_size);
+
+      if (rest == chunk)
+	{
+	  /* The chunk holds part of a single block.  Grow it.  */
+	  chunk_size *= 2;
+	  chunk = xrealloc (chunk, chunk_size);
+	}
+      else
+	{
+	  /* Parse the blocks before REST, which stay where they are,
+	     and carry REST over into a new chunk.  Make the chunk
+	     larger, up to a point, to save reads, and at least twice
+	     the size of REST, so that carrying takes linear time.  */
+	  char *next;
+	  parse_diff (chunk, rest, block_list_end, last_block);
+	  if (chunk_size < CHUNK_SIZE_MAXIMUM)
+	    chunk_size *= 2;
+	  chunk_size = MAX (chunk_size, 2 * rest_size);
+	  next = xmalloc (chunk_size);
+	  memcpy (next, rest, rest_size);
+	  chunk = next;
+	  total = rest_size;
+	}
     }
 
-  if (total != 0 && diff_result[total-1] != '\n')
+  if (total != 0 && chunk[total - 1] != '\n')
     fatal ("invalid diff format; incomplete last line");
 
-  *output_placement = diff_result;
+  *output_placement = chunk;
+  return chunk + total;
+}
+
+/* Wait for CHILD, which start_child started, and return the two way
+   diff that it output as a list of blocks, storing its last block
+   into *LAST_BLOCK.  */
+
+static struct diff_block *
+finish_child (struct diff_child *child, struct diff_block **last_block)
+{
+  struct diff_block *block_list = NULL;
+  struct diff_block **block_list_end = &block_list;
+  char *diff_contents;
+  char *diff_limit = read_child (child, &diff_contents, &block_list_end,
+				 last_block);
+  int wstatus, status;
+  int werrno = 0;
 
 #if ! HAVE_WORKING_FORK
 
-  wstatus = pclose (fpipe);
+  wstatus = pclose (child->fpipe);
   if (wstatus == -1)
     werrno = errno;
 
 #else
 
-  if (close (fd) != 0)
+  if (close (child->fd) != 0)
     perror_with_exit ("close");
-  if (waitpid (pid, &wstatus, 0) < 0)
+  if (waitpid (child->pid, &wstatus, 0) < 0)
     perror_with_exit ("waitpid");
 
 #endif
@@ -1270,51 +2023,70 @@ read_diff (char const *filea,
   status = ! werrno && WIFEXITED (wstatus) ? WEXITSTATUS (wstatus) : INT_MAX;
 
   if (EXIT_TROUBLE <= status)
-    error (EXIT_TROUBLE, werrno,
-	   _(status == 126
-	     ? "subsidiary program '%s' could not be invoked"
-	     : status == 127
-	     ? "subsidiary program '%s' not found"
-	     : status == INT_MAX
-	     ? "subsidiary program '%s' failed"
-	     : "subsidiary program '%s' failed (exit status %d)"),
-	   diff_program, status);
-
-  return diff_result + total;
+    {
+      /* A child running diff's engine has said nothing about why it
+	 failed, so find out by comparing the files here.  */
+      if (! diff_program)
+	{
+	  free (diff_contents);
+	  return engine_diff (child->filea, child->fileb, last_block);
+	}
+
+      error (EXIT_TROUBLE, werrno,
+	     _(status == 126
+	       ? "subsidiary program '%s' could not be invoked"
+	       : status == 127
+	       ? "subsidiary program '%s' not found"
+	       : status == INT_MAX
+	       ? "subsidiary program '%s' failed"
+	       : "subsidiary program '%s' failed (exit status %d)"),
+	     diff_program, status);
+    }
+
+  parse_diff (diff_contents, diff_limit, &block_list_end, last_block);
+  return block_list;
 }
 
 
 /* Scan a regular diff line (consisting of > or <, followed by a
    space, followed by text (including nulls) up to a newline.
+   Move the text back to *TEXT_END, the end of the text of the lines
+   scanned before it, so that the lines of a block lie next to each
+   other as the lines of a file do and need no table of lengths, and
+   advance *TEXT_END past it.
 
    This next routine began life as a macro and many parameters in it
    are used as call-by-reference values.  */
 static char *
-scan_diff_line (char *scan_ptr, char **set_start, size_t *set_length,
-		char *limit, char leadingchar)
+scan_diff_line (char *scan_ptr, char **text_end, char *limit,
+		char leadingchar)
 {
   char *line_ptr;
+  size_t length;
 
-  if (!(scan_ptr[0] == leadingchar
+  if (!(scan_ptr + 2 <= limit
+	&& scan_ptr[0] == leadingchar
 	&& scan_ptr[1] == ' '))
     fatal ("invalid diff format; incorrect leading line chars");
 
-  *set_start = line_ptr = scan_ptr + 2;
+  line_ptr = scan_ptr + 2;
   while (*line_ptr++ != '\n')
     continue;
+  length = line_ptr - (scan_ptr + 2);
+  memmove (*text_end, scan_ptr + 2, length);
 
   /* Include newline if the original line ended in a newline,
-     or if an edit script is being generated.
+     or if an edit script is being generated; the newline follows
+     the line in memory in any case.
      Copy any missing newline message to stderr if an edit script is being
      generated, because edit scripts cannot handle missing newlines.
      Return the beginning of the next line.  */
-  *set_length = line_ptr - *set_start;
   if (line_ptr < limit && *line_ptr == '\\')
     {
       if (edscript)
 	fprintf (stderr, "%s:", program_name);
       else
-	--*set_length;
+	length--;
       line_ptr++;
       do
 	{
@@ -1324,10 +2096,11 @@ scan_diff_line (char *scan_ptr, char **set_start, size_t *set_length,
       while (*line_ptr++ != '\n');
     }
 
+  *text_end += length;
   return line_ptr;
 }
 
-/* Output a three way diff passed as a list of diff3_block's.  The
+/* Output a three way diff passed as an array of NBLOCKS diff3_block's.  The
    argument MAPPING is indexed by external file number (in the
    argument list) and contains the internal file number (from the diff
    passed).  This is important because the user expects outputs in
@@ -1336,20 +2109,20 @@ scan_diff_line (char *scan_ptr, char **set_start, size_t *set_length,
    example).  REV_MAPPING is the inverse of MAPPING.  */
 
 static void
-output_diff3 (FILE *outputfile, struct diff3_block *diff,
+output_diff3 (FILE *outputfile, struct diff3_block const *diff, lin nblocks,
 	      int const mapping[3], int const rev_mapping[3])
 {
   int i;
   int oddoneout;
-  char *cp;
-  struct diff3_block *ptr;
+  char const *cp;
+  struct diff3_block const *ptr;
   lin line;
   size_t length;
   int dontprint;
   static int skew_increment[3] = { 2, 3, 1 }; /* 0==>2==>1==>3 */
   char const *line_prefix = initial_tab ? "\t" : "  ";
 
-  for (ptr = diff; ptr; ptr = D_NEXT (ptr))
+  for (ptr = diff; ptr < diff + nblocks; ptr++)
     {
       char x[2];
 
@@ -1406,8 +2179,8 @@ output_diff3 (FILE *outputfile, struct diff3_block *diff,
 	      do
 		{
 		  fputs (line_prefix, outputfile);
-		  cp = D_RELNUM (ptr, realfile, line);
-		  length = D_RELLEN (ptr, realfile, line);
+		  cp = LINE_TEXT (D_RELNUM (ptr, realfile, line));
+		  length = LINE_LENGTH (D_RELNUM (ptr, realfile, line));
 		  fwrite (cp, sizeof (char), length, outputfile);
 		}
 	      while (++line < hight - lowt + 1);
@@ -1420,27 +2193,53 @@ output_diff3 (FILE *outputfile, struct diff3_block *diff,
 }
 
 
+/* Output to OUTPUTFILE the lines of B taken from FILENUM.  Lines
+   that lie next to each other in memory, as the lines of a file that
+   the engine compared do, are output with a single call.  */
+
+static void
+output_lines (FILE *outputfile, struct diff3_block const *b, int filenum)
+{
+  lin n = D_NUMLINES (b, filenum);
+  lin i = 0;
+
+  while (i < n)
+    {
+      char const *start = LINE_TEXT (D_RELNUM (b, filenum, i));
+      char const *end = start + LINE_LENGTH (D_RELNUM (b, filenum, i));
+      for (i++; i < n && LINE_TEXT (D_RELNUM (b, filenum, i)) == end; i++)
+	end += LINE_LENGTH (D_RELNUM (b, filenum, i));
+      fwrite (start, sizeof (char), end - start, outputfile);
+    }
+}
+
 /* Output to OUTPUTFILE the lines of B taken from FILENUM.  Double any
-   initial '.'s; yield nonzero if any initial '.'s were doubled.  */
+   initial '.'s; yield nonzero if any initial '.'s were doubled.  Like
+   output_lines, output lines that lie next to each other in memory
+   with a single call, up to the next line that starts with '.'.  */
 
 static bool
-dotlines (FILE *outputfile, struct diff3_block *b, int filenum)
+dotlines (FILE *outputfile, struct diff3_block const *b, int filenum)
 {
-  lin i;
+  lin n = D_NUMLINES (b, filenum);
+  lin i = 0;
   bool leading_dot = false;
 
-  for (i = 0;
-       i < D_NUMLINES (b, filenum);
-       i++)
+  while (i < n)
     {
-      char *line = D_RELNUM (b, filenum, i);
-      if (line[0] == '.')
+      char const *start = LINE_TEXT (D_RELNUM (b, filenum, i));
+      char const *end = start + LINE_LENGTH (D_RELNUM (b, filenum, i));
+      if (start[0] == '.')
 	{
 	  leading_dot = true;
-	  fputc ('.', outputfile);
+	  putc ('.', outputfile);
 	}
-      fwrite (line, sizeof (char),
-	      D_RELLEN (b, filenum, i), outputfile);
+      for (i++;
+	   (i < n && LINE_TEXT (D_RELNUM (b, filenum, i)) == end
+	    && *end != '.');
+	   i++)
+	end += LINE_LENGTH (D_RELNUM (b, filenum, i));
+      fwrite (start, sizeof (char), end - start, outputfile);
     }
 
   return leading_dot;
@@ -1467,8 +2266,8 @@ undotlines (FILE *outputfile, bool leading_dot, long int start, lin num)
 /* Output a diff3 set of blocks as an ed script.  This script applies
    the changes between file's 2 & 3 to file 1.  Take the precise
    format of the ed script to be output from global variables set
-   during options processing.  Reverse the order of
-   the set of diff3 blocks in DIFF; this gets
+   during options processing.  Output the NBLOCKS diff3 blocks in
+   DIFF in reverse order; this gets
    around the problems involved with changing line numbers in an ed
    script.
 
@@ -1484,17 +2283,20 @@ undotlines (FILE *outputfile, bool leading_dot, long int start, lin num)
    Return 1 if conflicts were found.  */
 
 static bool
-output_diff3_edscript (FILE *outputfile, struct diff3_block *diff,
+output_diff3_edscript (FILE *outputfile, struct diff3_block const *diff,
+		       lin nblocks,
 		       int const mapping[3], int const rev_mapping[3],
 		       char const *file0, char const *file1, char const *file2)
 {
   bool leading_dot;
   bool conflicts_found = false;
   bool conflict;
-  struct diff3_block *b;
+  lin i;
 
-  for (b = reverse_diff3_blocklist (diff); b; b = b->next)
+  for (i = nblocks; 0 < i--; )
     {
+      struct diff3_block const *b = &diff[i];
+
       /* Must do mapping correctly.  */
       enum diff_type type
 	= (b->correspond == DIFF_ALL
@@ -1589,7 +2391,70 @@ output_diff3_edscript (FILE *outputfile, struct diff3_block *diff,
   return conflicts_found;
 }
 
-/* Read from INFILE and output to OUTPUTFILE a set of diff3_blocks
+/* The size of the buffer through which output_diff3_merge copies
+   its input.  */
+enum { MERGE_BUFSIZE = 64 * 1024 };
+
+/* The input of output_diff3_merge: the stream FILE, and the data in
+   the buffer BUF that has been read from it but not yet used, which
+   runs from PTR to LIM.  */
+
+struct merge_input
+{
+  FILE *file;
+  char *buf;
+  char *ptr;
+  char *lim;
+};
+
+/* Read more data into the buffer of IN, which must be empty.  Return
+   false at end of file.  */
+
+static bool
+fill_merge_input (struct merge_input *in)
+{
+  size_t n = fread (in->buf, sizeof (char), MERGE_BUFSIZE, in->file);
+  if (n == 0)
+    {
+      if (ferror (in->file))
+	perror_with_exit (_("read failed"));
+      return false;
+    }
+  in->ptr = in->buf;
+  in->lim = in->buf + n;
+  return true;
+}
+
+/* Copy the next NUM lines of IN to OUTPUTFILE, or skip them if
+   OUTPUTFILE is null.  Copy whole buffers' worth of lines at a time,
+   finding the ends of lines with memchr.  Return the number of lines
+   that were not found because the input ended; an incomplete last
+   line counts as not found.  */
+
+static lin
+copy_merge_lines (struct merge_input *in, lin num, FILE *outputfile)
+{
+  while (0 < num && (in->ptr < in->lim || fill_merge_input (in)))
+    {
+      char *p = in->ptr;
+      for (; 0 < num; num--)
+	{
+	  char *nl = memchr (p, '\n', in->lim - p);
+	  if (! nl)
+	    {
+	      p = in->lim;
+	      break;
+	    }
+	  p = nl + 1;
+	}
+      if (outputfile)
+	fwrite (in->ptr, sizeof (char), p - in->ptr, outputfile);
+      in->ptr = p;
+    }
+  return num;
+}
+
+/* Read from INFILE and output to OUTPUTFILE the NBLOCKS diff3_blocks in
    DIFF as a merged file.  This acts like 'ed file0
    <[output_diff3_edscript]', except that it works even for binary
    data or incomplete lines.
@@ -1601,18 +2466,23 @@ output_diff3_edscript (FILE *outputfile, struct diff3_block *diff,
    Return 1 if conflicts were found.  */
 
 static bool
-output_diff3_merge (FILE *infile, FILE *outputfile, struct diff3_block *diff,
+output_diff3_merge (FILE *infile, FILE *outputfile,
+		    struct diff3_block const *diff, lin nblocks,
 		    int const mapping[3], int const rev_mapping[3],
 		    char const *file0, char const *file1, char const *file2)
 {
-  int c;
   lin i;
   bool conflicts_found = false;
   bool conflict;
-  struct diff3_block *b;
+  struct diff3_block const *b;
   lin linesread = 0;
+  struct merge_input in;
 
-  for (b = diff; b; b = b->next)
+  in.file = infile;
+  in.buf = xmalloc (MERGE_BUFSIZE);
+  in.ptr = in.lim = in.buf;
+
+  for (b = diff; b < diff + nblocks; b++)
     {
       /* Must do mapping correctly.  */
       enum diff_type type
@@ -1635,20 +2505,8 @@ output_diff3_merge (FILE *infile, FILE *outputfile, struct diff3_block *diff,
       /* Copy I lines from file 0.  */
       i = D_LOWLINE (b, FILE0) - linesread - 1;
       linesread += i;
-      while (0 <= --i)
-	do
-	  {
-	    c = getc (infile);
-	    if (c == EOF)
-	      {
-		if (ferror (infile))
-		  perror_with_exit (_("read failed"));
-		else if (feof (infile))
-		  fatal ("input file shrank");
-	      }
-	    putc (c, outputfile);
-	  }
-	while (c != '\n');
+      if (0 < i && copy_merge_lines (&in, i, outputfile) != 0)
+	fatal ("input file shrank");
 
       if (conflict)
 	{
@@ -1658,33 +2516,21 @@ output_diff3_merge (FILE *infile, FILE *outputfile, struct diff3_block *diff,
 	    {
 	      /* Put in lines from FILE0 with bracket.  */
 	      fprintf (outputfile, "<<<<<<< %s\n", file0);
-	      for (i = 0;
-		   i < D_NUMLINES (b, mapping[FILE0]);
-		   i++)
-		fwrite (D_RELNUM (b, mapping[FILE0], i), sizeof (char),
-			D_RELLEN (b, mapping[FILE0], i), outputfile);
+	      output_lines (outputfile, b, mapping[FILE0]);
 	    }
 
 	  if (show_2nd)
 	    {
 	      /* Put in lines from FILE1 with bracket.  */
 	      fprintf (outputfile, format_2nd, file1);
-	      for (i = 0;
-		   i < D_NUMLINES (b, mapping[FILE1]);
-		   i++)
-		fwrite (D_RELNUM (b, mapping[FILE1], i), sizeof (char),
-			D_RELLEN (b, mapping[FILE1], i), outputfile);
+	      output_lines (outputfile, b, mapping[FILE1]);
 	    }
 
 	  fputs ("=======\n", outputfile);
 	}
 
       /* Put in lines from FILE2.  */
-      for (i = 0;
-	   i < D_NUMLINES (b, mapping[FILE2]);
-	   i++)
-	fwrite (D_RELNUM (b, mapping[FILE2], i), sizeof (char),
-		D_RELLEN (b, mapping[FILE2], i), outputfile);
+      output_lines (outputfile, b, mapping[FILE2]);
 
       if (conflict)
 	fprintf (outputfile, ">>>>>>> %s\n", file2);
@@ -1692,42 +2538,336 @@ output_diff3_merge (FILE *infile, FILE *outputfile, struct diff3_block *diff,
       /* Skip I lines in file 0.  */
       i = D_NUMLINES (b, FILE0);
       linesread += i;
-      while (0 <= --i)
-	while ((c = getc (infile)) != '\n')
-	  if (c == EOF)
-	    {
-	      if (ferror (infile))
-		perror_with_exit (_("read failed"));
-	      else if (feof (infile))
-		{
-		  if (i || b->next)
-		    fatal ("input file shrank");
-		  return conflicts_found;
-		}
-	    }
+      if (0 < i)
+	{
+	  /* Only the last line of the file can be incomplete.  */
+	  lin missing = copy_merge_lines (&in, i, NULL);
+	  if (1 < missing || (missing && b + 1 < diff + nblocks))
+	    fatal ("input file shrank");
+	}
     }
+
   /* Copy rest of common file.  */
-  while ((c = getc (infile)) != EOF || !(ferror (infile) | feof (infile)))
-    putc (c, outputfile);
+  do
+    fwrite (in.ptr, sizeof (char), in.lim - in.ptr, outputfile);
+  while (fill_merge_input (&in));
+
+  free (in.buf);
   return conflicts_found;
 }
 
-/* Reverse the order of the list of diff3 blocks.  */
+/* Compare each of the NFILES files in FILE other than the common
+   file FILE[1] to the common file, and store the two way diffs into
+   THREAD, leaving THREAD[1] null.  Compare all but the last pair in
+   child processes when that pays, so that the comparisons run
+   concurrently.  */
 
-static struct diff3_block *
-reverse_diff3_blocklist (struct diff3_block *diff)
+static void
+diff_against_common (char **file, int nfiles, struct diff_block *thread[])
+{
+  struct diff_child *child = xnmalloc (nfiles, sizeof *child);
+  bool *concurrent = xnmalloc (nfiles, sizeof *concurrent);
+  struct diff_block *last_block;
+  int i;
+
+  thread[1] = NULL;
+  for (i = 0; i < nfiles - 1; i++)
+    concurrent[i] = i != 1 && start_child (file[i], file[1], &child[i]);
+  thread[nfiles - 1] = process_diff (file[nfiles - 1], file[1], &last_block);
+  for (i = 0; i < nfiles - 1; i++)
+    if (i != 1)
+      thread[i] = (concurrent[i]
+		   ? finish_child (&child[i], &last_block)
+		   : process_diff (file[i], file[1], &last_block));
+
+  free (concurrent);
+  free (child);
+}
+
+/* Fill in OPTIONS from diff3's options, and start diff's engine with
+   them.  */
+
+static void
+init_engine (struct engine_options *options)
+{
+  memset (options, 0, sizeof *options);
+  options->text = text;
+  options->strip_trailing_cr = strip_trailing_cr;
+  options->horizon_lines = HORIZON_LINES;
+  engine_init (options);
+}
+
+/* Compare the files named NAME[FILE0] and NAME[FILE1] to the common
+   file named NAME[FILEC], and store the two way diffs into THREAD[0]
+   and THREAD[1].  Compare the pairs concurrently if that pays.  */
+
+static void
+diff_with_common (char const *const name[3], struct diff_block *thread[2])
+{
+  bool same[2];
+  bool same_others;
+  bool trimmed = false;
+  struct middles middles;
+  struct diff_child child;
+  bool concurrent;
+  struct diff_block *last_block;
+  int i;
+
+  /* A file with the same contents as OLDFILE makes no changes to it,
+     and two files with the same contents make the same changes, so
+     such diffs need not be computed.  */
+  same[0] = same_contents (name[FILE0], name[FILEC]);
+  same[1] = same_contents (name[FILE1], name[FILEC]);
+  same_others = (! (same[0] || same[1])
+		 && same_contents (name[FILE0], name[FILE1]));
+
+  if (! diff_program && ! (same[0] && same[1]))
+    {
+      struct engine_options options;
+      init_engine (&options);
+
+      /* Compare only what is between the lines that all three files
+	 have in common at their start and end, as in the usual merge
+	 most of each file is the same.  */
+      if (! (same[0] || same[1] || same_others))
+	trimmed = trim_common_ends (name, &middles);
+
+      /* Read the common file just once, and share it and the
+	 equivalence classes of its lines between both comparisons.
+	 A child that compares a pair inherits it.  */
+      if (trimmed)
+	for (i = 0; i < 2; i++)
+	  middles.context[i] = engine_context_new (&options);
+      else
+	engine_retain (name[FILEC]);
+    }
+
+  concurrent = (! (same[0] || same[1] || same_others || trimmed)
+		&& start_child (name[FILE0], name[FILEC], &child));
+  thread[1] = (same[1] ? NULL
+	       : trimmed ? middle_diff (&middles, FILE1, &last_block)
+	       : process_diff (name[FILE1], name[FILEC], &last_block));
+  thread[0] = (same[0] ? NULL
+	       : same_others ? copy_diff_blocks (thread[1])
+	       : trimmed ? middle_diff (&middles, FILE0, &last_block)
+	       : concurrent ? finish_child (&child, &last_block)
+	       : process_diff (name[FILE0], name[FILEC], &last_block));
+}
+
+/* Store into LINE the lines of the version of the common file that
+   the blocks in USING, a list of blocks from one two way diff, make
+   of the common file's lines LOWC onward, which are at COMMON.  The
+   version runs from line LOW to line HIGH of the other file.  Between
+   the blocks, the version is the same as the common file.  */
+
+static void
+set_version (struct diff_block const *using, lin lowc, lin low, lin high,
+	     char const *const *const common[], char const *const *line[])
 {
-  register struct diff3_block *tmp, *next, *prev;
+  struct diff_block const *ptr;
+  lin i;
 
-  for (tmp = diff, prev = 0;  tmp;  tmp = next)
+  for (i = 0; i + low < D_LOWLINE (using, FO); i++)
+    line[i] = common[i];
+
+  for (ptr = using; ptr; ptr = D_NEXT (ptr))
     {
-      next = tmp->next;
-      tmp->next = prev;
-      prev = tmp;
+      lin linec = D_HIGHLINE (ptr, FC) + 1 - lowc;
+      lin j;
+
+      i = D_LOWLINE (ptr, FO) - low;
+      for (j = 0; j < D_NUMLINES (ptr, FO); i++, j++)
+	line[i] = D_LINEARRAY (ptr, FO) + j;
+
+      /* Catch the lines between here and the next diff.  */
+      for (;
+	   i < (D_NEXT (ptr) ? D_LOWLINE (D_NEXT (ptr), FO) : high + 1) - low;
+	   i++, linec++)
+	line[i] = common[linec];
     }
+}
 
-  return prev;
+/* Output to OUTPUTFILE the NUM lines at LINE.  */
+
+static void
+output_line_list (FILE *outputfile, char const *const *const line[],
+		  lin num)
+{
+  lin i;
+  for (i = 0; i < num; i++)
+    fwrite (LINE_TEXT (line[i]), sizeof (char), LINE_LENGTH (line[i]),
+	    outputfile);
 }
+
+/* Read from INFILE, the common file FILE[1] of the NFILES files in
+   FILE, and output to OUTPUTFILE the result of merging into it the
+   changes that each of the other files makes to it, as given by the
+   two way diffs in THREAD.  LABEL gives the names to output for the
+   files.
+
+   This generalizes make_3way_diff and output_diff3_merge to any
+   number of diffs: the blocks of all the diffs whose ranges in the
+   common file overlap or adjoin are grouped together, and each other
+   file's version of the group's range of the common file is worked
+   out from that file's blocks.  If only one file changes the range,
+   or all the files that change it change it the same way, output
+   their version.  Otherwise output a conflict that brackets each
+   changed version and the common file's lines, like -m -A.
+
+   Return true if conflicts were found.  */
+
+static bool
+output_nway_merge (FILE *infile, FILE *outputfile,
+		   struct diff_block *thread[], int nfiles,
+		   char const * const label[])
+{
+  struct diff_block **current = xnmalloc (nfiles, sizeof *current);
+  struct diff_block **using = xnmalloc (nfiles, sizeof *using);
+  struct diff_block **last_using = xnmalloc (nfiles, sizeof *last_using);
+  char const *const ***line = xnmalloc (nfiles, sizeof *line);
+  lin *numlines = xnmalloc (nfiles, sizeof *numlines);
+  bool conflicts_found = false;
+  lin linesread = 0;
+  struct merge_input in;
+  int d;
+
+  in.file = infile;
+  in.buf = xmalloc (MERGE_BUFSIZE);
+  in.ptr = in.lim = in.buf;
+
+  memcpy (current, thread, nfiles * sizeof *current);
+
+  for (;;)
+    {
+      lin lowc = LIN_MAX;
+      lin highc;
+      lin missing;
+      bool grew;
+      int changed = -1;
+      bool conflict = false;
+
+      /* Find the lowest block in the common file, and group with it
+	 every block that overlaps or adjoins the group, until the
+	 group stops growing.  */
+      for (d = 0; d < nfiles; d++)
+	if (current[d] && D_LOWLINE (current[d], FC) < lowc)
+	  lowc = D_LOWLINE (current[d], FC);
+      if (lowc == LIN_MAX)
+	break;
+
+      for (d = 0; d < nfiles; d++)
+	using[d] = last_using[d] = NULL;
+      highc = lowc - 1;
+      do
+	{
+	  grew = false;
+	  for (d = 0; d < nfiles; d++)
+	    while (current[d] && D_LOWLINE (current[d], FC) <= highc + 1)
+	      {
+		struct diff_block *b = current[d];
+		if (using[d])
+		  last_using[d]->next = b;
+		else
+		  using[d] = b;
+		last_using[d] = b;
+		current[d] = b->next;
+		b->next = NULL;
+		highc = MAX (highc, D_HIGHLINE (b, FC));
+		grew = true;
+	      }
+	}
+      while (grew);
+
+      /* Gather the common file's lines in the group from the blocks,
+	 which between them cover every line of it.  */
+      numlines[1] = highc - lowc + 1;
+      line[1] = xcalloc (numlines[1], sizeof *line[1]);
+      for (d = 0; d < nfiles; d++)
+	{
+	  struct diff_block *ptr;
+	  for (ptr = using[d]; ptr; ptr = D_NEXT (ptr))
+	    {
+	      lin offset = D_LOWLINE (ptr, FC) - lowc;
+	      if (!copy_stringlist (D_LINEARRAY (ptr, FC), line[1] + offset,
+				    D_NUMLINES (ptr, FC)))
+		fatal ("internal error: screwup in format of diff blocks");
+	    }
+	}
+
+      /* Work out each changed file's version of the group, and see
+	 whether the versions conflict.  */
+      for (d = 0; d < nfiles; d++)
+	if (using[d])
+	  {
+	    lin low = D_LOW_MAPLINE (using[d], FC, FO, lowc);
+	    lin high = D_HIGH_MAPLINE (last_using[d], FC, FO, highc);
+	    numlines[d] = high - low + 1;
+	    line[d] = xnmalloc (numlines[d], sizeof *line[d]);
+	    set_version (using[d], lowc, low, high, line[1], line[d]);
+	    if (changed < 0)
+	      changed = d;
+	    else if (! conflict)
+	      conflict = (numlines[d] != numlines[changed]
+			  || !compare_line_list (line[d], line[changed],
+						 numlines[d]));
+	  }
+
+      /* Copy the lines of the common file before the group.  */
+      if (copy_merge_lines (&in, lowc - linesread - 1, outputfile) != 0)
+	fatal ("input file shrank");
+
+      if (! conflict)
+	output_line_list (outputfile, line[changed], numlines[changed]);
+      else
+	{
+	  int last = nfiles - 1;
+	  conflicts_found = true;
+	  while (! using[last])
+	    last--;
+	  fprintf (outputfile, "<<<<<<< %s\n", label[changed]);
+	  output_line_list (outputfile, line[changed], numlines[changed]);
+	  fprintf (outputfile, "||||||| %s\n", label[1]);
+	  output_line_list (outputfile, line[1], numlines[1]);
+	  for (d = changed + 1; d <= last; d++)
+	    if (using[d])
+	      {
+		if (d == last)
+		  fputs ("=======\n", outputfile);
+		else
+		  fprintf (outputfile, "======= %s\n", label[d]);
+		output_line_list (outputfile, line[d], numlines[d]);
+	      }
+	  fprintf (outputfile, ">>>>>>> %s\n", label[last]);
+	}
+
+      for (d = 0; d < nfiles; d++)
+	if (using[d] || d == 1)
+	  free (line[d]);
+
+      /* Skip the lines of the group in the common file.  Only the
+	 last line of the file can be incomplete.  */
+      linesread = highc;
+      missing = copy_merge_lines (&in, numlines[1], NULL);
+      for (d = 0; d < nfiles && ! current[d]; d++)
+	continue;
+      if (1 < missing || (missing && d < nfiles))
+	fatal ("input file shrank");
+    }
+
+  /* Copy rest of common file.  */
+  do
+    fwrite (in.ptr, sizeof (char), in.lim - in.ptr, outputfile);
+  while (fill_merge_input (&in));
+
+  free (in.buf);
+  free (numlines);
+  free (line);
+  free (last_using);
+  free (using);
+  free (current);
+  return conflicts_found;
+}
+
 
 static void
 fatal (char const *msgid)
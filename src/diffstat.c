@@ -0,0 +1,206 @@
+/* Summaries of the lines changed in each file for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <xalloc.h>
+
+/* The --numstat output is a line for each pair of files that differ,
+   with the numbers of lines inserted and deleted and the name of the
+   second file, separated by tabs, or "-" for both numbers if the
+   files are binary.  The --stat output lists the same as a histogram
+   after all files are compared, and then the totals.  The numbers are
+   taken from the edit script alone, so no hunk is formatted.  */
+
+/* The lines deleted and inserted in the pair of files being compared,
+   over all its windows.  */
+static intmax_t pair_deleted;
+static intmax_t pair_inserted;
+
+/* A pair of files listed by --stat.  */
+struct stat_entry
+{
+  char *name;
+  intmax_t deleted;
+  intmax_t inserted;
+  bool binary;
+};
+
+static struct stat_entry *entries;
+static size_t nentries;
+static size_t entries_alloc;
+
+/* The width of --stat output.  */
+enum { STAT_WIDTH = 80, STAT_BAR_MIN = 10 };
+
+/* Add the lines that SCRIPT deletes and inserts to the counts for the
+   pair of files being compared, leaving out those of changes that -B
+   or -I ignore.  */
+
+void
+count_stat_script (struct change *script)
+{
+  struct change *next = script;
+
+  while (next)
+    {
+      struct change *this = next;
+      lin first0, last0, first1, last1;
+
+      if (! (ignore_blank_lines || ignore_regexp.fastmap))
+	{
+	  pair_deleted += this->deleted;
+	  pair_inserted += this->inserted;
+	  next = this->link;
+	  continue;
+	}
+
+      /* Detach the change to see whether it is ignored.  */
+      next = this->link;
+      this->link = 0;
+      if (analyze_hunk (this, &first0, &last0, &first1, &last1))
+	{
+	  pair_deleted += last0 - first0 + 1;
+	  pair_inserted += last1 - first1 + 1;
+	}
+      this->link = next;
+    }
+}
+
+/* Report the counts for the pair of files whose second file is NAME,
+   and which differ, as text if not BINARY.  */
+
+void
+stat_pair (char const *name, bool binary)
+{
+  if (output_style == OUTPUT_NUMSTAT)
+    {
+      if (binary)
+	printf ("-\t-\t%s\n", name);
+      else
+	printf ("%"PRIdMAX"\t%"PRIdMAX"\t%s\n",
+		pair_inserted, pair_deleted, name);
+    }
+  else
+    {
+      struct stat_entry *e;
+      if (nentries == entries_alloc)
+	entries = x2nrealloc (entries, &entries_alloc, sizeof *entries);
+      e = &entries[nentries++];
+      e->name = xstrdup (name);
+      e->deleted = pair_deleted;
+      e->inserted = pair_inserted;
+      e->binary = binary;
+    }
+
+  pair_deleted = pair_inserted = 0;
+}
+
+/* Return the number of digits of N, which is not negative.  */
+
+static int
+digits (intmax_t n)
+{
+  int d = 1;
+  while (9 < n)
+    {
+      n /= 10;
+      d++;
+    }
+  return d;
+}
+
+/* Output N copies of C.  */
+
+static void
+repeat (int c, intmax_t n)
+{
+  while (0 < n--)
+    putchar (c);
+}
+
+/* Output the --stat histogram and totals.  The bars are scaled down
+   to fit if the largest count would make them too wide, with every
+   nonzero count keeping at least one mark.  */
+
+void
+print_stat_summary (void)
+{
+  size_t name_width = 0;
+  intmax_t most = 0;
+  intmax_t deleted = 0, inserted = 0;
+  int count_width, bar_width;
+  size_t i;
+
+  if (output_style != OUTPUT_STAT || ! nentries)
+    return;
+
+  for (i = 0; i < nentries; i++)
+    {
+      struct stat_entry const *e = &entries[i];
+      name_width = MAX (name_width, strlen (e->name));
+      most = MAX (most, e->deleted + e->inserted);
+      deleted += e->deleted;
+      inserted += e->inserted;
+    }
+
+  count_width = MAX (digits (most), 3);
+  bar_width = MIN (name_width, STAT_WIDTH);
+  bar_width = MAX (STAT_WIDTH - bar_width - count_width - 5, STAT_BAR_MIN);
+
+  for (i = 0; i < nentries; i++)
+    {
+      struct stat_entry const *e = &entries[i];
+      intmax_t plus = e->inserted;
+      intmax_t minus = e->deleted;
+
+      printf (" %s", e->name);
+      repeat (' ', name_width - strlen (e->name));
+      if (e->binary)
+	{
+	  printf (" | %*s\n", count_width, "Bin");
+	  continue;
+	}
+      printf (" | %*"PRIdMAX" ", count_width, plus + minus);
+      if (bar_width < most)
+	{
+	  plus = plus ? MAX (1, plus * bar_width / most) : 0;
+	  minus = minus ? MAX (1, minus * bar_width / most) : 0;
+	}
+      repeat ('+', plus);
+      repeat ('-', minus);
+      putchar ('\n');
+    }
+
+  printf (ngettext (" %lu file changed", " %lu files changed",
+		    nentries),
+	  (unsigned long int) nentries);
+  if (inserted || ! deleted)
+    printf (ngettext (", %"PRIdMAX" insertion(+)",
+		      ", %"PRIdMAX" insertions(+)", inserted),
+	    inserted);
+  if (deleted || ! inserted)
+    printf (ngettext (", %"PRIdMAX" deletion(-)",
+		      ", %"PRIdMAX" deletions(-)", deleted),
+	    deleted);
+  putchar ('\n');
+
+  for (i = 0; i < nentries; i++)
+    free (entries[i].name);
+  free (entries);
+}
@@ -19,12 +19,126 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "diff.h"
+#include "filestat.h"
+#include "numa.h"
+#include <cmpbuf.h>
 #include <error.h>
 #include <exclude.h>
 #include <filenamecat.h>
+#include <fnmatch.h>
+#include <hard-locale.h>
+#include <hash.h>
+#include <langinfo.h>
 #include <setjmp.h>
+#include <timespec.h>
 #include <xalloc.h>
 
+#if HAVE_WORKING_FORK
+# include <poll.h>
+#endif
+
+/* Patterns of the form "*SUFFIX", where SUFFIX has no wildcards, are
+   common (e.g., "*.o") and are kept apart from the others, in a hash
+   table of their suffixes.  A name is then checked against all of them
+   with one lookup per distinct suffix length, rather than with one
+   fnmatch call per pattern.  There is a table for 'excluded' and one
+   for 'included'.  */
+struct suffix_table
+{
+  Hash_table *suffixes;
+  size_t *lengths;
+  size_t n_lengths;
+  size_t lengths_alloc;
+};
+
+static struct suffix_table excluded_suffixes;
+static struct suffix_table included_suffixes;
+
+static size_t
+hash_suffix (void const *suffix, size_t table_size)
+{
+  return hash_string (suffix, table_size);
+}
+
+static bool
+same_suffix (void const *suffix1, void const *suffix2)
+{
+  return strcmp (suffix1, suffix2) == 0;
+}
+
+/* Add PATTERN with OPTIONS to the patterns of file names, recording it
+   in T if it is a plain suffix pattern and in EX otherwise.  */
+
+static void
+add_name_pattern (struct suffix_table *t, struct exclude *ex,
+		  char const *pattern, int options)
+{
+  char const *suffix = pattern + 1;
+  size_t len;
+  size_t i;
+
+  if (! (pattern[0] == '*' && (options & EXCLUDE_WILDCARDS)
+	 && ! (options & FNM_CASEFOLD)
+	 && ! suffix[strcspn (suffix, "*?[\\")]))
+    {
+      add_exclude (ex, pattern, options);
+      return;
+    }
+
+  if (! t->suffixes)
+    {
+      t->suffixes = hash_initialize (0, NULL, hash_suffix, same_suffix, free);
+      if (! t->suffixes)
+	xalloc_die ();
+    }
+  if (hash_lookup (t->suffixes, suffix))
+    return;
+  if (! hash_insert (t->suffixes, xstrdup (suffix)))
+    xalloc_die ();
+
+  len = strlen (suffix);
+  for (i = 0; i < t->n_lengths; i++)
+    if (t->lengths[i] == len)
+      return;
+  if (t->n_lengths == t->lengths_alloc)
+    t->lengths = x2nrealloc (t->lengths, &t->lengths_alloc,
+			     sizeof *t->lengths);
+  t->lengths[t->n_lengths++] = len;
+}
+
+/* Add PATTERN with OPTIONS to the patterns of files to be excluded,
+   recording it in EX unless it is a plain suffix pattern.  This has
+   the signature of add_exclude, so that add_exclude_file can use it.  */
+
+void
+add_excluded_pattern (struct exclude *ex, char const *pattern, int options)
+{
+  add_name_pattern (&excluded_suffixes, ex, pattern, options);
+}
+
+/* Likewise for the patterns of files to be compared.  */
+
+void
+add_included_pattern (struct exclude *ex, char const *pattern, int options)
+{
+  add_name_pattern (&included_suffixes, ex, pattern, options);
+}
+
+/* Return true if the file NAME, of length LEN, matches a pattern of T
+   or EX.  */
+
+static bool
+name_matches (struct suffix_table const *t, struct exclude const *ex,
+	      char const *name, size_t len)
+{
+  size_t i;
+  for (i = 0; i < t->n_lengths; i++)
+    if (t->lengths[i] <= len
+	&& hash_lookup (t->suffixes, name + len - t->lengths[i]))
+      return true;
+  return excluded_file_name (ex, name);
+}
+
 /* Read the directory named by DIR and store into DIRDATA a sorted vector
    of filenames for its contents.  DIR->desc == -1 means this directory is
    known to be nonexistent, so set DIRDATA to an empty vector.
@@ -34,9 +148,21 @@ struct dirdata
 {
   size_t nnames;	/* Number of names.  */
   char const **names;	/* Sorted names of files in dir, followed by 0.  */
-  char *data;	/* Allocated storage for file names.  */
+  char const **keys;	/* Collation keys parallel to names, or 0.  */
 };
 
+/* Each name in a 'data' table is preceded by its length, as a size_t
+   that may be unaligned, and by a byte that says what readdir could
+   tell of the file: whether it might be a directory, and whether it
+   is known to be a regular file.  */
+#define MAYBE_DIR(name) ((name)[-1] & 1)
+#define KNOWN_REG(name) ((name)[-1] & 2)
+
+/* With --include, a name that matches none of its patterns is kept
+   only if the file might be a directory, and marked so that it is
+   left out if it turns out not to be one.  */
+#define NOT_INCLUDED(name) ((name)[-1] & 4)
+
 /* Whether file names in directories should be compared with
    locale-specific sorting.  */
 static bool locale_specific_sorting;
@@ -44,7 +170,147 @@ static bool locale_specific_sorting;
 /* Where to go if locale-specific sorting fails.  */
 static jmp_buf failed_locale_specific_sorting;
 
+/* The status of each directory on the path from the top of the
+   recursion to the directories being compared, on each side, so that
+   a loop is found with one lookup rather than by walking the path.
+   The tables point at the status in the directories' comparisons,
+   which last while their subdirectories are compared.  A child that
+   --jobs starts gets a copy of the tables as they are.  */
+static Hash_table *active_dirs[2];
+
 static bool dir_loop (struct comparison const *, int);
+static bool enter_dir (struct comparison const *, int);
+static bool set_aside_lone_file (struct comparison const *,
+				 char const *, char const *);
+static bool left_out (struct comparison const *, char const *, int);
+
+/* Return the length of NAME in a 'data' table.  */
+
+static size_t
+name_length (char const *name)
+{
+  size_t len;
+  memcpy (&len, name - 1 - sizeof len, sizeof len);
+  return len;
+}
+
+/* Storage for the names read from directories and the tables that
+   sort them.  Each level of diff_dirs allocates after the levels above
+   it and releases what it allocated when it is done, so that diff -r
+   reuses the same blocks from directory to directory rather than
+   allocating and freeing several tables for each one.  Released
+   blocks are kept for reuse.  */
+
+struct name_block
+{
+  struct name_block *next;
+  size_t size;			/* Bytes available in DATA.  */
+  size_t used;			/* Bytes of DATA allocated.  */
+  max_align_t data[];
+};
+
+enum { NAME_BLOCK_SIZE = 64 * 1024 };
+
+/* The blocks in use, the newest first, and the blocks released.  */
+static struct name_block *name_blocks;
+static struct name_block *spare_name_blocks;
+
+/* A point in the name storage to release it back to.  */
+struct name_mark
+{
+  struct name_block *block;
+  size_t used;
+};
+
+/* Return the current point in the name storage.  */
+
+static struct name_mark
+mark_names (void)
+{
+  struct name_mark m;
+  m.block = name_blocks;
+  m.used = name_blocks ? name_blocks->used : 0;
+  return m;
+}
+
+/* Release the name storage allocated since M.  */
+
+static void
+release_names (struct name_mark m)
+{
+  while (name_blocks != m.block)
+    {
+      struct name_block *b = name_blocks;
+      name_blocks = b->next;
+      b->next = spare_name_blocks;
+      spare_name_blocks = b;
+    }
+  if (m.block)
+    m.block->used = m.used;
+}
+
+/* Return room for SIZE bytes at the end of the name storage, after
+   the first USED bytes of OBJ, which must be the room last returned
+   and not yet allocated, and which are moved along if the room is
+   elsewhere.  So a table can grow as it is filled in.  A new block
+   is twice as large as what it must hold, so that a growing table is
+   copied only a few times.  */
+
+static void *
+name_room (void *obj, size_t used, size_t size)
+{
+  struct name_block *b = name_blocks;
+  struct name_block **s;
+  size_t need;
+
+  if (SIZE_MAX / 2 - offsetof (struct name_block, data) - used < size)
+    xalloc_die ();
+  need = used + size;
+  if (b && need <= b->size - b->used)
+    return (char *) b->data + b->used;
+
+  for (s = &spare_name_blocks; *s && (*s)->size < need; s = &(*s)->next)
+    continue;
+  if (*s)
+    {
+      b = *s;
+      *s = b->next;
+    }
+  else
+    {
+      size_t bsize = MAX (2 * need, NAME_BLOCK_SIZE);
+      b = xmalloc (offsetof (struct name_block, data) + bsize);
+      b->size = bsize;
+    }
+  b->used = 0;
+  b->next = name_blocks;
+  name_blocks = b;
+  if (used)
+    memcpy (b->data, obj, used);
+  return b->data;
+}
+
+/* Allocate the first SIZE bytes of the room that name_room last
+   returned.  */
+
+static void
+take_names (size_t size)
+{
+  size_t align = sizeof (max_align_t);
+  struct name_block *b = name_blocks;
+  if (b)
+    b->used = MIN (b->size, b->used + (size + align - 1) / align * align);
+}
+
+/* Return SIZE bytes of name storage.  */
+
+static void *
+name_alloc (size_t size)
+{
+  void *p = name_room (NULL, 0, size);
+  take_names (size);
+  return p;
+}
 
 
 /* Read a directory and get its vector of names.  */
@@ -61,51 +327,82 @@ dir_read (struct file_data const *dir, struct dirdata *dirdata)
   /* Number of files in directory.  */
   size_t nnames;
 
-  /* Allocated and used storage for file name data.  */
+  /* Storage for file name data, and how much of it is used.  */
   char *data;
-  size_t data_alloc, data_used;
+  size_t data_used;
 
   dirdata->names = 0;
-  dirdata->data = 0;
+  dirdata->keys = 0;
   nnames = 0;
   data = 0;
+  data_used = 0;
 
   if (dir->desc != -1)
     {
-      /* Open the directory and check for errors.  */
-      register DIR *reading = opendir (dir->name);
+      /* Open the directory and check for errors.  Read it through a
+	 copy of its descriptor if it is open, as the descriptor is
+	 still needed to look up the files in it.  */
+      register DIR *reading = 0;
+#ifdef AT_FDCWD
+      if (0 <= dir->desc)
+	{
+	  int desc = dup (dir->desc);
+	  if (0 <= desc && ! (reading = fdopendir (desc)))
+	    close (desc);
+	}
+      if (!reading)
+#endif
+	reading = opendir (dir->name);
       if (!reading)
 	return false;
 
-      /* Initialize the table of filenames.  */
-
-      data_alloc = 512;
-      data_used = 0;
-      dirdata->data = data = xmalloc (data_alloc);
-
       /* Read the directory entries, and insert the subfiles
-	 into the 'data' table.  */
+	 into the 'data' table.
+
+	 There is no need to call getdents64 directly: glibc's readdir
+	 already fetches entries with it into a buffer of at least
+	 32 KiB.  Nor can d_type save compare_files from stat-ing a
+	 pair of files, as it needs their sizes and time stamps as well
+	 as their types; the type is kept only where that suffices.  */
 
       while ((errno = 0, (next = readdir (reading)) != 0))
 	{
 	  char *d_name = next->d_name;
 	  size_t d_size = _D_EXACT_NAMLEN (next) + 1;
+#ifdef DT_UNKNOWN
+	  char type = ((next->d_type == DT_DIR
+			|| next->d_type == DT_UNKNOWN
+			|| (next->d_type == DT_LNK && ! no_dereference_symlinks))
+		       | (next->d_type == DT_REG) << 1);
+#else
+	  char type = 1;
+#endif
 
 	  /* Ignore "." and "..".  */
 	  if (d_name[0] == '.'
 	      && (d_name[1] == 0 || (d_name[1] == '.' && d_name[2] == 0)))
 	    continue;
 
-	  if (excluded_file_name (excluded, d_name))
+	  if (name_matches (&excluded_suffixes, excluded, d_name, d_size - 1))
 	    continue;
 
-	  while (data_alloc < data_used + d_size)
+	  /* Files that --include leaves out need not be looked at
+	     further unless they might be directories, which are
+	     searched whatever their names.  */
+	  if (included
+	      && ! name_matches (&included_suffixes, included,
+				 d_name, d_size - 1))
 	    {
-	      if (PTRDIFF_MAX / 2 <= data_alloc)
-		xalloc_die ();
-	      dirdata->data = data = xrealloc (data, data_alloc *= 2);
+	      if (! (type & 1))
+		continue;
+	      type |= 4;
 	    }
 
+	  size_t len = d_size - 1;
+	  data = name_room (data, data_used, sizeof len + 1 + d_size);
+	  memcpy (data + data_used, &len, sizeof len);
+	  data_used += sizeof len;
+	  data[data_used++] = type;
 	  memcpy (data + data_used, d_name, d_size);
 	  data_used += d_size;
 	  nnames++;
@@ -126,14 +423,17 @@ dir_read (struct file_data const *dir, struct dirdata *dirdata)
     }
 
   /* Create the 'names' table from the 'data' table.  */
+  take_names (data_used);
   if (PTRDIFF_MAX / sizeof *names - 1 <= nnames)
     xalloc_die ();
-  dirdata->names = names = xmalloc ((nnames + 1) * sizeof *names);
+  dirdata->names = names = name_alloc ((nnames + 1) * sizeof *names);
   dirdata->nnames = nnames;
   for (i = 0;  i < nnames;  i++)
     {
-      names[i] = data;
-      data += strlen (data) + 1;
+      size_t len;
+      memcpy (&len, data, sizeof len);
+      names[i] = data + sizeof len + 1;
+      data += sizeof len + 1 + len + 1;
     }
   names[nnames] = 0;
   return true;
@@ -192,7 +492,839 @@ compare_names_for_qsort (void const *file1, void const *file2)
     }
   return file_name_cmp (name1, name2);
 }
+
+/* A file name and the key it is sorted by, for sort_names: the name
+   itself, or its collation key.  PREFIX holds the first bytes of the
+   key, the first most significant, padded with zeros, so that most
+   comparisons need not look at the key.  */
+
+struct sorted_name
+{
+  uint64_t prefix;
+  char const *key;
+  size_t len;
+  char const *name;
+};
+
+enum { PREFIX_BYTES = sizeof (uint64_t) };
+
+/* Buckets smaller than this are sorted by insertion, and those whose
+   keys are this long alike by qsort, which needs no stack for each
+   byte.  */
+enum { RADIX_SORT_MIN = 32 };
+enum { RADIX_SORT_DEPTH = 64 };
+
+/* Set S's key to KEY of length LEN, and its name to NAME.  */
+
+static void
+set_sorted_name (struct sorted_name *s, char const *key, size_t len,
+		 char const *name)
+{
+  size_t i;
+  s->prefix = 0;
+  for (i = 0; i < PREFIX_BYTES; i++)
+    s->prefix = s->prefix << CHAR_BIT | (i < len ? (unsigned char) key[i] : 0);
+  s->key = key;
+  s->len = len;
+  s->name = name;
+}
+
+/* Return the byte at DEPTH of the key of S, which is at least DEPTH
+   bytes long.  */
+
+static unsigned char
+sorted_byte (struct sorted_name const *s, size_t depth)
+{
+  return (depth < PREFIX_BYTES
+	  ? s->prefix >> (PREFIX_BYTES - 1 - depth) * CHAR_BIT & UCHAR_MAX
+	  : (unsigned char) s->key[depth]);
+}
+
+/* Compare S1 and S2 by key as strcmp would, breaking ties with
+   file_name_cmp on their names.  */
+
+static int
+compare_sorted_names (struct sorted_name const *s1,
+		      struct sorted_name const *s2)
+{
+  int diff;
+  if (s1->prefix != s2->prefix)
+    return s1->prefix < s2->prefix ? -1 : 1;
+  diff = (MIN (s1->len, s2->len) < PREFIX_BYTES ? 0
+	  : strcmp (s1->key + PREFIX_BYTES, s2->key + PREFIX_BYTES));
+  return diff ? diff : file_name_cmp (s1->name, s2->name);
+}
+
+static int
+compare_sorted_names_for_qsort (void const *s1, void const *s2)
+{
+  return compare_sorted_names (s1, s2);
+}
+
+/* Sort the N names V, whose keys agree in their first DEPTH bytes,
+   using TMP, which has room for N names.  Keys are sorted by their
+   bytes, most significant first, so that huge directories are sorted
+   in a few passes over the names rather than with n log n calls of a
+   comparison function.  */
+
+static void
+radix_sort (struct sorted_name *v, struct sorted_name *tmp, size_t n,
+	    size_t depth)
+{
+  size_t count[UCHAR_MAX + 1];
+  size_t start[UCHAR_MAX + 1];
+  size_t i;
+  int c;
+
+  if (n < RADIX_SORT_MIN)
+    {
+      for (i = 1; i < n; i++)
+	{
+	  struct sorted_name s = v[i];
+	  size_t j;
+	  for (j = i; 0 < j && 0 < compare_sorted_names (&v[j - 1], &s); j--)
+	    v[j] = v[j - 1];
+	  v[j] = s;
+	}
+      return;
+    }
+  if (RADIX_SORT_DEPTH <= depth)
+    {
+      qsort (v, n, sizeof *v, compare_sorted_names_for_qsort);
+      return;
+    }
+
+  memset (count, 0, sizeof count);
+  for (i = 0; i < n; i++)
+    count[sorted_byte (&v[i], depth)]++;
+  start[0] = 0;
+  for (c = 0; c < UCHAR_MAX; c++)
+    start[c + 1] = start[c] + count[c];
+  for (i = 0; i < n; i++)
+    tmp[start[sorted_byte (&v[i], depth)]++] = v[i];
+  memcpy (v, tmp, n * sizeof *v);
+
+  /* The keys that end here are all the same, and are sorted by name.  */
+  radix_sort (v, tmp, count[0], SIZE_MAX);
+  for (i = count[0], c = 1; c <= UCHAR_MAX; i += count[c++])
+    if (1 < count[c])
+      radix_sort (v + i, tmp, count[c], depth + 1);
+}
+
+/* Sort DIRDATA's names by the N keys V that were set from them, and
+   set DIRDATA's keys to the keys if KEYED.  */
+
+static void
+sort_names (struct dirdata *dirdata, struct sorted_name *v, bool keyed)
+{
+  size_t nnames = dirdata->nnames;
+  size_t i;
+
+  radix_sort (v, name_alloc (nnames * sizeof *v), nnames, 0);
+  if (keyed)
+    dirdata->keys = name_alloc (nnames * sizeof *dirdata->keys);
+  for (i = 0; i < nnames; i++)
+    {
+      dirdata->names[i] = v[i].name;
+      if (keyed)
+	dirdata->keys[i] = v[i].key;
+    }
+}
+
+/* Sort the names of DIRDATA in the same order as
+   compare_names_for_qsort, but by transforming each name once with
+   strxfrm and sorting the results in byte order, which is much
+   cheaper than calling strcoll for each comparison.  Set DIRDATA's
+   keys to the collation keys parallel to the sorted names, for the
+   merge in diff_dirs.  Return false, leaving DIRDATA unsorted and
+   without keys, if a name cannot be transformed.  */
+
+static bool
+sort_by_keys (struct dirdata *dirdata)
+{
+  size_t nnames = dirdata->nnames;
+  char const **names = dirdata->names;
+  size_t *key_offset = name_alloc ((nnames + 1) * sizeof *key_offset);
+  struct sorted_name *v;
+  size_t avail = 256;
+  size_t keydata_used = 0;
+  char *keydata = NULL;
+  size_t i;
+
+  for (i = 0; i < nnames; i++)
+    {
+      for (;;)
+	{
+	  size_t size;
+	  keydata = name_room (keydata, keydata_used, avail);
+	  errno = 0;
+	  size = strxfrm (keydata + keydata_used, names[i], avail);
+	  if (errno)
+	    return false;
+	  if (size < avail)
+	    {
+	      key_offset[i] = keydata_used;
+	      keydata_used += size + 1;
+	      break;
+	    }
+	  avail = size + 1;
+	}
+    }
+  key_offset[nnames] = keydata_used;
+  take_names (keydata_used);
+
+  v = name_alloc (nnames * sizeof *v);
+  for (i = 0; i < nnames; i++)
+    set_sorted_name (&v[i], keydata + key_offset[i],
+		     key_offset[i + 1] - key_offset[i] - 1, names[i]);
+  sort_names (dirdata, v, true);
+  return true;
+}
+
+/* Sort the names of DIRDATA in byte order, as compare_names_for_qsort
+   does without locale-specific sorting.  */
+
+static void
+sort_in_byte_order (struct dirdata *dirdata)
+{
+  size_t nnames = dirdata->nnames;
+  char const **names = dirdata->names;
+  struct sorted_name *v = name_alloc (nnames * sizeof *v);
+  size_t i;
+
+  for (i = 0; i < nnames; i++)
+    set_sorted_name (&v[i], names[i], name_length (names[i]), names[i]);
+  sort_names (dirdata, v, false);
+}
+
+/* Compare the names *NAMES0 and *NAMES1 from the directories with
+   DIRDATA[0] and DIRDATA[1], which have been sorted by key.  */
+
+static int
+compare_keys (struct dirdata const dirdata[2],
+	      char const **names0, char const **names1)
+{
+  char const *key0 = dirdata[0].keys[names0 - dirdata[0].names];
+  char const *key1 = dirdata[1].keys[names1 - dirdata[1].names];
+  int diff = strcmp (key0, key1);
+  return diff ? diff : file_name_cmp (*names0, *names1);
+}
+
+/* Return true if file names might not collate in byte order in the
+   current locale.  */
+
+static bool
+hard_collation (void)
+{
+  static signed char hard = -1;
+  if (hard < 0)
+    {
+      hard = hard_locale (LC_COLLATE);
+#ifdef __GLIBC__
+      /* glibc collates in byte order in locales without collation
+	 rules, such as C.UTF-8.  nl_langinfo returns the number of
+	 rules in place of a pointer, so this test is exact only if
+	 it is zero, which is all that matters.  */
+      if (! nl_langinfo (_NL_COLLATE_NRULES))
+	hard = false;
+#endif
+    }
+  return hard;
+}
+
+#if defined AT_FDCWD && defined POSIX_FADV_WILLNEED
+# define CAN_PREFETCH true
+
+/* Ask the system to start reading the file NAME in the directory
+   DIR, so that with --prefetch the files ahead are read from slow
+   storage while the current ones are compared.  Only regular files
+   are worth it, and only those that readdir says are regular can be
+   opened without risk of blocking or of side effects.  */
+
+static void
+prefetch_file (struct file_data const *dir, char const *name)
+{
+  if (KNOWN_REG (name) && 0 <= dir->desc)
+    {
+      int desc = openat (dir->desc, name, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+      if (0 <= desc)
+	{
+	  posix_fadvise (desc, 0, 0, POSIX_FADV_WILLNEED);
+	  close (desc);
+	}
+    }
+}
+#else
+# define CAN_PREFETCH false
+# define prefetch_file(dir, name) ((void) 0)
+#endif
 
+#if HAVE_WORKING_FORK
+
+/* With --jobs, runs of files in a directory that are not directories
+   are compared by child processes, up to JOBS at a time.  Each child
+   writes to temporary files, which are copied to stdout and stderr in
+   the order the children were started, so the output is the same as
+   when comparing one file at a time.  A child that finishes before
+   those started earlier keeps its output waiting, and another child
+   starts in its place, so that one slow pair holds up the output but
+   not the comparisons after it, until JOB_BACKLOG finished children
+   or JOB_BACKLOG_BYTES bytes of output are waiting.  Directories are
+   compared by the parent itself, which goes on into a subdirectory
+   while the children compare the files before it, so that one large
+   subdirectory, or many small ones, keep all the children busy.  What
+   the parent outputs meanwhile, such as "Only in" lines and errors,
+   is diverted to temporary files of a slot of the queue of its own,
+   and copied out in turn like a child's output.  With --stats, each
+   child sends its figures back through the pipe that tells the parent
+   it has exited, and the parent reports how busy the children were,
+   how much output waited, and how long it waited itself.  The parent
+   compares all files itself with --output-index, which records where
+   in stdout each pair's output starts, and --stat, which lists all
+   files at the end.  So it does with --remote, whose workers must have one process to talk
+   to, and --checkpoint, which records the pairs whose output is out.  */
+
+enum { JOB_PAIRS = 16 };
+enum { JOB_BACKLOG = 64 };
+enum { JOB_BACKLOG_BYTES = 64 * 1024 * 1024 };
+
+struct job
+{
+  /* The child, or 0 if the slot holds output that the parent diverted.  */
+  pid_t pid;
+
+  /* The read end of a pipe whose write end only the child has open,
+     which therefore reads as end of file once the child exits.  */
+  int done_fd;
+
+  /* Whether the child has exited, and the largest value HANDLE_FILE
+     returned in it.  */
+  bool done;
+  int val;
+
+  /* Temporary files for the child's stdout and stderr.  */
+  int out, err;
+
+  /* The names of the files to compare.  */
+  int npairs;
+  char const *names[JOB_PAIRS][2];
+};
+
+/* A circular queue of JOB_SLOTS jobs, of which PENDING starting at
+   FIRST_JOB have been started and have not had their output copied.
+   RUNNING of them have not yet exited, and those that have exited
+   have BACKLOG_BYTES of output waiting.  */
+static struct job *job;
+static int job_slots;
+static int first_job;
+static int pending_jobs;
+static int running_jobs;
+static off_t backlog_bytes;
+
+/* When PENDING_JOBS or RUNNING_JOBS last changed, for --stats.  */
+static struct timespec jobs_changed;
+
+/* The slot that the parent's output is diverted to, or -1, and the
+   parent's stdout and stderr while it is.  */
+static int diverted_slot = -1;
+static int saved_stdout = -1;
+static int saved_stderr = -1;
+
+/* Return a temporary file descriptor for a child's output.  */
+
+static int
+job_temp (void)
+{
+  FILE *f = tmpfile ();
+  if (! f)
+    pfatal_with_name ("tmpfile");
+  return fileno (f);
+}
+
+/* Return the size of the temporary file FD.  */
+
+static off_t
+job_output_size (int fd)
+{
+  struct stat st;
+  if (fstat (fd, &st) != 0)
+    pfatal_with_name ("fstat");
+  return st.st_size;
+}
+
+/* Copy the contents of the temporary file FD to STREAM, and empty FD.  */
+
+static void
+copy_job_output (int fd, FILE *stream)
+{
+  char buf[16 * 1024];
+  ssize_t n;
+
+  if (lseek (fd, 0, SEEK_SET) != 0)
+    pfatal_with_name ("lseek");
+  while ((n = read (fd, buf, sizeof buf)) != 0)
+    {
+      if (n < 0)
+	pfatal_with_name ("read");
+      fwrite (buf, sizeof (char), n, stream);
+    }
+  if (lseek (fd, 0, SEEK_SET) != 0 || ftruncate (fd, 0) != 0)
+    pfatal_with_name ("ftruncate");
+}
+
+/* With --stats, add the jobs pending and running since they last
+   changed, times the seconds since then, to their sums over time.
+   Call this before they change.  */
+
+static void
+tally_jobs (void)
+{
+  struct timespec now;
+
+  if (! stats_format)
+    return;
+  gettime (&now);
+  if (jobs_changed.tv_sec | jobs_changed.tv_nsec)
+    {
+      double secs = ((now.tv_sec - jobs_changed.tv_sec)
+		     + (now.tv_nsec - jobs_changed.tv_nsec) / 1e9);
+      stats.job_running_seconds += running_jobs * secs;
+      stats.job_waiting_seconds += (pending_jobs - running_jobs) * secs;
+    }
+  jobs_changed = now;
+}
+
+/* Wait until at least one running job exits, and collect the status
+   of each that has.  With --stats, count the time waited as waiting
+   for output if FOR_OUTPUT, and for a child otherwise.  */
+
+static void
+wait_for_job (bool for_output)
+{
+  struct pollfd *fds = xnmalloc (running_jobs, sizeof *fds);
+  int *slot = xnmalloc (running_jobs, sizeof *slot);
+  struct timespec start;
+  int n = 0;
+  int i;
+
+  for (i = 0; i < pending_jobs; i++)
+    {
+      int s = (first_job + i) % job_slots;
+      if (! job[s].done)
+	{
+	  fds[n].fd = job[s].done_fd;
+	  fds[n].events = POLLIN;
+	  slot[n++] = s;
+	}
+    }
+
+  if (stats_format)
+    gettime (&start);
+  while (poll (fds, n, -1) < 0)
+    if (errno != EINTR)
+      pfatal_with_name ("poll");
+  if (stats_format)
+    {
+      struct timespec now;
+      double secs;
+      gettime (&now);
+      secs = ((now.tv_sec - start.tv_sec)
+	      + (now.tv_nsec - start.tv_nsec) / 1e9);
+      *(for_output ? &stats.output_wait : &stats.jobs_wait) += secs;
+    }
+
+  tally_jobs ();
+  for (i = 0; i < n; i++)
+    if (fds[i].revents)
+      {
+	struct job *j = &job[slot[i]];
+	int wstatus;
+
+	stats_receive (j->done_fd);
+	if (waitpid (j->pid, &wstatus, 0) < 0)
+	  pfatal_with_name ("waitpid");
+	close (j->done_fd);
+	j->done = true;
+	j->val = WIFEXITED (wstatus) ? WEXITSTATUS (wstatus) : EXIT_TROUBLE;
+	running_jobs--;
+	backlog_bytes += job_output_size (j->out) + job_output_size (j->err);
+      }
+
+  free (fds);
+  free (slot);
+}
+
+/* Copy the output of the jobs that have exited at the head of the
+   queue, and return the largest value HANDLE_FILE returned in them.  */
+
+static int
+copy_finished_jobs (void)
+{
+  int val = EXIT_SUCCESS;
+
+  while (pending_jobs && job[first_job].done)
+    {
+      struct job *j = &job[first_job];
+
+      if (fflush (stdout) != 0)
+	pfatal_with_name (_("write failed"));
+      backlog_bytes -= job_output_size (j->out) + job_output_size (j->err);
+      copy_job_output (j->out, stdout);
+      if (fflush (stdout) != 0)
+	pfatal_with_name (_("write failed"));
+      copy_job_output (j->err, stderr);
+
+      tally_jobs ();
+      first_job = (first_job + 1) % job_slots;
+      pending_jobs--;
+      if (val < j->val)
+	val = j->val;
+    }
+
+  return val;
+}
+
+/* Finish all pending jobs, returning the largest of their values.  */
+
+static int
+finish_jobs (void)
+{
+  int val = copy_finished_jobs ();
+  while (pending_jobs)
+    {
+      int v;
+      wait_for_job (false);
+      v = copy_finished_jobs ();
+      if (val < v)
+	val = v;
+    }
+  return val;
+}
+
+/* Start a child process that calls HANDLE_FILE with CMP for each
+   pair of names in J.  */
+
+static void
+start_job (struct job *j, struct comparison const *cmp,
+	   int (*handle_file) (struct comparison const *,
+			       char const *, char const *))
+{
+  int fds[2];
+
+  /* Do not let the child inherit buffered output.  */
+  if (fflush (stdout) != 0)
+    pfatal_with_name (_("write failed"));
+  fflush (stderr);
+
+  /* Programs that the child runs, such as decompressors, need not
+     hold the pipe open.  */
+  if (pipe (fds) != 0
+      || fcntl (fds[0], F_SETFD, FD_CLOEXEC) != 0
+      || fcntl (fds[1], F_SETFD, FD_CLOEXEC) != 0)
+    pfatal_with_name ("pipe");
+
+  j->pid = fork ();
+  if (j->pid < 0)
+    pfatal_with_name ("fork");
+
+  if (j->pid == 0)
+    {
+      int val = EXIT_SUCCESS;
+      int i;
+
+      close (fds[0]);
+      place_worker (j - job);
+      stats_child ();
+
+      /* The other children keep the processors busy, so this one
+	 finds the ends of large files by itself.  */
+      jobs = 1;
+      if (dup2 (j->out, STDOUT_FILENO) < 0
+	  || dup2 (j->err, STDERR_FILENO) < 0)
+	pfatal_with_name ("dup2");
+
+      for (i = 0; i < j->npairs; i++)
+	{
+	  int v = (*handle_file) (cmp, j->names[i][0], j->names[i][1]);
+	  if (val < v)
+	    val = v;
+	}
+
+      if (fflush (stdout) != 0)
+	pfatal_with_name (_("write failed"));
+      fflush (stderr);
+      stats_send (fds[1]);
+      _exit (val);
+    }
+
+  close (fds[1]);
+  j->done_fd = fds[0];
+  j->done = false;
+  tally_jobs ();
+  stats.job_groups++;
+  pending_jobs++;
+  running_jobs++;
+}
+
+/* Copy out the output of the finished jobs at the head of the queue,
+   waiting for jobs to exit while the queue is full, while the output
+   waiting behind the oldest job has grown too large, or if WAIT_ANY,
+   until one has.  Make sure the slot after the pending ones has its
+   temporary files.  Return the largest value HANDLE_FILE returned in
+   the jobs whose output was copied.  */
+
+static int
+next_slot (bool wait_any)
+{
+  int val = copy_finished_jobs ();
+  struct job *j;
+
+  while (wait_any || pending_jobs == job_slots
+	 || (pending_jobs && JOB_BACKLOG_BYTES < backlog_bytes))
+    {
+      int v;
+      wait_for_job (! wait_any);
+      v = copy_finished_jobs ();
+      if (val < v)
+	val = v;
+      wait_any = running_jobs == jobs;
+    }
+
+  j = &job[(first_job + pending_jobs) % job_slots];
+  if (j->out < 0)
+    {
+      j->out = job_temp ();
+      j->err = job_temp ();
+    }
+  return val;
+}
+
+/* Return a duplicate of FD that programs the children run do not
+   inherit.  */
+
+static int
+dup_cloexec (int fd)
+{
+  int d = dup (fd);
+  if (d < 0 || fcntl (d, F_SETFD, FD_CLOEXEC) != 0)
+    pfatal_with_name ("dup");
+  return d;
+}
+
+/* If jobs are pending, divert the parent's stdout and stderr to a new
+   slot after them, so that what it outputs follows their output.
+   Return the largest value HANDLE_FILE returned in the jobs whose
+   output was copied to make room.  */
+
+static int
+divert_output (void)
+{
+  int val;
+  struct job *j;
+
+  if (! pending_jobs || 0 <= diverted_slot)
+    return EXIT_SUCCESS;
+
+  val = next_slot (false);
+  if (! pending_jobs)
+    return val;
+
+  if (fflush (stdout) != 0)
+    pfatal_with_name (_("write failed"));
+  fflush (stderr);
+  if (saved_stdout < 0)
+    {
+      saved_stdout = dup_cloexec (STDOUT_FILENO);
+      saved_stderr = dup_cloexec (STDERR_FILENO);
+    }
+  diverted_slot = (first_job + pending_jobs) % job_slots;
+  j = &job[diverted_slot];
+  if (dup2 (j->out, STDOUT_FILENO) < 0 || dup2 (j->err, STDERR_FILENO) < 0)
+    pfatal_with_name ("dup2");
+  j->pid = 0;
+  j->done = false;
+  j->val = EXIT_SUCCESS;
+  pending_jobs++;
+  return val;
+}
+
+/* End the diversion of the parent's output, if any, letting the slot
+   it went to be copied out in turn.  */
+
+static void
+end_diversion (void)
+{
+  struct job *j;
+  off_t size;
+
+  if (diverted_slot < 0)
+    return;
+
+  if (fflush (stdout) != 0)
+    pfatal_with_name (_("write failed"));
+  fflush (stderr);
+  if (dup2 (saved_stdout, STDOUT_FILENO) < 0
+      || dup2 (saved_stderr, STDERR_FILENO) < 0)
+    pfatal_with_name ("dup2");
+  j = &job[diverted_slot];
+  size = job_output_size (j->out) + job_output_size (j->err);
+  diverted_slot = -1;
+
+  /* Give back the slot, which is the last pending one, if the parent
+     output nothing, as is usual.  */
+  if (! size)
+    pending_jobs--;
+  else
+    {
+      j->done = true;
+      backlog_bytes += size;
+    }
+}
+
+/* Whether the job after the pending ones is collecting names.  */
+static bool job_open;
+
+/* Arrange for HANDLE_FILE to be called with CMP, NAME0 and NAME1 in
+   a child process.  Return the largest value HANDLE_FILE returned in
+   any job whose output was copied meanwhile.  */
+
+static int
+queue_pair (struct comparison const *cmp,
+	    int (*handle_file) (struct comparison const *,
+				char const *, char const *),
+	    char const *name0, char const *name1)
+{
+  int val = EXIT_SUCCESS;
+  struct job *j;
+
+  if (! job)
+    {
+      int i;
+      job_slots = jobs <= INT_MAX - JOB_BACKLOG ? jobs + JOB_BACKLOG : jobs;
+      job = xnmalloc (job_slots, sizeof *job);
+      for (i = 0; i < job_slots; i++)
+	job[i].out = job[i].err = -1;
+      plan_workers ();
+    }
+
+  if (! job_open)
+    {
+      /* The parent's output so far precedes that of the new job.  */
+      end_diversion ();
+      val = next_slot (running_jobs == jobs);
+      job[(first_job + pending_jobs) % job_slots].npairs = 0;
+      job_open = true;
+    }
+
+  j = &job[(first_job + pending_jobs) % job_slots];
+  j->names[j->npairs][0] = name0;
+  j->names[j->npairs][1] = name1;
+  if (++j->npairs == JOB_PAIRS)
+    {
+      start_job (j, cmp, handle_file);
+      job_open = false;
+    }
+
+  return val;
+}
+
+/* Start the job that is collecting names, if any, and finish all
+   jobs.  Return the largest value HANDLE_FILE returned in them.  */
+
+static int
+flush_jobs (struct comparison const *cmp,
+	    int (*handle_file) (struct comparison const *,
+				char const *, char const *))
+{
+  if (job_open)
+    {
+      start_job (&job[(first_job + pending_jobs) % job_slots], cmp,
+		 handle_file);
+      job_open = false;
+    }
+  end_diversion ();
+  return finish_jobs ();
+}
+
+/* Start the job that is collecting names, if any, and let the parent
+   go on while the jobs run, diverting its output after theirs.  With
+   --progress, whose reports must not be diverted, finish all jobs
+   instead.  Return the largest value HANDLE_FILE returned in the jobs
+   whose output was copied.  */
+
+static int
+pass_jobs (struct comparison const *cmp,
+	   int (*handle_file) (struct comparison const *,
+			       char const *, char const *))
+{
+  if (show_progress)
+    return flush_jobs (cmp, handle_file);
+  if (job_open)
+    {
+      start_job (&job[(first_job + pending_jobs) % job_slots], cmp,
+		 handle_file);
+      job_open = false;
+    }
+  return divert_output ();
+}
+
+#endif
+
+/* Compare the file FIXED with each of the N files NAMES, as the first
+   file of each comparison if FIXED_FIRST and as the second otherwise,
+   by calling HANDLE_FILE with no parent, for --from-file and
+   --to-file.  With --jobs, comparisons with operands that are not
+   directories are made by child processes as in diff_dirs, which
+   share what this process has kept in memory of FIXED.  Return the
+   largest value HANDLE_FILE returned.  */
+
+int
+diff_fixed (char const *fixed, bool fixed_first, char *const *names, int n,
+	    int (*handle_file) (struct comparison const *,
+				char const *, char const *))
+{
+  int val = EXIT_SUCCESS;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      char const *name0 = fixed_first ? fixed : names[i];
+      char const *name1 = fixed_first ? names[i] : fixed;
+      int v1;
+
+#if HAVE_WORKING_FORK
+      struct stat st;
+      if (1 < jobs && ! paginate && ! manifest_name
+	  && ! output_index && output_style != OUTPUT_STAT && ! remote_count
+	  && ! STREQ (names[i], "-")
+	  && stat (names[i], &st) == 0 && ! S_ISDIR (st.st_mode))
+	v1 = queue_pair (NULL, handle_file, name0, name1);
+      else
+	{
+	  v1 = 1 < jobs ? flush_jobs (NULL, handle_file) : EXIT_SUCCESS;
+	  int v2 = (*handle_file) (NULL, name0, name1);
+	  if (v1 < v2)
+	    v1 = v2;
+	}
+#else
+      v1 = (*handle_file) (NULL, name0, name1);
+#endif
+      if (val < v1)
+	val = v1;
+    }
+
+#if HAVE_WORKING_FORK
+  if (1 < jobs)
+    {
+      int v1 = flush_jobs (NULL, handle_file);
+      if (val < v1)
+	val = v1;
+    }
+#endif
+
+  return val;
+}
+
 /* Compare the contents of two directories named in CMP.
    This is a top-level routine; it does everything necessary for diff
    on two directories.
@@ -216,9 +1348,15 @@ diff_dirs (struct comparison const *cmp,
 			       char const *, char const *))
 {
   struct dirdata dirdata[2];
+  struct name_mark mark;
   int volatile val = EXIT_SUCCESS;
+  bool entered[2];
   int i;
 
+  /* File names are sorted and matched against -x in the locale's
+     collating order.  */
+  use_locale (LC_COLLATE);
+
   if ((cmp->file[0].desc == -1 || dir_loop (cmp, 0))
       && (cmp->file[1].desc == -1 || dir_loop (cmp, 1)))
     {
@@ -227,7 +1365,11 @@ diff_dirs (struct comparison const *cmp,
       return EXIT_TROUBLE;
     }
 
+  for (i = 0; i < 2; i++)
+    entered[i] = cmp->file[i].desc != -1 && enter_dir (cmp, i);
+
   /* Get contents of both dirs.  */
+  mark = mark_names ();
   for (i = 0; i < 2; i++)
     if (! dir_read (&cmp->file[i], &dirdata[i]))
       {
@@ -238,18 +1380,36 @@ diff_dirs (struct comparison const *cmp,
   if (val == EXIT_SUCCESS)
     {
       char const **volatile names[2];
+      char const **volatile ahead[2];
+      bool volatile keyed = false;
       names[0] = dirdata[0].names;
       names[1] = dirdata[1].names;
 
-      /* Use locale-specific sorting if possible, else native byte order.  */
-      locale_specific_sorting = true;
+      /* Use locale-specific sorting if possible, else native byte order.
+	 Where the locale collates in byte order anyway, skip strcoll.  */
+      locale_specific_sorting = ignore_file_name_case || hard_collation ();
       if (setjmp (failed_locale_specific_sorting))
-	locale_specific_sorting = false;
+	{
+	  locale_specific_sorting = false;
+	  keyed = false;
+	}
 
-      /* Sort the directories.  */
-      for (i = 0; i < 2; i++)
-	qsort (names[i], dirdata[i].nnames, sizeof *dirdata[i].names,
-	       compare_names_for_qsort);
+      /* Sort the directories, by collation key if possible.  */
+      if (locale_specific_sorting && ! ignore_file_name_case && ! keyed)
+	{
+	  keyed = sort_by_keys (&dirdata[0]) && sort_by_keys (&dirdata[1]);
+	  if (! keyed)
+	    dirdata[0].keys = 0;
+	}
+      if (! keyed)
+	{
+	  for (i = 0; i < 2; i++)
+	    if (FILE_NAME_CMP_IS_STRCMP && ! locale_specific_sorting)
+	      sort_in_byte_order (&dirdata[i]);
+	    else
+	      qsort (names[i], dirdata[i].nnames, sizeof *dirdata[i].names,
+		     compare_names_for_qsort);
+	}
 
       /* If '-S name' was given, and this is the topmost level of comparison,
 	 ignore all file names less than the specified starting name.  */
@@ -262,13 +1422,43 @@ diff_dirs (struct comparison const *cmp,
 	    names[1]++;
 	}
 
+      /* With --resume, skip the names before the one that the
+	 checkpoint was written after, and that name too unless it is
+	 of a directory on the way to the pair.  */
+      {
+	bool last;
+	char const *resume_at = resume_point (&last);
+	if (resume_at)
+	  for (i = 0; i < 2; i++)
+	    while (*names[i]
+		   && compare_names (*names[i], resume_at) < last)
+	      names[i]++;
+      }
+
+      ahead[0] = names[0];
+      ahead[1] = names[1];
+      if (show_progress)
+	for (i = 0; i < 2; i++)
+	  progress.names_found += (dirdata[i].nnames
+				   - (names[i] - dirdata[i].names));
+
       /* Loop while files remain in one or both dirs.  */
       while (*names[0] || *names[1])
 	{
+	  /* Start reading the current files, if that has not been
+	     started already, and the next PREFETCH files after them, so
+	     that even --prefetch=1 has the next pair read while the
+	     current one is compared.  */
+	  if (CAN_PREFETCH && prefetch)
+	    for (i = 0; i < 2; i++)
+	      while (*ahead[i] && ahead[i] - names[i] <= prefetch)
+		prefetch_file (&cmp->file[i], *ahead[i]++);
+
 	  /* Compare next name in dir 0 with next name in dir 1.
 	     At the end of a dir,
 	     pretend the "next name" in that dir is very large.  */
 	  int nameorder = (!*names[0] ? 1 : !*names[1] ? -1
+			   : keyed ? compare_keys (dirdata, names[0], names[1])
 			   : compare_names (*names[0], *names[1]));
 
 	  /* Prefer a file_name_cmp match if available.  This algorithm is
@@ -305,18 +1495,66 @@ diff_dirs (struct comparison const *cmp,
 		}
 	    }
 
-	  int v1 = (*handle_file) (cmp,
-				   0 < nameorder ? 0 : *names[0]++,
-				   nameorder < 0 ? 0 : *names[1]++);
+	  char const *name0 = 0 < nameorder ? 0 : *names[0]++;
+	  char const *name1 = nameorder < 0 ? 0 : *names[1]++;
+	  int v1;
+
+	  progress.names_done += !!name0 + !!name1;
+	  progress_tick ();
+
+	  if ((! name0 || left_out (cmp, name0, 0))
+	      && (! name1 || left_out (cmp, name1, 1)))
+	    continue;
+
+	  if (find_renames && ! (name0 && name1)
+	      && set_aside_lone_file (cmp, name0, name1))
+	    continue;
+
+#if HAVE_WORKING_FORK
+	  if (1 < jobs && ! paginate && ! manifest_name
+	      && ! output_index && output_style != OUTPUT_STAT
+	      && ! remote_count && ! checkpoint_name
+	      && ! (name0 && MAYBE_DIR (name0))
+	      && ! (name1 && MAYBE_DIR (name1)))
+	    v1 = queue_pair (cmp, handle_file, name0, name1);
+	  else
+	    {
+	      /* Output from a subdirectory must follow that of the
+		 files before it.  */
+	      v1 = 1 < jobs ? pass_jobs (cmp, handle_file) : EXIT_SUCCESS;
+	      checkpoint_begin (name0 ? name0 : name1);
+	      int v2 = (*handle_file) (cmp, name0, name1);
+	      checkpoint_end (v2);
+	      if (v1 < v2)
+		v1 = v2;
+	    }
+#else
+	  checkpoint_begin (name0 ? name0 : name1);
+	  v1 = (*handle_file) (cmp, name0, name1);
+	  checkpoint_end (v1);
+#endif
+	  if (val < v1)
+	    val = v1;
+	}
+
+#if HAVE_WORKING_FORK
+      /* The jobs of a subdirectory can go on while the parent
+	 directory's later files are compared.  */
+      if (1 < jobs)
+	{
+	  int v1 = (cmp->parent ? pass_jobs (cmp, handle_file)
+		    : flush_jobs (cmp, handle_file));
 	  if (val < v1)
 	    val = v1;
 	}
+#endif
     }
 
+  release_names (mark);
   for (i = 0; i < 2; i++)
     {
-      free (dirdata[i].names);
-      free (dirdata[i].data);
+      if (entered[i])
+	hash_delete (active_dirs[i], &cmp->file[i].stat);
     }
 
   return val;
@@ -327,11 +1565,43 @@ diff_dirs (struct comparison const *cmp,
 static bool _GL_ATTRIBUTE_PURE
 dir_loop (struct comparison const *cmp, int i)
 {
-  struct comparison const *p = cmp;
-  while ((p = p->parent))
-    if (0 < same_file (&p->file[i].stat, &cmp->file[i].stat))
-      return true;
-  return false;
+  return (active_dirs[i]
+	  && hash_lookup (active_dirs[i], &cmp->file[i].stat));
+}
+
+static size_t
+hash_dir (void const *entry, size_t table_size)
+{
+  struct stat const *st = entry;
+  return (size_t) (st->st_ino ^ ((uintmax_t) st->st_dev << 7)) % table_size;
+}
+
+static bool
+same_dir (void const *entry1, void const *entry2)
+{
+  return 0 < same_file ((struct stat const *) entry1,
+			(struct stat const *) entry2);
+}
+
+/* Add the directory in argument I of CMP to the active directories.
+   Return true if it was not there already.  */
+
+static bool
+enter_dir (struct comparison const *cmp, int i)
+{
+  void const *st = &cmp->file[i].stat;
+  void *found;
+
+  if (! active_dirs[i])
+    {
+      active_dirs[i] = hash_initialize (0, NULL, hash_dir, same_dir, NULL);
+      if (! active_dirs[i])
+	xalloc_die ();
+    }
+  found = hash_insert (active_dirs[i], st);
+  if (! found)
+    xalloc_die ();
+  return found == st;
 }
 
 /* Find a matching filename in a directory.  */
@@ -347,14 +1617,13 @@ find_dir_file_pathname (char const *dir, char const *file)
 
   char *val;
   struct dirdata dirdata;
-  dirdata.names = NULL;
-  dirdata.data = NULL;
+  struct name_mark mark = mark_names ();
 
   if (ignore_file_name_case)
     {
       struct file_data filedata;
       filedata.name = dir;
-      filedata.desc = 0;
+      filedata.desc = UNOPENED;
 
       if (dir_read (&filedata, &dirdata))
 	{
@@ -379,7 +1648,301 @@ find_dir_file_pathname (char const *dir, char const *file)
     }
 
   val = file_name_concat (dir, match, NULL);
-  free (dirdata.names);
-  free (dirdata.data);
+  release_names (mark);
+  return val;
+}
+
+/* With --find-renames, the regular files that are in only one of two
+   directories being compared are set aside until all directories have
+   been compared.  Then each file that is only in a first directory is
+   paired with a file of the same contents that is only in a second
+   directory, wherever the two are, and the rest are handled as usual.  */
+
+struct lone_file
+{
+  char *dir[2];		/* The names of the two directories.  */
+  bool dir_exists[2];	/* Whether each directory exists.  */
+  char *name;		/* The file's name within its directory.  */
+  int side;		/* 0 if the file is in dir[0], 1 if in dir[1].  */
+  off_t size;
+  size_t hash;		/* Hash of the contents, if they were read.  */
+  bool hashed;
+  size_t partner;	/* Index of the file paired with, or SIZE_MAX.  */
+};
+
+static struct lone_file *lone_files;
+static size_t lone_files_used;
+static size_t lone_files_alloc;
+
+/* Return true if --include leaves out the file NAME in the directory
+   of CMP's side SIDE: if its name matches no pattern, and it is not a
+   directory.  Only files whose type readdir could not tell, and which
+   might be directories, need to be looked at here.  */
+
+static bool
+left_out (struct comparison const *cmp, char const *name, int side)
+{
+  struct file_data const *dir = &cmp->file[side];
+  struct stat st;
+  int r;
+
+  if (! NOT_INCLUDED (name))
+    return false;
+
+#ifdef AT_FDCWD
+  if (0 <= dir->desc)
+    r = file_status (dir->desc, name, &st, no_dereference_symlinks);
+  else
+#endif
+    {
+      char *file = file_name_concat (dir->name, name, NULL);
+      r = file_status (-1, file, &st, no_dereference_symlinks);
+      free (file);
+    }
+  return r != 0 || ! S_ISDIR (st.st_mode);
+}
+
+/* Set aside the file NAME0 or NAME1 (the other is null) of the
+   directories of CMP, if it is a nonempty regular file.
+   Return true if it was set aside.  */
+
+static bool
+set_aside_lone_file (struct comparison const *cmp,
+		     char const *name0, char const *name1)
+{
+  int side = ! name0;
+  char const *name = side ? name1 : name0;
+  struct file_data const *dir = &cmp->file[side];
+  struct stat st;
+  struct lone_file *l;
+  int r;
+  int f;
+
+  if (! (KNOWN_REG (name) || MAYBE_DIR (name)))
+    return false;
+
+#ifdef AT_FDCWD
+  if (0 <= dir->desc)
+    r = file_status (dir->desc, name, &st, no_dereference_symlinks);
+  else
+#endif
+    {
+      char *file = file_name_concat (dir->name, name, NULL);
+      r = file_status (-1, file, &st, no_dereference_symlinks);
+      free (file);
+    }
+  if (r != 0 || ! S_ISREG (st.st_mode) || st.st_size == 0)
+    return false;
+
+  if (lone_files_used == lone_files_alloc)
+    lone_files = x2nrealloc (lone_files, &lone_files_alloc,
+			     sizeof *lone_files);
+  l = &lone_files[lone_files_used++];
+  for (f = 0; f < 2; f++)
+    {
+      l->dir[f] = xstrdup (cmp->file[f].name);
+      l->dir_exists[f] = cmp->file[f].desc != NONEXISTENT;
+    }
+  l->name = xstrdup (name);
+  l->side = side;
+  l->size = st.st_size;
+  l->hash = 0;
+  l->hashed = false;
+  l->partner = SIZE_MAX;
+  return true;
+}
+
+/* Read the contents of the lone file L and set its hash.  On failure,
+   leave it unhashed, so that it is not paired.  */
+
+static void
+hash_lone_file (struct lone_file *l)
+{
+  char *file = file_name_concat (l->dir[l->side], l->name, NULL);
+  int desc = open (file, O_RDONLY | O_BINARY);
+  if (0 <= desc)
+    {
+      char buf[64 * 1024];
+      size_t h = 0;
+      size_t bytes;
+      while ((bytes = block_read (desc, buf, sizeof buf)) != 0
+	     && bytes != SIZE_MAX)
+	{
+	  size_t i;
+	  for (i = 0; i < bytes; i++)
+	    h = h * 31 + (unsigned char) buf[i];
+	}
+      l->hash = h;
+      l->hashed = bytes == 0;
+      close (desc);
+    }
+  free (file);
+}
+
+/* Return true if the lone files L0 and L1 have the same contents.  */
+
+static bool
+same_lone_contents (struct lone_file const *l0, struct lone_file const *l1)
+{
+  struct lone_file const *l[2];
+  char *file[2];
+  int desc[2];
+  bool same = true;
+  int f;
+
+  l[0] = l0;
+  l[1] = l1;
+  for (f = 0; f < 2; f++)
+    {
+      file[f] = file_name_concat (l[f]->dir[l[f]->side], l[f]->name, NULL);
+      desc[f] = open (file[f], O_RDONLY | O_BINARY);
+      same &= 0 <= desc[f];
+    }
+
+  while (same)
+    {
+      char buf[2][32 * 1024];
+      size_t bytes0 = block_read (desc[0], buf[0], sizeof buf[0]);
+      size_t bytes1 = block_read (desc[1], buf[1], sizeof buf[1]);
+      same = (bytes0 == bytes1 && bytes0 != SIZE_MAX
+	      && memcmp (buf[0], buf[1], bytes0) == 0);
+      if (bytes0 == 0)
+	break;
+    }
+
+  for (f = 0; f < 2; f++)
+    {
+      if (0 <= desc[f])
+	close (desc[f]);
+      free (file[f]);
+    }
+  return same;
+}
+
+static int
+compare_lone_files (void const *p1, void const *p2)
+{
+  struct lone_file const *l1 = &lone_files[*(size_t const *) p1];
+  struct lone_file const *l2 = &lone_files[*(size_t const *) p2];
+  if (l1->size != l2->size)
+    return l1->size < l2->size ? -1 : 1;
+  if (l1->hashed != l2->hashed)
+    return l1->hashed < l2->hashed ? -1 : 1;
+  if (l1->hash != l2->hash)
+    return l1->hash < l2->hash ? -1 : 1;
+  if (l1->side != l2->side)
+    return l1->side - l2->side;
+  return l1 < l2 ? -1 : l1 != l2;
+}
+
+/* Pair up the files set aside by diff_dirs, and report each pair as a
+   file that was moved.  Call HANDLE_FILE as diff_dirs would for each
+   file left over.  Return the maximum of the values returned by
+   HANDLE_FILE and of EXIT_FAILURE if any file was moved.  */
+
+int
+diff_lone_files (int (*handle_file) (struct comparison const *,
+				     char const *, char const *))
+{
+  size_t n = lone_files_used;
+  size_t *order = xnmalloc (n, sizeof *order);
+  int val = EXIT_SUCCESS;
+  size_t i, j, k;
+
+  /* Hash the files that have a file of the same size on the other
+     side, and sort them so that those with the same contents are
+     together, the first directory's before the second's.  */
+  for (i = 0; i < n; i++)
+    order[i] = i;
+  qsort (order, n, sizeof *order, compare_lone_files);
+  for (i = 0; i < n; i = j)
+    {
+      bool both_sides = false;
+      for (j = i + 1;
+	   j < n && lone_files[order[j]].size == lone_files[order[i]].size;
+	   j++)
+	both_sides |= (lone_files[order[j]].side
+		       != lone_files[order[i]].side);
+      if (both_sides)
+	{
+	  for (k = i; k < j; k++)
+	    hash_lone_file (&lone_files[order[k]]);
+	  qsort (order + i, j - i, sizeof *order, compare_lone_files);
+	}
+    }
+
+  /* Pair the files in each run of the same contents in order.  */
+  for (i = 0; i < n; i = j)
+    {
+      struct lone_file const *li = &lone_files[order[i]];
+      size_t first1;
+      for (j = i + 1;
+	   (j < n && li->hashed
+	    && lone_files[order[j]].size == li->size
+	    && lone_files[order[j]].hashed
+	    && lone_files[order[j]].hash == li->hash);
+	   j++)
+	continue;
+      for (first1 = i; first1 < j && lone_files[order[first1]].side == 0;
+	   first1++)
+	continue;
+      for (k = first1; i < first1 && k < j; k++)
+	{
+	  size_t k0;
+	  for (k0 = i; k0 < first1; k0++)
+	    if (lone_files[order[k0]].partner == SIZE_MAX
+		&& same_lone_contents (&lone_files[order[k0]],
+				       &lone_files[order[k]]))
+	      {
+		lone_files[order[k0]].partner = order[k];
+		lone_files[order[k]].partner = order[k0];
+		break;
+	      }
+	}
+    }
+  free (order);
+
+  /* Report the files in the order they were found.  */
+  for (i = 0; i < n; i++)
+    {
+      struct lone_file *l = &lone_files[i];
+      int v1 = EXIT_SUCCESS;
+
+      if (l->partner == SIZE_MAX)
+	{
+	  struct comparison parent;
+	  int f;
+	  memset (&parent, 0, sizeof parent);
+	  for (f = 0; f < 2; f++)
+	    {
+	      parent.file[f].name = l->dir[f];
+	      parent.file[f].desc = l->dir_exists[f] ? UNOPENED : NONEXISTENT;
+	    }
+	  v1 = (*handle_file) (&parent, l->side ? 0 : l->name,
+			       l->side ? l->name : 0);
+	}
+      else if (l->side == 0)
+	{
+	  struct lone_file const *l1 = &lone_files[l->partner];
+	  char *file0 = file_name_concat (l->dir[0], l->name, NULL);
+	  char *file1 = file_name_concat (l1->dir[1], l1->name, NULL);
+	  message ("File %s was moved to %s\n", file0, file1);
+	  free (file0);
+	  free (file1);
+	  v1 = EXIT_FAILURE;
+	}
+      if (val < v1)
+	val = v1;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      free (lone_files[i].dir[0]);
+      free (lone_files[i].dir[1]);
+      free (lone_files[i].name);
+    }
+  free (lone_files);
+  lone_files = NULL;
+  lone_files_used = lone_files_alloc = 0;
   return val;
 }
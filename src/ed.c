@@ -19,17 +19,43 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "diff.h"
+#include <rewrite.h>
 
 static void print_ed_hunk (struct change *);
 static void print_rcs_hunk (struct change *);
 static void pr_forward_ed_hunk (struct change *);
 
-/* Print our script as ed commands.  */
+/* Reverse the links of the edit script SCRIPT in place, and return
+   its new head.  */
+
+static struct change *
+reverse_script (struct change *script)
+{
+  struct change *reversed = 0;
+
+  while (script)
+    {
+      struct change *next = script->link;
+      script->link = reversed;
+      reversed = script;
+      script = next;
+    }
+
+  return reversed;
+}
+
+/* Print our script as ed commands.  The commands change the last
+   lines first, so that each one's line numbers are still those of
+   the first file.  The script is in forward order, as for the other
+   output styles, so walk it backwards by reversing its links while
+   it is printed.  */
 
 void
 print_ed_script (struct change *script)
 {
-  print_script (script, find_reverse_change, print_ed_hunk);
+  struct change *reversed = reverse_script (script);
+  print_script (reversed, find_reverse_change, print_ed_hunk);
+  reverse_script (reversed);
 }
 
 /* Print a hunk of an ed diff */
@@ -59,26 +85,45 @@ print_ed_hunk (struct change *hunk)
   /* Print new/changed lines from second file, if needed */
   if (changes != OLD)
     {
+      char const *const *linbuf = files[1].linbuf;
       lin i;
+      lin run = f1;
       bool insert_mode = true;
 
+      /* Print the lines between those that are just a dot in runs.
+	 Such a line is the only kind two bytes long that starts with
+	 a dot, so look at the text of only the lines of that length.
+	 Their lengths come from the table of lines, which is much
+	 smaller than the text, so that a long run of inserted lines
+	 costs little more than copying it out.  */
       for (i = f1; i <= l1; i++)
+	if (linbuf[i + 1] - linbuf[i] == 2 && linbuf[i][0] == '.')
+	  {
+	    if (run < i && !insert_mode)
+	      {
+		fputs ("a\n", outfile);
+		insert_mode = true;
+	      }
+	    print_bare_lines (&files[1], run, i - 1);
+
+	    /* The file's line is just a dot, and it would exit
+	       insert mode.  Precede the dot with another dot, exit
+	       insert mode and remove the extra dot.  */
+	    if (!insert_mode)
+	      fputs ("a\n", outfile);
+	    fputs ("..\n.\ns/.//\n", outfile);
+	    insert_mode = false;
+	    run = i + 1;
+	  }
+
+      if (run <= l1)
 	{
 	  if (!insert_mode)
 	    {
 	      fputs ("a\n", outfile);
 	      insert_mode = true;
 	    }
-	  if (files[1].linbuf[i][0] == '.' && files[1].linbuf[i][1] == '\n')
-	    {
-	      /* The file's line is just a dot, and it would exit
-		 insert mode.  Precede the dot with another dot, exit
-		 insert mode and remove the extra dot.  */
-	      fputs ("..\n.\ns/.//\n", outfile);
-	      insert_mode = false;
-	    }
-	  else
-	    print_1_line ("", &files[1].linbuf[i]);
+	  print_bare_lines (&files[1], run, l1);
 	}
 
       if (insert_mode)
@@ -101,7 +146,7 @@ pr_forward_ed_script (struct change *script)
 static void
 pr_forward_ed_hunk (struct change *hunk)
 {
-  lin i, f0, l0, f1, l1;
+  lin f0, l0, f1, l1;
 
   /* Determine range of line numbers involved in each file.  */
   enum changes changes = analyze_hunk (hunk, &f0, &l0, &f1, &l1);
@@ -122,8 +167,7 @@ pr_forward_ed_hunk (struct change *hunk)
   /* For insertion (with or without deletion), print the number range
      and the lines from file 2.  */
 
-  for (i = f1; i <= l1; i++)
-    print_1_line ("", &files[1].linbuf[i]);
+  print_bare_lines (&files[1], f1, l1);
 
   fputs (".\n", outfile);
 }
@@ -143,7 +187,7 @@ print_rcs_script (struct change *script)
 static void
 print_rcs_hunk (struct change *hunk)
 {
-  lin i, f0, l0, f1, l1;
+  lin f0, l0, f1, l1;
   long int tf0, tl0, tf1, tl1;
 
   /* Determine range of line numbers involved in each file.  */
@@ -169,7 +213,77 @@ print_rcs_hunk (struct change *hunk)
       fprintf (outfile, "a%ld %ld\n", tl0, tf1 <= tl1 ? tl1 - tf1 + 1 : 1);
 
       /* Print the inserted lines.  */
-      for (i = f1; i <= l1; i++)
-	print_1_line ("", &files[1].linbuf[i]);
+      print_bare_lines (&files[1], f1, l1);
+    }
+}
+
+/* Write the first file over with the changes that print_ed_script
+   would output as ed commands, as ed would with a final w command:
+   the second file's lines replace the first's in each hunk, and the
+   lines between the hunks, including those of hunks that -B or -I
+   ignore, stay as they were.  Each run of the first file's unchanged
+   bytes is copied whole.  */
+
+void
+apply_ed_script (struct change *script)
+{
+  char const *const *linbuf0 = files[0].linbuf;
+  char const *const *linbuf1 = files[1].linbuf;
+  char const *pos = FILE_BUFFER (&files[0]);
+  char const *end0 = pos + files[0].buffered;
+  char const *ins = pos;
+  char const *ins_lim = pos;
+  struct change *next = script;
+  bool changed = false;
+  FILE *out;
+  int err;
+
+  if (files[0].desc == STDIN_FILENO)
+    fatal ("cannot apply changes to standard input");
+
+  out = tmpfile ();
+  if (! out)
+    pfatal_with_name ("tmpfile");
+
+  while (next)
+    {
+      struct change *this = next;
+      struct change *end = find_change (next);
+      lin f0, l0, f1, l1;
+      enum changes changes;
+
+      next = end->link;
+      end->link = 0;
+      changes = analyze_hunk (this, &f0, &l0, &f1, &l1);
+      end->link = next;
+      if (!changes)
+	continue;
+
+      /* The lines inserted by the previous hunk go before the
+	 unchanged lines that follow it.  */
+      fwrite (ins, 1, ins_lim - ins, out);
+      fwrite (pos, 1, linbuf0[f0] - pos, out);
+      ins = linbuf1[f1];
+      ins_lim = linbuf1[l1 + 1];
+      pos = linbuf0[l0 + 1];
+      changed = true;
+    }
+
+  /* The newline appended on input to a file that lacks one is not
+     part of any of its lines.  */
+  fwrite (ins, 1, ins_lim - ins, out);
+  fwrite (pos, 1, end0 - files[0].missing_newline - pos, out);
+
+  if (ferror (out))
+    pfatal_with_name ("tmpfile");
+  if (changed)
+    {
+      err = rewrite_file (files[0].name, out);
+      if (err)
+	{
+	  errno = err;
+	  pfatal_with_name (files[0].name);
+	}
     }
+  fclose (out);
 }
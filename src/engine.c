@@ -0,0 +1,885 @@
+/* diff's comparison engine, for programs other than diff
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* The option variables that the engine's modules share are defined
+   here rather than in diff.c, so that programs other than diff can
+   link the engine without diff's main program.  */
+#define GDIFF_MAIN
+#include "diff.h"
+#include "engine.h"
+#include <binary-io.h>
+#include <intprops.h>
+#include <xalloc.h>
+
+/* A context for comparisons; see engine.h.  */
+
+struct engine_context
+{
+  /* The options to compare with.  Their regexps, compiled, are in
+     REGEXPS, which compiles the disjunction of them into REGEXP.  */
+  struct engine_options options;
+  struct regexp_list regexps;
+  struct re_pattern_buffer regexp;
+
+  /* The latest comparison's files, whose text its hunks point into,
+     and whether their buffers are still to be freed.  */
+  struct file_data file[2];
+  bool have_files;
+
+  /* The latest comparison's hunks, and the arrays of line addresses
+     that they point into, along with any copies of text that
+     engine_compare_buffers and engine_replace_lines made.  */
+  struct engine_hunk *hunks;
+  void **arrays;
+  size_t narrays;
+  size_t arrays_alloc;
+
+  /* The names that engine_compare_fds gives the files in messages.  */
+  char name[2][sizeof "/dev/fd/" + INT_STRLEN_BOUND (int)];
+
+  /* Once engine_replace_lines has been called, the address and length
+     of each line of the latest comparison's texts, as edited, and the
+     number of lines that the second text's arrays have room for.  */
+  bool editing;
+  char **edit_line[2];
+  size_t *edit_length[2];
+  lin edit_lines[2];
+  lin edit_alloc;
+};
+
+/* The end of the list of hunks that engine_compare is building, and
+   the context that owns them, if any.  */
+
+struct hunk_list
+{
+  struct engine_hunk **end;
+  struct engine_context *context;
+};
+
+/* The file that engine_retain has kept in memory, and its name, or
+   null if there is none.  */
+
+static struct file_data retained_file;
+static char const *retained_name;
+
+/* The options that engine_init was given.  */
+
+static struct engine_context init_context;
+
+/* The function that engine_side_by_side calls for each run, its
+   argument, and whether it has been called for a hunk.  */
+
+static void (*run_function) (struct engine_run const *, void *);
+static void *run_arg;
+static bool run_changed;
+
+/* Compile the regexps of CTX's options.  */
+
+static void
+compile_regexps (struct engine_context *ctx)
+{
+  char const *const *r = ctx->options.ignore_regexps;
+
+  if (r)
+    {
+      ctx->regexps.buf = &ctx->regexp;
+      ctx->regexps.indexed = true;
+      re_set_syntax (RE_SYNTAX_GREP | RE_NO_POSIX_BACKTRACKING);
+      for (; *r; r++)
+	add_regexp (&ctx->regexps, *r);
+      summarize_regexp_list (&ctx->regexps);
+      ctx->options.ignore_regexps = NULL;
+    }
+}
+
+/* Set the engine's options to those of CTX.  */
+
+static void
+use_context (struct engine_context const *ctx)
+{
+  struct engine_options const *options = &ctx->options;
+
+  output_style = OUTPUT_NORMAL;
+  no_diff_means_no_output = true;
+  text = options->text;
+  strip_trailing_cr = options->strip_trailing_cr;
+  horizon_lines = options->horizon_lines;
+  ignore_case = options->ignore_case;
+  ignore_blank_lines = options->ignore_blank_lines;
+  minimal = options->minimal;
+  speed_large_files = options->speed_large_files;
+  max_memory = options->max_memory;
+  tabsize = 8;
+  outfile = stdout;
+
+  if (options->ignore_all_space)
+    ignore_white_space = IGNORE_ALL_SPACE;
+  else if (options->ignore_space_change)
+    ignore_white_space = IGNORE_SPACE_CHANGE;
+  else
+    ignore_white_space = ((options->ignore_tab_expansion
+			   ? IGNORE_TAB_EXPANSION : IGNORE_NO_WHITE_SPACE)
+			  | (options->ignore_trailing_space
+			     ? IGNORE_TRAILING_SPACE : IGNORE_NO_WHITE_SPACE));
+
+  ignore_regexp = ctx->regexp;
+  ignore_regexp_set = ctx->regexps.set;
+}
+
+/* Set up the engine to compare files as normal-format 'diff' would
+   with OPTIONS.  Call this once, before engine_compare.  */
+
+void
+engine_init (struct engine_options const *options)
+{
+  init_context.options = *options;
+  compile_regexps (&init_context);
+  use_context (&init_context);
+}
+
+/* Record that the array P belongs to CTX's latest comparison,
+   and is to be freed with its hunks.  */
+
+static void
+keep_array (struct engine_context *ctx, void *p)
+{
+  if (ctx->arrays_alloc == ctx->narrays)
+    ctx->arrays = x2nrealloc (ctx->arrays, &ctx->arrays_alloc,
+			      sizeof *ctx->arrays);
+  ctx->arrays[ctx->narrays++] = p;
+}
+
+/* Make the lines from FIRST through LAST of FILE the lines of HUNK's
+   file F, storing the starts of the lines and the end of the last
+   into the array at *LINBUF and advancing it past them.  */
+
+static void
+set_lines (struct engine_hunk *hunk, int f, struct file_data const *file,
+	   lin first, lin last, char const ***linbuf)
+{
+  lin n = last - first + 1;
+
+  hunk->linbuf[f] = *linbuf;
+  memcpy (*linbuf, file->linbuf + first, (n + 1) * sizeof **linbuf);
+  *linbuf += n + 1;
+}
+
+/* Append the changes in SCRIPT, whose line numbers refer to the lines
+   of FILE, to the hunk list ARG, leaving out those that -B or -I
+   would have 'diff' leave out.  The tables of the lines of all the
+   hunks are allocated together, one array for each file, and are
+   added to the arrays of ARG's context if it has one.  */
+
+static void
+add_hunks (struct change *script, struct file_data const file[],
+	   void *arg)
+{
+  struct hunk_list *list = arg;
+  struct change *e;
+  lin entries[2];
+  char const **linbuf[2];
+  int f;
+
+  /* A hunk's table holds one more entry than its lines, for the end
+     of the last.  */
+  entries[0] = entries[1] = 0;
+  for (e = script; e; e = e->link)
+    {
+      entries[0] += e->deleted ? e->deleted + 1 : 0;
+      entries[1] += e->inserted ? e->inserted + 1 : 0;
+    }
+  for (f = 0; f < 2; f++)
+    {
+      linbuf[f] = (entries[f]
+		   ? xnmalloc (entries[f], sizeof *linbuf[f]) : NULL);
+      if (list->context && entries[f])
+	keep_array (list->context, linbuf[f]);
+    }
+
+  for (e = script; e; e = e->link)
+    {
+      struct engine_hunk *hunk;
+      struct change *next = e->link;
+      lin first[2], last[2];
+      enum changes changes;
+
+      e->link = NULL;
+      changes = analyze_hunk (e, &first[0], &last[0], &first[1], &last[1]);
+      e->link = next;
+      if (! changes)
+	continue;
+
+      hunk = xzalloc (sizeof *hunk);
+      first[0] = e->line0;
+      last[0] = e->line0 + e->deleted - 1;
+      first[1] = e->line1;
+      last[1] = e->line1 + e->inserted - 1;
+
+      for (f = 0; f < 2; f++)
+	{
+	  hunk->first[f] = translate_line_number (&file[f], first[f]);
+	  hunk->last[f] = hunk->first[f] + (last[f] - first[f]);
+	  if (first[f] <= last[f])
+	    set_lines (hunk, f, &file[f], first[f], last[f], &linbuf[f]);
+	}
+
+      *list->end = hunk;
+      list->end = &hunk->next;
+    }
+}
+
+/* Open the files named NAME0 and NAME1 for CMP, either of which may
+   be "-" for standard input.  Exit if a file cannot be opened.  */
+
+static void
+open_files (struct comparison *cmp, char const *name0, char const *name1)
+{
+  int f;
+
+  memset (cmp, 0, sizeof *cmp);
+  cmp->file[0].name = name0;
+  cmp->file[1].name = name1;
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *file = &cmp->file[f];
+
+      if (STREQ (file->name, "-"))
+	{
+	  off_t pos;
+	  file->desc = STDIN_FILENO;
+	  if (fstat (STDIN_FILENO, &file->stat) != 0)
+	    pfatal_with_name (file->name);
+	  if (S_ISREG (file->stat.st_mode))
+	    {
+	      pos = lseek (STDIN_FILENO, 0, SEEK_CUR);
+	      if (pos < 0)
+		pfatal_with_name (file->name);
+	      file->stat.st_size = MAX (0, file->stat.st_size - pos);
+	    }
+	}
+      else if (f && file_name_cmp (file->name, cmp->file[0].name) == 0)
+	{
+	  file->desc = cmp->file[0].desc;
+	  file->stat = cmp->file[0].stat;
+	}
+      else if (f && retained_name
+	       && file_name_cmp (file->name, retained_name) == 0)
+	*file = retained_file;
+      else if ((file->desc = open (file->name, O_RDONLY | O_BINARY)) < 0
+	       || fstat (file->desc, &file->stat) != 0)
+	pfatal_with_name (file->name);
+    }
+}
+
+/* Close the files that open_files opened for CMP.  */
+
+static void
+close_files (struct comparison const *cmp)
+{
+  int f;
+
+  for (f = 0; f < 2; f++)
+    if (! STREQ (cmp->file[f].name, "-") && ! cmp->file[f].retained
+	&& ! (f && cmp->file[1].desc == cmp->file[0].desc)
+	&& close (cmp->file[f].desc) != 0)
+      pfatal_with_name (cmp->file[f].name);
+}
+
+/* Compare the files named NAME0 and NAME1, either of which may be "-"
+   for standard input, and store a list of the hunks of differences
+   between them into *HUNKS.  The files' text stays in memory for the
+   hunks to point into.  Return 0 if the files are the same, 1 if
+   they differ, and -1 without storing any hunks if either is binary
+   and they differ.  Exit if a file cannot be read.  */
+
+int
+engine_compare (char const *name0, char const *name1,
+		struct engine_hunk **hunks)
+{
+  struct comparison cmp;
+  struct hunk_list list;
+  int changes;
+
+  open_files (&cmp, name0, name1);
+  *hunks = NULL;
+  list.end = hunks;
+  list.context = NULL;
+  changes = script_2_files (&cmp, add_hunks, &list);
+  close_files (&cmp);
+  return 0 < changes && ! *hunks ? 0 : changes;
+}
+
+/* Keep the file NAME, which must not be "-", in memory along with
+   what comparisons find out about its lines, and use them in every
+   later comparison that names the file as its second file.  Do
+   nothing if the file appears to be binary.  Exit if the file cannot
+   be read.  */
+
+void
+engine_retain (char const *name)
+{
+  struct file_data *file = &retained_file;
+
+  file->name = name;
+  if ((file->desc = open (name, O_RDONLY | O_BINARY)) < 0
+      || fstat (file->desc, &file->stat) != 0)
+    pfatal_with_name (name);
+  if (retain_file (file))
+    retained_name = name;
+  if (close (file->desc) != 0)
+    pfatal_with_name (name);
+  file->desc = -1;
+}
+
+/* Pass to run_function the run of lines FIRST0 up to LIMIT0 of the
+   first file and FIRST1 up to LIMIT1 of the second, which are a hunk
+   if CHANGED.  */
+
+static void
+call_run_function (bool changed, lin first0, lin limit0,
+		   lin first1, lin limit1)
+{
+  struct engine_run run;
+  lin first[2], limit[2];
+  int f;
+
+  first[0] = first0;
+  limit[0] = limit0;
+  first[1] = first1;
+  limit[1] = limit1;
+
+  run.changed = changed;
+  for (f = 0; f < 2; f++)
+    {
+      run.lines[f] = limit[f] - first[f];
+      run.text[f] = files[f].linbuf[first[f]];
+      run.size[f] = files[f].linbuf[limit[f]] - files[f].linbuf[first[f]];
+      run.first[f] = first[f];
+    }
+
+  run_changed |= changed;
+  run_function (&run, run_arg);
+}
+
+/* Output SCRIPT, whose line numbers refer to the lines of FILE, side
+   by side, and then tell run_function that the text of the runs is
+   about to go away.  */
+
+static void
+print_side_by_side (struct change *script, struct file_data const file[],
+		    void *arg)
+{
+  print_sdiff_script (script);
+  run_function (NULL, run_arg);
+}
+
+/* Compare the files named NAME0 and NAME1, either of which may be "-"
+   for standard input, as 'diff --side-by-side' would with OPTIONS.
+   Call RUN with ARG for each run of common lines and each hunk of
+   differences, in order; RUN may call engine_show_run to output the
+   run side by side on standard output.  After the runs of each window
+   of the files, call RUN with a null run; the text of the runs passed
+   so far is freed or overwritten after that call returns.  Return 0 if the files are
+   the same, 1 if they differ, and -1 without calling RUN if either is
+   binary and they differ.  Exit if a file cannot be read.  */
+
+int
+engine_side_by_side (char const *name0, char const *name1,
+		     struct engine_sdiff_options const *options,
+		     void (*run) (struct engine_run const *, void *),
+		     void *arg)
+{
+  struct comparison cmp;
+  int changes;
+
+  output_style = OUTPUT_SDIFF;
+  no_diff_means_no_output = false;
+  left_column = options->left_column;
+  expand_tabs = options->expand_tabs;
+  tabsize = options->tabsize ? options->tabsize : 8;
+  set_sdiff_width (options->width ? options->width : 130);
+  sdiff_run_hook = call_run_function;
+  run_function = run;
+  run_arg = arg;
+  run_changed = false;
+
+  open_files (&cmp, name0, name1);
+  changes = script_2_files (&cmp, print_side_by_side, NULL);
+  close_files (&cmp);
+  return changes < 0 ? changes : run_changed;
+}
+
+/* Output RUN, which engine_side_by_side has just passed to its run
+   function, side by side.  */
+
+void
+engine_show_run (struct engine_run const *run)
+{
+  print_sdiff_run (run->changed, run->first[0],
+		   run->first[0] + run->lines[0], run->first[1],
+		   run->first[1] + run->lines[1]);
+}
+
+/* Return a new context for comparing files as normal-format 'diff'
+   would with OPTIONS.  The context does not refer to OPTIONS, or to
+   its regexps, after this returns.  */
+
+struct engine_context *
+engine_context_new (struct engine_options const *options)
+{
+  struct engine_context *ctx = xzalloc (sizeof *ctx);
+  ctx->options = *options;
+  compile_regexps (ctx);
+  return ctx;
+}
+
+/* Free the hunks of CTX's latest comparison, and the text they
+   point into.  */
+
+static void
+free_result (struct engine_context *ctx)
+{
+  struct engine_hunk *hunk = ctx->hunks;
+
+  while (hunk)
+    {
+      struct engine_hunk *next = hunk->next;
+      free (hunk);
+      hunk = next;
+    }
+  ctx->hunks = NULL;
+
+  while (ctx->narrays)
+    free (ctx->arrays[--ctx->narrays]);
+
+  if (ctx->editing)
+    {
+      int f;
+      for (f = 0; f < 2; f++)
+	{
+	  free (ctx->edit_line[f]);
+	  free (ctx->edit_length[f]);
+	}
+      ctx->editing = false;
+    }
+
+  if (ctx->have_files)
+    {
+      if (ctx->file[0].buffer != ctx->file[1].buffer)
+	file_buffer_free (&ctx->file[0]);
+      file_buffer_free (&ctx->file[1]);
+      ctx->have_files = false;
+    }
+}
+
+/* Compare the files open on FD0 and FD1 with CTX's options, from
+   their current offsets, and store a list of the hunks of differences
+   between them into *HUNKS.  The hunks, and the text of the files that
+   they point into, belong to CTX, and last until its next
+   comparison or until it is freed.  Return as engine_compare does.
+   Exit if a file cannot be read.  */
+
+/* Compare the files of CMP, which have been set up but not read,
+   with CTX's options, and store the hunks into *HUNKS.  */
+
+static int
+compare_in_context (struct engine_context *ctx, struct comparison *cmp,
+		    struct engine_hunk **hunks)
+{
+  struct hunk_list list;
+  int changes;
+
+  use_context (ctx);
+  list.end = &ctx->hunks;
+  list.context = ctx;
+  changes = script_2_files (cmp, add_hunks, &list);
+  use_context (&init_context);
+
+  ctx->file[0] = cmp->file[0];
+  ctx->file[1] = cmp->file[1];
+  ctx->have_files = true;
+  *hunks = changes < 0 ? NULL : ctx->hunks;
+  return 0 < changes && ! *hunks ? 0 : changes;
+}
+
+/* Compare the files open on FD0 and FD1 with CTX's options, from
+   their current offsets, and store a list of the hunks of differences
+   between them into *HUNKS.  The hunks, and the text of the files that
+   they point into, belong to CTX, and last until its next
+   comparison or until it is freed.  Return as engine_compare does.
+   Exit if a file cannot be read.  */
+
+int
+engine_compare_fds (struct engine_context *ctx, int fd0, int fd1,
+		    struct engine_hunk **hunks)
+{
+  struct comparison cmp;
+  int f;
+
+  free_result (ctx);
+  memset (&cmp, 0, sizeof cmp);
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *file = &cmp.file[f];
+      sprintf (ctx->name[f], "/dev/fd/%d", f ? fd1 : fd0);
+      file->name = ctx->name[f];
+      file->desc = f ? fd1 : fd0;
+      if (fstat (file->desc, &file->stat) != 0)
+	pfatal_with_name (file->name);
+    }
+
+  return compare_in_context (ctx, &cmp, hunks);
+}
+
+/* Compare the SIZE0 bytes of text at TEXT0 with the SIZE1 bytes at
+   TEXT1 with CTX's options, and store a list of the hunks of
+   differences between them into *HUNKS.  The text is used where it
+   is, without being copied or checked for null bytes, so each buffer
+   must be aligned as malloc would align it and have ENGINE_TEXT_ROOM
+   bytes after the text that the engine can overwrite; with the
+   strip_trailing_cr option, the text itself is changed.  The hunks
+   point into the buffers, which the caller must keep until CTX's
+   next comparison or until it is freed.  Return 0 if the texts are
+   the same and 1 if they differ.  */
+
+int
+engine_compare_text (struct engine_context *ctx,
+		     char *text0, size_t size0, char *text1, size_t size1,
+		     struct engine_hunk **hunks)
+{
+  struct comparison cmp;
+  int f;
+
+  free_result (ctx);
+  memset (&cmp, 0, sizeof cmp);
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *file = &cmp.file[f];
+      size_t size = f ? size1 : size0;
+      file->name = f ? "text1" : "text0";
+      file->desc = -1;
+      file->stat.st_size = size;
+      file->buffer = (word *) (f ? text1 : text0);
+      file->bufsize = size + ENGINE_TEXT_ROOM;
+      file->buffered = size;
+      file->eof = true;
+      file->supplied = true;
+    }
+
+  return compare_in_context (ctx, &cmp, hunks);
+}
+
+/* Compare the SIZE0 bytes at TEXT0 with the SIZE1 bytes at TEXT1, as
+   engine_compare_fds would compare files holding them, but without
+   checking for null bytes.  The text is copied into buffers with room
+   for engine_compare_text to work on, which belong to CTX.  */
+
+int
+engine_compare_buffers (struct engine_context *ctx,
+			char const *text0, size_t size0,
+			char const *text1, size_t size1,
+			struct engine_hunk **hunks)
+{
+  char *copy0 = xmalloc (size0 + ENGINE_TEXT_ROOM);
+  char *copy1 = xmalloc (size1 + ENGINE_TEXT_ROOM);
+  int changes;
+
+  memcpy (copy0, text0, size0);
+  memcpy (copy1, text1, size1);
+  changes = engine_compare_text (ctx, copy0, size0, copy1, size1, hunks);
+  keep_array (ctx, copy0);
+  keep_array (ctx, copy1);
+  return changes;
+}
+
+/* Return the number of lines in the SIZE bytes of text at TXT.  */
+
+static lin
+count_lines (char const *txt, size_t size)
+{
+  char const *p = txt;
+  char const *lim = txt + size;
+  lin n = 0;
+
+  while (p < lim)
+    {
+      char const *nl = memchr (p, '\n', lim - p);
+      n++;
+      if (! nl)
+	break;
+      p = nl + 1;
+    }
+  return n;
+}
+
+/* Store the address and length of each line of the SIZE bytes of
+   text at TXT into LINE and LENGTH.  */
+
+static void
+split_lines (char *txt, size_t size, char **line, size_t *length)
+{
+  char *p = txt;
+  char *lim = txt + size;
+
+  while (p < lim)
+    {
+      char *nl = memchr (p, '\n', lim - p);
+      char *end = nl ? nl + 1 : lim;
+      *line++ = p;
+      *length++ = end - p;
+      p = end;
+    }
+}
+
+/* Set up CTX's tables of the lines of its latest comparison's
+   texts, for engine_replace_lines.  */
+
+static void
+start_editing (struct engine_context *ctx)
+{
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      char *txt = (char *) ctx->file[f].buffer;
+      size_t size = ctx->file[f].buffered - ctx->file[f].missing_newline;
+      lin n = count_lines (txt, size);
+      lin alloc = MAX (n, 1);
+      ctx->edit_line[f] = xnmalloc (alloc, sizeof *ctx->edit_line[f]);
+      ctx->edit_length[f] = xnmalloc (alloc, sizeof *ctx->edit_length[f]);
+      split_lines (txt, size, ctx->edit_line[f],
+		   ctx->edit_length[f]);
+      ctx->edit_lines[f] = n;
+      if (f)
+	ctx->edit_alloc = alloc;
+    }
+  ctx->editing = true;
+}
+
+/* Compare lines FIRST[0] up to LIM[0] of CTX's first text with
+   lines FIRST[1] up to LIM[1] of its second, counting from 0, and
+   return the hunks of differences between them, numbered as lines of
+   the whole texts.  The lines of the hunks point into copies of the
+   lines compared, which CTX keeps.  */
+
+static struct engine_hunk *
+compare_region (struct engine_context *ctx,
+		lin const first[2], lin const lim[2])
+{
+  struct comparison cmp;
+  struct hunk_list list;
+  struct engine_hunk *region = NULL;
+  struct engine_hunk *hunk;
+  char *txt[2];
+  int f;
+
+  memset (&cmp, 0, sizeof cmp);
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *file = &cmp.file[f];
+      size_t size = 0;
+      char *p;
+      lin i;
+
+      for (i = first[f]; i < lim[f]; i++)
+	size += ctx->edit_length[f][i];
+      txt[f] = p = xmalloc (size + ENGINE_TEXT_ROOM);
+      for (i = first[f]; i < lim[f]; i++)
+	{
+	  memcpy (p, ctx->edit_line[f][i], ctx->edit_length[f][i]);
+	  p += ctx->edit_length[f][i];
+	}
+
+      file->name = f ? "text1" : "text0";
+      file->desc = -1;
+      file->stat.st_size = size;
+      file->buffer = (word *) txt[f];
+      file->bufsize = size + ENGINE_TEXT_ROOM;
+      file->buffered = size;
+      file->eof = true;
+      file->supplied = true;
+    }
+
+  use_context (ctx);
+  list.end = &region;
+  list.context = ctx;
+  script_2_files (&cmp, add_hunks, &list);
+  use_context (&init_context);
+
+  for (f = 0; f < 2; f++)
+    {
+      file_buffer_free (&cmp.file[f]);
+      keep_array (ctx, txt[f]);
+    }
+
+  for (hunk = region; hunk; hunk = hunk->next)
+    for (f = 0; f < 2; f++)
+      {
+	hunk->first[f] += first[f];
+	hunk->last[f] += first[f];
+      }
+  return region;
+}
+
+/* Replace lines FIRST through LAST of the second text of CTX's
+   latest comparison, counting from 1, with the SIZE bytes of text at
+   TXT, and store a list of the hunks of differences between the
+   texts as edited into *HUNKS.  LAST is FIRST - 1 to insert the text
+   before line FIRST, and TXT is followed by a newline if it lacks
+   one and lines follow it.  The latest comparison must have been made
+   with engine_compare_text or engine_compare_buffers, and may have
+   been edited already.
+
+   Only the hunks that the replaced lines touch are found again: the
+   lines between the unchanged lines around them, in both texts, are
+   compared with each other, so that only they are hashed.  The other
+   hunks stay as they were, so the hunks are correct but may differ
+   from those that comparing the texts whole would find.  The time
+   taken grows with the lines compared, and only slightly with the
+   size of the texts and the number of hunks, as the tables of the
+   lines that follow the replaced ones and the hunks after them are
+   adjusted.  The hunks and the copy of TXT belong to CTX, as
+   with its other comparisons.  Return 0 if there are no hunks and 1
+   otherwise; texts that are the same again may still have hunks that
+   undo each other.  */
+
+int
+engine_replace_lines (struct engine_context *ctx,
+		      lin first, lin last, char const *txt, size_t size,
+		      struct engine_hunk **hunks)
+{
+  lin e0 = first - 1;
+  lin e1 = last;
+  lin n1, m, n, delta, d;
+  lin lo[2], hi[2];
+  size_t prefix = 0;
+  char *copy;
+  bool newline;
+  struct engine_hunk **p;
+  struct engine_hunk *h, *region;
+
+  if (! (ctx->have_files && ctx->file[1].supplied))
+    abort ();
+  if (! ctx->editing)
+    start_editing (ctx);
+  n1 = ctx->edit_lines[1];
+  if (! (0 <= e0 && e0 <= e1 && e1 <= n1))
+    abort ();
+
+  /* Text appended to a last line that lacks a newline replaces that
+     line, which gets one.  */
+  if (size && e0 == n1 && n1
+      && ctx->edit_line[1][n1 - 1][ctx->edit_length[1][n1 - 1] - 1]
+	 != '\n')
+    {
+      e0--;
+      prefix = ctx->edit_length[1][e0] + 1;
+    }
+
+  /* Copy the text, with a newline in memory after it in any case.  */
+  newline = size && txt[size - 1] != '\n' && e1 < n1;
+  copy = xmalloc (prefix + size + 1);
+  if (prefix)
+    {
+      memcpy (copy, ctx->edit_line[1][e0], prefix - 1);
+      copy[prefix - 1] = '\n';
+    }
+  memcpy (copy + prefix, txt, size);
+  copy[prefix + size] = '\n';
+  keep_array (ctx, copy);
+  size += prefix + newline;
+  m = count_lines (copy, size);
+  delta = m - (e1 - e0);
+
+  /* Find the hunks that the replaced lines touch, and the unchanged
+     lines around them.  D is the number of the first text's lines
+     less the second's before each point outside a hunk.  */
+  lo[1] = e0;
+  hi[1] = e1;
+  d = 0;
+  for (p = &ctx->hunks; *p && (*p)->last[1] < lo[1]; p = &(*p)->next)
+    d = (*p)->last[0] - (*p)->last[1];
+  lo[0] = lo[1] + d;
+  if (*p && (*p)->first[1] - 1 < lo[1])
+    {
+      lo[0] = (*p)->first[0] - 1;
+      lo[1] = (*p)->first[1] - 1;
+    }
+  while (*p && (*p)->first[1] - 1 <= hi[1])
+    {
+      h = *p;
+      hi[1] = MAX (hi[1], h->last[1]);
+      d = h->last[0] - h->last[1];
+      *p = h->next;
+      free (h);
+    }
+  hi[0] = hi[1] + d;
+
+  /* Replace the lines in the table of the second text's lines.  */
+  n = n1 + delta;
+  if (ctx->edit_alloc < n)
+    {
+      ctx->edit_alloc = n + n / 2;
+      ctx->edit_line[1] = xnrealloc (ctx->edit_line[1], ctx->edit_alloc,
+				     sizeof *ctx->edit_line[1]);
+      ctx->edit_length[1] = xnrealloc (ctx->edit_length[1], ctx->edit_alloc,
+				       sizeof *ctx->edit_length[1]);
+    }
+  memmove (ctx->edit_line[1] + e0 + m, ctx->edit_line[1] + e1,
+	   (n1 - e1) * sizeof *ctx->edit_line[1]);
+  memmove (ctx->edit_length[1] + e0 + m, ctx->edit_length[1] + e1,
+	   (n1 - e1) * sizeof *ctx->edit_length[1]);
+  split_lines (copy, size, ctx->edit_line[1] + e0,
+	       ctx->edit_length[1] + e0);
+  ctx->edit_lines[1] = n;
+  hi[1] += delta;
+
+  /* Renumber the hunks after the replaced lines, and put the hunks
+     found between the unchanged lines in place of those removed.  */
+  for (h = *p; h; h = h->next)
+    {
+      h->first[1] += delta;
+      h->last[1] += delta;
+    }
+  region = (lo[0] < hi[0] || lo[1] < hi[1]
+	    ? compare_region (ctx, lo, hi) : NULL);
+  if (region)
+    {
+      h = region;
+      while (h->next)
+	h = h->next;
+      h->next = *p;
+      *p = region;
+    }
+
+  *hunks = ctx->hunks;
+  return !!ctx->hunks;
+}
+
+/* Free CTX, along with the hunks of its latest comparison.  */
+
+void
+engine_context_free (struct engine_context *ctx)
+{
+  free_result (ctx);
+  free (ctx->arrays);
+  free_regexp_list (&ctx->regexps);
+  free (ctx);
+}
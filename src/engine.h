@@ -0,0 +1,158 @@
+/* Interface to diff's comparison engine, for programs other than diff
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* This header is deliberately independent of diff.h, whose option
+   variables would collide with the options of the programs that
+   include it.  It needs "system.h" for 'lin' and 'word'.  */
+
+/* Options that change how the engine compares files.  */
+struct engine_options
+{
+  /* Treat all files as text (-a).  */
+  bool text;
+
+  /* Remove trailing carriage returns from input.  */
+  bool strip_trailing_cr;
+
+  /* Keep this many lines of common prefix and suffix (--horizon-lines).  */
+  lin horizon_lines;
+
+  /* Ignore changes in case (-i).  */
+  bool ignore_case;
+
+  /* Ignore changes that affect only blank lines (-B).  */
+  bool ignore_blank_lines;
+
+  /* Ignore changes due to tab expansion (-E), in trailing white space
+     (-Z), in the amount of white space (-b), and in all white space
+     (-w).  */
+  bool ignore_tab_expansion;
+  bool ignore_trailing_space;
+  bool ignore_space_change;
+  bool ignore_all_space;
+
+  /* Ignore changes whose lines all match one of these regexps (-I);
+     a null-terminated array, or null if there are none.  */
+  char const *const *ignore_regexps;
+
+  /* Try hard to find a smaller set of changes (-d).  */
+  bool minimal;
+
+  /* Assume large files with many scattered small changes (-H).  */
+  bool speed_large_files;
+
+  /* If nonzero, compare large files a window at a time, using about
+     this many bytes of memory (--max-memory).  */
+  size_t max_memory;
+};
+
+/* Options that change how engine_side_by_side outputs lines.  */
+struct engine_sdiff_options
+{
+  /* Output only the left column of common lines (--left-column).  */
+  bool left_column;
+
+  /* Expand tabs to spaces in the output (-t).  */
+  bool expand_tabs;
+
+  /* Tab stops are this many columns apart (--tabsize); 0 means 8.  */
+  size_t tabsize;
+
+  /* Output at most this many columns per line (-W); 0 means 130.  */
+  size_t width;
+};
+
+/* A hunk of differences, as normal-format 'diff' would output it:
+   lines FIRST[0] through LAST[0] of the first file were replaced by
+   lines FIRST[1] through LAST[1] of the second.  Lines are numbered
+   from 1, and an empty range has LAST[F] == FIRST[F] - 1.
+
+   LINBUF[F][I] is the start of line FIRST[F] + I of file F, and
+   LINBUF[F][I + 1] its end, just past its newline if it has one, as
+   in diff's own tables of lines; LINBUF[F] is null if the range is
+   empty.  The lines point into the file's text, and the arrays are
+   parts of larger ones shared by all the hunks of a comparison, so
+   none of them can be freed, though their entries may be changed.
+   A line that lacks a newline, which can only be the last line of
+   its file, is nevertheless followed by one in memory, so that it
+   can be output as if complete.  */
+struct engine_hunk
+{
+  lin first[2];
+  lin last[2];
+  char const **linbuf[2];
+  struct engine_hunk *next;
+};
+
+/* A run of lines that engine_side_by_side found: LINES[F] lines of
+   file F, which are common to both files if !CHANGED and a hunk of
+   differences otherwise.  The lines are the SIZE[F] bytes at TEXT[F],
+   as they are in the file unless the strip_trailing_cr option removed
+   carriage returns from them.  */
+struct engine_run
+{
+  bool changed;
+  lin lines[2];
+  char const *text[2];
+  size_t size[2];
+
+  /* Where the lines are in the engine's tables, for engine_show_run.  */
+  lin first[2];
+};
+
+/* A context for comparing files with options of its own, for programs
+   that compare with more than one set of options, or that embed the
+   engine and so cannot rely on engine_init's being called just once.
+   The context also owns the hunks of its latest comparison and the
+   text they point into, which last until its next comparison or
+   until it is freed.  Contexts can be used one after another in any
+   order, but as the engine keeps the state of a comparison in static
+   variables, no two comparisons can be in progress at once, whether
+   in separate threads or through engine_compare and a context.  */
+struct engine_context;
+
+/* The bytes of room that engine_compare_text needs after each text,
+   for a newline and for sentinels.  */
+enum { ENGINE_TEXT_ROOM = 2 * sizeof (word) };
+
+/* engine.c */
+extern void engine_init (struct engine_options const *);
+extern int engine_compare (char const *, char const *,
+			   struct engine_hunk **);
+extern void engine_retain (char const *);
+extern int engine_side_by_side (char const *, char const *,
+				struct engine_sdiff_options const *,
+				void (*) (struct engine_run const *, void *),
+				void *);
+extern void engine_show_run (struct engine_run const *);
+extern struct engine_context *engine_context_new
+  (struct engine_options const *);
+extern int engine_compare_fds (struct engine_context *, int, int,
+			       struct engine_hunk **);
+extern int engine_compare_text (struct engine_context *,
+				char *, size_t, char *, size_t,
+				struct engine_hunk **);
+extern int engine_compare_buffers (struct engine_context *,
+				   char const *, size_t,
+				   char const *, size_t,
+				   struct engine_hunk **);
+extern int engine_replace_lines (struct engine_context *, lin, lin,
+				 char const *, size_t,
+				 struct engine_hunk **);
+extern void engine_context_free (struct engine_context *);
@@ -0,0 +1,117 @@
+/* Get the status of files.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "system.h"
+#include "filestat.h"
+
+/* Where statx is available, the status of a file is got with it,
+   asking for only what diff and cmp look at: everything but the
+   access and birth times, which a network file system may have to
+   ask its server for.  With --cached-stat, the status that the file
+   system has cached is used rather than asking the server at all;
+   it may be out of date if the file was changed elsewhere.  If the
+   kernel lacks statx, or a sandbox forbids it, stat is used.  */
+
+bool cached_stat;
+
+#if defined STATX_BASIC_STATS && defined AT_FDCWD
+
+# include <sys/sysmacros.h>
+
+/* Whether statx may work.  */
+static bool statx_works = true;
+
+/* Get the status of NAME relative to the directory open on DIRDESC,
+   or of the file open on DIRDESC if NAME is empty, with FLAGS as for
+   statx, into *ST.  Return 0 if successful, -1 (setting errno)
+   otherwise, and -2 if statx does not work.  */
+
+static int
+statx_status (int dirdesc, char const *name, struct stat *st, int flags)
+{
+  struct statx stx;
+
+  if (! statx_works)
+    return -2;
+  if (statx (dirdesc, name,
+	     flags | (cached_stat ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT),
+	     STATX_BASIC_STATS & ~STATX_ATIME, &stx)
+      != 0)
+    {
+      if (errno == ENOSYS || errno == EPERM)
+	{
+	  statx_works = false;
+	  return -2;
+	}
+      return -1;
+    }
+
+  memset (st, 0, sizeof *st);
+  st->st_dev = makedev (stx.stx_dev_major, stx.stx_dev_minor);
+  st->st_ino = stx.stx_ino;
+  st->st_mode = stx.stx_mode;
+  st->st_nlink = stx.stx_nlink;
+  st->st_uid = stx.stx_uid;
+  st->st_gid = stx.stx_gid;
+  st->st_rdev = makedev (stx.stx_rdev_major, stx.stx_rdev_minor);
+  st->st_size = stx.stx_size;
+  st->st_blksize = stx.stx_blksize;
+  st->st_blocks = stx.stx_blocks;
+  st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+  return 0;
+}
+#else
+# define statx_status(dirdesc, name, st, flags) (-2)
+#endif
+
+/* Get the status of the file NAME into *ST, looking NAME up relative
+   to the directory open on DIRDESC if DIRDESC is not negative, and
+   not following a symbolic link if NOFOLLOW.  Return 0 if successful,
+   -1 (setting errno) otherwise.  */
+
+int
+file_status (int dirdesc, char const *name, struct stat *st, bool nofollow)
+{
+#ifdef AT_FDCWD
+  int flags = nofollow ? AT_SYMLINK_NOFOLLOW : 0;
+  int r = statx_status (dirdesc < 0 ? AT_FDCWD : dirdesc, name, st, flags);
+  if (r != -2)
+    return r;
+  if (0 <= dirdesc)
+    return fstatat (dirdesc, name, st, flags);
+#endif
+  return nofollow ? lstat (name, st) : stat (name, st);
+}
+
+/* Get the status of the file open on DESC into *ST.  Return 0 if
+   successful, -1 (setting errno) otherwise.  */
+
+int
+desc_status (int desc, struct stat *st)
+{
+#ifdef AT_EMPTY_PATH
+  int r = statx_status (desc, "", st, AT_EMPTY_PATH);
+  if (r != -2)
+    return r;
+#endif
+  return fstat (desc, st);
+}
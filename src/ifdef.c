@@ -30,16 +30,40 @@ struct group
   lin from, upto; /* start and limit lines for this group of lines */
 };
 
+/* A line format is compiled into an array of steps, ending with
+   STEP_END, so that print_ifdef_lines need not rescan the format for
+   every line it prints.  */
+enum step_type
+{
+  STEP_END,
+  STEP_TEXT,		/* print LEN bytes of TEXT */
+  STEP_LINE,		/* %L */
+  STEP_LINE_NO_NEWLINE,	/* %l */
+  STEP_NUMBER,		/* print the line number using printf format TEXT */
+  STEP_DECIMAL		/* %dn, which needs no printf */
+};
+
+struct format_step
+{
+  enum step_type type;
+  char const *text;
+  size_t len;
+};
+
+/* The compiled forms of LINE_FORMAT, or null if not compiled yet.  */
+static struct format_step *line_program[NEW + 1];
+
 static char const *format_group (FILE *, char const *, char,
 				 struct group const *);
 static char const *do_printf_spec (FILE *, char const *,
-				   struct file_data const *, lin,
 				   struct group const *);
+static char const *scan_printf_spec (char const *, char *);
 static char const *scan_char_literal (char const *, char *);
 static lin groups_letter_value (struct group const *, char);
 static void format_ifdef (char const *, lin, lin, lin, lin);
 static void print_ifdef_hunk (struct change *);
-static void print_ifdef_lines (FILE *, char const *, struct group const *);
+static void print_ifdef_lines (FILE *, enum changes, struct group const *);
+static struct format_step *compile_line_format (char const *);
 
 static lin next_line0;
 static lin next_line1;
@@ -175,21 +199,21 @@ format_group (register FILE *out, char const *format, char endchar,
 
 	  case '<':
 	    /* Print lines deleted from first file.  */
-	    print_ifdef_lines (out, line_format[OLD], &groups[0]);
+	    print_ifdef_lines (out, OLD, &groups[0]);
 	    continue;
 
 	  case '=':
 	    /* Print common lines.  */
-	    print_ifdef_lines (out, line_format[UNCHANGED], &groups[0]);
+	    print_ifdef_lines (out, UNCHANGED, &groups[0]);
 	    continue;
 
 	  case '>':
 	    /* Print lines inserted from second file.  */
-	    print_ifdef_lines (out, line_format[NEW], &groups[1]);
+	    print_ifdef_lines (out, NEW, &groups[1]);
 	    continue;
 
 	  default:
-	    f = do_printf_spec (out, f - 2, 0, 0, groups);
+	    f = do_printf_spec (out, f - 2, groups);
 	    if (f)
 	      continue;
 	    /* Fall through. */
@@ -231,15 +255,17 @@ groups_letter_value (struct group const *g, char letter)
     }
 }
 
-/* Print to file OUT, using FORMAT to print the line group GROUP.
+/* Print to file OUT, using line format WHICH to print the line group GROUP.
    But do nothing if OUT is zero.  */
 static void
-print_ifdef_lines (register FILE *out, char const *format,
+print_ifdef_lines (register FILE *out, enum changes which,
 		   struct group const *group)
 {
   struct file_data const *file = group->file;
   char const * const *linbuf = file->linbuf;
   lin from = group->from, upto = group->upto;
+  char const *format = line_format[which];
+  struct format_step const *program;
 
   if (!out)
     return;
@@ -262,65 +288,153 @@ print_ifdef_lines (register FILE *out, char const *format,
 	}
     }
 
+  if (!line_program[which])
+    line_program[which] = compile_line_format (format);
+  program = line_program[which];
+
   for (;  from < upto;  from++)
     {
-      register char c;
-      register char const *f = format;
+      register struct format_step const *step;
 
-      while ((c = *f++) != 0)
-	{
-	  char const *f1 = f;
-	  if (c == '%')
-	    switch ((c = *f++))
-	      {
-	      case '%':
-		break;
-
-	      case 'l':
-		output_1_line (linbuf[from],
-			       (linbuf[from + 1]
-				- (linbuf[from + 1][-1] == '\n')),
-			       0, 0);
-		continue;
+      for (step = program; step->type != STEP_END; step++)
+	switch (step->type)
+	  {
+	  case STEP_TEXT:
+	    {
+	      char const *t = step->text;
+	      char const *lim = t + step->len;
+	      do
+		putc (*t, out);
+	      while (++t < lim);
+	    }
+	    break;
 
-	      case 'L':
-		output_1_line (linbuf[from], linbuf[from + 1], 0, 0);
-		continue;
+	  case STEP_LINE:
+	    output_1_line (linbuf[from], linbuf[from + 1], 0, 0);
+	    break;
+
+	  case STEP_LINE_NO_NEWLINE:
+	    output_1_line (linbuf[from],
+			   (linbuf[from + 1]
+			    - (linbuf[from + 1][-1] == '\n')),
+			   0, 0);
+	    break;
+
+	  case STEP_NUMBER:
+	    {
+	      long int value = translate_line_number (file, from);
+	      fprintf (out, step->text, value);
+	    }
+	    break;
+
+	  case STEP_DECIMAL:
+	    {
+	      char buf[INT_BUFSIZE_BOUND (long int)];
+	      char *p = buf + sizeof buf;
+	      long int value = translate_line_number (file, from);
+	      bool negative = value < 0;
+	      do
+		*--p = '0' + (negative ? - (value % 10) : value % 10);
+	      while ((value /= 10) != 0);
+	      if (negative)
+		*--p = '-';
+	      do
+		putc (*p, out);
+	      while (++p < buf + sizeof buf);
+	    }
+	    break;
+
+	  default:
+	    abort ();
+	  }
+    }
+}
+
+/* Compile the line format FORMAT into an array of steps.
+   Directives that are not valid are printed literally, as
+   format_group does with group formats.  */
+static struct format_step *
+compile_line_format (char const *format)
+{
+  size_t len = strlen (format);
+
+  /* Each byte of FORMAT yields at most one step, and each directive
+     at most one more byte of text than its own length.  */
+  struct format_step *program = xnmalloc (len + 1, sizeof *program);
+  char *buf = xmalloc (2 * len + 1);
+  struct format_step *step = program;
+  char const *f = format;
+  char c;
+
+  while ((c = *f++) != 0)
+    {
+      char const *f1 = f;
+      char const *spec = f - 1;
+      char conv;
+
+      if (c == '%')
+	switch ((c = *f++))
+	  {
+	  case '%':
+	    break;
+
+	  case 'l':
+	  case 'L':
+	    step->type = c == 'l' ? STEP_LINE_NO_NEWLINE : STEP_LINE;
+	    step++;
+	    continue;
 
-	      default:
-		f = do_printf_spec (out, f - 2, file, from, 0);
-		if (f)
-		  continue;
-		c = '%';
-		f = f1;
-		break;
+	  default:
+	    f = scan_printf_spec (spec, &conv);
+	    if (conv == 'c' && *f == '\''
+		&& (f = scan_char_literal (f + 1, &c)))
+	      break;
+	    if (conv && strchr ("doxX", conv) && *f == 'n')
+	      {
+		/* For example, if the spec is "%3xn", use the printf
+		   format spec "%3lx".  Here the spec prefix is "%3".  */
+		size_t spec_prefix_len = f - spec - 1;
+		step->type = (spec_prefix_len == 1 && conv == 'd'
+			      ? STEP_DECIMAL : STEP_NUMBER);
+		step->text = buf;
+		memcpy (buf, spec, spec_prefix_len);
+		buf += spec_prefix_len;
+		*buf++ = 'l';
+		*buf++ = conv;
+		*buf++ = '\0';
+		step++;
+		f++;
+		continue;
 	      }
+	    c = '%';
+	    f = f1;
+	    break;
+	  }
 
-	  putc (c, out);
+      /* Append C to the text of the previous step if possible.  */
+      if (step != program && step[-1].type == STEP_TEXT
+	  && step[-1].text + step[-1].len == buf)
+	step[-1].len++;
+      else
+	{
+	  step->type = STEP_TEXT;
+	  step->text = buf;
+	  step->len = 1;
+	  step++;
 	}
+      *buf++ = c;
     }
+
+  step->type = STEP_END;
+  return program;
 }
 
 static char const *
-do_printf_spec (FILE *out, char const *spec,
-		struct file_data const *file, lin n,
-		struct group const *groups)
+do_printf_spec (FILE *out, char const *spec, struct group const *groups)
 {
-  char const *f = spec;
   char c;
-  char c1;
-
-  /* Scan printf-style SPEC of the form %[-'0]*[0-9]*(.[0-9]*)?[cdoxX].  */
-  /* assert (*f == '%'); */
-  f++;
-  while ((c = *f++) == '-' || c == '\'' || c == '0')
-    continue;
-  while (ISDIGIT (c))
-    c = *f++;
-  if (c == '.')
-    while (ISDIGIT (c = *f++))
-      continue;
-  c1 = *f++;
+  char const *f = scan_printf_spec (spec, &c);
+  char c1 = *f++;
 
   switch (c)
     {
@@ -340,20 +454,9 @@ do_printf_spec (FILE *out, char const *spec,
 
     case 'd': case 'o': case 'x': case 'X':
       {
-	lin value;
-
-	if (file)
-	  {
-	    if (c1 != 'n')
-	      return 0;
-	    value = translate_line_number (file, n);
-	  }
-	else
-	  {
-	    value = groups_letter_value (groups, c1);
-	    if (value < 0)
-	      return 0;
-	  }
+	lin value = groups_letter_value (groups, c1);
+	if (value < 0)
+	  return 0;
 
 	if (out)
 	  {
@@ -386,6 +489,29 @@ do_printf_spec (FILE *out, char const *spec,
   return f;
 }
 
+/* Scan the printf-style spec SPEC of the form
+   %[-'0]*[0-9]*(.[0-9]*)?[cdoxX], and put its conversion character
+   into *CONVPTR.  Yield the address of the first character after the
+   conversion character.  */
+static char const *
+scan_printf_spec (char const *spec, char *convptr)
+{
+  char const *f = spec;
+  char c;
+
+  /* assert (*f == '%'); */
+  f++;
+  while ((c = *f++) == '-' || c == '\'' || c == '0')
+    continue;
+  while (ISDIGIT (c))
+    c = *f++;
+  if (c == '.')
+    while (ISDIGIT (c = *f++))
+      continue;
+  *convptr = c;
+  return f;
+}
+
 /* Scan the character literal represented in the string LIT; LIT points just
    after the initial apostrophe.  Put the literal's value into *VALPTR.
    Yield the address of the first character after the closing apostrophe,
@@ -0,0 +1,222 @@
+/* Sidecar indexes of the lines of large files for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+
+#include <error.h>
+#include <stat-time.h>
+#include <xalloc.h>
+
+/* With --write-index, diff writes next to each regular file that it
+   reads whole a sidecar file, FILE.diff-index, that records where
+   each line of FILE starts in diff's buffer and the hash of each line,
+   and with --read-index it uses such an index rather than splitting
+   and hashing the file again.  This pays for files that are large
+   and are compared with new versions of themselves over and over.
+
+   The index is in the host's byte order: a header, the offsets of the
+   starts of the lines and of the end of the last, and the hashes.  It
+   is used only if it was written for a file with the same size,
+   inode number, modification and change times, and with the same
+   options affecting the hashes, which make up OPTIONS.  */
+
+static char const index_magic[16] = "GNU diff index 1";
+
+struct index_header
+{
+  char magic[sizeof index_magic];
+
+  /* 1, to check the byte order.  */
+  uint64_t one;
+
+  uint64_t options;
+  uint64_t size;
+  uint64_t ino;
+  int64_t mtime_sec, mtime_nsec;
+  int64_t ctime_sec, ctime_nsec;
+  uint64_t lines;
+};
+
+/* Return the name of the index of the file NAME, which the caller
+   must free.  */
+
+static char *
+index_name (char const *name)
+{
+  static char const suffix[] = ".diff-index";
+  size_t len = strlen (name);
+  char *r = xmalloc (len + sizeof suffix);
+  memcpy (r, name, len);
+  memcpy (r + len, suffix, sizeof suffix);
+  return r;
+}
+
+/* Fill in *H for the file whose status is *ST, with LINES lines,
+   hashed with OPTIONS.  */
+
+static void
+set_header (struct index_header *h, struct stat const *st,
+	    uint64_t options, lin lines)
+{
+  struct timespec mtime = get_stat_mtime (st);
+  struct timespec ctime = get_stat_ctime (st);
+
+  memset (h, 0, sizeof *h);
+  memcpy (h->magic, index_magic, sizeof h->magic);
+  h->one = 1;
+  h->options = options;
+  h->size = st->st_size;
+  h->ino = st->st_ino;
+  h->mtime_sec = mtime.tv_sec;
+  h->mtime_nsec = mtime.tv_nsec;
+  h->ctime_sec = ctime.tv_sec;
+  h->ctime_nsec = ctime.tv_nsec;
+  h->lines = lines;
+}
+
+/* If the regular file CURRENT, whose text is in its buffer, has an
+   index that is up to date and was written with OPTIONS, set
+   CURRENT->index to it.  Otherwise leave CURRENT alone.  */
+
+void
+load_line_index (struct file_data *current, uint64_t options)
+{
+  char *name;
+  int fd;
+  struct stat st;
+  struct index_header h;
+  struct index_header const *mh;
+  struct line_index *index;
+  size_t size;
+  void *region;
+
+  if (! S_ISREG (current->stat.st_mode))
+    return;
+
+  name = index_name (current->name);
+  fd = open (name, O_RDONLY | O_BINARY);
+  free (name);
+  if (fd < 0)
+    return;
+
+  set_header (&h, &current->stat, options, 0);
+  if (! (fstat (fd, &st) == 0 && sizeof h <= st.st_size
+	 && st.st_size <= SIZE_MAX))
+    {
+      close (fd);
+      return;
+    }
+  size = st.st_size;
+
+#if USE_MMAP
+  region = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (region == MAP_FAILED)
+    region = NULL;
+#else
+  region = xmalloc (size);
+  if (block_read (fd, region, size) != size)
+    {
+      free (region);
+      region = NULL;
+    }
+#endif
+  close (fd);
+  if (! region)
+    return;
+
+  /* Check everything but the number of lines against what the header
+     would be if the index were written now, and check that the lines
+     fit the file and the text in the buffer.  */
+  mh = region;
+  h.lines = mh->lines;
+  if (memcmp (mh, &h, sizeof h) == 0
+      && mh->lines < PTRDIFF_MAX / (2 * sizeof (uint64_t))
+      && size == sizeof h + (2 * mh->lines + 1) * sizeof (uint64_t))
+    {
+      uint64_t const *offset = (uint64_t const *) (mh + 1);
+      if (offset[mh->lines] == current->buffered)
+	{
+	  index = xmalloc (sizeof *index);
+	  index->lines = mh->lines;
+	  index->offset = offset;
+	  index->hash = offset + mh->lines + 1;
+	  index->region = region;
+	  index->size = size;
+	  current->index = index;
+	  return;
+	}
+    }
+
+#if USE_MMAP
+  munmap (region, size);
+#else
+  free (region);
+#endif
+}
+
+/* Write the index of CURRENT, hashed with OPTIONS: its LINES lines
+   start at the offsets OFFSET in its buffer, with OFFSET[LINES] being
+   the end of the last, and have the hashes HASH.  Warn if the index
+   cannot be written, as diff works as well without it.  */
+
+void
+save_line_index (struct file_data const *current, uint64_t options,
+		 lin lines, uint64_t const *offset, uint64_t const *hash)
+{
+  struct index_header h;
+  char *name = index_name (current->name);
+  size_t namelen = strlen (name);
+  char *temp = xmalloc (namelen + sizeof ".tmp");
+  FILE *fp;
+
+  memcpy (temp, name, namelen);
+  strcpy (temp + namelen, ".tmp");
+  set_header (&h, &current->stat, options, lines);
+
+  fp = fopen (temp, "wb");
+  if (! fp
+      || fwrite (&h, sizeof h, 1, fp) != 1
+      || fwrite (offset, sizeof *offset, lines + 1, fp) != lines + 1
+      || (lines && fwrite (hash, sizeof *hash, lines, fp) != lines)
+      || fclose (fp) != 0
+      || rename (temp, name) != 0)
+    {
+      error (0, errno, _("%s: cannot write index"), name);
+      unlink (temp);
+    }
+
+  free (temp);
+  free (name);
+}
+
+/* Free INDEX, if any.  */
+
+void
+free_line_index (struct line_index *index)
+{
+  if (index)
+    {
+#if USE_MMAP
+      munmap (index->region, index->size);
+#else
+      free (index->region);
+#endif
+      free (index);
+    }
+}
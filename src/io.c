@@ -19,42 +19,242 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "diff.h"
+#include "mapwatch.h"
+#include "probes.h"
 #include <binary-io.h>
 #include <cmpbuf.h>
 #include <file-type.h>
+#include <wchar.h>
+#include <wctype.h>
 #include <xalloc.h>
 
+/* Regular files at least this large are mapped into memory rather
+   than read, so that they are not copied out of the page cache.
+   Smaller files are cheaper to read.  */
+enum { MMAP_THRESHOLD = 1024 * 1024 };
+
 /* Rotate an unsigned value to the left.  */
 #define ROL(v, n) ((v) << (n) | (v) >> (sizeof (v) * CHAR_BIT - (n)))
-
-/* Given a hash value and a new character, return a new hash value.  */
-#define HASH(h, c) ((c) + ROL (h, 7))
 
 /* The type of a hash value.  */
 typedef size_t hash_value;
 verify (! TYPE_SIGNED (hash_value));
 
+/* Odd multipliers whose bits are spread evenly; the first is derived
+   from the golden ratio.  */
+#define HASH_K1 ((hash_value) UINTMAX_C (0x9e3779b97f4a7c15))
+#define HASH_K2 ((hash_value) UINTMAX_C (0xbf58476d1ce4e5b9))
+
+/* Given a hash value and a new word, return a new hash value.  The
+   multiplication carries each bit of the word into all the bits above
+   it, and the rotation brings the high-order bits, which depend on the
+   most input, down to where the next multiplication spreads them.
+   Lines that differ only in a few bytes, such as fixed-width records
+   with different serial numbers, thus rarely hash alike.  */
+#define HASH(h, w) ROL (((h) ^ (w)) * HASH_K1, 31)
+
+/* Return the final hash of SIZE bytes whose words have been combined
+   into H, mixing in the size and the high-order bits once more so
+   that every bit of the result depends on every bit of input.  */
+static hash_value
+hash_finish (hash_value h, size_t size)
+{
+  h = (h ^ size) * HASH_K2;
+  return h ^ h >> (sizeof h * CHAR_BIT / 2);
+}
+
+/* Line hashes are stored temporarily in a file's equivs vector.  */
+verify (sizeof (hash_value) == sizeof (lin));
+
+/* Return the hash of the SIZE bytes at P, consuming a word at a time.
+   Lines are hashed by hashing their canonical forms with this.  */
+static hash_value
+hash_bytes (char const *p, size_t size)
+{
+  hash_value h = 0;
+  size_t n = size;
+  word w;
+
+  for (; sizeof w <= size; p += sizeof w, size -= sizeof w)
+    {
+      memcpy (&w, p, sizeof w);
+      h = HASH (h, w);
+    }
+  if (size)
+    {
+      for (w = 0; size; size--)
+	w = w << CHAR_BIT | (unsigned char) *p++;
+      h = HASH (h, w);
+    }
+  return hash_finish (h, n);
+}
+
+/* Each byte, lowercased if ignore_case; likewise but with white space
+   turned into a space; and whether each byte is white space.  */
+static unsigned char fold[UCHAR_MAX + 1];
+static unsigned char fold_space[UCHAR_MAX + 1];
+static bool is_space[UCHAR_MAX + 1];
+static bool fold_ready;
+
+/* The options that the tables were filled in for.  */
+static bool fold_case;
+static enum DIFF_white_space fold_white_space;
+
+/* Whether ignore_case, and tolower changes exactly the ASCII letters
+   A-Z, as it does in the C locale and in UTF-8 locales.  Lines can
+   then be lowercased a word at a time.  */
+static bool ascii_case_fold;
+
+/* Whether lines that are not all ASCII are compared a character at a
+   time with the wide character functions, as they are when case or
+   changes in white space are ignored in a multibyte locale.  */
+static bool multibyte_lines;
+
+/* Fill in the tables above for the current locale and options.  */
+
+static void
+prepare_fold (void)
+{
+  int c;
+
+  ascii_case_fold = ignore_case;
+  for (c = 0; c <= UCHAR_MAX; c++)
+    {
+      fold[c] = ignore_case ? tolower (c) : c;
+      is_space[c] = isspace (c) != 0;
+      fold_space[c] = is_space[c] ? ' ' : fold[c];
+      if (fold[c] != ('A' <= c && c <= 'Z' ? c - 'A' + 'a' : c))
+	ascii_case_fold = false;
+    }
+  multibyte_lines = (1 < MB_CUR_MAX
+		     && (ignore_case
+			 || ignore_white_space == IGNORE_SPACE_CHANGE
+			 || ignore_white_space == IGNORE_ALL_SPACE));
+  fold_case = ignore_case;
+  fold_white_space = ignore_white_space;
+  fold_ready = true;
+}
+
+/* Return W with the ASCII letters A-Z in each of its bytes lowercased.
+   A byte's low seven bits plus 0x80 - 'A' has its top bit set if they
+   are at least 'A', and plus 0x7f - 'Z' if they are past 'Z'; neither
+   sum carries into the next byte.  Bytes with the top bit set are not
+   ASCII and are left alone.  */
+
+static word
+fold_ascii_word (word w)
+{
+  word const ones = (word) -1 / UCHAR_MAX;
+  word low7 = w & (ones * 0x7f);
+  word ge_a = low7 + ones * (0x80 - 'A');
+  word gt_z = low7 + ones * (0x7f - 'Z');
+  word upper = ~w & (ge_a ^ gt_z) & (ones * 0x80);
+  return w | upper >> 2;
+}
+
+/* Return true if the SIZE bytes at P are all ASCII.  */
+
+static bool
+ascii_bytes (char const *p, size_t size)
+{
+  word const high = (word) -1 / UCHAR_MAX * 0x80;
+  word w, any = 0;
+
+  for (; sizeof w <= size; p += sizeof w, size -= sizeof w)
+    {
+      memcpy (&w, p, sizeof w);
+      any |= w;
+    }
+  for (; size; size--)
+    any |= (unsigned char) *p++;
+  return ! (any & high);
+}
+
+/* Return the hash of the SIZE bytes at P lowercased, the same as
+   hash_bytes would return for a lowercased copy of them.  */
+
+static hash_value
+hash_folded_bytes (char const *p, size_t size)
+{
+  hash_value h = 0;
+  size_t n = size;
+  word w;
+
+  for (; sizeof w <= size; p += sizeof w, size -= sizeof w)
+    {
+      memcpy (&w, p, sizeof w);
+      h = HASH (h, fold_ascii_word (w));
+    }
+  if (size)
+    {
+      for (w = 0; size; size--)
+	w = w << CHAR_BIT | fold[(unsigned char) *p++];
+      h = HASH (h, w);
+    }
+  return hash_finish (h, n);
+}
+
+/* Return true if the SIZE bytes at P and Q are the same lowercased.  */
+
+static bool
+same_folded_bytes (char const *p, char const *q, size_t size)
+{
+  word w, x;
+
+  for (; sizeof w <= size; p += sizeof w, q += sizeof w, size -= sizeof w)
+    {
+      memcpy (&w, p, sizeof w);
+      memcpy (&x, q, sizeof x);
+      if (w != x && fold_ascii_word (w) != fold_ascii_word (x))
+	return false;
+    }
+  for (; size; size--)
+    if (fold[(unsigned char) *p++] != fold[(unsigned char) *q++])
+      return false;
+  return true;
+}
+
 /* Lines are put into equivalence classes of lines that match in lines_differ.
    Each equivalence class is represented by one of these structures,
    but only while the classes are being computed.
    Afterward, each class is represented by a number.  */
 struct equivclass
 {
-  lin next;		/* Next item in this bucket.  */
-  hash_value hash;	/* Hash of lines in this class.  */
   char const *line;	/* A line that fits this class.  */
   size_t length;	/* That line's length, not counting its newline.  */
 };
 
-/* Hash-table: array of buckets, each being a chain of equivalence classes.
-   buckets[-1] is reserved for incomplete lines.  */
-static lin *buckets;
+/* Hash table of equivalence classes, using open addressing with
+   linear probing.  The table is kept as parallel arrays, so that a
+   probe compares the full hash of each candidate without touching the
+   class itself or its line text.  A class number of 0 marks an
+   empty slot.  */
+struct equivtable
+{
+  hash_value *hash;
+  lin *class;
+
+  /* The number of slots in the table, which is a power of 2, minus 1.  */
+  size_t mask;
+
+  /* The number of bits to shift a hash right to get a slot.  */
+  int shift;
+
+  /* The number of slots in use.  */
+  size_t used;
+};
+
+/* The table of the classes of the files being compared, and the
+   number of slots allocated for it, which can be more than it uses.  */
+static struct equivtable table;
+static size_t table_alloc;
 
-/* Number of buckets in the hash table array, not counting buckets[-1].  */
-static size_t nbuckets;
+/* The class of the most recent incomplete line, or 0 if none.  Such
+   lines are kept out of the table so that they can compare equal
+   only to the other file's incomplete line.  */
+static lin incomplete_class;
 
 /* Array in which the equivalence classes are allocated.
-   The bucket-chains go through the elements in this array.
    The number of an equivalence class is its index in this array.  */
 static struct equivclass *equivs;
 
@@ -63,7 +263,342 @@ static lin equivs_index;
 
 /* Number of elements allocated in the array 'equivs'.  */
 static lin equivs_alloc;
-
+
+/* The table's memory, and an array for classes with SPARE_ALLOC
+   elements, are kept from one comparison to the next unless they are
+   larger than this many slots or elements, so that comparing many
+   small files does not allocate and clear them afresh each time.  */
+enum { KEEP_MAX = 64 * 1024 };
+static struct equivclass *spare_equivs;
+static lin spare_alloc;
+
+/* The file that retain_file has kept in memory, if any.  Its lines
+   are put into classes lazily, as comparisons first find them to
+   differ, and the classes outlive the comparison.  They are numbered
+   from 1 up, ahead of the classes of each comparison's other file,
+   which start afresh each time.  */
+static struct
+{
+  /* The class of each line, or 0 if the line has no class yet.  */
+  lin *classes;
+
+  /* The classes of the lines, and their number plus 1.  */
+  struct equivtable table;
+  struct equivclass *equivs;
+  lin equivs_index;
+  lin equivs_alloc;
+
+  /* The class of the file's incomplete last line, or 0 if none.  */
+  lin incomplete_class;
+} retained;
+
+/* The dictionary of lines that lasts the whole run (--line-dictionary).
+   A line put into it gets a copy of its text that lasts as long, so
+   that the comparisons that follow find the line's class there rather
+   than making a class of their own for it each time.  Its classes are
+   numbered apart from each comparison's; a comparison maps each class
+   of the dictionary that it meets to one of its own, so that the
+   arrays that it indexes by class stay as small as its files.  */
+static struct
+{
+  struct equivtable table;
+  struct equivclass *equivs;
+  lin equivs_index;
+  size_t equivs_alloc;
+
+  /* For each class, the class of the comparison being made that
+     stands for it, or 0; and the classes for which that is not 0.  */
+  lin *local;
+  lin *met;
+  lin nmet;
+  size_t met_alloc;
+
+  /* The free part of the block that the text of lines is copied
+     into.  */
+  char *text;
+  size_t text_left;
+
+  /* Roughly how many bytes the dictionary takes up, and whether it
+     has room for no more lines.  */
+  size_t memory;
+  bool full;
+} dictionary;
+
+/* Allocate as T an empty table of 2**BITS slots.  */
+
+static void
+alloc_table (struct equivtable *t, int bits)
+{
+  size_t slots = (size_t) 1 << bits;
+  if (PTRDIFF_MAX / (sizeof *t->hash + sizeof *t->class) < slots)
+    xalloc_die ();
+  t->hash = xmalloc (slots * sizeof *t->hash);
+  advise_huge_pages (t->hash, slots * sizeof *t->hash);
+  t->class = xmalloc (slots * sizeof *t->class);
+  advise_huge_pages (t->class, slots * sizeof *t->class);
+  memset (t->class, 0, slots * sizeof *t->class);
+  t->mask = slots - 1;
+  t->shift = sizeof (hash_value) * CHAR_BIT - bits;
+  t->used = 0;
+}
+
+/* Make TABLE empty, with 2**BITS slots, reusing its memory if it has
+   enough.  */
+
+static void
+reset_table (int bits)
+{
+  size_t slots = (size_t) 1 << bits;
+  if (table_alloc < slots)
+    {
+      free (table.hash);
+      free (table.class);
+      alloc_table (&table, bits);
+      table_alloc = slots;
+    }
+  else
+    {
+      memset (table.class, 0, slots * sizeof *table.class);
+      table.mask = slots - 1;
+      table.shift = sizeof (hash_value) * CHAR_BIT - bits;
+      table.used = 0;
+    }
+}
+
+/* Return the slot of T at which to start looking for the hash H.  */
+
+static size_t
+first_slot (struct equivtable const *t, hash_value h)
+{
+  return h >> t->shift;
+}
+
+/* Double the size of T, moving its classes to the new table.  */
+
+static void
+grow_table (struct equivtable *t)
+{
+  hash_value *old_hash = t->hash;
+  lin *old_class = t->class;
+  size_t old_slots = t->mask + 1;
+  size_t used = t->used;
+  size_t slot;
+
+  stats.table_grows++;
+  alloc_table (t, sizeof (hash_value) * CHAR_BIT - t->shift + 1);
+  t->used = used;
+
+  for (slot = 0; slot < old_slots; slot++)
+    if (old_class[slot])
+      {
+	size_t s = first_slot (t, old_hash[slot]);
+	while (t->class[s])
+	  s = (s + 1) & t->mask;
+	t->hash[s] = old_hash[slot];
+	t->class[s] = old_class[slot];
+      }
+
+  free (old_hash);
+  free (old_class);
+}
+
+/* Return a copy of the LENGTH bytes at P that lasts for the run,
+   followed by the newline that ends them, which lines_differ needs as
+   a sentinel.  */
+
+static char const *
+dictionary_text (char const *p, size_t length)
+{
+  enum { TEXT_BLOCK = 64 * 1024 };
+  size_t size = length + 1;
+  char *r;
+
+  if (TEXT_BLOCK / 4 < size)
+    r = xmalloc (size);
+  else
+    {
+      if (dictionary.text_left < size)
+	{
+	  dictionary.text = xmalloc (TEXT_BLOCK);
+	  dictionary.text_left = TEXT_BLOCK;
+	}
+      r = dictionary.text;
+      dictionary.text += size;
+      dictionary.text_left -= size;
+    }
+
+  memcpy (r, p, size);
+  return r;
+}
+
+/* Put into the dictionary the line at P, of length LENGTH and with
+   hash H, which it does not have and whose class belongs at SLOT of
+   its table.  Return the line's class, or 0 if the dictionary is
+   full.  */
+
+static lin
+dictionary_add (hash_value h, char const *p, size_t length, size_t slot)
+{
+  struct equivtable *t = &dictionary.table;
+  size_t cost = (length + 1 + sizeof *dictionary.equivs + sizeof *dictionary.local
+		 + 4 * (sizeof *t->hash + sizeof *t->class));
+  lin d;
+
+  if (dictionary.full || line_dictionary - dictionary.memory < cost)
+    {
+      dictionary.full = true;
+      return 0;
+    }
+
+  d = dictionary.equivs_index++;
+  if (dictionary.equivs_alloc <= d)
+    {
+      size_t old_alloc = dictionary.equivs_alloc;
+      dictionary.equivs = x2nrealloc (dictionary.equivs,
+				      &dictionary.equivs_alloc,
+				      sizeof *dictionary.equivs);
+      dictionary.local = xnrealloc (dictionary.local,
+				    dictionary.equivs_alloc,
+				    sizeof *dictionary.local);
+      memset (dictionary.local + old_alloc, 0,
+	      ((dictionary.equivs_alloc - old_alloc)
+	       * sizeof *dictionary.local));
+    }
+  dictionary.equivs[d].line = dictionary_text (p, length);
+  dictionary.equivs[d].length = length;
+  dictionary.memory += cost;
+
+  t->hash[slot] = h;
+  t->class[slot] = d;
+  if (t->mask / 2 < ++t->used)
+    grow_table (t);
+  return d;
+}
+
+static bool same_canonical_form (char const *, size_t,
+				 char const *, size_t);
+
+/* Return true if the line at LINE, of length LENGTH and with the same
+   hash as the lines of class EQ, belongs to that class.  */
+
+static bool
+same_class (struct equivclass const *eq, char const *line, size_t length)
+{
+  /* Reuse existing equivalence class if the lines are identical.
+     This detects the common case of exact identity
+     faster than lines_differ would.  */
+  if (eq->length == length && memcmp (eq->line, line, length) == 0)
+    return true;
+
+  /* lines_differ works a byte at a time, which is right only for
+     ASCII text in a multibyte locale.  */
+  if (multibyte_lines
+      && ! (ascii_bytes (eq->line, eq->length) && ascii_bytes (line, length)))
+    return same_canonical_form (eq->line, eq->length, line, length);
+
+  if (ignore_white_space == IGNORE_NO_WHITE_SPACE)
+    {
+      if (!ignore_case || eq->length != length)
+	return false;
+      if (ascii_case_fold)
+	return same_folded_bytes (eq->line, line, length);
+    }
+
+  stats.lines_differ++;
+  return ! lines_differ (eq->line, line);
+}
+
+/* Look in T for the class, among the classes EQS, of the line at
+   LINE, of length LENGTH and with hash H.  Return the class if there
+   is one.  Otherwise return 0 and set *SLOT to the empty slot where
+   the line's class belongs.  */
+
+static lin
+find_class (struct equivtable const *t, struct equivclass const *eqs,
+	    hash_value h, char const *line, size_t length, size_t *slot)
+{
+  size_t s;
+  size_t probes = 1;
+  lin i;
+
+  for (s = first_slot (t, h); (i = t->class[s]) != 0;
+       s = (s + 1) & t->mask, probes++)
+    if (t->hash[s] == h)
+      {
+	stats.compares++;
+	if (same_class (&eqs[i], line, length))
+	  break;
+	stats.collisions++;
+      }
+
+  stats.lookups++;
+  stats.probes += probes;
+  if (stats.max_probes < probes)
+    stats.max_probes = probes;
+
+  *slot = s;
+  return i;
+}
+
+/* The classes of the tokens of changed lines, for --word-diff.  They
+   are kept apart from the classes of lines, which are still in use
+   while the hunks are output, and are put in classes of tokens that
+   are the same byte for byte, or the same but for the case of ASCII
+   letters with --ignore-case.  */
+static struct equivtable token_table;
+static struct equivclass *token_equivs;
+static lin token_equivs_index;
+static size_t token_equivs_alloc;
+
+/* Forget the classes of tokens.  */
+
+void
+reset_token_classes (void)
+{
+  if (! token_table.class)
+    alloc_table (&token_table, 9);
+  else
+    {
+      memset (token_table.class, 0,
+	      (token_table.mask + 1) * sizeof *token_table.class);
+      token_table.used = 0;
+    }
+  token_equivs_index = 1;
+}
+
+/* Return the class of the token of SIZE bytes at P, making a new
+   class if it is unlike the tokens seen since the classes were last
+   reset.  */
+
+lin
+token_class (char const *p, size_t size)
+{
+  struct equivtable *t = &token_table;
+  bool fold_letters = ignore_case && ascii_case_fold;
+  hash_value h = fold_letters ? hash_folded_bytes (p, size) : hash_bytes (p, size);
+  size_t s;
+  lin i;
+
+  for (s = first_slot (t, h); (i = t->class[s]) != 0; s = (s + 1) & t->mask)
+    if (t->hash[s] == h && token_equivs[i].length == size
+	&& (fold_letters
+	    ? same_folded_bytes (token_equivs[i].line, p, size)
+	    : memcmp (token_equivs[i].line, p, size) == 0))
+      return i;
+
+  i = token_equivs_index++;
+  while (token_equivs_alloc <= i)
+    token_equivs = x2nrealloc (token_equivs, &token_equivs_alloc,
+			       sizeof *token_equivs);
+  token_equivs[i].line = p;
+  token_equivs[i].length = size;
+  t->hash[s] = h;
+  t->class[s] = i;
+  if (t->mask / 2 < ++t->used)
+    grow_table (t);
+  return i;
+}
+
 /* Read a block of data into a file buffer, checking for EOF and error.  */
 
 /*为current文件加载size个字节到buffer*/
@@ -79,9 +614,163 @@ file_block_read (struct file_data *current, size_t size)
 	pfatal_with_name (current->name);
       current->buffered += s;
       current->eof = s < size;
+      progress_tick ();
     }
 }
 
+/* Blocks that held the text or the lines of one comparison are kept
+   for the next rather than freed, so that comparing many small files
+   does not allocate and fault in fresh memory for each pair.  Each
+   block taken is the smallest that is large enough.  Blocks larger
+   than MMAP_THRESHOLD are freed, as files that would need them are
+   mapped rather than read.  */
+enum { SPARE_BLOCKS = 8 };
+static struct
+{
+  void *block;
+  size_t size;
+} spare_blocks[SPARE_BLOCKS];
+
+/* Return a block of at least SIZE bytes.  */
+
+void *
+take_spare_block (size_t size)
+{
+  int best = -1;
+  int i;
+  void *block;
+
+  for (i = 0; i < SPARE_BLOCKS; i++)
+    if (spare_blocks[i].block && size <= spare_blocks[i].size
+	&& (best < 0 || spare_blocks[i].size < spare_blocks[best].size))
+      best = i;
+  if (best < 0)
+    return xmalloc (size);
+
+  block = spare_blocks[best].block;
+  spare_blocks[best].block = NULL;
+  return block;
+}
+
+/* Keep BLOCK, which has at least SIZE bytes, for take_spare_block,
+   in place of a smaller block if all are kept; or free it.  */
+
+void
+keep_spare_block (void *block, size_t size)
+{
+  int smallest = -1;
+  int i;
+
+  if (block && size <= MMAP_THRESHOLD)
+    for (i = 0; i < SPARE_BLOCKS; i++)
+      {
+	if (! spare_blocks[i].block)
+	  {
+	    smallest = i;
+	    break;
+	  }
+	if (smallest < 0 || spare_blocks[i].size < spare_blocks[smallest].size)
+	  smallest = i;
+      }
+
+  if (0 <= smallest
+      && (! spare_blocks[smallest].block || spare_blocks[smallest].size < size))
+    {
+      free (spare_blocks[smallest].block);
+      spare_blocks[smallest].block = block;
+      spare_blocks[smallest].size = size;
+    }
+  else
+    free (block);
+}
+
+/* Free the buffer of CURRENT, whether it was allocated or mapped,
+   unless the buffer is retained.  */
+
+void
+file_buffer_free (struct file_data *current)
+{
+  free_line_index (current->index);
+  current->index = NULL;
+  if (current->retained || current->supplied)
+    return;
+#if USE_MMAP
+  if (current->mapped)
+    {
+      unwatch_mapping (current->buffer);
+      munmap (current->buffer, current->mapped);
+      current->mapped = 0;
+      return;
+    }
+#endif
+  keep_spare_block (current->buffer, current->bufsize);
+}
+
+#if USE_MMAP
+/* Try to map the regular file CURRENT, which has FILE_SIZE bytes,
+   into a private region of at least SIZE bytes instead of reading it.
+   The region is anonymous memory overlaid with a copy-on-write
+   mapping of the file, so the appended newline and the sentinels can
+   be stored past the end of the file's data.  Return true if
+   successful; otherwise leave CURRENT alone.  */
+
+static bool
+map_file (struct file_data *current, size_t file_size, size_t size)
+{
+  size_t pagesize = getpagesize ();
+  size_t mapsize;
+  off_t pos;
+  void *region;
+  struct stat st;
+
+  /* A file's pages in the page cache are small, so with --huge-pages
+     the file is read into anonymous memory instead.  With --direct-io
+     it is read so as to keep it out of the cache, and with --apply it
+     may be rewritten while its data are still in use.  */
+  if (file_size < MMAP_THRESHOLD || huge_pages || direct_io || apply_edits)
+    return false;
+
+  /* Any data already read by sip must start at the beginning of the
+     file, so that the mapping's offset is page-aligned.  */
+  pos = lseek (current->desc, 0, SEEK_CUR);
+  if (pos < 0 || pos != current->buffered)
+    return false;
+
+  mapsize = size + (pagesize - size % pagesize) % pagesize;
+  if (mapsize < size)
+    return false;
+
+  region = mmap (NULL, mapsize, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+    return false;
+  if (mmap (region, file_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_FIXED, current->desc, 0) == MAP_FAILED
+      /* Fall back on reading a file that is changing.  */
+      || fstat (current->desc, &st) != 0
+      || st.st_size != current->stat.st_size
+      /* A file that shrinks later would raise SIGBUS; report it.  */
+      || ! watch_mapping (region, mapsize, current->name))
+    {
+      munmap (region, mapsize);
+      return false;
+    }
+
+#ifdef MADV_WILLNEED
+  /* All of the file will be scanned right away, so start reading it
+     in now, to overlap the I/O with the scanning.  */
+  madvise (region, file_size, MADV_WILLNEED);
+#endif
+
+  keep_spare_block (current->buffer, current->bufsize);
+  current->buffer = region;
+  current->bufsize = current->mapped = mapsize;
+  current->buffered = file_size;
+  current->eof = true;
+  return true;
+}
+#endif
+
 /* Check for binary files and compare them for exact identity.  */
 
 /* Return 1 if BUF contains a non text character.
@@ -96,12 +785,16 @@ file_block_read (struct file_data *current, size_t size)
 static bool
 sip (struct file_data *current, bool skip_test)
 {
+  /* The text of a supplied file is already in its buffer.  */
+  if (current->supplied)
+    return false;
+
   /* If we have a nonexistent file at this stage, treat it as empty.  */
   if (current->desc < 0)
     {
       /* Leave room for a sentinel.  */
       current->bufsize = sizeof (word);
-      current->buffer = xmalloc (current->bufsize);
+      current->buffer = take_spare_block (current->bufsize);
     }
   else
     {
@@ -109,7 +802,7 @@ sip (struct file_data *current, bool skip_test)
       current->bufsize = buffer_lcm (sizeof (word),
 				     STAT_BLOCKSIZE (current->stat),
 				     PTRDIFF_MAX - 2 * sizeof (word));
-      current->buffer = xmalloc (current->bufsize);
+      current->buffer = take_spare_block (current->bufsize);
 
 #ifdef __KLIBC__
       /* Skip test if seek is not possible */
@@ -122,8 +815,26 @@ sip (struct file_data *current, bool skip_test)
 	{
 	  /* Check first part of file to see if it's a binary file.  */
 
-	  int prev_mode = set_binary_mode (current->desc, O_BINARY);
+	  int prev_mode;
 	  off_t buffered;
+
+#if USE_MMAP
+	  /* Map a large regular file now and check the mapping, rather
+	     than reading a block that slurp would then map again.  When
+	     comparing a window at a time the file is read instead.  */
+	  if (S_ISREG (current->stat.st_mode) && ! max_memory)
+	    {
+	      size_t sample = current->bufsize;
+	      size_t file_size = current->stat.st_size;
+	      size_t cc = (file_size + 2 * sizeof (word)
+			   - file_size % sizeof (word));
+	      if (file_size == current->stat.st_size && file_size < cc
+		  && cc < PTRDIFF_MAX && map_file (current, file_size, cc))
+		return binary_file_p (current->buffer, MIN (file_size, sample));
+	    }
+#endif
+
+	  prev_mode = set_binary_mode (current->desc, O_BINARY);
 	  /*尝试读满buffer*/
 	  file_block_read (current, current->bufsize);
 	  buffered = current->buffered;
@@ -156,9 +867,10 @@ slurp (struct file_data *current)
 {
   size_t cc;
 
-  if (current->desc < 0)
+  if (current->desc < 0 || current->mapped || current->supplied)
     {
-      /* The file is nonexistent.  */
+      /* The file is nonexistent, or sip has already mapped it, or its
+	 text was supplied.  */
       return;
     }
 
@@ -175,10 +887,16 @@ slurp (struct file_data *current)
 	  || PTRDIFF_MAX <= cc)
 	xalloc_die ();
 
+#if USE_MMAP
+      if (map_file (current, file_size, cc))
+	return;
+#endif
+
       if (current->bufsize < cc)
 	{
 	  current->bufsize = cc;
 	  current->buffer = xrealloc (current->buffer, cc);
+	  advise_huge_pages (current->buffer, cc);
 	}
 
       /* Try to read at least 1 more byte than the size indicates, to
@@ -194,7 +912,10 @@ slurp (struct file_data *current)
     }
 
   /* It's not a regular file, or it's a growing regular file; read it,
-     growing the buffer as needed.  */
+     growing the buffer as needed.  Doubling the buffer keeps the total
+     copying linear, and typical allocators grow large blocks by
+     remapping pages rather than copying them, so a chain of separate
+     chunks would only add a final copy into one contiguous buffer.  */
 
   file_block_read (current, current->bufsize - current->buffered);
 
@@ -206,6 +927,7 @@ slurp (struct file_data *current)
 	    xalloc_die ();
 	  current->bufsize *= 2;
 	  current->buffer = xrealloc (current->buffer, current->bufsize);
+	  advise_huge_pages (current->buffer, current->bufsize);
 	  file_block_read (current, current->bufsize - current->buffered);
 	}
 
@@ -217,215 +939,585 @@ slurp (struct file_data *current)
     }
 }
 
-/* Split the file into lines, simultaneously computing the equivalence
-   class for each line.  */
-
-static void
-find_and_hash_each_line (struct file_data *current)
+/* A buffer for the canonical form of a line, and its size; and
+   another, for comparing two lines' canonical forms.  */
+static char *canon;
+static size_t canon_size;
+static char *other_canon;
+static size_t other_canon_size;
+
+/* Make room for at least SIZE bytes in the canonical form buffer,
+   keeping the first USED bytes, and return the buffer.  */
+
+static char *
+canon_room (size_t size, size_t used)
 {
-  char const *p = current->prefix_end;
-  lin i, *bucket;
-  size_t length;
+  if (canon_size < size)
+    {
+      char *old = canon;
+      canon_size = MAX (size, 2 * canon_size);
+      canon = xmalloc (canon_size);
+      if (used)
+	memcpy (canon, old, used);
+      free (old);
+    }
+  return canon;
+}
 
-  /* Cache often-used quantities in local variables to help the compiler.  */
-  char const **linbuf = current->linbuf;
-  lin alloc_lines = current->alloc_lines;
-  lin line = 0;
-  lin linbuf_base = current->linbuf_base;
-  lin *cureqs = xmalloc (alloc_lines * sizeof *cureqs);
-  struct equivclass *eqs = equivs;
-  lin eqs_index = equivs_index;
-  lin eqs_alloc = equivs_alloc;
-  char const *suffix_begin = current->suffix_begin;
-  char const *bufend = FILE_BUFFER (current) + current->buffered;
-  bool ig_case = ignore_case;
-  enum DIFF_white_space ig_white_space = ignore_white_space;
-  bool diff_length_compare_anyway =
-    ig_white_space != IGNORE_NO_WHITE_SPACE;
-  bool same_length_diff_contents_compare_anyway =
-    diff_length_compare_anyway | ig_case;
+/* The most bytes that put_blank_run stores.  */
+enum { BLANK_RUN_MAX = 1 + (sizeof (size_t) * CHAR_BIT + 6) / 7 };
 
-  while (p < suffix_begin)
+/* Store at Q, in the canonical form buffer that starts at *Q0, the form
+   of a run of spaces and tabs that expands to WIDTH columns, with room
+   for REST more bytes after it, and return the end of the form.  Set
+   *Q0 to the buffer's new start if it moves.  A run of one column is
+   a space, and a longer run is a tab followed by its width, seven bits
+   to a byte, so that the form takes time proportional to the line's
+   length rather than to its expanded width.  */
+
+static char *
+put_blank_run (char **q0, char *q, size_t width, size_t rest)
+{
+  size_t used = q - *q0;
+  if (canon_size - used < BLANK_RUN_MAX
+      || canon_size - used - BLANK_RUN_MAX < rest)
     {
-      char const *ip = p;
-      hash_value h = 0;
-      unsigned char c;
+      if (SIZE_MAX - used - rest < BLANK_RUN_MAX)
+	xalloc_die ();
+      *q0 = canon_room (used + BLANK_RUN_MAX + rest, used);
+      q = *q0 + used;
+    }
 
-      /* Hash this line until we find a newline.  */
-      switch (ig_white_space)
+  if (width == 1)
+    *q++ = ' ';
+  else
+    {
+      *q++ = '\t';
+      do
 	{
-	case IGNORE_ALL_SPACE:
-	  while ((c = *p++) != '\n')
-	    if (! isspace (c))
-	      h = HASH (h, ig_case ? tolower (c) : c);
-	  break;
+	  *q++ = (width & 0x7f) | (0x7f < width) << 7;
+	  width >>= 7;
+	}
+      while (width);
+    }
+  return q;
+}
 
-	case IGNORE_SPACE_CHANGE:
-	  while ((c = *p++) != '\n')
-	    {
-	      if (isspace (c))
-		{
-		  do
-		    if ((c = *p++) == '\n')
-		      goto hashing_done;
-		  while (isspace (c));
+/* Return the number of columns that a blank C, a space or a tab, takes
+   up when it starts at *COLUMN, and advance *COLUMN past it.  */
 
-		  h = HASH (h, ' ');
-		}
+static size_t
+blank_width (unsigned char c, size_t *column)
+{
+  size_t width = c == ' ' ? 1 : tabsize - *column % tabsize;
+  *column = *column + width < *column ? 0 : *column + width;
+  return width;
+}
 
-	      /* C is now the first non-space.  */
-	      h = HASH (h, ig_case ? tolower (c) : c);
-	    }
-	  break;
+/* Store into the canonical form buffer the form of the LEN-byte line
+   at P that is the same for all lines that lines_differ considers
+   equal when ignoring white space as IG_WHITE_SPACE says, and return
+   its length.  IG_WHITE_SPACE does not ignore trailing white space;
+   the caller removes it first if need be.  */
 
-	case IGNORE_TAB_EXPANSION:
-	case IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE:
-	case IGNORE_TRAILING_SPACE:
+static size_t
+canonical_line (char const *p, size_t len,
+		enum DIFF_white_space ig_white_space)
+{
+  char const *lim = p + len;
+  char *q = canon_room (len, 0);
+  char *q0 = q;
+
+  switch (ig_white_space)
+    {
+    case IGNORE_ALL_SPACE:
+      /* Drop all white space.  Store each byte, but advance past it
+	 only if it is kept, so that the loop has no branches.  */
+      for (; p < lim; p++)
+	{
+	  unsigned char c = *p;
+	  *q = fold[c];
+	  q += ! is_space[c];
+	}
+      break;
+
+    case IGNORE_SPACE_CHANGE:
+      /* Turn each run of white space into one space, and then drop
+	 the space that ends the line, if any.  */
+      {
+	bool prev_space = false;
+	for (; p < lim; p++)
+	  {
+	    unsigned char c = *p;
+	    bool space = is_space[c];
+	    *q = fold_space[c];
+	    q += ! (space & prev_space);
+	    prev_space = space;
+	  }
+	q -= prev_space;
+      }
+      break;
+
+    case IGNORE_TAB_EXPANSION:
+      {
+	size_t column = 0;
+	while (p < lim)
 	  {
-	    size_t column = 0;
-	    while ((c = *p++) != '\n')
+	    unsigned char c = *p++;
+
+	    switch (c)
 	      {
-		if (ig_white_space & IGNORE_TRAILING_SPACE
-		    && isspace (c))
+	      case ' ':
+		/* A lone space is its own form.  */
+		if (p == lim || (*p != ' ' && *p != '\t'))
 		  {
-		    char const *p1 = p;
-		    unsigned char c1;
-		    do
-		      if ((c1 = *p1++) == '\n')
-			{
-			  p = p1;
-			  goto hashing_done;
-			}
-		    while (isspace (c1));
+		    column++;
+		    break;
 		  }
-
-		size_t repetitions = 1;
-
-		if (ig_white_space & IGNORE_TAB_EXPANSION)
-		  switch (c)
+		/* Fall through.  */
+	      case '\t':
+		{
+		  size_t width = blank_width (c, &column);
+		  for (; p < lim && (*p == ' ' || *p == '\t'); p++)
 		    {
-		    case '\b':
-		      column -= 0 < column;
-		      break;
-
-		    case '\t':
-		      c = ' ';
-		      repetitions = tabsize - column % tabsize;
-		      column = (column + repetitions < column
-				? 0
-				: column + repetitions);
-		      break;
-
-		    case '\r':
-		      column = 0;
-		      break;
-
-		    default:
-		      column++;
-		      break;
+		      size_t w = blank_width (*p, &column);
+		      if (width + w < width)
+			xalloc_die ();
+		      width += w;
 		    }
+		  q = put_blank_run (&q0, q, width, lim - p);
+		}
+		continue;
+
+	      case '\b':
+		column -= 0 < column;
+		break;
 
-		if (ig_case)
-		  c = tolower (c);
+	      case '\r':
+		column = 0;
+		break;
 
-		do
-		  h = HASH (h, c);
-		while (--repetitions != 0);
+	      default:
+		column++;
+		break;
 	      }
+
+	    *q++ = fold[c];
 	  }
-	  break;
+      }
+      break;
 
-	default:
-	  if (ig_case)
-	    while ((c = *p++) != '\n')
-	      h = HASH (h, tolower (c));
-	  else
-	    while ((c = *p++) != '\n')
-	      h = HASH (h, c);
-	  break;
-	}
+    default:
+      for (; p < lim; p++)
+	*q++ = fold[(unsigned char) *p];
+      break;
+    }
 
-   hashing_done:;
+  return q - q0;
+}
 
-      bucket = &buckets[h % nbuckets];
-      length = p - ip - 1;
+/* Like canonical_line, but for a line in a multibyte locale.  Lowercase
+   and classify the line's characters with the wide character functions
+   rather than its bytes, and count a character as one column.  Keep
+   bytes that are not part of a valid character as they are.  */
 
-      if (p == bufend
-	  && current->missing_newline
-	  && ROBUST_OUTPUT_STYLE (output_style))
+static size_t
+canonical_mb_line (char const *p, size_t len,
+		   enum DIFF_white_space ig_white_space)
+{
+  char const *lim = p + len;
+  char *q0 = canon_room (len, 0);
+  char *q = q0;
+  size_t column = 0;
+  size_t run = 0;
+  bool prev_space = false;
+  mbstate_t in = { 0 };
+  mbstate_t out = { 0 };
+
+  while (p < lim)
+    {
+      char buf[MB_LEN_MAX];
+      size_t outlen = 1;
+      size_t used, rest;
+      bool space = false;
+      wchar_t wc;
+      size_t bytes = mbrtowc (&wc, p, lim - p, &in);
+
+      if ((size_t) -2 <= bytes)
 	{
-	  /* The last line is incomplete and we do not silently
-	     complete lines.  If the line cannot compare equal to any
-	     complete line, put it into buckets[-1] so that it can
-	     compare equal only to the other file's incomplete line
-	     (if one exists).  */
-	  if (ig_white_space < IGNORE_TRAILING_SPACE)
-	    bucket = &buckets[-1];
+	  memset (&in, 0, sizeof in);
+	  buf[0] = *p;
+	  bytes = 1;
 	}
+      else
+	{
+	  bytes += ! bytes;
+	  space = iswspace (wc) != 0;
+	  if (ignore_case)
+	    wc = towlower (wc);
+	  outlen = wcrtomb (buf, wc, &out);
+	  if (outlen == (size_t) -1)
+	    {
+	      memset (&out, 0, sizeof out);
+	      memcpy (buf, p, bytes);
+	      outlen = bytes;
+	    }
+	}
+      p += bytes;
 
-      for (i = *bucket;  ;  i = eqs[i].next)
-	if (!i)
-	  {
-	    /* Create a new equivalence class in this bucket.  */
-	    i = eqs_index++;
-	    if (i == eqs_alloc)
-	      {
-		if (PTRDIFF_MAX / (2 * sizeof *eqs) <= eqs_alloc)
-		  xalloc_die ();
-		eqs_alloc *= 2;
-		eqs = xrealloc (eqs, eqs_alloc * sizeof *eqs);
-	      }
-	    eqs[i].next = *bucket;
-	    eqs[i].hash = h;
-	    eqs[i].line = ip;
-	    eqs[i].length = length;
-	    *bucket = i;
-	    break;
-	  }
-	else if (eqs[i].hash == h)
-	  {
-	    char const *eqline = eqs[i].line;
+      switch (ig_white_space)
+	{
+	case IGNORE_ALL_SPACE:
+	  if (space)
+	    continue;
+	  break;
+
+	case IGNORE_SPACE_CHANGE:
+	  if (space)
+	    {
+	      if (prev_space)
+		continue;
+	      buf[0] = ' ';
+	      outlen = 1;
+	    }
+	  prev_space = space;
+	  break;
 
-	    /* Reuse existing class if lines_differ reports the lines
-               equal.  */
-	    if (eqs[i].length == length)
+	case IGNORE_TAB_EXPANSION:
+	  switch (outlen == 1 ? buf[0] : 0)
+	    {
+	    case ' ': case '\t':
 	      {
-		/* Reuse existing equivalence class if the lines are identical.
-		   This detects the common case of exact identity
-		   faster than lines_differ would.  */
-		if (memcmp (eqline, ip, length) == 0)
-		  break;
-		if (!same_length_diff_contents_compare_anyway)
-		  continue;
+		size_t w = blank_width (buf[0], &column);
+		if (run + w < run)
+		  xalloc_die ();
+		run += w;
 	      }
-	    else if (!diff_length_compare_anyway)
 	      continue;
 
-	    if (! lines_differ (eqline, ip))
+	    case '\b':
+	      column -= 0 < column;
 	      break;
-	  }
+
+	    case '\r':
+	      column = 0;
+	      break;
+
+	    default:
+	      column++;
+	      break;
+	    }
+	  break;
+
+	default:
+	  break;
+	}
+
+      if (run)
+	{
+	  q = put_blank_run (&q0, q, run, outlen + (lim - p));
+	  run = 0;
+	}
+
+      /* Make room for this character's form and the rest of the line.  */
+      used = q - q0;
+      rest = lim - p;
+      if (canon_size - used < outlen || canon_size - used - outlen < rest)
+	{
+	  if (SIZE_MAX - used - rest < outlen)
+	    xalloc_die ();
+	  q0 = canon_room (used + outlen + rest, used);
+	  q = q0 + used;
+	}
+
+      memcpy (q, buf, outlen);
+      q += outlen;
+    }
+
+  if (run)
+    q = put_blank_run (&q0, q, run, 0);
+  q -= prev_space;
+  return q - q0;
+}
+
+/* Return the length of the LEN bytes at P, a line without its newline,
+   less any trailing white space that the options ignore, and set
+   *IG_WHITE_SPACE to how the options ignore the rest of its white
+   space.  */
+
+static size_t
+trimmed_length (char const *p, size_t len,
+		enum DIFF_white_space *ig_white_space)
+{
+  *ig_white_space = ignore_white_space;
+  if (*ig_white_space == IGNORE_TRAILING_SPACE
+      || *ig_white_space == IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE)
+    {
+      while (len && isspace ((unsigned char) p[len - 1]))
+	len--;
+      *ig_white_space = (*ig_white_space == IGNORE_TRAILING_SPACE
+			 ? IGNORE_NO_WHITE_SPACE : IGNORE_TAB_EXPANSION);
+    }
+  return len;
+}
+
+/* Store the canonical form of the LEN bytes at P, a line without its
+   newline, into the canonical form buffer and return its length.  */
+
+static size_t
+canonical_form (char const *p, size_t len)
+{
+  enum DIFF_white_space ig_white_space;
+  len = trimmed_length (p, len, &ig_white_space);
+  return (multibyte_lines && ! ascii_bytes (p, len)
+	  ? canonical_mb_line (p, len, ig_white_space)
+	  : canonical_line (p, len, ig_white_space));
+}
+
+/* Return true if the LEN0 bytes at P0 and the LEN1 bytes at P1, lines
+   without their newlines, have the same canonical form.  */
+
+static bool
+same_canonical_form (char const *p0, size_t len0,
+		     char const *p1, size_t len1)
+{
+  size_t n0 = canonical_form (p0, len0);
+  size_t n1;
+  char *c0 = canon;
+  size_t size0 = canon_size;
+
+  canon = other_canon;
+  canon_size = other_canon_size;
+  n1 = canonical_form (p1, len1);
+  other_canon = canon;
+  other_canon_size = canon_size;
+  canon = c0;
+  canon_size = size0;
+
+  return n0 == n1 && memcmp (c0, other_canon, n0) == 0;
+}
+
+/* Return the hash of the line at P, which ends in a newline, taking
+   into account the options that affect how lines compare.  Set *END
+   to the start of the next line.  The hash is that of the line's
+   canonical form, which is stored first in a buffer if it differs
+   from the line itself, and is hashed a word at a time.  */
+
+static hash_value
+hash_line (char const *p, char const **end)
+{
+  char const *nl = rawmemchr (p, '\n');
+  enum DIFF_white_space ig_white_space;
+  size_t len;
+
+  *end = nl + 1;
+
+  if (! fold_ready)
+    prepare_fold ();
+
+  len = trimmed_length (p, nl - p, &ig_white_space);
+
+  if (multibyte_lines && ! ascii_bytes (p, len))
+    return hash_bytes (canon, canonical_mb_line (p, len, ig_white_space));
+
+  if (ig_white_space == IGNORE_NO_WHITE_SPACE)
+    {
+      if (!ignore_case)
+	return hash_bytes (p, len);
+      if (ascii_case_fold)
+	return hash_folded_bytes (p, len);
+    }
+
+  return hash_bytes (canon, canonical_line (p, len, ig_white_space));
+}
+
+/* Return a signature of the options and locale tables that the
+   hashes of lines depend on, for the indexes of the lines of files
+   (--read-index, --write-index), or 0 if lines are hashed in a way
+   that depends on the locale's multibyte characters, which indexes
+   are not used for.  */
+
+static uint64_t
+index_options (void)
+{
+  hash_value h;
+
+  if (! fold_ready)
+    prepare_fold ();
+  if (multibyte_lines)
+    return 0;
+
+  h = hash_bytes ((char const *) fold, sizeof fold);
+  h = HASH (h, hash_bytes ((char const *) is_space, sizeof is_space));
+  h = HASH (h, (ignore_case | strip_trailing_cr << 1 | ascii_case_fold << 2
+		| ignore_white_space << 3));
+  h = HASH (h, tabsize);
+  h = HASH (h, sizeof h);
+  return hash_finish (h, 0) | 1;
+}
+
+/* Return true if an index of the lines of file F of FILEVEC can be
+   read or written: the file is a regular file that has been read
+   whole into a buffer of its own.  */
+
+static bool
+indexable (struct file_data const filevec[], int f)
+{
+  struct file_data const *file = &filevec[f];
+  return (0 <= file->desc && S_ISREG (file->stat.st_mode)
+	  && ! file->retained && ! file->supplied
+	  && filevec[0].buffer != filevec[1].buffer);
+}
+
+/* Write the index of the lines of CURRENT, whose text is in its
+   buffer, hashed with OPTIONS.  */
+
+static void
+write_line_index (struct file_data const *current, uint64_t options)
+{
+  char const *buffer = FILE_BUFFER (current);
+  size_t pos = 0;
+  lin lines = 0;
+  size_t alloc = 0;
+  uint64_t *offset = NULL;
+  uint64_t *hash = NULL;
+
+  for (;;)
+    {
+      char const *p;
+      if (lines == alloc)
+	{
+	  size_t n = alloc;
+	  offset = x2nrealloc (offset, &alloc, sizeof *offset);
+	  hash = x2nrealloc (hash, &n, sizeof *hash);
+	}
+      offset[lines] = pos;
+      if (pos == current->buffered)
+	break;
+      hash[lines++] = hash_line (buffer + pos, &p);
+      pos = p - buffer;
+    }
+
+  save_line_index (current, options, lines, offset, hash);
+  free (offset);
+  free (hash);
+}
+
+/* We have found N lines in a buffer of size S; guess the
+   proportionate number of lines that will be found in a buffer of
+   size T.  However, do not guess a number of lines so large that the
+   resulting line table might cause overflow in size calculations.  */
+static lin
+guess_lines (lin n, size_t s, size_t t)
+{
+  size_t guessed_bytes_per_line = n < 10 ? 32 : s / (n - 1);
+  lin guessed_lines = MAX (1, t / guessed_bytes_per_line);
+  return MIN (guessed_lines, PTRDIFF_MAX / (2 * sizeof (char *) + 1) - 5) + 5;
+}
+
+/* Return how many more lines to make room for in a line table that
+   is full, with N lines spanning S bytes and BASE lines before them,
+   when T bytes follow them that may have lines to record, but no more
+   than MOST lines.  Make room for half the lines guessed to be left,
+   so that the guess, made again from more lines each time the table
+   fills, need not be right to keep the table from being much larger
+   than the lines in it; but grow the table by at least a sixteenth,
+   unless MOST is less, so that growing it takes linear time.  */
+
+static lin _GL_ATTRIBUTE_PURE
+more_lines (lin n, lin base, size_t s, size_t t, lin most)
+{
+  lin more = MAX (guess_lines (n + 1, s, t) / 2, (n - base) / 16 + 1);
+  more = MIN (more, most);
+  if (PTRDIFF_MAX / MAX (sizeof (char *), sizeof (hash_value)) - (n - base)
+      <= more)
+    xalloc_die ();
+  return more;
+}
+
+/* Split the file into lines, computing the hash of each line.
+   Record the hashes in CURRENT->equivs for now; assign_equivs later
+   replaces them with equivalence classes.  This stage does not
+   touch the hash table shared by both files.  Lines of the retained
+   file that already have classes are not hashed.  */
+
+static void
+find_and_hash_each_line (struct file_data *current)
+{
+  char const *p = current->prefix_end;
+
+  /* Cache often-used quantities in local variables to help the compiler.  */
+  char const **linbuf = current->linbuf;
+  lin alloc_lines = current->alloc_lines;
+  lin line = 0;
+  lin linbuf_base = current->linbuf_base;
+  lin hashed = progress.hashed;
+  hash_value *hashes = xmalloc (alloc_lines * sizeof *hashes);
+  char const *suffix_begin = current->suffix_begin;
+  char const *bufend = FILE_BUFFER (current) + current->buffered;
+  lin const *known = (current->retained
+		      ? retained.classes + current->prefix_lines : NULL);
+  struct line_index const *index = current->index;
+  char const *buffer = FILE_BUFFER (current);
+  char const *prefix_end = current->prefix_end;
+
+  /* The end of the lines that are all recorded.  */
+  char const *record_lim = no_diff_means_no_output ? suffix_begin : bufend;
+  lin i;
+
+  while (p < suffix_begin)
+    {
+      char const *ip = p;
+      hash_value h;
+      lin k = current->prefix_lines + line;
+
+      if (known && known[line])
+	{
+	  h = 0;
+	  p = (char const *) rawmemchr (ip, '\n') + 1;
+	}
+      else if (index && k < index->lines
+	       && index->offset[k] == (uint64_t) (ip - buffer)
+	       && index->offset[k] < index->offset[k + 1]
+	       && index->offset[k + 1] <= current->buffered
+	       && buffer[index->offset[k + 1] - 1] == '\n')
+	{
+	  /* The index is checked line by line, as it costs little,
+	     and a damaged index then only costs the time to hash the
+	     rest of the lines.  */
+	  h = index->hash[k];
+	  p = buffer + index->offset[k + 1];
+	}
+      else
+	{
+	  index = NULL;
+	  h = hash_line (ip, &p);
+	}
 
       /* Maybe increase the size of the line table.  */
       if (line == alloc_lines)
 	{
-	  /* Double (alloc_lines - linbuf_base) by adding to alloc_lines.  */
-	  if (PTRDIFF_MAX / 3 <= alloc_lines
-	      || PTRDIFF_MAX / sizeof *cureqs <= 2 * alloc_lines - linbuf_base
-	      || PTRDIFF_MAX / sizeof *linbuf <= alloc_lines - linbuf_base)
-	    xalloc_die ();
-	  alloc_lines = 2 * alloc_lines - linbuf_base;
-	  cureqs = xrealloc (cureqs, alloc_lines * sizeof *cureqs);
+	  alloc_lines += more_lines (line, linbuf_base, ip - prefix_end,
+				     record_lim - ip, LIN_MAX);
+	  hashes = xrealloc (hashes, alloc_lines * sizeof *hashes);
 	  linbuf += linbuf_base;
 	  linbuf = xrealloc (linbuf,
 			     (alloc_lines - linbuf_base) * sizeof *linbuf);
 	  linbuf -= linbuf_base;
 	}
       linbuf[line] = ip;
-      cureqs[line] = i;
+      hashes[line] = h;
       ++line;
+
+      if (show_progress && ! (line & 0xffff))
+	{
+	  progress.hashed = hashed + line;
+	  progress_tick ();
+	}
     }
 
   current->buffered_lines = line;
+  progress.hashed = hashed + line;
 
   for (i = 0;  ;  i++)
     {
@@ -434,12 +1526,10 @@ find_and_hash_each_line (struct file_data *current)
 	 so that we can compute the length of any buffered line.  */
       if (line == alloc_lines)
 	{
-	  /* Double (alloc_lines - linbuf_base) by adding to alloc_lines.  */
-	  if (PTRDIFF_MAX / 3 <= alloc_lines
-	      || PTRDIFF_MAX / sizeof *cureqs <= 2 * alloc_lines - linbuf_base
-	      || PTRDIFF_MAX / sizeof *linbuf <= alloc_lines - linbuf_base)
-	    xalloc_die ();
-	  alloc_lines = 2 * alloc_lines - linbuf_base;
+	  alloc_lines += more_lines (line, linbuf_base, p - prefix_end,
+				     bufend - p,
+				     (no_diff_means_no_output
+				      ? context - i + 1 : LIN_MAX));
 	  linbuf += linbuf_base;
 	  linbuf = xrealloc (linbuf,
 			     (alloc_lines - linbuf_base) * sizeof *linbuf);
@@ -461,27 +1551,186 @@ find_and_hash_each_line (struct file_data *current)
 
       line++;
 
-      while (*p++ != '\n')
-	continue;
+      p = (char const *) rawmemchr (p, '\n') + 1;
     }
 
   /* Done with cache in local variables.  */
   current->linbuf = linbuf;
   current->valid_lines = line;
   current->alloc_lines = alloc_lines;
-  current->equivs = cureqs;
+  current->equivs = (lin *) hashes;
+}
+
+/* Replace the line hashes that find_and_hash_each_line recorded for
+   CURRENT with equivalence classes, creating classes as needed.
+   Lines of the retained file keep the classes they already have, and
+   their new classes go into the retained file's table.  The lines of
+   other files look for their classes in the table SHARED first, if
+   it is not null.  Otherwise, with --line-dictionary, they look for
+   them in the dictionary, and go into it if they are not there and it
+   has room.  */
+
+static void
+assign_equivs (struct file_data *current, struct equivtable const *shared)
+{
+  /* Cache often-used quantities in local variables to help the compiler.  */
+  char const *const *linbuf = current->linbuf;
+  lin lines = current->buffered_lines;
+  lin *cureqs = current->equivs;
+  hash_value const *hashes = (hash_value const *) cureqs;
+  lin *known = (current->retained
+		? retained.classes + current->prefix_lines : NULL);
+  struct equivtable *t = current->retained ? &retained.table : &table;
+  bool use_dictionary = line_dictionary && ! shared && ! current->retained;
+  struct equivclass *eqs = equivs;
+  lin eqs_index = equivs_index;
+  lin eqs_alloc = equivs_alloc;
+  char const *suffix_begin = current->suffix_begin;
+  char const *bufend = FILE_BUFFER (current) + current->buffered;
+  lin line;
+
+  for (line = 0; line < lines; line++)
+    {
+      char const *ip = linbuf[line];
+      char const *p = line + 1 < lines ? linbuf[line + 1] : suffix_begin;
+      size_t length = p - ip - 1;
+      hash_value h = hashes[line];
+      size_t slot IF_LINT (= 0);
+      lin d = 0;
+      lin i;
+
+      /* If the last line is incomplete and we do not silently
+	 complete lines, and if the line cannot compare equal to any
+	 complete line, keep it out of the table so that it can
+	 compare equal only to the other file's incomplete line
+	 (if one exists).  */
+      bool incomplete = (p == bufend
+			 && current->missing_newline
+			 && ROBUST_OUTPUT_STYLE (output_style)
+			 && ignore_white_space < IGNORE_TRAILING_SPACE);
+
+      if (known && known[line])
+	i = known[line];
+      else if (incomplete)
+	{
+	  i = incomplete_class;
+	  if (i && ! same_class (&eqs[i], ip, length))
+	    i = 0;
+	}
+      else
+	{
+	  i = shared ? find_class (shared, eqs, h, ip, length, &slot) : 0;
+	  if (use_dictionary)
+	    {
+	      d = find_class (&dictionary.table, dictionary.equivs,
+			      h, ip, length, &slot);
+	      if (d)
+		{
+		  stats.dictionary_hits++;
+		  i = dictionary.local[d];
+		}
+	      else
+		d = dictionary_add (h, ip, length, slot);
+	    }
+	  if (!i && !d)
+	    i = find_class (t, eqs, h, ip, length, &slot);
+	}
+
+      if (!i)
+	{
+	  /* Create a new equivalence class.  */
+	  i = eqs_index++;
+	  if (i == eqs_alloc)
+	    {
+	      if (PTRDIFF_MAX / (2 * sizeof *eqs) <= eqs_alloc)
+		xalloc_die ();
+	      eqs_alloc *= 2;
+	      eqs = xrealloc (eqs, eqs_alloc * sizeof *eqs);
+	    }
+	  eqs[i].line = ip;
+	  eqs[i].length = length;
+
+	  if (incomplete)
+	    incomplete_class = i;
+	  else if (d)
+	    {
+	      dictionary.local[d] = i;
+	      if (dictionary.nmet == dictionary.met_alloc)
+		dictionary.met = x2nrealloc (dictionary.met,
+					     &dictionary.met_alloc,
+					     sizeof *dictionary.met);
+	      dictionary.met[dictionary.nmet++] = d;
+	    }
+	  else
+	    {
+	      t->hash[slot] = h;
+	      t->class[slot] = i;
+	      if (t->mask / 2 < ++t->used)
+		grow_table (t);
+	    }
+	}
+
+      if (known)
+	known[line] = i;
+      cureqs[line] = i;
+    }
+
+  stats.lines += lines;
+  stats.classes += eqs_index - equivs_index;
+
+  /* Done with cache in local variables.  */
   equivs = eqs;
   equivs_alloc = eqs_alloc;
   equivs_index = eqs_index;
 }
-
+
+/* Strip the CRs that precede newlines in the SIZE bytes at P.
+   Return the number of bytes left.  Move the text between CRs with
+   memmove rather than a byte at a time, as every line has a CR in
+   files from systems that end lines with CRLF.  */
+
+static size_t
+strip_crs (char *p, size_t size)
+{
+  char *cr = memchr (p, '\r', size);
+
+  if (cr)
+    {
+      char *dst = cr;
+      char const *src = cr;
+      char const *srclim = p + size;
+
+      do
+	{
+	  /* SRC points to a CR.  Keep it unless a newline follows,
+	     and then move the text up to the next CR.  */
+	  char const *next;
+	  size_t n;
+	  if (! (src + 1 < srclim && src[1] == '\n'))
+	    *dst++ = '\r';
+	  src++;
+	  next = memchr (src, '\r', srclim - src);
+	  n = (next ? next : srclim) - src;
+	  memmove (dst, src, n);
+	  dst += n;
+	  src += n;
+	}
+      while (src < srclim);
+
+      size = dst - p;
+    }
+
+  return size;
+}
+
 /* Prepare the text.  Make sure the text end is initialized.
    Make sure text ends in a newline,
    but remember that we had to add one.
-   Strip trailing CRs, if that was requested.  */
+   Strip trailing CRs, if that was requested, except in the first
+   STRIPPED bytes, which have been stripped already.  */
 
 static void
-prepare_text (struct file_data *current)
+prepare_text (struct file_data *current, size_t stripped)
 {
   size_t buffered = current->buffered;
   char *p = FILE_BUFFER (current);
@@ -500,73 +1749,271 @@ prepare_text (struct file_data *current)
   /* Don't use uninitialized storage when planting or using sentinels.  */
   memset (p + buffered, 0, sizeof (word));
 
-  if (strip_trailing_cr)
+  if (strip_trailing_cr && stripped < buffered)
     {
-      char *dst;
-      char *srclim = p + buffered;
-      *srclim = '\r';
-      dst = rawmemchr (p, '\r');
+      /* Start just before STRIPPED, in case the newline appended
+	 above follows a CR.  */
+      size_t start = stripped - (0 < stripped);
+      buffered = start + strip_crs (p + start, buffered - start);
+    }
+
+  current->buffered = buffered;
+}
+
+/* The number of lines of the identical prefix and suffix that are
+   hashed along with the lines between them.  This is horizon_lines,
+   except that with --horizon-lines=auto widen_horizon doubles it
+   for the files being compared whenever the changes found reach
+   the lines it keeps.  */
+static lin horizon;
+
+#if HAVE_WORKING_FORK
+
+/* With --jobs=NUM, the identical prefix and suffix of two large
+   buffers are found by up to NUM child processes at once, much as cmp
+   --jobs compares large files.  The bytes that the buffers could have
+   in common at their start are split into parts.  The child for each
+   part compares it and writes to a pipe how many bytes at its start
+   are identical, and how many newlines they hold if the prefix's
+   lines are to be counted.  Then, if the suffix is wanted, the child
+   compares the bytes that are as far from the end of each buffer as
+   the part is from their start, backward from their end, and writes
+   how many bytes at their end are identical.  So the suffix is
+   sought while the prefix is, before it is known where the prefix
+   ends.  The parent takes the results in order, up to the first part
+   that differs, and stops the suffix where the prefix begins, so the
+   ends found are those that comparing a byte at a time would find.
+   The children only read the buffers, which they share with the
+   parent, and a child that fails is taken to have found a difference
+   at the start of its part.  */
+
+struct ends_part
+{
+  pid_t pid;
+  int fd;			/* Read end of the pipe from the child.  */
+  size_t size;			/* Number of bytes in the part.  */
+  bool prefix_read;		/* Whether its prefix result has been read.  */
+};
+
+struct ends_result
+{
+  size_t same;			/* Identical bytes at the start or end.  */
+  size_t newlines;		/* Newlines among them, if counted.  */
+};
+
+/* Parts smaller than this are not worth a process.  */
+enum { MINIMUM_ENDS_PART = 1024 * 1024 };
+
+/* The parts being compared, if any.  */
+static struct ends_part *ends_part;
+static int ends_parts;
+
+/* Return the number of identical bytes at the start of the SIZE bytes
+   at P0 and P1.  */
+
+static size_t _GL_ATTRIBUTE_PURE
+same_leading_bytes (char const *p0, char const *p1, size_t size)
+{
+  enum { CHUNK = 256 };
+  size_t i = 0;
+
+  while (CHUNK <= size - i && memcmp (p0 + i, p1 + i, CHUNK) == 0)
+    i += CHUNK;
+  while (i < size && p0[i] == p1[i])
+    i++;
+  return i;
+}
+
+/* Return the number of identical bytes at the end of the SIZE bytes
+   before END0 and END1.  */
+
+static size_t _GL_ATTRIBUTE_PURE
+same_trailing_bytes (char const *end0, char const *end1, size_t size)
+{
+  enum { CHUNK = 256 };
+  size_t i = 0;
+
+  while (CHUNK <= size - i
+	 && memcmp (end0 - i - CHUNK, end1 - i - CHUNK, CHUNK) == 0)
+    i += CHUNK;
+  while (i < size && end0[-1 - i] == end1[-1 - i])
+    i++;
+  return i;
+}
+
+/* Start finding the ends of the N0 bytes at BUFFER0 and the N1 bytes
+   at BUFFER1 in parts, counting the newlines of the prefix if COUNT,
+   and seeking the suffix too if SUFFIX.  Return false, having started
+   nothing, if the buffers are too small to be worth it.  */
+
+static bool
+start_ends_parts (char const *buffer0, size_t n0,
+		  char const *buffer1, size_t n1, bool count, bool suffix)
+{
+  size_t common = MIN (n0, n1);
+  size_t offset = 0;
+  int nparts = MIN (jobs, common / MINIMUM_ENDS_PART);
+  int i;
 
-      if (dst != srclim)
+  if (nparts < 2)
+    return false;
+
+  ends_part = xnmalloc (nparts, sizeof *ends_part);
+  ends_parts = nparts;
+  for (i = 0; i < nparts; i++)
+    {
+      struct ends_part *part = &ends_part[i];
+      int fd[2];
+
+      part->size = common / nparts + (i < common % nparts);
+      part->prefix_read = false;
+      if (pipe (fd) != 0)
+	pfatal_with_name ("pipe");
+      part->pid = fork ();
+      if (part->pid < 0)
+	pfatal_with_name ("fork");
+      if (part->pid == 0)
 	{
-	  char const *src = dst;
-	  do
+	  struct ends_result r;
+	  close (fd[0]);
+	  r.same = same_leading_bytes (buffer0 + offset, buffer1 + offset,
+				       part->size);
+	  r.newlines = count ? count_newlines (buffer0 + offset, r.same) : 0;
+	  if (write (fd[1], &r, sizeof r) != sizeof r)
+	    _exit (EXIT_TROUBLE);
+	  if (suffix)
 	    {
-	      *dst = *src++;
-	      dst += ! (*dst == '\r' && *src == '\n');
+	      r.same = same_trailing_bytes (buffer0 + n0 - offset,
+					    buffer1 + n1 - offset,
+					    part->size);
+	      r.newlines = 0;
+	      if (write (fd[1], &r, sizeof r) != sizeof r)
+		_exit (EXIT_TROUBLE);
 	    }
-	  while (src < srclim);
-
-	  buffered -= src - dst;
+	  _exit (EXIT_SUCCESS);
 	}
+      close (fd[1]);
+      part->fd = fd[0];
+      offset += part->size;
     }
 
-  current->buffered = buffered;
-}
-
-/* We have found N lines in a buffer of size S; guess the
-   proportionate number of lines that will be found in a buffer of
-   size T.  However, do not guess a number of lines so large that the
-   resulting line table might cause overflow in size calculations.  */
-static lin
-guess_lines (lin n, size_t s, size_t t)
-{
-  size_t guessed_bytes_per_line = n < 10 ? 32 : s / (n - 1);
-  lin guessed_lines = MAX (1, t / guessed_bytes_per_line);
-  return MIN (guessed_lines, PTRDIFF_MAX / (2 * sizeof (char *) + 1) - 5) + 5;
+  return true;
 }
 
-/* Given a vector of two file_data objects, find the identical
-   prefixes and suffixes of each object.  */
+/* Read the next result of PART into *R, taking a child that failed
+   to have found a difference at the start of its part.  */
 
 static void
-find_identical_ends (struct file_data filevec[])
+read_ends_result (struct ends_part const *part, struct ends_result *r)
 {
-  word *w0, *w1;
-  char *p0, *p1, *buffer0, *buffer1;
-  char const *end0, *beg0;
-  char const **linbuf0, **linbuf1;
-  lin i, lines;
-  size_t n0, n1;
-  lin alloc_lines0, alloc_lines1;
-  bool prefix_needed;
-  lin buffered_prefix, prefix_count, prefix_mask;
-  lin middle_guess, suffix_guess;
+  if (read (part->fd, r, sizeof *r) != sizeof *r || part->size < r->same)
+    r->same = r->newlines = 0;
+}
 
-  slurp (&filevec[0]);
-  prepare_text (&filevec[0]);
-  if (filevec[0].desc != filevec[1].desc)
-    {
-      slurp (&filevec[1]);
-      prepare_text (&filevec[1]);
+/* Return the number of identical bytes at the start of the buffers
+   whose ends are being found in parts, and store the number of
+   newlines among them into *NEWLINES if they were counted.  */
+
+static size_t
+prefix_from_parts (size_t *newlines)
+{
+  size_t same = 0;
+  int i;
+
+  *newlines = 0;
+  for (i = 0; i < ends_parts; i++)
+    {
+      struct ends_result r;
+      read_ends_result (&ends_part[i], &r);
+      ends_part[i].prefix_read = true;
+      same += r.same;
+      *newlines += r.newlines;
+      if (r.same < ends_part[i].size)
+	break;
     }
-  else
+  return same;
+}
+
+/* Return the number of identical bytes at the end of the buffers
+   whose ends are being found in parts, up to LIMIT.  */
+
+static size_t
+suffix_from_parts (size_t limit)
+{
+  size_t same = 0;
+  int i;
+
+  for (i = 0; i < ends_parts && same < limit; i++)
     {
-      filevec[1].buffer = filevec[0].buffer;
-      filevec[1].bufsize = filevec[0].bufsize;
-      filevec[1].buffered = filevec[0].buffered;
-      filevec[1].missing_newline = filevec[0].missing_newline;
+      struct ends_result r;
+      if (! ends_part[i].prefix_read)
+	read_ends_result (&ends_part[i], &r);
+      read_ends_result (&ends_part[i], &r);
+      same += r.same;
+      if (r.same < ends_part[i].size)
+	break;
     }
+  return MIN (same, limit);
+}
+
+/* Stop the children that are finding ends in parts.  */
+
+static void
+stop_ends_parts (void)
+{
+  int i;
+
+  for (i = 0; i < ends_parts; i++)
+    {
+      kill (ends_part[i].pid, SIGTERM);
+      close (ends_part[i].fd);
+      waitpid (ends_part[i].pid, NULL, 0);
+    }
+  free (ends_part);
+  ends_part = NULL;
+  ends_parts = 0;
+}
+
+#else
+
+/* Without fork, the ends are found by this process alone.  */
+# define start_ends_parts(buffer0, n0, buffer1, n1, count, suffix) false
+# define prefix_from_parts(newlines) (abort (), 0)
+# define suffix_from_parts(limit) (abort (), 0)
+# define stop_ends_parts() abort ()
+
+#endif
+
+/* Given a vector of two file_data objects, find the identical
+   prefixes and suffixes of each object.  */
+
+static void
+find_identical_ends (struct file_data filevec[])
+{
+  word *w0, *w1;
+  char *p0, *p1, *buffer0, *buffer1;
+  char const *end0, *beg0;
+  char const **linbuf0, **linbuf1;
+  lin i, lines;
+  size_t n0, n1;
+  lin alloc_lines0, alloc_lines1;
+  bool prefix_needed;
+  lin buffered_prefix, prefix_count, prefix_mask;
+  lin middle_guess, suffix_guess;
+  char *scan_end0;
+  size_t prefix_newlines IF_LINT (= 0);
+
+  /* Whether only the last lines of the prefix are needed, so that its
+     lines need only be counted, and whether the suffix is wanted.  */
+  bool count_prefix = (no_diff_means_no_output && ! show_function
+		       && context < LIN_MAX / 4
+		       && context < filevec[0].buffered);
+  bool want_suffix = (! ROBUST_OUTPUT_STYLE (output_style)
+		      || (filevec[0].missing_newline
+			  == filevec[1].missing_newline));
+
+  /* Whether child processes are finding the ends, with --jobs.  */
+  bool in_parts = false;
 
   /* Find identical prefix.  */
 
@@ -580,6 +2027,14 @@ find_identical_ends (struct file_data filevec[])
   if (p0 == p1)
     /* The buffers are the same; sentinels won't work.  */
     p0 = p1 += n1;
+  else if (1 < jobs
+	   && (in_parts = start_ends_parts (buffer0, n0, buffer1, n1,
+					    count_prefix, want_suffix)))
+    {
+      size_t same = prefix_from_parts (&prefix_newlines);
+      p0 += same;
+      p1 += same;
+    }
   else
     {
       /* Insert end sentinels, in this case characters that are guaranteed
@@ -602,20 +2057,21 @@ find_identical_ends (struct file_data filevec[])
       p1 = (char *) w1;
       while (*p0 == *p1)
 	p0++, p1++;/*执行两个buffer比对，按byte比对*/
-
-      /* Don't mistakenly count missing newline as part of prefix.  */
-      if (ROBUST_OUTPUT_STYLE (output_style)
-	  && ((buffer0 + n0 - filevec[0].missing_newline < p0)
-	      !=
-	      (buffer1 + n1 - filevec[1].missing_newline < p1)))
-	p0--, p1--;
     }
+  scan_end0 = p0;
+
+  /* Don't mistakenly count missing newline as part of prefix.  */
+  if (ROBUST_OUTPUT_STYLE (output_style)
+      && ((buffer0 + n0 - filevec[0].missing_newline < p0)
+	  !=
+	  (buffer1 + n1 - filevec[1].missing_newline < p1)))
+    p0--, p1--;
 
   /* Now P0 and P1 point at the first nonmatching characters.  */
 
   /* Skip back to last line-beginning in the prefix,
-     and then discard up to HORIZON_LINES lines from the prefix.  */
-  i = horizon_lines;
+     and then discard up to HORIZON lines from the prefix.  */
+  i = horizon;
   while (p0 != buffer0 && (p0[-1] != '\n' || i--))
     p0--, p1--;/*向回退，退到行开始位置，并丢掉相等行中horizon_lines行（这个用来做锚点）*/
 
@@ -629,8 +2085,7 @@ find_identical_ends (struct file_data filevec[])
   p0 = buffer0 + n0;
   p1 = buffer1 + n1;
 
-  if (! ROBUST_OUTPUT_STYLE (output_style)
-      || filevec[0].missing_newline == filevec[1].missing_newline)
+  if (want_suffix)
     {
       end0 = p0;	/* Addr of last char in file 0.  */
 
@@ -639,7 +2094,29 @@ find_identical_ends (struct file_data filevec[])
 	 of the identical prefix.  */
       beg0 = filevec[0].prefix_end + (n0 < n1 ? 0 : n0 - n1);
 
-      /* Scan back until chars don't match or we reach that point.  */
+      /* If the children found the suffix, there is nothing left to
+	 scan.  */
+      if (in_parts)
+	{
+	  size_t same = suffix_from_parts (p0 - beg0);
+	  p0 -= same;
+	  p1 -= same;
+	  beg0 = p0;
+	}
+
+      /* Scan back a word at a time while the words match, and then
+	 until chars don't match or we reach that point.  The buffers
+	 end at different alignments, so copy the words out.  */
+      while (sizeof (word) <= (size_t) (p0 - beg0))
+	{
+	  word x0, x1;
+	  memcpy (&x0, p0 - sizeof x0, sizeof x0);
+	  memcpy (&x1, p1 - sizeof x1, sizeof x1);
+	  if (x0 != x1)
+	    break;
+	  p0 -= sizeof x0;
+	  p1 -= sizeof x1;
+	}
       while (p0 != beg0)
 	if (*--p0 != *--p1)
 	  {
@@ -650,16 +2127,15 @@ find_identical_ends (struct file_data filevec[])
 	  }
 
       /* Are we at a line-beginning in both files?  If not, add the rest of
-	 this line to the main body.  Discard up to HORIZON_LINES lines from
+	 this line to the main body.  Discard up to HORIZON lines from
 	 the identical suffix.  Also, discard one extra line,
 	 because shift_boundaries may need it.  */
-      i = horizon_lines + !((buffer0 == p0 || p0[-1] == '\n')
-			    &&
-			    (buffer1 == p1 || p1[-1] == '\n'));
+      i = horizon + !((buffer0 == p0 || p0[-1] == '\n')
+		      &&
+		      (buffer1 == p1 || p1[-1] == '\n'));
       /*查找到换行*/
       while (i-- && p0 != end0)
-	while (*p0++ != '\n')
-	  continue;
+	p0 = (char *) rawmemchr (p0, '\n') + 1;
 
       p1 += p0 - beg0;
     }
@@ -667,6 +2143,8 @@ find_identical_ends (struct file_data filevec[])
   /* Record the suffix.  */
   filevec[0].suffix_begin = p0;
   filevec[1].suffix_begin = p1;
+  if (in_parts)
+    stop_ends_parts ();
 
   /* Calculate number of lines of prefix to save.
 
@@ -682,8 +2160,7 @@ find_identical_ends (struct file_data filevec[])
      Handle 1 more line than the context says (because we count 1 too many),
      rounded up to the next power of 2 to speed index computation.  */
 
-  if (no_diff_means_no_output && ! function_regexp.fastmap
-      && context < LIN_MAX / 4 && context < n0)
+  if (count_prefix)
     {
       middle_guess = guess_lines (0, 0, p0 - filevec[0].prefix_end);
       suffix_guess = guess_lines (0, 0, buffer0 + n0 - p0);
@@ -700,14 +2177,35 @@ find_identical_ends (struct file_data filevec[])
 
   prefix_mask = prefix_count - 1;
   lines = 0;
-  linbuf0 = xmalloc (alloc_lines0 * sizeof *linbuf0);
+  linbuf0 = take_spare_block (alloc_lines0 * sizeof *linbuf0);
   prefix_needed = ! (no_diff_means_no_output
 		     && filevec[0].prefix_end == p0
 		     && filevec[1].prefix_end == p1);
   p0 = buffer0;
 
-  /* If the prefix is needed, find the prefix lines.  */
-  if (prefix_needed)
+  /* If the prefix is needed, find the prefix lines.  If only its last
+     lines are kept, count the lines, which is quicker than finding
+     where each starts, unless the children counted them already, and
+     then find the last lines by searching back from its end.  */
+  if (prefix_needed && prefix_count)
+    {
+      lin kept;
+      end0 = filevec[0].prefix_end;
+      lines = (in_parts
+	       ? prefix_newlines - count_newlines (end0, scan_end0 - end0)
+	       : count_newlines (buffer0, end0 - buffer0));
+      kept = MIN (lines, context);
+      p0 = (char *) end0;
+      for (i = lines; lines - kept < i; i--)
+	{
+	  do
+	    p0--;
+	  while (p0 != buffer0 && p0[-1] != '\n');
+	  linbuf0[(i - 1) & prefix_mask] = p0;
+	}
+      p0 = (char *) end0;
+    }
+  else if (prefix_needed)
     {
       end0 = filevec[0].prefix_end;
       while (p0 != end0)
@@ -721,8 +2219,7 @@ find_identical_ends (struct file_data filevec[])
 	      linbuf0 = xrealloc (linbuf0, alloc_lines0 * sizeof *linbuf0);
 	    }
 	  linbuf0[l] = p0;
-	  while (*p0++ != '\n')
-	    continue;
+	  p0 = (char *) rawmemchr (p0, '\n') + 1;
 	}
     }
   buffered_prefix = prefix_count && context < lines ? context : lines;
@@ -735,7 +2232,7 @@ find_identical_ends (struct file_data filevec[])
   if (alloc_lines1 < buffered_prefix
       || PTRDIFF_MAX / sizeof *linbuf1 <= alloc_lines1)
     xalloc_die ();
-  linbuf1 = xmalloc (alloc_lines1 * sizeof *linbuf1);
+  linbuf1 = take_spare_block (alloc_lines1 * sizeof *linbuf1);
 
   if (buffered_prefix != lines)
     {
@@ -760,35 +2257,560 @@ find_identical_ends (struct file_data filevec[])
   filevec[0].prefix_lines = filevec[1].prefix_lines = lines;
 }
 
-/* If 1 < k, then (2**k - prime_offset[k]) is the largest prime less
-   than 2**k.  This table is derived from Chris K. Caldwell's list
-   <http://www.utm.edu/research/primes/lists/2small/>.  */
+/* Read the rest of each file of FILEVEC into memory, and prepare its
+   text.  */
 
-static unsigned char const prime_offset[] =
+static void
+slurp_files (struct file_data filevec[])
 {
-  0, 0, 1, 1, 3, 1, 3, 1, 5, 3, 3, 9, 3, 1, 3, 19, 15, 1, 5, 1, 3, 9, 3,
-  15, 3, 39, 5, 39, 57, 3, 35, 1, 5, 9, 41, 31, 5, 25, 45, 7, 87, 21,
-  11, 57, 17, 55, 21, 115, 59, 81, 27, 129, 47, 111, 33, 55, 5, 13, 27,
-  55, 93, 1, 57, 25
+  /* retain_file has prepared the text of a retained file already.  */
+  if (! filevec[0].retained)
+    {
+      slurp (&filevec[0]);
+      prepare_text (&filevec[0], 0);
+    }
+  if (filevec[1].retained)
+    {
+      /* Likewise.  */
+    }
+  else if (filevec[0].desc != filevec[1].desc || filevec[1].supplied
+	   || filevec[0].retained)
+    {
+      slurp (&filevec[1]);
+      prepare_text (&filevec[1], 0);
+    }
+  else
+    {
+      filevec[1].buffer = filevec[0].buffer;
+      filevec[1].bufsize = filevec[0].bufsize;
+      filevec[1].buffered = filevec[0].buffered;
+      filevec[1].mapped = filevec[0].mapped;
+      filevec[1].missing_newline = filevec[0].missing_newline;
+    }
+}
+
+/* Return the bytes of memory that the buffers of the files of FILEVEC
+   and the tables of their lines take up.  */
+
+size_t
+files_memory (struct file_data const filevec[])
+{
+  size_t total = 0;
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data const *file = &filevec[f];
+      if (! (f && file->buffer == filevec[0].buffer))
+	total += file->bufsize;
+      if (! (f && file->linbuf == filevec[0].linbuf))
+	total += ((file->alloc_lines - file->linbuf_base)
+		  * sizeof *file->linbuf);
+      if (file->equivs)
+	total += file->alloc_lines * sizeof *file->equivs;
+    }
+
+  return total;
+}
+
+/* Record the lines of the files of FILEVEC, which share one buffer,
+   as compare_files arranges for a file compared with itself or with a
+   hard link to it, in one table that both files use.  All the lines
+   are in the identical prefix, so none need be hashed, and the buffer
+   need not be compared with itself to find the ends.  */
+
+static void
+share_lines (struct file_data filevec[])
+{
+  char const *p = FILE_BUFFER (&filevec[0]);
+  char const *bufend = p + filevec[0].buffered;
+  lin alloc_lines = guess_lines (0, 0, filevec[0].buffered);
+  char const **linbuf = take_spare_block (alloc_lines * sizeof *linbuf);
+  lin lines = 0;
+  int f;
+
+  for (; p < bufend; p = (char const *) rawmemchr (p, '\n') + 1)
+    {
+      if (lines + 1 == alloc_lines)
+	{
+	  if (PTRDIFF_MAX / (2 * sizeof *linbuf) <= alloc_lines)
+	    xalloc_die ();
+	  alloc_lines *= 2;
+	  linbuf = xrealloc (linbuf, alloc_lines * sizeof *linbuf);
+	}
+      linbuf[lines++] = p;
+    }
+
+  /* If the last line is incomplete and we do not silently complete
+     lines, don't count its appended newline.  */
+  linbuf[lines] = bufend - (filevec[0].missing_newline
+			    && ROBUST_OUTPUT_STYLE (output_style));
+
+  for (f = 0; f < 2; f++)
+    {
+      filevec[f].prefix_end = filevec[f].suffix_begin = bufend;
+      filevec[f].linbuf = linbuf + lines;
+      filevec[f].linbuf_base = - lines;
+      filevec[f].alloc_lines = alloc_lines - lines;
+      filevec[f].prefix_lines = lines;
+      filevec[f].buffered_lines = filevec[f].valid_lines = 0;
+      filevec[f].equivs = NULL;
+      filevec[f].equiv_max = 1;
+    }
+}
+
+/* Given a vector of two file_data objects whose text is in their
+   buffers, build the table of equivalence classes.  */
+
+static void
+hash_files (struct file_data filevec[])
+{
+  int i;
+  lin lines;
+  bool retaining = filevec[0].retained || filevec[1].retained;
+
+  /* The index of the retained file, if RETAINING.  */
+  int r = filevec[0].retained ? 0 : 1;
+
+  stats_phase (STATS_ENDS);
+  if (filevec[0].buffer == filevec[1].buffer && ! retaining)
+    {
+      share_lines (filevec);
+      stats_memory (files_memory (filevec));
+      return;
+    }
+  find_identical_ends (filevec);
+  stats_phase (STATS_HASH);
+  progress.hashed = 0;
+
+  /* Equivalence class 0 is permanently safe for lines that were not
+     hashed.  Real equivalence classes start at 1, after the classes
+     that the retained file's lines already have, if it is being
+     compared.  */
+  if (retaining)
+    {
+      equivs = retained.equivs;
+      equivs_alloc = retained.equivs_alloc;
+      equivs_index = retained.equivs_index;
+      incomplete_class = retained.incomplete_class;
+    }
+  else
+    {
+      equivs = spare_equivs;
+      equivs_alloc = spare_alloc;
+      spare_equivs = NULL;
+      spare_alloc = 0;
+      equivs_index = 1;
+      incomplete_class = 0;
+    }
+
+  /* Hash each file's lines on their own, and only then merge the
+     results into equivalence classes; only the second stage needs the
+     shared table.  */
+  for (i = 0; i < 2; i++)
+    find_and_hash_each_line (&filevec[i]);
+
+  /* Allow for a new class for each line hashed.  Sizing this and the
+     table by the lines actually hashed rather than by the space
+     allocated for lines keeps them from doubling the peak memory of
+     large comparisons.  */
+  lines = filevec[0].buffered_lines + filevec[1].buffered_lines + 1;
+  if (PTRDIFF_MAX / sizeof *equivs - equivs_index <= lines)
+    xalloc_die ();
+  if (equivs_alloc < equivs_index - 1 + lines)
+    {
+      equivs_alloc = equivs_index - 1 + lines;
+      equivs = xrealloc (equivs, equivs_alloc * sizeof *equivs);
+    }
+
+  /* Allocate a hash table with a power-of-2 number of slots, at
+     least as many as there are lines.  The table grows if more than
+     half its slots fill up.  While the lines go into the dictionary
+     of lines instead, the table stays small.  */
+  for (i = 9; (size_t) 1 << i < lines; i++)
+    continue;
+  if (line_dictionary && ! dictionary.full && ! retaining)
+    i = 9;
+  reset_table (i);
+  if (line_dictionary && ! dictionary.table.class)
+    {
+      alloc_table (&dictionary.table, 9);
+      dictionary.equivs_index = 1;
+    }
+  if (retaining)
+    {
+      /* Classify the retained file's lines first, so that their
+	 classes do not refer to the other file and can be kept.  */
+      assign_equivs (&filevec[r], NULL);
+      retained.equivs_index = equivs_index;
+      retained.incomplete_class = incomplete_class;
+      assign_equivs (&filevec[1 - r], &retained.table);
+      retained.equivs = equivs;
+      retained.equivs_alloc = equivs_alloc;
+    }
+  else
+    {
+      for (i = 0; i < 2; i++)
+	assign_equivs (&filevec[i], NULL);
+      if (equivs_alloc <= KEEP_MAX)
+	{
+	  spare_equivs = equivs;
+	  spare_alloc = equivs_alloc;
+	}
+      else
+	free (equivs);
+    }
+
+  filevec[0].equiv_max = filevec[1].equiv_max = equivs_index;
+
+  /* The classes of this comparison mean nothing to the next.  */
+  while (dictionary.nmet)
+    dictionary.local[dictionary.met[--dictionary.nmet]] = 0;
+
+  stats_memory (files_memory (filevec)
+		+ (table.mask + 1) * (sizeof *table.hash + sizeof *table.class)
+		+ equivs_alloc * sizeof *equivs
+		+ dictionary.memory);
+  stats.slots += table.mask + 1;
+  stats.slots_used += table.used;
+
+  /* grow_table may have replaced the table's memory.  */
+  table_alloc = table.mask + 1;
+  if (KEEP_MAX < table_alloc)
+    {
+      free (table.hash);
+      free (table.class);
+      table.hash = NULL;
+      table.class = NULL;
+      table_alloc = 0;
+    }
+}
+
+/* Comparing files a window at a time (--max-memory).
+
+   Each window holds the next WINDOW_SIZE or so bytes of each file.
+   It ends in the middle of a run of lines that are the same in both
+   files, so that no hunk or its context crosses from one window into
+   the next, and the windows are compared as if they were whole files.
+   The bytes of each buffer past the end of its window are carried
+   over into the next window.  */
+
+/* Number of bytes of each file to read into a window, or 0 if the
+   current files are being compared all at once.  */
+static size_t window_size;
+
+/* Whether the windows are compared by remote workers (--remote),
+   which need only to know where they are, so that their lines are
+   not hashed here.  */
+static bool remote_windows;
+
+/* The state of each file's window.  */
+static struct
+{
+  size_t cut;		/* Buffer offset at which the window ends.  */
+  size_t end;		/* Buffer offset at which the data read ends.  */
+  lin lines;		/* Number of lines in the window.  */
+  size_t stripped;	/* Bytes whose trailing CRs have been stripped.  */
+  word saved;		/* The bytes at CUT, which sentinels overwrite.  */
+  struct read_advice advice;	/* For advising the system about reads.  */
+} window[2];
+
+/* Estimated memory used by diff per byte of input text, counting the
+   text itself and the tables built for its lines.  */
+enum { MEMORY_PER_BYTE = 4 };
+
+/* Never use windows smaller than this.  */
+enum { WINDOW_SIZE_MINIMUM = 64 * 1024 };
+
+/* Return the number of bytes of each file of FILEVEC to read at a
+   time in order to stay within max_memory, or 0 if the files can be
+   read all at once.  */
+
+static size_t
+choose_window_size (struct file_data const filevec[])
+{
+  int f;
+  uintmax_t total = 0;
+
+  if (! max_memory || output_style == OUTPUT_ED
+      || filevec[0].desc == filevec[1].desc)
+    return 0;
+
+  for (f = 0; f < 2; f++)
+    {
+      if (filevec[f].desc < 0)
+	continue;
+      if (! S_ISREG (filevec[f].stat.st_mode))
+	{
+	  total = UINTMAX_MAX;
+	  break;
+	}
+      total += filevec[f].stat.st_size;
+    }
+
+  if (total <= max_memory / MEMORY_PER_BYTE)
+    return 0;
+  return MAX (WINDOW_SIZE_MINIMUM, max_memory / (2 * MEMORY_PER_BYTE));
+}
+
+/* Return the start of the line after the one at P, which ends
+   before LIM.  */
+
+static char const *
+next_line (char const *p, char const *lim)
+{
+  char const *nl = memchr (p, '\n', lim - p);
+  return nl ? nl + 1 : lim;
+}
+
+/* Store into *LINES a newly allocated vector of pointers to the
+   starts of the lines in the SIZE bytes at P, followed by a pointer
+   to P + SIZE.  Return the number of lines.  */
+
+static lin
+split_lines (char const *p, size_t size, char const ***lines)
+{
+  char const *lim = p + size;
+  char const *q;
+  char const **v;
+  lin n = 0;
+
+  for (q = p; q < lim; q = next_line (q, lim))
+    n++;
+
+  *lines = v = xnmalloc (n + 1, sizeof *v);
+  for (q = p; q < lim; q = next_line (q, lim))
+    *v++ = q;
+  *v = lim;
+  return n;
+}
+
+/* An entry in the table of lines used to choose a window's end.  */
+struct window_line
+{
+  hash_value hash;
+  lin line1;			/* The line's index in file 1.  */
+  unsigned char count[2];	/* Occurrences in each file, up to 2.  */
 };
 
-/* Verify that this host's size_t is not too wide for the above table.  */
+/* Return the entry for the line at P in ENTRIES, which has 2**BITS
+   slots.  Set *HASH to the line's hash.  Lines that compare equal
+   share an entry, and so may lines that merely hash alike.  */
+
+static struct window_line *
+window_line_entry (struct window_line *entries, int bits,
+		   char const *p, hash_value *hash)
+{
+  char const *end;
+  hash_value h = hash_line (p, &end);
+  size_t mask = ((size_t) 1 << bits) - 1;
+  size_t slot;
+
+  for (slot = h >> (sizeof h * CHAR_BIT - bits);
+       (entries[slot].count[0] | entries[slot].count[1])
+	 && entries[slot].hash != h;
+       slot = (slot + 1) & mask)
+    continue;
+  *hash = h;
+  return &entries[slot];
+}
 
-verify (sizeof (size_t) * CHAR_BIT <= sizeof prime_offset);
+/* Choose where the windows of FILEVEC end, given that the first
+   COMPLETE[f] bytes of file F's buffer consist of complete lines.
+   Look for a run of 2 * CONTEXT + 1 lines that are the same in both
+   files, starting with a line that occurs just once in each window,
+   and end the windows after the first CONTEXT + 1 lines of the run.
+   Use the last such run that lets at least one of the windows cover
+   half its lines.  If there is none, end each window after its
+   complete lines; the differences found may then be less than
+   minimal.  Set window[f].cut and window[f].lines accordingly.  */
+
+static void
+choose_window_cut (struct file_data const filevec[], size_t const complete[])
+{
+  char const **lines[2];
+  lin n[2], cut[2];
+  lin run = context < LIN_MAX / 2 ? 2 * context + 1 : LIN_MAX;
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      n[f] = split_lines (FILE_BUFFER (&filevec[f]), complete[f], &lines[f]);
+      cut[f] = n[f];
+    }
+
+  if (run <= MIN (n[0], n[1]))
+    {
+      struct window_line *entries;
+      hash_value h;
+      lin i, k;
+      int bits;
+
+      for (bits = 9; (size_t) 1 << bits < 2 * (n[0] + n[1]); bits++)
+	continue;
+      entries = xcalloc ((size_t) 1 << bits, sizeof *entries);
+
+      for (f = 0; f < 2; f++)
+	for (i = 0; i < n[f]; i++)
+	  {
+	    struct window_line *e =
+	      window_line_entry (entries, bits, lines[f][i], &h);
+	    e->hash = h;
+	    e->count[f] += e->count[f] < 2;
+	    if (f)
+	      e->line1 = i;
+	  }
+
+      for (k = n[0] - run; 0 <= k; k--)
+	{
+	  struct window_line const *e =
+	    window_line_entry (entries, bits, lines[0][k], &h);
+	  lin j = e->line1;
+	  if (e->count[0] == 1 && e->count[1] == 1 && j + run <= n[1]
+	      && (n[0] / 2 <= k + context + 1 || n[1] / 2 <= j + context + 1))
+	    {
+	      for (i = 0; i < run; i++)
+		{
+		  struct equivclass eq;
+		  eq.line = lines[0][k + i];
+		  eq.length = lines[0][k + i + 1] - eq.line - 1;
+		  if (! same_class (&eq, lines[1][j + i],
+				    lines[1][j + i + 1] - lines[1][j + i] - 1))
+		    break;
+		}
+	      if (i == run)
+		{
+		  cut[0] = k + context + 1;
+		  cut[1] = j + context + 1;
+		  break;
+		}
+	    }
+	}
+
+      free (entries);
+    }
+
+  for (f = 0; f < 2; f++)
+    {
+      window[f].cut = lines[f][cut[f]] - FILE_BUFFER (&filevec[f]);
+      window[f].lines = cut[f];
+      free (lines[f]);
+    }
+}
+
+/* Read the next window of each file of FILEVEC into its buffer,
+   following the data already there, and prepare its text.  */
+
+static void
+fill_windows (struct file_data filevec[])
+{
+  size_t complete[2];
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *current = &filevec[f];
+      size_t size = MAX (window_size, window[f].end);
+      char *buf;
+
+      current->buffered = window[f].end;
+      if (current->desc < 0)
+	current->eof = true;
+
+      /* Read until the window is full.  Enlarge a window that does not
+	 contain even one complete line.  */
+      for (;;)
+	{
+	  if (current->bufsize < size + 2 * sizeof (word))
+	    {
+	      current->bufsize = size + 2 * sizeof (word);
+	      current->buffer = xrealloc (current->buffer, current->bufsize);
+	    }
+	  size_t buffered = current->buffered;
+	  file_block_read (current, size - buffered);
+	  read_advice_update (&window[f].advice, current->buffered - buffered);
+	  buf = FILE_BUFFER (current);
+	  if (current->eof || memchr (buf, '\n', current->buffered))
+	    break;
+	  if (PTRDIFF_MAX / 2 - 2 * sizeof (word) < size)
+	    xalloc_die ();
+	  size *= 2;
+	}
+
+      /* Leave out a trailing partial line, even at end of file, so
+	 that an incomplete last line stays at the end of the last
+	 window.  */
+      complete[f] = current->buffered;
+      while (0 < complete[f] && buf[complete[f] - 1] != '\n')
+	complete[f]--;
+
+      /* Strip CRs before choosing the cut, so that lines compare
+	 as they will in the window.  */
+      if (strip_trailing_cr)
+	{
+	  size_t from = window[f].stripped;
+	  size_t removed = (complete[f] - from
+			    - strip_crs (buf + from, complete[f] - from));
+	  memmove (buf + complete[f] - removed, buf + complete[f],
+		   current->buffered - complete[f]);
+	  complete[f] -= removed;
+	  current->buffered -= removed;
+	  window[f].stripped = complete[f];
+	}
+
+      window[f].end = current->buffered;
+    }
+
+  if (filevec[0].eof && filevec[1].eof)
+    for (f = 0; f < 2; f++)
+      {
+	/* This is the last window.  */
+	window[f].cut = window[f].end;
+	window[f].lines = 0;
+      }
+  else
+    choose_window_cut (filevec, complete);
+
+  for (f = 0; f < 2; f++)
+    {
+      char *buf = FILE_BUFFER (&filevec[f]);
+      memcpy (&window[f].saved, buf + window[f].cut, sizeof window[f].saved);
+      filevec[f].buffered = window[f].cut;
+      prepare_text (&filevec[f], window[f].stripped);
+    }
+}
 
 /* Given a vector of two file_data objects, read the file associated
    with each one, and build the table of equivalence classes.
+   With --max-memory, read only the first window of each large file.
    Return nonzero if either file appears to be a binary file.
    If PRETEND_BINARY is nonzero, pretend they are binary regardless.  */
 
 bool
 read_files (struct file_data filevec[], bool pretend_binary)
 {
-  int i;
+  int f;
   bool skip_test = text | pretend_binary;
-  bool appears_binary = pretend_binary | sip (&filevec[0], skip_test);
-
-  if (filevec[0].desc != filevec[1].desc)
+  bool appears_binary;
+  uint64_t options = 0;
+
+  PROBE2 (read_files, filevec[0].name, filevec[1].name);
+  stats_phase (STATS_READ);
+  stats.files++;
+  progress.files = filevec;
+  if (fold_case != ignore_case || fold_white_space != ignore_white_space)
+    fold_ready = false;
+  /* retain_file has read a retained file already, and found it to
+     be text.  */
+  appears_binary = (pretend_binary
+		    | (! filevec[0].retained && sip (&filevec[0], skip_test)));
+
+  if (filevec[1].retained)
+    {
+      /* Likewise.  */
+    }
+  else if (filevec[0].desc != filevec[1].desc || filevec[1].supplied
+	   || filevec[0].retained)
     appears_binary |= sip (&filevec[1], skip_test | appears_binary);
   else
     {
@@ -803,34 +2825,248 @@ read_files (struct file_data filevec[], bool pretend_binary)
       return true;
     }
 
-  find_identical_ends (filevec);
+  window_size = (filevec[0].retained || filevec[1].retained
+		 || filevec[1].supplied
+		 ? 0 : choose_window_size (filevec));
+  if (window_size)
+    {
+      window[0].end = filevec[0].buffered;
+      window[1].end = filevec[1].buffered;
+      window[0].stripped = window[1].stripped = 0;
+      for (f = 0; f < 2; f++)
+	read_advice_init (&window[f].advice, filevec[f].desc,
+			  (0 <= filevec[f].desc
+			   && S_ISREG (filevec[f].stat.st_mode)
+			   ? filevec[f].stat.st_size : -1),
+			  true);
+      remote_windows = remote_comparable (filevec);
+      fill_windows (filevec);
+    }
+  else
+    {
+      remote_windows = false;
+      slurp_files (filevec);
+      if (read_index || write_index)
+	options = index_options ();
+      if (read_index && options)
+	for (f = 0; f < 2; f++)
+	  if (indexable (filevec, f))
+	    load_line_index (&filevec[f], options);
+    }
 
-  equivs_alloc = filevec[0].alloc_lines + filevec[1].alloc_lines + 1;
-  if (PTRDIFF_MAX / sizeof *equivs <= equivs_alloc)
-    xalloc_die ();
-  equivs = xmalloc (equivs_alloc * sizeof *equivs);
-  /* Equivalence class 0 is permanently safe for lines that were not
-     hashed.  Real equivalence classes start at 1.  */
-  equivs_index = 1;
+  horizon = horizon_lines;
+  if (! remote_windows)
+    hash_files (filevec);
 
-  /* Allocate (one plus) a prime number of hash buckets.  Use a prime
-     number between 1/3 and 2/3 of the value of equiv_allocs,
-     approximately.  */
-  for (i = 9; (size_t) 1 << i < equivs_alloc / 3; i++)
-    continue;
-  nbuckets = ((size_t) 1 << i) - prime_offset[i];
-  if (PTRDIFF_MAX / sizeof *buckets <= nbuckets)
-    xalloc_die ();
-  buckets = zalloc ((nbuckets + 1) * sizeof *buckets);
-  buckets++;
+  if (write_index && options)
+    for (f = 0; f < 2; f++)
+      if (indexable (filevec, f) && ! filevec[f].index)
+	write_line_index (&filevec[f], options);
 
-  for (i = 0; i < 2; i++)
-    find_and_hash_each_line (&filevec[i]);
+  PROBE2 (hashed, filevec[0].buffered_lines, filevec[1].buffered_lines);
+  return false;
+}
 
-  filevec[0].equiv_max = filevec[1].equiv_max = equivs_index;
+/* Read the file of FILEVEC with index LONE, when the other does not
+   exist and is treated as empty, as read_files would, but do not
+   divide it into lines or hash them, for it can only be all deleted
+   or all inserted.  Return true if it appears to be a binary file.  */
 
-  free (equivs);
-  free (buckets - 1);
+bool
+read_lone_file (struct file_data filevec[], int lone)
+{
+  struct file_data *current = &filevec[lone];
+
+  PROBE2 (read_files, filevec[0].name, filevec[1].name);
+  stats_phase (STATS_READ);
+  stats.files++;
+  progress.files = filevec;
+  sip (&filevec[! lone], true);
+  if (sip (current, text))
+    {
+      set_binary_mode (current->desc, O_BINARY);
+      return true;
+    }
 
+  slurp (current);
+  prepare_text (current, 0);
+  filevec[0].prefix_lines = filevec[1].prefix_lines = 0;
+  filevec[0].window_lines = filevec[1].window_lines = 0;
   return false;
 }
+
+/* With --horizon-lines=auto, return true if the changes flagged in
+   the files of FILEVEC, which read_files has prepared all at once,
+   run into the first or last line hashed of either file, and the
+   identical prefix or suffix past that line has a line that
+   shift_boundaries could slide the changes onto if it were hashed
+   too: the line just before the first line hashed being like the last
+   line of the run of changes at the start, or the line just after the
+   last line hashed being like the first line of the run at the end.
+   The files then need more of their identical prefix and suffix to
+   place their changes as they would be placed with all of it.  */
+
+bool
+horizon_reached (struct file_data const filevec[])
+{
+  int f;
+
+  if (! adaptive_horizon || window_size || LIN_MAX / 2 < horizon)
+    return false;
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data const *c = &filevec[f];
+      char const *buffer = FILE_BUFFER (c);
+      lin n = c->buffered_lines;
+
+      if (! n)
+	continue;
+
+      if (c->changed[0] && buffer < c->prefix_end)
+	{
+	  char const *p = c->prefix_end - 1;
+	  lin last = 0;
+	  while (c->changed[last + 1])
+	    last++;
+	  while (buffer < p && p[-1] != '\n')
+	    p--;
+	  if (! lines_differ (p, c->linbuf[last]))
+	    return true;
+	}
+
+      if (c->changed[n - 1] && c->suffix_begin < buffer + c->buffered)
+	{
+	  lin first = n - 1;
+	  while (c->changed[first - 1])
+	    first--;
+	  if (! lines_differ (c->linbuf[first], c->suffix_begin))
+	    return true;
+	}
+    }
+
+  return false;
+}
+
+/* Hash the files of FILEVEC again, keeping twice as many lines of
+   their identical prefix and suffix, after horizon_reached has said
+   that they need more and the tables of their lines have been
+   freed.  A large horizon thus costs nothing for the many files
+   that never need it.  */
+
+void
+widen_horizon (struct file_data filevec[])
+{
+  horizon = horizon ? 2 * horizon : 1;
+  stats.horizon_widened++;
+  hash_files (filevec);
+}
+
+/* Read the file CURRENT, whose descriptor and status have been set,
+   into memory and keep it there, so that comparisons of other files
+   with it can share its text and the equivalence classes of its
+   lines.  Such a comparison passes a copy of CURRENT as either of
+   its files, and is never done a window at a time.  Return false, keeping
+   nothing, if the file appears to be binary.  */
+
+bool
+retain_file (struct file_data *current)
+{
+  char const *p;
+  char const *lim;
+  lin lines = 0;
+
+  sip (current, true);
+  slurp (current);
+  prepare_text (current, 0);
+
+  /* Look at the whole file, so that a file that appears binary is
+     known to differ from the retained file without reading it.  */
+  if (! text && memchr (current->buffer, 0, current->buffered))
+    {
+      file_buffer_free (current);
+      return false;
+    }
+
+  lim = FILE_BUFFER (current) + current->buffered;
+  for (p = FILE_BUFFER (current); p != lim;
+       p = (char const *) rawmemchr (p, '\n') + 1)
+    lines++;
+
+  retained.classes = xcalloc (lines, sizeof *retained.classes);
+  alloc_table (&retained.table, 9);
+  retained.equivs = NULL;
+  retained.equivs_alloc = 0;
+  retained.equivs_index = 1;
+  retained.incomplete_class = 0;
+  current->retained = true;
+  return true;
+}
+
+/* If the files of FILEVEC are being compared a window at a time,
+   discard the windows just compared and read the next ones, building
+   the table of equivalence classes as read_files does.  Return true
+   if there was more data to read.  */
+
+bool
+read_next_windows (struct file_data filevec[])
+{
+  int f;
+
+  if (! window_size)
+    return false;
+
+  stats_phase (STATS_READ);
+  for (f = 0; f < 2; f++)
+    {
+      char *buf = FILE_BUFFER (&filevec[f]);
+      memcpy (buf + window[f].cut, &window[f].saved, sizeof window[f].saved);
+      memmove (buf, buf + window[f].cut, window[f].end - window[f].cut);
+      window[f].end -= window[f].cut;
+      window[f].stripped -= MIN (window[f].stripped, window[f].cut);
+      filevec[f].window_lines += window[f].lines;
+      filevec[f].window_bytes += window[f].cut;
+    }
+
+  if (filevec[0].eof && filevec[1].eof
+      && ! window[0].end && ! window[1].end)
+    return false;
+
+  fill_windows (filevec);
+  if (! remote_windows)
+    hash_files (filevec);
+  return true;
+}
+
+/* Return true if the windows that read_files and read_next_windows
+   find are to be compared by remote workers, and not hashed.  */
+
+bool
+windows_are_remote (void)
+{
+  return window_size && remote_windows;
+}
+
+/* Return true if the files being compared are being compared a
+   window at a time.  */
+
+bool
+comparing_windows (void)
+{
+  return window_size != 0;
+}
+
+/* Store the offset in its file and the size of the current window of
+   each file of FILEVEC into OFFSET and SIZE.  */
+
+void
+window_extents (struct file_data const filevec[],
+		uintmax_t offset[2], size_t size[2])
+{
+  int f;
+  for (f = 0; f < 2; f++)
+    {
+      offset[f] = filevec[f].window_bytes;
+      size[f] = window[f].cut;
+    }
+}
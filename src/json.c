@@ -0,0 +1,135 @@
+/* JSON output routines for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+
+static void print_json_hunk (struct change *);
+static void print_json_range (struct file_data const *, lin, lin);
+static void print_json_string (char const *);
+
+/* Has a hunk been printed for the current pair of files?  */
+static bool hunk_printed;
+
+/* Print the start of the JSON record for the files NAME0 and NAME1.
+   This is one line of output per pair of files that differ, so that
+   the output of a recursive comparison can be read a record at a time.  */
+
+void
+print_json_header (char const *name0, char const *name1)
+{
+  fputs ("{\"old\":", outfile);
+  print_json_string (name0);
+  fputs (",\"new\":", outfile);
+  print_json_string (name1);
+  fputs (",\"hunks\":[", outfile);
+  hunk_printed = false;
+}
+
+/* Print the end of the JSON record for the current pair of files.  */
+
+void
+print_json_trailer (void)
+{
+  fputs ("]}\n", outfile);
+}
+
+/* Print the edit-script SCRIPT as hunks of a JSON record.
+   With --max-memory, this is called once for each window of the files,
+   so the record is ended only by finish_output.  */
+
+void
+print_json_script (struct change *script)
+{
+  begin_output ();
+  print_script (script, find_change, print_json_hunk);
+}
+
+/* Print a hunk of a JSON record.
+   This is a contiguous portion of a complete edit script,
+   describing changes in consecutive lines.  */
+
+static void
+print_json_hunk (struct change *hunk)
+{
+  lin first0, last0, first1, last1;
+
+  /* Determine range of line numbers involved in each file.  */
+  if (! analyze_hunk (hunk, &first0, &last0, &first1, &last1))
+    return;
+
+  if (hunk_printed)
+    putc (',', outfile);
+  hunk_printed = true;
+
+  fputs ("{\"old\":", outfile);
+  print_json_range (&files[0], first0, last0);
+  fputs (",\"new\":", outfile);
+  print_json_range (&files[1], first1, last1);
+  putc ('}', outfile);
+}
+
+/* Print lines A through B of FILE as an array of the number of line A,
+   the count of lines, and their offset and length in bytes.
+   If B < A, the range is empty and lies just before line A.
+   No line text is copied; the offsets locate it in the input.  */
+
+static void
+print_json_range (struct file_data const *file, lin a, lin b)
+{
+  char const *buf = FILE_BUFFER (file);
+  char const *beg = file->linbuf[a];
+  char const *end = file->linbuf[b + 1];
+  long int line = translate_line_number (file, a);
+  long int count = b - a + 1;
+  uintmax_t offset = file->window_bytes + (beg - buf);
+  uintmax_t length = end - beg;
+
+  fprintf (outfile, "[%ld,%ld,%"PRIuMAX",%"PRIuMAX"]",
+	   line, count, offset, length);
+}
+
+/* Print the file name NAME as a JSON string.  Escape the characters
+   that JSON requires; other bytes are output as is.  */
+
+static void
+print_json_string (char const *name)
+{
+  FILE *out = outfile;
+  unsigned char const *p;
+
+  putc ('"', out);
+  for (p = (unsigned char const *) name; *p; p++)
+    switch (*p)
+      {
+      case '"': fputs ("\\\"", out); break;
+      case '\\': fputs ("\\\\", out); break;
+      case '\b': fputs ("\\b", out); break;
+      case '\f': fputs ("\\f", out); break;
+      case '\n': fputs ("\\n", out); break;
+      case '\r': fputs ("\\r", out); break;
+      case '\t': fputs ("\\t", out); break;
+      default:
+	if (*p < ' ')
+	  fprintf (out, "\\u%04x", *p);
+	else
+	  putc (*p, out);
+	break;
+      }
+  putc ('"', out);
+}
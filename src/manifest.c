@@ -0,0 +1,316 @@
+/* Manifest of identical files for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+
+#include <error.h>
+#include <hash.h>
+#include <stat-time.h>
+#include <timespec.h>
+#include <xalloc.h>
+
+/* With --manifest=FILE, each pair of regular files that diff finds
+   identical is recorded in FILE along with the status of both files,
+   and in later runs a pair whose files still have the same status is
+   taken to be identical without being read.  The status includes the
+   inode change time, which any change to a file's contents updates
+   and which, unlike the modification time, cannot be set back.
+
+   FILE holds a header and then three null-terminated fields per
+   pair: the numbers from the files' status, and the two names.  */
+
+static char const manifest_header[] = "GNU diff manifest 1";
+
+/* What the manifest records of a file's status.  */
+
+struct manifest_stat
+{
+  uintmax_t size;
+  uintmax_t ino;
+  struct timespec mtime;
+  struct timespec ctime;
+};
+
+struct manifest_entry
+{
+  /* The names of the two files, each followed by a null byte.  */
+  char *names;
+  size_t names_size;
+
+  struct manifest_stat stat[2];
+
+  /* Whether this run found the pair identical, so that it is kept.  */
+  bool seen;
+};
+
+static Hash_table *manifest_table;
+
+static size_t _GL_ATTRIBUTE_PURE
+manifest_hash (void const *entry, size_t table_size)
+{
+  struct manifest_entry const *e = entry;
+  size_t h = 0;
+  size_t i;
+  for (i = 0; i < e->names_size; i++)
+    h = h * 31 + (unsigned char) e->names[i];
+  return h % table_size;
+}
+
+static bool
+manifest_compare (void const *entry1, void const *entry2)
+{
+  struct manifest_entry const *e1 = entry1;
+  struct manifest_entry const *e2 = entry2;
+  return (e1->names_size == e2->names_size
+	  && memcmp (e1->names, e2->names, e1->names_size) == 0);
+}
+
+static void
+manifest_free (void *entry)
+{
+  struct manifest_entry *e = entry;
+  free (e->names);
+  free (e);
+}
+
+static void
+get_manifest_stat (struct manifest_stat *ms, struct stat const *st)
+{
+  ms->size = st->st_size;
+  ms->ino = st->st_ino;
+  ms->mtime = get_stat_mtime (st);
+  ms->ctime = get_stat_ctime (st);
+}
+
+static bool
+same_manifest_stat (struct manifest_stat const *a,
+		    struct manifest_stat const *b)
+{
+  return (a->size == b->size && a->ino == b->ino
+	  && timespec_cmp (a->mtime, b->mtime) == 0
+	  && timespec_cmp (a->ctime, b->ctime) == 0);
+}
+
+/* Set *KEY to look up the pair of files FILE[0] and FILE[1],
+   using BUF of size BUFSIZE if it is big enough.  */
+
+static void
+manifest_key (struct manifest_entry *key, struct file_data const file[],
+	      char *buf, size_t bufsize)
+{
+  size_t size0 = strlen (file[0].name) + 1;
+  size_t size1 = strlen (file[1].name) + 1;
+  key->names_size = size0 + size1;
+  key->names = key->names_size <= bufsize ? buf : xmalloc (key->names_size);
+  memcpy (key->names, file[0].name, size0);
+  memcpy (key->names + size0, file[1].name, size1);
+}
+
+static void
+insert_entry (struct manifest_entry *e)
+{
+  if (! hash_insert (manifest_table, e))
+    xalloc_die ();
+}
+
+/* Start a manifest to be written to NAME, reading the pairs that NAME
+   records if it exists.  */
+
+void
+read_manifest (char const *name)
+{
+  FILE *fp;
+  char *buf = NULL;
+  size_t bufsize = 0;
+  size_t used = 0;
+  char const *p;
+  char const *lim;
+
+  manifest_table = hash_initialize (0, NULL, manifest_hash,
+				    manifest_compare, manifest_free);
+  if (! manifest_table)
+    xalloc_die ();
+
+  fp = fopen (name, "rb");
+  if (! fp)
+    {
+      if (errno != ENOENT)
+	pfatal_with_name (name);
+      return;
+    }
+
+  for (;;)
+    {
+      size_t bytes;
+      if (used == bufsize)
+	buf = x2realloc (buf, &bufsize);
+      bytes = fread (buf + used, 1, bufsize - used, fp);
+      if (! bytes)
+	break;
+      used += bytes;
+    }
+  if (ferror (fp) || fclose (fp) != 0)
+    pfatal_with_name (name);
+
+  p = buf;
+  lim = buf + used;
+  if (! (sizeof manifest_header <= used
+	 && memcmp (p, manifest_header, sizeof manifest_header) == 0))
+    error (EXIT_TROUBLE, 0, _("%s: not a diff manifest"), name);
+  p += sizeof manifest_header;
+
+  while (p < lim)
+    {
+      struct manifest_entry *e = xmalloc (sizeof *e);
+      struct manifest_stat *s = e->stat;
+      intmax_t t[4];
+      long int ns[4];
+      char const *names;
+      char const *name1;
+      char const *end;
+
+      names = memchr (p, 0, lim - p);
+      name1 = names ? memchr (names + 1, 0, lim - (names + 1)) : NULL;
+      end = name1 ? memchr (name1 + 1, 0, lim - (name1 + 1)) : NULL;
+      if (! (end
+	     && (sscanf (p,
+			 ("%"SCNuMAX" %"SCNuMAX" %"SCNdMAX" %ld %"SCNdMAX" %ld"
+			  " %"SCNuMAX" %"SCNuMAX" %"SCNdMAX" %ld %"SCNdMAX" %ld"),
+			 &s[0].size, &s[0].ino, &t[0], &ns[0], &t[1], &ns[1],
+			 &s[1].size, &s[1].ino, &t[2], &ns[2], &t[3], &ns[3])
+		 == 12)))
+	error (EXIT_TROUBLE, 0, _("%s: not a diff manifest"), name);
+
+      s[0].mtime.tv_sec = t[0];
+      s[0].mtime.tv_nsec = ns[0];
+      s[0].ctime.tv_sec = t[1];
+      s[0].ctime.tv_nsec = ns[1];
+      s[1].mtime.tv_sec = t[2];
+      s[1].mtime.tv_nsec = ns[2];
+      s[1].ctime.tv_sec = t[3];
+      s[1].ctime.tv_nsec = ns[3];
+
+      names++;
+      e->names_size = end + 1 - names;
+      e->names = xmemdup (names, e->names_size);
+      e->seen = false;
+      insert_entry (e);
+      p = end + 1;
+    }
+
+  free (buf);
+}
+
+/* Return true if the manifest says that the regular files FILE[0] and
+   FILE[1] are identical, and keep them in the manifest if so.  */
+
+bool
+manifest_lists (struct file_data const file[])
+{
+  char buf[1024];
+  struct manifest_entry key;
+  struct manifest_entry *e;
+  bool listed = false;
+
+  if (! manifest_table)
+    return false;
+
+  manifest_key (&key, file, buf, sizeof buf);
+  e = hash_lookup (manifest_table, &key);
+  if (e)
+    {
+      struct manifest_stat s[2];
+      get_manifest_stat (&s[0], &file[0].stat);
+      get_manifest_stat (&s[1], &file[1].stat);
+      listed = (same_manifest_stat (&s[0], &e->stat[0])
+		&& same_manifest_stat (&s[1], &e->stat[1]));
+      e->seen |= listed;
+    }
+  if (key.names != buf)
+    free (key.names);
+  return listed;
+}
+
+/* Record in the manifest that the regular files FILE[0] and FILE[1]
+   were found identical.  Do nothing if the comparison ignored some
+   differences, as then the files need not be identical.  */
+
+void
+manifest_add (struct file_data const file[])
+{
+  struct manifest_entry *e;
+  struct manifest_entry *old;
+
+  if (! manifest_table
+      || ignore_white_space != IGNORE_NO_WHITE_SPACE || ignore_case
+      || ignore_blank_lines || ignore_regexp.fastmap || strip_trailing_cr)
+    return;
+
+  e = xmalloc (sizeof *e);
+  manifest_key (e, file, NULL, 0);
+  get_manifest_stat (&e->stat[0], &file[0].stat);
+  get_manifest_stat (&e->stat[1], &file[1].stat);
+  e->seen = true;
+
+  old = hash_delete (manifest_table, e);
+  if (old)
+    manifest_free (old);
+  insert_entry (e);
+}
+
+static bool
+write_entry (void *entry, void *fp)
+{
+  struct manifest_entry const *e = entry;
+  struct manifest_stat const *s = e->stat;
+  if (e->seen)
+    {
+      fprintf (fp,
+	       ("%"PRIuMAX" %"PRIuMAX" %"PRIdMAX" %ld %"PRIdMAX" %ld"
+		" %"PRIuMAX" %"PRIuMAX" %"PRIdMAX" %ld %"PRIdMAX" %ld"),
+	       s[0].size, s[0].ino,
+	       (intmax_t) s[0].mtime.tv_sec, (long int) s[0].mtime.tv_nsec,
+	       (intmax_t) s[0].ctime.tv_sec, (long int) s[0].ctime.tv_nsec,
+	       s[1].size, s[1].ino,
+	       (intmax_t) s[1].mtime.tv_sec, (long int) s[1].mtime.tv_nsec,
+	       (intmax_t) s[1].ctime.tv_sec, (long int) s[1].ctime.tv_nsec);
+      putc ('\0', fp);
+      fwrite (e->names, 1, e->names_size, fp);
+    }
+  return true;
+}
+
+/* Write the pairs found identical in this run to the manifest NAME,
+   replacing it.  */
+
+void
+write_manifest (char const *name)
+{
+  char *temp = concat (name, ".tmp", "");
+  FILE *fp = fopen (temp, "wb");
+  if (! fp)
+    pfatal_with_name (temp);
+  fwrite (manifest_header, 1, sizeof manifest_header, fp);
+  hash_do_for_each (manifest_table, write_entry, fp);
+  if (ferror (fp) | (fclose (fp) != 0))
+    pfatal_with_name (temp);
+  if (rename (temp, name) != 0)
+    pfatal_with_name (name);
+  free (temp);
+}
@@ -0,0 +1,154 @@
+/* Watch the regions that input files are mapped into.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "system.h"
+#include "mapwatch.h"
+
+#include <ignore-value.h>
+#include <progname.h>
+#include <signal.h>
+
+/* If a file that is mapped into memory shrinks while the mapping is
+   in use, touching a page past the file's new end raises SIGBUS.
+   Rather than dying of the signal, diff and cmp then report that the
+   file changed and exit with status 2, as for other trouble.  A signal
+   handler can use only what was set up before, so the regions are
+   kept in a small table, and a file is read rather than mapped if
+   the table is full.  */
+
+#if defined SIGBUS && defined SA_SIGINFO
+
+/* The most regions watched at once.  diff maps at most two files at
+   a time, and the file that diff3 keeps for both of its comparisons.  */
+enum { WATCHED_MAX = 8 };
+
+/* The regions watched, and the names of the files mapped into them;
+   an entry whose START is null is free.  */
+static struct watched
+{
+  char const *start;
+  size_t size;
+  char const *name;
+} watched[WATCHED_MAX];
+
+/* The message that the handler outputs, translated beforehand.  */
+static char const *changed_message;
+
+/* Output the string S to standard error, from a signal handler.  */
+
+static void
+write_string (char const *s)
+{
+  ignore_value (write (STDERR_FILENO, s, strlen (s)));
+}
+
+/* Handle the signal SIG, raised by touching the address in INFO: if
+   it is in a watched region, report that the file changed and exit.  */
+
+static void
+sigbus_handler (int sig, siginfo_t *info,
+		void *context __attribute__((unused)))
+{
+  char const *addr = info->si_addr;
+  int i;
+
+  for (i = 0; i < WATCHED_MAX; i++)
+    if (watched[i].start && watched[i].start <= addr
+	&& addr - watched[i].start < watched[i].size)
+      {
+	write_string (program_name);
+	write_string (": ");
+	write_string (watched[i].name);
+	write_string (": ");
+	write_string (changed_message);
+	write_string ("\n");
+	_exit (EXIT_TROUBLE);
+      }
+
+  /* Any other fault kills the process as usual, when the instruction
+     that raised it is retried.  */
+  signal (sig, SIG_DFL);
+}
+
+/* Watch the SIZE bytes at START, which the file NAME is mapped into,
+   until unwatch_mapping (START).  Return false, and watch nothing,
+   if the region cannot be watched; the caller should then read the
+   file instead.  NAME must last as long as the mapping.  */
+
+bool
+watch_mapping (void const *start, size_t size, char const *name)
+{
+  static bool handled;
+  int i;
+
+  if (! handled)
+    {
+      struct sigaction act;
+      changed_message = _("file changed as we read it");
+      memset (&act, 0, sizeof act);
+      sigemptyset (&act.sa_mask);
+      act.sa_sigaction = sigbus_handler;
+      act.sa_flags = SA_SIGINFO;
+      if (sigaction (SIGBUS, &act, NULL) != 0)
+	return false;
+      handled = true;
+    }
+
+  for (i = 0; i < WATCHED_MAX; i++)
+    if (! watched[i].start)
+      {
+	watched[i].size = size;
+	watched[i].name = name;
+	watched[i].start = start;
+	return true;
+      }
+  return false;
+}
+
+/* Stop watching the region at START, before it is unmapped.  */
+
+void
+unwatch_mapping (void const *start)
+{
+  int i;
+
+  for (i = 0; i < WATCHED_MAX; i++)
+    if (watched[i].start == start)
+      {
+	watched[i].start = NULL;
+	return;
+      }
+}
+
+#else
+
+bool
+watch_mapping (void const *start __attribute__((unused)),
+	       size_t size __attribute__((unused)),
+	       char const *name __attribute__((unused)))
+{
+  return true;
+}
+
+void
+unwatch_mapping (void const *start __attribute__((unused)))
+{
+}
+
+#endif
@@ -0,0 +1,289 @@
+/* Moved-block output routines for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <xalloc.h>
+
+/* The --moves output is normal output in which a block of at least
+   move_min lines that the first file deletes in one place and the
+   second inserts in another is output once, as a move, without its
+   text.  Moves are found after the edit script is, among the lines
+   that it deletes and inserts, by looking up the rolling hash of each
+   move_min consecutive inserted lines' equivalence classes in a table
+   of those of the deleted lines, so that the search costs time
+   proportional to the number of changed lines.  */
+
+/* A block of COUNT lines that is at FIRST0 in the first file and at
+   FIRST1 in the second.  */
+struct move
+{
+  lin first0, first1, count;
+};
+
+static struct move *moves;
+static size_t nmoves;
+static size_t moves_alloc;
+
+/* For each line of the first file, whether it is the source of a
+   move; and for each line of the second file, 1 more than the index
+   in MOVES of the move it is part of, or 0.  */
+static char *moved0;
+static lin *move_of1;
+
+static void print_moves_hunk (struct change *);
+
+/* The multiplier of the rolling hash.  */
+#define MOVE_HASH_K ((size_t) UINTMAX_C (0x9e3779b97f4a7c15))
+
+/* Return the hash of the N classes at EQUIVS.  */
+
+static size_t
+window_hash (lin const *equivs, lin n)
+{
+  size_t h = 0;
+  lin i;
+  for (i = 0; i < n; i++)
+    h = h * MOVE_HASH_K + equivs[i];
+  return h;
+}
+
+/* Return true if the N lines of file 0 at LINE0 and of file 1 at LINE1
+   are deleted and inserted, are not yet part of a move, and are
+   alike.  */
+
+static bool
+can_move (lin line0, lin line1, lin n)
+{
+  lin const *eq0 = files[0].equivs;
+  lin const *eq1 = files[1].equivs;
+  lin i;
+
+  if (files[0].buffered_lines - line0 < n)
+    return false;
+  for (i = 0; i < n; i++)
+    if (! files[0].changed[line0 + i] || moved0[line0 + i]
+	|| eq0[line0 + i] != eq1[line1 + i])
+      return false;
+  return true;
+}
+
+/* Find the blocks of lines that SCRIPT deletes from one place and
+   inserts in another, and record them in MOVES.  */
+
+static void
+find_moves (struct change *script)
+{
+  lin const *eq0 = files[0].equivs;
+  lin const *eq1 = files[1].equivs;
+  lin k = move_min;
+  size_t power = 1;
+  lin *slot;
+  size_t *slot_hash;
+  size_t mask;
+  size_t windows = 0;
+  struct change *e;
+  size_t j;
+  lin i;
+
+  nmoves = 0;
+  moved0 = xzalloc (files[0].buffered_lines + 1);
+  move_of1 = xcalloc (files[1].buffered_lines + 1, sizeof *move_of1);
+
+  for (i = 1; i < k; i++)
+    power *= MOVE_HASH_K;
+
+  /* Size a table of the starts of the windows of K deleted lines,
+     by their hashes, at no more than half full.  */
+  for (e = script; e; e = e->link)
+    if (k <= e->deleted)
+      windows += e->deleted - k + 1;
+  if (! windows)
+    return;
+  for (mask = 15; mask / 2 < windows; mask = 2 * mask + 1)
+    continue;
+  slot = xnmalloc (mask + 1, sizeof *slot);
+  slot_hash = xnmalloc (mask + 1, sizeof *slot_hash);
+  for (j = 0; j <= mask; j++)
+    slot[j] = -1;
+
+  for (e = script; e; e = e->link)
+    if (k <= e->deleted)
+      {
+	lin line = e->line0;
+	lin end = e->line0 + e->deleted;
+	size_t h = window_hash (eq0 + line, k);
+	for (;;)
+	  {
+	    j = h & mask;
+	    while (0 <= slot[j])
+	      j = (j + 1) & mask;
+	    slot[j] = line;
+	    slot_hash[j] = h;
+	    if (line + k == end)
+	      break;
+	    h = (h - eq0[line] * power) * MOVE_HASH_K + eq0[line + k];
+	    line++;
+	  }
+      }
+
+  /* Slide a window over each run of inserted lines, and when its
+     lines are alike a window of deleted lines, extend the match as
+     far as it goes and take it as a move.  */
+  for (e = script; e; e = e->link)
+    if (k <= e->inserted)
+      {
+	lin line = e->line1;
+	lin end = e->line1 + e->inserted;
+	size_t h = window_hash (eq1 + line, k);
+	while (line + k <= end)
+	  {
+	    lin from = -1;
+	    for (j = h & mask; 0 <= slot[j]; j = (j + 1) & mask)
+	      if (slot_hash[j] == h && can_move (slot[j], line, k))
+		{
+		  from = slot[j];
+		  break;
+		}
+
+	    if (from < 0)
+	      {
+		if (line + k == end)
+		  break;
+		h = (h - eq1[line] * power) * MOVE_HASH_K + eq1[line + k];
+		line++;
+	      }
+	    else
+	      {
+		lin n = k;
+		while (line + n < end && can_move (from + n, line + n, 1))
+		  n++;
+		if (nmoves == moves_alloc)
+		  moves = x2nrealloc (moves, &moves_alloc, sizeof *moves);
+		moves[nmoves].first0 = from;
+		moves[nmoves].first1 = line;
+		moves[nmoves].count = n;
+		nmoves++;
+		for (i = 0; i < n; i++)
+		  {
+		    moved0[from + i] = 1;
+		    move_of1[line + i] = nmoves;
+		  }
+		line += n;
+		if (end < line + k)
+		  break;
+		h = window_hash (eq1 + line, k);
+	      }
+	  }
+      }
+
+  free (slot);
+  free (slot_hash);
+}
+
+/* Print the edit script SCRIPT with moved blocks shown as moves.  */
+
+void
+print_moves_script (struct change *script)
+{
+  find_moves (script);
+  print_script (script, find_change, print_moves_hunk);
+  free (moved0);
+  free (move_of1);
+}
+
+/* Print lines FIRST0 through LAST0 of the first file and FIRST1
+   through LAST1 of the second as a hunk of a normal diff.  If either
+   range is empty, it lies just before its first line.  */
+
+static void
+print_normal_lines (lin first0, lin last0, lin first1, lin last1)
+{
+  enum changes changes = ((first0 <= last0 ? OLD : 0)
+			  | (first1 <= last1 ? NEW : 0));
+  lin i;
+
+  print_number_range (',', &files[0], first0, last0);
+  fputc (change_letter[changes], outfile);
+  print_number_range (',', &files[1], first1, last1);
+  fputc ('\n', outfile);
+
+  for (i = first0; i <= last0; i++)
+    print_1_line ("<", &files[0].linbuf[i]);
+  if (changes == CHANGED)
+    fputs ("---\n", outfile);
+  for (i = first1; i <= last1; i++)
+    print_1_line (">", &files[1].linbuf[i]);
+}
+
+/* Print a hunk of --moves output.  A hunk without moved lines is
+   output as in a normal diff.  Otherwise its lines that were deleted
+   but not moved are output as deletions, and the lines that were
+   inserted as additions, or as moves if they were moved.  */
+
+static void
+print_moves_hunk (struct change *hunk)
+{
+  lin first0, last0, first1, last1;
+  lin i, j;
+  bool any_moved = false;
+
+  if (! analyze_hunk (hunk, &first0, &last0, &first1, &last1))
+    return;
+
+  begin_output ();
+
+  for (i = first0; i <= last0 && ! any_moved; i++)
+    any_moved = moved0[i];
+  for (j = first1; j <= last1 && ! any_moved; j++)
+    any_moved = move_of1[j] != 0;
+  if (! any_moved)
+    {
+      print_normal_lines (first0, last0, first1, last1);
+      return;
+    }
+
+  for (i = first0; i <= last0; )
+    if (moved0[i])
+      i++;
+    else
+      {
+	lin a = i;
+	while (i <= last0 && ! moved0[i])
+	  i++;
+	print_normal_lines (a, i - 1, first1, first1 - 1);
+      }
+
+  for (j = first1; j <= last1; )
+    {
+      lin m = move_of1[j];
+      lin a = j;
+      while (j <= last1 && move_of1[j] == m)
+	j++;
+      if (! m)
+	print_normal_lines (last0 + 1, last0, a, j - 1);
+      else
+	{
+	  lin from = moves[m - 1].first0 + (a - moves[m - 1].first1);
+	  print_number_range (',', &files[0], from, from + (j - a) - 1);
+	  fputc ('m', outfile);
+	  print_number_range (',', &files[1], a, j - 1);
+	  fputc ('\n', outfile);
+	}
+    }
+}
@@ -39,7 +39,6 @@ static void
 print_normal_hunk (struct change *hunk)
 {
   lin first0, last0, first1, last1;
-  register lin i;
 
   /* Determine range of line numbers involved in each file.  */
   enum changes changes = analyze_hunk (hunk, &first0, &last0, &first1, &last1);
@@ -56,14 +55,12 @@ print_normal_hunk (struct change *hunk)
 
   /* Print the lines that the first file has.  */
   if (changes & OLD)
-    for (i = first0; i <= last0; i++)
-      print_1_line ("<", &files[0].linbuf[i]);
+    print_flagged_lines ("<", &files[0], first0, last0);
 
   if (changes == CHANGED)
     fputs ("---\n", outfile);
 
   /* Print the lines that the second file has.  */
   if (changes & NEW)
-    for (i = first1; i <= last1; i++)
-      print_1_line (">", &files[1].linbuf[i]);
+    print_flagged_lines (">", &files[1], first1, last1);
 }
@@ -0,0 +1,143 @@
+/* Place worker processes on the nodes of the machine.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "system.h"
+#include "numa.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <xalloc.h>
+
+/* On a machine whose memory is split among nodes, each close to some
+   of the CPUs, a child process that compares files for --jobs is kept
+   on the CPUs of one node, the workers taking the nodes in turn.  The
+   child allocates its buffers and tables after it is placed, and
+   memory is taken from the node of the CPU that first touches it, so
+   the child's data stays on its own node rather than being reached
+   across the machine.  Only the CPUs that diff may already run on are
+   used, and on a machine with one node nothing is done.  */
+
+#if defined __linux__ && defined CPU_SETSIZE
+
+/* The CPUs of each node, among those this process may run on, for
+   the nodes that have any; and the number of such nodes, if more
+   than one.  */
+static cpu_set_t *node_cpus;
+static int nodes;
+
+/* Add to *SET the CPUs in the list in the file F, such as "0-3,8".
+   Return false if the list cannot be read.  */
+
+static bool
+read_cpu_list (FILE *f, cpu_set_t *set)
+{
+  int c;
+
+  do
+    {
+      int lo, hi;
+      if (fscanf (f, "%d", &lo) != 1)
+	return false;
+      hi = lo;
+      c = getc (f);
+      if (c == '-')
+	{
+	  if (fscanf (f, "%d", &hi) != 1)
+	    return false;
+	  c = getc (f);
+	}
+      for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+	CPU_SET (lo, set);
+    }
+  while (c == ',');
+
+  return true;
+}
+
+/* Find the nodes of the machine and their CPUs, before the first
+   worker is started.  */
+
+void
+plan_workers (void)
+{
+  static bool planned;
+  cpu_set_t allowed;
+  int n;
+
+  if (planned)
+    return;
+  planned = true;
+  if (sched_getaffinity (0, sizeof allowed, &allowed) != 0)
+    return;
+
+  for (n = 0; n < CPU_SETSIZE; n++)
+    {
+      char name[sizeof "/sys/devices/system/node/node/cpulist"
+		+ INT_STRLEN_BOUND (int)];
+      cpu_set_t set;
+      FILE *f;
+      bool ok;
+
+      sprintf (name, "/sys/devices/system/node/node%d/cpulist", n);
+      f = fopen (name, "r");
+      if (! f)
+	break;
+      CPU_ZERO (&set);
+      ok = read_cpu_list (f, &set);
+      fclose (f);
+      CPU_AND (&set, &set, &allowed);
+      if (ok && CPU_COUNT (&set))
+	{
+	  node_cpus = xnrealloc (node_cpus, nodes + 1, sizeof *node_cpus);
+	  node_cpus[nodes++] = set;
+	}
+    }
+
+  if (nodes < 2)
+    {
+      free (node_cpus);
+      node_cpus = NULL;
+      nodes = 0;
+    }
+}
+
+/* Keep the calling process, worker number WORKER, on the CPUs of its
+   node.  */
+
+void
+place_worker (int worker)
+{
+  if (nodes)
+    sched_setaffinity (0, sizeof *node_cpus, &node_cpus[worker % nodes]);
+}
+
+#else
+
+void
+plan_workers (void)
+{
+}
+
+void
+place_worker (int worker __attribute__((unused)))
+{
+}
+
+#endif
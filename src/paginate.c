@@ -0,0 +1,248 @@
+/* Pagination of output for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+
+#include <wchar.h>
+
+/* The output for one pair of files is written to a temporary file,
+   and copied from it to stdout in pages when the pair is done, as
+   'pr -h HEADER' would lay it out with its defaults: pages of 66
+   lines, each with a header of 5 lines and a trailer of 5 blank lines.
+   This saves a fork, an exec and a wait for each pair of files.  */
+
+enum
+{
+  PAGE_LINES = 66,
+  HEADER_LINES = 5,
+  TRAILER_LINES = 5,
+  BODY_LINES = PAGE_LINES - HEADER_LINES - TRAILER_LINES,
+
+  /* Print columns of the line that says the date, header and page.  */
+  HEADER_WIDTH = 72
+};
+
+/* The temporary file, kept open for the next pair of files.  */
+static FILE *page_file;
+
+/* The header given to begin_pagination, and the time it was called.  */
+static char *page_header;
+static char page_date[MAX (sizeof "YYYY-MM-DD HH:MM",
+			   INT_STRLEN_BOUND (intmax_t) + 1)];
+
+/* The state of the copy to stdout.  */
+static uintmax_t page_number;
+static int page_lines;
+static bool page_open;
+static bool at_line_start;
+static bool after_formfeed;
+
+/* Return the number of print columns of the string S.  */
+
+static size_t
+string_width (char const *s)
+{
+  char const *lim = s + strlen (s);
+  size_t width = 0;
+  mbstate_t mbstate = { 0 };
+
+  while (s < lim)
+    {
+      wchar_t wc;
+      size_t bytes = mbrtowc (&wc, s, lim - s, &mbstate);
+      if (bytes == (size_t) -1 || bytes == (size_t) -2)
+	{
+	  memset (&mbstate, 0, sizeof mbstate);
+	  bytes = 1;
+	  width++;
+	}
+      else
+	{
+	  int w = wcwidth (wc);
+	  width += 0 < w ? w : 0;
+	  bytes += ! bytes;
+	}
+      s += bytes;
+    }
+
+  return width;
+}
+
+static void
+begin_page (void)
+{
+  char page[sizeof "Page " + INT_STRLEN_BOUND (uintmax_t)];
+  size_t date_width = strlen (page_date);
+  size_t header_width = string_width (page_header);
+  size_t page_width;
+  size_t available;
+  int lhs_spaces = 1, rhs_spaces = 1;
+
+  sprintf (page, _("Page %"PRIuMAX), ++page_number);
+  page_width = string_width (page);
+
+  /* Center the header between the date and the page number.  */
+  available = date_width + header_width + page_width;
+  if (available < HEADER_WIDTH)
+    {
+      available = HEADER_WIDTH - available;
+      lhs_spaces = MAX (1, available / 2);
+      rhs_spaces = MAX (1, available - available / 2);
+    }
+
+  printf ("\n\n%s%*s%s%*s%s\n\n\n",
+	  page_date, lhs_spaces, "", page_header, rhs_spaces, "", page);
+  page_lines = 0;
+  page_open = true;
+}
+
+static void
+end_page (void)
+{
+  int n;
+  for (n = page_lines; n < BODY_LINES + TRAILER_LINES; n++)
+    putchar ('\n');
+  page_open = false;
+}
+
+/* Copy the SIZE bytes of BUF to stdout in pages.  A formfeed ends the
+   current page, or outputs an empty page if there is none, and a
+   newline right after it is discarded.  */
+
+static void
+paginate_buffer (char const *buf, size_t size)
+{
+  char const *p = buf;
+  char const *lim = buf + size;
+
+  while (p < lim)
+    {
+      char const *q;
+
+      if (after_formfeed)
+	{
+	  after_formfeed = false;
+	  if (*p == '\n')
+	    {
+	      p++;
+	      continue;
+	    }
+	}
+
+      if (*p == '\f')
+	{
+	  if (! page_open)
+	    begin_page ();
+	  if (! at_line_start)
+	    {
+	      putchar ('\n');
+	      page_lines++;
+	      at_line_start = true;
+	    }
+	  end_page ();
+	  after_formfeed = true;
+	  p++;
+	  continue;
+	}
+
+      if (at_line_start)
+	{
+	  if (page_open && page_lines == BODY_LINES)
+	    end_page ();
+	  if (! page_open)
+	    begin_page ();
+	  at_line_start = false;
+	}
+
+      for (q = p; q < lim && *q != '\n' && *q != '\f'; q++)
+	continue;
+      if (q < lim && *q == '\n')
+	{
+	  q++;
+	  page_lines++;
+	  at_line_start = true;
+	}
+      fwrite (p, sizeof (char), q - p, stdout);
+      p = q;
+    }
+}
+
+/* Begin paginating the output for a pair of files, with HEADER
+   (which is freed when done) at the top of each page.
+   Return the stream to write the output to.  */
+
+FILE *
+begin_pagination (char *header)
+{
+  time_t now = time (0);
+  struct tm const *tm = localtime (&now);
+
+  if (! (tm && strftime (page_date, sizeof page_date, "%Y-%m-%d %H:%M", tm)))
+    sprintf (page_date, "%"PRIdMAX, (intmax_t) now);
+
+  if (! page_file)
+    {
+      page_file = tmpfile ();
+      if (! page_file)
+	pfatal_with_name ("tmpfile");
+    }
+
+  page_header = header;
+  page_number = 0;
+  page_open = false;
+  at_line_start = true;
+  after_formfeed = false;
+  return page_file;
+}
+
+/* Copy the output written since begin_pagination to stdout in pages.  */
+
+void
+finish_pagination (void)
+{
+  char buf[16 * 1024];
+  off_t size;
+
+  if (fflush (page_file) != 0 || ferror (page_file))
+    pfatal_with_name (_("write failed"));
+  size = ftello (page_file);
+  rewind (page_file);
+
+  while (0 < size)
+    {
+      size_t bytes = fread (buf, sizeof (char), MIN (size, sizeof buf),
+			    page_file);
+      if (! bytes)
+	pfatal_with_name (_("read failed"));
+      paginate_buffer (buf, bytes);
+      size -= bytes;
+    }
+
+  /* 'pr' ends a last line that lacks a newline.  */
+  if (! at_line_start)
+    {
+      putchar ('\n');
+      page_lines++;
+    }
+  if (page_open)
+    end_page ();
+
+  rewind (page_file);
+  free (page_header);
+}
@@ -0,0 +1,65 @@
+/* Static probes on the hot paths of GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Where <sys/sdt.h> is available, PROBEn (NAME, ARG1, ..., ARGn)
+   marks a USDT probe of the provider "diffutils" that SystemTap,
+   bpftrace, perf and the like can attach to in an unmodified binary.
+   A probe that nothing is attached to costs a no-op instruction and
+   making its arguments available, which are all at hand where the
+   probes are.  Elsewhere, or if compiled with -DDISABLE_PROBES, the
+   probes compile to nothing.
+
+   The probes, and their arguments, are:
+
+     compare_files_start (name0, name1)	  diff is about to compare a pair
+     compare_files_done (name0, name1, status)  ...and has finished
+     read_files (name0, name1)		  reading a pair of files begins
+     hashed (lines0, lines1)		  their lines have been hashed
+     compare_start (lines0, lines1)	  the search for changes begins,
+					  on the lines not discarded
+     compare_done (costly)		  ...and has ended, cut short
+					  if COSTLY
+     begin_output (name0, name1)	  output for a pair begins
+     diff_child (filea, fileb, pid)	  diff3 has started comparing
+					  two files in process PID
+
+   Names are null-terminated strings; NAME0 or NAME1 of a file that
+   exists in only one directory is null.  */
+
+#ifndef DIFF_PROBES_H
+#define DIFF_PROBES_H
+
+#if defined __has_include && ! defined DISABLE_PROBES
+# if __has_include (<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define HAVE_PROBES 1
+# endif
+#endif
+
+#ifdef HAVE_PROBES
+# define PROBE1(name, a) DTRACE_PROBE1 (diffutils, name, a)
+# define PROBE2(name, a, b) DTRACE_PROBE2 (diffutils, name, a, b)
+# define PROBE3(name, a, b, c) DTRACE_PROBE3 (diffutils, name, a, b, c)
+#else
+# define PROBE1(name, a) ((void) 0)
+# define PROBE2(name, a, b) ((void) 0)
+# define PROBE3(name, a, b, c) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,528 @@
+/* Comparing huge files on remote workers for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <c-ctype.h>
+#include <error.h>
+#include <signal.h>
+#include <xalloc.h>
+
+/* With --remote=COMMAND, a pair of files too large for --max-memory
+   is cut into windows as usual, each ending inside a run of lines
+   that are the same in both files, but the windows are compared by
+   workers rather than here.  Each worker is a 'diff --remote-worker'
+   that COMMAND starts, typically on another machine, reading the same
+   files.  The windows' lines are not even hashed here, as only where
+   they begin and end is needed.  The windows are handed to the
+   workers in turn, and their output is copied to stdout in order,
+   each worker comparing the next window while the output of the
+   others is copied.
+
+   A worker reads requests on its standard input and answers on its
+   standard output.  Strings are sent as their length in decimal, a
+   newline and their bytes.  The coordinator first sends the number of
+   diff's options, a newline and the options as strings, and then for
+   each pair of files:
+
+     "F\n" followed by the names of the files as strings;
+     "C OFFSET0 SIZE0 LINES0 OFFSET1 SIZE1 LINES1\n" for each window,
+     where LINES is the number of lines of the file before the window.
+
+   The worker answers each "C" with "STATUS SIZE\n", where STATUS is 1
+   if the windows differ and 0 otherwise, followed by SIZE bytes of
+   output for the window, without a header.  It exits when its input
+   ends.  */
+
+/* A worker started by --remote.  */
+struct worker
+{
+  char const *command;
+  pid_t pid;
+  FILE *to;
+  FILE *from;
+
+  /* Whether a window has been sent to this worker and not answered.  */
+  bool busy;
+};
+
+static struct worker *workers;
+static size_t remote_alloc;
+static bool workers_started;
+
+/* The options to pass to the workers.  */
+static char **remote_options;
+static int remote_noptions;
+
+/* Add a worker started by COMMAND.  */
+
+void
+add_remote_worker (char const *command)
+{
+  if (remote_count == remote_alloc)
+    workers = x2nrealloc (workers, &remote_alloc, sizeof *workers);
+  memset (&workers[remote_count], 0, sizeof *workers);
+  workers[remote_count++].command = command;
+}
+
+/* Pass the COUNT options at OPTIONS to the workers.  */
+
+void
+set_remote_options (char **options, int count)
+{
+  remote_options = options;
+  remote_noptions = count;
+}
+
+/* Return true if the files of FILEVEC, if they are compared a window
+   at a time, can have their windows compared by the workers.  The
+   workers read the windows from the files at their offsets, which
+   rules out anything but regular files and stripping CRs, and the
+   output must be made of hunks that are independent of each other
+   and counted nowhere else.  */
+
+bool
+remote_comparable (struct file_data const filevec[])
+{
+  return (remote_count && ! brief && ! strip_trailing_cr
+	  && ! output_index && ! max_hunks && ! show_function
+	  && (output_style == OUTPUT_NORMAL
+	      || output_style == OUTPUT_CONTEXT
+	      || output_style == OUTPUT_UNIFIED)
+	  && S_ISREG (filevec[0].stat.st_mode)
+	  && S_ISREG (filevec[1].stat.st_mode));
+}
+
+static void worker_failed (struct worker const *) __attribute__((noreturn));
+
+/* Report that worker W failed, and exit.  */
+
+static void
+worker_failed (struct worker const *w)
+{
+  error (EXIT_TROUBLE, 0, _("remote worker '%s' failed"), w->command);
+  abort ();
+}
+
+/* Send worker W the requests written to it so far.  A worker that
+   has exited is reported as having failed, rather than killing diff
+   with SIGPIPE.  */
+
+static void
+flush_worker (struct worker *w)
+{
+  void (*handler) (int) = signal (SIGPIPE, SIG_IGN);
+  bool flushed = fflush (w->to) == 0;
+  signal (SIGPIPE, handler);
+  if (! flushed)
+    worker_failed (w);
+}
+
+/* Read from STREAM a decimal number followed by DELIM into *N.
+   Return false if there is none.  */
+
+static bool
+read_number (FILE *stream, int delim, uintmax_t *n)
+{
+  uintmax_t v = 0;
+  int c = getc (stream);
+
+  if (! c_isdigit (c))
+    return false;
+  do
+    {
+      if ((UINTMAX_MAX - 9) / 10 < v)
+	return false;
+      v = 10 * v + (c - '0');
+    }
+  while (c_isdigit (c = getc (stream)));
+
+  *n = v;
+  return c == delim;
+}
+
+/* Write the string S to STREAM.  */
+
+static void
+write_string (FILE *stream, char const *s)
+{
+  size_t len = strlen (s);
+  fprintf (stream, "%"PRIuMAX"\n", (uintmax_t) len);
+  fwrite (s, sizeof (char), len, stream);
+}
+
+/* Read a string from STREAM into a newly allocated buffer, and return
+   it, or a null pointer if there is none.  */
+
+static char *
+read_string (FILE *stream)
+{
+  uintmax_t len;
+  char *s;
+
+  if (! read_number (stream, '\n', &len) || SIZE_MAX <= len)
+    return NULL;
+  s = xmalloc (len + 1);
+  if (fread (s, sizeof (char), len, stream) != len
+      || memchr (s, '\0', len))
+    {
+      free (s);
+      return NULL;
+    }
+  s[len] = '\0';
+  return s;
+}
+
+/* Start the workers, and send them diff's options.  */
+
+static void
+start_workers (void)
+{
+#if HAVE_WORKING_FORK
+  size_t i;
+  int j;
+
+  for (i = 0; i < remote_count; i++)
+    {
+      struct worker *w = &workers[i];
+      char *command = concat (w->command, " --remote-worker", "");
+      int to[2], from[2];
+
+      /* The coordinator's ends of the pipes must not be inherited by
+	 the other workers, which would keep this one from seeing its
+	 input end.  */
+      if (pipe (to) != 0 || pipe (from) != 0
+	  || fcntl (to[1], F_SETFD, FD_CLOEXEC) != 0
+	  || fcntl (from[0], F_SETFD, FD_CLOEXEC) != 0)
+	pfatal_with_name ("pipe");
+
+      w->pid = fork ();
+      if (w->pid == 0)
+	{
+	  if (dup2 (to[0], STDIN_FILENO) < 0
+	      || dup2 (from[1], STDOUT_FILENO) < 0)
+	    _exit (EXIT_TROUBLE);
+	  close (to[0]);
+	  close (from[1]);
+	  execl ("/bin/sh", "sh", "-c", command, (char *) NULL);
+	  _exit (errno == ENOENT ? 127 : 126);
+	}
+      if (w->pid < 0)
+	pfatal_with_name ("fork");
+
+      close (to[0]);
+      close (from[1]);
+      free (command);
+      w->to = fdopen (to[1], "w");
+      w->from = fdopen (from[0], "r");
+      if (! (w->to && w->from))
+	pfatal_with_name ("fdopen");
+
+      fprintf (w->to, "%d\n", remote_noptions);
+      for (j = 0; j < remote_noptions; j++)
+	write_string (w->to, remote_options[j]);
+    }
+#else
+  fatal ("--remote is not supported on this system");
+#endif
+  workers_started = true;
+}
+
+/* Copy the output of the window that worker W has compared to the
+   output, and return the worker's status for it.  */
+
+static int
+finish_window (struct worker *w)
+{
+  uintmax_t status, size;
+  char buf[16 * 1024];
+
+  if (! (read_number (w->from, ' ', &status)
+	 && read_number (w->from, '\n', &size)
+	 && status <= 1))
+    worker_failed (w);
+  w->busy = false;
+
+  if (size)
+    begin_output ();
+  while (size)
+    {
+      size_t n = MIN (size, sizeof buf);
+      if (fread (buf, sizeof (char), n, w->from) != n)
+	worker_failed (w);
+      fwrite (buf, sizeof (char), n, outfile);
+      size -= n;
+    }
+  return status;
+}
+
+/* Compare the files of CMP, whose first windows read_files has found,
+   by having the workers compare each pair of windows.  Return 1 if
+   the files differ and 0 if they do not.  */
+
+int
+compare_remotely (struct comparison *cmp)
+{
+  int changes = 0;
+  size_t next = 0;
+  size_t i;
+
+  if (! workers_started)
+    start_workers ();
+
+  /* The header that begin_output prints describes FILES.  */
+  files[0] = cmp->file[0];
+  files[1] = cmp->file[1];
+
+  for (i = 0; i < remote_count; i++)
+    {
+      fputs ("F\n", workers[i].to);
+      write_string (workers[i].to, cmp->file[0].name);
+      write_string (workers[i].to, cmp->file[1].name);
+    }
+
+  /* The workers take the windows in turn, so the next worker is the
+     one that has had its window longest.  */
+  do
+    {
+      struct worker *w = &workers[next];
+      uintmax_t offset[2];
+      size_t size[2];
+      int f;
+
+      if (w->busy)
+	changes |= finish_window (w);
+
+      window_extents (cmp->file, offset, size);
+      fputc ('C', w->to);
+      for (f = 0; f < 2; f++)
+	fprintf (w->to, " %"PRIuMAX" %"PRIuMAX" %"PRIdMAX,
+		 offset[f], (uintmax_t) size[f],
+		 (intmax_t) cmp->file[f].window_lines);
+      fputc ('\n', w->to);
+      flush_worker (w);
+      w->busy = true;
+      next = (next + 1) % remote_count;
+    }
+  while (read_next_windows (cmp->file));
+
+  for (i = 0; i < remote_count; i++)
+    {
+      struct worker *w = &workers[(next + i) % remote_count];
+      if (w->busy)
+	changes |= finish_window (w);
+    }
+
+  return changes;
+}
+
+/* Tell the workers that there is nothing more to compare, and wait
+   for them to exit.  */
+
+void
+finish_remote_workers (void)
+{
+#if HAVE_WORKING_FORK
+  size_t i;
+
+  if (! workers_started)
+    return;
+
+  for (i = 0; i < remote_count; i++)
+    {
+      struct worker *w = &workers[i];
+      int wstatus;
+      flush_worker (w);
+      if (fclose (w->to) != 0)
+	worker_failed (w);
+      fclose (w->from);
+      if (waitpid (w->pid, &wstatus, 0) < 0)
+	pfatal_with_name ("waitpid");
+      if (! (WIFEXITED (wstatus) && WEXITSTATUS (wstatus) == EXIT_SUCCESS))
+	worker_failed (w);
+    }
+#endif
+}
+
+/* As a worker, replace the arguments *ARGC and *ARGV, which are just
+   the program name and --remote-worker, with the program name and the
+   options that the coordinator sends.  */
+
+void
+read_remote_arguments (int *argc, char ***argv)
+{
+  uintmax_t n;
+  char **v;
+  size_t i;
+
+  if (! read_number (stdin, '\n', &n) || INT_MAX <= n)
+    fatal ("invalid request from remote coordinator");
+  v = xnmalloc (n + 2, sizeof *v);
+  v[0] = (*argv)[0];
+  for (i = 1; i <= n; i++)
+    if (! (v[i] = read_string (stdin)))
+      fatal ("invalid request from remote coordinator");
+  v[i] = NULL;
+  *argc = n + 1;
+  *argv = v;
+}
+
+/* Read SIZE bytes at OFFSET in the file NAME open on DESC into BUF.  */
+
+static void
+read_window (int desc, char const *name, char *buf, size_t size,
+	     uintmax_t offset)
+{
+  while (size)
+    {
+      ssize_t n = pread (desc, buf, MIN (size, SSIZE_MAX), offset);
+      if (n < 0)
+	pfatal_with_name (name);
+      if (n == 0)
+	error (EXIT_TROUBLE, 0, _("%s: file shrank"), name);
+      buf += n;
+      size -= n;
+      offset += n;
+    }
+}
+
+/* Compare the windows of SIZE bytes at OFFSET of the files NAME open
+   on DESC, which have LINES lines before them, outputting the hunks
+   to OUTFILE without a header.  Return 1 if they differ and 0 if not.  */
+
+static int
+compare_window (char *const name[2], int const desc[2],
+		uintmax_t const offset[2], size_t const size[2],
+		lin const lines[2])
+{
+  struct comparison cmp;
+  char *buf[2];
+  int changes;
+  int f;
+
+  memset (&cmp, 0, sizeof cmp);
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *file = &cmp.file[f];
+
+      /* Leave room for a newline and sentinels, as fill_windows does.  */
+      buf[f] = xmalloc (size[f] + 2 * sizeof (word));
+      read_window (desc[f], name[f], buf[f], size[f], offset[f]);
+
+      file->name = name[f];
+      file->desc = -1;
+      file->stat.st_size = size[f];
+      file->buffer = (word *) buf[f];
+      file->bufsize = size[f] + 2 * sizeof (word);
+      file->buffered = size[f];
+      file->eof = true;
+      file->supplied = true;
+      file->window_lines = lines[f];
+    }
+
+  read_files (cmp.file, false);
+  changes = diff_lines (&cmp);
+
+  for (f = 0; f < 2; f++)
+    {
+      file_buffer_free (&cmp.file[f]);
+      free (buf[f]);
+    }
+  return changes;
+}
+
+/* As a worker, answer the coordinator's requests until they end.
+   Return the exit status.  */
+
+int
+serve_remote_requests (void)
+{
+  char *name[2] = { NULL, NULL };
+  int desc[2] = { -1, -1 };
+  FILE *out = tmpfile ();
+  char buf[16 * 1024];
+  int c;
+  int f;
+
+  if (! out)
+    pfatal_with_name ("tmpfile");
+
+  while ((c = getchar ()) != EOF)
+    {
+      if (c == 'F' && getchar () == '\n')
+	{
+	  for (f = 0; f < 2; f++)
+	    {
+	      if (0 <= desc[f] && close (desc[f]) != 0)
+		pfatal_with_name (name[f]);
+	      free (name[f]);
+	      if (! (name[f] = read_string (stdin)))
+		fatal ("invalid request from remote coordinator");
+	      desc[f] = open (name[f], O_RDONLY | O_BINARY);
+	      if (desc[f] < 0)
+		pfatal_with_name (name[f]);
+	    }
+	}
+      else if (c == 'C' && getchar () == ' ' && 0 <= desc[0])
+	{
+	  uintmax_t offset[2], size[2], lines[2];
+	  size_t n[2];
+	  lin l[2];
+	  off_t outsize;
+	  int changes;
+
+	  for (f = 0; f < 2; f++)
+	    if (! (read_number (stdin, ' ', &offset[f])
+		   && read_number (stdin, ' ', &size[f])
+		   && read_number (stdin, f ? '\n' : ' ', &lines[f])
+		   && size[f] < PTRDIFF_MAX / 2 && lines[f] < LIN_MAX))
+	      fatal ("invalid request from remote coordinator");
+	    else
+	      {
+		n[f] = size[f];
+		l[f] = lines[f];
+	      }
+
+	  outfile = out;
+	  changes = compare_window (name, desc, offset, n, l);
+	  outfile = NULL;
+
+	  if (fflush (out) != 0 || (outsize = ftello (out)) < 0)
+	    pfatal_with_name ("tmpfile");
+	  printf ("%d %"PRIuMAX"\n", changes, (uintmax_t) outsize);
+	  rewind (out);
+	  while (outsize)
+	    {
+	      size_t len = MIN (outsize, sizeof buf);
+	      if (fread (buf, sizeof (char), len, out) != len)
+		pfatal_with_name ("tmpfile");
+	      fwrite (buf, sizeof (char), len, stdout);
+	      outsize -= len;
+	    }
+	  if (fflush (stdout) != 0)
+	    pfatal_with_name (_("write failed"));
+	  rewind (out);
+	  if (ftruncate (fileno (out), 0) != 0)
+	    pfatal_with_name ("tmpfile");
+	}
+      else
+	fatal ("invalid request from remote coordinator");
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -19,21 +19,25 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "system.h"
+#include "engine.h"
 #include "paths.h"
 
 #include <stdio.h>
 #include <unlocked-io.h>
 
 #include <c-stack.h>
+#include <cmpbuf.h>
 #include <dirname.h>
 #include <error.h>
 #include <exitfail.h>
 #include <file-type.h>
 #include <getopt.h>
+#include <inttostr.h>
 #include <progname.h>
 #include <system-quote.h>
 #include <version-etc.h>
 #include <xalloc.h>
+#include <xstrtol.h>
 
 /* The official name of this program (e.g., no 'g' prefix).  */
 #define PROGRAM_NAME "sdiff"
@@ -41,7 +45,8 @@
 #define AUTHORS \
   proper_name ("Thomas Lord")
 
-/* Size of chunks read from files which must be parsed into lines.  */
+/* Initial size of chunks read from files which must be parsed into
+   lines.  */
 #define SDIFF_BUFSIZE ((size_t) 65536)
 
 static char const *editor_program = DEFAULT_EDITOR_PROGRAM;
@@ -55,12 +60,16 @@ static pid_t volatile diffpid;
 #endif
 
 struct line_filter;
+struct hunk_side;
 
 static void catchsig (int);
-static bool edit (struct line_filter *, char const *, lin, lin, struct line_filter *, char const *, lin, lin, FILE *);
+static bool edit (struct hunk_side const *, struct hunk_side const *, FILE *);
 static bool interact (struct line_filter *, struct line_filter *, char const *, struct line_filter *, char const *, FILE *);
 static void checksigs (void);
 static void diffarg (char const *);
+static void finish_batch_edit (FILE *, FILE *, bool);
+static void merge_in_process (char const *, char const *)
+  __attribute__((noreturn));
 static void fatal (char const *) __attribute__((noreturn));
 static void perror_fatal (char const *) __attribute__((noreturn));
 static void trapsigs (void);
@@ -115,17 +124,63 @@ static char const *output;
 /* Do not print common lines.  */
 static bool suppress_common_lines;
 
+/* How to resolve every hunk without asking (--policy): 'l' to use the
+   left version, 'r' the right version, 'b' both, or 0 to ask.  */
+static char policy;
+
+/* Defer the editing that edit commands ask for until the merge ends,
+   and then edit all the hunks at once in one file (--batch-edit).  */
+static bool batch_edit;
+
+/* A hunk in the file of hunks to edit: where in the merged output its
+   edited version goes, and whether its last line lacked a newline.  */
+struct batch_hunk
+{
+  off_t offset;
+  bool missing_newline;
+};
+static struct batch_hunk *batch_hunk;
+static size_t batch_hunks, batch_hunks_alloc;
+
+/* Run the diff program to compare files, rather than comparing them
+   in-process with diff's engine.  */
+static bool use_diff_program;
+
+/* How to compare the files and show them side by side when comparing
+   them in-process.  */
+static struct engine_options compare_options;
+static struct engine_sdiff_options sdiff_options;
+
+/* When merging interactively, compare files a window at a time if
+   they need more than this much memory, so that the user sees the
+   first hunk without waiting for the rest of the files to be read and
+   compared.  */
+enum { INTERACTIVE_MAX_MEMORY = 64 * 1024 * 1024 };
+
+/* The regexps of -I options, a null-terminated array.  */
+static char const **ignore_regexps;
+static size_t ignore_regexps_count;
+
+/* The minimum width of the gutter between the columns, as in diff.  */
+#ifndef GUTTER_WIDTH_MINIMUM
+# define GUTTER_WIDTH_MINIMUM 3
+#endif
+
 /* Value for the long option that does not have single-letter equivalents.  */
 enum
 {
-  DIFF_PROGRAM_OPTION = CHAR_MAX + 1,
+  BATCH_EDIT_OPTION = CHAR_MAX + 1,
+  DIFF_PROGRAM_OPTION,
   HELP_OPTION,
+  MAX_MEMORY_OPTION,
+  POLICY_OPTION,
   STRIP_TRAILING_CR_OPTION,
   TABSIZE_OPTION
 };
 
 static struct option const longopts[] =
 {
+  {"batch-edit", 0, 0, BATCH_EDIT_OPTION},
   {"diff-program", 1, 0, DIFF_PROGRAM_OPTION},
   {"expand-tabs", 0, 0, 't'},
   {"help", 0, 0, HELP_OPTION},
@@ -137,8 +192,10 @@ static struct option const longopts[] =
   {"ignore-tab-expansion", 0, 0, 'E'},
   {"ignore-trailing-space", 0, 0, 'Z'},
   {"left-column", 0, 0, 'l'},
+  {"max-memory", 1, 0, MAX_MEMORY_OPTION},
   {"minimal", 0, 0, 'd'},
   {"output", 1, 0, 'o'},
+  {"policy", 1, 0, POLICY_OPTION},
   {"speed-large-files", 0, 0, 'H'},
   {"strip-trailing-cr", 0, 0, STRIP_TRAILING_CR_OPTION},
   {"suppress-common-lines", 0, 0, 's'},
@@ -171,6 +228,10 @@ check_stdout (void)
 
 static char const * const option_help_msgid[] = {
   N_("-o, --output=FILE            operate interactively, sending output to FILE"),
+  N_("    --policy=WHICH           with -o, take WHICH version of every change\n"
+     "                               without asking: 'left', 'right' or 'both'"),
+  N_("    --batch-edit             with -o, edit all the hunks that edit commands\n"
+     "                               choose at once, when the merge ends"),
   "",
   N_("-i, --ignore-case            consider upper- and lower-case to be the same"),
   N_("-E, --ignore-tab-expansion   ignore changes due to tab expansion"),
@@ -191,6 +252,8 @@ static char const * const option_help_msgid[] = {
   "",
   N_("-d, --minimal                try hard to find a smaller set of changes"),
   N_("-H, --speed-large-files      assume large files, many scattered small changes"),
+  N_("    --max-memory=SIZE        compare large files in pieces, using about SIZE bytes;\n"
+     "                               with -o and no --policy, the default is 64 MiB"),
   N_("    --diff-program=PROGRAM   use PROGRAM to compare files"),
   "",
   N_("    --help                   display this help and exit"),
@@ -349,25 +412,45 @@ struct line_filter {
   char *bufpos;
   char *buffer;
   char *buflim;
+  size_t bufsize;	/* size of BUFFER, not counting the sentinel */
+  bool grow;		/* Grow BUFFER as INFILE fills it?  */
 };
 
 static void
 lf_init (struct line_filter *lf, FILE *infile)
 {
+  struct stat st;
+
   lf->infile = infile;
+  lf->bufsize = SDIFF_BUFSIZE;
+  lf->grow = fstat (fileno (infile), &st) == 0 && S_ISREG (st.st_mode);
   lf->bufpos = lf->buffer = lf->buflim = xmalloc (SDIFF_BUFSIZE + 1);
   lf->buflim[0] = '\n';
 }
 
-/* Fill an exhausted line_filter buffer from its INFILE */
+/* Fill an exhausted line_filter buffer from its INFILE.  Reading a
+   regular file a full buffer at a time grows the buffer, so that long
+   files are read in fewer, larger chunks.  */
 static size_t
 lf_refill (struct line_filter *lf)
 {
-  size_t s = ck_fread (lf->buffer, SDIFF_BUFSIZE, lf->infile);
+  size_t s;
+
+  if (lf->grow && lf->buflim - lf->buffer == lf->bufsize)
+    {
+      size_t size = buffer_grow (lf->bufsize, SIZE_MAX - 1);
+      if (size != lf->bufsize)
+	{
+	  free (lf->buffer);
+	  lf->buffer = xmalloc (size + 1);
+	  lf->bufsize = size;
+	}
+    }
+
+  s = ck_fread (lf->buffer, lf->bufsize, lf->infile);
   lf->bufpos = lf->buffer;
   lf->buflim = lf->buffer + s;
   lf->buflim[0] = '\n';
-  checksigs ();
   return s;
 }
 
@@ -447,6 +530,8 @@ main (int argc, char *argv[])
 {
   int opt;
   char const *prog;
+  uintmax_t numval;
+  char *numend;
 
   exit_failure = EXIT_TROUBLE;
   initialize_main (&argc, &argv);
@@ -461,6 +546,7 @@ main (int argc, char *argv[])
     editor_program = prog;
 
   diffarg (DEFAULT_DIFF_PROGRAM);
+  ignore_regexps = xnmalloc (argc, sizeof *ignore_regexps);
 
   /* parse command line args */
   while ((opt = getopt_long (argc, argv, "abBdEHiI:lo:stvw:WZ", longopts, 0))
@@ -470,39 +556,48 @@ main (int argc, char *argv[])
 	{
 	case 'a':
 	  diffarg ("-a");
+	  compare_options.text = true;
 	  break;
 
 	case 'b':
 	  diffarg ("-b");
+	  compare_options.ignore_space_change = true;
 	  break;
 
 	case 'B':
 	  diffarg ("-B");
+	  compare_options.ignore_blank_lines = true;
 	  break;
 
 	case 'd':
 	  diffarg ("-d");
+	  compare_options.minimal = true;
 	  break;
 
 	case 'E':
 	  diffarg ("-E");
+	  compare_options.ignore_tab_expansion = true;
 	  break;
 
 	case 'H':
 	  diffarg ("-H");
+	  compare_options.speed_large_files = true;
 	  break;
 
 	case 'i':
 	  diffarg ("-i");
+	  compare_options.ignore_case = true;
 	  break;
 
 	case 'I':
 	  diffarg ("-I");
 	  diffarg (optarg);
+	  ignore_regexps[ignore_regexps_count++] = optarg;
 	  break;
 
 	case 'l':
 	  diffarg ("--left-column");
+	  sdiff_options.left_column = true;
 	  break;
 
 	case 'o':
@@ -515,6 +610,7 @@ main (int argc, char *argv[])
 
 	case 't':
 	  diffarg ("-t");
+	  sdiff_options.expand_tabs = true;
 	  break;
 
 	case 'v':
@@ -526,18 +622,40 @@ main (int argc, char *argv[])
 	case 'w':
 	  diffarg ("-W");
 	  diffarg (optarg);
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (! (0 < numval && numval <= SIZE_MAX) || *numend)
+	    try_help ("invalid width '%s'", optarg);
+	  sdiff_options.width = numval;
 	  break;
 
 	case 'W':
 	  diffarg ("-w");
+	  compare_options.ignore_all_space = true;
 	  break;
 
 	case 'Z':
 	  diffarg ("-Z");
+	  compare_options.ignore_trailing_space = true;
+	  break;
+
+	case BATCH_EDIT_OPTION:
+	  batch_edit = true;
 	  break;
 
 	case DIFF_PROGRAM_OPTION:
 	  diffargv[0] = optarg;
+	  use_diff_program = true;
+	  break;
+
+	case POLICY_OPTION:
+	  if (STREQ (optarg, "left"))
+	    policy = 'l';
+	  else if (STREQ (optarg, "right"))
+	    policy = 'r';
+	  else if (STREQ (optarg, "both"))
+	    policy = 'b';
+	  else
+	    try_help ("invalid --policy value '%s'", optarg);
 	  break;
 
 	case HELP_OPTION:
@@ -545,13 +663,30 @@ main (int argc, char *argv[])
 	  check_stdout ();
 	  return EXIT_SUCCESS;
 
+	case MAX_MEMORY_OPTION:
+	  diffarg ("--max-memory");
+	  diffarg (optarg);
+	  if (xstrtoumax (optarg, 0, 0, &numval, "kKMGTPEZY0") != LONGINT_OK
+	      || ! numval)
+	    try_help ("invalid --max-memory value '%s'", optarg);
+	  compare_options.max_memory = MIN (numval, SIZE_MAX);
+	  break;
+
 	case STRIP_TRAILING_CR_OPTION:
+	  /* The engine strips carriage returns from the lines it keeps
+	     in memory, but the merged output keeps them.  */
 	  diffarg ("--strip-trailing-cr");
+	  use_diff_program = true;
 	  break;
 
 	case TABSIZE_OPTION:
 	  diffarg ("--tabsize");
 	  diffarg (optarg);
+	  numval = strtoumax (optarg, &numend, 10);
+	  if (! (0 < numval && numval <= SIZE_MAX - GUTTER_WIDTH_MINIMUM)
+	      || *numend)
+	    try_help ("invalid tabsize '%s'", optarg);
+	  sdiff_options.tabsize = numval;
 	  break;
 
 	default:
@@ -559,6 +694,11 @@ main (int argc, char *argv[])
 	}
     }
 
+  if (policy && ! output)
+    try_help ("--policy requires --output", 0);
+  if (batch_edit && ! output)
+    try_help ("--batch-edit requires --output", 0);
+
   if (argc - optind != 2)
     {
       if (argc - optind < 2)
@@ -595,8 +735,12 @@ main (int argc, char *argv[])
 	fatal ("both files to be compared are directories");
 
       lname = expand_name (argv[optind], leftdir, argv[optind + 1]);
-      left = ck_fopen (lname, "r");
       rname = expand_name (argv[optind + 1], rightdir, argv[optind]);
+
+      if (! use_diff_program)
+	merge_in_process (lname, rname);
+
+      left = ck_fopen (lname, "r");
       right = ck_fopen (rname, "r");
       out = ck_fopen (output, "w");
 
@@ -658,7 +802,17 @@ main (int argc, char *argv[])
       lf_init (&lfilt, left);
       lf_init (&rfilt, right);
 
-      interact_ok = interact (&diff_filt, &lfilt, lname, &rfilt, rname, out);
+      if (batch_edit)
+	{
+	  FILE *body = tmpfile ();
+	  if (! body)
+	    perror_fatal ("tmpfile");
+	  interact_ok = interact (&diff_filt, &lfilt, lname, &rfilt, rname,
+				  body);
+	  finish_batch_edit (body, out, interact_ok);
+	}
+      else
+	interact_ok = interact (&diff_filt, &lfilt, lname, &rfilt, rname, out);
 
       ck_fclose (left);
       ck_fclose (right);
@@ -751,7 +905,12 @@ trapsigs (void)
   int i;
 
 #if HAVE_SIGACTION
-  catchaction.sa_flags = SA_RESTART;
+  /* Let a signal interrupt a read that is waiting for the diff
+     program or the user, instead of restarting it, so that sdiff
+     does not wait for more input before noticing the signal.  Every
+     failed read or write calls perror_fatal, which checks for
+     signals first.  */
+  catchaction.sa_flags = 0;
   sigemptyset (&catchaction.sa_mask);
   for (i = 0;  i < NUM_SIGS;  i++)
     sigaddset (&catchaction.sa_mask, sigs[i]);
@@ -856,10 +1015,299 @@ flush_line (void)
 }
 
 
+/* The lines that one file contributes to a hunk: LEN lines starting
+   with line number LINE of the file named NAME.  If LF is nonnull, LF
+   reads them from the file; otherwise they are the SIZE bytes at
+   TEXT.  */
+struct hunk_side
+{
+  char const *name;
+  lin line;
+  lin len;
+  struct line_filter *lf;
+  char const *text;
+  size_t size;
+};
+
+/* Copy SIDE's lines to OUTFILE.  */
+static void
+side_copy (struct hunk_side const *side, FILE *outfile)
+{
+  if (side->lf)
+    lf_copy (side->lf, side->len, outfile);
+  else
+    ck_fwrite (side->text, side->size, outfile);
+}
+
+/* Skip SIDE's lines.  */
+static void
+side_skip (struct hunk_side const *side)
+{
+  if (side->lf)
+    lf_skip (side->lf, side->len);
+}
+
+/* Resolve the hunk whose sides are LEFT and RIGHT as --policy says,
+   copying the chosen lines to OUTFILE.  */
+static void
+apply_policy (struct hunk_side const *left, struct hunk_side const *right,
+	      FILE *outfile)
+{
+  if (policy == 'r')
+    side_skip (left);
+  else
+    side_copy (left, outfile);
+
+  if (policy == 'l')
+    side_skip (right);
+  else
+    side_copy (right, outfile);
+}
+
+/* Open the temporary file that the editor edits, in MODE, and make
+   it TMP.  */
+static void
+open_edit_file (char const *mode)
+{
+  if (tmpname)
+    tmp = fopen (tmpname, mode);
+  else
+    {
+      int fd = temporary_file ();
+      if (fd < 0)
+	perror_fatal ("mkstemp");
+      tmp = fdopen (fd, mode);
+    }
+
+  if (! tmp)
+    perror_fatal (tmpname);
+}
+
+/* Run the editor on the temporary file.  */
+static void
+run_editor (void)
+{
+  int wstatus;
+  int werrno = 0;
+  char const *argv[3];
+
+  ignore_SIGINT = true;
+  checksigs ();
+  argv[0] = editor_program;
+  argv[1] = tmpname;
+  argv[2] = 0;
+
+  {
+#if ! HAVE_WORKING_FORK
+    char *command = system_quote_argv (SCI_SYSTEM, (char **) argv);
+    wstatus = system (command);
+    if (wstatus == -1)
+      werrno = errno;
+    free (command);
+#else
+    pid_t pid;
+
+    pid = fork ();
+    if (pid == 0)
+      {
+	execvp (editor_program, (char **) argv);
+	_exit (errno == ENOENT ? 127 : 126);
+      }
+
+    if (pid < 0)
+      perror_fatal ("fork");
+
+    while (waitpid (pid, &wstatus, 0) < 0)
+      if (errno == EINTR)
+	checksigs ();
+      else
+	perror_fatal ("waitpid");
+#endif
+  }
+
+  ignore_SIGINT = false;
+  check_child_status (werrno, wstatus, EXIT_SUCCESS, editor_program);
+}
+
+/* Copy the edited temporary file to OUTFILE.  */
+static void
+copy_edited (FILE *outfile)
+{
+  char buf[SDIFF_BUFSIZE];
+  size_t size;
+  tmp = ck_fopen (tmpname, "r");
+  while ((size = ck_fread (buf, SDIFF_BUFSIZE, tmp)) != 0)
+    {
+      checksigs ();
+      ck_fwrite (buf, size, outfile);
+    }
+  ck_fclose (tmp);
+}
+
+/* The line that precedes hunk N in the file of hunks to edit with
+   --batch-edit.  */
+#define BATCH_MARKER "@@@ sdiff hunk %lu @@@\n"
+
+/* Start adding a hunk to the file of hunks to edit, noting that its
+   edited version belongs at the current end of the merged output
+   OUTFILE.  Return where its lines start in the file.  */
+static off_t
+begin_batch_hunk (FILE *outfile)
+{
+  off_t start;
+
+  if (! tmp)
+    open_edit_file ("w+");
+
+  if (batch_hunks == batch_hunks_alloc)
+    batch_hunk = x2nrealloc (batch_hunk, &batch_hunks_alloc,
+			     sizeof *batch_hunk);
+  batch_hunk[batch_hunks].offset = ftello (outfile);
+  if (batch_hunk[batch_hunks].offset < 0)
+    perror_fatal (_("temporary file"));
+  batch_hunks++;
+
+  fprintf (tmp, BATCH_MARKER, (unsigned long int) batch_hunks);
+  start = ftello (tmp);
+  if (start < 0)
+    perror_fatal (tmpname);
+  return start;
+}
+
+/* Finish adding the hunk whose lines start at START to the file of
+   hunks to edit.  If its last line lacks a newline, add one so that
+   the next marker starts a line, and remember to remove it again.  */
+static void
+end_batch_hunk (off_t start)
+{
+  off_t end = ftello (tmp);
+  bool missing_newline = false;
+
+  if (end < 0)
+    perror_fatal (tmpname);
+  if (start < end)
+    {
+      if (fseeko (tmp, end - 1, SEEK_SET) != 0)
+	perror_fatal (tmpname);
+      missing_newline = getc (tmp) != '\n';
+      if (fseeko (tmp, end, SEEK_SET) != 0)
+	perror_fatal (tmpname);
+      if (missing_newline)
+	putc ('\n', tmp);
+    }
+  batch_hunk[batch_hunks - 1].missing_newline = missing_newline;
+}
+
+/* Copy the bytes of BODY from *POS up to LIMIT to OUTFILE, and set
+   *POS to LIMIT.  */
+static void
+copy_body (FILE *body, off_t *pos, off_t limit, FILE *outfile)
+{
+  char buf[SDIFF_BUFSIZE];
+
+  while (*pos < limit)
+    {
+      size_t size = ck_fread (buf, MIN (limit - *pos, SDIFF_BUFSIZE), body);
+      if (! size)
+	fatal ("temporary file shrank");
+      ck_fwrite (buf, size, outfile);
+      *pos += size;
+    }
+}
+
+/* Output the merged output BODY to OUTFILE, putting each hunk in the
+   file of hunks to edit where it belongs.  If EDIT, first run the
+   editor on the file, so that it edits all the hunks at once.  */
+static void
+finish_batch_edit (FILE *body, FILE *outfile, bool edit)
+{
+  char *text = NULL;
+  char *p = NULL, *lim = NULL;
+  off_t pos = 0;
+  size_t n;
+
+  if (batch_hunks)
+    {
+      size_t size = 0, alloc = SDIFF_BUFSIZE, r;
+
+      ck_fclose (tmp);
+      tmp = NULL;
+      if (edit)
+	run_editor ();
+
+      tmp = ck_fopen (tmpname, "r");
+      text = xmalloc (alloc);
+      while ((r = ck_fread (text + size, alloc - size, tmp)) != 0)
+	{
+	  size += r;
+	  if (size == alloc)
+	    text = x2realloc (text, &alloc);
+	}
+      ck_fclose (tmp);
+      tmp = NULL;
+      p = text;
+      lim = text + size;
+    }
+
+  if (fseeko (body, 0, SEEK_SET) != 0)
+    perror_fatal (_("temporary file"));
+
+  for (n = 0; n <= batch_hunks; n++)
+    {
+      /* Find the marker that ends hunk N, or that starts hunk 1 if N
+	 is 0.  Anything before the first marker is ignored.  */
+      char *end = lim;
+      char marker[sizeof BATCH_MARKER + INT_BUFSIZE_BOUND (unsigned long int)];
+      size_t markerlen = 0;
+
+      if (n < batch_hunks)
+	{
+	  char *q;
+	  markerlen = sprintf (marker, BATCH_MARKER,
+			       (unsigned long int) (n + 1));
+	  for (q = p; ; q = (char *) memchr (q, '\n', lim - q) + 1)
+	    {
+	      if (markerlen <= lim - q && memcmp (q, marker, markerlen) == 0)
+		break;
+	      if (! memchr (q, '\n', lim - q))
+		{
+		  char const *name = tmpname;
+		  tmpname = 0;
+		  error (0, 0, _("%s: cannot find line '%.*s'; edits kept"),
+			 name, (int) markerlen - 1, marker);
+		  exiterr ();
+		}
+	    }
+	  end = q;
+	}
+
+      if (n)
+	{
+	  if (batch_hunk[n - 1].missing_newline && p < end
+	      && end[-1] == '\n')
+	    end--;
+	  copy_body (body, &pos, batch_hunk[n - 1].offset, outfile);
+	  ck_fwrite (p, end - p, outfile);
+	}
+
+      if (n < batch_hunks)
+	p = end + markerlen;
+    }
+
+  {
+    char buf[SDIFF_BUFSIZE];
+    size_t size;
+    while ((size = ck_fread (buf, SDIFF_BUFSIZE, body)) != 0)
+      ck_fwrite (buf, size, outfile);
+  }
+
+  free (text);
+  ck_fclose (body);
+}
+
 /* interpret an edit command */
 static bool
-edit (struct line_filter *left, char const *lname, lin lline, lin llen,
-      struct line_filter *right, char const *rname, lin rline, lin rlen,
+edit (struct hunk_side const *left, struct hunk_side const *right,
       FILE *outfile)
 {
   for (;;)
@@ -931,12 +1379,12 @@ edit (struct line_filter *left, char const *lname, lin lline, lin llen,
       switch (cmd0)
 	{
 	case '1': case 'l':
-	  lf_copy (left, llen, outfile);
-	  lf_skip (right, rlen);
+	  side_copy (left, outfile);
+	  side_skip (right);
 	  return true;
 	case '2': case 'r':
-	  lf_copy (right, rlen, outfile);
-	  lf_skip (left, llen);
+	  side_copy (right, outfile);
+	  side_skip (left);
 	  return true;
 	case 's':
 	  suppress_common_lines = true;
@@ -948,121 +1396,67 @@ edit (struct line_filter *left, char const *lname, lin lline, lin llen,
 	  return false;
 	case 'e':
 	  {
-	    int fd;
+	    off_t start = 0;
 
-	    if (tmpname)
-	      tmp = fopen (tmpname, "w");
+	    if (batch_edit)
+	      start = begin_batch_hunk (outfile);
 	    else
-	      {
-		if ((fd = temporary_file ()) < 0)
-		  perror_fatal ("mkstemp");
-		tmp = fdopen (fd, "w");
-	      }
-
-	    if (! tmp)
-	      perror_fatal (tmpname);
+	      open_edit_file ("w");
 
 	    switch (cmd1)
 	      {
 	      case 'd':
-		if (llen)
+		if (left->len)
 		  {
-		    if (llen == 1)
-		      fprintf (tmp, "--- %s %ld\n", lname, (long int) lline);
+		    if (left->len == 1)
+		      fprintf (tmp, "--- %s %ld\n", left->name,
+			       (long int) left->line);
 		    else
-		      fprintf (tmp, "--- %s %ld,%ld\n", lname,
-			       (long int) lline,
-			       (long int) (lline + llen - 1));
+		      fprintf (tmp, "--- %s %ld,%ld\n", left->name,
+			       (long int) left->line,
+			       (long int) (left->line + left->len - 1));
 		  }
 		/* Fall through.  */
 	      case '1': case 'b': case 'l':
-		lf_copy (left, llen, tmp);
+		side_copy (left, tmp);
 		break;
 
 	      default:
-		lf_skip (left, llen);
+		side_skip (left);
 		break;
 	      }
 
 	    switch (cmd1)
 	      {
 	      case 'd':
-		if (rlen)
+		if (right->len)
 		  {
-		    if (rlen == 1)
-		      fprintf (tmp, "+++ %s %ld\n", rname, (long int) rline);
+		    if (right->len == 1)
+		      fprintf (tmp, "+++ %s %ld\n", right->name,
+			       (long int) right->line);
 		    else
-		      fprintf (tmp, "+++ %s %ld,%ld\n", rname,
-			       (long int) rline,
-			       (long int) (rline + rlen - 1));
+		      fprintf (tmp, "+++ %s %ld,%ld\n", right->name,
+			       (long int) right->line,
+			       (long int) (right->line + right->len - 1));
 		  }
 		/* Fall through.  */
 	      case '2': case 'b': case 'r':
-		lf_copy (right, rlen, tmp);
+		side_copy (right, tmp);
 		break;
 
 	      default:
-		lf_skip (right, rlen);
+		side_skip (right);
 		break;
 	      }
 
-	    ck_fclose (tmp);
-
-	    {
-	      int wstatus;
-	      int werrno = 0;
-	      char const *argv[3];
-
-	      ignore_SIGINT = true;
-	      checksigs ();
-	      argv[0] = editor_program;
-	      argv[1] = tmpname;
-	      argv[2] = 0;
-
+	    if (batch_edit)
+	      end_batch_hunk (start);
+	    else
 	      {
-#if ! HAVE_WORKING_FORK
-		char *command = system_quote_argv (SCI_SYSTEM, (char **) argv);
-		wstatus = system (command);
-		if (wstatus == -1)
-		  werrno = errno;
-		free (command);
-#else
-		pid_t pid;
-
-		pid = fork ();
-		if (pid == 0)
-		  {
-		    execvp (editor_program, (char **) argv);
-		    _exit (errno == ENOENT ? 127 : 126);
-		  }
-
-		if (pid < 0)
-		  perror_fatal ("fork");
-
-		while (waitpid (pid, &wstatus, 0) < 0)
-		  if (errno == EINTR)
-		    checksigs ();
-		  else
-		    perror_fatal ("waitpid");
-#endif
+		ck_fclose (tmp);
+		run_editor ();
+		copy_edited (outfile);
 	      }
-
-	      ignore_SIGINT = false;
-	      check_child_status (werrno, wstatus, EXIT_SUCCESS,
-				  editor_program);
-	    }
-
-	    {
-	      char buf[SDIFF_BUFSIZE];
-	      size_t size;
-	      tmp = ck_fopen (tmpname, "r");
-	      while ((size = ck_fread (buf, SDIFF_BUFSIZE, tmp)) != 0)
-		{
-		  checksigs ();
-		  ck_fwrite (buf, size, outfile);
-		}
-	      ck_fclose (tmp);
-	    }
 	    return true;
 	  }
 	default:
@@ -1113,7 +1507,7 @@ interact (struct line_filter *diff,
 	  switch (diff_help[0])
 	    {
 	    case 'i':
-	      if (suppress_common_lines)
+	      if (suppress_common_lines | policy)
 		lf_skip (diff, lenmax);
 	      else
 		lf_copy (diff, lenmax, stdout);
@@ -1123,11 +1517,28 @@ interact (struct line_filter *diff,
 	      break;
 
 	    case 'c':
-	      lf_copy (diff, lenmax, stdout);
-	      if (! edit (left, lname, lline, llen,
-			  right, rname, rline, rlen,
-			  outfile))
-		return false;
+	      {
+		struct hunk_side lside, rside;
+		lside.name = lname;
+		lside.line = lline;
+		lside.len = llen;
+		lside.lf = left;
+		rside.name = rname;
+		rside.line = rline;
+		rside.len = rlen;
+		rside.lf = right;
+		if (policy)
+		  {
+		    lf_skip (diff, lenmax);
+		    apply_policy (&lside, &rside, outfile);
+		  }
+		else
+		  {
+		    lf_copy (diff, lenmax, stdout);
+		    if (! edit (&lside, &rside, outfile))
+		      return false;
+		  }
+	      }
 	      break;
 
 	    default:
@@ -1140,6 +1551,168 @@ interact (struct line_filter *diff,
     }
 }
 
+/* The state of a merge that compares files in-process.  */
+struct merge
+{
+  char const *lname, *rname;
+  lin lline, rline;
+  FILE *outfile;
+  FILE *body;		/* with --batch-edit, where the merge goes first */
+  bool ok;
+
+  /* Output that has been put off, so that output copied from adjacent
+     text in a file can be written all at once.  */
+  char const *pending;
+  size_t pending_size;
+};
+
+/* Return the output file of merge M, creating it if need be.  */
+static FILE *
+merge_outfile (struct merge *m)
+{
+  if (! m->outfile)
+    m->outfile = ck_fopen (output, "w");
+  return m->outfile;
+}
+
+/* Return the stream that merge M writes merged lines to.  */
+static FILE *
+merge_stream (struct merge *m)
+{
+  return m->body ? m->body : merge_outfile (m);
+}
+
+/* Write the output that merge M has put off.  */
+static void
+merge_flush (struct merge *m)
+{
+  if (m->pending_size)
+    ck_fwrite (m->pending, m->pending_size, merge_stream (m));
+  m->pending_size = 0;
+}
+
+/* Output the SIZE bytes at TEXT as part of merge M.  If they follow
+   the output that has been put off in memory, put them off as well.  */
+static void
+merge_put (struct merge *m, char const *text, size_t size)
+{
+  if (m->pending_size && m->pending + m->pending_size != text)
+    merge_flush (m);
+  if (! m->pending_size)
+    m->pending = text;
+  m->pending_size += size;
+}
+
+/* Reveal RUN, the next run of lines that the engine has found, and
+   handle the user's commands for it, as part of the merge ARG.  If
+   RUN is null, the text of earlier runs is about to go away.  */
+static void
+merge_run (struct engine_run const *run, void *arg)
+{
+  struct merge *m = arg;
+
+  if (! run)
+    {
+      merge_flush (m);
+      return;
+    }
+
+  if (! m->ok)
+    return;
+
+  checksigs ();
+
+  if (! run->changed)
+    {
+      if (! (suppress_common_lines | policy))
+	engine_show_run (run);
+      merge_put (m, run->text[0], run->size[0]);
+    }
+  else if (policy)
+    {
+      if (policy != 'r')
+	merge_put (m, run->text[0], run->size[0]);
+      if (policy != 'l')
+	merge_put (m, run->text[1], run->size[1]);
+    }
+  else
+    {
+      struct hunk_side lside, rside;
+      lside.name = m->lname;
+      lside.line = m->lline;
+      lside.len = run->lines[0];
+      lside.lf = NULL;
+      lside.text = run->text[0];
+      lside.size = run->size[0];
+      rside.name = m->rname;
+      rside.line = m->rline;
+      rside.len = run->lines[1];
+      rside.lf = NULL;
+      rside.text = run->text[1];
+      rside.size = run->size[1];
+      merge_flush (m);
+      engine_show_run (run);
+      m->ok = edit (&lside, &rside, merge_stream (m));
+    }
+
+  m->lline += run->lines[0];
+  m->rline += run->lines[1];
+}
+
+/* Merge the files LNAME and RNAME interactively into the output
+   file, comparing them with diff's engine instead of running diff,
+   so that their lines are read only once and stay in memory.  Exit
+   with diff's status.  */
+static void
+merge_in_process (char const *lname, char const *rname)
+{
+  struct merge m;
+  int changes;
+
+  ignore_regexps[ignore_regexps_count] = NULL;
+  if (ignore_regexps_count)
+    compare_options.ignore_regexps = ignore_regexps;
+  if (! (compare_options.max_memory || policy))
+    compare_options.max_memory = INTERACTIVE_MAX_MEMORY;
+  engine_init (&compare_options);
+
+  m.lname = lname;
+  m.rname = rname;
+  m.lline = m.rline = 1;
+  m.outfile = NULL;
+  m.body = NULL;
+  m.ok = true;
+  m.pending_size = 0;
+  if (batch_edit)
+    {
+      m.body = tmpfile ();
+      if (! m.body)
+	perror_fatal ("tmpfile");
+    }
+
+  trapsigs ();
+  changes = engine_side_by_side (lname, rname, &sdiff_options,
+				 merge_run, &m);
+  if (changes < 0)
+    printf (_("Binary files %s and %s differ\n"), lname, rname);
+  if (m.body)
+    finish_batch_edit (m.body, merge_outfile (&m), m.ok);
+  ck_fclose (merge_outfile (&m));
+
+  if (tmpname)
+    {
+      unlink (tmpname);
+      tmpname = 0;
+    }
+
+  if (! m.ok)
+    exiterr ();
+
+  untrapsig (0);
+  checksigs ();
+  exit (changes != 0);
+}
+
 /* Return true if DIR is an existing directory.  */
 static bool
 diraccess (char const *dir)
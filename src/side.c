@@ -22,7 +22,9 @@
 
 #include "diff.h"
 
+#include <langinfo.h>
 #include <wchar.h>
+#include <xalloc.h>
 
 static void print_sdiff_common_lines (lin, lin);
 static void print_sdiff_hunk (struct change *);
@@ -30,11 +32,42 @@ static void print_sdiff_hunk (struct change *);
 /* Next line number to be printed in the two input files.  */
 static lin next0, next1;
 
+/* The printable ASCII characters, which print_half_line can output
+   without consulting the locale.  */
+static char const printable_ascii[] =
+  " !\"#%&'()*+,-./0123456789:;<=>?"
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_"
+  "abcdefghijklmnopqrstuvwxyz{|}~";
+
+/* Whether each byte is one of PRINTABLE_ASCII.  */
+static bool is_printable_ascii[UCHAR_MAX + 1];
+
+/* Whether the locale's encoding is UTF-8, whose characters
+   print_half_line can decode without calling mbrtowc.  */
+static bool utf8_locale;
+
+/* The print columns of each character from U+0000 through U+FFFF plus
+   2, or 0 if not yet known, so that wcwidth is called just once for
+   each character met in a line rather than for each time it is met.  */
+static unsigned char bmp_width[0x10000];
+
+/* The output line being built: both of its halves and the gutter are
+   put together here and then output with one write, rather than a
+   write for each run of characters and each run of padding.  */
+static char *row;
+static size_t row_used, row_alloc;
+
 /* Print the edit-script SCRIPT as a sdiff style output.  */
 
 void
 print_sdiff_script (struct change *script)
 {
+  char const *p;
+
+  for (p = printable_ascii; *p; p++)
+    is_printable_ascii[(unsigned char) *p] = true;
+  utf8_locale = 1 < MB_CUR_MAX && STREQ (nl_langinfo (CODESET), "UTF-8");
+
   begin_output ();
 
   next0 = next1 = - files[0].prefix_lines;
@@ -43,23 +76,123 @@ print_sdiff_script (struct change *script)
   print_sdiff_common_lines (files[0].valid_lines, files[1].valid_lines);
 }
 
+/* Make room for N more bytes in the output line, and return where
+   they go.  */
+
+static char *
+row_room (size_t n)
+{
+  while (row_alloc - row_used < n)
+    row = x2realloc (row, &row_alloc);
+  return row + row_used;
+}
+
+/* Append the N bytes at P to the output line.  */
+
+static void
+row_append (char const *p, size_t n)
+{
+  memcpy (row_room (n), p, n);
+  row_used += n;
+}
+
+/* Append the byte C to the output line.  */
+
+static void
+row_putc (char c)
+{
+  *row_room (1) = c;
+  row_used++;
+}
+
+/* Output N spaces.  */
+
+static void
+print_spaces (size_t n)
+{
+  memset (row_room (n), ' ', n);
+  row_used += n;
+}
+
+/* If the N bytes at P start with a well-formed UTF-8 character of two
+   to four bytes, store it into *PWC and return its length; otherwise
+   return 0, leaving mbrtowc to say what the bytes are.  */
+
+static size_t
+utf8_char (char const *p, size_t n, wchar_t *pwc)
+{
+  unsigned char const *s = (unsigned char const *) p;
+  unsigned int c = s[0];
+  unsigned int wc;
+
+  if (0xc2 <= c && c <= 0xdf)
+    {
+      if (2 <= n && (s[1] ^ 0x80) < 0x40)
+	{
+	  *pwc = (c & 0x1f) << 6 | (s[1] ^ 0x80);
+	  return 2;
+	}
+    }
+  else if (0xe0 <= c && c <= 0xef)
+    {
+      if (3 <= n && (s[1] ^ 0x80) < 0x40 && (s[2] ^ 0x80) < 0x40)
+	{
+	  wc = (c & 0x0f) << 12 | (s[1] ^ 0x80) << 6 | (s[2] ^ 0x80);
+	  if (0x800 <= wc && ! (0xd800 <= wc && wc <= 0xdfff))
+	    {
+	      *pwc = wc;
+	      return 3;
+	    }
+	}
+    }
+  else if (0xf0 <= c && c <= 0xf4)
+    {
+      if (4 <= n && (s[1] ^ 0x80) < 0x40 && (s[2] ^ 0x80) < 0x40
+	  && (s[3] ^ 0x80) < 0x40)
+	{
+	  wc = ((c & 0x07) << 18 | (s[1] ^ 0x80) << 12
+		| (s[2] ^ 0x80) << 6 | (s[3] ^ 0x80));
+	  if (0x10000 <= wc && wc <= 0x10ffff)
+	    {
+	      *pwc = wc;
+	      return 4;
+	    }
+	}
+    }
+  return 0;
+}
+
+/* Return the print columns of WC, as wcwidth does.  */
+
+static int
+char_width (wchar_t wc)
+{
+  unsigned long int i = wc;
+  if (i < sizeof bmp_width)
+    {
+      if (! bmp_width[i])
+	bmp_width[i] = wcwidth (wc) + 2;
+      return bmp_width[i] - 2;
+    }
+  return wcwidth (wc);
+}
+
 /* Tab from column FROM to column TO, where FROM <= TO.  Yield TO.  */
 
 static size_t
 tab_from_to (size_t from, size_t to)
 {
-  FILE *out = outfile;
   size_t tab;
   size_t tab_size = tabsize;
 
   if (!expand_tabs)
     for (tab = from + tab_size - from % tab_size;  tab <= to;  tab += tab_size)
       {
-	putc ('\t', out);
+	row_putc ('\t');
 	from = tab;
       }
-  while (from++ < to)
-    putc (' ', out);
+  if (from < to)
+    print_spaces (to - from);
   return to;
 }
 
@@ -70,18 +203,37 @@ tab_from_to (size_t from, size_t to)
 static size_t
 print_half_line (char const *const *line, size_t indent, size_t out_bound)
 {
-  FILE *out = outfile;
   register size_t in_position = 0;
   register size_t out_position = 0;
   register char const *text_pointer = line[0];
   register char const *text_limit = line[1];
   mbstate_t mbstate = { 0 };
 
+  stats.output_bytes += text_limit - text_pointer;
   while (text_pointer < text_limit)
     {
       char const *tp0 = text_pointer;
       register char c = *text_pointer++;
 
+      if (is_printable_ascii[(unsigned char) c])
+	{
+	  /* Each of a run of these characters takes one column, so
+	     output as much of the run as fits all at once.  */
+	  size_t run, fits;
+	  while (text_pointer < text_limit
+		 && is_printable_ascii[(unsigned char) *text_pointer])
+	    text_pointer++;
+	  run = text_pointer - tp0;
+	  fits = in_position < out_bound ? MIN (run, out_bound - in_position) : 0;
+	  if (fits)
+	    {
+	      row_append (tp0, fits);
+	      out_position = in_position + fits;
+	    }
+	  in_position += run;
+	  continue;
+	}
+
       switch (c)
 	{
 	case '\t':
@@ -94,14 +246,17 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
 		  {
 		    if (out_bound < tabstop)
 		      tabstop = out_bound;
-		    for (;  out_position < tabstop;  out_position++)
-		      putc (' ', out);
+		    if (out_position < tabstop)
+		      {
+			print_spaces (tabstop - out_position);
+			out_position = tabstop;
+		      }
 		  }
 		else
 		  if (tabstop < out_bound)
 		    {
 		      out_position = tabstop;
-		      putc (c, out);
+		      row_putc (c);
 		    }
 	      }
 	    in_position += spaces;
@@ -110,7 +265,7 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
 
 	case '\r':
 	  {
-	    putc (c, out);
+	    row_putc (c);
 	    tab_from_to (0, indent);
 	    in_position = out_position = 0;
 	  }
@@ -122,11 +277,11 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
 	      if (out_position <= in_position)
 		/* Add spaces to make up for suppressed tab past out_bound.  */
 		for (;  out_position < in_position;  out_position++)
-		  putc (' ', out);
+		  row_putc (' ');
 	      else
 		{
 		  out_position = in_position;
-		  putc (c, out);
+		  row_putc (c);
 		}
 	    }
 	  break;
@@ -134,17 +289,20 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
 	default:
 	  {
 	    wchar_t wc;
-	    size_t bytes = mbrtowc (&wc, tp0, text_limit - tp0, &mbstate);
+	    size_t bytes = (utf8_locale
+			    ? utf8_char (tp0, text_limit - tp0, &wc) : 0);
+	    if (! bytes)
+	      bytes = mbrtowc (&wc, tp0, text_limit - tp0, &mbstate);
 
 	    if (0 < bytes && bytes < (size_t) -2)
 	      {
-		int width = wcwidth (wc);
+		int width = char_width (wc);
 		if (0 < width)
 		  in_position += width;
 		if (in_position <= out_bound)
 		  {
 		    out_position = in_position;
-		    fwrite (tp0, 1, bytes, stdout);
+		    row_append (tp0, bytes);
 		  }
 		text_pointer = tp0 + bytes;
 		break;
@@ -154,35 +312,7 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
 	case '\f':
 	case '\v':
 	  if (in_position < out_bound)
-	    putc (c, out);
-	  break;
-
-	case ' ': case '!': case '"': case '#': case '%':
-	case '&': case '\'': case '(': case ')': case '*':
-	case '+': case ',': case '-': case '.': case '/':
-	case '0': case '1': case '2': case '3': case '4':
-	case '5': case '6': case '7': case '8': case '9':
-	case ':': case ';': case '<': case '=': case '>':
-	case '?':
-	case 'A': case 'B': case 'C': case 'D': case 'E':
-	case 'F': case 'G': case 'H': case 'I': case 'J':
-	case 'K': case 'L': case 'M': case 'N': case 'O':
-	case 'P': case 'Q': case 'R': case 'S': case 'T':
-	case 'U': case 'V': case 'W': case 'X': case 'Y':
-	case 'Z':
-	case '[': case '\\': case ']': case '^': case '_':
-	case 'a': case 'b': case 'c': case 'd': case 'e':
-	case 'f': case 'g': case 'h': case 'i': case 'j':
-	case 'k': case 'l': case 'm': case 'n': case 'o':
-	case 'p': case 'q': case 'r': case 's': case 't':
-	case 'u': case 'v': case 'w': case 'x': case 'y':
-	case 'z': case '{': case '|': case '}': case '~':
-	  /* These characters are printable ASCII characters.  */
-	  if (in_position++ < out_bound)
-	    {
-	      out_position = in_position;
-	      putc (c, out);
-	    }
+	    row_putc (c);
 	  break;
 
 	case '\n':
@@ -201,7 +331,6 @@ static void
 print_1sdiff_line (char const *const *left, char sep,
 		   char const *const *right)
 {
-  FILE *out = outfile;
   size_t hw = sdiff_half_width;
   size_t c2o = sdiff_column2_offset;
   size_t col = 0;
@@ -218,7 +347,7 @@ print_1sdiff_line (char const *const *left, char sep,
       col = tab_from_to (col, (hw + c2o - 1) / 2) + 1;
       if (sep == '|' && put_newline != (right[1][-1] == '\n'))
 	sep = put_newline ? '/' : '\\';
-      putc (sep, out);
+      row_putc (sep);
     }
 
   if (right)
@@ -232,7 +361,49 @@ print_1sdiff_line (char const *const *left, char sep,
     }
 
   if (put_newline)
-    putc ('\n', out);
+    row_putc ('\n');
+
+  fwrite (row, 1, row_used, outfile);
+  row_used = 0;
+}
+
+/* Print side by side the lines of the first file from FIRST0 up to
+   LIMIT0 and those of the second from FIRST1 up to LIMIT1, as common
+   lines if !CHANGED and as a hunk otherwise.  */
+
+void
+print_sdiff_run (bool changed, lin first0, lin limit0,
+		 lin first1, lin limit1)
+{
+  lin i = first0, j = first1;
+
+  if (!changed)
+    {
+      if (!left_column)
+	{
+	  while (i != limit0 && j != limit1)
+	    print_1sdiff_line (&files[0].linbuf[i++], ' ',
+			       &files[1].linbuf[j++]);
+	  while (j != limit1)
+	    print_1sdiff_line (0, ')', &files[1].linbuf[j++]);
+	}
+      while (i != limit0)
+	print_1sdiff_line (&files[0].linbuf[i++], '(', 0);
+    }
+  else
+    {
+      /* Print "xxx  |  xxx " lines.  */
+      for (;  i < limit0 && j < limit1;  i++, j++)
+	print_1sdiff_line (&files[0].linbuf[i], '|', &files[1].linbuf[j]);
+
+      /* Print "     >  xxx " lines.  */
+      for (;  j < limit1;  j++)
+	print_1sdiff_line (0, '>', &files[1].linbuf[j]);
+
+      /* Print "xxx  <     " lines.  */
+      for (;  i < limit0;  i++)
+	print_1sdiff_line (&files[0].linbuf[i], '<', 0);
+    }
 }
 
 /* Print lines common to both files in side-by-side format.  */
@@ -241,25 +412,21 @@ print_sdiff_common_lines (lin limit0, lin limit1)
 {
   lin i0 = next0, i1 = next1;
 
-  if (!suppress_common_lines && (i0 != limit0 || i1 != limit1))
+  if (i0 != limit0 || i1 != limit1)
     {
-      if (sdiff_merge_assist)
+      if (sdiff_run_hook)
+	sdiff_run_hook (false, i0, limit0, i1, limit1);
+      else if (!suppress_common_lines)
 	{
-	  long int len0 = limit0 - i0;
-	  long int len1 = limit1 - i1;
-	  fprintf (outfile, "i%ld,%ld\n", len0, len1);
-	}
+	  if (sdiff_merge_assist)
+	    {
+	      long int len0 = limit0 - i0;
+	      long int len1 = limit1 - i1;
+	      fprintf (outfile, "i%ld,%ld\n", len0, len1);
+	    }
 
-      if (!left_column)
-	{
-	  while (i0 != limit0 && i1 != limit1)
-	    print_1sdiff_line (&files[0].linbuf[i0++], ' ',
-			       &files[1].linbuf[i1++]);
-	  while (i1 != limit1)
-	    print_1sdiff_line (0, ')', &files[1].linbuf[i1++]);
+	  print_sdiff_run (false, i0, limit0, i1, limit1);
 	}
-      while (i0 != limit0)
-	print_1sdiff_line (&files[0].linbuf[i0++], '(', 0);
     }
 
   next0 = limit0;
@@ -274,47 +441,58 @@ static void
 print_sdiff_hunk (struct change *hunk)
 {
   lin first0, last0, first1, last1;
-  register lin i, j;
 
   /* Determine range of line numbers involved in each file.  */
   enum changes changes =
     analyze_hunk (hunk, &first0, &last0, &first1, &last1);
   if (!changes)
     return;
+  index_hunk (last0 - first0 + 1, last1 - first1 + 1);
 
   /* Print out lines up to this change.  */
   print_sdiff_common_lines (first0, first1);
 
-  if (sdiff_merge_assist)
+  if (sdiff_run_hook)
+    sdiff_run_hook (true, first0, last0 + 1, first1, last1 + 1);
+  else
     {
-      long int len0 = last0 - first0 + 1;
-      long int len1 = last1 - first1 + 1;
-      fprintf (outfile, "c%ld,%ld\n", len0, len1);
-    }
+      if (sdiff_merge_assist)
+	{
+	  long int len0 = last0 - first0 + 1;
+	  long int len1 = last1 - first1 + 1;
+	  fprintf (outfile, "c%ld,%ld\n", len0, len1);
+	}
 
-  /* Print "xxx  |  xxx " lines.  */
-  if (changes == CHANGED)
-    {
-      for (i = first0, j = first1;  i <= last0 && j <= last1;  i++, j++)
-	print_1sdiff_line (&files[0].linbuf[i], '|', &files[1].linbuf[j]);
-      changes = (i <= last0 ? OLD : 0) + (j <= last1 ? NEW : 0);
-      next0 = first0 = i;
-      next1 = first1 = j;
+      print_sdiff_run (true, first0, last0 + 1, first1, last1 + 1);
     }
 
-  /* Print "     >  xxx " lines.  */
-  if (changes & NEW)
-    {
-      for (j = first1; j <= last1; ++j)
-	print_1sdiff_line (0, '>', &files[1].linbuf[j]);
-      next1 = j;
-    }
+  next0 = last0 + 1;
+  next1 = last1 + 1;
+}
 
-  /* Print "xxx  <     " lines.  */
-  if (changes & OLD)
-    {
-      for (i = first0; i <= last0; ++i)
-	print_1sdiff_line (&files[0].linbuf[i], '<', 0);
-      next0 = i;
-    }
+/* Set the half line width and column 2 offset of side-by-side output
+   for lines WIDTH columns wide.  */
+
+void
+set_sdiff_width (size_t width)
+{
+  /* Maximize first the half line width, and then the gutter width,
+     according to the following constraints:
+
+      1.  Two half lines plus a gutter must fit in a line.
+      2.  If the half line width is nonzero:
+	  a.  The gutter width is at least GUTTER_WIDTH_MINIMUM.
+	  b.  If tabs are not expanded to spaces,
+	      a half line plus a gutter is an integral number of tabs,
+	      so that tabs in the right column line up.  */
+
+  size_t t = expand_tabs ? 1 : tabsize;
+  size_t w = width;
+  size_t t_plus_g = t + GUTTER_WIDTH_MINIMUM;
+  size_t unaligned_off = (w >> 1) + (t_plus_g >> 1) + (w & t_plus_g & 1);
+  size_t off = unaligned_off - unaligned_off % t;
+  sdiff_half_width = (off <= GUTTER_WIDTH_MINIMUM || w <= off
+		      ? 0
+		      : MIN (off - GUTTER_WIDTH_MINIMUM, w - off));
+  sdiff_column2_offset = sdiff_half_width ? off : w;
 }
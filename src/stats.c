@@ -0,0 +1,311 @@
+/* Report where GNU DIFF spends its time (--stats), and how far it has
+   got (--progress).
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <ignore-value.h>
+#include <progname.h>
+#include <timespec.h>
+
+/* The names of the phases, as --stats reports them.  */
+static char const *const phase_name[STATS_PHASES] =
+  { "read", "ends", "hash", "discard", "compare", "shift", "output",
+    "other" };
+
+/* The phase being timed, and when it began, by the clock and in CPU
+   time.  */
+static enum stats_phase current_phase;
+static bool timing;
+static struct timespec phase_start;
+static clock_t phase_start_cpu;
+
+/* The seconds of wall-clock and CPU time spent in each phase.  */
+static double wall[STATS_PHASES];
+static double cpu[STATS_PHASES];
+
+/* When the clock started, and when the next progress report is due.  */
+static struct timespec progress_start;
+static struct timespec progress_due;
+
+/* Charge the time since the current phase began to that phase, and
+   begin PHASE.  Do nothing unless --stats or --progress was given.
+   The first call starts the clock.  */
+
+void
+stats_phase (enum stats_phase phase)
+{
+  struct timespec now;
+  clock_t now_cpu;
+
+  if (! (stats_format || show_progress))
+    return;
+
+  gettime (&now);
+  now_cpu = clock ();
+  if (! timing)
+    {
+      progress_start = progress_due = now;
+      progress_due.tv_sec++;
+    }
+  else
+    {
+      wall[current_phase] += ((now.tv_sec - phase_start.tv_sec)
+			      + (now.tv_nsec - phase_start.tv_nsec) / 1e9);
+      cpu[current_phase] += ((double) (now_cpu - phase_start_cpu)
+			     / CLOCKS_PER_SEC);
+    }
+  timing = true;
+  current_phase = phase;
+  phase_start = now;
+  phase_start_cpu = now_cpu;
+}
+
+/* Note that BYTES of memory are in use, if that is the most yet.  */
+
+void
+stats_memory (size_t bytes)
+{
+  if (stats.peak_memory < bytes)
+    stats.peak_memory = bytes;
+}
+
+/* Report to standard error how far the comparison has got, if
+   --progress was given and no report has been made for a second.
+   This is called often, from every phase, so it must be cheap when
+   no report is due.  */
+
+void
+progress_tick (void)
+{
+  struct file_data const *f = progress.files;
+  struct timespec now;
+
+  if (! (show_progress && timing))
+    return;
+  gettime (&now);
+  if (timespec_cmp (now, progress_due) < 0)
+    return;
+  progress_due = now;
+  progress_due.tv_sec++;
+
+  fprintf (stderr, "%s: %lds", program_name,
+	   (long int) (now.tv_sec - progress_start.tv_sec));
+  if (progress.names_found)
+    fprintf (stderr, ", %"PRIuMAX" of %"PRIuMAX" names",
+	     progress.names_done, progress.names_found);
+  if (f && current_phase != STATS_OTHER)
+    {
+      fprintf (stderr, ", %s and %s: ", f[0].name, f[1].name);
+      switch (current_phase)
+	{
+	case STATS_READ:
+	  fprintf (stderr, "read %"PRIuMAX" and %"PRIuMAX" bytes",
+		   f[0].window_bytes + f[0].buffered,
+		   f[1].window_bytes + f[1].buffered);
+	  break;
+	case STATS_ENDS:
+	case STATS_HASH:
+	  fprintf (stderr, "hashed %ld lines", (long int) progress.hashed);
+	  break;
+	case STATS_DISCARD:
+	case STATS_COMPARE:
+	case STATS_SHIFT:
+	  fprintf (stderr, "compared %ld of %ld and %ld of %ld lines",
+		   (long int) progress.settled[0],
+		   (long int) f[0].nondiscarded_lines,
+		   (long int) progress.settled[1],
+		   (long int) f[1].nondiscarded_lines);
+	  break;
+	default:
+	  fprintf (stderr, "output %"PRIuMAX" bytes", stats.output_bytes);
+	  break;
+	}
+    }
+  putc ('\n', stderr);
+}
+
+/* The counters that print_stats reports, their names, and whether
+   the figure of several processes is the largest of theirs rather
+   than the sum.  */
+static struct
+{
+  char const *name;
+  uintmax_t *value;
+  bool max;
+} const counter[] =
+  {
+    { "files", &stats.files },
+    { "lines", &stats.lines },
+    { "classes", &stats.classes },
+    { "dictionary_hits", &stats.dictionary_hits },
+    { "horizon_widened", &stats.horizon_widened },
+    { "lookups", &stats.lookups },
+    { "probes", &stats.probes },
+    { "max_probes", &stats.max_probes, true },
+    { "slots", &stats.slots },
+    { "slots_used", &stats.slots_used },
+    { "table_grows", &stats.table_grows },
+    { "compares", &stats.compares },
+    { "collisions", &stats.collisions },
+    { "lines_differ", &stats.lines_differ },
+    { "diagonals", &stats.diagonals },
+    { "auto_myers", &stats.auto_myers },
+    { "auto_histogram", &stats.auto_histogram },
+    { "hunks", &stats.hunks },
+    { "output_bytes", &stats.output_bytes },
+    { "peak_memory", &stats.peak_memory, true },
+    { "job_groups", &stats.job_groups },
+  };
+
+/* What a child process that --jobs started sends its parent.  */
+struct child_stats
+{
+  struct stats stats;
+  double wall[STATS_PHASES];
+  double cpu[STATS_PHASES];
+};
+
+/* In a child process that --jobs started, forget the figures of the
+   parent, so that those that stats_send sends are the child's own.  */
+
+void
+stats_child (void)
+{
+  if (! stats_format)
+    return;
+  memset (&stats, 0, sizeof stats);
+  memset (wall, 0, sizeof wall);
+  memset (cpu, 0, sizeof cpu);
+  gettime (&phase_start);
+  phase_start_cpu = clock ();
+}
+
+/* Send the figures of a child process that --jobs started to the
+   parent through the pipe FD.  They are small enough to be written at
+   once.  If they cannot be, the parent goes without them.  */
+
+void
+stats_send (int fd)
+{
+  struct child_stats c;
+
+  if (! stats_format)
+    return;
+  stats_phase (current_phase);
+  c.stats = stats;
+  memcpy (c.wall, wall, sizeof wall);
+  memcpy (c.cpu, cpu, sizeof cpu);
+  ignore_value (write (fd, &c, sizeof c));
+}
+
+/* Add the figures that a child process sent through the pipe FD, if
+   it sent them, to this process's.  */
+
+void
+stats_receive (int fd)
+{
+  struct child_stats c;
+  int i;
+
+  if (! stats_format || read (fd, &c, sizeof c) != sizeof c)
+    return;
+  for (i = 0; i < STATS_PHASES; i++)
+    {
+      wall[i] += c.wall[i];
+      cpu[i] += c.cpu[i];
+    }
+  for (i = 0; i < sizeof counter / sizeof *counter; i++)
+    {
+      uintmax_t *v = counter[i].value;
+      uintmax_t child = *(uintmax_t const *) ((char const *) &c.stats
+					      + ((char *) v - (char *) &stats));
+      *v = counter[i].max ? MAX (*v, child) : *v + child;
+    }
+}
+
+/* Print to standard error the time spent in each phase and the
+   counters, as text or as a line of JSON, followed by the mean length
+   of a lookup in the hash table and the fraction of its slots that
+   were in use.  */
+
+void
+print_stats (void)
+{
+  double total_wall = 0;
+  double total_cpu = 0;
+  double mean_probes = (stats.lookups
+			? (double) stats.probes / stats.lookups : 0);
+  double occupancy = (stats.slots
+		      ? (double) stats.slots_used / stats.slots : 0);
+  double elapsed;
+  double jobs_busy;
+  double jobs_queued;
+  int i;
+
+  if (! stats_format)
+    return;
+
+  stats_phase (current_phase);
+  elapsed = ((phase_start.tv_sec - progress_start.tv_sec)
+	     + (phase_start.tv_nsec - progress_start.tv_nsec) / 1e9);
+  jobs_busy = (elapsed && stats.job_groups
+	       ? stats.job_running_seconds / elapsed / jobs : 0);
+  jobs_queued = elapsed ? stats.job_waiting_seconds / elapsed : 0;
+  for (i = 0; i < STATS_PHASES; i++)
+    {
+      total_wall += wall[i];
+      total_cpu += cpu[i];
+    }
+
+  if (stats_format == STATS_JSON)
+    {
+      fputs ("{\"phases\":{", stderr);
+      for (i = 0; i < STATS_PHASES; i++)
+	fprintf (stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}",
+		 i ? "," : "", phase_name[i], wall[i], cpu[i]);
+      fprintf (stderr, "},\"wall\":%.6f,\"cpu\":%.6f",
+	       total_wall, total_cpu);
+      for (i = 0; i < sizeof counter / sizeof *counter; i++)
+	fprintf (stderr, ",\"%s\":%"PRIuMAX, counter[i].name,
+		 *counter[i].value);
+      fprintf (stderr, ",\"mean_probes\":%.3f,\"occupancy\":%.3f",
+	       mean_probes, occupancy);
+      fprintf (stderr, (",\"jobs_busy\":%.3f,\"jobs_queued\":%.3f"
+			",\"jobs_wait\":%.6f,\"output_wait\":%.6f}\n"),
+	       jobs_busy, jobs_queued, stats.jobs_wait, stats.output_wait);
+    }
+  else
+    {
+      fprintf (stderr, "%-13s %10s %10s\n", "phase", "wall", "cpu");
+      for (i = 0; i < STATS_PHASES; i++)
+	fprintf (stderr, "%-13s %10.6f %10.6f\n",
+		 phase_name[i], wall[i], cpu[i]);
+      fprintf (stderr, "%-13s %10.6f %10.6f\n",
+	       "total", total_wall, total_cpu);
+      for (i = 0; i < sizeof counter / sizeof *counter; i++)
+	fprintf (stderr, "%-13s %10"PRIuMAX"\n", counter[i].name,
+		 *counter[i].value);
+      fprintf (stderr, "%-13s %10.3f\n", "mean_probes", mean_probes);
+      fprintf (stderr, "%-13s %10.3f\n", "occupancy", occupancy);
+      fprintf (stderr, "%-13s %10.3f\n", "jobs_busy", jobs_busy);
+      fprintf (stderr, "%-13s %10.3f\n", "jobs_queued", jobs_queued);
+      fprintf (stderr, "%-13s %10.6f\n", "jobs_wait", stats.jobs_wait);
+      fprintf (stderr, "%-13s %10.6f\n", "output_wait", stats.output_wait);
+    }
+}
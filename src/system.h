@@ -53,6 +53,15 @@
 #include <fcntl.h>
 #include <time.h>
 
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#if HAVE_SYS_MMAN_H && defined MAP_PRIVATE && defined MAP_ANONYMOUS
+# define USE_MMAP 1
+#else
+# define USE_MMAP 0
+#endif
+
 #include <sys/wait.h>
 
 #include <dirent.h>
@@ -128,7 +137,10 @@ int strcasecmp (char const *, char const *);
 #endif
 
 /* The integer type of a line number.  Since files are read into main
-   memory, ptrdiff_t should be wide enough.  */
+   memory, ptrdiff_t should be wide enough.  A narrower type would
+   halve the size of the vectors that the comparison algorithm walks,
+   but on 64-bit hosts it makes that algorithm slower, as every index
+   must then be widened before use.  */
 
 typedef ptrdiff_t lin;
 #define LIN_MAX PTRDIFF_MAX
@@ -146,6 +158,9 @@ verify (sizeof (lin) <= sizeof (long int));
 
 #ifndef file_name_cmp
 # define file_name_cmp strcmp
+# define FILE_NAME_CMP_IS_STRCMP true
+#else
+# define FILE_NAME_CMP_IS_STRCMP false
 #endif
 
 #ifndef initialize_main
@@ -19,8 +19,10 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "diff.h"
+#include "probes.h"
 #include <dirname.h>
 #include <error.h>
+#include <sh-quote.h>
 #include <system-quote.h>
 #include <xalloc.h>
 #include "xvasprintf.h"
@@ -28,22 +30,23 @@
 char const pr_program[] = PR_PROGRAM;
 
 /* Queue up one-line messages to be printed at the end,
-   when -l is specified.  Each message is recorded with a 'struct msg'.  */
+   when -l is specified.  The messages are formatted when they are
+   queued, and kept one after another in a buffer of at most
+   MESSAGE_QUEUE_MAX bytes; when it would fill, what it holds is
+   moved to a temporary file.  So on a huge tree the queue takes
+   little memory, however many files are only in one directory.  */
 
-struct msg
-{
-  struct msg *next;
-  char args[1]; /* Format + 4 args, each '\0' terminated, concatenated.  */
-};
+enum { MESSAGE_QUEUE_MAX = 64 * 1024 };
 
-/* Head of the chain of queues messages.  */
+static char *msg_queue;
+static size_t msg_queue_used;
+static size_t msg_queue_alloc;
 
-static struct msg *msg_chain;
+/* The temporary file that the messages too many for the buffer have
+   been moved to, or null if there were none.  */
 
-/* Tail of the chain of queues messages.  */
+static FILE *msg_file;
 
-static struct msg **msg_chain_end = &msg_chain;
-
 /* Use when a system call returns non-zero status.
    NAME should normally be the file name.  */
 
@@ -89,30 +92,33 @@ message5 (char const *format_msgid, char const *arg1, char const *arg2,
 {
   if (paginate)
     {
-      char *p;
-      char const *arg[5];
-      int i;
-      size_t size[5];
-      size_t total_size = offsetof (struct msg, args);
-      struct msg *new;
-
-      arg[0] = format_msgid;
-      arg[1] = arg1;
-      arg[2] = arg2;
-      arg[3] = arg3 ? arg3 : "";
-      arg[4] = arg4 ? arg4 : "";
-
-      for (i = 0;  i < 5;  i++)
-	total_size += size[i] = strlen (arg[i]) + 1;
-
-      new = xmalloc (total_size);
+      char *m = xasprintf (_(format_msgid), arg1, arg2, arg3, arg4);
+      size_t size = strlen (m);
 
-      for (i = 0, p = new->args;  i < 5;  p += size[i++])
-	memcpy (p, arg[i], size[i]);
+      if (MESSAGE_QUEUE_MAX - msg_queue_used < size)
+	{
+	  if (! msg_file)
+	    {
+	      msg_file = tmpfile ();
+	      if (! msg_file)
+		pfatal_with_name ("tmpfile");
+	    }
+	  if (fwrite (msg_queue, 1, msg_queue_used, msg_file)
+	      != msg_queue_used)
+	    pfatal_with_name (_("write failed"));
+	  msg_queue_used = 0;
+	}
 
-      *msg_chain_end = new;
-      new->next = 0;
-      msg_chain_end = &new->next;
+      if (msg_queue_alloc - msg_queue_used < size)
+	{
+	  msg_queue_alloc = MAX (msg_queue_used + size,
+				 MIN (2 * msg_queue_alloc + 256,
+				      MESSAGE_QUEUE_MAX));
+	  msg_queue = xrealloc (msg_queue, msg_queue_alloc);
+	}
+      memcpy (msg_queue + msg_queue_used, m, size);
+      msg_queue_used += size;
+      free (m);
     }
   else
     {
@@ -127,22 +133,30 @@ message5 (char const *format_msgid, char const *arg1, char const *arg2,
 void
 print_message_queue (void)
 {
-  char const *arg[5];
-  int i;
-  struct msg *m = msg_chain;
+  /* Forget the file first, as pfatal_with_name calls this again.  */
+  FILE *f = msg_file;
+  msg_file = NULL;
 
-  while (m)
+  if (f)
     {
-      struct msg *next = m->next;
-      arg[0] = m->args;
-      for (i = 0;  i < 4;  i++)
-	arg[i + 1] = arg[i] + strlen (arg[i]) + 1;
-      printf (_(arg[0]), arg[1], arg[2], arg[3], arg[4]);
-      free (m);
-      m = next;
+      char buf[16 * 1024];
+      size_t bytes;
+
+      if (fflush (f) != 0 || ferror (f))
+	pfatal_with_name (_("write failed"));
+      rewind (f);
+      while ((bytes = fread (buf, 1, sizeof buf, f)) != 0)
+	fwrite (buf, 1, bytes, stdout);
+      if (ferror (f))
+	pfatal_with_name (_("read failed"));
+      fclose (f);
     }
+
+  if (msg_queue_used)
+    fwrite (msg_queue, 1, msg_queue_used, stdout);
+  msg_queue_used = 0;
 }
-
+
 /* Call before outputting the results of comparing files NAME0 and NAME1
    to set up OUTFILE, the stdio stream for the output to go to.
 
@@ -250,15 +264,139 @@ c_escape (char const *str)
   return (char *) str;
 }
 
+/* The number of hunks whose output has begun for the current pair of
+   files.  */
+static lin hunks_begun;
+
+/* For --output-index, where the output for the current pair of files
+   starts in standard output, its number of hunks, and the number of
+   lines that they delete and insert.  */
+static off_t index_offset;
+static lin index_hunks;
+static lin index_deleted;
+static lin index_inserted;
+
+/* Start the --output-index file NAME, to which the output of diff is
+   indexed as it is written.  Each pair of files with output gets a
+   line of six fields separated by tabs: the offset in bytes in
+   standard output at which the pair's output starts, its number of
+   hunks, the number of lines those hunks delete and insert, and the
+   names of the two files quoted as in the header.  The offsets are
+   positions in standard output, which must be seekable.  */
+
+void
+open_output_index (char const *name)
+{
+  output_index = fopen (name, "w");
+  if (! output_index)
+    pfatal_with_name (name);
+}
+
+/* Finish the --output-index file NAME, if any.  */
+
+void
+close_output_index (char const *name)
+{
+  if (output_index
+      && (ferror (output_index) | (fclose (output_index) != 0)))
+    pfatal_with_name (name);
+}
+
+/* Count a hunk that deletes DELETED lines and inserts INSERTED lines
+   as output, for --output-index.  */
+
+void
+index_hunk (lin deleted, lin inserted)
+{
+  index_hunks++;
+  index_deleted += deleted;
+  index_inserted += inserted;
+}
+
+/* Add the current pair of files, whose output has ended, to the
+   --output-index file.  */
+
+static void
+index_output (void)
+{
+  char *name0 = c_escape (current_name0);
+  char *name1 = c_escape (current_name1);
+
+  fprintf (output_index, "%"PRIdMAX"\t%"PRIdMAX"\t%"PRIdMAX"\t%"PRIdMAX
+	   "\t%s\t%s\n",
+	   (intmax_t) index_offset, (intmax_t) index_hunks,
+	   (intmax_t) index_deleted, (intmax_t) index_inserted,
+	   name0, name1);
+  if (name0 != current_name0)
+    free (name0);
+  if (name1 != current_name1)
+    free (name1);
+}
+
+/* The line that starts the output of a pair of files in a recursive
+   comparison or with -l: "diff", the options, and the two names.  It
+   is built in a buffer kept from pair to pair, after the part before
+   the names, which is made once, so that comparing many small files
+   that differ does not allocate and format a line for each pair.  */
+static char *header_line;
+static size_t header_line_alloc;
+static size_t header_prefix_len;
+
+/* Make header_line the line for the files with the quoted names NAME0
+   and NAME1, and return its length.  */
+
+static size_t
+make_header_line (char const *name0, char const *name1)
+{
+  size_t len0 = strlen (name0);
+  size_t len1 = strlen (name1);
+  size_t len;
+  char *p;
+
+  if (! header_line)
+    {
+      char const *switches = switch_string ();
+      size_t switches_len = strlen (switches);
+      header_prefix_len = sizeof "diff" + switches_len;
+      header_line_alloc = header_prefix_len + 1;
+      header_line = xmalloc (header_line_alloc);
+      memcpy (header_line, "diff", sizeof "diff" - 1);
+      memcpy (header_line + sizeof "diff" - 1, switches, switches_len);
+      header_line[header_prefix_len - 1] = ' ';
+    }
+
+  len = header_prefix_len + len0 + 1 + len1;
+  while (header_line_alloc <= len)
+    header_line = x2realloc (header_line, &header_line_alloc);
+  p = header_line + header_prefix_len;
+  memcpy (p, name0, len0);
+  p += len0;
+  *p++ = ' ';
+  memcpy (p, name1, len1);
+  p[len1] = '\0';
+  return len;
+}
+
 void
 begin_output (void)
 {
   char *names[2];
-  char *name;
+  size_t header_len = 0;
 
+  hunks_begun++;
   if (outfile != 0)
     return;
+  hunks_begun = 1;
 
+  if (output_index)
+    {
+      index_offset = ftello (stdout);
+      if (index_offset < 0)
+	pfatal_with_name (_("standard output"));
+      index_hunks = index_deleted = index_inserted = 0;
+    }
+
+  PROBE2 (begin_output, current_name0, current_name1);
   names[0] = c_escape (current_name0);
   names[1] = c_escape (current_name1);
 
@@ -267,10 +405,14 @@ begin_output (void)
      the standard: it says that we must print only the last component
      of the pathnames, and it requires two spaces after "diff" if
      there are no options.  These requirements are silly and do not
-     match historical practice.  */
-  name = xasprintf ("diff%s %s %s", switch_string, names[0], names[1]);
-
-  if (paginate)
+     match historical practice.  It is needed only for -l, or for a
+     comparison within directories.  */
+  if (paginate || (currently_recursive && output_style != OUTPUT_JSON))
+    header_len = make_header_line (names[0], names[1]);
+
+  if (paginate && ! paginate_with_pr)
+    outfile = begin_pagination (xstrdup (header_line));
+  else if (paginate)
     {
       char const *argv[4];
 
@@ -279,7 +421,7 @@ begin_output (void)
 
       argv[0] = pr_program;
       argv[1] = "-h";
-      argv[2] = name;
+      argv[2] = header_line;
       argv[3] = 0;
 
       /* Make OUTFILE a pipe to a subsidiary 'pr'.  */
@@ -333,12 +475,13 @@ begin_output (void)
 
       /* If handling multiple files (because scanning a directory),
 	 print which files the following output is about.  */
-      if (currently_recursive)
-	printf ("%s\n", name);
+      if (currently_recursive && output_style != OUTPUT_JSON)
+	{
+	  fwrite (header_line, sizeof (char), header_len, stdout);
+	  putc ('\n', stdout);
+	}
     }
 
-  free (name);
-
   /* A special header is needed at the beginning of context output.  */
   switch (output_style)
     {
@@ -350,6 +493,10 @@ begin_output (void)
       print_context_header (files, (char const *const *)names, true);
       break;
 
+    case OUTPUT_JSON:
+      print_json_header (current_name0, current_name1);
+      break;
+
     default:
       break;
     }
@@ -360,13 +507,30 @@ begin_output (void)
     free (names[1]);
 }
 
+/* Return true if --max-hunks hunks have been output for the current
+   pair of files.  */
+
+bool
+hunk_limit_reached (void)
+{
+  return max_hunks && outfile && max_hunks <= hunks_begun;
+}
+
 /* Call after the end of output of diffs for one file.
-   Close OUTFILE and get rid of the 'pr' subfork.  */
+   Paginate the output, or close OUTFILE and get rid of the 'pr' subfork.  */
 
 void
 finish_output (void)
 {
-  if (outfile != 0 && outfile != stdout)
+  if (outfile != 0 && output_style == OUTPUT_JSON)
+    print_json_trailer ();
+
+  if (outfile != 0 && output_index)
+    index_output ();
+
+  if (outfile != 0 && paginate && ! paginate_with_pr)
+    finish_pagination ();
+  else if (outfile != 0 && outfile != stdout)
     {
       int status;
       int wstatus;
@@ -598,7 +762,7 @@ print_script (struct change *script,
 {
   struct change *next = script;
 
-  while (next)
+  while (next && ! hunk_limit_reached ())
     {
       struct change *this, *end;
 
@@ -615,7 +779,26 @@ print_script (struct change *script,
 #endif
 
       /* Print this hunk.  */
-      (*printfun) (this);
+      if (output_index)
+	{
+	  bool began = outfile != 0;
+	  lin begun = hunks_begun;
+	  (*printfun) (this);
+	  if (outfile != 0 && (! began || begun < hunks_begun))
+	    {
+	      lin deleted = 0, inserted = 0;
+	      struct change *e;
+	      for (e = this; e; e = e->link)
+		{
+		  deleted += e->deleted;
+		  inserted += e->inserted;
+		}
+	      index_hunk (deleted, inserted);
+	    }
+	}
+      else
+	(*printfun) (this);
+      progress_tick ();
 
       /* Reconnect the script so it will all be freed properly.  */
       end->link = next;
@@ -641,12 +824,13 @@ print_1_line (char const *line_flag, char const *const *line)
 
   if (line_flag && *line_flag)
     {
-      char const *flag_format_1 = flag_format = initial_tab ? "%s\t" : "%s ";
+      char separator = initial_tab ? '\t' : ' ';
       char const *line_flag_1 = line_flag;
+      flag_format = initial_tab ? "%s\t" : "%s ";
 
       if (suppress_blank_empty && **line == '\n')
 	{
-	  flag_format_1 = "%s";
+	  separator = 0;
 
 	  /* This hack to omit trailing blanks takes advantage of the
 	     fact that the only way that LINE_FLAG can end in a blank
@@ -654,7 +838,10 @@ print_1_line (char const *line_flag, char const *const *line)
 	  line_flag_1 += *line_flag_1 == ' ';
 	}
 
-      fprintf (out, flag_format_1, line_flag_1);
+      /* This is done for every line output, so avoid fprintf.  */
+      fputs (line_flag_1, out);
+      if (separator)
+	putc (separator, out);
     }
 
   output_1_line (base, limit, flag_format, line_flag);
@@ -672,6 +859,9 @@ void
 output_1_line (char const *base, char const *limit, char const *flag_format,
 	       char const *line_flag)
 {
+  /* Copying the line into the stdio buffer costs too little to be
+     worth a gather list pointing into the input buffers.  */
+  stats.output_bytes += limit - base;
   if (!expand_tabs)
     fwrite (base, sizeof (char), limit - base, outfile);
   else
@@ -681,6 +871,19 @@ output_1_line (char const *base, char const *limit, char const *flag_format,
       register char const *t = base;
       register size_t column = 0;
       size_t tab_size = tabsize;
+      static bool printable_ready;
+      static bool printable[UCHAR_MAX + 1];
+
+      /* Looking up isprint in a table of our own is much faster than
+	 calling it for each character.  The locale does not change
+	 while diff runs.  */
+      if (! printable_ready)
+	{
+	  int i;
+	  for (i = 0; i <= UCHAR_MAX; i++)
+	    printable[i] = isprint (i) != 0;
+	  printable_ready = true;
+	}
 
       while (t < limit)
 	switch ((c = *t++))
@@ -710,13 +913,123 @@ output_1_line (char const *base, char const *limit, char const *flag_format,
 	    break;
 
 	  default:
-	    column += isprint (c) != 0;
+	    column += printable[c];
 	    putc (c, out);
 	    break;
 	  }
     }
 }
 
+/* Print lines FIRST through LAST of FILE with no line flags, as ed
+   and RCS scripts do.  The lines follow one another in FILE's buffer,
+   so unless -t must expand their tabs they are output at once.  */
+
+void
+print_bare_lines (struct file_data const *file, lin first, lin last)
+{
+  char const *const *linbuf = file->linbuf;
+
+  if (last < first)
+    return;
+  if (! expand_tabs)
+    output_1_line (linbuf[first], linbuf[last + 1], 0, "");
+  else
+    for (; first <= last; first++)
+      print_1_line ("", &linbuf[first]);
+}
+
+/* Print lines FIRST through LAST of FILE, each flagged with LINE_FLAG,
+   a single character, as print_1_line would, as context and normal
+   output do.  With -t, a carriage return inside a line repeats the
+   flag, so the lines go through print_1_line one at a time.  */
+
+void
+print_flagged_lines (char const *line_flag, struct file_data const *file,
+		     lin first, lin last)
+{
+  if (expand_tabs)
+    for (; first <= last; first++)
+      print_1_line (line_flag, &file->linbuf[first]);
+  else
+    {
+      char prefix[3];
+      prefix[0] = line_flag[0];
+      prefix[1] = initial_tab ? '\t' : ' ';
+      prefix[2] = '\0';
+      print_prefixed_lines (file, first, last, prefix,
+			    (! suppress_blank_empty ? prefix
+			     : line_flag[0] == ' ' ? "" : line_flag));
+    }
+}
+
+/* Print lines FIRST through LAST of FILE, each preceded by PREFIX, or
+   by EMPTY_PREFIX if the line is empty, as unified and context output
+   do.  Unless -t must expand their tabs, the lines and their prefixes
+   are gathered into a buffer and written a block at a time, which on
+   long runs of context is cheaper than a few stdio calls per line.
+   The line boundaries come from FILE's line table, so the text need
+   not be scanned again for newlines.  */
+
+void
+print_prefixed_lines (struct file_data const *file, lin first, lin last,
+		      char const *prefix, char const *empty_prefix)
+{
+  enum { PREFIXED_BUFSIZE = 64 * 1024 };
+  static char *buf;
+  char const *const *linbuf = file->linbuf;
+  FILE *out = outfile;
+  size_t prefix_len = strlen (prefix);
+  size_t empty_prefix_len = strlen (empty_prefix);
+  size_t used = 0;
+  lin i;
+
+  if (last < first)
+    return;
+
+  if (expand_tabs)
+    {
+      for (i = first; i <= last; i++)
+	{
+	  fputs (*linbuf[i] == '\n' ? empty_prefix : prefix, out);
+	  output_1_line (linbuf[i], linbuf[i + 1], 0, 0);
+	}
+    }
+  else
+    {
+      if (! buf)
+	buf = xmalloc (PREFIXED_BUFSIZE);
+
+      stats.output_bytes += linbuf[last + 1] - linbuf[first];
+      for (i = first; i <= last; i++)
+	{
+	  char const *base = linbuf[i];
+	  size_t len = linbuf[i + 1] - base;
+	  bool empty = *base == '\n';
+	  char const *p = empty ? empty_prefix : prefix;
+	  size_t plen = empty ? empty_prefix_len : prefix_len;
+
+	  if (PREFIXED_BUFSIZE - used < plen + len)
+	    {
+	      fwrite (buf, 1, used, out);
+	      used = 0;
+	      if (PREFIXED_BUFSIZE < plen + len)
+		{
+		  fwrite (p, 1, plen, out);
+		  fwrite (base, 1, len, out);
+		  continue;
+		}
+	    }
+	  memcpy (buf + used, p, plen);
+	  memcpy (buf + used + plen, base, len);
+	  used += plen + len;
+	}
+      fwrite (buf, 1, used, out);
+    }
+
+  if (linbuf[last + 1][-1] != '\n')
+    fprintf (out, "\n\\ %s\n", _("No newline at end of file"));
+}
+
 char const change_letter[] = { 0, 'd', 'a', 'c' };
 
 /* Translate an internal line number (an index into diff's table of lines)
@@ -729,7 +1042,7 @@ char const change_letter[] = { 0, 'd', 'a', 'c' };
 lin _GL_ATTRIBUTE_PURE
 translate_line_number (struct file_data const *file, lin i)
 {
-  return i + file->prefix_lines + 1;
+  return i + file->window_lines + file->prefix_lines + 1;
 }
 
 /* Translate a line number range.  This is always done for printing,
@@ -766,6 +1079,274 @@ print_number_range (char sepchar, struct file_data *file, lin a, lin b)
     fprintf (outfile, "%ld", trans_b);
 }
 
+
+/* Return true if the LEN bytes at P contain the string S.  */
+
+static bool _GL_ATTRIBUTE_PURE
+contains_string (char const *p, size_t len, char const *s)
+{
+  size_t slen = strlen (s);
+  char const *lim = p + len;
+
+  while (slen <= lim - p)
+    {
+      p = memchr (p, s[0], lim - p - slen + 1);
+      if (!p)
+	return false;
+      if (memcmp (p + 1, s + 1, slen - 1) == 0)
+	return true;
+      p++;
+    }
+  return false;
+}
+
+/* A set of regexps, each with a string that all its matches contain.
+   A line can match a regexp only if it contains the regexp's string,
+   so look for the strings first and run only the regexps whose
+   strings are found.  With only a few strings, look for each in
+   turn, as memchr finds each quickly.  With more, use an Aho-Corasick
+   automaton, which looks at each byte of a line once however many
+   strings there are.  */
+
+enum { REGEXP_SET_AUTOMATON_MIN = 4 };
+
+struct regexp_set
+{
+  /* The strings and their regexps, and their number.  */
+  char **strings;
+  struct re_pattern_buffer **regexps;
+  size_t n;
+
+  /* For each regexp, the number of the last line it was run on, so
+     that it is not run twice on a line that has its string twice;
+     and the number of lines searched so far.  */
+  uintmax_t *tried;
+  uintmax_t lines;
+
+  /* For the automaton, NEXT[S * (UCHAR_MAX + 1) + C] is the state
+     that follows state S on byte C, and state 0 is the start state.
+     OUTPUT[S] is 1 plus the index of a string that the bytes leading
+     to state S end with, or 0 if there is none; SAME[I] is likewise
+     for the next string after string I that is the same as it; and
+     DICT[S] is the state, other than S, for the longest proper suffix
+     of those bytes that has an output, or 0.  NEXT is null if there
+     is no automaton.  */
+  int *next;
+  size_t *output;
+  size_t *same;
+  int *dict;
+};
+
+/* Return a set of the N regexps REGEXPS, where every match of
+   REGEXPS[I] contains STRINGS[I].  The set takes over both arrays.  */
+
+static struct regexp_set *
+new_regexp_set (char **strings, struct re_pattern_buffer **regexps, size_t n)
+{
+  struct regexp_set *set = xmalloc (sizeof *set);
+  int *next, *fail, *queue, *dict;
+  size_t *output, *same;
+  size_t states = 1, total = 1, head = 0, tail = 0, i;
+  int s, c;
+
+  set->strings = strings;
+  set->regexps = regexps;
+  set->n = n;
+  set->tried = xcalloc (n, sizeof *set->tried);
+  set->lines = 0;
+  set->next = NULL;
+  if (n < REGEXP_SET_AUTOMATON_MIN)
+    return set;
+
+  for (i = 0; i < n; i++)
+    total += strlen (strings[i]);
+  if (INT_MAX < total)
+    return set;
+  next = xcalloc (total, (UCHAR_MAX + 1) * sizeof *next);
+  output = xcalloc (total, sizeof *output);
+  same = xcalloc (n, sizeof *same);
+  dict = xcalloc (total, sizeof *dict);
+  fail = xnmalloc (total, sizeof *fail);
+  queue = xnmalloc (total, sizeof *queue);
+
+  /* Build the trie of the strings.  No edge of the trie leads back to
+     the start state, so a zero entry means there is no edge yet.  */
+  for (i = 0; i < n; i++)
+    {
+      unsigned char const *p = (unsigned char const *) strings[i];
+      s = 0;
+      for (; *p; p++)
+	{
+	  int *t = &next[s * (UCHAR_MAX + 1) + *p];
+	  if (! *t)
+	    *t = states++;
+	  s = *t;
+	}
+      same[i] = output[s];
+      output[s] = i + 1;
+    }
+
+  /* Visit the states in order of depth, so that the failure state of
+     each, and that state's row, are complete by the time they are
+     needed.  Replace each missing edge with the failure state's.  */
+  for (c = 0; c <= UCHAR_MAX; c++)
+    if (next[c])
+      {
+	fail[next[c]] = 0;
+	queue[tail++] = next[c];
+      }
+  while (head < tail)
+    {
+      int *row;
+      s = queue[head++];
+      row = &next[s * (UCHAR_MAX + 1)];
+      for (c = 0; c <= UCHAR_MAX; c++)
+	{
+	  int f = next[fail[s] * (UCHAR_MAX + 1) + c];
+	  if (row[c])
+	    {
+	      fail[row[c]] = f;
+	      dict[row[c]] = output[f] ? f : dict[f];
+	      queue[tail++] = row[c];
+	    }
+	  else
+	    row[c] = f;
+	}
+    }
+
+  free (fail);
+  free (queue);
+  set->next = next;
+  set->output = output;
+  set->same = same;
+  set->dict = dict;
+  return set;
+}
+
+/* Return true if regexp I of SET, and any later regexps whose
+   strings are the same as its, matches the LEN-byte line at LINE.  */
+
+static bool
+regexp_set_try (struct regexp_set *set, size_t i,
+		char const *line, size_t len)
+{
+  for (;;)
+    {
+      if (set->tried[i] != set->lines)
+	{
+	  set->tried[i] = set->lines;
+	  if (0 <= re_search (set->regexps[i], line, len, 0, len, 0))
+	    return true;
+	}
+      if (! set->next || ! set->same[i])
+	return false;
+      i = set->same[i] - 1;
+    }
+}
+
+/* Return true if one of the regexps of SET matches the LEN-byte line
+   at LINE.  */
+
+static bool
+regexp_set_search (struct regexp_set *set, char const *line, size_t len)
+{
+  set->lines++;
+
+  if (set->next)
+    {
+      int const *next = set->next;
+      size_t const *output = set->output;
+      int const *dict = set->dict;
+      unsigned char const *p = (unsigned char const *) line;
+      unsigned char const *lim = p + len;
+      int s = 0;
+
+      while (p < lim)
+	{
+	  int t;
+	  s = next[s * (UCHAR_MAX + 1) + *p++];
+	  for (t = output[s] ? s : dict[s]; t; t = dict[t])
+	    if (regexp_set_try (set, output[t] - 1, line, len))
+	      return true;
+	}
+    }
+  else
+    {
+      size_t i;
+      for (i = 0; i < set->n; i++)
+	if (contains_string (line, len, set->strings[i])
+	    && regexp_set_try (set, i, line, len))
+	  return true;
+    }
+  return false;
+}
+
+/* Return true if the LEN bytes at LINE, which do not include the
+   line's newline, match an -I regexp.  */
+
+bool
+matches_ignore_regexp (char const *line, size_t len)
+{
+  return (ignore_regexp_set
+	  ? regexp_set_search (ignore_regexp_set, line, len)
+	  : 0 <= re_search (&ignore_regexp, line, len, 0, len, 0));
+}
+
+/* Return true if line I of FILE can be ignored by -B or -I.
+   TRIVIAL_LENGTH, SKIP_WHITE_SPACE and SKIP_LEADING_WHITE_SPACE
+   are as computed by analyze_hunk.  */
+
+static bool
+ignorable_line (struct file_data const *file, lin i, size_t trivial_length,
+		bool skip_white_space, bool skip_leading_white_space)
+{
+  char const *line = file->linbuf[i];
+  char const *lastbyte = file->linbuf[i + 1] - 1;
+  char const *newline = lastbyte + (*lastbyte != '\n');
+  size_t len = newline - line;
+  char const *p = line;
+  signed char *known = 0;
+  bool ignorable;
+
+  /* The lines of a class are identical unless options like -i or -b
+     are in effect, so the regexp need be run on only one of them.  */
+  if (ignorable_class)
+    {
+      known = &ignorable_class[file->equivs[i]];
+      if (*known)
+	return 0 < *known;
+    }
+
+  if (skip_white_space)
+    for (; *p != '\n'; p++)
+      if (! isspace ((unsigned char) *p))
+	{
+	  if (! skip_leading_white_space)
+	    p = line;
+	  break;
+	}
+  ignorable = (newline - p == trivial_length
+	       || (ignore_regexp.fastmap
+		   && matches_ignore_regexp (line, len)));
+
+  if (known)
+    *known = ignorable ? 1 : -1;
+  return ignorable;
+}
+
+/* Return true if line I of FILE can be ignored by -B or -I, so that
+   a hunk of nothing but such lines would be ignored.  */
+
+bool
+line_is_ignorable (struct file_data const *file, lin i)
+{
+  bool skip_white_space =
+    ignore_blank_lines && IGNORE_TRAILING_SPACE <= ignore_white_space;
+  return ignorable_line (file, i, ignore_blank_lines - 1, skip_white_space,
+			 (skip_white_space
+			  && IGNORE_SPACE_CHANGE <= ignore_white_space));
+}
+
 /* Look at a hunk of edit script and report the range of lines in each file
    that it applies to.  HUNK is the start of the hunk, which is a chain
    of 'struct change'.  The first and last line numbers of file 0 are stored in
@@ -798,9 +1379,6 @@ analyze_hunk (struct change *hunk,
   bool skip_leading_white_space =
     skip_white_space && IGNORE_SPACE_CHANGE <= ignore_white_space;
 
-  char const * const *linbuf0 = files[0].linbuf;  /* Help the compiler.  */
-  char const * const *linbuf1 = files[1].linbuf;
-
   show_from = show_to = 0;
 
   *first0 = hunk->line0;
@@ -815,46 +1393,12 @@ analyze_hunk (struct change *hunk,
       show_to += next->inserted;
 
       for (i = next->line0; i <= l0 && trivial; i++)
-	{
-	  char const *line = linbuf0[i];
-	  char const *lastbyte = linbuf0[i + 1] - 1;
-	  char const *newline = lastbyte + (*lastbyte != '\n');
-	  size_t len = newline - line;
-	  char const *p = line;
-	  if (skip_white_space)
-	    for (; *p != '\n'; p++)
-	      if (! isspace ((unsigned char) *p))
-		{
-		  if (! skip_leading_white_space)
-		    p = line;
-		  break;
-		}
-	  if (newline - p != trivial_length
-	      && (! ignore_regexp.fastmap
-		  || re_search (&ignore_regexp, line, len, 0, len, 0) < 0))
-	    trivial = 0;
-	}
+	trivial = ignorable_line (&files[0], i, trivial_length,
+				  skip_white_space, skip_leading_white_space);
 
       for (i = next->line1; i <= l1 && trivial; i++)
-	{
-	  char const *line = linbuf1[i];
-	  char const *lastbyte = linbuf1[i + 1] - 1;
-	  char const *newline = lastbyte + (*lastbyte != '\n');
-	  size_t len = newline - line;
-	  char const *p = line;
-	  if (skip_white_space)
-	    for (; *p != '\n'; p++)
-	      if (! isspace ((unsigned char) *p))
-		{
-		  if (! skip_leading_white_space)
-		    p = line;
-		  break;
-		}
-	  if (newline - p != trivial_length
-	      && (! ignore_regexp.fastmap
-		  || re_search (&ignore_regexp, line, len, 0, len, 0) < 0))
-	    trivial = 0;
-	}
+	trivial = ignorable_line (&files[1], i, trivial_length,
+				  skip_white_space, skip_leading_white_space);
     }
   while ((next = next->link) != 0);
 
@@ -870,6 +1414,356 @@ analyze_hunk (struct change *hunk,
   return (show_from ? OLD : UNCHANGED) | (show_to ? NEW : UNCHANGED);
 }
 
+/* Return the longest string that every match of the PATLEN-byte
+   grep-style regexp PATTERN contains, in a newly allocated buffer,
+   or null if there is no such string.  Look only at the text outside
+   groups and bracket expressions and away from repetition operators,
+   and give up on alternation, so that the string is surely needed
+   if not always the longest one that is.  */
+
+static char *
+required_literal (char const *pattern, size_t patlen)
+{
+  char const *p = pattern;
+  char const *lim = pattern + patlen;
+  char *run = xmalloc (patlen + 1);
+  char *best = xmalloc (patlen + 1);
+  size_t run_len = 0, best_len = 0;
+  int depth = 0;
+
+  while (p < lim)
+    {
+      unsigned char c = *p++;
+      bool literal = false;
+
+      if (c == '\\' && p < lim)
+	{
+	  c = *p++;
+	  switch (c)
+	    {
+	    case '|':
+	      best_len = 0;
+	      goto done;
+
+	    case '(':
+	      depth++;
+	      break;
+
+	    case ')':
+	      depth -= 0 < depth;
+	      break;
+
+	    case '{':
+	      run_len -= 0 < run_len;
+	      while (p < lim && ! (p[0] == '\\' && p + 1 < lim && p[1] == '}'))
+		p++;
+	      p += 2;
+	      break;
+
+	    case '?':
+	    case '+':
+	      /* The character before '\+' is needed, but an operator
+		 after the '\+' could make it optional.  */
+	      run_len -= 0 < run_len;
+	      break;
+
+	    default:
+	      /* A backslash before punctuation quotes it; before a
+		 letter or digit it makes an operator or back-reference.  */
+	      literal = (c < 0x80 && ! isalnum (c)
+			 && c != '<' && c != '>' && c != '`' && c != '\'');
+	      break;
+	    }
+	}
+      else
+	switch (c)
+	  {
+	  case '\n':
+	    best_len = 0;
+	    goto done;
+
+	  case '[':
+	    p += p < lim && *p == '^';
+	    p += p < lim && *p == ']';
+	    for (; p < lim && *p != ']'; p++)
+	      if (*p == '[' && p + 1 < lim
+		  && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+		{
+		  char const *close = p + 2;
+		  while (close + 1 < lim
+			 && ! (close[0] == p[1] && close[1] == ']'))
+		    close++;
+		  p = close + 1;
+		}
+	    p++;
+	    break;
+
+	  case '*':
+	    run_len -= 0 < run_len;
+	    break;
+
+	  case '.': case '^': case '$':
+	    break;
+
+	  default:
+	    literal = c < 0x80;
+	    break;
+	  }
+
+      if (literal)
+	{
+	  if (depth == 0)
+	    run[run_len++] = c;
+	}
+      else if (run_len)
+	{
+	  if (best_len < run_len)
+	    memcpy (best, run, best_len = run_len);
+	  run_len = 0;
+	}
+    }
+
+  if (best_len < run_len)
+    memcpy (best, run, best_len = run_len);
+
+ done:
+  free (run);
+  if (! best_len)
+    {
+      free (best);
+      return NULL;
+    }
+  best[best_len] = '\0';
+  return best;
+}
+
+/* Return a string containing the command options with which diff was invoked.
+   Spaces appear between what were separate ARGV-elements.
+   There is a space at the beginning but none at the end.
+   If there were no options, the result is an empty string.
+
+   Arguments: OPTIONVEC, a vector containing separate ARGV-elements, and COUNT,
+   the length of that vector.  */
+
+static char *
+option_list (char **optionvec, int count)
+{
+  int i;
+  size_t size = 1;
+  char *result;
+  char *p;
+
+  for (i = 0; i < count; i++)
+    size += 1 + shell_quote_length (optionvec[i]);
+
+  p = result = xmalloc (size);
+
+  for (i = 0; i < count; i++)
+    {
+      *p++ = ' ';
+      p = shell_quote_copy (p, optionvec[i]);
+    }
+
+  *p = '\0';
+  return result;
+}
+
+/* Return a string containing the command options with which diff was
+   invoked.  It is made when first needed, for the header of a piece
+   of output.  */
+
+char const *
+switch_string (void)
+{
+  static char *result;
+  if (! result)
+    result = option_list (switch_vector, switch_count);
+  return result;
+}
+
+/* Set the locale category CATEGORY from the environment, unless that
+   has been done already.  diff sets only LC_CTYPE and LC_MESSAGES at
+   startup, as loading each of the others costs more than a typical
+   comparison of small files; the code that depends on one of them
+   calls this first.  */
+
+void
+use_locale (int category)
+{
+  static int const categories[] = { LC_COLLATE, LC_TIME };
+  static bool set[sizeof categories / sizeof *categories];
+  int i;
+
+  for (i = 0; i < sizeof categories / sizeof *categories; i++)
+    if (categories[i] == category)
+      {
+	if (! set[i])
+	  {
+	    setlocale (category, "");
+	    set[i] = true;
+	  }
+	return;
+      }
+}
+
+/* Append to REGLIST the regexp PATTERN.  */
+
+void
+add_regexp (struct regexp_list *reglist, char const *pattern)
+{
+  size_t patlen = strlen (pattern);
+  char const *m;
+
+  /* Ranges in bracket expressions depend on the collating order.  */
+  use_locale (LC_COLLATE);
+  m = re_compile_pattern (pattern, patlen, reglist->buf);
+
+  if (m != 0)
+    error (0, 0, "%s: %s", pattern, m);
+  else
+    {
+      char *regexps = reglist->regexps;
+      size_t len = reglist->len;
+      bool multiple_regexps = reglist->multiple_regexps = regexps != 0;
+      size_t newlen = reglist->len = len + 2 * multiple_regexps + patlen;
+      size_t size = reglist->size;
+
+      if (size <= newlen)
+	{
+	  if (!size)
+	    size = 1;
+
+	  do size *= 2;
+	  while (size <= newlen);
+
+	  reglist->size = size;
+	  reglist->regexps = regexps = xrealloc (regexps, size);
+	}
+      if (multiple_regexps)
+	{
+	  regexps[len++] = '\\';
+	  regexps[len++] = '|';
+	}
+      memcpy (regexps + len, pattern, patlen + 1);
+
+      /* A leading '^' anchors the whole regexp unless it has other
+	 alternatives; be conservative about those.  */
+      if (! (pattern[0] == '^' && ! strstr (pattern, "\\|")
+	     && ! strchr (pattern, '\n')))
+	reglist->unanchored = true;
+
+      if (reglist->indexed && ! reglist->no_literal)
+	{
+	  char *literal = required_literal (pattern, patlen);
+	  if (literal)
+	    {
+	      struct re_pattern_buffer *buf = xzalloc (sizeof *buf);
+	      size_t n = reglist->nliterals;
+	      re_compile_pattern (pattern, patlen, buf);
+	      reglist->literals = xnrealloc (reglist->literals, n + 1,
+					     sizeof *reglist->literals);
+	      reglist->literal_bufs = xnrealloc (reglist->literal_bufs, n + 1,
+						 sizeof *reglist->literal_bufs);
+	      reglist->literals[n] = literal;
+	      reglist->literal_bufs[n] = buf;
+	      reglist->nliterals = n + 1;
+	    }
+	  else
+	    reglist->no_literal = true;
+	}
+    }
+}
+
+/* Ensure that REGLIST represents the disjunction of its regexps.
+   This is done here, rather than earlier, to avoid O(N^2) behavior.  */
+
+void
+summarize_regexp_list (struct regexp_list *reglist)
+{
+  if (reglist->regexps)
+    {
+      /* At least one regexp was specified.  Allocate a fastmap for it.  */
+      reglist->buf->fastmap = xmalloc (1 << CHAR_BIT);
+      if (reglist->multiple_regexps)
+	{
+	  /* Compile the disjunction of the regexps.
+	     (If just one regexp was specified, it is already compiled.)  */
+	  char const *m = re_compile_pattern (reglist->regexps, reglist->len,
+					      reglist->buf);
+	  if (m)
+	    error (EXIT_TROUBLE, 0, "%s: %s", reglist->regexps, m);
+	}
+      re_compile_fastmap (reglist->buf);
+
+      /* Index the regexps by the strings that their matches contain
+	 only if each regexp has one.  */
+      if (reglist->no_literal)
+	{
+	  while (reglist->nliterals)
+	    {
+	      struct re_pattern_buffer *buf
+		= reglist->literal_bufs[--reglist->nliterals];
+	      regfree (buf);
+	      free (buf);
+	      free (reglist->literals[reglist->nliterals]);
+	    }
+	  free (reglist->literals);
+	  free (reglist->literal_bufs);
+	}
+      else if (reglist->nliterals)
+	{
+	  size_t i;
+	  for (i = 0; i < reglist->nliterals; i++)
+	    {
+	      reglist->literal_bufs[i]->fastmap = xmalloc (1 << CHAR_BIT);
+	      re_compile_fastmap (reglist->literal_bufs[i]);
+	    }
+	  reglist->set = new_regexp_set (reglist->literals,
+					 reglist->literal_bufs,
+					 reglist->nliterals);
+	}
+      reglist->literals = NULL;
+      reglist->literal_bufs = NULL;
+      reglist->nliterals = 0;
+    }
+}
+
+/* Free what REGLIST and its regexps have allocated.  */
+
+void
+free_regexp_list (struct regexp_list *reglist)
+{
+  struct regexp_set *set = reglist->set;
+
+  if (set)
+    {
+      size_t i;
+      for (i = 0; i < set->n; i++)
+	{
+	  regfree (set->regexps[i]);
+	  free (set->regexps[i]);
+	  free (set->strings[i]);
+	}
+      free (set->strings);
+      free (set->regexps);
+      free (set->tried);
+      if (set->next)
+	{
+	  free (set->next);
+	  free (set->output);
+	  free (set->same);
+	  free (set->dict);
+	}
+      free (set);
+      reglist->set = NULL;
+    }
+  if (reglist->regexps)
+    regfree (reglist->buf);
+  free (reglist->regexps);
+  reglist->regexps = NULL;
+  reglist->len = reglist->size = 0;
+}
+
 /* Concatenate three strings, returning a newly malloc'd string.  */
 
 char *
@@ -890,6 +1784,26 @@ zalloc (size_t size)
   return p;
 }
 
+/* With --huge-pages, ask for the SIZE bytes at P, if there are
+   enough of them, to be backed by huge pages, so that a large buffer
+   or table that is used out of order takes fewer entries of the
+   translation lookaside buffer.  Only whole huge pages within the
+   block can be backed, and the block should not have been touched
+   yet, as pages already faulted in stay small.  */
+
+void
+advise_huge_pages (void *p, size_t size)
+{
+#if USE_MMAP && defined MADV_HUGEPAGE
+  enum { HUGE_PAGE = 2 * 1024 * 1024, HUGE_PAGE_MIN = 8 * HUGE_PAGE };
+  uintptr_t start = ((uintptr_t) p + HUGE_PAGE - 1) & - (uintptr_t) HUGE_PAGE;
+  uintptr_t end = ((uintptr_t) p + size) & - (uintptr_t) HUGE_PAGE;
+
+  if (huge_pages && HUGE_PAGE_MIN <= size && start < end)
+    madvise ((void *) start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
 void
 debug_script (struct change *sp)
 {
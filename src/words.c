@@ -0,0 +1,257 @@
+/* Word-level output routines for GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <xalloc.h>
+
+/* The --word-diff output shows, for each hunk found by comparing
+   lines, the text of the hunk's new lines with the words that the
+   old lines have instead marked as [-deleted-], and the words that
+   the new lines add marked as {+added+}.  Only the lines of the hunk
+   are split into words, and their words are compared with the same
+   algorithm as lines, so the work is proportional to the size of the
+   hunks rather than of the files.  A word is a run of letters, digits,
+   underscores and bytes that are not ASCII, a run of white space
+   other than newlines, or any other single byte.  */
+
+/* Compare the words' equivalence classes with compareseq, noting the
+   words deleted and inserted in the context's CHANGED vectors.  */
+#define ELEMENT lin
+#define EQUAL(x,y) ((x) == (y))
+#define OFFSET lin
+#define EXTRA_CONTEXT_FIELDS \
+  char *changed[2]; \
+  lin cost; \
+  lin budget;
+#define NOTE_DELETE(c, xoff) ((c)->changed[0][xoff] = 1)
+#define NOTE_INSERT(c, yoff) ((c)->changed[1][yoff] = 1)
+#define EARLY_ABORT(c) ((c)->budget < ++(c)->cost)
+#define NOTE_DIAGONALS(c, n) ((c)->cost += (n))
+#define USE_HEURISTIC 1
+#include <diffseq.h>
+
+/* The work allowed for comparing the words of a hunk, per word.  A
+   hunk that would take more is shown as all its old words deleted and
+   all its new words added.  */
+enum { WORD_COST_PER_WORD = 64, WORD_COST_MINIMUM = 4096 };
+
+/* The words of one side of a hunk.  */
+struct words
+{
+  /* The start of each word, and the end of the last.  */
+  char const **start;
+
+  /* The equivalence class of each word.  */
+  lin *class;
+
+  /* Whether each word was deleted or inserted.  */
+  char *changed;
+
+  lin count;
+};
+
+static void print_word_diff_hunk (struct change *);
+
+/* Whether the output so far ends in a newline.  */
+static bool at_line_start;
+
+/* Print the edit script SCRIPT as word differences.  */
+
+void
+print_word_diff_script (struct change *script)
+{
+  at_line_start = true;
+  print_script (script, find_change, print_word_diff_hunk);
+}
+
+/* Return the kind of the byte C: 0 for a newline, 1 for other white
+   space, 2 for a byte of a word, and 3 for a byte that is a word by
+   itself.  */
+
+static int
+byte_kind (unsigned char c)
+{
+  if (c == '\n')
+    return 0;
+  if (isspace (c))
+    return 1;
+  if (isalnum (c) || c == '_' || 0x80 <= c)
+    return 2;
+  return 3;
+}
+
+/* Split the text from P to LIM into words, storing them into *W.  */
+
+static void
+split_words (struct words *w, char const *p, char const *lim)
+{
+  lin n = 0;
+  size_t alloc = lim - p + 1;
+
+  w->start = xnmalloc (alloc, sizeof *w->start);
+  w->class = xnmalloc (alloc, sizeof *w->class);
+  w->changed = xzalloc (alloc);
+
+  while (p < lim)
+    {
+      char const *q = p;
+      int kind = byte_kind (*q++);
+      if (kind == 1 || kind == 2)
+	while (q < lim && byte_kind (*q) == kind)
+	  q++;
+      w->start[n] = p;
+      w->class[n] = (kind == 1 && ignore_white_space != IGNORE_NO_WHITE_SPACE
+		     ? token_class (" ", 1)
+		     : token_class (p, q - p));
+      n++;
+      p = q;
+    }
+
+  w->start[n] = lim;
+  w->count = n;
+}
+
+static void
+free_words (struct words *w)
+{
+  free (w->start);
+  free (w->class);
+  free (w->changed);
+}
+
+/* Output the text from P to LIM between OPEN and CLOSE, closing and
+   opening them again around each newline, so that each line of
+   output stands on its own.  */
+
+static void
+print_marked (char const *open, char const *close,
+	      char const *p, char const *lim)
+{
+  FILE *out = outfile;
+
+  while (p < lim)
+    {
+      char const *nl = memchr (p, '\n', lim - p);
+      char const *end = nl ? nl : lim;
+      if (p < end)
+	{
+	  fputs (open, out);
+	  fwrite (p, 1, end - p, out);
+	  fputs (close, out);
+	  at_line_start = false;
+	}
+      if (! nl)
+	break;
+      putc ('\n', out);
+      at_line_start = true;
+      p = nl + 1;
+    }
+}
+
+/* Print a hunk of --word-diff output: the range of lines, as in a
+   normal diff, and then the text of the hunk's lines with the words
+   that differ marked.  */
+
+static void
+print_word_diff_hunk (struct change *hunk)
+{
+  lin first0, last0, first1, last1;
+  struct words w[2];
+  struct context ctxt;
+  lin diags;
+  lin i, j;
+  enum changes changes = analyze_hunk (hunk, &first0, &last0,
+				       &first1, &last1);
+  if (!changes)
+    return;
+
+  begin_output ();
+
+  print_number_range (',', &files[0], first0, last0);
+  fputc (change_letter[changes], outfile);
+  print_number_range (',', &files[1], first1, last1);
+  fputc ('\n', outfile);
+  at_line_start = true;
+
+  reset_token_classes ();
+  split_words (&w[0], files[0].linbuf[first0], files[0].linbuf[last0 + 1]);
+  split_words (&w[1], files[1].linbuf[first1], files[1].linbuf[last1 + 1]);
+
+  ctxt.xvec = w[0].class;
+  ctxt.yvec = w[1].class;
+  ctxt.changed[0] = w[0].changed;
+  ctxt.changed[1] = w[1].changed;
+  ctxt.cost = 0;
+  ctxt.budget = (MAX (WORD_COST_MINIMUM,
+		      WORD_COST_PER_WORD * (w[0].count + w[1].count)));
+  diags = w[0].count + w[1].count + 3;
+  ctxt.fdiag = xnmalloc (diags, 2 * sizeof *ctxt.fdiag);
+  ctxt.bdiag = ctxt.fdiag + diags;
+  ctxt.fdiag += w[1].count + 1;
+  ctxt.bdiag += w[1].count + 1;
+  ctxt.heuristic = true;
+  ctxt.too_expensive = 256;
+
+  if (compareseq (0, w[0].count, 0, w[1].count, false, &ctxt))
+    {
+      memset (w[0].changed, 1, w[0].count);
+      memset (w[1].changed, 1, w[1].count);
+    }
+  free (ctxt.fdiag - (w[1].count + 1));
+
+  /* Output the runs of deleted words before the inserted words that
+     take their place, and the words in common once.  */
+  i = j = 0;
+  while (i < w[0].count || j < w[1].count)
+    {
+      if (i < w[0].count && w[0].changed[i])
+	{
+	  lin a = i;
+	  while (i < w[0].count && w[0].changed[i])
+	    i++;
+	  print_marked ("[-", "-]", w[0].start[a], w[0].start[i]);
+	}
+      else if (j < w[1].count && w[1].changed[j])
+	{
+	  lin a = j;
+	  while (j < w[1].count && w[1].changed[j])
+	    j++;
+	  print_marked ("{+", "+}", w[1].start[a], w[1].start[j]);
+	}
+      else
+	{
+	  char const *p = w[1].start[j];
+	  size_t len = w[1].start[j + 1] - p;
+	  fwrite (p, 1, len, outfile);
+	  at_line_start = p[len - 1] == '\n';
+	  i++;
+	  j++;
+	}
+    }
+
+  /* The last line of a file may lack a newline.  */
+  if (! at_line_start)
+    {
+      putc ('\n', outfile);
+      at_line_start = true;
+    }
+
+  for (i = 0; i < 2; i++)
+    free_words (&w[i]);
+}
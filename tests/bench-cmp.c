@@ -0,0 +1,245 @@
+/* Measure how close cmp's inner loops come to the limits of the host.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Usage: bench-cmp FILE [BUF_SIZE]...
+
+   For each buffer size, which may have a suffix such as K or M
+   (default 4K 16K 64K 128K 256K 1M 4M), measure in megabytes per
+   second how fast cmp's stages go, and how fast the nearest thing
+   the C library and the kernel offer goes:
+
+     read	  block_read reading FILE into cmp's buffer, a buffer at a time
+     raw_read	  the same with plain read, at the buffer size that is fastest
+     compare	  block_compare finding that both buffers are the same
+     memcmp	  memcmp doing the same
+     newlines	  count_newlines counting the newlines in a buffer
+     memchr	  memchr scanning a buffer for a byte that is not there
+
+   and, as read%, cmp% and nl%, what percentage of its limit
+   each stage reaches.  The buffers hold the start of FILE, which
+   should be text and, for the read figures to be of the page cache
+   rather than the disk, small enough to stay cached.  cmp's own
+   buffer size is the least common multiple of the files' block sizes,
+   which 'stat -c %o' shows.
+
+   cmp's functions are all static, so cmp.c is included here with its
+   main renamed.  Build and run this with 'make bench-cmp'.  */
+
+#define main cmp_main
+#include "cmp.c"
+#undef main
+
+#include <timespec.h>
+
+/* Time each stage over at least this many nanoseconds.  */
+enum { MIN_NSECS = 250 * 1000 * 1000 };
+
+/* The file to read.  */
+static int bench_desc;
+
+/* A stage of cmp, or its limit, applied to a buffer of SIZE bytes;
+   return the number of bytes processed.  */
+typedef size_t (*stage) (size_t size);
+
+static size_t
+read_stage (size_t size)
+{
+  size_t done = 0;
+  size_t r;
+  if (lseek (bench_desc, 0, SEEK_SET) != 0)
+    error (EXIT_TROUBLE, errno, "lseek");
+  while ((r = block_read (bench_desc, (char *) buffer[0], size)) != 0)
+    {
+      if (r == SIZE_MAX)
+	error (EXIT_TROUBLE, errno, "read");
+      done += r;
+      if (r < size)
+	break;
+    }
+  return done;
+}
+
+static size_t
+raw_read_stage (size_t size)
+{
+  size_t done = 0;
+  ssize_t r;
+  if (lseek (bench_desc, 0, SEEK_SET) != 0)
+    error (EXIT_TROUBLE, errno, "lseek");
+  while ((r = read (bench_desc, buffer[0], size)) != 0)
+    {
+      if (r < 0)
+	error (EXIT_TROUBLE, errno, "read");
+      done += r;
+    }
+  return done;
+}
+
+/* The buffers that the in-memory stages work on, and their results,
+   volatile so that the compiler cannot reuse one call's result for
+   the next.  */
+static word *volatile bench_buffer[2];
+static size_t volatile sink;
+
+static size_t
+compare_stage (size_t size)
+{
+  sink = block_compare (bench_buffer[0], bench_buffer[1]);
+  return size;
+}
+
+static size_t
+memcmp_stage (size_t size)
+{
+  sink = memcmp (bench_buffer[0], bench_buffer[1], size);
+  return size;
+}
+
+static size_t
+newlines_stage (size_t size)
+{
+  sink = count_newlines ((char const *) bench_buffer[0], size);
+  return size;
+}
+
+static size_t
+memchr_stage (size_t size)
+{
+  sink = memchr (bench_buffer[0], '\0', size) != NULL;
+  return size;
+}
+
+/* Return the megabytes per second at which STAGE processes buffers of
+   SIZE bytes.  */
+
+static double
+rate (stage f, size_t size)
+{
+  struct timespec start, now;
+  double bytes = 0;
+  double nsecs;
+
+  f (size);
+  gettime (&start);
+  do
+    {
+      int i;
+      for (i = 0; i < 16; i++)
+	bytes += f (size);
+      gettime (&now);
+      nsecs = ((now.tv_sec - start.tv_sec) * 1e9
+	       + (now.tv_nsec - start.tv_nsec));
+    }
+  while (nsecs < MIN_NSECS);
+  return bytes / nsecs * 1e9 / (1024 * 1024);
+}
+
+/* Fill both buffers, of SIZE bytes, with the start of the file,
+   repeated if it is smaller, followed by sentinels that differ.  */
+
+static void
+fill_buffers (size_t size)
+{
+  char *b0 = (char *) buffer[0];
+  char *b1 = (char *) buffer[1];
+  size_t filled = 0;
+
+  while (filled < size)
+    {
+      size_t r = pread (bench_desc, b0 + filled, size - filled, 0);
+      if (r == (size_t) -1 || r == 0)
+	error (EXIT_TROUBLE, r ? errno : 0, "%s", file[0]);
+      filled += r;
+    }
+  memcpy (b1, b0, size);
+  memset (b0 + size, 0, sizeof (word));
+  memset (b1 + size, 1, sizeof (word));
+  bench_buffer[0] = buffer[0];
+  bench_buffer[1] = buffer[1];
+}
+
+int
+main (int argc, char **argv)
+{
+  static char const *const default_sizes[] =
+    { "4K", "16K", "64K", "128K", "256K", "1M", "4M" };
+  int nsizes = argc < 3 ? sizeof default_sizes / sizeof *default_sizes
+		: argc - 2;
+  size_t *size;
+  size_t max_size = 0;
+  double raw_read = 0;
+  int i;
+
+  set_program_name (argv[0]);
+  if (argc < 2)
+    {
+      fprintf (stderr, "Usage: %s FILE [BUF_SIZE]...\n", argv[0]);
+      return EXIT_TROUBLE;
+    }
+
+  file[0] = argv[1];
+  bench_desc = open (file[0], O_RDONLY | O_BINARY);
+  if (bench_desc < 0 || fstat (bench_desc, &stat_buf[0]) != 0)
+    error (EXIT_TROUBLE, errno, "%s", file[0]);
+  if (stat_buf[0].st_size == 0)
+    error (EXIT_TROUBLE, 0, "%s: empty file", file[0]);
+
+  size = xnmalloc (nsizes, sizeof *size);
+  for (i = 0; i < nsizes; i++)
+    {
+      char const *arg = argc < 3 ? default_sizes[i] : argv[i + 2];
+      uintmax_t n;
+      if (xstrtoumax (arg, 0, 0, &n, valid_suffixes) != LONGINT_OK
+	  || n == 0 || PTRDIFF_MAX / 2 - sizeof (word) < n)
+	error (EXIT_TROUBLE, 0, "invalid buffer size '%s'", arg);
+      size[i] = n;
+      max_size = MAX (max_size, n);
+    }
+
+  /* Allocate buffers big enough for every size, so that each size is
+     measured with the same memory.  */
+  buf_size = max_size;
+  allocate_buffers ();
+
+  /* The fastest that plain read goes at any of the sizes is the limit
+     that block_read is judged against.  */
+  for (i = 0; i < nsizes; i++)
+    raw_read = MAX (raw_read, rate (raw_read_stage, size[i]));
+
+  printf ("%-10s %9s %9s %6s %9s %9s %6s %9s %9s %6s\n",
+	  "buf_size", "read", "raw_read", "read%", "compare", "memcmp",
+	  "cmp%", "newlines", "memchr", "nl%");
+  for (i = 0; i < nsizes; i++)
+    {
+      double r, c, m, n, s;
+      r = rate (read_stage, size[i]);
+      fill_buffers (size[i]);
+      c = rate (compare_stage, size[i]);
+      m = rate (memcmp_stage, size[i]);
+      n = rate (newlines_stage, size[i]);
+      s = rate (memchr_stage, size[i]);
+      printf (("%-10lu %9.0f %9.0f %6.1f %9.0f %9.0f %6.1f"
+	       " %9.0f %9.0f %6.1f\n"),
+	      (unsigned long int) size[i], r, raw_read, 100 * r / raw_read,
+	      c, m, 100 * c / m, n, s, 100 * n / s);
+    }
+
+  free (size);
+  return EXIT_SUCCESS;
+}
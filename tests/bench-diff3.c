@@ -0,0 +1,273 @@
+/* Measure how fast diff3 merges, and where its time goes.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Usage: bench-diff3 RUNS LINES/CONFLICTS...
+
+   For each LINES/CONFLICTS, generate an OLDFILE of LINES lines, and a
+   MYFILE and YOURFILE that each change one line in EDIT_EVERY.
+   CONFLICTS percent of YOURFILE's changes are to the lines that
+   MYFILE changes, and conflict; the rest are to lines halfway between.
+   Then merge the three files RUNS times with each of -m, -e and -3,
+   comparing the pairs of files with diff's engine as diff3 does by
+   default (VIA "engine"), and with diff run in child processes as
+   --diff-program=diff does (VIA "program"), and report:
+
+     MERGES/S	merges per second
+     DIFF_MS	milliseconds per merge spent comparing MYFILE and YOURFILE
+		to OLDFILE, including waiting for child processes
+     MERGE_MS	milliseconds per merge spent by make_3way_diff
+     OUTPUT_MS	milliseconds per merge spent outputting the result
+     PEAK_KB	the most memory that a merge's process used, in KiB
+     CHILD_KB	the most that any child process it waited for used
+
+   Each merge runs in a process of its own, as diff3 does, so that
+   its peak memory is its own; the time to start it is not counted.
+   diff3's functions are all static, so diff3.c is included here with
+   its main renamed.  Build and run this with 'make bench-diff3'.  */
+
+#define main diff3_main
+#include "diff3.c"
+#undef main
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <timespec.h>
+#include <xvasprintf.h>
+
+/* How many lines apart each file's changes are.  */
+enum { EDIT_EVERY = 100 };
+
+/* The phases of a merge that are timed.  */
+enum { PHASE_DIFF, PHASE_MERGE, PHASE_OUTPUT, PHASES };
+
+/* What a merge reports to the parent.  */
+struct result
+{
+  double secs[PHASES];
+  long int peak_kb;
+  long int child_kb;
+};
+
+/* The output styles measured, as options of diff3.  */
+static char const *const style[] = { "-m", "-e", "-3" };
+
+/* Return the seconds since START.  */
+static double
+since (struct timespec start)
+{
+  struct timespec now;
+  gettime (&now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Write the file NAME of LINES lines, in which line I is changed
+   if WHICH changes it: 0 for OLDFILE, 1 for MYFILE, 2 for YOURFILE,
+   of which CONFLICTS percent of the changes conflict with MYFILE's.  */
+static void
+generate (char const *name, long int lines, int which, int conflicts)
+{
+  FILE *f = fopen (name, "w");
+  long int i;
+
+  if (! f)
+    error (EXIT_TROUBLE, errno, "%s", name);
+  for (i = 0; i < lines; i++)
+    {
+      long int edit = i / EDIT_EVERY;
+      bool conflicting = (edit * conflicts / 100
+			  != (edit + 1) * conflicts / 100);
+      bool changed = (which == 1
+		      ? i % EDIT_EVERY == 0
+		      : which == 2
+		      && i % EDIT_EVERY == (conflicting ? 0 : EDIT_EVERY / 2));
+      if (changed)
+	fprintf (f, "line %ld as changed in file %d\n", i, which);
+      else
+	fprintf (f, "line %ld of the input, with\ta tab and some words\n", i);
+    }
+  if (ferror (f) | (fclose (f) != 0))
+    error (EXIT_TROUBLE, errno, "%s", name);
+}
+
+/* Merge the files NAME, in diff3's order MYFILE OLDFILE YOURFILE, in
+   the output style STYLE, using diff in child processes if PROGRAM,
+   and report to the pipe OUT.  This runs in a child process.  */
+static void
+merge_once (char *const name[3], char const *style, bool program, int out)
+{
+  static int const mapping[3] = { 0, 2, 1 };
+  static int const rev_mapping[3] = { 0, 2, 1 };
+  char const *pair[3];
+  struct diff_block *thread[2];
+  struct diff3_block *diff3;
+  struct result r;
+  struct rusage usage;
+  struct timespec start;
+  lin nblocks;
+  FILE *sink;
+  int i;
+
+  merge = style[1] == 'm';
+  flagging = show_2nd = merge;
+  edscript = ! merge;
+  simple_only = style[1] == '3';
+  diff_program = program ? "diff" : NULL;
+  sink = fopen ("/dev/null", "w");
+  if (! sink)
+    error (EXIT_TROUBLE, errno, "/dev/null");
+
+  for (i = 0; i < 3; i++)
+    pair[i] = name[rev_mapping[i]];
+  gettime (&start);
+  diff_with_common (pair, thread);
+  r.secs[PHASE_DIFF] = since (start);
+
+  gettime (&start);
+  diff3 = make_3way_diff (thread[0], thread[1], false, &nblocks);
+  r.secs[PHASE_MERGE] = since (start);
+
+  gettime (&start);
+  if (merge)
+    {
+      FILE *in = fopen (name[0], "r");
+      if (! in)
+	error (EXIT_TROUBLE, errno, "%s", name[0]);
+      output_diff3_merge (in, sink, diff3, nblocks, mapping, rev_mapping,
+			  name[0], name[1], name[2]);
+    }
+  else
+    output_diff3_edscript (sink, diff3, nblocks, mapping, rev_mapping,
+			   name[0], name[1], name[2]);
+  if (fflush (sink) != 0)
+    error (EXIT_TROUBLE, errno, "/dev/null");
+  r.secs[PHASE_OUTPUT] = since (start);
+
+  getrusage (RUSAGE_SELF, &usage);
+  r.peak_kb = usage.ru_maxrss;
+  getrusage (RUSAGE_CHILDREN, &usage);
+  r.child_kb = usage.ru_maxrss;
+  if (write (out, &r, sizeof r) != sizeof r)
+    _exit (EXIT_TROUBLE);
+  _exit (EXIT_SUCCESS);
+}
+
+/* Merge the files NAME RUNS times as merge_once does, and report the
+   mean times and the peak memory.  */
+static void
+bench (char *const name[3], long int lines, int conflicts, int runs,
+       char const *style, bool program)
+{
+  double secs[PHASES] = { 0 };
+  long int peak_kb = 0, child_kb = 0;
+  double total;
+  int run, i;
+
+  for (run = 0; run < runs; run++)
+    {
+      struct result r;
+      int fd[2], status;
+      pid_t pid;
+
+      if (pipe (fd) != 0)
+	error (EXIT_TROUBLE, errno, "pipe");
+      pid = fork ();
+      if (pid < 0)
+	error (EXIT_TROUBLE, errno, "fork");
+      if (pid == 0)
+	{
+	  close (fd[0]);
+	  merge_once (name, style, program, fd[1]);
+	}
+      close (fd[1]);
+      if (read (fd[0], &r, sizeof r) != sizeof r
+	  || waitpid (pid, &status, 0) != pid
+	  || ! WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS)
+	error (EXIT_TROUBLE, 0, "a merge failed");
+      close (fd[0]);
+
+      for (i = 0; i < PHASES; i++)
+	secs[i] += r.secs[i];
+      peak_kb = MAX (peak_kb, r.peak_kb);
+      child_kb = MAX (child_kb, r.child_kb);
+    }
+
+  total = 0;
+  for (i = 0; i < PHASES; i++)
+    total += secs[i];
+  printf ("%9ld %5d%% %-5s %-7s %10.1f %9.2f %9.2f %9.2f %9ld %9ld\n",
+	  lines, conflicts, style, program ? "program" : "engine",
+	  total ? runs / total : 0,
+	  secs[PHASE_DIFF] * 1000 / runs, secs[PHASE_MERGE] * 1000 / runs,
+	  secs[PHASE_OUTPUT] * 1000 / runs, peak_kb, child_kb);
+  fflush (stdout);
+}
+
+int
+main (int argc, char **argv)
+{
+  char const *tmpdir = getenv ("TMPDIR");
+  char *dir;
+  char *name[3];
+  int runs, arg, i;
+
+  set_program_name (argv[0]);
+  if (argc < 3 || (runs = atoi (argv[1])) <= 0)
+    error (EXIT_TROUBLE, 0, "usage: %s RUNS LINES/CONFLICTS...", argv[0]);
+
+#ifdef SIGCHLD
+  signal (SIGCHLD, SIG_DFL);
+#endif
+
+  dir = xasprintf ("%s/bench-diff3.%ld", tmpdir ? tmpdir : "/tmp",
+		   (long int) getpid ());
+  if (mkdir (dir, S_IRWXU) != 0)
+    error (EXIT_TROUBLE, errno, "%s", dir);
+  name[0] = xasprintf ("%s/mine", dir);
+  name[1] = xasprintf ("%s/older", dir);
+  name[2] = xasprintf ("%s/yours", dir);
+
+  printf ("%9s %6s %-5s %-7s %10s %9s %9s %9s %9s %9s\n",
+	  "LINES", "CONFL", "STYLE", "VIA", "MERGES/S", "DIFF_MS",
+	  "MERGE_MS", "OUTPUT_MS", "PEAK_KB", "CHILD_KB");
+
+  for (arg = 2; arg < argc; arg++)
+    {
+      long int lines;
+      int conflicts;
+      char slash;
+
+      if (sscanf (argv[arg], "%ld%c%d", &lines, &slash, &conflicts) != 3
+	  || slash != '/' || lines < 0 || conflicts < 0 || 100 < conflicts)
+	error (EXIT_TROUBLE, 0, "%s: not LINES/CONFLICTS", argv[arg]);
+
+      generate (name[0], lines, 1, conflicts);
+      generate (name[1], lines, 0, conflicts);
+      generate (name[2], lines, 2, conflicts);
+      for (i = 0; i < sizeof style / sizeof *style; i++)
+	{
+	  bench (name, lines, conflicts, runs, style[i], false);
+	  bench (name, lines, conflicts, runs, style[i], true);
+	}
+    }
+
+  for (i = 0; i < 3; i++)
+    unlink (name[i]);
+  rmdir (dir);
+  return EXIT_SUCCESS;
+}
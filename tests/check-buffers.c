@@ -0,0 +1,124 @@
+/* Output the hunks that engine_compare_buffers finds.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Usage: check-buffers OPTIONS FILE0 FILE1
+
+   Read FILE0 and FILE1 into memory, compare them with
+   engine_compare_buffers with the options among -i, -b, -w, -E, -Z,
+   -B and -d that OPTIONS has, such as "-ib" or "-", and output the
+   hunks as the lines of normal-format 'diff' output that start them,
+   such as "3,4c3".  Exit with status 0 if there are no hunks and 1
+   otherwise, as 'diff' would.  The test engine-buffers compares the
+   output with that of 'diff'.  */
+
+#include "system.h"
+#include "engine.h"
+
+#include <stdio.h>
+#include <xalloc.h>
+
+/* Read the file NAME into memory, storing its size into *SIZE, and
+   return its contents.  Exit if it cannot be read.  */
+static char *
+read_file (char const *name, size_t *size)
+{
+  FILE *fp = fopen (name, "rb");
+  char *buf = NULL;
+  size_t alloc = 0;
+  size_t n;
+
+  *size = 0;
+  if (! fp)
+    {
+      perror (name);
+      exit (EXIT_TROUBLE);
+    }
+  do
+    {
+      if (*size == alloc)
+	buf = x2realloc (buf, &alloc);
+      n = fread (buf + *size, 1, alloc - *size, fp);
+      *size += n;
+    }
+  while (n);
+  if (ferror (fp) || fclose (fp) != 0)
+    {
+      perror (name);
+      exit (EXIT_TROUBLE);
+    }
+  return buf;
+}
+
+/* Output the line numbers FIRST through LAST as 'diff' would.  */
+static void
+print_range (lin first, lin last)
+{
+  if (first < last)
+    printf ("%ld,%ld", (long int) first, (long int) last);
+  else
+    printf ("%ld", (long int) last);
+}
+
+int
+main (int argc, char **argv)
+{
+  struct engine_options options;
+  struct engine_context *ctx;
+  struct engine_hunk *hunks;
+  struct engine_hunk const *h;
+  char *text[2];
+  size_t size[2];
+  int f;
+  int changes;
+
+  if (argc != 4)
+    {
+      fprintf (stderr, "usage: %s OPTIONS FILE0 FILE1\n", argv[0]);
+      return EXIT_TROUBLE;
+    }
+  for (f = 0; f < 2; f++)
+    text[f] = read_file (argv[2 + f], &size[f]);
+
+  memset (&options, 0, sizeof options);
+  options.text = true;
+  options.ignore_case = !!strchr (argv[1], 'i');
+  options.ignore_space_change = !!strchr (argv[1], 'b');
+  options.ignore_all_space = !!strchr (argv[1], 'w');
+  options.ignore_tab_expansion = !!strchr (argv[1], 'E');
+  options.ignore_trailing_space = !!strchr (argv[1], 'Z');
+  options.ignore_blank_lines = !!strchr (argv[1], 'B');
+  options.minimal = !!strchr (argv[1], 'd');
+  ctx = engine_context_new (&options);
+
+  changes = engine_compare_buffers (ctx, text[0], size[0], text[1], size[1],
+				    &hunks);
+  for (h = hunks; h; h = h->next)
+    {
+      print_range (h->first[0], h->last[0]);
+      putchar (h->first[0] > h->last[0] ? 'a'
+	       : h->first[1] > h->last[1] ? 'd' : 'c');
+      print_range (h->first[1], h->last[1]);
+      putchar ('\n');
+    }
+
+  engine_context_free (ctx);
+  for (f = 0; f < 2; f++)
+    free (text[f]);
+  return changes;
+}
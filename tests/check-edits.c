@@ -0,0 +1,248 @@
+/* Check engine_replace_lines on random edits.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Usage: check-edits [SEED [ROUNDS]]
+
+   For each of ROUNDS rounds, compare two short random texts with
+   engine_compare_text, then make a few random edits to the second
+   with engine_replace_lines.  After each edit, check that applying
+   the hunks it returns to the first text gives the second text as
+   edited, byte for byte, and that the hunks are numbered as the lines
+   they apply to.  The texts have few distinct lines, so that they have
+   many lines in common, and may end without a newline.  On a failure,
+   output the texts and the edit and exit with status 1.  Build and
+   run this with 'make check TESTS=engine-edits'.  */
+
+#include "system.h"
+#include "engine.h"
+
+#include <stdio.h>
+#include <xalloc.h>
+
+/* The most lines in a random text, and in the text of an edit.  */
+enum { MAX_LINES = 8, MAX_EDIT_LINES = 3 };
+
+/* The lines that random texts are made of.  */
+static char const *const line_text[] = { "a", "b", "c", "" };
+
+/* The seed of the random numbers.  */
+static unsigned long int seed;
+
+/* Return a random number less than N.  */
+static int
+rnd (int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+/* Store into BUF a random text of up to MAX lines, whose last line
+   may lack a newline, and return its size.  */
+static size_t
+random_text (char *buf, int max)
+{
+  int lines = rnd (max + 1);
+  size_t size = 0;
+  int i;
+
+  for (i = 0; i < lines; i++)
+    {
+      char const *t = line_text[rnd (sizeof line_text / sizeof *line_text)];
+      size_t len = strlen (t);
+      memcpy (buf + size, t, len);
+      buf[size + len] = '\n';
+      size += len + 1;
+    }
+  if (1 < size && buf[size - 2] != '\n' && rnd (3) == 0)
+    size--;
+  return size;
+}
+
+/* Return the number of lines in the SIZE bytes at TEXT, and store the
+   offset of the start of each line, and of the end of the text, into
+   START.  */
+static int
+split (char const *text, size_t size, size_t *start)
+{
+  int n = 0;
+  size_t i;
+
+  start[0] = 0;
+  for (i = 0; i < size; i++)
+    if (text[i] == '\n' || i + 1 == size)
+      start[++n] = i + 1;
+  return n;
+}
+
+/* Output the SIZE bytes at TEXT to standard error, labeled LABEL.  */
+static void
+show (char const *label, char const *text, size_t size)
+{
+  fprintf (stderr, "%s: \"", label);
+  fwrite (text, 1, size, stderr);
+  fprintf (stderr, "\"\n");
+}
+
+/* Apply HUNKS to the SIZE0 bytes at TEXT0, storing the result into
+   OUT, and return its size, or -1 if the hunks are out of order or
+   misnumbered.  */
+static long int
+apply (char const *text0, size_t size0, struct engine_hunk const *hunks,
+       char *out)
+{
+  size_t start[MAX_LINES + 2];
+  int n0 = split (text0, size0, start);
+  int line0 = 0;
+  int line1 = 0;
+  size_t size = 0;
+  struct engine_hunk const *h;
+
+  for (h = hunks; h; h = h->next)
+    {
+      int lines1 = h->last[1] - h->first[1] + 1;
+      int skip = h->first[0] - 1 - line0;
+      if (skip < 0 || n0 < h->last[0] || h->last[0] < h->first[0] - 1
+	  || lines1 < 0 || line1 + skip != h->first[1] - 1)
+	return -1;
+      memcpy (out + size, text0 + start[line0],
+	      start[line0 + skip] - start[line0]);
+      size += start[line0 + skip] - start[line0];
+      if (lines1)
+	{
+	  size_t n = h->linbuf[1][lines1] - h->linbuf[1][0];
+	  memcpy (out + size, h->linbuf[1][0], n);
+	  size += n;
+	}
+      line0 = h->last[0];
+      line1 = h->last[1];
+    }
+  memcpy (out + size, text0 + start[line0], start[n0] - start[line0]);
+  return size + start[n0] - start[line0];
+}
+
+/* Check that HUNKS and CHANGES, which a comparison of the SIZE0
+   bytes at TEXT0 with the SIZE1 bytes at TEXT1 returned, describe
+   those texts.  If not, output the texts and what the hunks give, and
+   return false.  */
+static bool
+check (char const *text0, size_t size0, char const *text1, size_t size1,
+       struct engine_hunk const *hunks, int changes)
+{
+  char got[4 * MAX_LINES];
+  long int size = apply (text0, size0, hunks, got);
+
+  if (0 <= size && size == size1 && memcmp (got, text1, size1) == 0
+      && changes == !!hunks)
+    return true;
+
+  show ("text0", text0, size0);
+  show ("text1", text1, size1);
+  if (size < 0)
+    fprintf (stderr, "hunks out of order\n");
+  else
+    show ("got", got, size);
+  fprintf (stderr, "changes: %d\n", changes);
+  return false;
+}
+
+int
+main (int argc, char **argv)
+{
+  /* Each line takes at most 2 bytes.  */
+  enum { TEXT_SIZE = 2 * MAX_LINES };
+  char *text0 = xmalloc (TEXT_SIZE + ENGINE_TEXT_ROOM);
+  char *text1 = xmalloc (TEXT_SIZE + ENGINE_TEXT_ROOM);
+  struct engine_options options;
+  struct engine_context *ctx;
+  int rounds;
+  int round;
+
+  seed = 1 < argc ? strtoul (argv[1], NULL, 10) : 1;
+  rounds = 2 < argc ? atoi (argv[2]) : 10000;
+  memset (&options, 0, sizeof options);
+  options.text = true;
+  ctx = engine_context_new (&options);
+
+  for (round = 0; round < rounds; round++)
+    {
+      char text[TEXT_SIZE];
+      size_t size0 = random_text (text0, MAX_LINES);
+      size_t size = random_text (text1, MAX_LINES);
+      struct engine_hunk *hunks;
+      int changes;
+      int edits;
+
+      memcpy (text, text1, size);
+      changes = engine_compare_text (ctx, text0, size0, text1, size, &hunks);
+      if (! check (text0, size0, text, size, hunks, changes))
+	{
+	  fprintf (stderr, "round %d: comparing\n", round);
+	  return EXIT_FAILURE;
+	}
+
+      for (edits = rnd (4); 0 < edits; edits--)
+	{
+	  char txt[2 * MAX_EDIT_LINES];
+	  char edited[TEXT_SIZE];
+	  size_t start[MAX_LINES + 2];
+	  int n1 = split (text, size, start);
+	  int first = rnd (n1 + 1) + 1;
+	  int last = first - 1 + rnd (n1 - first + 2);
+	  size_t txtsize = random_text (txt, MAX_EDIT_LINES);
+	  size_t before = start[first - 1];
+	  size_t after = start[last];
+	  size_t edsize;
+
+	  if (MAX_LINES < n1 - (last - first + 1) + MAX_EDIT_LINES)
+	    break;
+
+	  /* The text as edited: text appended to a last line that
+	     lacks a newline gives that line one, and the new text gets
+	     one if it lacks one and lines follow it.  */
+	  memcpy (edited, text, before);
+	  edsize = before;
+	  if (txtsize && before && edited[before - 1] != '\n')
+	    edited[edsize++] = '\n';
+	  memcpy (edited + edsize, txt, txtsize);
+	  edsize += txtsize;
+	  if (txtsize && txt[txtsize - 1] != '\n' && after < size)
+	    edited[edsize++] = '\n';
+	  memcpy (edited + edsize, text + after, size - after);
+	  edsize += size - after;
+
+	  changes = engine_replace_lines (ctx, first, last, txt, txtsize,
+					  &hunks);
+	  if (! check (text0, size0, edited, edsize, hunks, changes))
+	    {
+	      fprintf (stderr, "round %d: replacing lines %d through %d\n",
+		       round, first, last);
+	      show ("of", text, size);
+	      show ("with", txt, txtsize);
+	      return EXIT_FAILURE;
+	    }
+	  memcpy (text, edited, edsize);
+	  size = edsize;
+	}
+    }
+
+  engine_context_free (ctx);
+  free (text0);
+  free (text1);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+/* Fuzz cmp for slow inputs.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Each input is compared as 'cmp -s' would, or as 'cmp -l' would if
+   its first line has -l, with the output going to the null device.
+   cmp's functions are all static, so cmp.c is included here with its
+   main renamed.  */
+
+#define main cmp_main
+#include "cmp.c"
+#undef main
+
+#include "fuzz.h"
+
+int
+LLVMFuzzerTestOneInput (uint8_t const *data, size_t size)
+{
+  struct fuzz_input in;
+  int f;
+
+  fuzz_split (data, size, 2, &in);
+
+  if (! buffer[0])
+    {
+      if (! freopen ("/dev/null", "w", stdout))
+	abort ();
+      buf_size = 8192;
+      allocate_buffers ();
+    }
+  comparison_type = fuzz_option (&in, 'l') ? type_all_diffs : type_status;
+  for (f = 0; f < 2; f++)
+    {
+      file[f] = fuzz_file (f, in.text[f], in.length[f]);
+      file_desc[f] = fuzz_desc[f];
+      if (fstat (file_desc[f], &stat_buf[f]) != 0)
+	abort ();
+    }
+
+  fuzz_cpu_work ();
+  cmp ();
+  fuzz_cost (size, fuzz_cpu_work ());
+  return 0;
+}
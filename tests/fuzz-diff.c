@@ -0,0 +1,76 @@
+/* Fuzz diff's comparison of two files for slow inputs.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Each input is compared as 'diff -a' would with the options among
+   -i, -b, -w, -E, -Z, -B, -d, -H and -u that its first line has,
+   reading the files with read_files and comparing them with
+   diff_2_files, with the output going to the null device.  */
+
+#include "diff.h"
+#include "engine.h"
+#include "fuzz.h"
+
+int
+LLVMFuzzerTestOneInput (uint8_t const *data, size_t size)
+{
+  struct fuzz_input in;
+  struct engine_options options;
+  struct comparison cmp;
+  static bool initialized;
+  int f;
+
+  fuzz_split (data, size, 2, &in);
+
+  memset (&options, 0, sizeof options);
+  options.text = true;
+  options.ignore_case = fuzz_option (&in, 'i');
+  options.ignore_blank_lines = fuzz_option (&in, 'B');
+  options.ignore_tab_expansion = fuzz_option (&in, 'E');
+  options.ignore_trailing_space = fuzz_option (&in, 'Z');
+  options.ignore_space_change = fuzz_option (&in, 'b');
+  options.ignore_all_space = fuzz_option (&in, 'w');
+  options.minimal = fuzz_option (&in, 'd');
+  options.speed_large_files = fuzz_option (&in, 'H');
+  engine_init (&options);
+  if (fuzz_option (&in, 'u'))
+    {
+      output_style = OUTPUT_UNIFIED;
+      context = 3;
+    }
+  if (! initialized)
+    {
+      if (! freopen ("/dev/null", "w", stdout))
+	abort ();
+      initialized = true;
+    }
+
+  memset (&cmp, 0, sizeof cmp);
+  for (f = 0; f < 2; f++)
+    {
+      cmp.file[f].name = fuzz_file (f, in.text[f], in.length[f]);
+      cmp.file[f].desc = fuzz_desc[f];
+      if (fstat (cmp.file[f].desc, &cmp.file[f].stat) != 0)
+	abort ();
+    }
+
+  memset (&stats, 0, sizeof stats);
+  diff_2_files (&cmp);
+  fuzz_cost (size, stats.diagonals + stats.probes + stats.lines_differ);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/* Fuzz diff3's comparison of three files for slow inputs.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Each input's first and last files are compared with its middle
+   file by process_diff, as 'diff3 -a' would, and the two diffs are
+   combined by make_3way_diff.  diff3's functions are all static, so
+   diff3.c is included here with its main renamed.
+
+   The files' text and the blocks of the diffs are never freed, as
+   diff3 exits once it has output them, so run this with libFuzzer's
+   -detect_leaks=0.  */
+
+#define main diff3_main
+#include "diff3.c"
+#undef main
+
+#include "fuzz.h"
+
+int
+LLVMFuzzerTestOneInput (uint8_t const *data, size_t size)
+{
+  static bool initialized;
+  struct fuzz_input in;
+  struct diff_block *thread0, *thread1, *last_block;
+  lin nblocks;
+  char const *name[3];
+  int f;
+
+  if (! initialized)
+    {
+      struct engine_options options;
+      memset (&options, 0, sizeof options);
+      options.text = text = true;
+      options.horizon_lines = 100;
+      engine_init (&options);
+      initialized = true;
+    }
+
+  fuzz_split (data, size, 3, &in);
+  for (f = 0; f < 3; f++)
+    name[f] = fuzz_file (f, in.text[f], in.length[f]);
+
+  fuzz_cpu_work ();
+  thread0 = process_diff (name[0], name[1], &last_block);
+  thread1 = process_diff (name[2], name[1], &last_block);
+  make_3way_diff (thread0, thread1, false, &nblocks);
+  fuzz_cost (size, fuzz_cpu_work ());
+  return 0;
+}
@@ -0,0 +1,74 @@
+/* Run a fuzzing harness on inputs named on the command line.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Without libFuzzer, link a harness with this to replay inputs, such
+   as those in tests/slow, and output each input's name and the work
+   it took per byte.  The output is to standard error, as the harnesses
+   send standard output to the null device.  */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput (uint8_t const *, size_t);
+extern double fuzz_last_cost;
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      FILE *fp = fopen (argv[i], "rb");
+      uint8_t *data = NULL;
+      size_t size = 0;
+      size_t alloc = 0;
+      size_t n;
+
+      if (! fp)
+	{
+	  perror (argv[i]);
+	  return EXIT_FAILURE;
+	}
+      do
+	{
+	  if (size == alloc)
+	    {
+	      alloc = 2 * alloc + 8192;
+	      data = realloc (data, alloc);
+	      if (! data)
+		abort ();
+	    }
+	  n = fread (data + size, 1, alloc - size, fp);
+	  size += n;
+	}
+      while (n);
+      if (ferror (fp) || fclose (fp) != 0)
+	{
+	  perror (argv[i]);
+	  return EXIT_FAILURE;
+	}
+
+      LLVMFuzzerTestOneInput (data, size);
+      fprintf (stderr, "%s %.3f\n", argv[i], fuzz_last_cost);
+      free (data);
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+/* Common code of the fuzzing harnesses of GNU DIFF.
+
+   Copyright (C) 2015 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* The harnesses fuzz-diff.c, fuzz-diff3.c and fuzz-cmp.c are libFuzzer
+   entry points that look for inputs which are slow rather than ones
+   which crash.  Build them with 'make fuzz' in the tests directory.
+
+   An input is a line of options, such as "-ib" or an empty line,
+   followed by the text of the files, each but the last ended by a
+   line "====".  The option letters are those of diff or cmp, and the
+   others are ignored.  tests/slow-inputs splits inputs in this form
+   the same way.
+
+   After each comparison, the harness passes to fuzz_cost the work
+   that the comparison did: for diff, by the counters of --stats, and
+   for diff3 and cmp, whose option variables keep them from including
+   diff.h, in microseconds of CPU time.  To steer the
+   fuzzer towards slow inputs, fuzz_cost marks one of the counters that
+   libFuzzer treats as coverage for each power of 2 that the work per
+   byte of input reaches, so that an input doing more work per byte
+   than any before counts as new coverage and joins the corpus.  If
+   the environment variable FUZZ_MAX_COST is set, an input doing more
+   than that much work per byte aborts, so that libFuzzer saves it as
+   a crash.  Keep such inputs, once the slowness is fixed, in
+   tests/slow, and their costs in tests/slow/costs.
+
+   Compiled with a C compiler other than clang and with fuzz-main.c,
+   a harness instead runs each of the inputs named on its command line
+   and reports their work.  */
+
+/* Include this after the headers of the program being fuzzed.  */
+
+#include <stdint.h>
+
+/* The line that ends each file of an input but the last.  */
+static char const fuzz_separator[] = "====\n";
+
+/* An input split into options and files.  */
+struct fuzz_input
+{
+  char const *options;
+  size_t options_length;
+  char const *text[3];
+  size_t length[3];
+};
+
+/* Split the SIZE bytes of DATA into IN, with NFILES files.  Files
+   that the input lacks are empty.  */
+
+static void
+fuzz_split (uint8_t const *data, size_t size, int nfiles,
+	    struct fuzz_input *in)
+{
+  char const *p = (char const *) data;
+  char const *lim = p + size;
+  char const *nl = memchr (p, '\n', size);
+  size_t sep = sizeof fuzz_separator - 1;
+  int f;
+
+  in->options = p;
+  in->options_length = nl ? nl - p : size;
+  p = nl ? nl + 1 : lim;
+
+  for (f = 0; f < nfiles; f++)
+    {
+      char const *q = p;
+      if (f < nfiles - 1)
+	while (q < lim
+	       && ! (sep <= lim - q && memcmp (q, fuzz_separator, sep) == 0))
+	  {
+	    q = memchr (q, '\n', lim - q);
+	    q = q ? q + 1 : lim;
+	  }
+      else
+	q = lim;
+      in->text[f] = p;
+      in->length[f] = q - p;
+      p = q < lim ? q + sep : lim;
+    }
+}
+
+/* Return true if the options of IN include the letter C.  */
+
+static bool _GL_UNUSED
+fuzz_option (struct fuzz_input const *in, char c)
+{
+  return memchr (in->options, c, in->options_length) != NULL;
+}
+
+/* The names and descriptors of the temporary files that hold the
+   files of an input.  */
+static char fuzz_name[3][32];
+static int fuzz_desc[3] = { -1, -1, -1 };
+
+static void
+fuzz_remove_files (void)
+{
+  int f;
+  for (f = 0; f < 3; f++)
+    if (0 <= fuzz_desc[f])
+      unlink (fuzz_name[f]);
+}
+
+/* Put the LENGTH bytes at TEXT into temporary file F, and return its
+   name, with the file open and positioned at its start.  */
+
+static char const *
+fuzz_file (int f, char const *text, size_t length)
+{
+  if (fuzz_desc[f] < 0)
+    {
+      if (f == 0)
+	atexit (fuzz_remove_files);
+      sprintf (fuzz_name[f], "/tmp/fuzz-%d-XXXXXX", f);
+      fuzz_desc[f] = mkstemp (fuzz_name[f]);
+      if (fuzz_desc[f] < 0)
+	abort ();
+    }
+  if (ftruncate (fuzz_desc[f], 0) != 0
+      || (length
+	  && pwrite (fuzz_desc[f], text, length, 0) != (ssize_t) length)
+      || lseek (fuzz_desc[f], 0, SEEK_SET) != 0)
+    abort ();
+  return fuzz_name[f];
+}
+
+#ifdef __clang__
+/* Counters that libFuzzer treats as coverage, one for each power of 2
+   of the work per byte.  */
+__attribute__ ((section ("__libfuzzer_extra_counters")))
+static uint8_t fuzz_cost_counter[64];
+#endif
+
+/* The work per byte that fuzz_cost last found, for fuzz-main.c.  */
+double fuzz_last_cost;
+
+/* The CPU time, in microseconds, since the last call.  */
+
+static uintmax_t _GL_UNUSED
+fuzz_cpu_work (void)
+{
+  static clock_t last;
+  clock_t now = clock ();
+  uintmax_t work = (double) (now - last) * 1000000 / CLOCKS_PER_SEC;
+  last = now;
+  return work;
+}
+
+/* Note that an input of SIZE bytes did WORK.  */
+
+static void
+fuzz_cost (size_t size, uintmax_t work)
+{
+  double cost = (double) work / (size + 1);
+  char const *max = getenv ("FUZZ_MAX_COST");
+  double limit;
+  int bits;
+
+  for (bits = 0, limit = 1; bits < 63 && limit <= cost; bits++, limit *= 2)
+    continue;
+#ifdef __clang__
+  fuzz_cost_counter[bits] = 1;
+#endif
+  fuzz_last_cost = cost;
+  if (max && strtod (max, NULL) < cost)
+    abort ();
+}
+
+int LLVMFuzzerTestOneInput (uint8_t const *, size_t);
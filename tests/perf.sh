@@ -0,0 +1,89 @@
+# Helpers for the perf-* tests, which fail if diff's performance in a
+# key scenario regresses beyond a tolerance.  Source this after init.sh,
+# as "$abs_srcdir/perf.sh", since init.sh changes to a new directory.
+#
+# The work that diff does is judged by the counters of --stats=json,
+# such as the lines it hashed and the diagonals its search for changes
+# extended.  For given input these are the same on every host and every
+# run, so each test compares them with golden values recorded when the
+# test was written, and a regression shows up however busy the host is.
+# When a change to diff legitimately alters a counter, update its
+# golden value.
+#
+# By default the scenarios are small enough for 'make check'.  With
+# RUN_EXPENSIVE_TESTS=yes they are full size (gigabyte files, a million
+# lines, a hundred thousand files), and diff's wall-clock time is also
+# checked, against that of a simpler command doing comparable I/O on the
+# same files.
+#
+# PERF_TOLERANCE is the percentage by which a counter may exceed its
+# golden value (default 25), and PERF_TIME_FACTOR how many times
+# slower than the baseline command diff may be (default 4).
+
+: ${PERF_TOLERANCE=25}
+: ${PERF_TIME_FACTOR=4}
+
+if test "$RUN_EXPENSIVE_TESTS" = yes; then
+  perf_full=:
+else
+  perf_full=false
+fi
+
+# Output $1 lines of a pseudo-random word and a number that repeats
+# every thousand lines, from a Park-Miller generator seeded with $2, as
+# in the 'bench' script.  The same on every host.
+perf_lines_ ()
+{
+  awk -v n=$1 -v seed=$2 'BEGIN {
+    for (i = 0; i < n; i++) {
+      seed = seed * 16807 % 2147483647
+      printf "w%d %d\n", seed % 10000, i % 1000
+    }
+  }'
+}
+
+# Output the counter $1 from the diff --stats=json report in the file $2.
+perf_counter_ ()
+{
+  sed -n 's/.*"'$1'":\([0-9]*\).*/\1/p' "$2"
+}
+
+# Fail unless the counter $1 of the report in $2 is at most the golden
+# value $3, give or take PERF_TOLERANCE percent.
+perf_at_most_ ()
+{
+  perf_value=$(perf_counter_ $1 "$2")
+  test -n "$perf_value" || framework_failure_
+  if awk -v v=$perf_value -v g=$3 -v t=$PERF_TOLERANCE \
+       'BEGIN { exit ! (v > g * (1 + t / 100)) }'; then
+    echo "$1 is $perf_value, above the golden $3 plus $PERF_TOLERANCE%" >&2
+    fail=1
+  fi
+}
+
+# Output the seconds that the command "$@" takes, with its output
+# discarded, or nothing if 'date' cannot time it to better than a second.
+perf_time_ ()
+{
+  perf_start=$(date +%s.%N)
+  "$@" > /dev/null 2>&1
+  perf_end=$(date +%s.%N)
+  case $perf_start$perf_end in
+    *N*) ;;
+    *) echo "$perf_start $perf_end" | awk '{ print $2 - $1 }' ;;
+  esac
+}
+
+# With RUN_EXPENSIVE_TESTS=yes, fail if the seconds $1 that diff took
+# exceed PERF_TIME_FACTOR times the seconds $2 of the baseline command,
+# plus a second for noise.
+perf_time_at_most_ ()
+{
+  $perf_full || return 0
+  test -n "$1" && test -n "$2" || return 0
+  if awk -v d=$1 -v b=$2 -v f=$PERF_TIME_FACTOR \
+       'BEGIN { exit ! (d > f * b + 1) }'; then
+    echo "diff took $1 s, more than $PERF_TIME_FACTOR times $2 s" >&2
+    fail=1
+  fi
+}